@@ -23,6 +23,7 @@
 #include "packet.h"
 #include "crc.h"
 #include "comm_usb.h"
+#include "ringbuf.h"
 
 // CC2520
 #include "hal_cc2520.h"
@@ -39,14 +40,18 @@
 #define MAX_PL_LEN			100
 #define RX_BUFFER_SIZE		PACKET_MAX_PL_LEN
 
+// Private types
+typedef struct {
+	uint8_t len;
+	uint8_t data[TX_BUFFER_LENGTH];
+} tx_slot_t;
+
 // Private variables
 static basicRfCfg_t basicRfConfig;
 static THD_WORKING_AREA(rx_thread_wa, 2048);
 static THD_WORKING_AREA(tx_thread_wa, 512);
-static uint8_t tx_buffer[TX_BUFFER_SLOTS][TX_BUFFER_LENGTH];
-static uint8_t tx_slot_len[TX_BUFFER_SLOTS];
-static int tx_slot_read;
-static int tx_slot_write;
+static tx_slot_t tx_slots[TX_BUFFER_SLOTS];
+static ringbuf_t tx_rb;
 static thread_t *tx_tp;
 static virtual_timer_t vt;
 static uint8_t rx_buffer[RX_BUFFER_SIZE];
@@ -68,8 +73,7 @@ static void wakeup_tx(void *p);
 #include "led.h"
 
 void comm_cc2520_init(void) {
-	tx_slot_read = 0;
-	tx_slot_write = 0;
+	ringbuf_init(&tx_rb, tx_slots, sizeof(tx_slot_t), TX_BUFFER_SLOTS);
 
 	// rf
 	halAssyInit();
@@ -164,14 +168,16 @@ void comm_cc2520_send_buffer(uint8_t *data, unsigned int len) {
  * before blocking the RF channel by sending the response.
  */
 void comm_cc2520_send_packet(uint8_t *data, uint8_t len) {
-	memcpy(tx_buffer[tx_slot_write], data, len);
-	tx_slot_len[tx_slot_write] = len;
-
-	tx_slot_write++;
-	if (tx_slot_write >= TX_BUFFER_SLOTS) {
-		tx_slot_write = 0;
+	// Drop the packet if the fifo is full
+	tx_slot_t *slot = ringbuf_write_slot(&tx_rb);
+	if (!slot) {
+		return;
 	}
 
+	memcpy(slot->data, data, len);
+	slot->len = len;
+	ringbuf_commit(&tx_rb);
+
 	chSysLock();
 	if (!chVTIsArmedI(&vt)) {
 		chVTSetI(&vt, US2ST(TX_DELAY_US), wakeup_tx, NULL);
@@ -255,14 +261,11 @@ static THD_FUNCTION(tx_thread, arg) {
 	for(;;) {
 		chEvtWaitAny((eventmask_t) 1);
 
-		while(tx_slot_read != tx_slot_write) {
-			basicRfSendPacket(CC2520_DEST_ADDRESS, tx_buffer[tx_slot_read], tx_slot_len[tx_slot_read]);
+		tx_slot_t *slot;
+		while ((slot = ringbuf_read_slot(&tx_rb)) != 0) {
+			basicRfSendPacket(CC2520_DEST_ADDRESS, slot->data, slot->len);
 			led_toggle(LED_GREEN);
-
-			tx_slot_read++;
-			if (tx_slot_read >= TX_BUFFER_SLOTS) {
-				tx_slot_read = 0;
-			}
+			ringbuf_release(&tx_rb);
 		}
 	}
 }
@@ -0,0 +1,311 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINGBUF_H_
+#define RINGBUF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Single producer single consumer ring buffer of fixed-size slots. Either
+ * side can be an ISR. The producer only writes write_pos, high_water and
+ * overflows, and the consumer only writes read_pos, so no locking is needed.
+ * One slot is always left empty to tell a full buffer from an empty one.
+ *
+ * Use a slot size of 1 for byte queues. For frames, either push and pop
+ * whole slots or fill them in place with ringbuf_write_slot and
+ * ringbuf_commit.
+ */
+typedef struct {
+	uint8_t *data;
+	unsigned int slot_size;
+	unsigned int slots;
+	unsigned int read_pos;
+	unsigned int write_pos;
+	unsigned int high_water;
+	unsigned int overflows;
+} ringbuf_t;
+
+// Static initializer, for buffers that an ISR can use before any init function runs
+#define RINGBUF_INIT(data, slot_size, slots) \
+	{(uint8_t*)(data), (slot_size), (slots), 0, 0, 0, 0}
+
+// The index of the other side is loaded with acquire and the own index is
+// stored with release, so that slot contents are visible before the index.
+#define RINGBUF_LOAD(x)				__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RINGBUF_STORE(x, val)		__atomic_store_n(&(x), (val), __ATOMIC_RELEASE)
+
+/**
+ * Initialize a ring buffer. Must not be called while the buffer is in use.
+ *
+ * @param rb
+ * The ring buffer.
+ *
+ * @param data
+ * Storage for slots * slot_size bytes.
+ *
+ * @param slot_size
+ * The size of one slot in bytes.
+ *
+ * @param slots
+ * The number of slots. slots - 1 of them can be used.
+ */
+static inline void ringbuf_init(ringbuf_t *rb, void *data,
+		unsigned int slot_size, unsigned int slots) {
+	rb->data = (uint8_t*)data;
+	rb->slot_size = slot_size;
+	rb->slots = slots;
+	rb->read_pos = 0;
+	rb->write_pos = 0;
+	rb->high_water = 0;
+	rb->overflows = 0;
+}
+
+/**
+ * Consumer: drop all content.
+ */
+static inline void ringbuf_flush(ringbuf_t *rb) {
+	RINGBUF_STORE(rb->read_pos, RINGBUF_LOAD(rb->write_pos));
+}
+
+/**
+ * Get the number of used slots. Can be called from both sides.
+ */
+static inline unsigned int ringbuf_level(ringbuf_t *rb) {
+	const unsigned int write = RINGBUF_LOAD(rb->write_pos);
+	const unsigned int read = RINGBUF_LOAD(rb->read_pos);
+	return (write + rb->slots - read) % rb->slots;
+}
+
+/**
+ * Get the number of free slots. Can be called from both sides.
+ */
+static inline unsigned int ringbuf_space(ringbuf_t *rb) {
+	return rb->slots - 1 - ringbuf_level(rb);
+}
+
+static inline bool ringbuf_is_empty(ringbuf_t *rb) {
+	return RINGBUF_LOAD(rb->read_pos) == RINGBUF_LOAD(rb->write_pos);
+}
+
+static inline bool ringbuf_is_full(ringbuf_t *rb) {
+	return ringbuf_space(rb) == 0;
+}
+
+/**
+ * Get the highest number of used slots seen after a push.
+ */
+static inline unsigned int ringbuf_high_water(ringbuf_t *rb) {
+	return rb->high_water;
+}
+
+/**
+ * Get the number of slots that were dropped because the buffer was full.
+ */
+static inline unsigned int ringbuf_overflows(ringbuf_t *rb) {
+	return rb->overflows;
+}
+
+/**
+ * Clear the high-water mark and the overflow count. The producer writes
+ * them, so it must not run at the same time. Call this in a system lock when
+ * the producer is an ISR or a thread.
+ */
+static inline void ringbuf_reset_stats(ringbuf_t *rb) {
+	rb->high_water = ringbuf_level(rb);
+	rb->overflows = 0;
+}
+
+static inline void ringbuf_update_high_water(ringbuf_t *rb) {
+	const unsigned int level = ringbuf_level(rb);
+	if (level > rb->high_water) {
+		rb->high_water = level;
+	}
+}
+
+/**
+ * Producer: get the next free slot to fill in place.
+ *
+ * @return
+ * Pointer to the slot, or NULL if the buffer is full. In that case an
+ * overflow is counted.
+ */
+static inline void *ringbuf_write_slot(ringbuf_t *rb) {
+	const unsigned int write = rb->write_pos;
+	unsigned int next = write + 1;
+	if (next >= rb->slots) {
+		next = 0;
+	}
+
+	if (next == RINGBUF_LOAD(rb->read_pos)) {
+		rb->overflows++;
+		return 0;
+	}
+
+	return rb->data + write * rb->slot_size;
+}
+
+/**
+ * Producer: publish the slot returned by ringbuf_write_slot.
+ */
+static inline void ringbuf_commit(ringbuf_t *rb) {
+	unsigned int next = rb->write_pos + 1;
+	if (next >= rb->slots) {
+		next = 0;
+	}
+
+	RINGBUF_STORE(rb->write_pos, next);
+	ringbuf_update_high_water(rb);
+}
+
+/**
+ * Producer: copy slots into the buffer.
+ *
+ * @param items
+ * count * slot_size bytes to copy.
+ *
+ * @param count
+ * The number of slots to push.
+ *
+ * @return
+ * The number of slots pushed. The rest are dropped and counted as overflows.
+ */
+static inline unsigned int ringbuf_push(ringbuf_t *rb, const void *items, unsigned int count) {
+	const unsigned int write = rb->write_pos;
+	const unsigned int read = RINGBUF_LOAD(rb->read_pos);
+	const unsigned int space = (read + rb->slots - write - 1) % rb->slots;
+
+	unsigned int n = count;
+	if (n > space) {
+		rb->overflows += n - space;
+		n = space;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	unsigned int first = rb->slots - write;
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(rb->data + write * rb->slot_size, items, first * rb->slot_size);
+	memcpy(rb->data, (const uint8_t*)items + first * rb->slot_size,
+			(n - first) * rb->slot_size);
+
+	unsigned int next = write + n;
+	if (next >= rb->slots) {
+		next -= rb->slots;
+	}
+
+	RINGBUF_STORE(rb->write_pos, next);
+	ringbuf_update_high_water(rb);
+
+	return n;
+}
+
+/**
+ * Consumer: get the oldest slot to read in place.
+ *
+ * @return
+ * Pointer to the slot, or NULL if the buffer is empty.
+ */
+static inline void *ringbuf_read_slot(ringbuf_t *rb) {
+	const unsigned int read = rb->read_pos;
+
+	if (read == RINGBUF_LOAD(rb->write_pos)) {
+		return 0;
+	}
+
+	return rb->data + read * rb->slot_size;
+}
+
+/**
+ * Consumer: drop the slot returned by ringbuf_read_slot.
+ */
+static inline void ringbuf_release(ringbuf_t *rb) {
+	unsigned int next = rb->read_pos + 1;
+	if (next >= rb->slots) {
+		next = 0;
+	}
+
+	RINGBUF_STORE(rb->read_pos, next);
+}
+
+/**
+ * Consumer: copy the oldest slots without removing them.
+ *
+ * @param items
+ * Buffer for count * slot_size bytes.
+ *
+ * @param count
+ * The maximum number of slots to copy.
+ *
+ * @return
+ * The number of slots copied.
+ */
+static inline unsigned int ringbuf_peek(ringbuf_t *rb, void *items, unsigned int count) {
+	const unsigned int read = rb->read_pos;
+	const unsigned int write = RINGBUF_LOAD(rb->write_pos);
+	const unsigned int level = (write + rb->slots - read) % rb->slots;
+
+	unsigned int n = count;
+	if (n > level) {
+		n = level;
+	}
+
+	unsigned int first = rb->slots - read;
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(items, rb->data + read * rb->slot_size, first * rb->slot_size);
+	memcpy((uint8_t*)items + first * rb->slot_size, rb->data,
+			(n - first) * rb->slot_size);
+
+	return n;
+}
+
+/**
+ * Consumer: copy and remove the oldest slots.
+ *
+ * @param items
+ * Buffer for count * slot_size bytes.
+ *
+ * @param count
+ * The maximum number of slots to pop.
+ *
+ * @return
+ * The number of slots popped.
+ */
+static inline unsigned int ringbuf_pop(ringbuf_t *rb, void *items, unsigned int count) {
+	const unsigned int n = ringbuf_peek(rb, items, count);
+
+	unsigned int next = rb->read_pos + n;
+	if (next >= rb->slots) {
+		next -= rb->slots;
+	}
+
+	RINGBUF_STORE(rb->read_pos, next);
+
+	return n;
+}
+
+#endif /* RINGBUF_H_ */
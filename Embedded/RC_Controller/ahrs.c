@@ -384,7 +384,7 @@ void ahrs_update_madgwick(float *gyroXYZ, float *accelXYZ, float *magXYZ, float
 		// Reference direction of Earth's magnetic field
 		hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
 		hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
-		_2bx = sqrt(hx * hx + hy * hy);
+		_2bx = sqrtf(hx * hx + hy * hy);
 		_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
 		_4bx = 2.0f * _2bx;
 		_4bz = 2.0f * _2bz;
@@ -524,7 +524,7 @@ float ahrs_get_roll(ATTITUDE_INFO *att) {
 	const float q2 = att->q2;
 	const float q3 = att->q3;
 
-	return -atan2f(q0 * q1 + q2 * q3, 0.5 - (q1 * q1 + q2 * q2));
+	return -UTILS_ATAN2(q0 * q1 + q2 * q3, 0.5 - (q1 * q1 + q2 * q2));
 }
 
 float ahrs_get_pitch(ATTITUDE_INFO *att) {
@@ -533,7 +533,7 @@ float ahrs_get_pitch(ATTITUDE_INFO *att) {
 	const float q2 = att->q2;
 	const float q3 = att->q3;
 
-	return asinf(-2.0 * (q1 * q3 - q0 * q2));
+	return UTILS_ASIN(-2.0 * (q1 * q3 - q0 * q2));
 }
 
 float ahrs_get_yaw(ATTITUDE_INFO *att) {
@@ -542,7 +542,7 @@ float ahrs_get_yaw(ATTITUDE_INFO *att) {
 	const float q2 = att->q2;
 	const float q3 = att->q3;
 
-	return -atan2f(q0 * q3 + q1 * q2, 0.5 - (q2 * q2 + q3 * q3));
+	return -UTILS_ATAN2(q0 * q3 + q1 * q2, 0.5 - (q2 * q2 + q3 * q3));
 }
 
 void ahrs_get_roll_pitch_yaw(float *rpy, ATTITUDE_INFO *att) {
@@ -552,26 +552,13 @@ void ahrs_get_roll_pitch_yaw(float *rpy, ATTITUDE_INFO *att) {
 	const float q2 = att->q2;
 	const float q3 = att->q3;
 
-	rpy[0] = -atan2f(q0 * q1 + q2 * q3, 0.5 - (q1 * q1 + q2 * q2));
-	rpy[1] = asinf(-2.0 * (q1 * q3 - q0 * q2));
-	rpy[2] = -atan2f(q0 * q3 + q1 * q2, 0.5 - (q2 * q2 + q3 * q3));
+	rpy[0] = -UTILS_ATAN2(q0 * q1 + q2 * q3, 0.5 - (q1 * q1 + q2 * q2));
+	rpy[1] = UTILS_ASIN(-2.0 * (q1 * q3 - q0 * q2));
+	rpy[2] = -UTILS_ATAN2(q0 * q3 + q1 * q2, 0.5 - (q2 * q2 + q3 * q3));
 }
 
 static float invSqrt(float x) {
-	// Fast inverse square-root
-	// See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
-	//	union {
-	//		float as_float;
-	//		long as_int;
-	//	} un;
-	//
-	//	float xhalf = 0.5f*x;
-	//	un.as_float = x;
-	//	un.as_int = 0x5f3759df - (un.as_int >> 1);
-	//	un.as_float = un.as_float * (1.5f - xhalf * un.as_float * un.as_float);
-	//	return un.as_float;
-
-	// Use normal inverse square root.
+	// The fast inverse square root is only used with FAST_MATH, see
 	// http://diydrones.com/forum/topics/madgwick-imu-ahrs-and-fast-inverse-square-root
-	return 1.0 / sqrtf(x);
+	return UTILS_INV_SQRT(x);
 }
@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "pos.h"
 #include "bldc_interface.h"
+#include "geofence.h"
 
 // Defines
 #define AP_HZ						100 // Hz
@@ -216,6 +217,10 @@ static THD_FUNCTION(ap_thread, arg) {
 
 	chRegSetThreadName("Autopilot");
 
+#if MAIN_MODE == MAIN_MODE_MULTIROTOR
+	bool fence_hold = false;
+#endif
+
 	for(;;) {
 		chThdSleep(CH_CFG_ST_FREQUENCY / AP_HZ);
 
@@ -225,6 +230,9 @@ static THD_FUNCTION(ap_thread, arg) {
 
 		if (!m_is_active) {
 			m_rad_now = -1.0;
+#if MAIN_MODE == MAIN_MODE_MULTIROTOR
+			fence_hold = false;
+#endif
 			chMtxUnlock(&m_ap_lock);
 			continue;
 		}
@@ -241,7 +249,10 @@ static THD_FUNCTION(ap_thread, arg) {
 		// Time of today according to our clock
 		int ms_today = pos_get_ms_today();
 
-		if (len >= 2) {
+		// Stop at the geofence
+		bool fence_ok = geofence_check_pos();
+
+		if (len >= 2 && fence_ok) {
 			POS_STATE p;
 			pos_get_pos(&p);
 
@@ -502,21 +513,61 @@ static THD_FUNCTION(ap_thread, arg) {
 
 				utils_truncate_number_abs(&speed, main_config.ap_max_speed);
 
+#if MAIN_MODE == MAIN_MODE_MULTIROTOR
+				// mr_control follows m_rp_now and uses the speed as its
+				// velocity limit, so there is nothing to actuate here.
+				(void)servo_pos;
+				m_rp_now.speed = speed;
+#else
 				servo_simple_set_pos_ramp(servo_pos);
 				autopilot_set_motor_speed(speed);
+#endif
 			}
 		} else {
 			route_end = true;
 		}
 
 		if (route_end) {
+#if MAIN_MODE == MAIN_MODE_MULTIROTOR
+			// Fly to the last point of the route and hold the position there. An
+			// empty route cannot be followed, so mr_control falls back to
+			// position hold at the current position. Outside the geofence the
+			// position where the fence was crossed is held instead.
+			if (!fence_ok) {
+				if (!fence_hold) {
+					POS_STATE p;
+					pos_get_pos(&p);
+					m_rp_now.px = p.px;
+					m_rp_now.py = p.py;
+					m_rp_now.speed = main_config.ap_max_speed;
+					fence_hold = true;
+				}
+			} else if (len > 0) {
+				int last_point_ind = m_point_last - 1;
+				if (last_point_ind < 0) {
+					last_point_ind += AP_ROUTE_SIZE;
+				}
+
+				m_rp_now = m_route[last_point_ind];
+				m_rp_now.speed = main_config.ap_max_speed;
+			} else {
+				m_is_active = false;
+			}
+#else
 			servo_simple_set_pos_ramp(main_config.car.steering_center);
 			if (!main_config.car.disable_motor) {
 				bldc_interface_set_current_brake(10.0);
 			}
+#endif
 			m_rad_now = -1.0;
 		}
 
+#if MAIN_MODE == MAIN_MODE_MULTIROTOR
+		if (fence_ok) {
+			fence_hold = false;
+		}
+#endif
+
 		chMtxUnlock(&m_ap_lock);
 	}
 }
@@ -532,9 +583,11 @@ static void steering_angle_to_point(
 
 	const float D = utils_point_distance(goal_x, goal_y, current_x, current_y);
 	*distance = D;
-	const float gamma = current_angle - atan2f((goal_y-current_y), (goal_x-current_x));
-	const float dx = D * cosf(gamma);
-	const float dy = D * sinf(gamma);
+	const float gamma = current_angle - UTILS_ATAN2((goal_y-current_y), (goal_x-current_x));
+	float sin_gamma, cos_gamma;
+	UTILS_SINCOS(gamma, &sin_gamma, &cos_gamma);
+	const float dx = D * cos_gamma;
+	const float dy = D * sin_gamma;
 
 	if (dy == 0.0) {
 		*steering_angle = 0.0;
@@ -26,6 +26,8 @@
 #include "packet.h"
 #include "bldc_interface.h"
 #include "commands.h"
+#include "stats.h"
+#include "ringbuf.h"
 
 // Settings
 #define CANDx						CAND1
@@ -33,6 +35,12 @@
 #define RX_BUFFER_SIZE				PACKET_MAX_PL_LEN
 #define CAN_STATUS_MSGS_TO_STORE	10
 
+// Private types
+typedef struct {
+	CANRxFrame frame;
+	systime_t rx_time;
+} can_rx_slot_t;
+
 // Threads
 static THD_WORKING_AREA(cancom_read_thread_wa, 512);
 static THD_WORKING_AREA(cancom_process_thread_wa, 4096);
@@ -44,9 +52,8 @@ static can_status_msg stat_msgs[CAN_STATUS_MSGS_TO_STORE];
 static mutex_t can_mtx;
 static uint8_t rx_buffer[RX_BUFFER_SIZE];
 static unsigned int rx_buffer_last_id;
-static CANRxFrame rx_frames[RX_FRAMES_SIZE];
-static int rx_frame_read;
-static int rx_frame_write;
+static can_rx_slot_t rx_frames[RX_FRAMES_SIZE];
+static ringbuf_t rx_frame_rb;
 static thread_t *process_tp;
 
 /*
@@ -63,17 +70,20 @@ static const CANConfig cancfg = {
 // Private functions
 static void send_packet_wrapper(unsigned char *data, unsigned int len);
 static void printf_wrapper(char *str);
+static can_status_msg *status_msg_get(int id);
+static void process_frame(can_rx_slot_t *slot);
 
 // Function pointers
 static void(*m_range_func)(uint8_t id, uint8_t dest, float range) = 0;
+static void(*m_status_func)(can_status_msg *msg, bool tacho_updated) = 0;
 
 void comm_can_init(void) {
 	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
 		stat_msgs[i].id = -1;
 	}
 
-	rx_frame_read = 0;
-	rx_frame_write = 0;
+	ringbuf_init(&rx_frame_rb, rx_frames, sizeof(can_rx_slot_t), RX_FRAMES_SIZE);
+	stats_register_queue(STATS_QUEUE_CAN_RX, &rx_frame_rb);
 
 	chMtxObjectInit(&can_mtx);
 
@@ -96,7 +106,7 @@ static THD_FUNCTION(cancom_read_thread, arg) {
 	chRegSetThreadName("CAN read");
 
 	event_listener_t el;
-	CANRxFrame rxmsg;
+	can_rx_slot_t slot;
 
 	chEvtRegister(&CANDx.rxfull_event, &el, 0);
 
@@ -105,17 +115,17 @@ static THD_FUNCTION(cancom_read_thread, arg) {
 			continue;
 		}
 
-		msg_t result = canReceive(&CANDx, CAN_ANY_MAILBOX, &rxmsg, TIME_IMMEDIATE);
+		msg_t result = canReceive(&CANDx, CAN_ANY_MAILBOX, &slot.frame, TIME_IMMEDIATE);
 
 		while (result == MSG_OK) {
-			rx_frames[rx_frame_write++] = rxmsg;
-			if (rx_frame_write == RX_FRAMES_SIZE) {
-				rx_frame_write = 0;
-			}
+			// Timestamp here, so that the time does not include the queue
+			// delay. The odometry uses it.
+			slot.rx_time = chVTGetSystemTimeX();
+			ringbuf_push(&rx_frame_rb, &slot, 1);
 
 			chEvtSignal(process_tp, (eventmask_t) 1);
 
-			result = canReceive(&CANDx, CAN_ANY_MAILBOX, &rxmsg, TIME_IMMEDIATE);
+			result = canReceive(&CANDx, CAN_ANY_MAILBOX, &slot.frame, TIME_IMMEDIATE);
 		}
 	}
 
@@ -128,6 +138,18 @@ static THD_FUNCTION(cancom_process_thread, arg) {
 	chRegSetThreadName("CAN process");
 	process_tp = chThdGetSelfX();
 
+	for(;;) {
+		chEvtWaitAny((eventmask_t) 1);
+
+		can_rx_slot_t slot;
+
+		while (ringbuf_pop(&rx_frame_rb, &slot, 1) > 0) {
+			process_frame(&slot);
+		}
+	}
+}
+
+static void process_frame(can_rx_slot_t *slot) {
 	int32_t ind = 0;
 	unsigned int rxbuf_len;
 	unsigned int rxbuf_ind;
@@ -135,103 +157,102 @@ static THD_FUNCTION(cancom_process_thread, arg) {
 	uint8_t crc_high;
 	bool commands_send;
 
-	for(;;) {
-		chEvtWaitAny((eventmask_t) 1);
+	CANRxFrame rxmsg = slot->frame;
 
-		while (rx_frame_read != rx_frame_write) {
-			CANRxFrame rxmsg = rx_frames[rx_frame_read++];
-
-			if (rxmsg.IDE == CAN_IDE_EXT) {
-				// Process extended IDs (VESC Communication)
-
-				uint8_t id = rxmsg.EID & 0xFF;
-				CAN_PACKET_ID cmd = rxmsg.EID >> 8;
-				can_status_msg *stat_tmp;
-
-				switch (cmd) {
-				case CAN_PACKET_FILL_RX_BUFFER:
-					memcpy(rx_buffer + rxmsg.data8[0], rxmsg.data8 + 1, rxmsg.DLC - 1);
-					break;
-
-				case CAN_PACKET_FILL_RX_BUFFER_LONG:
-					rxbuf_ind = (unsigned int)rxmsg.data8[0] << 8;
-					rxbuf_ind |= rxmsg.data8[1];
-					if (rxbuf_ind < RX_BUFFER_SIZE) {
-						memcpy(rx_buffer + rxbuf_ind, rxmsg.data8 + 2, rxmsg.DLC - 2);
-					}
-					break;
-
-				case CAN_PACKET_PROCESS_RX_BUFFER:
-					ind = 0;
-					rx_buffer_last_id = rxmsg.data8[ind++];
-					commands_send = rxmsg.data8[ind++];
-					rxbuf_len = (unsigned int)rxmsg.data8[ind++] << 8;
-					rxbuf_len |= (unsigned int)rxmsg.data8[ind++];
-
-					if (rxbuf_len > RX_BUFFER_SIZE) {
-						break;
-					}
-
-					crc_high = rxmsg.data8[ind++];
-					crc_low = rxmsg.data8[ind++];
-
-					if (crc16(rx_buffer, rxbuf_len)
-							== ((unsigned short) crc_high << 8
-									| (unsigned short) crc_low)) {
-
-						(void)commands_send;
-						bldc_interface_process_packet(rx_buffer, rxbuf_len);
-					}
-					break;
-
-				case CAN_PACKET_PROCESS_SHORT_BUFFER:
-					ind = 0;
-					rx_buffer_last_id = rxmsg.data8[ind++];
-					commands_send = rxmsg.data8[ind++];
-					(void)commands_send;
-					bldc_interface_process_packet(rxmsg.data8 + ind, rxmsg.DLC - ind);
-					break;
-
-				case CAN_PACKET_STATUS:
-					for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
-						stat_tmp = &stat_msgs[i];
-						if (stat_tmp->id == id || stat_tmp->id == -1) {
-							ind = 0;
-							stat_tmp->id = id;
-							stat_tmp->rx_time = chVTGetSystemTime();
-							stat_tmp->rpm = (float)buffer_get_int32(rxmsg.data8, &ind);
-							stat_tmp->current = (float)buffer_get_int16(rxmsg.data8, &ind) / 10.0;
-							stat_tmp->duty = (float)buffer_get_int16(rxmsg.data8, &ind) / 1000.0;
-							break;
-						}
-					}
-					break;
-
-				default:
-					break;
-				}
-			} else if (rxmsg.IDE == CAN_IDE_STD) {
-				// Process standard IDs
-				if ((rxmsg.SID & 0x700) == CAN_MASK_DW) {
-					switch (rxmsg.data8[0]) {
-					case CMD_DW_RANGE: {
-						int32_t ind = 1;
-						uint8_t id = rxmsg.SID & 0xFF;
-						uint8_t dest = rxmsg.data8[ind++];
-						float range = (float)buffer_get_int32(rxmsg.data8, &ind) / 1000.0;
-
-						if (m_range_func) {
-							m_range_func(id, dest, range);
-						}
-					} break;
-					default:
-						break;
-					}
-				}
+	if (rxmsg.IDE == CAN_IDE_EXT) {
+		// Process extended IDs (VESC Communication)
+
+		uint8_t id = rxmsg.EID & 0xFF;
+		CAN_PACKET_ID cmd = rxmsg.EID >> 8;
+		can_status_msg *stat_tmp;
+
+		switch (cmd) {
+		case CAN_PACKET_FILL_RX_BUFFER:
+			memcpy(rx_buffer + rxmsg.data8[0], rxmsg.data8 + 1, rxmsg.DLC - 1);
+			break;
+
+		case CAN_PACKET_FILL_RX_BUFFER_LONG:
+			rxbuf_ind = (unsigned int)rxmsg.data8[0] << 8;
+			rxbuf_ind |= rxmsg.data8[1];
+			if (rxbuf_ind < RX_BUFFER_SIZE) {
+				memcpy(rx_buffer + rxbuf_ind, rxmsg.data8 + 2, rxmsg.DLC - 2);
+			}
+			break;
+
+		case CAN_PACKET_PROCESS_RX_BUFFER:
+			ind = 0;
+			rx_buffer_last_id = rxmsg.data8[ind++];
+			commands_send = rxmsg.data8[ind++];
+			rxbuf_len = (unsigned int)rxmsg.data8[ind++] << 8;
+			rxbuf_len |= (unsigned int)rxmsg.data8[ind++];
+
+			if (rxbuf_len > RX_BUFFER_SIZE) {
+				break;
+			}
+
+			crc_high = rxmsg.data8[ind++];
+			crc_low = rxmsg.data8[ind++];
+
+			if (crc16(rx_buffer, rxbuf_len)
+					== ((unsigned short) crc_high << 8
+							| (unsigned short) crc_low)) {
+
+				(void)commands_send;
+				bldc_interface_process_packet(rx_buffer, rxbuf_len);
+			}
+			break;
+
+		case CAN_PACKET_PROCESS_SHORT_BUFFER:
+			ind = 0;
+			rx_buffer_last_id = rxmsg.data8[ind++];
+			commands_send = rxmsg.data8[ind++];
+			(void)commands_send;
+			bldc_interface_process_packet(rxmsg.data8 + ind, rxmsg.DLC - ind);
+			break;
+
+		case CAN_PACKET_STATUS:
+		case CAN_PACKET_STATUS_5:
+			stat_tmp = status_msg_get(id);
+			if (!stat_tmp) {
+				break;
 			}
 
-			if (rx_frame_read == RX_FRAMES_SIZE) {
-				rx_frame_read = 0;
+			ind = 0;
+			if (cmd == CAN_PACKET_STATUS) {
+				stat_tmp->rx_time = slot->rx_time;
+				stat_tmp->rpm = (float)buffer_get_int32(rxmsg.data8, &ind);
+				stat_tmp->current = (float)buffer_get_int16(rxmsg.data8, &ind) / 10.0;
+				stat_tmp->duty = (float)buffer_get_int16(rxmsg.data8, &ind) / 1000.0;
+			} else {
+				stat_tmp->tacho_rx_time = slot->rx_time;
+				stat_tmp->tachometer = buffer_get_int32(rxmsg.data8, &ind);
+				stat_tmp->v_in = (float)buffer_get_int16(rxmsg.data8, &ind) / 10.0;
+			}
+
+			if (m_status_func && (VESC_ID == ID_ALL || id == VESC_ID)) {
+				m_status_func(stat_tmp, cmd == CAN_PACKET_STATUS_5);
+			}
+			break;
+
+		default:
+			break;
+		}
+	} else if (rxmsg.IDE == CAN_IDE_STD) {
+		// Process standard IDs
+		if ((rxmsg.SID & 0x700) == CAN_MASK_DW) {
+			switch (rxmsg.data8[0]) {
+			case CMD_DW_RANGE: {
+				int32_t ind = 1;
+				uint8_t id = rxmsg.SID & 0xFF;
+				uint8_t dest = rxmsg.data8[ind++];
+				float range = (float)buffer_get_int32(rxmsg.data8, &ind) / 1000.0;
+
+				if (m_range_func) {
+					m_range_func(id, dest, range);
+				}
+			} break;
+			default:
+				break;
 			}
 		}
 	}
@@ -410,6 +431,36 @@ can_status_msg *comm_can_get_status_msg_id(int id) {
 	return 0;
 }
 
+/**
+ * Set a function to be called when a status message from the motor
+ * controller is received. It is called from the CAN thread.
+ *
+ * @param func
+ * The function. tacho_updated is true when the message was a
+ * CAN_PACKET_STATUS_5 with the tachometer, and false for CAN_PACKET_STATUS
+ * with rpm, current and duty cycle.
+ */
+void comm_can_set_status_func(void(*func)(can_status_msg *msg, bool tacho_updated)) {
+	m_status_func = func;
+}
+
+static can_status_msg *status_msg_get(int id) {
+	for (int i = 0;i < CAN_STATUS_MSGS_TO_STORE;i++) {
+		can_status_msg *stat = &stat_msgs[i];
+		if (stat->id == id) {
+			return stat;
+		}
+
+		if (stat->id == -1) {
+			memset(stat, 0, sizeof(can_status_msg));
+			stat->id = id;
+			return stat;
+		}
+	}
+
+	return 0;
+}
+
 static void send_packet_wrapper(unsigned char *data, unsigned int len) {
 	comm_can_send_buffer(VESC_ID, data, len, false);
 }
@@ -27,5 +27,6 @@ void comm_can_transmit_sid(uint32_t id, uint8_t *data, uint8_t len);
 void comm_can_send_buffer(uint8_t controller_id, uint8_t *data, unsigned int len, bool send);
 void comm_can_dw_range(uint8_t id, uint8_t dest, int samples);
 void comm_can_set_range_func(void(*func)(uint8_t id, uint8_t dest, float range));
+void comm_can_set_status_func(void(*func)(can_status_msg *msg, bool tacho_updated));
 
 #endif /* COMM_CAN_H_ */
@@ -24,6 +24,8 @@
 #include "packet.h"
 #include "led.h"
 #include "comm_usb.h"
+#include "stats.h"
+#include "ringbuf.h"
 
 // Settings
 #define DEBUG_MODE			0
@@ -35,12 +37,16 @@
 static THD_WORKING_AREA(tx_thread_wa, 1024);
 static THD_FUNCTION(tx_thread, arg);
 
+// Private types
+typedef struct {
+	int len;
+	uint8_t data[TX_BUFFER_LENGTH];
+} tx_slot_t;
+
 // Private variables
 static bool init_done = false;
-static uint8_t tx_buffer[TX_BUFFER_SLOTS][TX_BUFFER_LENGTH];
-static volatile int tx_slot_len[TX_BUFFER_SLOTS];
-static volatile int tx_slot_read;
-static volatile int tx_slot_write;
+static tx_slot_t tx_slots[TX_BUFFER_SLOTS];
+static ringbuf_t tx_rb;
 static thread_t *tx_tp;
 static virtual_timer_t vt;
 
@@ -54,8 +60,8 @@ void comm_cc1120_init(void) {
 	}
 
 	init_done = true;
-	tx_slot_read = 0;
-	tx_slot_write = 0;
+	ringbuf_init(&tx_rb, tx_slots, sizeof(tx_slot_t), TX_BUFFER_SLOTS);
+	stats_register_queue(STATS_QUEUE_CC1120_TX, &tx_rb);
 
 	cc1120_set_rx_callback(rx_func);
 
@@ -76,19 +82,21 @@ void comm_cc1120_send_buffer(uint8_t *data, unsigned int len) {
 
 	// Wait while fifo is full
 	int to = 1000;
-	while (((tx_slot_write + 1) % TX_BUFFER_SLOTS) == tx_slot_read && to) {
+	while (ringbuf_is_full(&tx_rb) && to) {
 		chThdSleepMilliseconds(1);
 		to--;
 	}
 
-	memcpy(tx_buffer[tx_slot_write], data, len);
-	tx_slot_len[tx_slot_write] = len;
-
-	tx_slot_write++;
-	if (tx_slot_write >= TX_BUFFER_SLOTS) {
-		tx_slot_write = 0;
+	// Drop the packet if the fifo still is full
+	tx_slot_t *slot = ringbuf_write_slot(&tx_rb);
+	if (!slot) {
+		return;
 	}
 
+	memcpy(slot->data, data, len);
+	slot->len = len;
+	ringbuf_commit(&tx_rb);
+
 	chSysLock();
 	if (!chVTIsArmedI(&vt)) {
 		chVTSetI(&vt, US2ST(TX_DELAY_US), wakeup_tx, NULL);
@@ -171,14 +179,11 @@ static THD_FUNCTION(tx_thread, arg) {
 	for(;;) {
 		chEvtWaitAny((eventmask_t) 1);
 
-		while(tx_slot_read != tx_slot_write) {
-			cc1120_transmit(tx_buffer[tx_slot_read], tx_slot_len[tx_slot_read]);
+		tx_slot_t *slot;
+		while ((slot = ringbuf_read_slot(&tx_rb)) != 0) {
+			cc1120_transmit(slot->data, slot->len);
 			led_toggle(LED_GREEN);
-
-			tx_slot_read++;
-			if (tx_slot_read >= TX_BUFFER_SLOTS) {
-				tx_slot_read = 0;
-			}
+			ringbuf_release(&tx_rb);
 		}
 	}
 #endif
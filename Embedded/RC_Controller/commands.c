@@ -36,6 +36,9 @@
 #include "comm_cc1120.h"
 #include "mr_control.h"
 #include "adconv.h"
+#include "stats.h"
+#include "imu_capture.h"
+#include "geofence.h"
 
 #include <math.h>
 #include <string.h>
@@ -43,7 +46,9 @@
 #include <stdio.h>
 
 // Defines
-#define FWD_TIME		20000
+#define FWD_TIME				20000
+#define POSE_STREAM_MAX_RATE	50 // Hz
+#define POSE_STREAM_TIMEOUT		3000 // The stream stops unless it is renewed within this time
 
 // Private variables
 static uint8_t m_send_buffer[PACKET_MAX_PL_LEN];
@@ -51,6 +56,17 @@ static void(*m_send_func)(unsigned char *data, unsigned int len) = 0;
 static virtual_timer_t vt;
 static mutex_t m_print_gps;
 static bool m_init_done = false;
+#if MAIN_MODE_IS_VEHICLE
+static volatile int m_pose_rate = 0;
+static volatile systime_t m_pose_req_time = 0;
+static void(* volatile m_pose_send_func)(unsigned char *data, unsigned int len) = 0;
+#endif
+
+// Threads
+#if MAIN_MODE_IS_VEHICLE
+static THD_WORKING_AREA(pose_stream_thread_wa, 1024);
+static THD_FUNCTION(pose_stream_thread, arg);
+#endif
 
 // Private functions
 static void stop_forward(void *p);
@@ -71,6 +87,11 @@ void commands_init(void) {
 	(void)stop_forward;
 #endif
 
+#if MAIN_MODE_IS_VEHICLE
+	chThdCreateStatic(pose_stream_thread_wa, sizeof(pose_stream_thread_wa),
+			NORMALPRIO, pose_stream_thread, NULL);
+#endif
+
 	m_init_done = true;
 }
 
@@ -121,6 +142,7 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 		for (unsigned int i = 0;i < len;i++) {
 			rtcm3_input_data(data[i], &rtcm_state);
 		}
+		stats_rtcm_bytes(len);
 		return;
 	}
 
@@ -136,6 +158,8 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 	len--;
 
 	if (id == main_id || id == ID_ALL) {
+		uint32_t stats_start = STATS_CYCLES_NOW();
+
 		switch (packet_id) {
 		// ==================== General commands ==================== //
 		case CMD_TERMINAL_CMD: {
@@ -146,6 +170,38 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			terminal_process_string((char*)data);
 		} break;
 
+		case CMD_TRACE: {
+			// Echo the trace with our receive and transmit timestamps appended.
+			uint32_t rx_time = UTILS_SYS_TIME_US();
+			commands_set_send_func(func);
+
+			if ((len + 12) > sizeof(m_send_buffer)) {
+				break;
+			}
+
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			memcpy(m_send_buffer + send_index, data, len);
+			send_index += len;
+			m_send_buffer[send_index++] = TRACE_HOP_FW_RX;
+			buffer_append_uint32(m_send_buffer, rx_time, &send_index);
+			m_send_buffer[send_index++] = TRACE_HOP_FW_TX;
+			buffer_append_uint32(m_send_buffer, UTILS_SYS_TIME_US(), &send_index);
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
+		case CMD_GET_STATS: {
+			commands_set_send_func(func);
+
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			send_index += stats_serialize(m_send_buffer + send_index,
+					sizeof(m_send_buffer) - send_index);
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
 		// ==================== Vehicle commands ==================== //
 #if MAIN_MODE_IS_VEHICLE
 		case CMD_SET_POS:
@@ -169,6 +225,19 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			}
 		} break;
 
+		case CMD_SET_POSE_STREAM: {
+			// Does not reset the timeout, the stream is not a sign that
+			// someone is in control of the vehicle.
+			if (len < 1) {
+				break;
+			}
+
+			int rate = data[0];
+			m_pose_send_func = func;
+			m_pose_req_time = chVTGetSystemTimeX();
+			m_pose_rate = rate > POSE_STREAM_MAX_RATE ? POSE_STREAM_MAX_RATE : rate;
+		} break;
+
 		case CMD_SET_ENU_REF: {
 			timeout_reset();
 			commands_set_send_func(func);
@@ -476,118 +545,14 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			timeout_reset();
 			commands_set_send_func(func);
 
-			int32_t ind = 0;
-			main_config.mag_use = data[ind++];
-			main_config.mag_comp = data[ind++];
-			main_config.yaw_mag_gain = buffer_get_float32_auto(data, &ind);
-
-			main_config.mag_cal_cx = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_cy = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_cz = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_xx = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_xy = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_xz = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_yx = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_yy = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_yz = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_zx = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_zy = buffer_get_float32_auto(data, &ind);
-			main_config.mag_cal_zz = buffer_get_float32_auto(data, &ind);
-
-			main_config.gps_ant_x = buffer_get_float32_auto(data, &ind);
-			main_config.gps_ant_y = buffer_get_float32_auto(data, &ind);
-			main_config.gps_comp = data[ind++];
-			main_config.gps_req_rtk = data[ind++];
-			main_config.gps_corr_gain_stat = buffer_get_float32_auto(data, &ind);
-			main_config.gps_corr_gain_dyn = buffer_get_float32_auto(data, &ind);
-			main_config.gps_corr_gain_yaw = buffer_get_float32_auto(data, &ind);
-			main_config.gps_send_nmea = data[ind++];
-			main_config.gps_use_ubx_info = data[ind++];
-			main_config.gps_ubx_max_acc = buffer_get_float32_auto(data, &ind);
-
-			main_config.ap_repeat_routes = data[ind++];
-			main_config.ap_base_rad = buffer_get_float32_auto(data, &ind);
-			main_config.ap_mode_time = data[ind++];
-			main_config.ap_max_speed = buffer_get_float32_auto(data, &ind);
-			main_config.ap_time_add_repeat_ms = buffer_get_int32(data, &ind);
-
-			main_config.log_en = data[ind++];
-			strcpy(main_config.log_name, (const char*)(data + ind));
-			ind += strlen(main_config.log_name) + 1;
+			MAIN_CONFIG main_cfg_tmp = main_config;
+			if (conf_general_decode_main_config(&main_cfg_tmp, data, len) < 0) {
+				break;
+			}
 
+			main_config = main_cfg_tmp;
 			log_set_enabled(main_config.log_en);
 			log_set_name(main_config.log_name);
-
-			// Car settings
-			main_config.car.yaw_use_odometry = data[ind++];
-			main_config.car.yaw_imu_gain = buffer_get_float32_auto(data, &ind);
-			main_config.car.disable_motor = data[ind++];
-
-			main_config.car.gear_ratio = buffer_get_float32_auto(data, &ind);
-			main_config.car.wheel_diam = buffer_get_float32_auto(data, &ind);
-			main_config.car.motor_poles = buffer_get_float32_auto(data, &ind);
-			main_config.car.steering_max_angle_rad = buffer_get_float32_auto(data, &ind);
-			main_config.car.steering_center = buffer_get_float32_auto(data, &ind);
-			main_config.car.steering_range = buffer_get_float32_auto(data, &ind);
-			main_config.car.steering_ramp_time = buffer_get_float32_auto(data, &ind);
-			main_config.car.axis_distance = buffer_get_float32_auto(data, &ind);
-
-			// Multirotor settings
-			main_config.mr.vel_decay_e = buffer_get_float32_auto(data, &ind);
-			main_config.mr.vel_decay_l = buffer_get_float32_auto(data, &ind);
-			main_config.mr.vel_max = buffer_get_float32_auto(data, &ind);
-			main_config.mr.map_min_x = buffer_get_float32_auto(data, &ind);
-			main_config.mr.map_max_x = buffer_get_float32_auto(data, &ind);
-			main_config.mr.map_min_y = buffer_get_float32_auto(data, &ind);
-			main_config.mr.map_max_y = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.vel_gain_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.vel_gain_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.vel_gain_d = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.tilt_gain_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.tilt_gain_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.tilt_gain_d = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.max_corr_error = buffer_get_float32_auto(data, &ind);
-			main_config.mr.max_tilt_error = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.ctrl_gain_roll_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_roll_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_roll_dp = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_roll_de = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.ctrl_gain_pitch_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_pitch_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_pitch_dp = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_pitch_de = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.ctrl_gain_yaw_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_yaw_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_yaw_dp = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_yaw_de = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.ctrl_gain_pos_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_pos_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_pos_d = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.ctrl_gain_alt_p = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_alt_i = buffer_get_float32_auto(data, &ind);
-			main_config.mr.ctrl_gain_alt_d = buffer_get_float32_auto(data, &ind);
-
-			main_config.mr.js_gain_tilt = buffer_get_float32_auto(data, &ind);
-			main_config.mr.js_gain_yaw = buffer_get_float32_auto(data, &ind);
-			main_config.mr.js_mode_rate = data[ind++];
-
-			main_config.mr.motor_fl_f = data[ind++];
-			main_config.mr.motor_bl_l = data[ind++];
-			main_config.mr.motor_fr_r = data[ind++];
-			main_config.mr.motor_br_b = data[ind++];
-			main_config.mr.motors_x = data[ind++];
-			main_config.mr.motors_cw = data[ind++];
-			main_config.mr.motor_pwm_min_us = buffer_get_uint16(data, &ind);
-			main_config.mr.motor_pwm_max_us = buffer_get_uint16(data, &ind);
-
 			conf_general_store_main_config(&main_config);
 
 			// Doing this while driving will get wrong as there is so much accelerometer noise then.
@@ -616,115 +581,94 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			int32_t send_index = 0;
 			m_send_buffer[send_index++] = main_id;
 			m_send_buffer[send_index++] = packet_id;
+			send_index += conf_general_encode_main_config(&main_cfg_tmp, 0, m_send_buffer + send_index);
+
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
+		case CMD_GET_MAIN_CONFIG_HASH: {
+			timeout_reset();
+			commands_set_send_func(func);
+
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			buffer_append_uint16(m_send_buffer, conf_general_main_config_hash(&main_config), &send_index);
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
+		case CMD_GET_MAIN_CONFIG_FIELDS: {
+			timeout_reset();
+			commands_set_send_func(func);
+
+			// The request is a header with the mask of the requested fields
+			if (len < 2 || data[0] != MAIN_CONFIG_SCHEMA_VERSION || len < (2 + (data[1] + 7) / 8)) {
+				break;
+			}
+
+			uint8_t mask[MAIN_CONFIG_MASK_BYTES];
+			memset(mask, 0, sizeof(mask));
+			for (int i = 0;i < MAIN_CONFIG_FIELD_NUM && i < data[1];i++) {
+				if (MAIN_CONFIG_MASK_GET(data + 2, i)) {
+					MAIN_CONFIG_MASK_SET(mask, i);
+				}
+			}
+
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			buffer_append_uint16(m_send_buffer, conf_general_main_config_hash(&main_config), &send_index);
+			send_index += conf_general_encode_main_config(&main_config, mask, m_send_buffer + send_index);
+
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
+		case CMD_SET_MAIN_CONFIG_FIELDS: {
+			timeout_reset();
+			commands_set_send_func(func);
+
+			MAIN_CONFIG_SET_RESULT res = MAIN_CONFIG_SET_INVALID;
+
+			if (len >= 2) {
+				int32_t ind = 0;
+				uint16_t hash = buffer_get_uint16(data, &ind);
+
+				if (hash != conf_general_main_config_hash(&main_config)) {
+					res = MAIN_CONFIG_SET_HASH_MISMATCH;
+				} else {
+					// Decode into a copy, so that all fields are applied or none
+					MAIN_CONFIG main_cfg_tmp = main_config;
+					if (conf_general_decode_main_config(&main_cfg_tmp, data + ind, len - ind) >= 0) {
+						MAIN_CONFIG main_cfg_old = main_config;
+						main_config = main_cfg_tmp;
+						log_set_enabled(main_config.log_en);
+						log_set_name(main_config.log_name);
+						conf_general_store_main_config_changes(&main_cfg_old, &main_config);
+						res = MAIN_CONFIG_SET_OK;
+					}
+				}
+			}
+
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			m_send_buffer[send_index++] = res;
+			buffer_append_uint16(m_send_buffer, conf_general_main_config_hash(&main_config), &send_index);
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
+
+		case CMD_IMU_CAPTURE_SET: {
+			commands_set_send_func(func);
 
-			m_send_buffer[send_index++] = main_cfg_tmp.mag_use;
-			m_send_buffer[send_index++] = main_cfg_tmp.mag_comp;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.yaw_mag_gain, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_cx, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_cy, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_cz, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_xx, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_xy, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_xz, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_yx, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_yy, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_yz, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_zx, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_zy, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mag_cal_zz, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_ant_x, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_ant_y, &send_index);
-			m_send_buffer[send_index++] = main_cfg_tmp.gps_comp;
-			m_send_buffer[send_index++] = main_cfg_tmp.gps_req_rtk;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_corr_gain_stat, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_corr_gain_dyn, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_corr_gain_yaw, &send_index);
-			m_send_buffer[send_index++] = main_cfg_tmp.gps_send_nmea;
-			m_send_buffer[send_index++] = main_cfg_tmp.gps_use_ubx_info;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.gps_ubx_max_acc, &send_index);
-
-			m_send_buffer[send_index++] = main_cfg_tmp.ap_repeat_routes;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.ap_base_rad, &send_index);
-			m_send_buffer[send_index++] = main_cfg_tmp.ap_mode_time;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.ap_max_speed, &send_index);
-			buffer_append_int32(m_send_buffer, main_cfg_tmp.ap_time_add_repeat_ms, &send_index);
-
-			m_send_buffer[send_index++] = main_cfg_tmp.log_en;
-			strcpy((char*)(m_send_buffer + send_index), main_cfg_tmp.log_name);
-			send_index += strlen(main_config.log_name) + 1;
-
-			// Car settings
-			m_send_buffer[send_index++] = main_cfg_tmp.car.yaw_use_odometry;
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.yaw_imu_gain, &send_index);
-			m_send_buffer[send_index++] = main_cfg_tmp.car.disable_motor;
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.gear_ratio, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.wheel_diam, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.motor_poles, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.steering_max_angle_rad, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.steering_center, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.steering_range, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.steering_ramp_time, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.car.axis_distance, &send_index);
-
-			// Multirotor settings
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_decay_e, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_decay_l, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_max, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.map_min_x, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.map_max_x, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.map_min_y, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.map_max_y, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_gain_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_gain_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.vel_gain_d, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.tilt_gain_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.tilt_gain_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.tilt_gain_d, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.max_corr_error, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.max_tilt_error, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_roll_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_roll_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_roll_dp, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_roll_de, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pitch_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pitch_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pitch_dp, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pitch_de, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_yaw_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_yaw_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_yaw_dp, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_yaw_de, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pos_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pos_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_pos_d, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_alt_p, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_alt_i, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.ctrl_gain_alt_d, &send_index);
-
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.js_gain_tilt, &send_index);
-			buffer_append_float32_auto(m_send_buffer, main_cfg_tmp.mr.js_gain_yaw, &send_index);
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.js_mode_rate;
-
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motor_fl_f;
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motor_bl_l;
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motor_fr_r;
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motor_br_b;
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motors_x;
-			m_send_buffer[send_index++] = main_cfg_tmp.mr.motors_cw;
-			buffer_append_uint16(m_send_buffer, main_cfg_tmp.mr.motor_pwm_min_us, &send_index);
-			buffer_append_uint16(m_send_buffer, main_cfg_tmp.mr.motor_pwm_max_us, &send_index);
+			int32_t ind = 0;
+			bool enabled = data[ind++];
+			int decimation = data[ind++];
+			imu_capture_set(enabled, decimation);
 
+			// Send ack
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
 			commands_send_packet(m_send_buffer, send_index);
 		} break;
 
@@ -800,6 +744,12 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 
 			autopilot_set_active(false);
 
+			// Brake when leaving the geofence
+			if (geofence_manual_brake()) {
+				mode = RC_MODE_CURRENT_BRAKE;
+				throttle = GEOFENCE_BRAKE_CURRENT;
+			}
+
 			switch (mode) {
 			case RC_MODE_CURRENT:
 				if (!main_config.car.disable_motor) {
@@ -844,6 +794,39 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			utils_truncate_number(&steering, 0.0, 1.0);
 			servo_simple_set_pos_ramp(steering);
 		} break;
+
+		case CMD_GEOFENCE_SET: {
+			timeout_reset();
+			commands_set_send_func(func);
+
+			static float fence_x[GEOFENCE_MAX_POINTS];
+			static float fence_y[GEOFENCE_MAX_POINTS];
+			int32_t ind = 0;
+			int points = 0;
+			bool ok = true;
+
+			while (ind < (int32_t)len) {
+				if (points >= GEOFENCE_MAX_POINTS) {
+					ok = false;
+					break;
+				}
+
+				fence_x[points] = buffer_get_float32(data, 1e4, &ind);
+				fence_y[points] = buffer_get_float32(data, 1e4, &ind);
+				points++;
+			}
+
+			if (ok) {
+				ok = geofence_set(fence_x, fence_y, points);
+			}
+
+			// Send ack
+			int32_t send_index = 0;
+			m_send_buffer[send_index++] = main_id;
+			m_send_buffer[send_index++] = packet_id;
+			m_send_buffer[send_index++] = ok;
+			commands_send_packet(m_send_buffer, send_index);
+		} break;
 #endif
 #if MAIN_MODE == MAIN_MODE_MULTIROTOR
 		case CMD_MR_GET_STATE: {
@@ -888,6 +871,7 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 			buffer_append_float32_auto(m_send_buffer, rp_goal.px, &send_index); // 84
 			buffer_append_float32_auto(m_send_buffer, rp_goal.py, &send_index); // 88
 			buffer_append_int32(m_send_buffer, pos_get_ms_today(), &send_index); // 92
+			buffer_append_float32_auto(m_send_buffer, pos.vz, &send_index); // 96
 			commands_send_packet(m_send_buffer, send_index);
 		} break;
 
@@ -969,6 +953,8 @@ void commands_process_packet(unsigned char *data, unsigned int len,
 		default:
 			break;
 		}
+
+		stats_cmd_done(packet_id, stats_start);
 	}
 }
 
@@ -1089,6 +1075,66 @@ void commands_send_dw_sample(DW_LOG_INFO *dw) {
 #endif
 }
 
+#if MAIN_MODE_IS_VEHICLE
+/**
+ * Send CMD_POSE at the rate requested with CMD_SET_POSE_STREAM. The packet
+ * is a compact subset of CMD_GET_STATE, so that a high rate stream fits on
+ * a slow link next to the other traffic:
+ *
+ * int32 ms_today, float32 px * 1e4, float32 py * 1e4, int16 speed * 1e3,
+ * int16 yaw * 1e2, int16 roll * 1e2, int16 pitch * 1e2
+ *
+ * The angles are in degrees, -180 to 180.
+ */
+static THD_FUNCTION(pose_stream_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("Pose stream");
+
+	uint8_t buffer[24];
+	systime_t time_p = chVTGetSystemTimeX();
+
+	for(;;) {
+		int rate = m_pose_rate;
+		void(*func)(unsigned char *data, unsigned int len) = m_pose_send_func;
+		bool expired = ST2MS(chVTTimeElapsedSinceX(m_pose_req_time)) > POSE_STREAM_TIMEOUT;
+
+		if (rate > 0 && func && !expired) {
+			POS_STATE pos;
+			pos_get_pos(&pos);
+			utils_norm_angle(&pos.yaw);
+			utils_norm_angle(&pos.roll);
+			utils_norm_angle(&pos.pitch);
+
+			int32_t ind = 0;
+			buffer[ind++] = main_id;
+			buffer[ind++] = CMD_POSE;
+			buffer_append_int32(buffer, pos_get_ms_today(), &ind);
+			buffer_append_float32(buffer, pos.px, 1e4, &ind);
+			buffer_append_float32(buffer, pos.py, 1e4, &ind);
+			buffer_append_float16(buffer, pos.speed, 1e3, &ind);
+			buffer_append_float16(buffer, pos.yaw, 1e2, &ind);
+			buffer_append_float16(buffer, pos.roll, 1e2, &ind);
+			buffer_append_float16(buffer, pos.pitch, 1e2, &ind);
+			func(buffer, ind);
+
+			time_p += MS2ST(1000 / rate);
+		} else {
+			time_p += MS2ST(10);
+		}
+
+		systime_t time = chVTGetSystemTimeX();
+
+		if (time_p >= time + 5) {
+			chThdSleepUntil(time_p);
+		} else {
+			time_p = time;
+			chThdSleepMilliseconds(1);
+		}
+	}
+}
+#endif
+
 static void stop_forward(void *p) {
 	(void)p;
 	bldc_interface_set_forward_func(0);
@@ -21,6 +21,8 @@
 #include "stm32f4xx_conf.h"
 #include "eeprom.h"
 #include "utils.h"
+#include "buffer.h"
+#include "crc.h"
 #include <string.h>
 
 // Settings
@@ -35,6 +37,9 @@ int main_id = 0;
 #endif
 uint16_t VirtAddVarTab[NB_OF_VAR];
 
+// Private variables
+static bool m_main_conf_stored = false;
+
 void conf_general_init(void) {
 	palSetPadMode(GPIOE, 8, PAL_MODE_INPUT_PULLUP);
 	palSetPadMode(GPIOE, 9, PAL_MODE_INPUT_PULLUP);
@@ -99,6 +104,9 @@ void conf_general_get_default_main_config(MAIN_CONFIG *conf) {
 	conf->gps_send_nmea = true;
 	conf->gps_use_ubx_info = true;
 	conf->gps_ubx_max_acc = 0.12;
+	conf->gps_use_mb_heading = false;
+	conf->gps_mb_baseline = 0.0;
+	conf->gps_mb_yaw_offset = 0.0;
 
 	conf->ap_repeat_routes = true;
 	conf->ap_base_rad = 1.2;
@@ -122,6 +130,7 @@ void conf_general_get_default_main_config(MAIN_CONFIG *conf) {
 	conf->car.steering_range = 0.58;
 	conf->car.steering_ramp_time = 0.6;
 	conf->car.axis_distance = 0.475;
+	conf->car.odometry_from_status = false;
 
 	// Default multirotor settings
 	conf->mr.vel_decay_e = 0.8;
@@ -179,6 +188,7 @@ void conf_general_get_default_main_config(MAIN_CONFIG *conf) {
 	conf->mr.motors_cw = true;
 	conf->mr.motor_pwm_min_us = 1200;
 	conf->mr.motor_pwm_max_us = 2000;
+	conf->mr.ap_enabled = false;
 
 	// Custom parameters based on ID
 	switch (main_id) {
@@ -292,6 +302,8 @@ void conf_general_read_main_conf(MAIN_CONFIG *conf) {
 	if (!is_ok) {
 		conf_general_get_default_main_config(conf);
 	}
+
+	m_main_conf_stored = is_ok;
 }
 
 /**
@@ -304,25 +316,215 @@ bool conf_general_store_main_config(MAIN_CONFIG *conf) {
 	utils_sys_lock_cnt();
 //	RCC_APB1PeriphClockCmd(RCC_APB1Periph_WWDG, DISABLE);
 
-	bool is_ok = true;
+	static uint16_t addrs[sizeof(MAIN_CONFIG) / 2];
+	static uint16_t vars[sizeof(MAIN_CONFIG) / 2];
 	uint8_t *conf_addr = (uint8_t*)conf;
-	uint16_t var;
 
 	FLASH_ClearFlag(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
 			FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
 
 	for (unsigned int i = 0;i < (sizeof(MAIN_CONFIG) / 2);i++) {
-		var = (conf_addr[2 * i] << 8) & 0xFF00;
-		var |= conf_addr[2 * i + 1] & 0xFF;
+		addrs[i] = EEPROM_BASE_MAINCONF + i;
+		vars[i] = (conf_addr[2 * i] << 8) & 0xFF00;
+		vars[i] |= conf_addr[2 * i + 1] & 0xFF;
+	}
 
-		if (EE_WriteVariable(EEPROM_BASE_MAINCONF + i, var) != FLASH_COMPLETE) {
-			is_ok = false;
-			break;
+	// Only the words that changed are written, with at most one page transfer
+	bool is_ok = EE_WriteVariables(addrs, vars, sizeof(MAIN_CONFIG) / 2) == FLASH_COMPLETE;
+	m_main_conf_stored = m_main_conf_stored || is_ok;
+
+//	RCC_APB1PeriphClockCmd(RCC_APB1Periph_WWDG, ENABLE);
+	utils_sys_unlock_cnt();
+
+	return is_ok;
+}
+
+/**
+ * Write the parts of MAIN_CONFIG that differ from a previous configuration
+ * to EEPROM. The previous configuration must be what is stored already. If
+ * the defaults are used because nothing was stored, the whole configuration
+ * is written.
+ *
+ * @param conf_old
+ * The configuration that is stored in EEPROM.
+ *
+ * @param conf
+ * A pointer to the configuration that should be stored.
+ */
+bool conf_general_store_main_config_changes(const MAIN_CONFIG *conf_old, MAIN_CONFIG *conf) {
+	static uint16_t addrs[sizeof(MAIN_CONFIG) / 2];
+	static uint16_t vars[sizeof(MAIN_CONFIG) / 2];
+	const uint8_t *old_addr = (const uint8_t*)conf_old;
+	uint8_t *conf_addr = (uint8_t*)conf;
+	uint16_t num = 0;
+
+	if (!m_main_conf_stored) {
+		return conf_general_store_main_config(conf);
+	}
+
+	for (unsigned int i = 0;i < (sizeof(MAIN_CONFIG) / 2);i++) {
+		if (old_addr[2 * i] != conf_addr[2 * i] ||
+				old_addr[2 * i + 1] != conf_addr[2 * i + 1]) {
+			addrs[num] = EEPROM_BASE_MAINCONF + i;
+			vars[num] = (conf_addr[2 * i] << 8) & 0xFF00;
+			vars[num] |= conf_addr[2 * i + 1] & 0xFF;
+			num++;
 		}
 	}
 
-//	RCC_APB1PeriphClockCmd(RCC_APB1Periph_WWDG, ENABLE);
+	if (num == 0) {
+		return true;
+	}
+
+	utils_sys_lock_cnt();
+
+	FLASH_ClearFlag(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+			FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+
+	bool is_ok = EE_WriteVariables(addrs, vars, num) == FLASH_COMPLETE;
+
 	utils_sys_unlock_cnt();
 
 	return is_ok;
 }
+
+/**
+ * Calculate the hash of MAIN_CONFIG that is used to check that delta updates
+ * are based on the same configuration on both sides.
+ *
+ * @param conf
+ * The configuration.
+ *
+ * @return
+ * CRC16 of the full serialization of the configuration.
+ */
+uint16_t conf_general_main_config_hash(const MAIN_CONFIG *conf) {
+	static uint8_t buffer[MAIN_CONFIG_HEADER_SIZE + sizeof(main_config_wire_t)];
+	int32_t len = conf_general_encode_main_config(conf, 0, buffer);
+	return crc16(buffer, len);
+}
+
+// Encoders and decoders for the field types in main_config_schema.h
+#define ENCODE_BOOL(v)		buffer[ind++] = (v)
+#define ENCODE_INT8(v)		buffer[ind++] = (uint8_t)(v)
+#define ENCODE_UINT16(v)	buffer_append_uint16(buffer, (v), &ind)
+#define ENCODE_INT32(v)		buffer_append_int32(buffer, (v), &ind)
+#define ENCODE_FLOAT(v)		buffer_append_float32_auto(buffer, (v), &ind)
+#define ENCODE_NAME(v)		strncpy((char*)buffer + ind, (v), MAIN_CONFIG_WIRE_SIZE_NAME); \
+							buffer[ind + MAIN_CONFIG_WIRE_SIZE_NAME - 1] = '\0'; \
+							ind += MAIN_CONFIG_WIRE_SIZE_NAME
+
+#define DECODE_BOOL(v)		(v) = buffer[ind++]
+#define DECODE_INT8(v)		(v) = (int8_t)buffer[ind++]
+#define DECODE_UINT16(v)	(v) = buffer_get_uint16(buffer, &ind)
+#define DECODE_INT32(v)		(v) = buffer_get_int32(buffer, &ind)
+#define DECODE_FLOAT(v)		(v) = buffer_get_float32_auto(buffer, &ind)
+#define DECODE_NAME(v)		memcpy((v), buffer + ind, MAIN_CONFIG_WIRE_SIZE_NAME); \
+							(v)[MAIN_CONFIG_WIRE_SIZE_NAME - 1] = '\0'; \
+							ind += MAIN_CONFIG_WIRE_SIZE_NAME
+
+/**
+ * Serialize MAIN_CONFIG as described in main_config_schema.h.
+ *
+ * @param conf
+ * The configuration to serialize.
+ *
+ * @param mask
+ * Field mask with MAIN_CONFIG_MASK_BYTES bytes for the fields to include.
+ * If this is null all fields are included.
+ *
+ * @param buffer
+ * The buffer to write to. It must have room for MAIN_CONFIG_HEADER_SIZE +
+ * sizeof(main_config_wire_t) bytes.
+ *
+ * @return
+ * The number of bytes written.
+ */
+int32_t conf_general_encode_main_config(const MAIN_CONFIG *conf, const uint8_t *mask, uint8_t *buffer) {
+	int32_t ind = 0;
+
+	buffer[ind++] = MAIN_CONFIG_SCHEMA_VERSION;
+	buffer[ind++] = MAIN_CONFIG_FIELD_NUM;
+
+	if (mask) {
+		memcpy(buffer + ind, mask, MAIN_CONFIG_MASK_BYTES);
+	} else {
+		memset(buffer + ind, 0, MAIN_CONFIG_MASK_BYTES);
+		for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+			MAIN_CONFIG_MASK_SET(buffer + ind, i);
+		}
+	}
+
+	const uint8_t *mask_now = buffer + ind;
+	ind += MAIN_CONFIG_MASK_BYTES;
+
+#define ENCODE_FIELD(id, type, member) \
+	if (MAIN_CONFIG_MASK_GET(mask_now, MAIN_CONFIG_FIELD_##id)) { \
+		ENCODE_##type(conf->member); \
+	}
+
+	MAIN_CONFIG_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
+
+	return ind;
+}
+
+/**
+ * Update MAIN_CONFIG from a buffer serialized as described in
+ * main_config_schema.h. Only the fields that are present in the buffer are
+ * updated.
+ *
+ * @param conf
+ * The configuration to update. Nothing is changed if decoding fails.
+ *
+ * @param buffer
+ * The buffer to decode.
+ *
+ * @param len
+ * The length of the buffer.
+ *
+ * @return
+ * The number of fields that were updated, or -1 if the buffer is invalid.
+ */
+int conf_general_decode_main_config(MAIN_CONFIG *conf, const uint8_t *buffer, int32_t len) {
+	if (len < 2 || buffer[0] != MAIN_CONFIG_SCHEMA_VERSION) {
+		return -1;
+	}
+
+	const int field_num = buffer[1];
+	const int mask_bytes = (field_num + 7) / 8;
+	const uint8_t *mask = buffer + 2;
+	int32_t ind = 2 + mask_bytes;
+
+	if (len < ind) {
+		return -1;
+	}
+
+	// Check the length before changing anything
+	int32_t len_needed = ind;
+
+#define FIELD_LEN(id, type, member) \
+	if (MAIN_CONFIG_FIELD_##id < field_num && MAIN_CONFIG_MASK_GET(mask, MAIN_CONFIG_FIELD_##id)) { \
+		len_needed += MAIN_CONFIG_WIRE_SIZE_##type; \
+	}
+
+	MAIN_CONFIG_FIELDS(FIELD_LEN)
+#undef FIELD_LEN
+
+	if (len < len_needed) {
+		return -1;
+	}
+
+	int fields = 0;
+
+#define DECODE_FIELD(id, type, member) \
+	if (MAIN_CONFIG_FIELD_##id < field_num && MAIN_CONFIG_MASK_GET(mask, MAIN_CONFIG_FIELD_##id)) { \
+		DECODE_##type(conf->member); \
+		fields++; \
+	}
+
+	MAIN_CONFIG_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
+
+	return fields;
+}
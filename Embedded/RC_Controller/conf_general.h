@@ -19,6 +19,7 @@
 #define CONF_GENERAL_H_
 
 #include "datatypes.h"
+#include "main_config_schema.h"
 
 #define MAIN_MODE_CAR 				0
 #define MAIN_MODE_MOTE_2400			1
@@ -48,6 +49,14 @@
 #define IMU_ROT_180					1
 #endif
 
+// Math profile. With FAST_MATH set to 1 the hot paths in ahrs.c, pos.c,
+// autopilot.c and mr_control.c use the approximations in utils.c instead of
+// atan2f, asinf, sinf, cosf, tanf and 1 / sqrtf. Can also be set with
+// make build_args='-DFAST_MATH=1'
+#ifndef FAST_MATH
+#define FAST_MATH					0
+#endif
+
 // Ublox settings
 #ifndef UBLOX_EN
 #define UBLOX_EN					1
@@ -66,6 +75,9 @@
 #define LOG_DW_ANCHOR1				234
 #define LOG_DW_ANCHOR2				35
 #define LOG_DW_FORCE_CC1120			1
+// Send the samples from all anchors instead of only the closest one. Enable
+// this for multilateration in RControlStation.
+#define LOG_DW_SEND_ALL				0
 
 // CC2520 Settings
 #define CC2520_RF_CHANNEL			12
@@ -114,5 +126,9 @@ void conf_general_init(void);
 void conf_general_get_default_main_config(MAIN_CONFIG *conf);
 void conf_general_read_main_conf(MAIN_CONFIG *conf);
 bool conf_general_store_main_config(MAIN_CONFIG *conf);
+bool conf_general_store_main_config_changes(const MAIN_CONFIG *conf_old, MAIN_CONFIG *conf);
+uint16_t conf_general_main_config_hash(const MAIN_CONFIG *conf);
+int32_t conf_general_encode_main_config(const MAIN_CONFIG *conf, const uint8_t *mask, uint8_t *buffer);
+int conf_general_decode_main_config(MAIN_CONFIG *conf, const uint8_t *buffer, int32_t len);
 
 #endif /* CONF_GENERAL_H_ */
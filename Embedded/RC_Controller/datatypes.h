@@ -55,6 +55,7 @@ typedef struct {
 	float pz; // Meters
 	float vx; // Meters / second
 	float vy; // Meters / second
+	float vz; // Meters / second
 	float speed; // Meters / second
 	float roll; // Degrees
 	float pitch; // Degrees
@@ -125,7 +126,8 @@ typedef enum {
 	CAN_PACKET_FILL_RX_BUFFER_LONG,
 	CAN_PACKET_PROCESS_RX_BUFFER,
 	CAN_PACKET_PROCESS_SHORT_BUFFER,
-	CAN_PACKET_STATUS
+	CAN_PACKET_STATUS,
+	CAN_PACKET_STATUS_5 = 27
 } CAN_PACKET_ID;
 
 // Commands
@@ -133,6 +135,8 @@ typedef enum {
 	// General commands
 	CMD_PRINTF = 0,
 	CMD_TERMINAL_CMD,
+	CMD_TRACE,
+	CMD_GET_STATS,
 
 	// Common vehicle commands
 	CMD_VESC_FWD = 50,
@@ -165,11 +169,19 @@ typedef enum {
 	CMD_SET_MAIN_CONFIG,
 	CMD_GET_MAIN_CONFIG,
 	CMD_GET_MAIN_CONFIG_DEFAULT,
+	CMD_IMU_CAPTURE_SET,
+	CMD_IMU_CAPTURE_DATA,
+	CMD_GET_MAIN_CONFIG_HASH,
+	CMD_GET_MAIN_CONFIG_FIELDS,
+	CMD_SET_MAIN_CONFIG_FIELDS,
+	CMD_SET_POSE_STREAM,
+	CMD_POSE,
 
 	// Car commands
 	CMD_GET_STATE = 120,
 	CMD_RC_CONTROL,
 	CMD_SET_SERVO_DIRECT,
+	CMD_GEOFENCE_SET,
 
 	// Multirotor commands
 	CMD_MR_GET_STATE = 160,
@@ -182,6 +194,29 @@ typedef enum {
 	CMD_MOTE_UBX_BASE_STATUS
 } CMD_PACKET;
 
+// Latency trace hops. Every node that handles a CMD_TRACE packet appends
+// the hop id followed by a 32-bit microsecond timestamp from its own clock.
+typedef enum {
+	TRACE_HOP_STATION_TX = 0,
+	TRACE_HOP_CLIENT_RX,
+	TRACE_HOP_CLIENT_TX,
+	TRACE_HOP_FW_RX,
+	TRACE_HOP_FW_TX,
+	TRACE_HOP_CLIENT_RX_RESP,
+	TRACE_HOP_CLIENT_TX_RESP,
+	TRACE_HOP_STATION_RX
+} TRACE_HOP;
+
+// Queues with high-water mark tracking in the firmware statistics
+typedef enum {
+	STATS_QUEUE_UBLOX_RX = 0,
+	STATS_QUEUE_CAN_RX,
+	STATS_QUEUE_CC2520_TX,
+	STATS_QUEUE_CC1120_TX,
+	STATS_QUEUE_IMU_CAPTURE,
+	STATS_QUEUE_NUM
+} STATS_QUEUE;
+
 // RC control modes
 typedef enum {
 	RC_MODE_CURRENT = 0,
@@ -203,6 +238,7 @@ typedef struct {
 	float steering_range;
 	float steering_ramp_time; // Ramp time constant for the steering servo in seconds
 	float axis_distance;
+	bool odometry_from_status; // Use the CAN status broadcasts from the motor controller for odometry instead of polling.
 } MAIN_CONFIG_CAR;
 
 typedef struct {
@@ -267,6 +303,9 @@ typedef struct {
 	bool motors_cw; // Front left (or front in + mode) runs in the clockwise direction (ccw if false)
 	uint16_t motor_pwm_min_us; // Minimum servo pulse length for motor in microseconds
 	uint16_t motor_pwm_max_us; // Maximum servo pulse length for motor in microseconds
+
+	// Hand over to position hold or the route at full throttle
+	bool ap_enabled;
 } MAIN_CONFIG_MULTIROTOR;
 
 // Car configuration
@@ -301,6 +340,9 @@ typedef struct {
 	bool gps_send_nmea; // Send NMEA data for logging and debugging
 	bool gps_use_ubx_info; // Use info about the ublox solution
 	float gps_ubx_max_acc; // Maximum ublox accuracy to use solution (m, higher = worse)
+	bool gps_use_mb_heading; // Correct yaw with the heading from a moving base receiver
+	float gps_mb_baseline; // Distance between the moving base antennas (m, 0 = don't check)
+	float gps_mb_yaw_offset; // Angle of the base to rover antenna vector from vehicle forward, clockwise (deg)
 
 	// Autopilot parameters
 	bool ap_repeat_routes; // Repeat the same route when the end is reached
@@ -372,6 +414,15 @@ typedef struct {
 	bool diff_soln; // Differential corrections are applied
 	bool rel_pos_valid; // Relative position components and accuracies valid
 	int carr_soln; // fix_type 0: no fix, 1: float, 2: fix
+	// Only in message version 1 (ZED-F9P and later), zero otherwise
+	float rel_pos_length; // Length of the relative position vector in meters
+	float rel_pos_heading; // Heading of the relative position vector in degrees, clockwise from north
+	float acc_length; // Accuracy of the length in meters
+	float acc_heading; // Accuracy of the heading in degrees
+	bool is_moving; // The base is moving (moving base mode)
+	bool ref_pos_miss; // Extrapolated base position was used
+	bool ref_obs_miss; // Extrapolated base observations were used
+	bool heading_valid; // rel_pos_heading is valid
 } ubx_nav_relposned;
 
 typedef struct {
@@ -507,7 +558,7 @@ typedef struct {
 	double P[2];        // Pseudorange observation
 	double L[2];        // Carrier phase observation
 	uint8_t cn0[2];     // Carrier-to-Noise density [dB Hz]
-	uint8_t lock[2];    // Lock. Set to 0 when the lock has changed, 127 otherwise. TODO: is this correct?
+	uint8_t lock[2];    // Lock time indicator (RTCM DF013/DF043). 0 after a slip, 127 after 937 s of lock
 	uint8_t prn;        // Sattelite
 	uint8_t freq;       // Frequency slot (GLONASS)
 	uint8_t code[2];    // Code indicator
@@ -596,6 +647,9 @@ typedef struct {
 	float rpm;
 	float current;
 	float duty;
+	uint32_t tacho_rx_time; // 0 until the first CAN_PACKET_STATUS_5
+	int32_t tachometer;
+	float v_in;
 } can_status_msg;
 
 typedef enum {
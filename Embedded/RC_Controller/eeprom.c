@@ -25,6 +25,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "eeprom.h"
+#include <string.h>
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -80,14 +81,33 @@ uint16_t DataVar = 0;
 /* Virtual address defined by the user: 0xFFFF value is prohibited */
 extern uint16_t VirtAddVarTab[NB_OF_VAR];
 
+/*
+ * RAM index of the valid page: the slot number of the latest copy of every
+ * variable, or 0 if the variable is not stored. It is built with one scan
+ * of the page and kept up to date on writes, so that reads do not have to
+ * scan the page backwards.
+ */
+static uint16_t m_index_page = NO_VALID_PAGE;
+static uint16_t m_var_slot[NB_OF_VAR];
+
+/* Lowest address that can be free on each page, 0 if unknown */
+static uint32_t m_free_addr[2] = {0, 0};
+
+/* Scratch buffers for the changed variables of a bulk write */
+static uint16_t m_bulk_addr[NB_OF_VAR];
+static uint16_t m_bulk_data[NB_OF_VAR];
+
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 static FLASH_Status EE_Format(void);
 static uint16_t EE_FindValidPage(uint8_t Operation);
 static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Data);
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data);
+static uint16_t EE_PageTransfer(const uint16_t *VirtAddress, const uint16_t *Data, uint16_t Num);
 static uint16_t EE_EraseSectorIfNotEmpty(uint32_t FLASH_Sector, uint8_t VoltageRange);
 static uint8_t* EE_get_sector_address(uint32_t fsector);
+static int EE_VarIndex(uint16_t VirtAddress);
+static void EE_BuildIndex(void);
+static uint16_t EE_FreeSlots(uint16_t Page);
 
 /**
  * @brief  Restore the pages to a known good state in case of page's status
@@ -104,6 +124,9 @@ uint16_t EE_Init(void)
 	int16_t x = -1;
 	uint16_t  FlashStatus;
 
+	/* Index the valid page, if any, to speed up the transfers below */
+	EE_BuildIndex();
+
 	/* Get Page0 status */
 	PageStatus0 = (*(__IO uint16_t*)PAGE0_BASE_ADDRESS);
 	/* Get Page1 status */
@@ -179,16 +202,18 @@ uint16_t EE_Init(void)
 					}
 				}
 			}
-			/* Mark Page0 as valid */
-			FlashStatus = FLASH_ProgramHalfWord(PAGE0_BASE_ADDRESS, VALID_PAGE);
-			/* If program operation was failed, a Flash error code is returned */
+			/* Erase Page1 before marking Page0 as valid, like in EE_PageTransfer.
+			   The other way around a power loss in between leaves two valid
+			   pages, which are formatted on the next start. */
+			FlashStatus = EE_EraseSectorIfNotEmpty(PAGE1_ID, VOLTAGE_RANGE);
+			/* If erase operation was failed, a Flash error code is returned */
 			if (FlashStatus != FLASH_COMPLETE)
 			{
 				return FlashStatus;
 			}
-			/* Erase Page1 */
-			FlashStatus = EE_EraseSectorIfNotEmpty(PAGE1_ID, VOLTAGE_RANGE);
-			/* If erase operation was failed, a Flash error code is returned */
+			/* Mark Page0 as valid */
+			FlashStatus = FLASH_ProgramHalfWord(PAGE0_BASE_ADDRESS, VALID_PAGE);
+			/* If program operation was failed, a Flash error code is returned */
 			if (FlashStatus != FLASH_COMPLETE)
 			{
 				return FlashStatus;
@@ -270,16 +295,18 @@ uint16_t EE_Init(void)
 					}
 				}
 			}
-			/* Mark Page1 as valid */
-			FlashStatus = FLASH_ProgramHalfWord(PAGE1_BASE_ADDRESS, VALID_PAGE);
-			/* If program operation was failed, a Flash error code is returned */
+			/* Erase Page0 before marking Page1 as valid, like in EE_PageTransfer.
+			   The other way around a power loss in between leaves two valid
+			   pages, which are formatted on the next start. */
+			FlashStatus = EE_EraseSectorIfNotEmpty(PAGE0_ID, VOLTAGE_RANGE);
+			/* If erase operation was failed, a Flash error code is returned */
 			if (FlashStatus != FLASH_COMPLETE)
 			{
 				return FlashStatus;
 			}
-			/* Erase Page0 */
-			FlashStatus = EE_EraseSectorIfNotEmpty(PAGE0_ID, VOLTAGE_RANGE);
-			/* If erase operation was failed, a Flash error code is returned */
+			/* Mark Page1 as valid */
+			FlashStatus = FLASH_ProgramHalfWord(PAGE1_BASE_ADDRESS, VALID_PAGE);
+			/* If program operation was failed, a Flash error code is returned */
 			if (FlashStatus != FLASH_COMPLETE)
 			{
 				return FlashStatus;
@@ -298,6 +325,9 @@ uint16_t EE_Init(void)
 		break;
 	}
 
+	/* Index the page that is valid after the repairs */
+	EE_BuildIndex();
+
 	return FLASH_COMPLETE;
 }
 
@@ -329,6 +359,23 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
 	/* Get the valid Page start Address */
 	PageStartAddress = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(ValidPage * PAGE_SIZE));
 
+	/* Look up the variable in the index if it covers the valid page */
+	if (ValidPage == m_index_page)
+	{
+		int VarIdx = EE_VarIndex(VirtAddress);
+
+		if (VarIdx >= 0)
+		{
+			if (m_var_slot[VarIdx] == 0)
+			{
+				return ReadStatus;
+			}
+
+			*Data = (*(__IO uint16_t*)(PageStartAddress + (uint32_t)m_var_slot[VarIdx] * 4));
+			return 0;
+		}
+	}
+
 	/* Get the valid Page end Address */
 	Address = (uint32_t)((EEPROM_START_ADDRESS - 2) + (uint32_t)((1 + ValidPage) * PAGE_SIZE));
 
@@ -381,13 +428,82 @@ uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data)
 	if (Status == PAGE_FULL)
 	{
 		/* Perform Page transfer */
-		Status = EE_PageTransfer(VirtAddress, Data);
+		Status = EE_PageTransfer(&VirtAddress, &Data, 1);
 	}
 
 	/* Return last operation status */
 	return Status;
 }
 
+/**
+ * @brief  Writes/updates several variables in EEPROM. Variables that already
+ *   have the requested value are skipped, and the changed ones are appended
+ *   in one pass. If they do not fit in the active page, all of them are
+ *   written during a single page transfer.
+ * @param  VirtAddress: Virtual addresses of the variables
+ * @param  Data: 16 bit data to be written for each variable
+ * @param  Num: Number of variables, at most NB_OF_VAR
+ * @retval Success or error status:
+ *           - FLASH_COMPLETE: on success
+ *           - PAGE_FULL: if there are too many variables
+ *           - NO_VALID_PAGE: if no valid page was found
+ *           - Flash error code: on write Flash error
+ */
+uint16_t EE_WriteVariables(const uint16_t *VirtAddress, const uint16_t *Data, uint16_t Num)
+{
+	uint16_t Status = FLASH_COMPLETE;
+	uint16_t ValidPage = PAGE0;
+	uint16_t ChangedNum = 0, VarIdx = 0;
+	uint16_t OldData = 0;
+
+	if (Num > NB_OF_VAR)
+	{
+		return PAGE_FULL;
+	}
+
+	/* Collect the variables that differ from what is stored */
+	for (VarIdx = 0; VarIdx < Num; VarIdx++)
+	{
+		if (EE_ReadVariable(VirtAddress[VarIdx], &OldData) != 0 || OldData != Data[VarIdx])
+		{
+			m_bulk_addr[ChangedNum] = VirtAddress[VarIdx];
+			m_bulk_data[ChangedNum] = Data[VarIdx];
+			ChangedNum++;
+		}
+	}
+
+	if (ChangedNum == 0)
+	{
+		return FLASH_COMPLETE;
+	}
+
+	/* Get valid Page for write operation */
+	ValidPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+
+	/* Check if there is no valid page */
+	if (ValidPage == NO_VALID_PAGE)
+	{
+		return NO_VALID_PAGE;
+	}
+
+	/* Move everything to the other page at once if the changes do not fit */
+	if (EE_FreeSlots(ValidPage) < ChangedNum)
+	{
+		return EE_PageTransfer(m_bulk_addr, m_bulk_data, ChangedNum);
+	}
+
+	for (VarIdx = 0; VarIdx < ChangedNum; VarIdx++)
+	{
+		Status = EE_VerifyPageFullWriteVariable(m_bulk_addr[VarIdx], m_bulk_data[VarIdx]);
+		if (Status != FLASH_COMPLETE)
+		{
+			return Status;
+		}
+	}
+
+	return Status;
+}
+
 /**
  * @brief  Erases PAGE and PAGE1 and writes VALID_PAGE header to PAGE
  * @param  None
@@ -419,6 +535,9 @@ static FLASH_Status EE_Format(void)
 	/* Erase Page1 */
 	FlashStatus = EE_EraseSectorIfNotEmpty(PAGE1_ID, VOLTAGE_RANGE);
 
+	/* Page0 is empty and valid now */
+	EE_BuildIndex();
+
 	/* Return Page1 erase operation status */
 	return FlashStatus;
 }
@@ -509,6 +628,8 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Da
 	FLASH_Status FlashStatus = FLASH_COMPLETE;
 	uint16_t ValidPage = PAGE0;
 	uint32_t Address = EEPROM_START_ADDRESS, PageEndAddress = EEPROM_START_ADDRESS+PAGE_SIZE;
+	uint32_t PageStartAddress = EEPROM_START_ADDRESS;
+	int VarIdx = 0;
 
 	/* Get valid Page for write operation */
 	ValidPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
@@ -520,7 +641,14 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Da
 	}
 
 	/* Get the valid Page start Address */
-	Address = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(ValidPage * PAGE_SIZE));
+	PageStartAddress = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(ValidPage * PAGE_SIZE));
+	Address = PageStartAddress;
+
+	/* Skip the part of the page that is known to be used */
+	if (m_free_addr[ValidPage] > Address)
+	{
+		Address = m_free_addr[ValidPage];
+	}
 
 	/* Get the valid Page end Address */
 	PageEndAddress = (uint32_t)((EEPROM_START_ADDRESS - 2) + (uint32_t)((1 + ValidPage) * PAGE_SIZE));
@@ -540,6 +668,16 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Da
 			}
 			/* Set variable virtual address */
 			FlashStatus = FLASH_ProgramHalfWord(Address + 2, VirtAddress);
+			/* Keep the free address and the index up to date */
+			m_free_addr[ValidPage] = Address + 4;
+			if (FlashStatus == FLASH_COMPLETE && ValidPage == m_index_page)
+			{
+				VarIdx = EE_VarIndex(VirtAddress);
+				if (VarIdx >= 0)
+				{
+					m_var_slot[VarIdx] = (uint16_t)((Address - PageStartAddress) / 4);
+				}
+			}
 			/* Return program operation status */
 			return FlashStatus;
 		}
@@ -557,20 +695,21 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Da
 /**
  * @brief  Transfers last updated variables data from the full Page to
  *   an empty one.
- * @param  VirtAddress: 16 bit virtual address of the variable
- * @param  Data: 16 bit data to be written as variable value
+ * @param  VirtAddress: 16 bit virtual addresses of the variables
+ * @param  Data: 16 bit data to be written as variable values
+ * @param  Num: Number of variables to write
  * @retval Success or error status:
  *           - FLASH_COMPLETE: on success
  *           - PAGE_FULL: if valid page is full
  *           - NO_VALID_PAGE: if no valid page was found
  *           - Flash error code: on write Flash error
  */
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
+static uint16_t EE_PageTransfer(const uint16_t *VirtAddress, const uint16_t *Data, uint16_t Num)
 {
 	FLASH_Status FlashStatus = FLASH_COMPLETE;
 	uint32_t NewPageAddress = EEPROM_START_ADDRESS;
 	uint16_t OldPageId=0;
-	uint16_t ValidPage = PAGE0, VarIdx = 0;
+	uint16_t ValidPage = PAGE0, VarIdx = 0, NewIdx = 0;
 	uint16_t EepromStatus = 0, ReadStatus = 0;
 
 	/* Get active Page for read operation */
@@ -605,18 +744,30 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
 		return FlashStatus;
 	}
 
-	/* Write the variable passed as parameter in the new active page */
-	EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
-	/* If program operation was failed, a Flash error code is returned */
-	if (EepromStatus != FLASH_COMPLETE)
+	/* Write the variables passed as parameter in the new active page */
+	for (NewIdx = 0; NewIdx < Num; NewIdx++)
 	{
-		return EepromStatus;
+		EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddress[NewIdx], Data[NewIdx]);
+		/* If program operation was failed, a Flash error code is returned */
+		if (EepromStatus != FLASH_COMPLETE)
+		{
+			return EepromStatus;
+		}
 	}
 
 	/* Transfer process: transfer variables from old to the new active page */
 	for (VarIdx = 0; VarIdx < NB_OF_VAR; VarIdx++)
 	{
-		if (VirtAddVarTab[VarIdx] != VirtAddress)  /* Check each variable except the one passed as parameter */
+		/* Check each variable except the ones passed as parameter */
+		for (NewIdx = 0; NewIdx < Num; NewIdx++)
+		{
+			if (VirtAddVarTab[VarIdx] == VirtAddress[NewIdx])
+			{
+				break;
+			}
+		}
+
+		if (NewIdx == Num)
 		{
 			/* Read the other last variable updates */
 			ReadStatus = EE_ReadVariable(VirtAddVarTab[VarIdx], &DataVar);
@@ -650,6 +801,9 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
 		return FlashStatus;
 	}
 
+	/* Index the new active page */
+	EE_BuildIndex();
+
 	/* Return last operation flash status */
 	return FlashStatus;
 }
@@ -660,6 +814,13 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
  */
 static uint16_t EE_EraseSectorIfNotEmpty(uint32_t FLASH_Sector, uint8_t VoltageRange) {
 	uint8_t *addr = EE_get_sector_address(FLASH_Sector);
+	uint16_t page = FLASH_Sector == PAGE0_ID ? PAGE0 : PAGE1;
+
+	/* The page is empty after this, so forget what is known about it */
+	m_free_addr[page] = 0;
+	if (m_index_page == page) {
+		m_index_page = NO_VALID_PAGE;
+	}
 
 	for (unsigned int i = 0;i < PAGE_SIZE;i++) {
 		if (addr[i] != 0xFF) {
@@ -683,6 +844,79 @@ static uint8_t* EE_get_sector_address(uint32_t fsector) {
 	return res;
 }
 
+/*
+ * Get the index of a virtual address in VirtAddVarTab, or -1 if it is not
+ * there. The addresses are consecutive, so the first guess is almost always
+ * right.
+ */
+static int EE_VarIndex(uint16_t VirtAddress) {
+	int ind = (int)VirtAddress - (int)VirtAddVarTab[0];
+
+	if (ind >= 0 && ind < NB_OF_VAR && VirtAddVarTab[ind] == VirtAddress) {
+		return ind;
+	}
+
+	for (int i = 0;i < NB_OF_VAR;i++) {
+		if (VirtAddVarTab[i] == VirtAddress) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Scan the valid page once from the start. Later copies of a variable
+ * replace earlier ones in the index, and the free address ends up right
+ * after the last used slot.
+ */
+static void EE_BuildIndex(void) {
+	memset(m_var_slot, 0, sizeof(m_var_slot));
+	m_index_page = EE_FindValidPage(READ_FROM_VALID_PAGE);
+
+	if (m_index_page == NO_VALID_PAGE) {
+		return;
+	}
+
+	uint32_t page_start = EEPROM_START_ADDRESS + (uint32_t)m_index_page * PAGE_SIZE;
+	uint32_t free_addr = page_start + 4;
+
+	/* Slot 0 holds the page status */
+	for (uint16_t slot = 1;slot < (PAGE_SIZE / 4);slot++) {
+		uint32_t addr = page_start + (uint32_t)slot * 4;
+
+		if ((*(__IO uint32_t*)addr) == 0xFFFFFFFF) {
+			continue;
+		}
+
+		free_addr = addr + 4;
+
+		int ind = EE_VarIndex(*(__IO uint16_t*)(addr + 2));
+		if (ind >= 0) {
+			m_var_slot[ind] = slot;
+		}
+	}
+
+	m_free_addr[m_index_page] = free_addr;
+}
+
+/*
+ * Number of free slots at the end of a page.
+ */
+static uint16_t EE_FreeSlots(uint16_t Page) {
+	uint32_t page_start = EEPROM_START_ADDRESS + (uint32_t)Page * PAGE_SIZE;
+	uint32_t page_end = page_start + PAGE_SIZE;
+	uint32_t addr = m_free_addr[Page] > page_start ? m_free_addr[Page] : page_start;
+
+	while (addr < page_end && (*(__IO uint32_t*)addr) != 0xFFFFFFFF) {
+		addr += 4;
+	}
+
+	m_free_addr[Page] = addr;
+
+	return (uint16_t)((page_end - addr) / 4);
+}
+
 /**
  * @}
  */
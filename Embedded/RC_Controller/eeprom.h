@@ -78,6 +78,7 @@
 uint16_t EE_Init(void);
 uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data);
 uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data);
+uint16_t EE_WriteVariables(const uint16_t *VirtAddress, const uint16_t *Data, uint16_t Num);
 
 #endif /* __EEPROM_H */
 
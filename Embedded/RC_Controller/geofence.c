@@ -0,0 +1,217 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "geofence.h"
+#include "pos.h"
+#include "stats.h"
+#include "commands.h"
+#include "terminal.h"
+
+#include <string.h>
+#include <math.h>
+
+// Settings
+#define BENCH_ITERATIONS			10000
+
+// Private variables
+// Two rasters, so that a new fence can be built while the old one is in use
+static geofence_raster_t m_rasters[2];
+static volatile int m_raster_now;
+static volatile bool m_enabled;
+static volatile bool m_was_inside;
+static volatile bool m_brake_latched;
+static volatile uint32_t m_violations;
+static volatile uint32_t m_checks;
+static volatile uint32_t m_check_cycles_max;
+static volatile uint64_t m_check_cycles_tot;
+static mutex_t m_set_lock;
+
+// Private functions
+static void terminal_cmd_geofence(int argc, const char **argv);
+
+void geofence_init(void) {
+	m_raster_now = 0;
+	m_enabled = false;
+	m_was_inside = true;
+	m_brake_latched = false;
+	m_violations = 0;
+	m_checks = 0;
+	m_check_cycles_max = 0;
+	m_check_cycles_tot = 0;
+	chMtxObjectInit(&m_set_lock);
+
+	terminal_register_command_callback(
+			"geofence",
+			"Print the geofence state and the cost of the containment check. Use "
+			"geofence bench to time the raster lookup.",
+			"[bench]",
+			terminal_cmd_geofence);
+}
+
+/**
+ * Set a new geofence. The polygon is rasterised once here, so that checking
+ * the position later is constant time.
+ *
+ * @param px
+ * The x coordinates of the polygon corners in the local ENU frame.
+ *
+ * @param py
+ * The y coordinates of the polygon corners in the local ENU frame.
+ *
+ * @param n
+ * The number of corners. 0 disables the geofence.
+ *
+ * @return
+ * True on success. If the polygon is invalid the old fence is kept.
+ */
+bool geofence_set(const float *px, const float *py, int n) {
+	if (n == 0) {
+		m_enabled = false;
+		return true;
+	}
+
+	chMtxLock(&m_set_lock);
+
+	int next = m_raster_now ^ 1;
+	bool res = geofence_raster_build(&m_rasters[next], px, py, n);
+
+	if (res) {
+		m_raster_now = next;
+		m_enabled = true;
+		m_was_inside = true;
+	}
+
+	chMtxUnlock(&m_set_lock);
+
+	return res;
+}
+
+bool geofence_is_enabled(void) {
+	return m_enabled;
+}
+
+/**
+ * Check if the current position is inside the geofence. This is meant to be
+ * called on every control tick.
+ *
+ * @return
+ * True if the position is inside the fence or if there is no fence.
+ */
+bool geofence_check_pos(void) {
+	if (!m_enabled) {
+		return true;
+	}
+
+	uint32_t start = STATS_CYCLES_NOW();
+
+	POS_STATE pos;
+	pos_get_pos(&pos);
+	bool inside = geofence_raster_inside(&m_rasters[m_raster_now], pos.px, pos.py);
+
+	uint32_t cycles = STATS_CYCLES_NOW() - start;
+
+	chSysLock();
+	m_checks++;
+	m_check_cycles_tot += cycles;
+	if (cycles > m_check_cycles_max) {
+		m_check_cycles_max = cycles;
+	}
+	if (!inside) {
+		m_violations++;
+	}
+	chSysUnlock();
+
+	return inside;
+}
+
+/**
+ * Check if a manual command should be replaced by braking. When the car
+ * leaves the fence it is braked until it has stopped. After that manual
+ * control is given back, so that the operator can drive the car back
+ * inside. The next exit brakes the car again.
+ *
+ * @return
+ * True if the car should brake.
+ */
+bool geofence_manual_brake(void) {
+	bool inside = geofence_check_pos();
+
+	if (!inside && m_was_inside) {
+		m_brake_latched = true;
+	}
+
+	m_was_inside = inside;
+
+	if (m_brake_latched) {
+		POS_STATE pos;
+		pos_get_pos(&pos);
+
+		if (inside || fabsf(pos.speed) < GEOFENCE_STOPPED_SPEED) {
+			m_brake_latched = false;
+		}
+	}
+
+	return m_brake_latched;
+}
+
+static void terminal_cmd_geofence(int argc, const char **argv) {
+	const geofence_raster_t *r = &m_rasters[m_raster_now];
+
+	if (argc == 2 && strcmp(argv[1], "bench") == 0) {
+		if (!m_enabled) {
+			commands_printf("No geofence set\n");
+			return;
+		}
+
+		// Walk over the bounding box of the fence and some space around it
+		const float span_x = (float)(r->w + 2) * r->cell;
+		const float span_y = (float)(r->h + 2) * r->cell;
+		int inside = 0;
+
+		uint32_t start = STATS_CYCLES_NOW();
+		for (int i = 0;i < BENCH_ITERATIONS;i++) {
+			float x = r->x_min - r->cell + span_x * (float)(i % 100) / 100.0;
+			float y = r->y_min - r->cell + span_y * (float)(i / 100) / 100.0;
+			inside += geofence_raster_inside(r, x, y);
+		}
+		uint32_t cycles = STATS_CYCLES_NOW() - start;
+
+		commands_printf("%d lookups, %d inside: %.1f cycles (%.3f us) per lookup\n",
+				BENCH_ITERATIONS, inside,
+				(double)cycles / (double)BENCH_ITERATIONS,
+				(double)(STATS_CYCLES_TO_US(cycles) / (float)BENCH_ITERATIONS));
+		return;
+	}
+
+	if (!m_enabled) {
+		commands_printf("Geofence disabled\n");
+		return;
+	}
+
+	commands_printf("Geofence enabled");
+	commands_printf("Raster: %d x %d cells of %.3f m, origin (%.2f, %.2f)",
+			r->w, r->h, (double)r->cell, (double)r->x_min, (double)r->y_min);
+	commands_printf("Checks: %u, violations: %u", m_checks, m_violations);
+
+	if (m_checks > 0) {
+		commands_printf("Check time avg: %.2f us, max: %.2f us",
+				(double)STATS_CYCLES_TO_US(m_check_cycles_tot / m_checks),
+				(double)STATS_CYCLES_TO_US(m_check_cycles_max));
+	}
+
+	commands_printf(" ");
+}
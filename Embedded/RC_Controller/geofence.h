@@ -0,0 +1,36 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GEOFENCE_H_
+#define GEOFENCE_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "geofence_raster.h"
+
+// Settings
+#define GEOFENCE_BRAKE_CURRENT		10.0
+#define GEOFENCE_STOPPED_SPEED		0.2 // Manual control is given back below this speed (m/s)
+
+// Functions
+void geofence_init(void);
+bool geofence_set(const float *px, const float *py, int n);
+bool geofence_is_enabled(void);
+bool geofence_check_pos(void);
+bool geofence_manual_brake(void);
+
+#endif /* GEOFENCE_H_ */
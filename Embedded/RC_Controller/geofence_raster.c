@@ -0,0 +1,187 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "geofence_raster.h"
+#include <math.h>
+#include <string.h>
+
+// Private functions
+static void set_cell(geofence_raster_t *r, int ix, int iy, bool inside);
+static void clear_edge(geofence_raster_t *r, float x0, float y0, float x1, float y1);
+
+/**
+ * Rasterise a polygon into a bitmap. The raster covers the bounding box of
+ * the polygon, with square cells that are as small as the raster size
+ * allows. A cell is inside when its center is inside the polygon (even-odd
+ * rule) and no polygon edge touches it. A cell that no edge touches is
+ * either completely inside or completely outside, so every cell that is
+ * inside is completely inside the polygon.
+ *
+ * @param r
+ * The raster to build.
+ *
+ * @param px
+ * The x coordinates of the polygon corners.
+ *
+ * @param py
+ * The y coordinates of the polygon corners.
+ *
+ * @param n
+ * The number of corners. The polygon is closed implicitly.
+ *
+ * @return
+ * True on success, false if the polygon is invalid.
+ */
+bool geofence_raster_build(geofence_raster_t *r, const float *px, const float *py, int n) {
+	if (n < 3 || n > GEOFENCE_MAX_POINTS) {
+		return false;
+	}
+
+	float x_min = px[0], x_max = px[0];
+	float y_min = py[0], y_max = py[0];
+
+	for (int i = 1;i < n;i++) {
+		if (px[i] < x_min) x_min = px[i];
+		if (px[i] > x_max) x_max = px[i];
+		if (py[i] < y_min) y_min = py[i];
+		if (py[i] > y_max) y_max = py[i];
+	}
+
+	float cell = (x_max - x_min) / (float)GEOFENCE_RASTER_W;
+	if ((y_max - y_min) / (float)GEOFENCE_RASTER_H > cell) {
+		cell = (y_max - y_min) / (float)GEOFENCE_RASTER_H;
+	}
+
+	if (cell < GEOFENCE_MIN_CELL) {
+		cell = GEOFENCE_MIN_CELL;
+	}
+
+	memset(r->bits, 0, sizeof(r->bits));
+	r->x_min = x_min;
+	r->y_min = y_min;
+	r->cell = cell;
+	r->cell_inv = 1.0 / cell;
+	r->w = (int)ceilf((x_max - x_min) / cell);
+	r->h = (int)ceilf((y_max - y_min) / cell);
+
+	if (r->w > GEOFENCE_RASTER_W) {
+		r->w = GEOFENCE_RASTER_W;
+	}
+
+	if (r->h > GEOFENCE_RASTER_H) {
+		r->h = GEOFENCE_RASTER_H;
+	}
+
+	// Scanline fill through the cell centers
+	float crossings[GEOFENCE_MAX_POINTS];
+
+	for (int iy = 0;iy < r->h;iy++) {
+		const float yc = y_min + ((float)iy + 0.5) * cell;
+		int cnum = 0;
+
+		for (int i = 0;i < n;i++) {
+			int j = (i + 1) % n;
+
+			if ((py[i] <= yc) != (py[j] <= yc)) {
+				float x = px[i] + (yc - py[i]) / (py[j] - py[i]) * (px[j] - px[i]);
+
+				// Insertion sort, there are only a few crossings
+				int k = cnum++;
+				while (k > 0 && crossings[k - 1] > x) {
+					crossings[k] = crossings[k - 1];
+					k--;
+				}
+				crossings[k] = x;
+			}
+		}
+
+		for (int i = 0;(i + 1) < cnum;i += 2) {
+			int ix0 = (int)ceilf((crossings[i] - x_min) / cell - 0.5);
+			int ix1 = (int)floorf((crossings[i + 1] - x_min) / cell - 0.5);
+
+			for (int ix = ix0;ix <= ix1;ix++) {
+				set_cell(r, ix, iy, true);
+			}
+		}
+	}
+
+	// Clear every cell that an edge touches
+	for (int i = 0;i < n;i++) {
+		int j = (i + 1) % n;
+		clear_edge(r,
+				(px[i] - x_min) * r->cell_inv, (py[i] - y_min) * r->cell_inv,
+				(px[j] - x_min) * r->cell_inv, (py[j] - y_min) * r->cell_inv);
+	}
+
+	return true;
+}
+
+/*
+ * Clear all cells that a segment touches (supercover), with the segment
+ * in cell units. Within one row of cells the segment covers an x interval,
+ * and every cell that overlaps that interval is touched. The interval is
+ * widened a little so that rounding never leaves a touched cell set.
+ */
+static void clear_edge(geofence_raster_t *r, float x0, float y0, float x1, float y1) {
+	const float eps = 1e-3;
+
+	if (y0 > y1) {
+		float t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+
+	const int iy0 = (int)floorf(y0 - eps);
+	const int iy1 = (int)floorf(y1 + eps);
+	const float dxdy = y1 > y0 ? (x1 - x0) / (y1 - y0) : 0.0;
+
+	for (int iy = iy0;iy <= iy1;iy++) {
+		float xa, xb;
+
+		if (y1 > y0) {
+			float ya = (float)iy < y0 ? y0 : (float)iy;
+			float yb = (float)(iy + 1) > y1 ? y1 : (float)(iy + 1);
+			xa = x0 + (ya - y0) * dxdy;
+			xb = x0 + (yb - y0) * dxdy;
+		} else {
+			xa = x0;
+			xb = x1;
+		}
+
+		if (xa > xb) {
+			float t = xa; xa = xb; xb = t;
+		}
+
+		const int ix1 = (int)floorf(xb + eps);
+		for (int ix = (int)floorf(xa - eps);ix <= ix1;ix++) {
+			set_cell(r, ix, iy, false);
+		}
+	}
+}
+
+static void set_cell(geofence_raster_t *r, int ix, int iy, bool inside) {
+	if (ix < 0 || iy < 0 || ix >= r->w || iy >= r->h) {
+		return;
+	}
+
+	int bit = iy * GEOFENCE_RASTER_W + ix;
+
+	if (inside) {
+		r->bits[bit >> 5] |= (1u << (bit & 31));
+	} else {
+		r->bits[bit >> 5] &= ~(1u << (bit & 31));
+	}
+}
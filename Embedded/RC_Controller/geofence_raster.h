@@ -0,0 +1,77 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GEOFENCE_RASTER_H_
+#define GEOFENCE_RASTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// This file does not depend on ChibiOS, so that it can be compiled and
+// tested on the host.
+
+// Settings
+#define GEOFENCE_RASTER_W			128
+#define GEOFENCE_RASTER_H			128
+#define GEOFENCE_MAX_POINTS			64
+#define GEOFENCE_MIN_CELL			0.05
+
+typedef struct {
+	float x_min;
+	float y_min;
+	float cell;
+	float cell_inv;
+	int w;
+	int h;
+	uint32_t bits[(GEOFENCE_RASTER_W * GEOFENCE_RASTER_H) / 32];
+} geofence_raster_t;
+
+// Functions
+bool geofence_raster_build(geofence_raster_t *r, const float *px, const float *py, int n);
+
+/**
+ * Check if a position is inside the fence. This is constant time.
+ *
+ * @param r
+ * The raster.
+ *
+ * @param x
+ * The x position in the local ENU frame.
+ *
+ * @param y
+ * The y position in the local ENU frame.
+ *
+ * @return
+ * True if the position is inside the fence.
+ */
+static inline bool geofence_raster_inside(const geofence_raster_t *r, float x, float y) {
+	if (x < r->x_min || y < r->y_min) {
+		return false;
+	}
+
+	int ix = (int)((x - r->x_min) * r->cell_inv);
+	int iy = (int)((y - r->y_min) * r->cell_inv);
+
+	if (ix >= r->w || iy >= r->h) {
+		return false;
+	}
+
+	int bit = iy * GEOFENCE_RASTER_W + ix;
+	return r->bits[bit >> 5] & (1u << (bit & 31));
+}
+
+#endif /* GEOFENCE_RASTER_H_ */
@@ -0,0 +1,227 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "imu_capture.h"
+#include "commands.h"
+#include "packet.h"
+#include "buffer.h"
+#include "datatypes.h"
+#include "conf_general.h"
+#include "terminal.h"
+#include "stats.h"
+#include "ringbuf.h"
+
+#include <string.h>
+
+// Settings
+#define RING_LEN					256
+#define BATCH_MAX					40
+#define SEND_INTERVAL_MS			10
+
+typedef struct {
+	uint32_t time_us;
+	int16_t raw[9];
+} imu_sample_t;
+
+// Private variables
+static imu_sample_t m_ring[RING_LEN];
+static ringbuf_t m_ring_rb;
+static volatile bool m_enabled;
+static volatile bool m_flush_pending;
+static volatile int m_decimation;
+static int m_decimation_cnt;
+static uint32_t m_time_us;
+static volatile uint32_t m_samples;
+static volatile uint32_t m_dropped;
+static uint16_t m_seq;
+static uint8_t m_send_buffer[PACKET_MAX_PL_LEN];
+
+// Threads
+static THD_WORKING_AREA(capture_thread_wa, 512);
+static THD_FUNCTION(capture_thread, arg);
+
+// Private functions
+static void send_batch(void);
+static void terminal_cmd_imu_capture(int argc, const char **argv);
+
+void imu_capture_init(void) {
+	ringbuf_init(&m_ring_rb, m_ring, sizeof(imu_sample_t), RING_LEN);
+	m_enabled = false;
+	m_flush_pending = false;
+	m_decimation = 1;
+	m_decimation_cnt = 0;
+	m_time_us = 0;
+	m_samples = 0;
+	m_dropped = 0;
+	m_seq = 0;
+
+	stats_register_queue(STATS_QUEUE_IMU_CAPTURE, &m_ring_rb);
+
+	chThdCreateStatic(capture_thread_wa, sizeof(capture_thread_wa),
+			NORMALPRIO, capture_thread, NULL);
+
+	terminal_register_command_callback(
+			"imu_capture",
+			"Print the state of the raw IMU capture stream.",
+			0,
+			terminal_cmd_imu_capture);
+}
+
+/**
+ * Start or stop the raw IMU capture. The samples are sent in batches to the
+ * last used send function in commands.
+ *
+ * @param enabled
+ * Enable or disable capturing.
+ *
+ * @param decimation
+ * Capture every n:th IMU sample. 1 captures at the full rate.
+ */
+void imu_capture_set(bool enabled, int decimation) {
+	if (decimation < 1) {
+		decimation = 1;
+	} else if (decimation > IMU_CAPTURE_DECIMATION_MAX) {
+		decimation = IMU_CAPTURE_DECIMATION_MAX;
+	}
+
+	// The producer is idle while capturing is disabled, so its state can be
+	// reset here. Old samples are dropped by the capture thread, as it is
+	// the only one that may move the read side of the ring.
+	chSysLock();
+	if (enabled && !m_enabled) {
+		m_decimation_cnt = 0;
+		m_time_us = 0;
+		m_samples = 0;
+		m_dropped = 0;
+		ringbuf_reset_stats(&m_ring_rb);
+		m_flush_pending = true;
+	}
+	m_decimation = decimation;
+	m_enabled = enabled;
+	chSysUnlock();
+}
+
+bool imu_capture_is_enabled(void) {
+	return m_enabled;
+}
+
+/**
+ * Add a raw IMU sample to the capture ring. This is meant to be called from
+ * the IMU read callback, and it must not be called from more than one thread.
+ *
+ * @param raw
+ * Accelerometer, gyro and magnetometer values as read from the MPU9150.
+ *
+ * @param dt_us
+ * Time since the previous IMU sample in microseconds.
+ */
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us) {
+	// Wait for the capture thread to drop the samples of the previous capture
+	if (!m_enabled || m_flush_pending) {
+		return;
+	}
+
+	m_time_us += dt_us;
+
+	m_decimation_cnt++;
+	if (m_decimation_cnt < m_decimation) {
+		return;
+	}
+	m_decimation_cnt = 0;
+
+	imu_sample_t *s = ringbuf_write_slot(&m_ring_rb);
+	if (!s) {
+		m_dropped++;
+		return;
+	}
+
+	s->time_us = m_time_us;
+	memcpy(s->raw, raw, sizeof(s->raw));
+	ringbuf_commit(&m_ring_rb);
+	m_samples++;
+}
+
+static THD_FUNCTION(capture_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("IMU capture");
+
+	for(;;) {
+		chThdSleepMilliseconds(SEND_INTERVAL_MS);
+
+		if (m_flush_pending) {
+			ringbuf_flush(&m_ring_rb);
+			m_seq = 0;
+			m_flush_pending = false;
+		}
+
+		while (!ringbuf_is_empty(&m_ring_rb)) {
+			send_batch();
+		}
+	}
+}
+
+/*
+ * Packet layout: sequence number, total number of dropped samples, number
+ * of samples and the time of the first sample. Every sample then has the
+ * time since the previous sample in microseconds and the nine raw values.
+ */
+static void send_batch(void) {
+	int32_t ind = 0;
+	m_send_buffer[ind++] = main_id;
+	m_send_buffer[ind++] = CMD_IMU_CAPTURE_DATA;
+	buffer_append_uint16(m_send_buffer, m_seq++, &ind);
+	buffer_append_uint32(m_send_buffer, m_dropped, &ind);
+
+	int num_ind = ind++;
+	int num = 0;
+	const imu_sample_t *s = ringbuf_read_slot(&m_ring_rb);
+	uint32_t time_last = s->time_us;
+	buffer_append_uint32(m_send_buffer, time_last, &ind);
+
+	while (s && num < BATCH_MAX) {
+		uint32_t dt = s->time_us - time_last;
+		if (dt > 65535) {
+			dt = 65535;
+		}
+		time_last = s->time_us;
+
+		buffer_append_uint16(m_send_buffer, dt, &ind);
+		for (int i = 0;i < 9;i++) {
+			buffer_append_int16(m_send_buffer, s->raw[i], &ind);
+		}
+
+		ringbuf_release(&m_ring_rb);
+		s = ringbuf_read_slot(&m_ring_rb);
+		num++;
+	}
+
+	m_send_buffer[num_ind] = num;
+	commands_send_packet(m_send_buffer, ind);
+}
+
+static void terminal_cmd_imu_capture(int argc, const char **argv) {
+	(void)argc;
+	(void)argv;
+
+	commands_printf("IMU capture %s", m_enabled ? "enabled" : "disabled");
+	commands_printf("Decimation: %d", m_decimation);
+	commands_printf("Samples: %u, dropped: %u", m_samples, m_dropped);
+	commands_printf("Ring: %u / %u, hwm: %u",
+			ringbuf_level(&m_ring_rb), RING_LEN - 1, ringbuf_high_water(&m_ring_rb));
+	commands_printf(" ");
+}
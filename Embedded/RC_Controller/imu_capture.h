@@ -0,0 +1,33 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMU_CAPTURE_H_
+#define IMU_CAPTURE_H_
+
+#include "ch.h"
+#include "hal.h"
+
+// Settings
+#define IMU_CAPTURE_DECIMATION_MAX		50
+
+// Functions
+void imu_capture_init(void);
+void imu_capture_set(bool enabled, int decimation);
+bool imu_capture_is_enabled(void);
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us);
+
+#endif /* IMU_CAPTURE_H_ */
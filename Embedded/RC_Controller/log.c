@@ -231,6 +231,13 @@ static THD_FUNCTION(log_thread, arg) {
 			} else if (m_dw_anchor_now == 2 && LOG_DW_ANCHOR2 >= 0) {
 				comm_can_dw_range(CAN_DW_ID_ANY, LOG_DW_ANCHOR2, 5);
 			} else if (m_dw_anchor_now >= 3) {
+#if LOG_DW_SEND_ALL
+				for (int i = 0;i < 3;i++) {
+					if (m_dw_anchor_info[i].valid) {
+						commands_send_dw_sample(&m_dw_anchor_info[i]);
+					}
+				}
+#else
 				int closest = -1;
 				float min_dist = 1e20;
 
@@ -245,6 +252,7 @@ static THD_FUNCTION(log_thread, arg) {
 				if (closest >= 0) {
 					commands_send_dw_sample(&m_dw_anchor_info[closest]);
 				}
+#endif
 
 				m_dw_anchor_now = -1;
 			}
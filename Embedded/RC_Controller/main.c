@@ -47,6 +47,9 @@
 #include "srf10.h"
 #include "pwm_esc.h"
 #include "mr_control.h"
+#include "stats.h"
+#include "imu_capture.h"
+#include "geofence.h"
 
 /*
  * Timers used:
@@ -79,14 +82,17 @@ int main(void) {
 
 	led_init();
 	ext_cb_init();
+	stats_init();
 
 #if MAIN_MODE == MAIN_MODE_CAR
 	conf_general_init();
 	adconv_init();
 	servo_simple_init();
 	pos_init();
+	imu_capture_init();
 	comm_can_init();
 	autopilot_init();
+	geofence_init();
 	timeout_init();
 	log_init();
 #if RADAR_EN
@@ -101,6 +107,9 @@ int main(void) {
 	srf10_init();
 	pwm_esc_init();
 	pos_init();
+	imu_capture_init();
+	autopilot_init();
+	geofence_init();
 	mr_control_init();
 #endif
 
@@ -0,0 +1,187 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAIN_CONFIG_SCHEMA_H_
+#define MAIN_CONFIG_SCHEMA_H_
+
+/*
+ * Wire format of MAIN_CONFIG. This is the only description of it: the
+ * encoders and decoders in the firmware and in the Linux programs are
+ * expanded from the field list below, so this file is included from there as
+ * well and must only contain plain C. It has to be included after
+ * datatypes.h.
+ *
+ * A packet starts with a header:
+ *   uint8  MAIN_CONFIG_SCHEMA_VERSION
+ *   uint8  Number of fields the sender knows about
+ *   uint8  Field mask, one bit per field, (field number + 7) / 8 bytes
+ * followed by the fields that are set in the mask, in field id order. Every
+ * field has a fixed size on the wire.
+ *
+ * Single fields can be read and written with the same encoding and a mask
+ * with only those fields set:
+ *   CMD_GET_MAIN_CONFIG_HASH:   reply uint16 hash
+ *   CMD_GET_MAIN_CONFIG_FIELDS: request header with the field mask, reply
+ *                               uint16 hash followed by the requested fields
+ *   CMD_SET_MAIN_CONFIG_FIELDS: request uint16 hash of the configuration the
+ *                               changes are based on, followed by the changed
+ *                               fields. Reply uint8 MAIN_CONFIG_SET_RESULT
+ *                               and the uint16 hash after the update.
+ * The hash is the CRC16 of the full encoding of the configuration, so it is
+ * the same on both sides. All fields in CMD_SET_MAIN_CONFIG_FIELDS are
+ * applied together, or none of them if the hash does not match.
+ *
+ * Rules for changing the list:
+ * - New fields are only added at the end. The position in the list is the
+ *   field id, so fields must never be reordered or removed. A receiver
+ *   ignores fields at the end that it does not know about, and keeps its
+ *   old value for fields that are missing in the packet.
+ * - Changes that can not follow these rules require a new schema version.
+ */
+
+#define MAIN_CONFIG_SCHEMA_VERSION			1
+
+// Size on the wire for each field type
+#define MAIN_CONFIG_WIRE_SIZE_BOOL			1
+#define MAIN_CONFIG_WIRE_SIZE_INT8			1
+#define MAIN_CONFIG_WIRE_SIZE_UINT16		2
+#define MAIN_CONFIG_WIRE_SIZE_INT32			4
+#define MAIN_CONFIG_WIRE_SIZE_FLOAT			4
+#define MAIN_CONFIG_WIRE_SIZE_NAME			(LOG_NAME_MAX_LEN + 1)
+
+// X(field id, type, MAIN_CONFIG member)
+#define MAIN_CONFIG_FIELDS(X) \
+	X(MAG_USE, BOOL, mag_use) \
+	X(MAG_COMP, BOOL, mag_comp) \
+	X(YAW_MAG_GAIN, FLOAT, yaw_mag_gain) \
+	X(MAG_CAL_CX, FLOAT, mag_cal_cx) \
+	X(MAG_CAL_CY, FLOAT, mag_cal_cy) \
+	X(MAG_CAL_CZ, FLOAT, mag_cal_cz) \
+	X(MAG_CAL_XX, FLOAT, mag_cal_xx) \
+	X(MAG_CAL_XY, FLOAT, mag_cal_xy) \
+	X(MAG_CAL_XZ, FLOAT, mag_cal_xz) \
+	X(MAG_CAL_YX, FLOAT, mag_cal_yx) \
+	X(MAG_CAL_YY, FLOAT, mag_cal_yy) \
+	X(MAG_CAL_YZ, FLOAT, mag_cal_yz) \
+	X(MAG_CAL_ZX, FLOAT, mag_cal_zx) \
+	X(MAG_CAL_ZY, FLOAT, mag_cal_zy) \
+	X(MAG_CAL_ZZ, FLOAT, mag_cal_zz) \
+	X(GPS_ANT_X, FLOAT, gps_ant_x) \
+	X(GPS_ANT_Y, FLOAT, gps_ant_y) \
+	X(GPS_COMP, BOOL, gps_comp) \
+	X(GPS_REQ_RTK, BOOL, gps_req_rtk) \
+	X(GPS_CORR_GAIN_STAT, FLOAT, gps_corr_gain_stat) \
+	X(GPS_CORR_GAIN_DYN, FLOAT, gps_corr_gain_dyn) \
+	X(GPS_CORR_GAIN_YAW, FLOAT, gps_corr_gain_yaw) \
+	X(GPS_SEND_NMEA, BOOL, gps_send_nmea) \
+	X(GPS_USE_UBX_INFO, BOOL, gps_use_ubx_info) \
+	X(GPS_UBX_MAX_ACC, FLOAT, gps_ubx_max_acc) \
+	X(AP_REPEAT_ROUTES, BOOL, ap_repeat_routes) \
+	X(AP_BASE_RAD, FLOAT, ap_base_rad) \
+	X(AP_MODE_TIME, BOOL, ap_mode_time) \
+	X(AP_MAX_SPEED, FLOAT, ap_max_speed) \
+	X(AP_TIME_ADD_REPEAT_MS, INT32, ap_time_add_repeat_ms) \
+	X(LOG_EN, BOOL, log_en) \
+	X(LOG_NAME, NAME, log_name) \
+	X(CAR_YAW_USE_ODOMETRY, BOOL, car.yaw_use_odometry) \
+	X(CAR_YAW_IMU_GAIN, FLOAT, car.yaw_imu_gain) \
+	X(CAR_DISABLE_MOTOR, BOOL, car.disable_motor) \
+	X(CAR_GEAR_RATIO, FLOAT, car.gear_ratio) \
+	X(CAR_WHEEL_DIAM, FLOAT, car.wheel_diam) \
+	X(CAR_MOTOR_POLES, FLOAT, car.motor_poles) \
+	X(CAR_STEERING_MAX_ANGLE_RAD, FLOAT, car.steering_max_angle_rad) \
+	X(CAR_STEERING_CENTER, FLOAT, car.steering_center) \
+	X(CAR_STEERING_RANGE, FLOAT, car.steering_range) \
+	X(CAR_STEERING_RAMP_TIME, FLOAT, car.steering_ramp_time) \
+	X(CAR_AXIS_DISTANCE, FLOAT, car.axis_distance) \
+	X(MR_VEL_DECAY_E, FLOAT, mr.vel_decay_e) \
+	X(MR_VEL_DECAY_L, FLOAT, mr.vel_decay_l) \
+	X(MR_VEL_MAX, FLOAT, mr.vel_max) \
+	X(MR_MAP_MIN_X, FLOAT, mr.map_min_x) \
+	X(MR_MAP_MAX_X, FLOAT, mr.map_max_x) \
+	X(MR_MAP_MIN_Y, FLOAT, mr.map_min_y) \
+	X(MR_MAP_MAX_Y, FLOAT, mr.map_max_y) \
+	X(MR_VEL_GAIN_P, FLOAT, mr.vel_gain_p) \
+	X(MR_VEL_GAIN_I, FLOAT, mr.vel_gain_i) \
+	X(MR_VEL_GAIN_D, FLOAT, mr.vel_gain_d) \
+	X(MR_TILT_GAIN_P, FLOAT, mr.tilt_gain_p) \
+	X(MR_TILT_GAIN_I, FLOAT, mr.tilt_gain_i) \
+	X(MR_TILT_GAIN_D, FLOAT, mr.tilt_gain_d) \
+	X(MR_MAX_CORR_ERROR, FLOAT, mr.max_corr_error) \
+	X(MR_MAX_TILT_ERROR, FLOAT, mr.max_tilt_error) \
+	X(MR_CTRL_GAIN_ROLL_P, FLOAT, mr.ctrl_gain_roll_p) \
+	X(MR_CTRL_GAIN_ROLL_I, FLOAT, mr.ctrl_gain_roll_i) \
+	X(MR_CTRL_GAIN_ROLL_DP, FLOAT, mr.ctrl_gain_roll_dp) \
+	X(MR_CTRL_GAIN_ROLL_DE, FLOAT, mr.ctrl_gain_roll_de) \
+	X(MR_CTRL_GAIN_PITCH_P, FLOAT, mr.ctrl_gain_pitch_p) \
+	X(MR_CTRL_GAIN_PITCH_I, FLOAT, mr.ctrl_gain_pitch_i) \
+	X(MR_CTRL_GAIN_PITCH_DP, FLOAT, mr.ctrl_gain_pitch_dp) \
+	X(MR_CTRL_GAIN_PITCH_DE, FLOAT, mr.ctrl_gain_pitch_de) \
+	X(MR_CTRL_GAIN_YAW_P, FLOAT, mr.ctrl_gain_yaw_p) \
+	X(MR_CTRL_GAIN_YAW_I, FLOAT, mr.ctrl_gain_yaw_i) \
+	X(MR_CTRL_GAIN_YAW_DP, FLOAT, mr.ctrl_gain_yaw_dp) \
+	X(MR_CTRL_GAIN_YAW_DE, FLOAT, mr.ctrl_gain_yaw_de) \
+	X(MR_CTRL_GAIN_POS_P, FLOAT, mr.ctrl_gain_pos_p) \
+	X(MR_CTRL_GAIN_POS_I, FLOAT, mr.ctrl_gain_pos_i) \
+	X(MR_CTRL_GAIN_POS_D, FLOAT, mr.ctrl_gain_pos_d) \
+	X(MR_CTRL_GAIN_ALT_P, FLOAT, mr.ctrl_gain_alt_p) \
+	X(MR_CTRL_GAIN_ALT_I, FLOAT, mr.ctrl_gain_alt_i) \
+	X(MR_CTRL_GAIN_ALT_D, FLOAT, mr.ctrl_gain_alt_d) \
+	X(MR_JS_GAIN_TILT, FLOAT, mr.js_gain_tilt) \
+	X(MR_JS_GAIN_YAW, FLOAT, mr.js_gain_yaw) \
+	X(MR_JS_MODE_RATE, BOOL, mr.js_mode_rate) \
+	X(MR_MOTOR_FL_F, INT8, mr.motor_fl_f) \
+	X(MR_MOTOR_BL_L, INT8, mr.motor_bl_l) \
+	X(MR_MOTOR_FR_R, INT8, mr.motor_fr_r) \
+	X(MR_MOTOR_BR_B, INT8, mr.motor_br_b) \
+	X(MR_MOTORS_X, BOOL, mr.motors_x) \
+	X(MR_MOTORS_CW, BOOL, mr.motors_cw) \
+	X(MR_MOTOR_PWM_MIN_US, UINT16, mr.motor_pwm_min_us) \
+	X(MR_MOTOR_PWM_MAX_US, UINT16, mr.motor_pwm_max_us) \
+	X(CAR_ODOMETRY_FROM_STATUS, BOOL, car.odometry_from_status) \
+	X(GPS_USE_MB_HEADING, BOOL, gps_use_mb_heading) \
+	X(GPS_MB_BASELINE, FLOAT, gps_mb_baseline) \
+	X(GPS_MB_YAW_OFFSET, FLOAT, gps_mb_yaw_offset) \
+	X(MR_AP_ENABLED, BOOL, mr.ap_enabled)
+
+#define MAIN_CONFIG_FIELD_ENUM(id, type, member)	MAIN_CONFIG_FIELD_##id,
+typedef enum {
+	MAIN_CONFIG_FIELDS(MAIN_CONFIG_FIELD_ENUM)
+	MAIN_CONFIG_FIELD_NUM
+} MAIN_CONFIG_FIELD;
+#undef MAIN_CONFIG_FIELD_ENUM
+
+// Packet with all fields. Only uint8_t members are used, so there is no
+// padding and offsetof gives the offset of every field at compile time.
+#define MAIN_CONFIG_WIRE_MEMBER(id, type, member)	uint8_t id[MAIN_CONFIG_WIRE_SIZE_##type];
+typedef struct {
+	MAIN_CONFIG_FIELDS(MAIN_CONFIG_WIRE_MEMBER)
+} main_config_wire_t;
+#undef MAIN_CONFIG_WIRE_MEMBER
+
+typedef enum {
+	MAIN_CONFIG_SET_OK = 0,
+	MAIN_CONFIG_SET_HASH_MISMATCH,
+	MAIN_CONFIG_SET_INVALID
+} MAIN_CONFIG_SET_RESULT;
+
+#define MAIN_CONFIG_MASK_BYTES				((MAIN_CONFIG_FIELD_NUM + 7) / 8)
+#define MAIN_CONFIG_HEADER_SIZE				(2 + MAIN_CONFIG_MASK_BYTES)
+#define MAIN_CONFIG_MASK_GET(mask, field)	(((mask)[(field) / 8] >> ((field) % 8)) & 1)
+#define MAIN_CONFIG_MASK_SET(mask, field)	((mask)[(field) / 8] |= (1 << ((field) % 8)))
+
+#endif /* MAIN_CONFIG_SCHEMA_H_ */
@@ -19,6 +19,7 @@
 #include "pos.h"
 #include "utils.h"
 #include "actuator.h"
+#include "autopilot.h"
 
 #include <math.h>
 
@@ -28,6 +29,12 @@
 #define AUTOPILOT_TIMEOUT_MS			1000
 #define MIN_THROTTLE					0.1
 #define THROTTLE_OVERRIDE_LIM			0.85
+#define AP_MAX_TILT						20.0 // Degrees
+#define AP_HOVER_TIME_CONST				2.0 // Seconds
+#define AP_HOVER_LEARN_MIN_THROTTLE		0.25
+#define AP_HOVER_LEARN_MIN_HEIGHT		0.5 // Meters
+#define AP_HOVER_LEARN_MAX_VZ			0.5 // Meters / second
+#define AP_GRAVITY						9.82
 
 // Private types
 typedef struct {
@@ -60,22 +67,37 @@ typedef struct {
 	float yaw;
 } MR_OUTPUT;
 
+typedef struct {
+	bool active;
+	float px_goal;
+	float py_goal;
+	float pz_goal;
+	float vx_integrator;
+	float vy_integrator;
+	float alt_integrator;
+	float throttle_hover;
+} MR_AP_STATE;
+
 // Private variables
 static MR_CONTROL_STATE m_ctrl;
 static MR_RC_STATE m_rc;
 static POS_STATE m_pos_last;
 static MR_OUTPUT m_output;
+static MR_AP_STATE m_ap;
 static float m_power_override[4];
 static float m_power_override_time;
 
 // Private functions
 static void update_rc_control(MR_CONTROL_STATE *ctrl, MR_RC_STATE *rc, POS_STATE *pos, float dt);
+static float update_ap_control(MR_CONTROL_STATE *ctrl, MR_AP_STATE *ap, POS_STATE *pos, float dt);
 
 void mr_control_init(void) {
 	memset(&m_rc, 0, sizeof(MR_RC_STATE));
 	memset(&m_ctrl, 0, sizeof(MR_CONTROL_STATE));
 	memset(&m_pos_last, 0, sizeof(POS_STATE));
 	memset(&m_output, 0, sizeof(MR_OUTPUT));
+	memset(&m_ap, 0, sizeof(MR_AP_STATE));
+	m_ap.throttle_hover = 0.5;
 	memset(m_power_override, 0, sizeof(m_power_override));
 	m_power_override_time = 0.0;
 }
@@ -151,12 +173,35 @@ void mr_control_run_iteration(float dt) {
 			was_below_tres = 0;
 		}
 
-		if (m_rc.throttle < THROTTLE_OVERRIDE_LIM || 1) {
+		if (!main_config.mr.ap_enabled || m_rc.throttle < THROTTLE_OVERRIDE_LIM) {
 			// Manual control
 			update_rc_control(&m_ctrl, &m_rc, &m_pos_last, dt);
 			m_output.throttle = m_rc.throttle;
+
+			// The throttle used in steady manual flight is the starting point
+			// for the altitude control when the autopilot takes over. On the
+			// ground and while climbing or sinking it says nothing about
+			// the hover throttle.
+			if (m_rc.throttle > AP_HOVER_LEARN_MIN_THROTTLE &&
+					m_pos_last.pz > AP_HOVER_LEARN_MIN_HEIGHT &&
+					fabsf(m_pos_last.vz) < AP_HOVER_LEARN_MAX_VZ) {
+				UTILS_LP_FAST(m_ap.throttle_hover, m_rc.throttle, dt / AP_HOVER_TIME_CONST);
+			}
+			m_ap.active = false;
 		} else {
-			// TODO: autopilot
+			// Autopilot. Hold the position where it took over, or follow the
+			// route when the autopilot is active.
+			if (!m_ap.active) {
+				m_ap.px_goal = m_pos_last.px;
+				m_ap.py_goal = m_pos_last.py;
+				m_ap.pz_goal = m_pos_last.pz;
+				m_ap.vx_integrator = 0.0;
+				m_ap.vy_integrator = 0.0;
+				m_ap.alt_integrator = 0.0;
+				m_ap.active = true;
+			}
+
+			m_output.throttle = update_ap_control(&m_ctrl, &m_ap, &m_pos_last, dt);
 		}
 
 		// Run attitude control
@@ -213,8 +258,8 @@ void mr_control_run_iteration(float dt) {
 		utils_truncate_number_abs(&m_output.yaw, 1.0);
 
 		// Compensate throttle for roll and pitch
-		const float tan_roll = tanf(m_pos_last.roll * M_PI / 180.0);
-		const float tan_pitch = tanf(m_pos_last.pitch * M_PI / 180.0);
+		const float tan_roll = UTILS_TAN(m_pos_last.roll * M_PI / 180.0);
+		const float tan_pitch = UTILS_TAN(m_pos_last.pitch * M_PI / 180.0);
 		const float tilt_comp_factor = sqrtf(tan_roll * tan_roll + tan_pitch * tan_pitch + 1);
 
 		m_output.throttle *= tilt_comp_factor;
@@ -251,3 +296,100 @@ static void update_rc_control(MR_CONTROL_STATE *ctrl, MR_RC_STATE *rc, POS_STATE
 	ctrl->pitch_goal = pitch;
 	ctrl->yaw_goal = yaw;
 }
+
+/**
+ * Cascaded position controller. The position error gives a velocity goal,
+ * the velocity error gives an acceleration that is turned into roll and
+ * pitch goals for the attitude control. The altitude is controlled
+ * separately with the throttle.
+ *
+ * @param ctrl
+ * The attitude control state to update the roll and pitch goals in.
+ *
+ * @param ap
+ * The autopilot state.
+ *
+ * @param pos
+ * The current position.
+ *
+ * @param dt
+ * Time since the last iteration in seconds.
+ *
+ * @return
+ * The throttle to use, before tilt compensation.
+ */
+static float update_ap_control(MR_CONTROL_STATE *ctrl, MR_AP_STATE *ap, POS_STATE *pos, float dt) {
+	float vel_max = main_config.ap_max_speed;
+
+	// The route does not carry a height, so the height where the autopilot
+	// took over is kept while following it.
+	if (autopilot_is_active()) {
+		ROUTE_POINT rp;
+		autopilot_get_goal_now(&rp);
+		ap->px_goal = rp.px;
+		ap->py_goal = rp.py;
+		vel_max = rp.speed;
+	}
+
+	// Altitude control
+	const float alt_error = ap->pz_goal - pos->pz;
+	ap->alt_integrator += alt_error * dt;
+	utils_truncate_number_abs(&ap->alt_integrator, 1.0 / main_config.mr.ctrl_gain_alt_i);
+
+	float throttle = ap->throttle_hover +
+			alt_error * main_config.mr.ctrl_gain_alt_p +
+			ap->alt_integrator * main_config.mr.ctrl_gain_alt_i -
+			pos->vz * main_config.mr.ctrl_gain_alt_d;
+	utils_truncate_number(&throttle, MIN_THROTTLE, 1.0);
+
+	// Without recent GPS corrections the position drifts away, so only
+	// keep the copter level in that case.
+	if (pos_time_since_gps_corr() > AUTOPILOT_TIMEOUT_MS) {
+		ap->vx_integrator = 0.0;
+		ap->vy_integrator = 0.0;
+		ctrl->roll_goal = 0.0;
+		ctrl->pitch_goal = 0.0;
+		return throttle;
+	}
+
+	// Position to velocity
+	float vx_goal = (ap->px_goal - pos->px) * main_config.mr.ctrl_gain_pos_p;
+	float vy_goal = (ap->py_goal - pos->py) * main_config.mr.ctrl_gain_pos_p;
+	const float v_goal = sqrtf(SQ(vx_goal) + SQ(vy_goal));
+	if (v_goal > vel_max) {
+		vx_goal *= vel_max / v_goal;
+		vy_goal *= vel_max / v_goal;
+	}
+
+	// Velocity to acceleration
+	const float acc_max = AP_GRAVITY * tanf(AP_MAX_TILT * M_PI / 180.0);
+	const float vx_error = vx_goal - pos->vx;
+	const float vy_error = vy_goal - pos->vy;
+
+	ap->vx_integrator += vx_error * dt;
+	ap->vy_integrator += vy_error * dt;
+	utils_truncate_number_abs(&ap->vx_integrator, acc_max / main_config.mr.ctrl_gain_pos_i);
+	utils_truncate_number_abs(&ap->vy_integrator, acc_max / main_config.mr.ctrl_gain_pos_i);
+
+	float ax = vx_error * main_config.mr.ctrl_gain_pos_d +
+			ap->vx_integrator * main_config.mr.ctrl_gain_pos_i;
+	float ay = vy_error * main_config.mr.ctrl_gain_pos_d +
+			ap->vy_integrator * main_config.mr.ctrl_gain_pos_i;
+	const float a_tot = sqrtf(SQ(ax) + SQ(ay));
+	if (a_tot > acc_max) {
+		ax *= acc_max / a_tot;
+		ay *= acc_max / a_tot;
+	}
+
+	// Acceleration to tilt. This is the inverse of the model in mr_update_pos
+	// in pos.c.
+	float sin_y, cos_y;
+	UTILS_SINCOS(-pos->yaw * M_PI / 180.0, &sin_y, &cos_y);
+	const float ax_body = cos_y * ax + sin_y * ay;
+	const float ay_body = -sin_y * ax + cos_y * ay;
+
+	ctrl->pitch_goal = UTILS_ATAN2(-ax_body, AP_GRAVITY) * 180.0 / M_PI;
+	ctrl->roll_goal = UTILS_ATAN2(-ay_body, AP_GRAVITY) * 180.0 / M_PI;
+
+	return throttle;
+}
@@ -31,10 +31,79 @@
 #include "ublox.h"
 #include "mr_control.h"
 #include "srf10.h"
+#include "imu_capture.h"
+#include "comm_can.h"
+#include "terminal.h"
 
 // Defines
 #define ITERATION_TIMER_FREQ			50000
 
+// Odometry from motor controller status broadcasts
+#define ODO_STATUS_TIMEOUT_MS			100 // Poll the values again if no status arrives for this long
+#define ODO_TACHO_TIMEOUT_MS			100 // Integrate rpm if no tachometer arrives for this long
+#define ODO_MAX_DT						0.1 // Seconds
+#define ODO_VALUES_SLOW_DIV				20 // Poll the full values at 100 / 20 Hz for diagnostics
+
+// Moving base heading
+#define MB_MIN_BASELINE					0.2 // Meters
+#define MB_MAX_BASELINE_ERR				0.05 // Meters, when the baseline is configured
+#define MB_MAX_HEADING_ACC				2.0 // Degrees
+#define MB_MAX_PITCH					30.0 // Degrees
+#define MB_DELAY_MS						80 // Output latency of the heading receiver
+#define MB_GAIN							0.3 // Fraction of the error corrected per heading sample
+#define MB_TIMEOUT_MS					1000 // Use the GNSS track for yaw when there is no heading for this long
+#define MB_HIST_LEN						32
+#define MB_HIST_INTERVAL_MS				10
+
+// Altitude estimation
+#define ALT_GRAVITY						9.82
+#define ALT_SONAR_MIN					0.05 // Meters
+#define ALT_SONAR_MAX					5.0 // Meters
+#define ALT_SONAR_MAX_TILT				30.0 // Degrees
+#define ALT_SONAR_MAX_JUMP				1.0 // Meters
+#define ALT_SONAR_MAX_REJECTS			5
+#define ALT_SONAR_TIMEOUT_MS			250
+#define ALT_SONAR_TIME_CONST			0.5 // Seconds
+#define ALT_GNSS_TIMEOUT_MS				1000
+#define ALT_GNSS_DELAY_MS				100
+#define ALT_GNSS_TIME_CONST				3.0 // Seconds
+#define ALT_ACC_BIAS_MAX				0.5 // Meters / second^2
+#define ALT_HIST_LEN					32
+#define ALT_HIST_INTERVAL_MS			10
+
+// Private types
+typedef struct {
+	bool tacho_valid;
+	int32_t last_tacho;
+	systime_t status_time;
+	systime_t last_rpm_time;
+} ODO_STATE;
+
+typedef struct {
+	float yaw_hist[MB_HIST_LEN];
+	int hist_ind;
+	float hist_time;
+	float heading;
+	float pitch;
+	float yaw_err;
+	systime_t time;
+	uint32_t samples;
+	float yaw_err_sq_sum;
+} MB_STATE;
+
+typedef struct {
+	float z_sonar;
+	float sonar_err;
+	int sonar_rejects;
+	float z_gnss;
+	float gnss_err;
+	systime_t gnss_time;
+	float acc_bias;
+	float z_hist[ALT_HIST_LEN];
+	int hist_ind;
+	float hist_time;
+} ALT_STATE;
+
 // Private variables
 static ATTITUDE_INFO m_att;
 static POS_STATE m_pos;
@@ -50,6 +119,9 @@ static mutex_t m_mutex_pos;
 static mutex_t m_mutex_gps;
 static int32_t m_ms_today;
 static bool m_ubx_pos_valid;
+static ALT_STATE m_alt;
+static ODO_STATE m_odo;
+static MB_STATE m_mb;
 
 // Private functions
 static void mpu9150_read(void);
@@ -58,15 +130,25 @@ static void init_gps_local(GPS_STATE *gps);
 static double nmea_parse_val(char *str);
 static void ublox_relposned_rx(ubx_nav_relposned *pos);
 static void correct_pos_gps(POS_STATE *pos);
+static void mb_heading_rx(ubx_nav_relposned *pos);
+static bool mb_heading_active(void);
+static void terminal_cmd_mb(int argc, const char **argv);
 
 #if MAIN_MODE == MAIN_MODE_CAR
 static void mc_values_received(mc_values *val);
+static void mc_status_received(can_status_msg *msg, bool tacho_updated);
+static bool odo_status_active(void);
+static float odo_tacho_distance(int32_t tacho);
+static float odo_rpm_to_speed(float rpm);
+static void odo_update(float distance, float speed);
 #elif MAIN_MODE == MAIN_MODE_MULTIROTOR
 static void srf_distance_received(float distance);
+static void gnss_height_received(float z);
 #endif
 
 #if MAIN_MODE == MAIN_MODE_MULTIROTOR
 static void mr_update_pos(POS_STATE *pos, float dt);
+static void mr_update_alt(POS_STATE *pos, float *accel, float dt);
 #endif
 
 void pos_init(void) {
@@ -75,6 +157,9 @@ void pos_init(void) {
 	memset(&m_pos, 0, sizeof(m_pos));
 	memset(&m_gps, 0, sizeof(m_gps));
 	memset(&m_mc_val, 0, sizeof(m_mc_val));
+	memset(&m_alt, 0, sizeof(m_alt));
+	memset(&m_odo, 0, sizeof(m_odo));
+	memset(&m_mb, 0, sizeof(m_mb));
 	m_imu_yaw = 0.0;
 	m_ubx_pos_valid = true;
 
@@ -108,8 +193,15 @@ void pos_init(void) {
 	mpu9150_set_read_callback(mpu9150_read);
 	ublox_set_rx_callback_relposned(ublox_relposned_rx);
 
+	terminal_register_command_callback(
+			"pos_mb",
+			"Print the moving base heading and the yaw error statistics. Use pos_mb reset to clear them.",
+			"[reset]",
+			terminal_cmd_mb);
+
 #if MAIN_MODE == MAIN_MODE_CAR
 	bldc_interface_set_rx_value_func(mc_values_received);
+	comm_can_set_status_func(mc_status_received);
 #elif MAIN_MODE == MAIN_MODE_MULTIROTOR
 	srf10_set_sample_callback(srf_distance_received);
 #endif
@@ -232,7 +324,9 @@ void pos_reset_enu_ref(void) {
 }
 
 void pos_get_mc_val(mc_values *v) {
+	chMtxLock(&m_mutex_pos);
 	*v = m_mc_val;
+	chMtxUnlock(&m_mutex_pos);
 }
 
 int32_t pos_get_ms_today(void) {
@@ -424,10 +518,8 @@ bool pos_input_nmea(const char *data) {
 #if MAIN_MODE == MAIN_MODE_CAR
 				m_pos.pz = m_pos.pz_gps - m_pos.gps_ground_level;
 #elif MAIN_MODE == MAIN_MODE_MULTIROTOR
-				// Update height from GPS if ultrasound measurements haven't been received for a while
-				if (ST2MS(chVTTimeElapsedSinceX(m_pos.ultra_update_time)) > 250) {
-					m_pos.pz = m_pos.pz_gps - m_pos.gps_ground_level;
-				}
+				// Used by mr_update_alt when there are no ultrasound measurements
+				gnss_height_received(m_pos.pz_gps - m_pos.gps_ground_level);
 #endif
 			}
 
@@ -471,24 +563,39 @@ static void mpu9150_read(void) {
 	cnt_last = cnt;
 	float dt = (float)time_elapsed / (float)ITERATION_TIMER_FREQ;
 
+	if (imu_capture_is_enabled()) {
+		int16_t raw[9];
+		mpu9150_get_raw_accel_gyro_mag(raw);
+		imu_capture_sample(raw, time_elapsed * (1000000 / ITERATION_TIMER_FREQ));
+	}
+
 	update_orientation_angles(accel, gyro, mag, dt);
 
 #if MAIN_MODE == MAIN_MODE_CAR
-	// Read MC values every 10 iterations (should be 100 Hz)
+	// Read MC values every 10 iterations (should be 100 Hz). When the
+	// odometry comes from the status broadcasts they are only needed for
+	// diagnostics, so they are read less often.
 	static int mc_read_cnt = 0;
+	static int mc_slow_cnt = 0;
 	mc_read_cnt++;
 	if (mc_read_cnt >= 10) {
 		mc_read_cnt = 0;
-		bldc_interface_get_values();
+		mc_slow_cnt++;
+
+		if (!odo_status_active() || mc_slow_cnt >= ODO_VALUES_SLOW_DIV) {
+			mc_slow_cnt = 0;
+			bldc_interface_get_values();
+		}
 	}
 #endif
 
 #if MAIN_MODE == MAIN_MODE_MULTIROTOR
+	chMtxLock(&m_mutex_pos);
+	mr_update_alt(&m_pos, accel, dt);
 	if (mr_control_is_throttle_over_tres()) {
-		chMtxLock(&m_mutex_pos);
 		mr_update_pos(&m_pos, dt);
-		chMtxUnlock(&m_mutex_pos);
 	}
+	chMtxUnlock(&m_mutex_pos);
 #endif
 
 	// Update time today
@@ -554,15 +661,14 @@ static void update_orientation_angles(float *accel, float *gyro, float *mag, flo
 	float my = mag_tmp[1];
 	float mz = mag_tmp[2];
 
-	float sr = sinf(roll);
-	float cr = cosf(roll);
-	float sp = sinf(pitch);
-	float cp = cosf(pitch);
+	float sr, cr, sp, cp;
+	UTILS_SINCOS(roll, &sr, &cr);
+	UTILS_SINCOS(pitch, &sp, &cp);
 
 	float c_mx = mx * cp + my * sr * sp + mz * sp * cr;
 	float c_my = my * cr - mz * sr;
 
-	float yaw_mag = atan2f(-c_my, c_mx);
+	float yaw_mag = UTILS_ATAN2(-c_my, c_mx);
 
 	chMtxLock(&m_mutex_pos);
 
@@ -625,6 +731,17 @@ static void update_orientation_angles(float *accel, float *gyro, float *mag, flo
 	m_pos.q2 = m_att.q2;
 	m_pos.q3 = m_att.q3;
 
+	// Yaw history for the delayed moving base heading
+	m_mb.hist_time += dt;
+	if (m_mb.hist_time >= ((float)MB_HIST_INTERVAL_MS / 1000.0)) {
+		m_mb.hist_time = 0.0;
+		m_mb.hist_ind++;
+		if (m_mb.hist_ind >= MB_HIST_LEN) {
+			m_mb.hist_ind = 0;
+		}
+		m_mb.yaw_hist[m_mb.hist_ind] = m_pos.yaw;
+	}
+
 	chMtxUnlock(&m_mutex_pos);
 }
 
@@ -684,6 +801,13 @@ static double nmea_parse_val(char *str) {
 }
 
 static void ublox_relposned_rx(ubx_nav_relposned *pos) {
+	// Relative to an antenna on the vehicle, so this says nothing about
+	// the quality of the position.
+	if (pos->is_moving) {
+		mb_heading_rx(pos);
+		return;
+	}
+
 	bool valid = true;
 
 	if (pos->acc_n > main_config.gps_ubx_max_acc) {
@@ -703,6 +827,128 @@ static void ublox_relposned_rx(ubx_nav_relposned *pos) {
 	m_ubx_pos_valid = valid;
 }
 
+/*
+ * Heading from a moving base receiver pair. The vector from the base antenna
+ * to the rover antenna gives the heading and the pitch of the vehicle. It is
+ * compared to the yaw estimate at the time of the measurement, and the
+ * difference is corrected in the yaw offset so that the gyro keeps the yaw
+ * smooth between the samples.
+ */
+static void mb_heading_rx(ubx_nav_relposned *pos) {
+	if (!main_config.gps_use_mb_heading) {
+		return;
+	}
+
+	// A float solution can have heading errors of many degrees
+	if (!pos->fix_ok || !pos->rel_pos_valid || pos->carr_soln != 2 ||
+			pos->ref_obs_miss) {
+		return;
+	}
+
+	const float len_hor = sqrtf(SQ(pos->pos_n) + SQ(pos->pos_e));
+	const float len = sqrtf(SQ(len_hor) + SQ(pos->pos_d));
+
+	if (len_hor < MB_MIN_BASELINE) {
+		return;
+	}
+
+	if (main_config.gps_mb_baseline > 0.0 &&
+			fabsf(len - main_config.gps_mb_baseline) > MB_MAX_BASELINE_ERR) {
+		return;
+	}
+
+	// Older receivers don't report the heading accuracy, so estimate it
+	// from the horizontal accuracy and the length.
+	float acc_heading = pos->acc_heading;
+	if (!pos->heading_valid) {
+		acc_heading = UTILS_ATAN2(sqrtf(SQ(pos->acc_n) + SQ(pos->acc_e)), len_hor) * 180.0 / M_PI;
+	}
+
+	if (acc_heading > MB_MAX_HEADING_ACC) {
+		return;
+	}
+
+	const float heading = UTILS_ATAN2(pos->pos_e, pos->pos_n) * 180.0 / M_PI;
+	const float pitch = UTILS_ATAN2(-pos->pos_d, len_hor) * 180.0 / M_PI;
+
+	if (fabsf(pitch) > MB_MAX_PITCH) {
+		return;
+	}
+
+	// Yaw is zero along x (east) and positive clockwise
+	float yaw_meas = heading - 90.0 - main_config.gps_mb_yaw_offset;
+	utils_norm_angle(&yaw_meas);
+
+	chMtxLock(&m_mutex_pos);
+
+	int ind = m_mb.hist_ind - MB_DELAY_MS / MB_HIST_INTERVAL_MS;
+	if (ind < 0) {
+		ind += MB_HIST_LEN;
+	}
+
+	const float err = utils_angle_difference(yaw_meas, m_mb.yaw_hist[ind]);
+
+	m_pos.yaw += MB_GAIN * err;
+	utils_norm_angle(&m_pos.yaw);
+	m_yaw_offset_gps -= MB_GAIN * err;
+	utils_norm_angle(&m_yaw_offset_gps);
+
+	// Shift the history by the same correction, otherwise the next samples
+	// within the delay are compared to the uncorrected yaw and the error is
+	// corrected more than once.
+	for (int i = 0;i < MB_HIST_LEN;i++) {
+		m_mb.yaw_hist[i] += MB_GAIN * err;
+		utils_norm_angle(&m_mb.yaw_hist[i]);
+	}
+
+	m_mb.heading = heading;
+	m_mb.pitch = pitch;
+	m_mb.yaw_err = err;
+	m_mb.time = chVTGetSystemTimeX();
+	m_mb.samples++;
+	m_mb.yaw_err_sq_sum += SQ(err);
+
+	chMtxUnlock(&m_mutex_pos);
+}
+
+static bool mb_heading_active(void) {
+	return main_config.gps_use_mb_heading && m_mb.time != 0 &&
+			ST2MS(chVTTimeElapsedSinceX(m_mb.time)) < MB_TIMEOUT_MS;
+}
+
+static void terminal_cmd_mb(int argc, const char **argv) {
+	if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+		chMtxLock(&m_mutex_pos);
+		m_mb.samples = 0;
+		m_mb.yaw_err_sq_sum = 0.0;
+		chMtxUnlock(&m_mutex_pos);
+		commands_printf("OK\n");
+		return;
+	}
+
+	chMtxLock(&m_mutex_pos);
+	MB_STATE mb = m_mb;
+	chMtxUnlock(&m_mutex_pos);
+
+	if (mb.time == 0) {
+		commands_printf("No moving base heading received\n");
+		return;
+	}
+
+	// The error is taken before each correction, so its RMS shows how much
+	// the yaw drifts between the heading samples.
+	commands_printf(
+			"Heading: %.2f deg\n"
+			"Pitch: %.2f deg\n"
+			"Yaw error: %.2f deg\n"
+			"Yaw error RMS: %.3f deg (%u samples)\n"
+			"Age: %u ms\n",
+			(double)mb.heading, (double)mb.pitch, (double)mb.yaw_err,
+			(double)sqrtf(mb.yaw_err_sq_sum / (float)(mb.samples > 0 ? mb.samples : 1)),
+			(unsigned int)mb.samples,
+			(unsigned int)ST2MS(chVTTimeElapsedSinceX(mb.time)));
+}
+
 static void correct_pos_gps(POS_STATE *pos) {
 #if MAIN_MODE == MAIN_MODE_MULTIROTOR
 	pos->gps_corr_cnt = sqrtf(SQ(pos->px_gps - pos->px_gps_last) +
@@ -718,7 +964,8 @@ static void correct_pos_gps(POS_STATE *pos) {
 			pos->px - pos->gps_ang_corr_x_last_car);
 	float yaw_diff = utils_angle_difference_rad(yaw_gps, yaw_car) * 180.0 / M_PI;
 
-	if (fabsf(pos->speed * 3.6) > 0.5) {
+	// The moving base heading is much better than the track, when there is one
+	if (fabsf(pos->speed * 3.6) > 0.5 && !mb_heading_active()) {
 		utils_step_towards(&m_yaw_offset_gps, m_yaw_offset_gps + yaw_diff,
 				main_config.gps_corr_gain_yaw * pos->gps_corr_cnt);
 	}
@@ -803,29 +1050,102 @@ static void correct_pos_gps(POS_STATE *pos) {
 }
 
 #if MAIN_MODE == MAIN_MODE_CAR
+/*
+ * The odometry state is updated from both the CAN thread (status messages)
+ * and the thread that handles the values reply, so these callbacks hold
+ * m_mutex_pos for the whole update.
+ */
 static void mc_values_received(mc_values *val) {
+	chMtxLock(&m_mutex_pos);
+
 	m_mc_val = *val;
 
-	static int32_t last_tacho = 0;
+	if (!odo_status_active()) {
+		odo_update(odo_tacho_distance(val->tachometer), odo_rpm_to_speed(val->rpm));
+	}
+
+	chMtxUnlock(&m_mutex_pos);
+}
+
+static void mc_status_received(can_status_msg *msg, bool tacho_updated) {
+	if (!main_config.car.odometry_from_status) {
+		return;
+	}
+
+	chMtxLock(&m_mutex_pos);
+
+	m_odo.status_time = chVTGetSystemTimeX();
+
+	// Keep the values for diagnostics fresh between the slow polls
+	m_mc_val.rpm = msg->rpm;
+	m_mc_val.current_motor = msg->current;
+	m_mc_val.duty_now = msg->duty;
+
+	if (tacho_updated) {
+		m_mc_val.tachometer = msg->tachometer;
+		m_mc_val.v_in = msg->v_in;
+		odo_update(odo_tacho_distance(msg->tachometer), odo_rpm_to_speed(msg->rpm));
+		chMtxUnlock(&m_mutex_pos);
+		return;
+	}
+
+	float distance = 0.0;
+
+	// Motor controllers that don't send the tachometer: integrate the speed
+	// between the reception times of the status messages.
+	if (msg->tacho_rx_time == 0 ||
+			ST2MS(msg->rx_time - msg->tacho_rx_time) > ODO_TACHO_TIMEOUT_MS) {
+		if (m_odo.last_rpm_time != 0) {
+			float dt = (float)ST2US(msg->rx_time - m_odo.last_rpm_time) / 1e6;
+			if (dt < ODO_MAX_DT) {
+				distance = odo_rpm_to_speed(msg->rpm) * dt;
+			}
+		}
+
+		// The tachometer reference does not include this distance
+		m_odo.tacho_valid = false;
+	}
+
+	m_odo.last_rpm_time = msg->rx_time;
+	odo_update(distance, odo_rpm_to_speed(msg->rpm));
 
+	chMtxUnlock(&m_mutex_pos);
+}
+
+static bool odo_status_active(void) {
+	return main_config.car.odometry_from_status && m_odo.status_time != 0 &&
+			ST2MS(chVTTimeElapsedSinceX(m_odo.status_time)) < ODO_STATUS_TIMEOUT_MS;
+}
+
+static float odo_tacho_distance(int32_t tacho) {
 	// Reset tacho the first time.
-	static bool tacho_read = false;
-	if (!tacho_read) {
-		tacho_read = true;
-		last_tacho = val->tachometer;
+	if (!m_odo.tacho_valid) {
+		m_odo.tacho_valid = true;
+		m_odo.last_tacho = tacho;
 	}
 
-	float distance = (float)(val->tachometer - last_tacho) * main_config.car.gear_ratio
+	// The tachometer wraps, so take the difference modulo 2^32
+	int32_t diff = (int32_t)((uint32_t)tacho - (uint32_t)m_odo.last_tacho);
+	float distance = (float)diff * main_config.car.gear_ratio
 			* (2.0 / main_config.car.motor_poles) * (1.0 / 6.0) * main_config.car.wheel_diam * M_PI;
-	last_tacho = val->tachometer;
+	m_odo.last_tacho = tacho;
 
+	return distance;
+}
+
+static float odo_rpm_to_speed(float rpm) {
+	return rpm * main_config.car.gear_ratio
+			* (2.0 / main_config.car.motor_poles) * (1.0 / 60.0)
+			* main_config.car.wheel_diam * M_PI;
+}
+
+// m_mutex_pos must be locked
+static void odo_update(float distance, float speed) {
 	float steering_angle = (servo_simple_get_pos_now()
 			- main_config.car.steering_center)
 											* ((2.0 * main_config.car.steering_max_angle_rad)
 													/ main_config.car.steering_range);
 
-	chMtxLock(&m_mutex_pos);
-
 	if (fabsf(distance) > 1e-6) {
 		float angle_rad = -m_pos.yaw * M_PI / 180.0;
 
@@ -855,27 +1175,133 @@ static void mc_values_received(mc_values *val) {
 		}
 	}
 
-	m_pos.speed = val->rpm * main_config.car.gear_ratio
-			* (2.0 / main_config.car.motor_poles) * (1.0 / 60.0)
-			* main_config.car.wheel_diam * M_PI;
-
-	chMtxUnlock(&m_mutex_pos);
+	m_pos.speed = speed;
 }
 #endif
 
 #if MAIN_MODE == MAIN_MODE_MULTIROTOR
 static void srf_distance_received(float distance) {
 	chMtxLock(&m_mutex_pos);
-	m_pos.pz = distance;
-	m_pos.ultra_update_time = chVTGetSystemTimeX();
+
+	// The beam follows the tilt of the copter
+	const float z = distance * cosf(m_pos.roll * M_PI / 180.0) *
+			cosf(m_pos.pitch * M_PI / 180.0);
 
 	if (!mr_control_is_throttle_over_tres()) {
-		m_pos.gps_ground_level = m_pos.pz_gps - m_pos.pz;
+		m_pos.gps_ground_level = m_pos.pz_gps - z;
+	}
+
+	bool valid = distance > ALT_SONAR_MIN && distance < ALT_SONAR_MAX &&
+			fabsf(m_pos.roll) < ALT_SONAR_MAX_TILT &&
+			fabsf(m_pos.pitch) < ALT_SONAR_MAX_TILT;
+
+	// Reject single spikes, but start using the sonar again if it keeps
+	// disagreeing with the estimate.
+	if (valid && fabsf(z - m_pos.pz) > ALT_SONAR_MAX_JUMP &&
+			m_alt.sonar_rejects < ALT_SONAR_MAX_REJECTS) {
+		m_alt.sonar_rejects++;
+		valid = false;
+	}
+
+	if (valid) {
+		m_alt.sonar_rejects = 0;
+		m_alt.z_sonar = z;
+		m_alt.sonar_err = z - m_pos.pz;
+		m_pos.ultra_update_time = chVTGetSystemTimeX();
 	}
 
 	chMtxUnlock(&m_mutex_pos);
 }
 
+// m_mutex_pos must be locked
+static void gnss_height_received(float z) {
+	int ind = m_alt.hist_ind - ALT_GNSS_DELAY_MS / ALT_HIST_INTERVAL_MS;
+	if (ind < 0) {
+		ind += ALT_HIST_LEN;
+	}
+
+	m_alt.z_gnss = z;
+	m_alt.gnss_err = z - m_alt.z_hist[ind];
+	m_alt.gnss_time = chVTGetSystemTimeX();
+}
+
+/**
+ * Altitude and vertical velocity estimation. The vertical acceleration is
+ * integrated at the IMU rate and corrected towards the ultrasound height
+ * when it is available and towards the GNSS height otherwise, using a third
+ * order complementary filter that also estimates the accelerometer bias.
+ * Each sample is compared to the estimate at the time it was measured when
+ * it arrives, which for the GNSS height is ALT_GNSS_DELAY_MS ago, and that
+ * error is corrected until the next sample. Comparing an old sample to the
+ * current estimate would pull the estimate back while climbing.
+ *
+ * @param pos
+ * The position state to update pz and vz in.
+ *
+ * @param accel
+ * Accelerometer sample in g, in the same frame as m_att.
+ *
+ * @param dt
+ * Time since the last sample in seconds.
+ */
+static void mr_update_alt(POS_STATE *pos, float *accel, float dt) {
+	const float q0 = m_att.q0;
+	const float q1 = m_att.q1;
+	const float q2 = m_att.q2;
+	const float q3 = m_att.q3;
+
+	// Vertical acceleration without gravity
+	const float acc_z = ((2.0 * (q1 * q3 - q0 * q2) * accel[0] +
+			2.0 * (q0 * q1 + q2 * q3) * accel[1] +
+			(q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3) * accel[2]) - 1.0) *
+			ALT_GRAVITY - m_alt.acc_bias;
+
+	pos->pz += pos->vz * dt + 0.5 * acc_z * dt * dt;
+	pos->vz += acc_z * dt;
+
+	m_alt.hist_time += dt;
+	if (m_alt.hist_time >= ((float)ALT_HIST_INTERVAL_MS / 1000.0)) {
+		m_alt.hist_time = 0.0;
+		m_alt.hist_ind++;
+		if (m_alt.hist_ind >= ALT_HIST_LEN) {
+			m_alt.hist_ind = 0;
+		}
+		m_alt.z_hist[m_alt.hist_ind] = pos->pz;
+	}
+
+	float error;
+	float time_const;
+
+	if (ST2MS(chVTTimeElapsedSinceX(pos->ultra_update_time)) < ALT_SONAR_TIMEOUT_MS) {
+		error = m_alt.sonar_err;
+		time_const = ALT_SONAR_TIME_CONST;
+	} else if (ST2MS(chVTTimeElapsedSinceX(m_alt.gnss_time)) < ALT_GNSS_TIMEOUT_MS) {
+		error = m_alt.gnss_err;
+		time_const = ALT_GNSS_TIME_CONST;
+	} else {
+		return;
+	}
+
+	const float k1 = 3.0 / time_const;
+	const float k2 = 3.0 / (time_const * time_const);
+	const float k3 = 1.0 / (time_const * time_const * time_const);
+	const float corr = error * k1 * dt;
+
+	pos->pz += corr;
+	pos->vz += error * k2 * dt;
+	m_alt.acc_bias -= error * k3 * dt;
+	utils_truncate_number_abs(&m_alt.acc_bias, ALT_ACC_BIAS_MAX);
+
+	// The correction also moves the estimate at the time of the samples, so
+	// the errors and the history are shifted by it. Otherwise the same error
+	// is corrected more than once.
+	m_alt.sonar_err -= corr;
+	m_alt.gnss_err -= corr;
+	for (int i = 0;i < ALT_HIST_LEN;i++) {
+		m_alt.z_hist[i] += corr;
+	}
+}
+
 static void mr_update_pos(POS_STATE *pos, float dt) {
 	float roll = pos->roll + pos->tilt_roll_err;
 	float pitch = pos->pitch + pos->tilt_pitch_err;
@@ -893,11 +1319,11 @@ static void mr_update_pos(POS_STATE *pos, float dt) {
 	yaw = yaw * M_PI / 180.0;
 
 	const float acc_v = 9.82;
-	const float cos_y = cosf(-yaw);
-	const float sin_y = sinf(-yaw);
+	float sin_y, cos_y;
+	UTILS_SINCOS(-yaw, &sin_y, &cos_y);
 
-	const float dvx = -acc_v * tanf(pitch) * dt;
-	const float dvy = -acc_v * tanf(roll) * dt;
+	const float dvx = -acc_v * UTILS_TAN(pitch) * dt;
+	const float dvy = -acc_v * UTILS_TAN(roll) * dt;
 
 	pos->vx += cos_y * dvx - sin_y * dvy;
 	pos->vy += cos_y * dvy + sin_y * dvx;
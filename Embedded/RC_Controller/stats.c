@@ -0,0 +1,293 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "buffer.h"
+#include "commands.h"
+#include "terminal.h"
+
+#include <string.h>
+
+// Settings
+#define THREADS_MAX				24
+#define LOAD_INTERVAL_MS		1000
+#define THREAD_NAME_LEN			19
+
+// Private types
+typedef struct {
+	uint32_t count;
+	uint32_t cycles_max;
+	uint64_t cycles_tot;
+} cmd_stats_t;
+
+// The thread pointer is only compared while walking the registry, as the
+// thread can terminate afterwards. The name is copied for the same reason.
+typedef struct {
+	thread_t *tp;
+	char name[THREAD_NAME_LEN + 1];
+	float load;
+} thread_stats_t;
+
+// Private variables
+static cmd_stats_t m_cmd_stats[256];
+static thread_stats_t m_thread_stats[THREADS_MAX];
+static ringbuf_t *m_queues[STATS_QUEUE_NUM];
+static volatile uint32_t m_rtcm_bytes;
+
+// Threads
+static THD_WORKING_AREA(stats_thread_wa, 512);
+static THD_FUNCTION(stats_thread, arg);
+
+// Private functions
+static void terminal_cmd_stats(int argc, const char **argv);
+
+void stats_init(void) {
+	// Enable the cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	memset(m_thread_stats, 0, sizeof(m_thread_stats));
+	stats_reset();
+
+	chThdCreateStatic(stats_thread_wa, sizeof(stats_thread_wa), LOWPRIO, stats_thread, NULL);
+
+	terminal_register_command_callback(
+			"stats",
+			"Print runtime statistics. Use stats reset to clear the counters.",
+			"[reset]",
+			terminal_cmd_stats);
+}
+
+void stats_reset(void) {
+	chSysLock();
+	memset(m_cmd_stats, 0, sizeof(m_cmd_stats));
+	for (int i = 0;i < STATS_QUEUE_NUM;i++) {
+		if (m_queues[i]) {
+			ringbuf_reset_stats(m_queues[i]);
+		}
+	}
+	m_rtcm_bytes = 0;
+	chSysUnlock();
+}
+
+/**
+ * Account for one handled command.
+ *
+ * @param cmd
+ * The command id.
+ *
+ * @param start_cycles
+ * The cycle counter when the handler was entered.
+ */
+void stats_cmd_done(uint8_t cmd, uint32_t start_cycles) {
+	uint32_t cycles = STATS_CYCLES_NOW() - start_cycles;
+	cmd_stats_t *s = &m_cmd_stats[cmd];
+
+	chSysLock();
+	s->count++;
+	s->cycles_tot += cycles;
+	if (cycles > s->cycles_max) {
+		s->cycles_max = cycles;
+	}
+	chSysUnlock();
+}
+
+/**
+ * Count received RTCM bytes. This is called from several threads.
+ *
+ * @param bytes
+ * The number of bytes.
+ */
+void stats_rtcm_bytes(uint32_t bytes) {
+	chSysLock();
+	m_rtcm_bytes += bytes;
+	chSysUnlock();
+}
+
+/**
+ * Report the high-water mark and the overflows of a queue. The ring buffer
+ * keeps the counts, so nothing has to be done on every push.
+ *
+ * @param queue
+ * The queue.
+ *
+ * @param rb
+ * The ring buffer of the queue. It must stay valid.
+ */
+void stats_register_queue(STATS_QUEUE queue, ringbuf_t *rb) {
+	m_queues[queue] = rb;
+}
+
+/**
+ * Serialize the statistics for CMD_GET_STATS.
+ *
+ * @param buffer
+ * The buffer to write to.
+ *
+ * @param max_len
+ * The size of the buffer. Commands that do not fit are left out.
+ *
+ * @return
+ * The number of bytes written.
+ */
+int32_t stats_serialize(uint8_t *buffer, int32_t max_len) {
+	int32_t ind = 0;
+
+	buffer_append_uint32(buffer, chVTGetSystemTimeX() / (CH_CFG_ST_FREQUENCY / 1000), &ind);
+	buffer_append_uint32(buffer, m_rtcm_bytes, &ind);
+
+	buffer[ind++] = STATS_QUEUE_NUM;
+	for (int i = 0;i < STATS_QUEUE_NUM;i++) {
+		ringbuf_t *rb = m_queues[i];
+		buffer_append_uint16(buffer, rb ? ringbuf_high_water(rb) : 0, &ind);
+		buffer_append_uint16(buffer, rb ? rb->slots - 1 : 0, &ind);
+		buffer_append_uint32(buffer, rb ? ringbuf_overflows(rb) : 0, &ind);
+	}
+
+	int thd_num_ind = ind++;
+	buffer[thd_num_ind] = 0;
+	for (int i = 0;i < THREADS_MAX;i++) {
+		thread_stats_t *t = &m_thread_stats[i];
+		if (!t->tp) {
+			continue;
+		}
+
+		const char *name = t->name;
+		int name_len = strlen(name);
+		if ((ind + name_len + 6) > max_len) {
+			break;
+		}
+
+		strcpy((char*)buffer + ind, name);
+		ind += name_len + 1;
+		buffer_append_float32_auto(buffer, t->load, &ind);
+		buffer[thd_num_ind]++;
+	}
+
+	int cmd_num_ind = ind++;
+	buffer[cmd_num_ind] = 0;
+	for (int i = 0;i < 256;i++) {
+		cmd_stats_t s = m_cmd_stats[i];
+		if (s.count == 0) {
+			continue;
+		}
+
+		if ((ind + 13) > max_len || buffer[cmd_num_ind] == 255) {
+			break;
+		}
+
+		buffer[ind++] = i;
+		buffer_append_uint32(buffer, s.count, &ind);
+		buffer_append_float32_auto(buffer,
+				STATS_CYCLES_TO_US(s.cycles_tot / s.count), &ind);
+		buffer_append_float32_auto(buffer, STATS_CYCLES_TO_US(s.cycles_max), &ind);
+		buffer[cmd_num_ind]++;
+	}
+
+	return ind;
+}
+
+static THD_FUNCTION(stats_thread, arg) {
+	(void)arg;
+
+	chRegSetThreadName("Stats");
+
+	static systime_t thd_time_last[THREADS_MAX];
+	systime_t time_last = chVTGetSystemTimeX();
+
+	for(;;) {
+		chThdSleepMilliseconds(LOAD_INTERVAL_MS);
+
+		systime_t time = chVTGetSystemTimeX();
+		systime_t elapsed = time - time_last;
+		time_last = time;
+
+		// Update the load of all registered threads from the time they
+		// have been running since the last iteration.
+		int ind = 0;
+		thread_t *tp = chRegFirstThread();
+		while (tp != NULL) {
+			if (ind < THREADS_MAX) {
+				thread_stats_t *t = &m_thread_stats[ind];
+
+				// Copied every time, as a thread can set its name after it
+				// was started
+				strncpy(t->name, tp->p_name ? tp->p_name : "", THREAD_NAME_LEN);
+
+				if (t->tp != tp) {
+					t->tp = tp;
+					t->load = 0.0;
+				} else if (elapsed > 0) {
+					t->load = (float)(tp->p_time - thd_time_last[ind]) / (float)elapsed;
+				}
+
+				thd_time_last[ind] = tp->p_time;
+				ind++;
+			}
+
+			tp = chRegNextThread(tp);
+		}
+
+		for (;ind < THREADS_MAX;ind++) {
+			m_thread_stats[ind].tp = 0;
+		}
+	}
+}
+
+static void terminal_cmd_stats(int argc, const char **argv) {
+	if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+		stats_reset();
+		commands_printf("Statistics reset\n");
+		return;
+	}
+
+	commands_printf("Uptime: %u s, RTCM bytes: %u",
+			chVTGetSystemTimeX() / (CH_CFG_ST_FREQUENCY / 1000) / 1000, m_rtcm_bytes);
+
+	static const char *queue_names[] = {"ublox rx", "can rx", "cc2520 tx", "cc1120 tx",
+			"imu capture"};
+	for (int i = 0;i < STATS_QUEUE_NUM;i++) {
+		ringbuf_t *rb = m_queues[i];
+		if (rb) {
+			commands_printf("Queue %-10s hwm: %4u / %4u, overflows: %u", queue_names[i],
+					ringbuf_high_water(rb), rb->slots - 1, ringbuf_overflows(rb));
+		}
+	}
+
+	commands_printf(" ");
+	commands_printf("          name   load");
+	for (int i = 0;i < THREADS_MAX;i++) {
+		thread_stats_t *t = &m_thread_stats[i];
+		if (t->tp) {
+			commands_printf("%14s %5.1f %%", t->name, (double)(t->load * 100.0));
+		}
+	}
+
+	commands_printf(" ");
+	commands_printf("cmd      count   avg (us)   max (us)");
+	for (int i = 0;i < 256;i++) {
+		cmd_stats_t s = m_cmd_stats[i];
+		if (s.count) {
+			commands_printf("%3d %10u %10.1f %10.1f", i, s.count,
+					(double)STATS_CYCLES_TO_US(s.cycles_tot / s.count),
+					(double)STATS_CYCLES_TO_US(s.cycles_max));
+		}
+	}
+
+	commands_printf(" ");
+}
@@ -0,0 +1,38 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "datatypes.h"
+#include "ringbuf.h"
+
+// Functions
+void stats_init(void);
+void stats_reset(void);
+void stats_cmd_done(uint8_t cmd, uint32_t start_cycles);
+void stats_rtcm_bytes(uint32_t bytes);
+void stats_register_queue(STATS_QUEUE queue, ringbuf_t *rb);
+int32_t stats_serialize(uint8_t *buffer, int32_t max_len);
+
+// Cycle counter, used for timing command handlers
+#define STATS_CYCLES_NOW()			(DWT->CYCCNT)
+#define STATS_CYCLES_TO_US(c)		((float)(c) / (float)(STM32_SYSCLK / 1000000))
+
+#endif /* STATS_H_ */
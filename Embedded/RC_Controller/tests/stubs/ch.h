@@ -0,0 +1,83 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CH_H_
+#define CH_H_
+
+/*
+ * The part of the ChibiOS API that the host tests need. Time is a plain
+ * counter in ms that the tests advance with stub_time_ms, and locks do
+ * nothing since the tests are single threaded.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint32_t systime_t;
+typedef int32_t msg_t;
+typedef uint32_t eventmask_t;
+typedef struct {int dummy;} mutex_t;
+typedef struct {int dummy;} thread_t;
+typedef struct {int dummy;} event_source_t;
+typedef struct {int dummy;} event_listener_t;
+
+extern systime_t stub_time_ms;
+
+#define CH_CFG_ST_FREQUENCY					1000
+#define NORMALPRIO							128
+#define MSG_OK								((msg_t)0)
+#define MSG_TIMEOUT							((msg_t)-1)
+#define TIME_IMMEDIATE						((systime_t)0)
+#define TIME_INFINITE						((systime_t)-1)
+#define ALL_EVENTS							((eventmask_t)-1)
+#define MS2ST(ms)							((systime_t)(ms))
+#define ST2MS(st)							((systime_t)(st))
+#define ST2US(st)							((systime_t)(st) * 1000)
+#define chVTGetSystemTimeX()				(stub_time_ms)
+#define chVTGetSystemTime()					(stub_time_ms)
+#define chVTTimeElapsedSinceX(start)		(stub_time_ms - (start))
+#define THD_WORKING_AREA(name, size)		char name[size]
+#define THD_FUNCTION(name, arg)				void name(void *arg)
+
+static inline void chSysLock(void) {}
+static inline void chSysUnlock(void) {}
+static inline void chSysLockFromISR(void) {}
+static inline void chSysUnlockFromISR(void) {}
+static inline void chMtxObjectInit(mutex_t *m) {(void)m;}
+static inline void chMtxLock(mutex_t *m) {(void)m;}
+static inline void chMtxUnlock(mutex_t *m) {(void)m;}
+static inline void chRegSetThreadName(const char *name) {(void)name;}
+static inline void chThdSleepMilliseconds(uint32_t ms) {(void)ms;}
+static inline void chThdSleep(systime_t time) {(void)time;}
+
+// Threads are not started, the tests call the functions they run
+static inline thread_t *chThdCreateStatic(void *wsp, size_t size, int prio, void (*func)(void *), void *arg) {
+	(void)wsp; (void)size; (void)prio; (void)func; (void)arg;
+	return 0;
+}
+static inline thread_t *chThdGetSelfX(void) {return 0;}
+static inline bool chThdShouldTerminateX(void) {return true;}
+static inline void chEvtRegister(event_source_t *esp, event_listener_t *elp, int id) {(void)esp; (void)elp; (void)id;}
+static inline void chEvtUnregister(event_source_t *esp, event_listener_t *elp) {(void)esp; (void)elp;}
+static inline void chEvtSignal(thread_t *tp, eventmask_t events) {(void)tp; (void)events;}
+static inline void chEvtSignalI(thread_t *tp, eventmask_t events) {(void)tp; (void)events;}
+static inline eventmask_t chEvtWaitAny(eventmask_t events) {return events;}
+static inline eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t time) {(void)time; return events;}
+
+#endif /* CH_H_ */
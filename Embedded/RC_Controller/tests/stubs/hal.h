@@ -0,0 +1,130 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+// No hardware on the host
+
+#include "ch.h"
+
+typedef struct BaseSequentialStream BaseSequentialStream;
+
+// CAN frames as in the STM32 CAN driver of ChibiOS. Nothing is received and
+// transmitted frames are dropped.
+typedef struct {
+	uint8_t DLC:4;
+	uint8_t RTR:1;
+	uint8_t IDE:1;
+	union {
+		uint32_t SID:11;
+		uint32_t EID:29;
+	};
+	union {
+		uint8_t data8[8];
+		uint32_t data32[2];
+	};
+} CANRxFrame;
+
+typedef CANRxFrame CANTxFrame;
+
+typedef struct {
+	uint32_t mcr;
+	uint32_t btr;
+} CANConfig;
+
+typedef struct {
+	event_source_t rxfull_event;
+} CANDriver;
+
+extern CANDriver CAND1;
+
+#define CAN_IDE_STD							0
+#define CAN_IDE_EXT							1
+#define CAN_RTR_DATA						0
+#define CAN_ANY_MAILBOX						0
+#define CAN_MCR_TXFP						((uint32_t)0x04)
+#define CAN_MCR_AWUM						((uint32_t)0x20)
+#define CAN_MCR_ABOM						((uint32_t)0x40)
+#define CAN_BTR_BRP(n)						((uint32_t)(n))
+#define CAN_BTR_TS1(n)						((uint32_t)(n) << 16)
+#define CAN_BTR_TS2(n)						((uint32_t)(n) << 20)
+#define CAN_BTR_SJW(n)						((uint32_t)(n) << 24)
+
+static inline void canStart(CANDriver *canp, const CANConfig *config) {(void)canp; (void)config;}
+static inline msg_t canReceive(CANDriver *canp, int mailbox, CANRxFrame *crfp, systime_t timeout) {
+	(void)canp; (void)mailbox; (void)crfp; (void)timeout;
+	return MSG_TIMEOUT;
+}
+static inline msg_t canTransmit(CANDriver *canp, int mailbox, const CANTxFrame *ctfp, systime_t timeout) {
+	(void)canp; (void)mailbox; (void)ctfp; (void)timeout;
+	return MSG_OK;
+}
+
+// UART driver. Nothing is received and transmissions end right away.
+typedef uint32_t uartflags_t;
+typedef struct UARTDriver UARTDriver;
+
+typedef struct {
+	volatile uint32_t BRR;
+} USART_TypeDef;
+
+typedef enum {UART_TX_IDLE = 0, UART_TX_ACTIVE, UART_TX_COMPLETE} uarttxstate_t;
+
+struct UARTDriver {
+	uarttxstate_t txstate;
+	USART_TypeDef *usart;
+};
+
+typedef struct {
+	void (*txend1_cb)(UARTDriver *uartp);
+	void (*txend2_cb)(UARTDriver *uartp);
+	void (*rxend_cb)(UARTDriver *uartp);
+	void (*rxchar_cb)(UARTDriver *uartp, uint16_t c);
+	void (*rxerr_cb)(UARTDriver *uartp, uartflags_t e);
+	uint32_t speed;
+	uint16_t cr1;
+	uint16_t cr2;
+	uint16_t cr3;
+} UARTConfig;
+
+extern UARTDriver UARTD6;
+extern USART_TypeDef stub_usart6;
+
+#define USART1								((USART_TypeDef*)0)
+#define USART_CR2_LINEN						((uint16_t)0x4000)
+#define STM32_PCLK1							42000000
+#define STM32_PCLK2							84000000
+
+static inline void uartStart(UARTDriver *uartp, const UARTConfig *config) {
+	(void)config;
+	uartp->usart = &stub_usart6;
+}
+static inline void uartStartSend(UARTDriver *uartp, size_t n, const void *txbuf) {(void)uartp; (void)n; (void)txbuf;}
+
+// Pads
+#define GPIOC								((void*)0)
+#define GPIOD								((void*)0)
+#define GPIO_AF_CAN1						9
+#define PAL_MODE_OUTPUT_PUSHPULL			6
+#define PAL_MODE_ALTERNATE(n)				((n) << 7)
+
+static inline void palSetPadMode(void *port, int pad, int mode) {(void)port; (void)pad; (void)mode;}
+static inline void palSetPad(void *port, int pad) {(void)port; (void)pad;}
+static inline void palClearPad(void *port, int pad) {(void)port; (void)pad;}
+
+#endif /* HAL_H_ */
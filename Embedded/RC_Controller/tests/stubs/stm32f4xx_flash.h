@@ -0,0 +1,64 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STM32F4XX_FLASH_H_
+#define STM32F4XX_FLASH_H_
+
+/*
+ * The flash part of the standard peripheral library, for the EEPROM
+ * emulation. The functions are implemented by the test with a simulated
+ * flash. Include this first, it also keeps the stm32f4xx_conf.h of the
+ * firmware with the rest of the library out.
+ */
+
+#include <stdint.h>
+
+#define __STM32F4xx_CONF_H
+
+#define __IO								volatile
+
+typedef enum {
+	FLASH_BUSY = 1,
+	FLASH_ERROR_RD,
+	FLASH_ERROR_PGS,
+	FLASH_ERROR_PGP,
+	FLASH_ERROR_PGA,
+	FLASH_ERROR_WRP,
+	FLASH_ERROR_PROGRAM,
+	FLASH_ERROR_OPERATION,
+	FLASH_COMPLETE
+} FLASH_Status;
+
+#define FLASH_Sector_0						((uint16_t)0x0000)
+#define FLASH_Sector_1						((uint16_t)0x0008)
+#define FLASH_Sector_2						((uint16_t)0x0010)
+#define FLASH_Sector_3						((uint16_t)0x0018)
+#define FLASH_Sector_4						((uint16_t)0x0020)
+#define FLASH_Sector_5						((uint16_t)0x0028)
+#define FLASH_Sector_6						((uint16_t)0x0030)
+#define FLASH_Sector_7						((uint16_t)0x0038)
+#define FLASH_Sector_8						((uint16_t)0x0040)
+#define FLASH_Sector_9						((uint16_t)0x0048)
+#define FLASH_Sector_10						((uint16_t)0x0050)
+#define FLASH_Sector_11						((uint16_t)0x0058)
+
+#define VoltageRange_3						((uint8_t)0x02)
+
+FLASH_Status FLASH_ProgramHalfWord(uint32_t Address, uint16_t Data);
+FLASH_Status FLASH_EraseSector(uint32_t FLASH_Sector, uint8_t VoltageRange);
+
+#endif /* STM32F4XX_FLASH_H_ */
@@ -0,0 +1,56 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STM32F4XX_TIM_H_
+#define STM32F4XX_TIM_H_
+
+/*
+ * The timer part of the standard peripheral library, for the iteration
+ * timer in pos.c. TIM6 is a plain counter that the tests set. Include this
+ * first, it also keeps the stm32f4xx_conf.h of the firmware with the rest
+ * of the library out.
+ */
+
+#include <stdint.h>
+
+#define __STM32F4xx_CONF_H
+
+typedef struct {
+	volatile uint32_t CNT;
+} TIM_TypeDef;
+
+typedef struct {
+	uint16_t TIM_Prescaler;
+	uint16_t TIM_CounterMode;
+	uint32_t TIM_Period;
+	uint16_t TIM_ClockDivision;
+	uint8_t TIM_RepetitionCounter;
+} TIM_TimeBaseInitTypeDef;
+
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+extern TIM_TypeDef stub_tim6;
+
+#define TIM6								(&stub_tim6)
+#define TIM_CounterMode_Up					((uint16_t)0x0000)
+#define RCC_APB1Periph_TIM6					((uint32_t)0x00000010)
+
+static inline void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state) {(void)periph; (void)state;}
+static inline void TIM_TimeBaseInit(TIM_TypeDef *tim, TIM_TimeBaseInitTypeDef *init) {(void)tim; (void)init;}
+static inline void TIM_Cmd(TIM_TypeDef *tim, FunctionalState state) {(void)tim; (void)state;}
+
+#endif /* STM32F4XX_TIM_H_ */
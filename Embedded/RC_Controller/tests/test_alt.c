@@ -0,0 +1,290 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Altitude estimation of the multirotor, with a simulated vertical flight.
+ * The accelerometer, the ultrasound sensor and the delayed GNSS height are
+ * generated from the true height and fed to pos.c, which is included so that
+ * its private state can be inspected.
+ */
+
+#include "stm32f4xx_tim.h"
+#include "../pos.c"
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Simulation settings
+#define SIM_DT_MS			2
+#define SIM_SONAR_MS		50
+#define SIM_SONAR_RANGE		2.5
+#define SIM_GNSS_MS			200
+#define SIM_HIST_LEN		1000
+
+typedef struct {
+	double z;
+	double vz;
+	double acc_bias;
+	bool sonar_on;
+	bool gnss_on;
+	float z_hist[SIM_HIST_LEN];
+	int hist_ind;
+	double err_max;
+} sim_state_t;
+
+systime_t stub_time_ms;
+TIM_TypeDef stub_tim6;
+MAIN_CONFIG main_config;
+
+static sim_state_t m_sim;
+static void(*m_srf_func)(float distance);
+
+// Stubs for the rest of the firmware
+void led_write(int num, int state) {(void)num; (void)state;}
+void mpu9150_init(void) {}
+void mpu9150_sample_gyro_offsets(uint32_t iteratons) {(void)iteratons;}
+void mpu9150_set_read_callback(void(*func)(void)) {(void)func;}
+void mpu9150_get_accel_gyro_mag(float *accel, float *gyro, float *mag) {(void)accel; (void)gyro; (void)mag;}
+void mpu9150_get_raw_accel_gyro_mag(int16_t *gyro_accel) {(void)gyro_accel;}
+void ublox_set_rx_callback_relposned(void(*func)(ubx_nav_relposned *pos)) {(void)func;}
+void commands_printf(const char* format, ...) {(void)format;}
+bool imu_capture_is_enabled(void) {return false;}
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us) {(void)raw; (void)dt_us;}
+bool mr_control_is_throttle_over_tres(void) {return true;}
+void mr_control_run_iteration(float dt) {(void)dt;}
+
+void srf10_set_sample_callback(void (*func)(float distance)) {
+	m_srf_func = func;
+}
+
+void terminal_register_command_callback(const char* command, const char *help,
+		const char *arg_names, void(*cbf)(int argc, const char **argv)) {
+	(void)command; (void)help; (void)arg_names; (void)cbf;
+}
+
+static void sim_reset(double z, double acc_bias) {
+	memset(&main_config, 0, sizeof(main_config));
+	memset(&m_sim, 0, sizeof(m_sim));
+	stub_time_ms = 10000;
+	pos_init();
+
+	m_sim.z = z;
+	m_sim.acc_bias = acc_bias;
+	m_sim.sonar_on = true;
+	m_sim.gnss_on = true;
+
+	for (int i = 0;i < SIM_HIST_LEN;i++) {
+		m_sim.z_hist[i] = z;
+	}
+}
+
+/*
+ * Fly with the vertical speed vz for some time. The speed changes in the
+ * first step, which the accelerometer sees as one large sample. The sonar
+ * stops sending samples above SIM_SONAR_RANGE, as srf10.c does, and the
+ * GNSS height is ALT_GNSS_DELAY_MS old. pos_input_nmea passes it on after
+ * subtracting the ground level.
+ */
+static void sim_run(double vz, double seconds) {
+	const int steps = (int)(seconds * 1000.0 / SIM_DT_MS);
+	const float dt = SIM_DT_MS / 1000.0;
+
+	for (int i = 0;i < steps;i++) {
+		const double acc = (vz - m_sim.vz) / dt;
+		m_sim.vz = vz;
+		m_sim.z += m_sim.vz * dt;
+		stub_time_ms += SIM_DT_MS;
+
+		m_sim.hist_ind = (m_sim.hist_ind + 1) % SIM_HIST_LEN;
+		m_sim.z_hist[m_sim.hist_ind] = m_sim.z;
+
+		float accel[3] = {0.0, 0.0, 1.0 + (acc + m_sim.acc_bias) / ALT_GRAVITY};
+		mr_update_alt(&m_pos, accel, dt);
+
+		if (m_sim.sonar_on && m_sim.z < SIM_SONAR_RANGE &&
+				stub_time_ms % SIM_SONAR_MS == 0) {
+			m_srf_func(m_sim.z);
+		}
+
+		if (m_sim.gnss_on && stub_time_ms % SIM_GNSS_MS == 0) {
+			int ind = m_sim.hist_ind - ALT_GNSS_DELAY_MS / SIM_DT_MS;
+			if (ind < 0) {
+				ind += SIM_HIST_LEN;
+			}
+
+			gnss_height_received(m_sim.z_hist[ind]);
+		}
+
+		m_sim.err_max = fmax(m_sim.err_max, fabs(m_pos.pz - m_sim.z));
+	}
+}
+
+/*
+ * The accelerometer bias is estimated with the ultrasound sensor, and without
+ * it from the GNSS height alone.
+ */
+static int test_bias_convergence(void) {
+	sim_reset(0.8, 0.3);
+	sim_run(0.0, 30.0);
+
+	printf("bias sonar: %.4f m/s^2, height error %.4f m\n",
+			(double)m_alt.acc_bias, (double)(m_pos.pz - m_sim.z));
+	CHECK(fabs(m_alt.acc_bias - 0.3) < 0.01, "bias %f", (double)m_alt.acc_bias);
+	CHECK(fabs(m_pos.pz - m_sim.z) < 0.01, "height error %f", m_pos.pz - m_sim.z);
+	CHECK(fabs(m_pos.vz) < 0.01, "vertical speed %f", (double)m_pos.vz);
+
+	sim_reset(10.0, -0.2);
+	m_sim.sonar_on = false;
+	m_pos.pz = 10.0;
+	sim_run(0.0, 60.0);
+
+	printf("bias GNSS: %.4f m/s^2, height error %.4f m\n",
+			(double)m_alt.acc_bias, (double)(m_pos.pz - m_sim.z));
+	CHECK(fabs(m_alt.acc_bias + 0.2) < 0.01, "bias %f", (double)m_alt.acc_bias);
+	CHECK(fabs(m_pos.pz - m_sim.z) < 0.01, "height error %f", m_pos.pz - m_sim.z);
+
+	return 0;
+}
+
+static int test_sonar_gate(void) {
+	sim_reset(2.0, 0.0);
+	m_sim.gnss_on = false;
+	m_pos.pz = 2.0;
+	sim_run(0.0, 2.0);
+	CHECK(fabs(m_alt.z_sonar - 2.0) < 1e-4, "sonar height %f", (double)m_alt.z_sonar);
+
+	// A single spike is rejected and does not move the estimate
+	const systime_t update_time = m_pos.ultra_update_time;
+	m_srf_func(3.5);
+	CHECK(m_alt.sonar_rejects == 1, "spike not rejected");
+	CHECK(fabs(m_alt.z_sonar - 2.0) < 1e-4, "spike used: %f", (double)m_alt.z_sonar);
+	CHECK(m_pos.ultra_update_time == update_time, "spike updated the time");
+
+	sim_run(0.0, 0.5);
+	CHECK(m_alt.sonar_rejects == 0, "rejects not reset");
+	CHECK(fabs(m_pos.pz - 2.0) < 0.01, "estimate moved by spike: %f", (double)m_pos.pz);
+
+	// Out of range and tilted samples are not used and are no spikes
+	const systime_t update_time_valid = m_pos.ultra_update_time;
+	m_srf_func(ALT_SONAR_MAX + 0.5);
+	m_srf_func(0.01);
+	m_pos.roll = ALT_SONAR_MAX_TILT + 5.0;
+	m_srf_func(2.0);
+	m_pos.roll = 0.0;
+	CHECK(m_alt.sonar_rejects == 0, "invalid samples counted as spikes");
+	CHECK(m_pos.ultra_update_time == update_time_valid, "invalid sample used");
+
+	// The beam is tilted with the copter
+	m_pos.roll = 20.0;
+	m_srf_func(2.0);
+	m_pos.roll = 0.0;
+	CHECK(fabs(m_alt.z_sonar - 2.0 * cosf(20.0 * M_PI / 180.0)) < 1e-4,
+			"tilted height %f", (double)m_alt.z_sonar);
+
+	// Flying over a table. The sonar keeps disagreeing and is used again
+	// after ALT_SONAR_MAX_REJECTS samples.
+	for (int i = 0;i < ALT_SONAR_MAX_REJECTS;i++) {
+		m_srf_func(0.7);
+		CHECK(m_alt.sonar_rejects == i + 1, "sample %d not rejected", i);
+	}
+
+	m_srf_func(0.7);
+	CHECK(m_alt.sonar_rejects == 0, "step not accepted");
+	CHECK(fabs(m_alt.z_sonar - 0.7) < 1e-4, "step height %f", (double)m_alt.z_sonar);
+
+	return 0;
+}
+
+/*
+ * Climb out of the range of the sonar and come down again, with the GNSS
+ * height available all the time.
+ */
+static int test_sonar_gnss_handover(void) {
+	sim_reset(1.0, 0.1);
+	m_pos.pz = 1.0;
+	sim_run(0.0, 20.0);
+	m_sim.err_max = 0.0;
+
+	sim_run(1.0, 1.0);
+	CHECK(ST2MS(chVTTimeElapsedSinceX(m_pos.ultra_update_time)) < ALT_SONAR_TIMEOUT_MS,
+			"sonar not used at %.1f m", m_sim.z);
+
+	sim_run(1.0, 8.0);
+	CHECK(ST2MS(chVTTimeElapsedSinceX(m_pos.ultra_update_time)) > ALT_SONAR_TIMEOUT_MS,
+			"sonar used at %.1f m", m_sim.z);
+	const double err_climb = m_sim.err_max;
+
+	m_sim.err_max = 0.0;
+	sim_run(0.0, 20.0);
+	const double err_hover = fabs(m_pos.pz - m_sim.z);
+
+	m_sim.err_max = 0.0;
+	sim_run(-1.0, 8.0);
+	sim_run(0.0, 5.0);
+	const double err_descent = m_sim.err_max;
+
+	printf("handover: max error climb %.3f m, hover %.3f m, descent %.3f m\n",
+			err_climb, err_hover, err_descent);
+
+	// The last sonar height is used for ALT_SONAR_TIMEOUT_MS after the sonar
+	// stops and the GNSS height is late. Compared to the current estimate
+	// they made the error 0.4 m during the climb.
+	CHECK(err_climb < 0.05, "climb error %f", err_climb);
+	CHECK(err_hover < 0.01, "hover error %f", err_hover);
+	CHECK(err_descent < 0.05, "descent error %f", err_descent);
+	CHECK(fabs(m_alt.z_sonar - 2.0) < 1e-3, "sonar height %f", (double)m_alt.z_sonar);
+
+	return 0;
+}
+
+/*
+ * Climbing on the GNSS height alone. The samples are late and arrive at
+ * 5 Hz, so comparing them to the current estimate would make it lag behind
+ * by about 0.2 m at 2 m/s.
+ */
+static int test_gnss_climb(void) {
+	sim_reset(10.0, 0.0);
+	m_sim.sonar_on = false;
+	m_pos.pz = 10.0;
+	sim_run(0.0, 10.0);
+
+	m_sim.err_max = 0.0;
+	sim_run(2.0, 10.0);
+	const double err_climb = m_sim.err_max;
+
+	m_sim.err_max = 0.0;
+	sim_run(0.0, 10.0);
+	const double err_stop = m_sim.err_max;
+
+	printf("GNSS climb: max error %.3f m, after stop %.3f m\n", err_climb, err_stop);
+	CHECK(err_climb < 0.02, "climb error %f", err_climb);
+	CHECK(err_stop < 0.02, "error after stop %f", err_stop);
+
+	return 0;
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_bias_convergence();
+	res |= test_sonar_gate();
+	res |= test_sonar_gnss_handover();
+	res |= test_gnss_climb();
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
@@ -0,0 +1,449 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The EEPROM emulation on a simulated flash. The two pages are mapped at
+ * their real addresses, programming can only clear bits and every program
+ * or erase operation can be the last one before a power loss. The source is
+ * included so that a reboot can clear its RAM state.
+ */
+
+#include "stm32f4xx_flash.h"
+#include "../eeprom.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Same layout as conf_general
+#define VAR_BASE			1000
+#define VAR_NUM				(sizeof(MAIN_CONFIG) / 2)
+#define FLASH_SIZE			(2 * PAGE_SIZE)
+
+uint16_t VirtAddVarTab[NB_OF_VAR];
+
+static uint8_t *m_flash;
+static int m_ops_left = -1;
+static jmp_buf m_power_loss;
+static unsigned int m_programs = 0;
+static unsigned int m_erases = 0;
+static unsigned int m_bad_programs = 0;
+
+// What should be stored
+static uint16_t m_shadow[VAR_NUM];
+static bool m_stored[VAR_NUM];
+
+static unsigned int m_rnd = 1;
+
+static unsigned int rnd(void) {
+	m_rnd = m_rnd * 1103515245 + 12345;
+	return (m_rnd >> 16) & 0x7FFF;
+}
+
+// Called before every flash operation. The power is lost when the budget is used up.
+static void power_check(void) {
+	if (m_ops_left == 0) {
+		longjmp(m_power_loss, 1);
+	}
+
+	if (m_ops_left > 0) {
+		m_ops_left--;
+	}
+}
+
+FLASH_Status FLASH_ProgramHalfWord(uint32_t Address, uint16_t Data) {
+	power_check();
+
+	if (Address < EEPROM_START_ADDRESS || (Address + 2) > (EEPROM_START_ADDRESS + FLASH_SIZE) ||
+			(Address & 1)) {
+		return FLASH_ERROR_PGA;
+	}
+
+	uint16_t *p = (uint16_t*)(m_flash + (Address - EEPROM_START_ADDRESS));
+
+	// Programming can only clear bits
+	if ((*p & Data) != Data) {
+		m_bad_programs++;
+	}
+
+	*p &= Data;
+	m_programs++;
+
+	return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_EraseSector(uint32_t FLASH_Sector, uint8_t VoltageRange) {
+	(void)VoltageRange;
+	power_check();
+
+	if (FLASH_Sector == PAGE0_ID) {
+		memset(m_flash, 0xFF, PAGE_SIZE);
+	} else if (FLASH_Sector == PAGE1_ID) {
+		memset(m_flash + PAGE_SIZE, 0xFF, PAGE_SIZE);
+	} else {
+		return FLASH_ERROR_OPERATION;
+	}
+
+	m_erases++;
+
+	return FLASH_COMPLETE;
+}
+
+static uint16_t page_status(int page) {
+	return *(uint16_t*)(m_flash + page * PAGE_SIZE);
+}
+
+// The RAM state is lost and the flash stays
+static void reboot(void) {
+	m_ops_left = -1;
+	m_index_page = NO_VALID_PAGE;
+	memset(m_var_slot, 0, sizeof(m_var_slot));
+	memset(m_free_addr, 0, sizeof(m_free_addr));
+	DataVar = 0;
+}
+
+// The latest copy of a variable by scanning the valid page, without the index
+static int scan_variable(uint16_t addr, uint16_t *data) {
+	int page = page_status(0) == VALID_PAGE ? 0 : (page_status(1) == VALID_PAGE ? 1 : -1);
+
+	if (page < 0) {
+		return -1;
+	}
+
+	uint16_t *p = (uint16_t*)(m_flash + page * PAGE_SIZE);
+	for (int slot = PAGE_SIZE / 4 - 1;slot > 0;slot--) {
+		if (p[2 * slot + 1] == addr) {
+			*data = p[2 * slot];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_vars(const uint16_t *expected, const bool *stored) {
+	CHECK((page_status(0) == VALID_PAGE) != (page_status(1) == VALID_PAGE),
+			"page status %04X %04X", page_status(0), page_status(1));
+
+	for (unsigned int i = 0;i < VAR_NUM;i++) {
+		uint16_t data = 0;
+		uint16_t scanned = 0;
+		uint16_t res = EE_ReadVariable(VAR_BASE + i, &data);
+		int found = scan_variable(VAR_BASE + i, &scanned);
+
+		CHECK(res == (stored[i] ? 0 : 1), "var %u read status %u", i, res);
+		CHECK(found == (stored[i] ? 1 : 0), "var %u not on the page", i);
+
+		if (stored[i]) {
+			CHECK(data == expected[i], "var %u is %04X, expected %04X", i, data, expected[i]);
+			CHECK(scanned == data, "var %u index %04X, scan %04X", i, data, scanned);
+		}
+	}
+
+	return 0;
+}
+
+static void erase_all(void) {
+	memset(m_flash, 0xFF, FLASH_SIZE);
+	reboot();
+	memset(m_stored, 0, sizeof(m_stored));
+}
+
+static uint16_t write_var(unsigned int var, uint16_t data) {
+	uint16_t res = EE_WriteVariable(VAR_BASE + var, data);
+
+	if (res == FLASH_COMPLETE) {
+		m_shadow[var] = data;
+		m_stored[var] = true;
+	}
+
+	return res;
+}
+
+// Write all variables, some of them changed, like conf_general does
+static uint16_t write_all(int changes) {
+	uint16_t addr[VAR_NUM];
+	uint16_t data[VAR_NUM];
+
+	for (unsigned int i = 0;i < VAR_NUM;i++) {
+		addr[i] = VAR_BASE + i;
+		data[i] = m_shadow[i];
+	}
+
+	for (int i = 0;i < changes;i++) {
+		data[rnd() % VAR_NUM] = rnd();
+	}
+
+	uint16_t res = EE_WriteVariables(addr, data, VAR_NUM);
+
+	if (res == FLASH_COMPLETE) {
+		memcpy(m_shadow, data, sizeof(m_shadow));
+		for (unsigned int i = 0;i < VAR_NUM;i++) {
+			m_stored[i] = true;
+		}
+	}
+
+	return res;
+}
+
+// Append single writes until fewer than slots are left on the valid page
+static int fill_page(unsigned int slots) {
+	for (;;) {
+		uint16_t page = EE_FindValidPage(READ_FROM_VALID_PAGE);
+		CHECK(page != NO_VALID_PAGE, "no valid page");
+
+		if (EE_FreeSlots(page) < slots) {
+			return 0;
+		}
+
+		CHECK(write_var(rnd() % VAR_NUM, rnd()) == FLASH_COMPLETE, "write failed");
+	}
+}
+
+static int test_basic(void) {
+	uint16_t data = 0;
+
+	erase_all();
+	CHECK(EE_Init() == FLASH_COMPLETE, "init");
+	CHECK(page_status(0) == VALID_PAGE && page_status(1) == ERASED, "not formatted");
+	CHECK(EE_ReadVariable(VAR_BASE, &data) == 1, "found in empty page");
+
+	CHECK(write_var(5, 0x1234) == FLASH_COMPLETE, "write");
+	CHECK(write_var(5, 0x4321) == FLASH_COMPLETE, "write");
+	CHECK(write_var(7, 0x0000) == FLASH_COMPLETE, "write");
+	CHECK(check_vars(m_shadow, m_stored) == 0, "after writes");
+
+	reboot();
+	CHECK(EE_Init() == FLASH_COMPLETE, "init");
+	CHECK(check_vars(m_shadow, m_stored) == 0, "after reboot");
+
+	// Storing the same values again does not program anything
+	CHECK(write_all(0) == FLASH_COMPLETE, "bulk write");
+	unsigned int programs = m_programs;
+	CHECK(write_all(0) == FLASH_COMPLETE, "bulk write");
+	CHECK(m_programs == programs, "%u words programmed for no change", m_programs - programs);
+
+	CHECK(write_all(3) == FLASH_COMPLETE, "bulk write");
+	CHECK(m_programs - programs <= 2 * 3, "%u words programmed for 3 changes", m_programs - programs);
+	CHECK(check_vars(m_shadow, m_stored) == 0, "after bulk writes");
+
+	return 0;
+}
+
+/*
+ * Many single and bulk writes, so that the pages are transferred back and
+ * forth, checked against the expected values and after reboots.
+ */
+static int test_transfers(void) {
+	erase_all();
+	CHECK(EE_Init() == FLASH_COMPLETE, "init");
+
+	unsigned int erases = m_erases;
+
+	for (int i = 0;i < 40000;i++) {
+		if ((i % 50) == 0) {
+			CHECK(write_all(1 + rnd() % 8) == FLASH_COMPLETE, "bulk write %d", i);
+		} else {
+			CHECK(write_var(rnd() % VAR_NUM, rnd()) == FLASH_COMPLETE, "write %d", i);
+		}
+
+		if ((i % 997) == 0) {
+			CHECK(check_vars(m_shadow, m_stored) == 0, "after %d writes", i);
+			reboot();
+			CHECK(EE_Init() == FLASH_COMPLETE, "init");
+			CHECK(check_vars(m_shadow, m_stored) == 0, "after %d writes and reboot", i);
+		}
+	}
+
+	CHECK(check_vars(m_shadow, m_stored) == 0, "at the end");
+	CHECK(m_erases - erases >= 8, "only %u page transfers", m_erases - erases);
+	CHECK(m_bad_programs == 0, "%u programs to non-erased words", m_bad_programs);
+
+	return 0;
+}
+
+// A bulk write that does not fit goes to the other page in one transfer
+static int test_bulk_transfer(void) {
+	erase_all();
+	CHECK(EE_Init() == FLASH_COMPLETE, "init");
+	CHECK(write_all(0) == FLASH_COMPLETE, "bulk write");
+	CHECK(fill_page(10) == 0, "fill");
+
+	unsigned int erases = m_erases;
+	uint16_t page = EE_FindValidPage(READ_FROM_VALID_PAGE);
+
+	CHECK(write_all(VAR_NUM) == FLASH_COMPLETE, "bulk write");
+	CHECK(m_erases - erases == 1, "%u erases", m_erases - erases);
+	CHECK(EE_FindValidPage(READ_FROM_VALID_PAGE) != page, "page not transferred");
+	CHECK(EE_FreeSlots(!page) >= (PAGE_SIZE / 4 - 1 - 2 * VAR_NUM), "new page too full");
+	CHECK(check_vars(m_shadow, m_stored) == 0, "after transfer");
+
+	return 0;
+}
+
+typedef enum {
+	OP_SINGLE = 0,
+	OP_BULK,
+	OP_BULK_TRANSFER,
+	OP_SINGLE_TRANSFER
+} op_t;
+
+static const char *op_names[] = {"single", "bulk", "bulk transfer", "single transfer"};
+
+/*
+ * Cut the power before every flash operation of a write, and for some of
+ * them once more before every operation of the repair in EE_Init. Every
+ * variable must then have either its old or its new value, and the EEPROM
+ * must still work.
+ */
+static int test_power_loss(op_t op) {
+	static uint8_t flash_before[FLASH_SIZE];
+	uint16_t old_shadow[VAR_NUM];
+	bool old_stored[VAR_NUM];
+	uint16_t new_shadow[VAR_NUM];
+	bool new_stored[VAR_NUM];
+
+	erase_all();
+	CHECK(EE_Init() == FLASH_COMPLETE, "init");
+
+	for (unsigned int i = 0;i < VAR_NUM;i += 2) {
+		CHECK(write_var(i, rnd()) == FLASH_COMPLETE, "write");
+	}
+
+	if (op == OP_BULK_TRANSFER || op == OP_SINGLE_TRANSFER) {
+		CHECK(fill_page(1) == 0, "fill");
+	}
+
+	memcpy(flash_before, m_flash, FLASH_SIZE);
+	memcpy(old_shadow, m_shadow, sizeof(m_shadow));
+	memcpy(old_stored, m_stored, sizeof(m_stored));
+
+	// The write without power loss
+	unsigned int seed = m_rnd;
+	unsigned int start = m_programs + m_erases;
+	if (op == OP_SINGLE || op == OP_SINGLE_TRANSFER) {
+		CHECK(write_var(1, 0xA5A5) == FLASH_COMPLETE, "write");
+	} else {
+		CHECK(write_all(VAR_NUM / 2) == FLASH_COMPLETE, "bulk write");
+	}
+
+	int op_num = m_programs + m_erases - start;
+	memcpy(new_shadow, m_shadow, sizeof(m_shadow));
+	memcpy(new_stored, m_stored, sizeof(m_stored));
+
+	for (int cut = 0;cut < op_num;cut++) {
+		for (volatile int cut_repair = -1;;cut_repair++) {
+			memcpy(m_flash, flash_before, FLASH_SIZE);
+			memcpy(m_shadow, old_shadow, sizeof(m_shadow));
+			memcpy(m_stored, old_stored, sizeof(m_stored));
+			m_rnd = seed;
+			reboot();
+			CHECK(EE_Init() == FLASH_COMPLETE, "init");
+
+			m_ops_left = cut;
+			if (setjmp(m_power_loss) == 0) {
+				if (op == OP_SINGLE || op == OP_SINGLE_TRANSFER) {
+					write_var(1, 0xA5A5);
+				} else {
+					write_all(VAR_NUM / 2);
+				}
+
+				CHECK(0, "%s: power not lost after %d operations", op_names[op], cut);
+			}
+
+			// Power lost again while repairing
+			volatile bool repaired = true;
+			if (cut_repair >= 0) {
+				reboot();
+				m_ops_left = cut_repair;
+				if (setjmp(m_power_loss) == 0) {
+					EE_Init();
+				} else {
+					repaired = false;
+				}
+			}
+
+			reboot();
+			CHECK(EE_Init() == FLASH_COMPLETE, "%s: init after cut %d", op_names[op], cut);
+			CHECK(m_bad_programs == 0, "%s: cut %d: programs to non-erased words", op_names[op], cut);
+
+			CHECK((page_status(0) == VALID_PAGE) != (page_status(1) == VALID_PAGE),
+					"%s: cut %d, %d: page status %04X %04X", op_names[op], cut, cut_repair,
+					page_status(0), page_status(1));
+
+			for (unsigned int i = 0;i < VAR_NUM;i++) {
+				uint16_t data = 0;
+				uint16_t res = EE_ReadVariable(VAR_BASE + i, &data);
+
+				bool is_old = old_stored[i] ? (res == 0 && data == old_shadow[i]) : res == 1;
+				bool is_new = new_stored[i] ? (res == 0 && data == new_shadow[i]) : res == 1;
+
+				CHECK(is_old || is_new, "%s: cut %d, %d: var %u is %04X (%u), old %04X, new %04X",
+						op_names[op], cut, cut_repair, i, data, res, old_shadow[i], new_shadow[i]);
+
+				m_shadow[i] = data;
+				m_stored[i] = res == 0;
+			}
+
+			// Still usable
+			CHECK(write_var(0, 0x5A5A) == FLASH_COMPLETE, "%s: write after cut %d", op_names[op], cut);
+			CHECK(check_vars(m_shadow, m_stored) == 0, "%s: cut %d", op_names[op], cut);
+
+			// Every repair step is cut for some of the write steps only, all would take minutes
+			bool cut_repairs = cut < 2 || (cut % 64) == 0 || cut >= (op_num - 2);
+			if (!cut_repairs || (cut_repair >= 0 && repaired)) {
+				break;
+			}
+		}
+	}
+
+	printf("%s: %d power cuts\n", op_names[op], op_num);
+
+	return 0;
+}
+
+int main(void) {
+	int res = 0;
+
+	// The pages at the addresses in eeprom.h
+	m_flash = mmap((void*)(uintptr_t)EEPROM_START_ADDRESS, FLASH_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (m_flash != (uint8_t*)(uintptr_t)EEPROM_START_ADDRESS) {
+		printf("Could not map the flash at 0x%08X\n", (unsigned int)EEPROM_START_ADDRESS);
+		return 1;
+	}
+
+	memset(VirtAddVarTab, 0, sizeof(VirtAddVarTab));
+	for (unsigned int i = 0;i < VAR_NUM;i++) {
+		VirtAddVarTab[i] = VAR_BASE + i;
+	}
+
+	res |= test_basic();
+	res |= test_transfers();
+	res |= test_bulk_transfer();
+	res |= test_power_loss(OP_SINGLE);
+	res |= test_power_loss(OP_BULK);
+	res |= test_power_loss(OP_SINGLE_TRANSFER);
+	res |= test_power_loss(OP_BULK_TRANSFER);
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
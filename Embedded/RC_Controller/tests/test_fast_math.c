@@ -0,0 +1,194 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The approximations used with FAST_MATH compared against libm in double
+ * precision. The limits are the errors the hot paths were checked with, so
+ * a change to an approximation that makes it worse fails here.
+ */
+
+#include "utils.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+#define STEPS				20000
+#define BENCH_ITERATIONS	2000000
+
+static volatile float m_sink;
+
+static double time_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double angle_diff(double a, double b) {
+	double d = fmod(a - b, 2.0 * M_PI);
+	if (d > M_PI) {
+		d -= 2.0 * M_PI;
+	} else if (d < -M_PI) {
+		d += 2.0 * M_PI;
+	}
+	return fabs(d);
+}
+
+static int test_sincos(void) {
+	double err = 0.0;
+	double err_better = 0.0;
+
+	for (int i = -STEPS;i <= STEPS;i++) {
+		float a = (float)i * (float)M_PI / (float)STEPS;
+		float s, c;
+
+		utils_fast_sincos(a, &s, &c);
+		err = fmax(err, fabs(s - sin(a)));
+		err = fmax(err, fabs(c - cos(a)));
+
+		utils_fast_sincos_better(a, &s, &c);
+		err_better = fmax(err_better, fabs(s - sin(a)));
+		err_better = fmax(err_better, fabs(c - cos(a)));
+	}
+
+	printf("sincos:        max error %.2e\n", err);
+	printf("sincos better: max error %.2e\n", err_better);
+	// The plain version is the coarse one, UTILS_SINCOS uses the better one
+	CHECK(err < 6e-2, "sincos error %g", err);
+	CHECK(err_better < 1.5e-3, "sincos better error %g", err_better);
+
+	return 0;
+}
+
+// Up to 1.2 rad, which covers the tilt angles the multirotor code uses
+static int test_tan(void) {
+	double err = 0.0;
+
+	for (int i = -STEPS;i <= STEPS;i++) {
+		float a = (float)i * 1.2f / (float)STEPS;
+		err = fmax(err, fabs(utils_fast_tan(a) - tan(a)));
+	}
+
+	printf("tan:           max error %.2e\n", err);
+	CHECK(err < 8e-3, "tan error %g", err);
+
+	return 0;
+}
+
+static int test_atan2(void) {
+	double err = 0.0;
+
+	// All directions at a few radii, including points on the axes
+	for (int r = 0;r < 4;r++) {
+		float rad = powf(10.0f, (float)(r - 2));
+
+		for (int i = -STEPS;i <= STEPS;i++) {
+			float a = (float)i * (float)M_PI / (float)STEPS;
+			float y = rad * sinf(a);
+			float x = rad * cosf(a);
+			err = fmax(err, angle_diff(utils_fast_atan2(y, x), atan2(y, x)));
+		}
+	}
+
+	printf("atan2:         max error %.2e rad\n", err);
+	CHECK(err < 1.2e-2, "atan2 error %g", err);
+
+	return 0;
+}
+
+static int test_asin(void) {
+	double err = 0.0;
+
+	for (int i = -STEPS;i <= STEPS;i++) {
+		float x = (float)i / (float)STEPS;
+		err = fmax(err, fabs(utils_fast_asin(x) - asin(x)));
+	}
+
+	printf("asin:          max error %.2e rad\n", err);
+	CHECK(err < 1.2e-2, "asin error %g", err);
+
+	return 0;
+}
+
+static int test_inv_sqrt(void) {
+	double err = 0.0;
+
+	for (int i = 1;i <= STEPS;i++) {
+		float x = powf(10.0f, -4.0f + 8.0f * (float)i / (float)STEPS);
+		err = fmax(err, fabs(utils_fast_inv_sqrt(x) * sqrt(x) - 1.0));
+	}
+
+	printf("inv sqrt:      max error %.2f %%\n", err * 100.0);
+	CHECK(err < 2.5e-3, "inv sqrt error %g", err);
+
+	return 0;
+}
+
+// Only printed. The host FPU has little in common with the Cortex-M4.
+static void bench(void) {
+	float acc = 0.0;
+	double start;
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		float s, c;
+		utils_fast_sincos_better((float)(i & 1023) * 0.006f - 3.0f, &s, &c);
+		acc += s + c;
+	}
+	printf("sincos better: %5.1f ns", (time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		float a = (float)(i & 1023) * 0.006f - 3.0f;
+		acc += sinf(a) + cosf(a);
+	}
+	printf(", sinf + cosf: %5.1f ns\n", (time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		acc += utils_fast_atan2((float)(i & 1023) - 512.0f, 100.0f);
+	}
+	printf("atan2:         %5.1f ns", (time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		acc += atan2f((float)(i & 1023) - 512.0f, 100.0f);
+	}
+	printf(", atan2f:      %5.1f ns\n", (time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	m_sink = acc;
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_sincos();
+	res |= test_tan();
+	res |= test_atan2();
+	res |= test_asin();
+	res |= test_inv_sqrt();
+
+	if (!res) {
+		bench();
+	}
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
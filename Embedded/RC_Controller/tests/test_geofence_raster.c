@@ -0,0 +1,218 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "geofence_raster.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+#define BENCH_ITERATIONS	1000000
+
+static geofence_raster_t m_r;
+static volatile int m_sink;
+
+static double time_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool point_in_polygon(double x, double y, const float *px, const float *py, int n) {
+	bool inside = false;
+	for (int i = 0, j = n - 1;i < n;j = i++) {
+		if (((double)py[i] > y) != ((double)py[j] > y) &&
+				x < (double)px[j] + ((double)px[i] - px[j]) * (y - py[j]) / ((double)py[i] - py[j])) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+/*
+ * Every cell that is marked inside must be completely inside the polygon.
+ * Check a grid of points in each such cell, including the corners. Returns
+ * the share of the polygon bounding box that is marked inside.
+ */
+static int check_conservative(const float *px, const float *py, int n, double *inside_share) {
+	const int sub = 8;
+	int inside_cells = 0;
+
+	for (int iy = 0;iy < m_r.h;iy++) {
+		for (int ix = 0;ix < m_r.w;ix++) {
+			double xc = m_r.x_min + ((double)ix + 0.5) * m_r.cell;
+			double yc = m_r.y_min + ((double)iy + 0.5) * m_r.cell;
+
+			if (!geofence_raster_inside(&m_r, xc, yc)) {
+				continue;
+			}
+
+			inside_cells++;
+
+			for (int sy = 0;sy <= sub;sy++) {
+				for (int sx = 0;sx <= sub;sx++) {
+					double x = m_r.x_min + ((double)ix + (double)sx / sub) * m_r.cell;
+					double y = m_r.y_min + ((double)iy + (double)sy / sub) * m_r.cell;
+					CHECK(point_in_polygon(x, y, px, py, n),
+							"cell (%d, %d) is inside but (%.4f, %.4f) is not", ix, iy, x, y);
+				}
+			}
+		}
+	}
+
+	*inside_share = (double)inside_cells / (double)(m_r.w * m_r.h);
+	return 0;
+}
+
+static int test_square(void) {
+	const float x[] = {0, 100, 100, 0};
+	const float y[] = {0, 0, 100, 100};
+
+	CHECK(geofence_raster_build(&m_r, x, y, 4), "build failed");
+	CHECK(geofence_raster_inside(&m_r, 50, 50), "center outside");
+	CHECK(!geofence_raster_inside(&m_r, 150, 50), "outside point inside");
+	CHECK(!geofence_raster_inside(&m_r, -0.1, 50), "outside point inside");
+	CHECK(!geofence_raster_inside(&m_r, 99.9, 50), "edge cell inside");
+
+	// The last bit of every word, which needs an unsigned shift
+	int bit31 = 0;
+	for (int iy = 0;iy < m_r.h;iy++) {
+		for (int ix = 31;ix < m_r.w;ix += 32) {
+			bit31 += geofence_raster_inside(&m_r, m_r.x_min + (ix + 0.5) * m_r.cell,
+					m_r.y_min + (iy + 0.5) * m_r.cell);
+		}
+	}
+	CHECK(bit31 > 0, "no inside cell at bit 31");
+
+	double share;
+	return check_conservative(x, y, 4, &share);
+}
+
+static int test_invalid(void) {
+	const float x[] = {0, 1};
+	const float y[] = {0, 1};
+	CHECK(!geofence_raster_build(&m_r, x, y, 2), "two points accepted");
+	return 0;
+}
+
+// Edges at shallow angles clip cell corners by tiny amounts
+static int test_shallow_edges(void) {
+	const float x[] = {0.0, 100.0, 99.7, 0.3};
+	const float y[] = {0.0, 0.37, 100.0, 99.1};
+
+	CHECK(geofence_raster_build(&m_r, x, y, 4), "build failed");
+	double share;
+	if (check_conservative(x, y, 4, &share)) {
+		return 1;
+	}
+	CHECK(share > 0.9, "only %.3f of the cells inside", share);
+	return 0;
+}
+
+// Random star shaped polygons, which are always simple
+static int test_random_polygons(void) {
+	srand(1234);
+
+	for (int p = 0;p < 200;p++) {
+		float x[GEOFENCE_MAX_POINTS], y[GEOFENCE_MAX_POINTS];
+		int n = 3 + rand() % (GEOFENCE_MAX_POINTS - 3);
+		double scale = 5.0 + (double)(rand() % 500);
+		double ang0 = (double)rand() / RAND_MAX;
+
+		for (int i = 0;i < n;i++) {
+			double ang = 2.0 * M_PI * ((double)i + ang0) / (double)n;
+			double rad = scale * (0.3 + 0.7 * (double)rand() / RAND_MAX);
+			x[i] = 1000.0 + rad * cos(ang);
+			y[i] = -500.0 + rad * sin(ang);
+		}
+
+		CHECK(geofence_raster_build(&m_r, x, y, n), "build failed, polygon %d", p);
+
+		double share;
+		if (check_conservative(x, y, n, &share)) {
+			printf("polygon %d, %d points, scale %.1f\n", p, n, scale);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The lookup geofence_check_pos does on every control tick, walking over
+ * the bounding box like geofence bench on the target, compared with a
+ * point in polygon test on the same fence with the maximum number of
+ * points. Only printed, as the host has little in common with the
+ * Cortex-M4.
+ */
+static void bench(void) {
+	float x[GEOFENCE_MAX_POINTS], y[GEOFENCE_MAX_POINTS];
+	for (int i = 0;i < GEOFENCE_MAX_POINTS;i++) {
+		double ang = 2.0 * M_PI * (double)i / (double)GEOFENCE_MAX_POINTS;
+		double rad = 100.0 * (0.6 + 0.4 * (i % 2));
+		x[i] = rad * cos(ang);
+		y[i] = rad * sin(ang);
+	}
+
+	if (!geofence_raster_build(&m_r, x, y, GEOFENCE_MAX_POINTS)) {
+		printf("bench: build failed\n");
+		return;
+	}
+
+	const float span_x = (float)(m_r.w + 2) * m_r.cell;
+	const float span_y = (float)(m_r.h + 2) * m_r.cell;
+	int inside = 0;
+	double start;
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		float px = m_r.x_min - m_r.cell + span_x * (float)(i % 100) / 100.0;
+		float py = m_r.y_min - m_r.cell + span_y * (float)((i / 100) % 100) / 100.0;
+		inside += geofence_raster_inside(&m_r, px, py);
+	}
+	printf("lookup per tick: raster %5.1f ns", (time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		float px = m_r.x_min - m_r.cell + span_x * (float)(i % 100) / 100.0;
+		float py = m_r.y_min - m_r.cell + span_y * (float)((i / 100) % 100) / 100.0;
+		inside += point_in_polygon(px, py, x, y, GEOFENCE_MAX_POINTS);
+	}
+	printf(", point in polygon with %d points %5.1f ns\n", GEOFENCE_MAX_POINTS,
+			(time_s() - start) * 1e9 / BENCH_ITERATIONS);
+
+	m_sink = inside;
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_square();
+	res |= test_invalid();
+	res |= test_shallow_edges();
+	res |= test_random_polygons();
+
+	if (!res) {
+		bench();
+	}
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
@@ -0,0 +1,337 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Yaw from a moving base receiver pair. A car turns at a constant rate, the
+ * gyro sees the rotation and the heading receiver reports the baseline
+ * vector MB_DELAY_MS late in RELPOSNED frames. The frames go through the
+ * decoder of ublox.c to pos.c, which are both included so that their
+ * private state can be used.
+ */
+
+#include "stm32f4xx_tim.h"
+#include "../ublox.c"
+#include "../pos.c"
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Simulation settings
+#define SIM_RATE			20.0 // Degrees / second
+#define SIM_MB_MS			100
+#define SIM_BASELINE		1.2 // Meters
+#define SIM_ANT_OFFSET		15.0 // Degrees, the baseline relative to the car
+#define SIM_HIST_LEN		1000
+
+// RELPOSNED flags
+#define RP_FIX_OK			0x01
+#define RP_DIFF_SOLN		0x02
+#define RP_REL_POS_VALID	0x04
+#define RP_CARR_FLOAT		(1 << 3)
+#define RP_CARR_FIX			(2 << 3)
+#define RP_IS_MOVING		0x20
+#define RP_REF_OBS_MISS		0x80
+#define RP_HEADING_VALID	0x100
+#define RP_GOOD				(RP_FIX_OK | RP_DIFF_SOLN | RP_REL_POS_VALID | RP_CARR_FIX | RP_IS_MOVING)
+
+typedef struct {
+	int version;
+	float heading; // Degrees from north
+	float length;
+	float pitch;
+	float acc_ne; // Meters
+	float acc_heading; // Degrees
+	uint32_t flags;
+} mb_frame_t;
+
+typedef struct {
+	double yaw;
+	double yaw_hist[SIM_HIST_LEN];
+	int hist_ind;
+	bool mb_on;
+	int version;
+} sim_state_t;
+
+systime_t stub_time_ms;
+TIM_TypeDef stub_tim6;
+UARTDriver UARTD6;
+USART_TypeDef stub_usart6;
+MAIN_CONFIG main_config;
+int main_id;
+
+static sim_state_t m_sim;
+
+// Stubs for the rest of the firmware
+void led_write(int num, int state) {(void)num; (void)state;}
+void mpu9150_init(void) {}
+void mpu9150_sample_gyro_offsets(uint32_t iteratons) {(void)iteratons;}
+void mpu9150_set_read_callback(void(*func)(void)) {(void)func;}
+void mpu9150_get_raw_accel_gyro_mag(int16_t *gyro_accel) {(void)gyro_accel;}
+void commands_printf(const char* format, ...) {(void)format;}
+void commands_send_nmea(unsigned char *data, unsigned int len) {(void)data; (void)len;}
+bool imu_capture_is_enabled(void) {return false;}
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us) {(void)raw; (void)dt_us;}
+float servo_simple_get_pos_now(void) {return main_config.car.steering_center;}
+void stats_register_queue(STATS_QUEUE queue, ringbuf_t *rb) {(void)queue; (void)rb;}
+void stats_rtcm_bytes(unsigned int bytes) {(void)bytes;}
+void bldc_interface_set_rx_value_func(void(*func)(mc_values *values)) {(void)func;}
+void bldc_interface_get_values(void) {}
+void comm_can_set_status_func(void(*func)(can_status_msg *msg, bool tacho_updated)) {(void)func;}
+void comm_cc2520_send_buffer(uint8_t *data, unsigned int len) {(void)data; (void)len;}
+
+// Level with some noise, turning clockwise at SIM_RATE
+void mpu9150_get_accel_gyro_mag(float *accel, float *gyro, float *mag) {
+	accel[0] = (stub_time_ms & 1) ? 0.01 : -0.01; accel[1] = 0.0; accel[2] = 1.0;
+	gyro[0] = 0.0; gyro[1] = 0.0; gyro[2] = SIM_RATE;
+	mag[0] = 0.3; mag[1] = 0.0; mag[2] = -0.5;
+}
+
+void terminal_register_command_callback(const char* command, const char *help,
+		const char *arg_names, void(*cbf)(int argc, const char **argv)) {
+	(void)command; (void)help; (void)arg_names; (void)cbf;
+}
+
+// RELPOSNED payload of version 0 (M8P) or 1 (F9P) with the given baseline
+static int relposned_payload(uint8_t *msg, const mb_frame_t *f) {
+	const double h = f->heading * M_PI / 180.0;
+	const double p = f->pitch * M_PI / 180.0;
+	const double ned[3] = {
+			f->length * cos(p) * cos(h),
+			f->length * cos(p) * sin(h),
+			-f->length * sin(p)};
+	int32_t cm[3];
+	int8_t hp[3];
+	int ind = 0;
+
+	for (int i = 0;i < 3;i++) {
+		cm[i] = (int32_t)(ned[i] * 100.0);
+		hp[i] = (int8_t)lround((ned[i] * 100.0 - cm[i]) * 100.0);
+	}
+
+	ubx_put_U1(msg, &ind, f->version);
+	ubx_put_U1(msg, &ind, 0);
+	ubx_put_U2(msg, &ind, 0);
+	ubx_put_U4(msg, &ind, stub_time_ms);
+	ubx_put_I4(msg, &ind, cm[0]);
+	ubx_put_I4(msg, &ind, cm[1]);
+	ubx_put_I4(msg, &ind, cm[2]);
+
+	if (f->version == 1) {
+		double heading = f->heading;
+		if (heading < 0.0) {
+			heading += 360.0;
+		}
+
+		ubx_put_I4(msg, &ind, (int32_t)(f->length * 100.0));
+		ubx_put_I4(msg, &ind, (int32_t)(heading * 1e5));
+		ubx_put_U4(msg, &ind, 0);
+	}
+
+	ubx_put_I1(msg, &ind, hp[0]);
+	ubx_put_I1(msg, &ind, hp[1]);
+	ubx_put_I1(msg, &ind, hp[2]);
+	ubx_put_I1(msg, &ind, 0);
+	ubx_put_U4(msg, &ind, (uint32_t)(f->acc_ne * 1e4));
+	ubx_put_U4(msg, &ind, (uint32_t)(f->acc_ne * 1e4));
+	ubx_put_U4(msg, &ind, (uint32_t)(f->acc_ne * 2e4));
+
+	if (f->version == 1) {
+		ubx_put_U4(msg, &ind, (uint32_t)(f->acc_ne * 1e4));
+		ubx_put_U4(msg, &ind, (uint32_t)(f->acc_heading * 1e5));
+		ubx_put_U4(msg, &ind, 0);
+	}
+
+	ubx_put_X4(msg, &ind, f->flags);
+
+	return ind;
+}
+
+// A good frame with the true heading of the car MB_DELAY_MS ago
+static mb_frame_t sim_frame(void) {
+	int ind = m_sim.hist_ind - MB_DELAY_MS;
+	if (ind < 0) {
+		ind += SIM_HIST_LEN;
+	}
+
+	mb_frame_t f;
+	f.version = m_sim.version;
+	f.heading = m_sim.yaw_hist[ind] + 90.0 + SIM_ANT_OFFSET;
+	utils_norm_angle(&f.heading);
+	f.length = SIM_BASELINE;
+	f.pitch = 2.0;
+	f.acc_ne = 0.008;
+	f.acc_heading = 0.4;
+	f.flags = RP_GOOD | (m_sim.version == 1 ? RP_HEADING_VALID : 0);
+	return f;
+}
+
+static void send_frame(const mb_frame_t *f, int len_diff) {
+	uint8_t msg[64];
+	int len = relposned_payload(msg, f);
+	ubx_decode(UBX_CLASS_NAV, UBX_NAV_RELPOSNED, msg, len + len_diff);
+}
+
+static void sim_reset(double yaw, int version) {
+	memset(&main_config, 0, sizeof(main_config));
+	main_config.gps_use_mb_heading = true;
+	main_config.gps_mb_yaw_offset = SIM_ANT_OFFSET;
+	main_config.gps_mb_baseline = SIM_BASELINE;
+	main_config.car.steering_center = 0.5;
+	main_config.car.steering_range = 0.6;
+
+	memset(&m_sim, 0, sizeof(m_sim));
+	stub_time_ms = 10000;
+	pos_init();
+
+	m_sim.yaw = yaw;
+	m_sim.mb_on = true;
+	m_sim.version = version;
+
+	for (int i = 0;i < SIM_HIST_LEN;i++) {
+		m_sim.yaw_hist[i] = yaw;
+	}
+
+	// The IMU yaw starts from the magnetometer
+	stub_time_ms++;
+	stub_tim6.CNT += ITERATION_TIMER_FREQ / 1000;
+	mpu9150_read();
+}
+
+/*
+ * Turn for some time with pos.c running at 1 kHz, and return the largest
+ * yaw error during the last second.
+ */
+static double sim_run(double seconds) {
+	const int steps = (int)(seconds * 1000.0);
+	double err_max = 0.0;
+
+	for (int i = 0;i < steps;i++) {
+		stub_time_ms++;
+		stub_tim6.CNT += ITERATION_TIMER_FREQ / 1000;
+		m_sim.yaw -= SIM_RATE / 1000.0;
+		if (m_sim.yaw < -180.0) {
+			m_sim.yaw += 360.0;
+		}
+
+		m_sim.hist_ind = (m_sim.hist_ind + 1) % SIM_HIST_LEN;
+		m_sim.yaw_hist[m_sim.hist_ind] = m_sim.yaw;
+
+		mpu9150_read();
+
+		if (m_sim.mb_on && stub_time_ms % SIM_MB_MS == 0) {
+			mb_frame_t f = sim_frame();
+			send_frame(&f, 0);
+		}
+
+		if (i >= steps - 1000) {
+			err_max = fmax(err_max, fabs(utils_angle_difference(m_pos.yaw, m_sim.yaw)));
+		}
+	}
+
+	return err_max;
+}
+
+/*
+ * The yaw starts 50 degrees off and converges to the heading of the car.
+ * The yaw offset is then the difference between the IMU yaw and the true
+ * yaw. Without the delay compensation the error would be SIM_RATE times
+ * MB_DELAY_MS, 1.6 degrees.
+ */
+static int test_converge(int version) {
+	sim_reset(-50.0, version);
+	double err = sim_run(10.0);
+
+	float ofs_true = m_imu_yaw - m_sim.yaw;
+	utils_norm_angle(&ofs_true);
+	const float ofs_err = utils_angle_difference(m_yaw_offset_gps, ofs_true);
+
+	printf("converge v%d:    yaw error %.3f deg, offset error %.3f deg, %u samples\n",
+			version, err, ofs_err, (unsigned int)m_mb.samples);
+	CHECK(err < 0.3, "yaw error %g", err);
+	CHECK(fabsf(ofs_err) < 0.3, "offset error %g", ofs_err);
+	CHECK(m_mb.samples >= 99, "%u samples", (unsigned int)m_mb.samples);
+	CHECK(mb_heading_active(), "heading not active");
+	CHECK(fabsf(m_mb.pitch - 2.0) < 0.1, "pitch %g", m_mb.pitch);
+
+	return 0;
+}
+
+/*
+ * Frames that fail one of the checks have the heading 30 degrees off. None
+ * of them may change the yaw.
+ */
+static int test_gates(void) {
+	sim_reset(120.0, 1);
+	sim_run(5.0);
+	m_sim.mb_on = false;
+
+	const uint32_t samples = m_mb.samples;
+	const float ofs = m_yaw_offset_gps;
+	mb_frame_t f;
+
+#define BAD_FRAME(change, len_diff) f = sim_frame(); f.heading += 30.0; change; \
+	send_frame(&f, len_diff); \
+	CHECK(m_mb.samples == samples && m_yaw_offset_gps == ofs, "%s accepted", #change)
+
+	BAD_FRAME(f.flags &= ~RP_CARR_FIX, 0);
+	BAD_FRAME(f.flags = (f.flags & ~(3 << 3)) | RP_CARR_FLOAT, 0);
+	BAD_FRAME(f.flags &= ~RP_FIX_OK, 0);
+	BAD_FRAME(f.flags &= ~RP_REL_POS_VALID, 0);
+	BAD_FRAME(f.flags |= RP_REF_OBS_MISS, 0);
+	BAD_FRAME(f.length = 0.15, 0);
+	BAD_FRAME(f.length = SIM_BASELINE + 0.1, 0);
+	BAD_FRAME(f.length = SIM_BASELINE - 0.1, 0);
+	BAD_FRAME(f.pitch = 35.0, 0);
+	BAD_FRAME(f.acc_heading = 2.5, 0);
+	BAD_FRAME((void)0, -1);
+	BAD_FRAME(f.version = 0; f.flags &= ~RP_HEADING_VALID; f.acc_ne = 0.05, 0);
+	BAD_FRAME(f.version = 0; f.flags &= ~RP_HEADING_VALID, -1);
+	BAD_FRAME(f.version = 2, 0);
+
+	// Not from a moving base, so used for the position quality instead
+	BAD_FRAME(f.flags &= ~RP_IS_MOVING, 0);
+
+	main_config.gps_use_mb_heading = false;
+	BAD_FRAME((void)0, 0);
+	main_config.gps_use_mb_heading = true;
+
+#undef BAD_FRAME
+
+	// Without the baseline length configured any length above the minimum works
+	main_config.gps_mb_baseline = 0.0;
+	f = sim_frame();
+	f.length = 0.5;
+	send_frame(&f, 0);
+	CHECK(m_mb.samples == samples + 1, "good frame not accepted");
+
+	// The GNSS track is used for yaw again after MB_TIMEOUT_MS
+	sim_run(MB_TIMEOUT_MS / 1000.0);
+	CHECK(!mb_heading_active(), "heading still active");
+
+	return 0;
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_converge(1);
+	res |= test_converge(0);
+	res |= test_gates();
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
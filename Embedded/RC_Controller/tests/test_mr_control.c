@@ -0,0 +1,344 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Closed loop simulation of mr_control with a simple rigid body model of
+ * the copter. The model is not tuned to a real airframe, it only has to be
+ * close enough to show that the control loops are wired up with the right
+ * signs and that the autopilot takeover and hover throttle logic behave.
+ *
+ * mr_control.c is included so that its private state can be inspected. The
+ * test is built with and without FAST_MATH, and both builds print the time
+ * of one control iteration.
+ */
+
+#include "../mr_control.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Simulation settings
+#define SIM_DT				0.001
+#define SIM_HOVER_THROTTLE	0.45
+#define SIM_ATT_GAIN		30000.0 // deg/s^2 per unit of attitude output
+#define SIM_ATT_DAMPING		5.0 // 1/s
+#define SIM_DRAG			0.3 // 1/s
+
+#define BENCH_ITERATIONS	200000
+
+typedef struct {
+	float px, py, pz;
+	float vx, vy, vz;
+	float roll, pitch, yaw;
+	float roll_rate, pitch_rate, yaw_rate;
+} sim_state_t;
+
+systime_t stub_time_ms;
+MAIN_CONFIG main_config;
+
+static sim_state_t m_sim;
+static MR_OUTPUT m_act;
+static double m_time;
+static bool m_ap_route_active;
+static ROUTE_POINT m_ap_goal;
+
+// Stubs for the rest of the firmware
+void actuator_set_output(float throttle, float roll, float pitch, float yaw) {
+	m_act.throttle = throttle;
+	m_act.roll = roll;
+	m_act.pitch = pitch;
+	m_act.yaw = yaw;
+}
+
+void actuator_set_motor(int motor, float throttle) {
+	(void)motor;
+	(void)throttle;
+	memset(&m_act, 0, sizeof(m_act));
+}
+
+void pos_get_pos(POS_STATE *p) {
+	memset(p, 0, sizeof(POS_STATE));
+	p->px = m_sim.px;
+	p->py = m_sim.py;
+	p->pz = m_sim.pz;
+	p->vx = m_sim.vx;
+	p->vy = m_sim.vy;
+	p->vz = m_sim.vz;
+	p->roll = m_sim.roll;
+	p->pitch = m_sim.pitch;
+	p->yaw = m_sim.yaw;
+	p->speed = sqrtf(SQ(m_sim.vx) + SQ(m_sim.vy));
+}
+
+int pos_time_since_gps_corr(void) {
+	return 0;
+}
+
+bool autopilot_is_active(void) {
+	return m_ap_route_active;
+}
+
+void autopilot_get_goal_now(ROUTE_POINT *rp) {
+	*rp = m_ap_goal;
+}
+
+static double time_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void sim_step(float dt) {
+	const float g = AP_GRAVITY;
+
+	m_sim.roll_rate += (SIM_ATT_GAIN * m_act.roll - SIM_ATT_DAMPING * m_sim.roll_rate) * dt;
+	m_sim.pitch_rate += (SIM_ATT_GAIN * m_act.pitch - SIM_ATT_DAMPING * m_sim.pitch_rate) * dt;
+	m_sim.yaw_rate += (SIM_ATT_GAIN * m_act.yaw - SIM_ATT_DAMPING * m_sim.yaw_rate) * dt;
+	m_sim.roll += m_sim.roll_rate * dt;
+	m_sim.pitch += m_sim.pitch_rate * dt;
+	m_sim.yaw += m_sim.yaw_rate * dt;
+
+	const float r = m_sim.roll * M_PI / 180.0;
+	const float p = m_sim.pitch * M_PI / 180.0;
+	const float thrust = g * m_act.throttle / SIM_HOVER_THROTTLE;
+
+	// The same tilt model as mr_update_pos in pos.c
+	const float ax_body = -thrust * sinf(p) * cosf(r);
+	const float ay_body = -thrust * sinf(r) * cosf(p);
+	const float sin_y = sinf(-m_sim.yaw * M_PI / 180.0);
+	const float cos_y = cosf(-m_sim.yaw * M_PI / 180.0);
+	const float ax = cos_y * ax_body - sin_y * ay_body - SIM_DRAG * m_sim.vx;
+	const float ay = sin_y * ax_body + cos_y * ay_body - SIM_DRAG * m_sim.vy;
+	const float az = thrust * cosf(r) * cosf(p) - g - SIM_DRAG * m_sim.vz;
+
+	m_sim.vx += ax * dt;
+	m_sim.vy += ay * dt;
+	m_sim.vz += az * dt;
+	m_sim.px += m_sim.vx * dt;
+	m_sim.py += m_sim.vy * dt;
+	m_sim.pz += m_sim.vz * dt;
+
+	if (m_sim.pz <= 0.0 && m_sim.vz <= 0.0) {
+		m_sim.pz = 0.0;
+		m_sim.vz = 0.0;
+		m_sim.vx = 0.0;
+		m_sim.vy = 0.0;
+	}
+}
+
+// Run with a fixed stick input for some time
+static void sim_run(float throttle, float seconds) {
+	const int steps = (int)(seconds / SIM_DT);
+
+	for (int i = 0;i < steps;i++) {
+		m_time += SIM_DT;
+		stub_time_ms = (systime_t)(m_time * 1000.0);
+		mr_control_set_input(throttle, 0.0, 0.0, 0.0);
+		mr_control_run_iteration(SIM_DT);
+		sim_step(SIM_DT);
+	}
+}
+
+static void sim_reset(float height) {
+	memset(&m_sim, 0, sizeof(m_sim));
+	memset(&m_act, 0, sizeof(m_act));
+	m_sim.pz = height;
+	m_act.throttle = height > 0.0 ? SIM_HOVER_THROTTLE : 0.0;
+	m_ap_route_active = false;
+	mr_control_init();
+}
+
+static void default_config(void) {
+	memset(&main_config, 0, sizeof(main_config));
+
+	// The defaults from conf_general.c
+	main_config.ap_max_speed = 30.0 / 3.6;
+	main_config.mr.ctrl_gain_roll_p = 0.8;
+	main_config.mr.ctrl_gain_roll_i = 1.0;
+	main_config.mr.ctrl_gain_roll_dp = 0.3;
+	main_config.mr.ctrl_gain_roll_de = 0.2;
+	main_config.mr.ctrl_gain_pitch_p = 0.8;
+	main_config.mr.ctrl_gain_pitch_i = 1.0;
+	main_config.mr.ctrl_gain_pitch_dp = 0.3;
+	main_config.mr.ctrl_gain_pitch_de = 0.2;
+	main_config.mr.ctrl_gain_yaw_p = 3.0;
+	main_config.mr.ctrl_gain_yaw_i = 0.2;
+	main_config.mr.ctrl_gain_yaw_dp = 0.4;
+	main_config.mr.ctrl_gain_yaw_de = 0.2;
+	main_config.mr.ctrl_gain_pos_p = 0.8;
+	main_config.mr.ctrl_gain_pos_i = 0.09;
+	main_config.mr.ctrl_gain_pos_d = 0.6;
+	main_config.mr.ctrl_gain_alt_p = 0.1;
+	main_config.mr.ctrl_gain_alt_i = 0.1;
+	main_config.mr.ctrl_gain_alt_d = 0.14;
+	main_config.mr.js_gain_tilt = 1.0;
+	main_config.mr.js_gain_yaw = 0.6;
+	main_config.mr.ap_enabled = false;
+}
+
+// The hover throttle must not be learned from the throttle on the ground
+static int test_no_hover_learning_on_ground(void) {
+	default_config();
+	sim_reset(0.0);
+
+	const float hover_start = m_ap.throttle_hover;
+	sim_run(0.3, 20.0);
+
+	CHECK(m_sim.pz == 0.0, "took off at throttle 0.3");
+	CHECK(m_ap.throttle_hover == hover_start,
+			"hover throttle learned on the ground: %.3f", (double)m_ap.throttle_hover);
+	return 0;
+}
+
+static int test_hover_learning_in_flight(void) {
+	default_config();
+	sim_reset(2.0);
+
+	sim_run(SIM_HOVER_THROTTLE, 15.0);
+
+	CHECK(fabsf(m_ap.throttle_hover - SIM_HOVER_THROTTLE) < 0.02,
+			"hover throttle %.3f, should be %.3f",
+			(double)m_ap.throttle_hover, (double)SIM_HOVER_THROTTLE);
+	return 0;
+}
+
+// Full throttle is manual control unless the autopilot is enabled
+static int test_takeover_disabled(void) {
+	default_config();
+	sim_reset(2.0);
+
+	sim_run(0.95, 1.0);
+
+	CHECK(!m_ap.active, "autopilot took over while disabled");
+	CHECK(m_act.throttle > 0.9, "throttle %.3f is not the stick", (double)m_act.throttle);
+	return 0;
+}
+
+// Hold the position and height where the autopilot took over
+static int test_position_hold(void) {
+	default_config();
+	main_config.mr.ap_enabled = true;
+	sim_reset(2.0);
+
+	sim_run(SIM_HOVER_THROTTLE, 15.0);
+	m_sim.vx = 1.0;
+	m_sim.vy = -0.5;
+
+	sim_run(0.95, 0.002);
+	CHECK(m_ap.active, "autopilot did not take over");
+	const float x0 = m_ap.px_goal;
+	const float y0 = m_ap.py_goal;
+	const float z0 = m_ap.pz_goal;
+
+	float err_max = 0.0;
+	for (int i = 0;i < 300;i++) {
+		sim_run(0.95, 0.1);
+		float err = sqrtf(SQ(m_sim.px - x0) + SQ(m_sim.py - y0));
+		if (i > 150 && err > err_max) {
+			err_max = err;
+		}
+	}
+
+	printf("Position hold after 15 s: horizontal error max %.3f m, height error %.3f m\n",
+			(double)err_max, (double)(m_sim.pz - z0));
+	CHECK(err_max < 0.3, "horizontal error %.3f m", (double)err_max);
+	CHECK(fabsf(m_sim.pz - z0) < 0.2, "height error %.3f m", (double)(m_sim.pz - z0));
+	return 0;
+}
+
+// Fly to the route goal point
+static int test_route_goal(void) {
+	default_config();
+	main_config.mr.ap_enabled = true;
+	sim_reset(2.0);
+
+	sim_run(SIM_HOVER_THROTTLE, 15.0);
+	m_ap_route_active = true;
+	memset(&m_ap_goal, 0, sizeof(m_ap_goal));
+	m_ap_goal.px = 10.0;
+	m_ap_goal.py = 5.0;
+	m_ap_goal.speed = 2.0;
+
+	float speed_max = 0.0;
+	for (int i = 0;i < 300;i++) {
+		sim_run(0.95, 0.1);
+		float speed = sqrtf(SQ(m_sim.vx) + SQ(m_sim.vy));
+		if (speed > speed_max) {
+			speed_max = speed;
+		}
+	}
+
+	float err = sqrtf(SQ(m_sim.px - 10.0) + SQ(m_sim.py - 5.0));
+	printf("Route goal after 30 s: error %.3f m, max speed %.2f m/s\n",
+			(double)err, (double)speed_max);
+	CHECK(err < 0.3, "goal error %.3f m", (double)err);
+	CHECK(speed_max < 2.5, "speed %.2f m/s above the limit", (double)speed_max);
+	return 0;
+}
+
+/*
+ * Time mr_control_run_iteration alone while flying a route, so that the
+ * position controller and the tilt compensation run as well. The copter is
+ * held in a tilted state, which the controller does not notice. Only
+ * printed, as the host FPU has little in common with the Cortex-M4.
+ */
+static void bench(void) {
+	default_config();
+	main_config.mr.ap_enabled = true;
+	sim_reset(2.0);
+	sim_run(SIM_HOVER_THROTTLE, 1.0);
+	sim_run(0.95, 0.1);
+
+	m_ap_route_active = true;
+	memset(&m_ap_goal, 0, sizeof(m_ap_goal));
+	m_ap_goal.px = 10.0;
+	m_ap_goal.py = 5.0;
+	m_ap_goal.speed = 2.0;
+	m_sim.roll = 3.0;
+	m_sim.pitch = -4.0;
+	m_sim.yaw = 30.0;
+	mr_control_set_input(0.95, 0.0, 0.0, 0.0);
+
+	const double start = time_s();
+	for (int i = 0;i < BENCH_ITERATIONS;i++) {
+		stub_time_ms++;
+		mr_control_run_iteration(SIM_DT);
+	}
+
+	printf("FAST_MATH %d: %5.1f ns per iteration\n", FAST_MATH,
+			(time_s() - start) * 1e9 / BENCH_ITERATIONS);
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_no_hover_learning_on_ground();
+	res |= test_hover_learning_in_flight();
+	res |= test_takeover_disabled();
+	res |= test_position_hold();
+	res |= test_route_goal();
+
+	if (!res) {
+		bench();
+	}
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
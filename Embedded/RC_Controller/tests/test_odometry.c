@@ -0,0 +1,295 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Car odometry from the status broadcasts of the motor controller. A
+ * simulated VESC sends CAN_PACKET_STATUS and CAN_PACKET_STATUS_5 frames that
+ * go through the frame handling of comm_can.c to pos.c, and the values
+ * replies that pos.c polls for when the broadcasts stop. Both files are
+ * included so that their private state can be used.
+ */
+
+#include "stm32f4xx_tim.h"
+#include "../comm_can.c"
+#include "../pos.c"
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Simulation settings
+#define SIM_ERPM			20000.0
+#define SIM_STATUS_MS		10
+#define SIM_STATUS_5_MS		20
+#define SIM_GEAR_RATIO		0.2
+#define SIM_MOTOR_POLES		4.0
+#define SIM_WHEEL_DIAM		0.11
+
+typedef struct {
+	double tacho;
+	bool status_on;
+	bool status_5_on;
+	double distance;
+} sim_state_t;
+
+systime_t stub_time_ms;
+TIM_TypeDef stub_tim6;
+CANDriver CAND1;
+MAIN_CONFIG main_config;
+int main_id;
+
+static sim_state_t m_sim;
+static void(*m_values_func)(mc_values *values);
+static int m_values_polls;
+
+// Stubs for the rest of the firmware
+void led_write(int num, int state) {(void)num; (void)state;}
+void mpu9150_init(void) {}
+void mpu9150_sample_gyro_offsets(uint32_t iteratons) {(void)iteratons;}
+void mpu9150_set_read_callback(void(*func)(void)) {(void)func;}
+void mpu9150_get_raw_accel_gyro_mag(int16_t *gyro_accel) {(void)gyro_accel;}
+void ublox_set_rx_callback_relposned(void(*func)(ubx_nav_relposned *pos)) {(void)func;}
+void commands_printf(const char* format, ...) {(void)format;}
+bool imu_capture_is_enabled(void) {return false;}
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us) {(void)raw; (void)dt_us;}
+float servo_simple_get_pos_now(void) {return main_config.car.steering_center;}
+void stats_register_queue(STATS_QUEUE queue, ringbuf_t *rb) {(void)queue; (void)rb;}
+void bldc_interface_init(void(*func)(unsigned char *data, unsigned int len)) {(void)func;}
+void bldc_interface_set_rx_printf_func(void(*func)(char *str)) {(void)func;}
+void bldc_interface_process_packet(unsigned char *data, unsigned int len) {(void)data; (void)len;}
+
+// Level, with some noise. Without noise the gradient in the Madgwick filter
+// is zero, which it does not handle.
+void mpu9150_get_accel_gyro_mag(float *accel, float *gyro, float *mag) {
+	accel[0] = (stub_time_ms & 1) ? 0.01 : -0.01; accel[1] = 0.0; accel[2] = 1.0;
+	gyro[0] = 0.0; gyro[1] = 0.0; gyro[2] = 0.0;
+	mag[0] = 0.3; mag[1] = 0.0; mag[2] = -0.5;
+}
+
+void terminal_register_command_callback(const char* command, const char *help,
+		const char *arg_names, void(*cbf)(int argc, const char **argv)) {
+	(void)command; (void)help; (void)arg_names; (void)cbf;
+}
+
+void bldc_interface_set_rx_value_func(void(*func)(mc_values *values)) {
+	m_values_func = func;
+}
+
+// Answered right away, as if the reply arrived before the next iteration
+void bldc_interface_get_values(void) {
+	m_values_polls++;
+
+	mc_values val;
+	memset(&val, 0, sizeof(val));
+	val.rpm = SIM_ERPM;
+	val.tachometer = (int32_t)(uint32_t)(int64_t)m_sim.tacho;
+	m_values_func(&val);
+}
+
+// Meters per tachometer step, which is one commutation
+static double m_per_tacho(void) {
+	return SIM_GEAR_RATIO * (2.0 / SIM_MOTOR_POLES) / 6.0 * SIM_WHEEL_DIAM * M_PI;
+}
+
+static double sim_speed(void) {
+	return SIM_ERPM / 60.0 * 6.0 * m_per_tacho();
+}
+
+static double pos_distance(void) {
+	return sqrt((double)m_pos.px * m_pos.px + (double)m_pos.py * m_pos.py);
+}
+
+static void can_rx(CAN_PACKET_ID cmd, uint8_t *data, int len) {
+	can_rx_slot_t slot;
+	memset(&slot, 0, sizeof(slot));
+	slot.frame.IDE = CAN_IDE_EXT;
+	slot.frame.EID = 7 | ((uint32_t)cmd << 8);
+	slot.frame.DLC = len;
+	memcpy(slot.frame.data8, data, len);
+	slot.rx_time = chVTGetSystemTimeX();
+	process_frame(&slot);
+}
+
+// The tachometer starts close to the end of its range
+static void sim_reset(double tacho) {
+	memset(&main_config, 0, sizeof(main_config));
+	main_config.car.odometry_from_status = true;
+	main_config.car.gear_ratio = SIM_GEAR_RATIO;
+	main_config.car.motor_poles = SIM_MOTOR_POLES;
+	main_config.car.wheel_diam = SIM_WHEEL_DIAM;
+	main_config.car.steering_center = 0.5;
+	main_config.car.steering_range = 0.6;
+	main_config.car.steering_max_angle_rad = 0.4;
+
+	memset(&m_sim, 0, sizeof(m_sim));
+	memset(&m_odo, 0, sizeof(m_odo));
+	m_values_polls = 0;
+	stub_time_ms = 10000;
+	comm_can_init();
+	pos_init();
+
+	m_sim.tacho = tacho;
+	m_sim.status_on = true;
+	m_sim.status_5_on = true;
+}
+
+/*
+ * Drive at constant speed for some time. pos.c runs its iteration at 1 kHz
+ * and the VESC sends STATUS and STATUS_5 at their own rates, with the
+ * tachometer as a 32 bit counter that wraps.
+ */
+static void sim_run(double seconds) {
+	const int steps = (int)(seconds * 1000.0);
+
+	for (int i = 0;i < steps;i++) {
+		stub_time_ms++;
+		stub_tim6.CNT += ITERATION_TIMER_FREQ / 1000;
+		m_sim.tacho += SIM_ERPM / 60.0 * 6.0 / 1000.0;
+		m_sim.distance += sim_speed() / 1000.0;
+
+		mpu9150_read();
+
+		uint8_t buffer[8];
+		int32_t ind = 0;
+
+		if (m_sim.status_on && stub_time_ms % SIM_STATUS_MS == 0) {
+			buffer_append_int32(buffer, (int32_t)SIM_ERPM, &ind);
+			buffer_append_int16(buffer, 52, &ind);
+			buffer_append_int16(buffer, 310, &ind);
+			can_rx(CAN_PACKET_STATUS, buffer, ind);
+		}
+
+		ind = 0;
+		if (m_sim.status_5_on && stub_time_ms % SIM_STATUS_5_MS == 0) {
+			buffer_append_int32(buffer, (int32_t)(uint32_t)(int64_t)m_sim.tacho, &ind);
+			buffer_append_int16(buffer, 168, &ind);
+			buffer_append_int16(buffer, 0, &ind);
+			can_rx(CAN_PACKET_STATUS_5, buffer, ind);
+		}
+	}
+}
+
+/*
+ * The tachometer passes INT32_MAX while driving. The distance follows it
+ * without a jump, and the values are not polled more than for diagnostics.
+ */
+static int test_tacho_wrap(void) {
+	sim_reset(2147483647.0 - 2000.0);
+	sim_run(0.05);
+
+	const double start = pos_distance() - m_sim.distance;
+	sim_run(2.0);
+
+	const double err = pos_distance() - m_sim.distance - start;
+	printf("tacho wrap:      distance %.3f m, error %.4f m, %d polls\n",
+			m_sim.distance, err, m_values_polls);
+	CHECK(m_sim.tacho > 2147483648.0, "the tachometer did not wrap");
+	CHECK(fabs(err) < 2.0 * m_per_tacho(), "distance error %g m", err);
+	CHECK(fabs(m_pos.speed - sim_speed()) < 1e-3, "speed %g", m_pos.speed);
+	CHECK(m_values_polls <= 11, "%d polls", m_values_polls);
+
+	return 0;
+}
+
+/*
+ * Without STATUS_5 the speed is integrated between the STATUS frames. When
+ * STATUS_5 stops the rpm takes over after ODO_TACHO_TIMEOUT_MS, and the
+ * distance driven until then is lost. When it comes back the tachometer
+ * reference starts over, so the distance the VESC counted meanwhile is not
+ * added twice.
+ */
+static int test_rpm_only(void) {
+	sim_reset(1000.0);
+	m_sim.status_5_on = false;
+	sim_run(2.0);
+
+	double err = pos_distance() - m_sim.distance;
+	printf("rpm only:        distance %.3f m, error %.4f m\n", m_sim.distance, err);
+	CHECK(fabs(err) < sim_speed() * 0.002 * SIM_STATUS_MS, "distance error %g m", err);
+
+	sim_reset(1000.0);
+	sim_run(1.0);
+	m_sim.status_5_on = false;
+	sim_run(1.0);
+	m_sim.status_5_on = true;
+	sim_run(1.0);
+
+	err = pos_distance() - m_sim.distance;
+	const double max_loss = sim_speed() * (ODO_TACHO_TIMEOUT_MS + 2 * SIM_STATUS_5_MS) / 1000.0;
+	printf("STATUS_5 gap:    distance %.3f m, error %.4f m\n", m_sim.distance, err);
+	CHECK(err < 2.0 * m_per_tacho() && err > -max_loss, "distance error %g m", err);
+
+	return 0;
+}
+
+/*
+ * When the broadcasts stop, the values are polled at 100 Hz again after
+ * ODO_STATUS_TIMEOUT_MS and the odometry comes from the replies. While the
+ * broadcasts are active the replies do not move the car.
+ */
+static int test_poll_fallback(void) {
+	sim_reset(1000.0);
+	sim_run(1.0);
+	CHECK(odo_status_active(), "status not active");
+	CHECK(m_values_polls <= 6, "%d polls with broadcasts", m_values_polls);
+
+	double err = pos_distance() - m_sim.distance;
+	CHECK(fabs(err) < sim_speed() * 0.002 * SIM_STATUS_5_MS, "distance error %g m", err);
+
+	m_sim.status_on = false;
+	m_sim.status_5_on = false;
+	m_values_polls = 0;
+	sim_run(ODO_STATUS_TIMEOUT_MS / 1000.0);
+	CHECK(!odo_status_active(), "status still active");
+
+	m_values_polls = 0;
+	sim_run(1.0);
+	err = pos_distance() - m_sim.distance;
+	printf("poll fallback:   %d polls in 1 s, error %.4f m\n", m_values_polls, err);
+	CHECK(m_values_polls >= 99 && m_values_polls <= 101, "%d polls", m_values_polls);
+	CHECK(fabs(err) < sim_speed() * (ODO_STATUS_TIMEOUT_MS + 20) / 1000.0, "distance error %g m", err);
+
+	// The broadcasts take over again
+	m_sim.status_on = true;
+	m_sim.status_5_on = true;
+	sim_run(0.1);
+	CHECK(odo_status_active(), "status not active again");
+	const double before = pos_distance() - m_sim.distance;
+	m_values_polls = 0;
+	sim_run(1.0);
+	err = pos_distance() - m_sim.distance - before;
+	CHECK(m_values_polls <= 6, "%d polls with broadcasts", m_values_polls);
+	CHECK(fabs(err) < 2.0 * m_per_tacho(), "distance error %g m", err);
+
+	// Nothing from the broadcasts is used when they are disabled
+	main_config.car.odometry_from_status = false;
+	m_values_polls = 0;
+	sim_run(0.5);
+	CHECK(m_values_polls >= 49, "%d polls", m_values_polls);
+
+	return 0;
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_tacho_wrap();
+	res |= test_rpm_only();
+	res |= test_poll_fallback();
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
@@ -0,0 +1,257 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The pose with FAST_MATH compared against the pose with libm. The same
+ * drive, with turns, a rolling and pitching body, the magnetometer and the
+ * odometry, is replayed through the IMU iteration of pos.c and ahrs.c in
+ * two builds of this file. test_pose_replay_ref is built without FAST_MATH
+ * and prints its pose trace, which test_pose_replay reads and compares with
+ * its own pose at every sample.
+ */
+
+#include "stm32f4xx_tim.h"
+#include "../pos.c"
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+// Simulation settings
+#define SIM_SECONDS			120
+#define SIM_TRACE_MS		10
+#define SIM_SPEED			2.0 // m/s
+#define SIM_GEAR_RATIO		0.2
+#define SIM_MOTOR_POLES		4.0
+#define SIM_WHEEL_DIAM		0.11
+
+// The largest allowed deviation of FAST_MATH from libm. The roll and pitch
+// are read out with the approximated atan2 and asin, which are up to 0.6
+// degrees off. The yaw gets that error twice, as the magnetometer heading
+// uses the approximated atan2 as well.
+#define MAX_DEV_TILT		0.7 // Degrees
+#define MAX_DEV_YAW			2.0 // Degrees
+#define MAX_DEV_POS			0.4 // Meters
+
+typedef struct {
+	double roll, pitch, yaw; // Radians
+	double roll_rate, pitch_rate, yaw_rate;
+	double tacho;
+	uint32_t noise;
+} sim_state_t;
+
+typedef struct {
+	double roll, pitch, yaw;
+	double px, py;
+} pose_t;
+
+systime_t stub_time_ms;
+TIM_TypeDef stub_tim6;
+MAIN_CONFIG main_config;
+int main_id;
+
+static sim_state_t m_sim;
+static void(*m_values_func)(mc_values *values);
+
+// Stubs for the rest of the firmware
+void led_write(int num, int state) {(void)num; (void)state;}
+void mpu9150_init(void) {}
+void mpu9150_sample_gyro_offsets(uint32_t iteratons) {(void)iteratons;}
+void mpu9150_set_read_callback(void(*func)(void)) {(void)func;}
+void mpu9150_get_raw_accel_gyro_mag(int16_t *gyro_accel) {(void)gyro_accel;}
+void ublox_set_rx_callback_relposned(void(*func)(ubx_nav_relposned *pos)) {(void)func;}
+void commands_printf(const char* format, ...) {(void)format;}
+bool imu_capture_is_enabled(void) {return false;}
+void imu_capture_sample(const int16_t *raw, uint32_t dt_us) {(void)raw; (void)dt_us;}
+float servo_simple_get_pos_now(void) {return main_config.car.steering_center;}
+void comm_can_set_status_func(void(*func)(can_status_msg *msg, bool tacho_updated)) {(void)func;}
+
+void terminal_register_command_callback(const char* command, const char *help,
+		const char *arg_names, void(*cbf)(int argc, const char **argv)) {
+	(void)command; (void)help; (void)arg_names; (void)cbf;
+}
+
+void bldc_interface_set_rx_value_func(void(*func)(mc_values *values)) {
+	m_values_func = func;
+}
+
+// Answered right away, as if the reply arrived before the next iteration
+void bldc_interface_get_values(void) {
+	mc_values val;
+	memset(&val, 0, sizeof(val));
+	val.rpm = SIM_SPEED / (SIM_GEAR_RATIO * (2.0 / SIM_MOTOR_POLES) * SIM_WHEEL_DIAM * M_PI) * 60.0;
+	val.tachometer = (int32_t)m_sim.tacho;
+	m_values_func(&val);
+}
+
+// Deterministic noise in -1.0 to 1.0, the same in both builds
+static double noise(void) {
+	m_sim.noise = m_sim.noise * 1664525 + 1013904223;
+	return (double)(m_sim.noise >> 8) / (double)(1 << 23) - 1.0;
+}
+
+/*
+ * The attitude is roll, pitch and yaw rotations in that order. The gyro gets
+ * the body rates from the angle rates, and the accelerometer and the
+ * magnetometer get gravity and the field rotated into the body, with the
+ * axes and signs that pos.c expects from the MPU9150.
+ */
+void mpu9150_get_accel_gyro_mag(float *accel, float *gyro, float *mag) {
+	const double sr = sin(m_sim.roll), cr = cos(m_sim.roll);
+	const double sp = sin(m_sim.pitch), cp = cos(m_sim.pitch);
+	const double sy = sin(m_sim.yaw), cy = cos(m_sim.yaw);
+
+	const double p = m_sim.roll_rate - m_sim.yaw_rate * sp;
+	const double q = m_sim.pitch_rate * cr + m_sim.yaw_rate * cp * sr;
+	const double r = -m_sim.pitch_rate * sr + m_sim.yaw_rate * cp * cr;
+
+	gyro[0] = p * 180.0 / M_PI + 0.05 * noise();
+	gyro[1] = q * 180.0 / M_PI + 0.05 * noise();
+	gyro[2] = r * 180.0 / M_PI + 0.05 * noise();
+
+	accel[0] = -sp + 0.005 * noise();
+	accel[1] = -sr * cp + 0.005 * noise();
+	accel[2] = cr * cp + 0.005 * noise();
+
+	// Field pointing north and down, rotated into a north-east-down body
+	// frame. pos.c swaps x and y and negates x before the tilt compensation.
+	const double fn = 0.3, fd = 0.5;
+	const double n1x = fn * cy, n1y = fn * sy;
+	const double n2x = cp * n1x - sp * fd, n2z = sp * n1x + cp * fd;
+	mag[0] = cr * n1y + sr * n2z + 0.002 * noise();
+	mag[1] = -n2x + 0.002 * noise();
+	mag[2] = -sr * n1y + cr * n2z + 0.002 * noise();
+}
+
+static void sim_reset(void) {
+	memset(&main_config, 0, sizeof(main_config));
+	main_config.mag_use = true;
+	main_config.yaw_mag_gain = 0.01;
+	main_config.car.gear_ratio = SIM_GEAR_RATIO;
+	main_config.car.motor_poles = SIM_MOTOR_POLES;
+	main_config.car.wheel_diam = SIM_WHEEL_DIAM;
+	main_config.car.steering_center = 0.5;
+	main_config.car.steering_range = 0.6;
+	main_config.car.steering_max_angle_rad = 0.4;
+
+	memset(&m_sim, 0, sizeof(m_sim));
+	m_sim.noise = 1234;
+	m_sim.tacho = 1000.0;
+	stub_time_ms = 10000;
+	pos_init();
+}
+
+// Gentle turns in both directions over uneven ground
+static void sim_step(void) {
+	const double t = (double)(stub_time_ms - 10000) / 1000.0;
+	const double deg = M_PI / 180.0;
+
+	m_sim.roll = 4.0 * deg * sin(2.0 * M_PI * t / 5.0);
+	m_sim.pitch = 3.0 * deg * sin(2.0 * M_PI * t / 7.0 + 1.0);
+	m_sim.roll_rate = 4.0 * deg * 2.0 * M_PI / 5.0 * cos(2.0 * M_PI * t / 5.0);
+	m_sim.pitch_rate = 3.0 * deg * 2.0 * M_PI / 7.0 * cos(2.0 * M_PI * t / 7.0 + 1.0);
+	m_sim.yaw_rate = (10.0 + 30.0 * sin(2.0 * M_PI * t / 8.0)) * deg;
+	m_sim.yaw += m_sim.yaw_rate / 1000.0;
+	m_sim.tacho += SIM_SPEED / 1000.0 /
+			(SIM_GEAR_RATIO * (2.0 / SIM_MOTOR_POLES) / 6.0 * SIM_WHEEL_DIAM * M_PI);
+
+	stub_time_ms++;
+	stub_tim6.CNT += ITERATION_TIMER_FREQ / 1000;
+	mpu9150_read();
+}
+
+static pose_t pose_now(void) {
+	pose_t p;
+	p.roll = m_pos.roll;
+	p.pitch = m_pos.pitch;
+	p.yaw = m_pos.yaw;
+	p.px = m_pos.px;
+	p.py = m_pos.py;
+	return p;
+}
+
+// The reference build prints the pose at every sample
+static int print_trace(void) {
+	sim_reset();
+
+	for (int i = 0;i < SIM_SECONDS * 1000;i++) {
+		sim_step();
+		if ((i + 1) % SIM_TRACE_MS == 0) {
+			pose_t p = pose_now();
+			printf("%.9g %.9g %.9g %.9g %.9g\n", p.roll, p.pitch, p.yaw, p.px, p.py);
+		}
+	}
+
+	return 0;
+}
+
+static int compare_trace(const char *ref_cmd) {
+	FILE *ref = popen(ref_cmd, "r");
+	CHECK(ref, "could not run %s", ref_cmd);
+
+	sim_reset();
+
+	double dev_tilt = 0.0;
+	double dev_yaw = 0.0;
+	double dev_pos = 0.0;
+	int samples = 0;
+
+	for (int i = 0;i < SIM_SECONDS * 1000;i++) {
+		sim_step();
+		if ((i + 1) % SIM_TRACE_MS != 0) {
+			continue;
+		}
+
+		pose_t r;
+		if (fscanf(ref, "%lf %lf %lf %lf %lf", &r.roll, &r.pitch, &r.yaw, &r.px, &r.py) != 5) {
+			break;
+		}
+
+		pose_t p = pose_now();
+		dev_tilt = fmax(dev_tilt, fmax(fabs(p.roll - r.roll), fabs(p.pitch - r.pitch)));
+		dev_yaw = fmax(dev_yaw, fabs(utils_angle_difference(p.yaw, r.yaw)));
+		dev_pos = fmax(dev_pos, sqrt(SQ(p.px - r.px) + SQ(p.py - r.py)));
+		samples++;
+	}
+
+	const int ref_res = pclose(ref);
+
+	printf("FAST_MATH vs libm over %.0f m: max deviation roll/pitch %.3f deg, "
+			"yaw %.3f deg, position %.3f m\n",
+			SIM_SPEED * SIM_SECONDS, dev_tilt, dev_yaw, dev_pos);
+	CHECK(ref_res == 0 && samples == SIM_SECONDS * 1000 / SIM_TRACE_MS,
+			"%d reference samples", samples);
+	CHECK(dev_tilt < MAX_DEV_TILT, "roll/pitch deviation %g deg", dev_tilt);
+	CHECK(dev_yaw < MAX_DEV_YAW, "yaw deviation %g deg", dev_yaw);
+	CHECK(dev_pos < MAX_DEV_POS, "position deviation %g m", dev_pos);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc == 2 && strcmp(argv[1], "trace") == 0) {
+		return print_trace();
+	}
+
+	// The reference is next to this binary
+	char ref_cmd[512];
+	snprintf(ref_cmd, sizeof(ref_cmd), "%s_ref trace", argv[0]);
+
+	int res = compare_trace(ref_cmd);
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
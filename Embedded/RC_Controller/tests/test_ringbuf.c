@@ -0,0 +1,281 @@
+/*
+	Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+	printf(__VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+#define STRESS_BYTES		4000000
+#define STRESS_FRAMES		500000
+#define BENCH_BYTES			8000000
+
+// Same layout as the radio tx slots
+typedef struct {
+	uint32_t seq;
+	uint8_t len;
+	uint8_t data[27];
+} frame_t;
+
+static double time_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int test_bytes(void) {
+	uint8_t storage[8];
+	uint8_t in[16], out[16];
+	ringbuf_t rb;
+
+	for (int i = 0;i < 16;i++) {
+		in[i] = i;
+	}
+
+	ringbuf_init(&rb, storage, 1, 8);
+	CHECK(ringbuf_is_empty(&rb), "not empty after init");
+	CHECK(ringbuf_space(&rb) == 7, "space %u", ringbuf_space(&rb));
+
+	// One slot is kept free
+	CHECK(ringbuf_push(&rb, in, 10) == 7, "pushed more than fits");
+	CHECK(ringbuf_is_full(&rb), "not full");
+	CHECK(ringbuf_overflows(&rb) == 3, "overflows %u", ringbuf_overflows(&rb));
+	CHECK(ringbuf_high_water(&rb) == 7, "high water %u", ringbuf_high_water(&rb));
+
+	CHECK(ringbuf_peek(&rb, out, 2) == 2 && out[0] == 0 && out[1] == 1, "peek");
+	CHECK(ringbuf_level(&rb) == 7, "peek removed data");
+	CHECK(ringbuf_pop(&rb, out, 5) == 5 && out[4] == 4, "pop");
+
+	// Across the end of the storage
+	CHECK(ringbuf_push(&rb, in + 7, 5) == 5, "push after wrap");
+	CHECK(ringbuf_pop(&rb, out, 16) == 7, "pop all");
+	for (int i = 0;i < 7;i++) {
+		CHECK(out[i] == i + 5, "byte %d is %d", i, out[i]);
+	}
+
+	CHECK(ringbuf_pop(&rb, out, 1) == 0, "pop from empty");
+
+	ringbuf_push(&rb, in, 2);
+	ringbuf_reset_stats(&rb);
+	CHECK(ringbuf_overflows(&rb) == 0, "overflows not reset");
+	CHECK(ringbuf_high_water(&rb) == 2, "high water not reset to the level");
+
+	ringbuf_flush(&rb);
+	CHECK(ringbuf_is_empty(&rb), "not empty after flush");
+
+	return 0;
+}
+
+static int test_slots(void) {
+	frame_t storage[4];
+	ringbuf_t rb = RINGBUF_INIT(storage, sizeof(frame_t), 4);
+
+	for (uint32_t i = 0;i < 3;i++) {
+		frame_t *f = ringbuf_write_slot(&rb);
+		CHECK(f, "no slot %u", i);
+		f->seq = i;
+		f->len = i + 1;
+		ringbuf_commit(&rb);
+	}
+
+	CHECK(ringbuf_write_slot(&rb) == 0, "slot from a full buffer");
+	CHECK(ringbuf_overflows(&rb) == 1, "overflow not counted");
+
+	frame_t *f = ringbuf_read_slot(&rb);
+	CHECK(f && f->seq == 0 && f->len == 1, "first slot");
+	ringbuf_release(&rb);
+
+	frame_t copy;
+	CHECK(ringbuf_pop(&rb, &copy, 1) == 1 && copy.seq == 1, "pop slot");
+	CHECK(ringbuf_read_slot(&rb) == (void*)&storage[2], "read slot in place");
+
+	return 0;
+}
+
+static ringbuf_t m_byte_rb;
+static uint8_t m_byte_storage[257];
+static ringbuf_t m_frame_rb;
+static frame_t m_frame_storage[16];
+static int m_chunk;
+
+// Pushes a byte sequence in chunks of varying size, retrying when full
+static void *byte_producer(void *arg) {
+	unsigned int total = *(unsigned int*)arg;
+	uint8_t chunk[64];
+	unsigned int seq = 0;
+	unsigned int rnd = 1;
+
+	while (seq < total) {
+		rnd = rnd * 1103515245 + 12345;
+		unsigned int n = m_chunk ? (unsigned int)m_chunk : 1 + (rnd >> 16) % 64;
+		if (n > total - seq) {
+			n = total - seq;
+		}
+
+		for (unsigned int i = 0;i < n;i++) {
+			chunk[i] = (seq + i) * 7;
+		}
+
+		unsigned int done = 0;
+		for (;;) {
+			done += ringbuf_push(&m_byte_rb, chunk + done, n - done);
+			if (done == n) {
+				break;
+			}
+			sched_yield();
+		}
+
+		seq += n;
+	}
+
+	return 0;
+}
+
+static void *frame_producer(void *arg) {
+	(void)arg;
+
+	for (uint32_t seq = 0;seq < STRESS_FRAMES;seq++) {
+		frame_t *f;
+		while ((f = ringbuf_write_slot(&m_frame_rb)) == 0) {
+			sched_yield();
+		}
+
+		f->seq = seq;
+		f->len = seq % sizeof(f->data);
+		for (int i = 0;i < f->len;i++) {
+			f->data[i] = seq + i;
+		}
+
+		ringbuf_commit(&m_frame_rb);
+	}
+
+	return 0;
+}
+
+/*
+ * One producer and one consumer thread. Every byte must arrive once and in
+ * order, and the overflows count the retries of the producer. Both sides
+ * yield when they have to wait, so that this also runs on a single core.
+ */
+static int test_stress_bytes(void) {
+	pthread_t thd;
+	unsigned int total = STRESS_BYTES;
+	uint8_t chunk[64];
+	unsigned int seq = 0;
+
+	ringbuf_init(&m_byte_rb, m_byte_storage, 1, sizeof(m_byte_storage));
+	m_chunk = 0;
+	pthread_create(&thd, 0, byte_producer, &total);
+
+	while (seq < total) {
+		unsigned int n = ringbuf_pop(&m_byte_rb, chunk, 1 + seq % sizeof(chunk));
+		if (n == 0) {
+			sched_yield();
+		}
+
+		for (unsigned int i = 0;i < n;i++) {
+			CHECK(chunk[i] == (uint8_t)((seq + i) * 7), "byte %u wrong", seq + i);
+		}
+		seq += n;
+	}
+
+	pthread_join(thd, 0);
+	CHECK(ringbuf_is_empty(&m_byte_rb), "data left");
+	CHECK(ringbuf_high_water(&m_byte_rb) <= sizeof(m_byte_storage) - 1, "high water above size");
+	printf("bytes: %u, high water %u, overflows %u\n", total,
+			ringbuf_high_water(&m_byte_rb), ringbuf_overflows(&m_byte_rb));
+
+	return 0;
+}
+
+// Slots filled and read in place from two threads
+static int test_stress_frames(void) {
+	pthread_t thd;
+
+	ringbuf_init(&m_frame_rb, m_frame_storage, sizeof(frame_t), 16);
+	pthread_create(&thd, 0, frame_producer, 0);
+
+	for (uint32_t seq = 0;seq < STRESS_FRAMES;seq++) {
+		frame_t *f;
+		while ((f = ringbuf_read_slot(&m_frame_rb)) == 0) {
+			sched_yield();
+		}
+
+		CHECK(f->seq == seq, "frame %u has seq %u", seq, f->seq);
+		CHECK(f->len == seq % sizeof(f->data), "frame %u length", seq);
+		for (int i = 0;i < f->len;i++) {
+			CHECK(f->data[i] == (uint8_t)(seq + i), "frame %u byte %d", seq, i);
+		}
+
+		ringbuf_release(&m_frame_rb);
+	}
+
+	pthread_join(thd, 0);
+	CHECK(ringbuf_is_empty(&m_frame_rb), "frames left");
+
+	return 0;
+}
+
+// Throughput between two threads. Only printed, the result depends on the host.
+static void bench(int chunk) {
+	pthread_t thd;
+	unsigned int total = BENCH_BYTES;
+	uint8_t buf[64];
+	unsigned int got = 0;
+
+	ringbuf_init(&m_byte_rb, m_byte_storage, 1, sizeof(m_byte_storage));
+	m_chunk = chunk;
+
+	double start = time_s();
+	pthread_create(&thd, 0, byte_producer, &total);
+
+	while (got < total) {
+		unsigned int n = ringbuf_pop(&m_byte_rb, buf, chunk);
+		if (n == 0) {
+			sched_yield();
+		}
+		got += n;
+	}
+
+	pthread_join(thd, 0);
+	double elapsed = time_s() - start;
+
+	printf("chunk %2d: %6.1f MB/s\n", chunk, (double)total / elapsed / 1e6);
+}
+
+int main(void) {
+	int res = 0;
+
+	res |= test_bytes();
+	res |= test_slots();
+	res |= test_stress_bytes();
+	res |= test_stress_frames();
+
+	if (!res) {
+		bench(1);
+		bench(16);
+		bench(64);
+	}
+
+	printf("%s\n", res ? "FAILED" : "OK");
+	return res;
+}
@@ -23,6 +23,8 @@
 #include "terminal.h"
 #include "comm_cc1120.h"
 #include "comm_cc2520.h"
+#include "stats.h"
+#include "ringbuf.h"
 
 #include <string.h>
 #include <math.h>
@@ -37,6 +39,7 @@
 #define HW_UBX_RESET_PIN			9
 #define BAUDRATE					115200
 #define SERIAL_RX_BUFFER_SIZE		1024
+#define SERIAL_RX_CHUNK				64
 #define LINE_BUFFER_SIZE			256
 #define UBX_BUFFER_SIZE				2048
 #define CFG_ACK_WAIT_MS				100
@@ -62,8 +65,7 @@ static thread_t *ack_wait_tp = 0;
 
 // Private variables
 static uint8_t m_serial_rx_buffer[SERIAL_RX_BUFFER_SIZE];
-static int m_serial_rx_read_pos = 0;
-static int m_serial_rx_write_pos = 0;
+static ringbuf_t m_serial_rx = RINGBUF_INIT(m_serial_rx_buffer, 1, SERIAL_RX_BUFFER_SIZE);
 static rtcm3_state m_rtcm_state;
 static bool m_print_next_relposned = false;
 static bool m_print_next_rawx = false;
@@ -147,11 +149,8 @@ static void rxerr(UARTDriver *uartp, uartflags_t e) {
  */
 static void rxchar(UARTDriver *uartp, uint16_t c) {
 	(void)uartp;
-	m_serial_rx_buffer[m_serial_rx_write_pos++] = c;
-
-	if (m_serial_rx_write_pos == SERIAL_RX_BUFFER_SIZE) {
-		m_serial_rx_write_pos = 0;
-	}
+	uint8_t ch = c;
+	ringbuf_push(&m_serial_rx, &ch, 1);
 
 	chSysLockFromISR();
 	chEvtSignalI(process_tp, (eventmask_t) 1);
@@ -190,6 +189,7 @@ void ublox_init(void) {
 	palSetPad(HW_UBX_RESET_PORT, HW_UBX_RESET_PIN);
 	chThdSleepMilliseconds(1000);
 
+	stats_register_queue(STATS_QUEUE_UBLOX_RX, &m_serial_rx);
 	uartStart(&HW_UART_DEV, &uart_cfg);
 
 	chThdCreateStatic(process_thread_wa, sizeof(process_thread_wa), NORMALPRIO, process_thread, NULL);
@@ -562,99 +562,108 @@ static THD_FUNCTION(process_thread, arg) {
 	for(;;) {
 		chEvtWaitAny((eventmask_t) 1);
 
-		while (m_serial_rx_read_pos != m_serial_rx_write_pos) {
-			uint8_t ch = m_serial_rx_buffer[m_serial_rx_read_pos++];
-			bool ch_used = false;
+		uint8_t chunk[SERIAL_RX_CHUNK];
+		unsigned int chunk_len;
+		uint32_t rtcm_bytes = 0;
 
-			if (m_serial_rx_read_pos == SERIAL_RX_BUFFER_SIZE) {
-				m_serial_rx_read_pos = 0;
-			}
-
-			// RTCM
-			if (!ch_used && m_decoder_state.line_pos == 0 && m_decoder_state.ubx_pos == 0) {
-				ch_used = rtcm3_input_data(ch, &m_rtcm_state) >= 0;
-			}
+		while ((chunk_len = ringbuf_pop(&m_serial_rx, chunk, SERIAL_RX_CHUNK)) > 0) {
+			for (unsigned int i = 0;i < chunk_len;i++) {
+				uint8_t ch = chunk[i];
+				bool ch_used = false;
 
-			// Ubx
-			if (!ch_used && m_decoder_state.line_pos == 0) {
-				int ubx_pos_last = m_decoder_state.ubx_pos;
+				// RTCM
+				if (!ch_used && m_decoder_state.line_pos == 0 && m_decoder_state.ubx_pos == 0) {
+					ch_used = rtcm3_input_data(ch, &m_rtcm_state) >= 0;
+					if (ch_used) {
+						rtcm_bytes++;
+					}
+				}
 
-				if (m_decoder_state.ubx_pos == 0) {
-					if (ch == 0xB5) {
+				// Ubx
+				if (!ch_used && m_decoder_state.line_pos == 0) {
+					int ubx_pos_last = m_decoder_state.ubx_pos;
+
+					if (m_decoder_state.ubx_pos == 0) {
+						if (ch == 0xB5) {
+							m_decoder_state.ubx_pos++;
+						}
+					} else if (m_decoder_state.ubx_pos == 1) {
+						if (ch == 0x62) {
+							m_decoder_state.ubx_pos++;
+							m_decoder_state.ubx_ck_a = 0;
+							m_decoder_state.ubx_ck_b = 0;
+						}
+					} else if (m_decoder_state.ubx_pos == 2) {
+						m_decoder_state.ubx_class = ch;
+						m_decoder_state.ubx_ck_a += ch;
+						m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
 						m_decoder_state.ubx_pos++;
-					}
-				} else if (m_decoder_state.ubx_pos == 1) {
-					if (ch == 0x62) {
+					} else if (m_decoder_state.ubx_pos == 3) {
+						m_decoder_state.ubx_id = ch;
+						m_decoder_state.ubx_ck_a += ch;
+						m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
 						m_decoder_state.ubx_pos++;
-						m_decoder_state.ubx_ck_a = 0;
-						m_decoder_state.ubx_ck_b = 0;
-					}
-				} else if (m_decoder_state.ubx_pos == 2) {
-					m_decoder_state.ubx_class = ch;
-					m_decoder_state.ubx_ck_a += ch;
-					m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
-					m_decoder_state.ubx_pos++;
-				} else if (m_decoder_state.ubx_pos == 3) {
-					m_decoder_state.ubx_id = ch;
-					m_decoder_state.ubx_ck_a += ch;
-					m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
-					m_decoder_state.ubx_pos++;
-				} else if (m_decoder_state.ubx_pos == 4) {
-					m_decoder_state.ubx_len = ch;
-					m_decoder_state.ubx_ck_a += ch;
-					m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
-					m_decoder_state.ubx_pos++;
-				} else if (m_decoder_state.ubx_pos == 5) {
-					m_decoder_state.ubx_len |= ch << 8;
-					m_decoder_state.ubx_ck_a += ch;
-					m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
-					m_decoder_state.ubx_pos++;
-				} else if ((m_decoder_state.ubx_pos - 6) < m_decoder_state.ubx_len) {
-					m_decoder_state.ubx[m_decoder_state.ubx_pos - 6] = ch;
-					m_decoder_state.ubx_ck_a += ch;
-					m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
-					m_decoder_state.ubx_pos++;
-				} else if ((m_decoder_state.ubx_pos - 6) == m_decoder_state.ubx_len) {
-					if (ch == m_decoder_state.ubx_ck_a) {
+					} else if (m_decoder_state.ubx_pos == 4) {
+						m_decoder_state.ubx_len = ch;
+						m_decoder_state.ubx_ck_a += ch;
+						m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
+						m_decoder_state.ubx_pos++;
+					} else if (m_decoder_state.ubx_pos == 5) {
+						m_decoder_state.ubx_len |= ch << 8;
+						m_decoder_state.ubx_ck_a += ch;
+						m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
 						m_decoder_state.ubx_pos++;
+					} else if ((m_decoder_state.ubx_pos - 6) < m_decoder_state.ubx_len) {
+						m_decoder_state.ubx[m_decoder_state.ubx_pos - 6] = ch;
+						m_decoder_state.ubx_ck_a += ch;
+						m_decoder_state.ubx_ck_b += m_decoder_state.ubx_ck_a;
+						m_decoder_state.ubx_pos++;
+					} else if ((m_decoder_state.ubx_pos - 6) == m_decoder_state.ubx_len) {
+						if (ch == m_decoder_state.ubx_ck_a) {
+							m_decoder_state.ubx_pos++;
+						}
+					} else if ((m_decoder_state.ubx_pos - 6) == (m_decoder_state.ubx_len + 1)) {
+						if (ch == m_decoder_state.ubx_ck_b) {
+							ubx_decode(m_decoder_state.ubx_class, m_decoder_state.ubx_id,
+									m_decoder_state.ubx, m_decoder_state.ubx_len);
+							m_decoder_state.ubx_pos = 0;
+						}
 					}
-				} else if ((m_decoder_state.ubx_pos - 6) == (m_decoder_state.ubx_len + 1)) {
-					if (ch == m_decoder_state.ubx_ck_b) {
-						ubx_decode(m_decoder_state.ubx_class, m_decoder_state.ubx_id,
-								m_decoder_state.ubx, m_decoder_state.ubx_len);
+
+					if (ubx_pos_last != m_decoder_state.ubx_pos) {
+						ch_used = true;
+					} else {
 						m_decoder_state.ubx_pos = 0;
 					}
 				}
 
-				if (ubx_pos_last != m_decoder_state.ubx_pos) {
-					ch_used = true;
-				} else {
-					m_decoder_state.ubx_pos = 0;
-				}
-			}
-
-			// NMEA
-			if (!ch_used) {
-				m_decoder_state.line[m_decoder_state.line_pos++] = ch;
-				if (m_decoder_state.line_pos == LINE_BUFFER_SIZE) {
-					m_decoder_state.line_pos = 0;
-				}
+				// NMEA
+				if (!ch_used) {
+					m_decoder_state.line[m_decoder_state.line_pos++] = ch;
+					if (m_decoder_state.line_pos == LINE_BUFFER_SIZE) {
+						m_decoder_state.line_pos = 0;
+					}
 
-				if (m_decoder_state.line_pos > 0 && m_decoder_state.line[m_decoder_state.line_pos - 1] == '\n') {
-					m_decoder_state.line[m_decoder_state.line_pos] = '\0';
-					m_decoder_state.line_pos = 0;
+					if (m_decoder_state.line_pos > 0 && m_decoder_state.line[m_decoder_state.line_pos - 1] == '\n') {
+						m_decoder_state.line[m_decoder_state.line_pos] = '\0';
+						m_decoder_state.line_pos = 0;
 
 #if MAIN_MODE_IS_VEHICLE
-					bool found = pos_input_nmea((const char*)m_decoder_state.line);
+						bool found = pos_input_nmea((const char*)m_decoder_state.line);
 
-					// Only send the lines that pos decoded
-					if (found) {
-						commands_send_nmea(m_decoder_state.line, strlen((char*)m_decoder_state.line));
-					}
+						// Only send the lines that pos decoded
+						if (found) {
+							commands_send_nmea(m_decoder_state.line, strlen((char*)m_decoder_state.line));
+						}
 #endif
+					}
 				}
 			}
 		}
+
+		if (rtcm_bytes > 0) {
+			stats_rtcm_bytes(rtcm_bytes);
+		}
 	}
 }
 
@@ -662,8 +671,7 @@ static void reset_decoder_state(void) {
 	memset(&m_decoder_state, 0, sizeof(decoder_state));
 	rtcm3_init_state(&m_rtcm_state);
 	rtcm3_set_rx_callback(rtcm_rx, &m_rtcm_state);
-	m_serial_rx_read_pos = 0;
-	m_serial_rx_write_pos = 0;
+	ringbuf_flush(&m_serial_rx);
 }
 
 static void ubx_terminal_cmd_poll(int argc, const char **argv) {
@@ -828,29 +836,62 @@ static void ubx_decode(uint8_t class, uint8_t id, uint8_t *msg, int len) {
 }
 
 static void ubx_decode_relposned(uint8_t *msg, int len) {
-	(void)len;
-
 	static ubx_nav_relposned pos;
-	int ind = 2;
+	int ind = 0;
 	uint32_t flags;
 
+	// Version 0 is 40 bytes. Version 1 is 64 bytes and adds the length
+	// and heading of the vector, which is what moving base receivers are
+	// used for.
+	uint8_t version = ubx_get_U1(msg, &ind);
+	if ((version == 0 && len < 40) || (version == 1 && len < 64) || version > 1) {
+		return;
+	}
+
+	memset(&pos, 0, sizeof(pos));
+	ind = 2;
+
 	pos.ref_station_id = ubx_get_U2(msg, &ind);
 	pos.i_tow = ubx_get_U4(msg, &ind);
 	pos.pos_n = (float)ubx_get_I4(msg, &ind) / 100.0;
 	pos.pos_e = (float)ubx_get_I4(msg, &ind) / 100.0;
 	pos.pos_d = (float)ubx_get_I4(msg, &ind) / 100.0;
+
+	if (version == 1) {
+		pos.rel_pos_length = (float)ubx_get_I4(msg, &ind) / 100.0;
+		pos.rel_pos_heading = (float)ubx_get_I4(msg, &ind) / 1e5;
+		ind += 4;
+	}
+
 	pos.pos_n += (float)ubx_get_I1(msg, &ind) / 10000.0;
 	pos.pos_e += (float)ubx_get_I1(msg, &ind) / 10000.0;
 	pos.pos_d += (float)ubx_get_I1(msg, &ind) / 10000.0;
-	ind += 1;
+
+	if (version == 1) {
+		pos.rel_pos_length += (float)ubx_get_I1(msg, &ind) / 10000.0;
+	} else {
+		ind += 1;
+	}
+
 	pos.acc_n = (float)ubx_get_U4(msg, &ind) / 10000.0;
 	pos.acc_e = (float)ubx_get_U4(msg, &ind) / 10000.0;
 	pos.acc_d = (float)ubx_get_U4(msg, &ind) / 10000.0;
+
+	if (version == 1) {
+		pos.acc_length = (float)ubx_get_U4(msg, &ind) / 10000.0;
+		pos.acc_heading = (float)ubx_get_U4(msg, &ind) / 1e5;
+		ind += 4;
+	}
+
 	flags = ubx_get_X4(msg, &ind);
 	pos.fix_ok = flags & 0x01;
 	pos.diff_soln = flags & 0x02;
 	pos.rel_pos_valid = flags & 0x04;
 	pos.carr_soln = (flags >> 3) & 0x03;
+	pos.is_moving = flags & 0x20;
+	pos.ref_pos_miss = flags & 0x40;
+	pos.ref_obs_miss = flags & 0x80;
+	pos.heading_valid = flags & 0x100;
 
 	if (rx_relposned) {
 		rx_relposned(&pos);
@@ -870,11 +911,18 @@ static void ubx_decode_relposned(uint8_t *msg, int len) {
 				"Fix OK: %d\n"
 				"Diff Soln: %d\n"
 				"Rel Pos Valid: %d\n"
-				"Carr Soln: %d\n",
+				"Carr Soln: %d\n"
+				"Length: %.3f m\n"
+				"Heading: %.2f deg\n"
+				"Heading ACC: %.2f deg\n"
+				"Moving Base: %d\n"
+				"Heading Valid: %d\n",
 				pos.i_tow,
 				(double)pos.pos_n, (double)pos.pos_e, (double)pos.pos_d,
 				(double)pos.acc_n, (double)pos.acc_e, (double)pos.acc_d,
-				pos.fix_ok, pos.diff_soln, pos.rel_pos_valid, pos.carr_soln);
+				pos.fix_ok, pos.diff_soln, pos.rel_pos_valid, pos.carr_soln,
+				(double)pos.rel_pos_length, (double)pos.rel_pos_heading,
+				(double)pos.acc_heading, pos.is_moving, pos.heading_valid);
 	}
 }
 
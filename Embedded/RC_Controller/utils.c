@@ -297,7 +297,7 @@ int utils_middle_of_3_int(int a, int b, int c) {
 float utils_fast_inv_sqrt(float x) {
 	union {
 		float as_float;
-		long as_int;
+		int32_t as_int;
 	} un;
 
 	float xhalf = 0.5f*x;
@@ -491,6 +491,35 @@ void utils_fast_sincos_better(float angle, float *sin, float *cos) {
 	}
 }
 
+/**
+ * Fast tangent based on utils_fast_sincos_better.
+ *
+ * @param angle
+ * The angle in radians. Must not be close to +-PI / 2.
+ *
+ * @return
+ * The tangent of angle.
+ */
+float utils_fast_tan(float angle) {
+	float s, c;
+	utils_fast_sincos_better(angle, &s, &c);
+	return s / c;
+}
+
+/**
+ * Fast arcsine based on utils_fast_atan2.
+ *
+ * @param x
+ * The sine, -1.0 to 1.0.
+ *
+ * @return
+ * The angle in radians.
+ */
+float utils_fast_asin(float x) {
+	utils_truncate_number(&x, -1.0, 1.0);
+	return utils_fast_atan2(x, sqrtf(1.0 - x * x));
+}
+
 /**
  * Calculate the distance between two points.
  *
@@ -20,6 +20,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include "conf_general.h"
 
 void utils_step_towards(float *value, float goal, float step);
@@ -42,6 +43,8 @@ float utils_fast_atan2(float y, float x);
 bool utils_saturate_vector_2d(float *x, float *y, float max);
 void utils_fast_sincos(float angle, float *sin, float *cos);
 void utils_fast_sincos_better(float angle, float *sin, float *cos);
+float utils_fast_tan(float angle);
+float utils_fast_asin(float x);
 float utils_point_distance(float x1, float y1, float x2, float y2);
 float utils_rp_distance(const ROUTE_POINT *p1, const ROUTE_POINT *p2);
 int utils_circle_line_int(float cx, float cy, float rad,
@@ -72,6 +75,9 @@ void utils_sys_unlock_cnt(void);
 // Return the age of a timestamp in seconds
 #define UTILS_AGE_S(x)		((float)chVTTimeElapsedSinceX(x) / (float)CH_CFG_ST_FREQUENCY)
 
+// System time in microseconds. This wraps around, so only differences are meaningful.
+#define UTILS_SYS_TIME_US()	((uint32_t)chVTGetSystemTimeX() * (1000000 / CH_CFG_ST_FREQUENCY))
+
 // nan and infinity check for floats
 #define UTILS_IS_INF(x)		((x) == (1.0 / 0.0) || (x) == (-1.0 / 0.0))
 #define UTILS_IS_NAN(x)		((x) != (x))
@@ -90,6 +96,21 @@ void utils_sys_unlock_cnt(void);
  */
 #define UTILS_LP_FAST(value, sample, filter_constant)	(value -= (filter_constant) * (value - (sample)))
 
+// Math profile, see FAST_MATH in conf_general.h
+#if FAST_MATH
+#define UTILS_ATAN2(y, x)			utils_fast_atan2(y, x)
+#define UTILS_ASIN(x)				utils_fast_asin(x)
+#define UTILS_TAN(x)				utils_fast_tan(x)
+#define UTILS_SINCOS(x, s, c)		utils_fast_sincos_better(x, s, c)
+#define UTILS_INV_SQRT(x)			utils_fast_inv_sqrt(x)
+#else
+#define UTILS_ATAN2(y, x)			atan2f(y, x)
+#define UTILS_ASIN(x)				asinf(x)
+#define UTILS_TAN(x)				tanf(x)
+#define UTILS_SINCOS(x, s, c)		do {*(s) = sinf(x); *(c) = cosf(x);} while (0)
+#define UTILS_INV_SQRT(x)			(1.0 / sqrtf(x))
+#endif
+
 // Constants
 #define FE_WGS84						(D(1.0)/D(298.257223563)) // earth flattening (WGS84)
 #define RE_WGS84						D(6378137.0)           // earth semimajor axis (WGS84) (m)
@@ -31,9 +31,21 @@ release_lin {
     UI_DIR = build/lin/obj
 }
 
-SOURCES += main.cpp\
-        mainwindow.cpp
+# The binary protocol is shared with RControlStation
+INCLUDEPATH += ../RControlStation
 
-HEADERS  += mainwindow.h
+SOURCES += main.cpp\
+        mainwindow.cpp \
+    ../RControlStation/netprotocol.cpp \
+    ../RControlStation/packet.cpp \
+    ../RControlStation/locpoint.cpp \
+    ../RControlStation/utility.cpp
+
+HEADERS  += mainwindow.h \
+    ../RControlStation/netprotocol.h \
+    ../RControlStation/packet.h \
+    ../RControlStation/locpoint.h \
+    ../RControlStation/utility.h \
+    ../RControlStation/datatypes.h
 
 FORMS    += mainwindow.ui
@@ -19,6 +19,10 @@
 #include "ui_mainwindow.h"
 #include <QMessageBox>
 #include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+#include <QMap>
+#include "netprotocol.h"
+#include "utility.h"
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -29,6 +33,7 @@ MainWindow::MainWindow(QWidget *parent) :
     mTcpSocket = new QTcpSocket(this);
     mUdpSocket = new QUdpSocket(this);
     mTcpConnected = false;
+    mPacket = new Packet(this);
 
     connect(mTcpSocket, SIGNAL(readyRead()), this, SLOT(tcpInputDataAvailable()));
     connect(mTcpSocket, SIGNAL(connected()), this, SLOT(tcpInputConnected()));
@@ -38,6 +43,10 @@ MainWindow::MainWindow(QWidget *parent) :
             this, SLOT(tcpInputError(QAbstractSocket::SocketError)));
     connect(mUdpSocket, SIGNAL(readyRead()),
             this, SLOT(udpReadReady()));
+    connect(mPacket, SIGNAL(dataToSend(QByteArray&)),
+            this, SLOT(packetDataToSend(QByteArray&)));
+    connect(mPacket, SIGNAL(packetReceived(QByteArray&)),
+            this, SLOT(packetReceived(QByteArray&)));
 }
 
 MainWindow::~MainWindow()
@@ -51,6 +60,14 @@ void MainWindow::tcpInputConnected()
     ui->disconnectedButton->setEnabled(true);
     ui->tcpButton->setEnabled(true);
     ui->udpButton->setEnabled(true);
+    ui->binaryButton->setEnabled(true);
+
+    // Get pushed states from all cars
+    if (ui->binaryButton->isChecked()) {
+        mPacket->sendPacket(NetProtocol::encodeHello());
+        mPacket->sendPacket(NetProtocol::encodeSubscribe(NET_SUB_ALL_CARS, mSubIntervalMs,
+                                                         QVector<quint8>()));
+    }
 }
 
 void MainWindow::tcpInputDisconnected()
@@ -60,7 +77,11 @@ void MainWindow::tcpInputDisconnected()
 
 void MainWindow::tcpInputDataAvailable()
 {
-    ui->incomingEdit->appendPlainText(QString::fromUtf8(mTcpSocket->readAll()));
+    if (ui->binaryButton->isChecked()) {
+        mPacket->processData(mTcpSocket->readAll());
+    } else {
+        ui->incomingEdit->appendPlainText(QString::fromUtf8(mTcpSocket->readAll()));
+    }
 }
 
 void MainWindow::tcpInputError(QAbstractSocket::SocketError socketError)
@@ -91,9 +112,34 @@ void MainWindow::udpReadReady()
     }
 }
 
+void MainWindow::packetDataToSend(QByteArray &data)
+{
+    if (mTcpConnected) {
+        mTcpSocket->write(data);
+    }
+}
+
+void MainWindow::packetReceived(QByteArray &data)
+{
+    ui->incomingEdit->appendPlainText(binaryToText(data));
+}
+
 void MainWindow::on_sendButton_clicked()
 {
-    if (ui->tcpButton->isChecked()) {
+    if (ui->binaryButton->isChecked()) {
+        QString error;
+        QList<QByteArray> msgs = xmlToBinary(ui->outgoingEdit->toPlainText(), error);
+
+        if (!error.isEmpty()) {
+            QMessageBox::warning(this, "Send Error",
+                                 "Could not translate the message: " + error);
+            return;
+        }
+
+        for (QByteArray msg: msgs) {
+            mPacket->sendPacket(msg);
+        }
+    } else if (ui->tcpButton->isChecked()) {
         mTcpSocket->write(ui->outgoingEdit->toPlainText().toUtf8());
     } else if (ui->udpButton->isChecked()) {
 
@@ -118,6 +164,7 @@ void MainWindow::on_disconnectedButton_toggled(bool checked)
         ui->disconnectedButton->setEnabled(true);
         ui->tcpButton->setEnabled(true);
         ui->udpButton->setEnabled(true);
+        ui->binaryButton->setEnabled(true);
     }
 }
 
@@ -131,6 +178,7 @@ void MainWindow::on_tcpButton_toggled(bool checked)
         ui->disconnectedButton->setEnabled(false);
         ui->tcpButton->setEnabled(false);
         ui->udpButton->setEnabled(false);
+        ui->binaryButton->setEnabled(false);
     } else {
         if (mTcpConnected) {
             mTcpSocket->abort();
@@ -157,6 +205,11 @@ void MainWindow::on_udpButton_toggled(bool checked)
     }
 }
 
+void MainWindow::on_binaryButton_toggled(bool checked)
+{
+    on_tcpButton_toggled(checked);
+}
+
 void MainWindow::on_getStateGenerateButton_clicked()
 {
     QString str;
@@ -373,3 +426,181 @@ void MainWindow::on_setStatusPollGenerateButton_clicked()
     ui->outgoingEdit->clear();
     ui->outgoingEdit->appendPlainText(str);
 }
+
+/**
+ * @brief MainWindow::xmlToBinary
+ * Translate the generated XML messages to the binary protocol of
+ * RControlStation (see netprotocol.h).
+ *
+ * @param xml
+ * A message document as made by the generate buttons.
+ *
+ * @param error
+ * Set to a description if the document could not be translated.
+ *
+ * @return
+ * The binary messages, one for every message in the document.
+ */
+QList<QByteArray> MainWindow::xmlToBinary(const QString &xml, QString &error)
+{
+    QList<QByteArray> res;
+    QXmlStreamReader stream(xml);
+    stream.readNextStartElement();
+
+    while (stream.readNextStartElement()) {
+        QString name = stream.name().toString();
+        QMap<QString, QString> fields;
+        QList<QMap<QString, QString> > points;
+
+        while (stream.readNextStartElement()) {
+            if (stream.name() == "point") {
+                QMap<QString, QString> point;
+                while (stream.readNextStartElement()) {
+                    point.insert(stream.name().toString(), stream.readElementText());
+                }
+                points.append(point);
+            } else {
+                fields.insert(stream.name().toString(), stream.readElementText());
+            }
+        }
+
+        // A single route point is written without a point element
+        if (points.isEmpty() && fields.contains("px")) {
+            points.append(fields);
+        }
+
+        QList<LocPoint> route;
+        for (QMap<QString, QString> point: points) {
+            LocPoint p;
+            p.setXY(point.value("px").toDouble(), point.value("py").toDouble());
+            p.setSpeed(point.value("speed").toDouble());
+            p.setTime(point.value("time").toInt());
+            route.append(p);
+        }
+
+        quint8 id = fields.value("id").toInt();
+        QByteArray msg;
+
+        if (name == "getState") {
+            msg.append((char)NET_MSG_GET_STATE);
+            msg.append((char)id);
+        } else if (name == "addRoutePoint") {
+            msg = NetProtocol::encodeRoute(NET_MSG_ROUTE_ADD, id, route);
+        } else if (name == "replaceRoute") {
+            msg = NetProtocol::encodeRoute(NET_MSG_ROUTE_REPLACE, id, route);
+        } else if (name == "removeLastPoint") {
+            msg.append((char)NET_MSG_ROUTE_REMOVE_LAST);
+            msg.append((char)id);
+        } else if (name == "clearRoute") {
+            msg.append((char)NET_MSG_ROUTE_CLEAR);
+            msg.append((char)id);
+        } else if (name == "setAutopilotActive") {
+            msg.append((char)NET_MSG_AP_ACTIVE);
+            msg.append((char)id);
+            msg.append((char)fields.value("enabled").toInt());
+        } else if (name == "getEnuRef") {
+            msg.append((char)NET_MSG_GET_ENU_REF);
+            msg.append((char)id);
+            msg.append((char)fields.value("fromMap").toInt());
+        } else if (name == "setEnuRef") {
+            msg = NetProtocol::encodeEnuRef(NET_MSG_SET_ENU_REF, id,
+                                            fields.value("lat").toDouble(),
+                                            fields.value("lon").toDouble(),
+                                            fields.value("height").toDouble());
+        } else if (name == "rcControl") {
+            uint8_t buffer[11];
+            int32_t ind = 0;
+            buffer[ind++] = NET_MSG_RC_CONTROL;
+            buffer[ind++] = id;
+            buffer[ind++] = fields.value("mode").toInt();
+            utility::buffer_append_double32_auto(buffer, fields.value("value").toDouble(), &ind);
+            utility::buffer_append_double32_auto(buffer, fields.value("steering").toDouble(), &ind);
+            msg = QByteArray((const char*)buffer, ind);
+        } else if (name == "setStatusPoll") {
+            // The station polls the car at the subscription interval. All
+            // cars stay subscribed.
+            int interval = fields.value("interval").toInt();
+            if (interval > 0) {
+                msg = NetProtocol::encodeSubscribe(NET_SUB_ALL_CARS | NET_SUB_POLL, interval,
+                                                   QVector<quint8>() << id);
+            } else {
+                msg = NetProtocol::encodeSubscribe(NET_SUB_ALL_CARS, mSubIntervalMs,
+                                                   QVector<quint8>());
+            }
+        } else {
+            error = "Unknown message " + name;
+            return res;
+        }
+
+        res.append(msg);
+    }
+
+    if (stream.hasError()) {
+        error = stream.errorString();
+    }
+
+    return res;
+}
+
+QString MainWindow::binaryToText(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return "Empty message";
+    }
+
+    NET_MSG msg = (NET_MSG)data.at(0);
+    QString res;
+
+    switch (msg) {
+    case NET_MSG_HELLO:
+        res = QString("HELLO: protocol version %1").arg(data.size() > 1 ? (quint8)data.at(1) : -1);
+        break;
+
+    case NET_MSG_SUBSCRIBED: {
+        if (data.size() < 4) {
+            res = "SUBSCRIBED: invalid length";
+            break;
+        }
+
+        int32_t ind = 2;
+        int interval = utility::buffer_get_uint16((const uint8_t*)data.constData(), &ind);
+        res = QString("SUBSCRIBED: flags 0x%1, interval %2 ms").
+                arg((quint8)data.at(1), 2, 16, QChar('0')).arg(interval);
+    } break;
+
+    case NET_MSG_STATE: {
+        quint8 id;
+        CAR_STATE state;
+        if (NetProtocol::decodeState(data, id, state)) {
+            res = QString("STATE %1: px %2 py %3 yaw %4 speed %5 vin %6").
+                    arg(id).arg(state.px).arg(state.py).arg(state.yaw).
+                    arg(state.speed).arg(state.vin);
+        } else {
+            res = "STATE: invalid length";
+        }
+    } break;
+
+    case NET_MSG_ENU_REF: {
+        quint8 id;
+        double llh[3];
+        if (NetProtocol::decodeEnuRef(data, id, llh[0], llh[1], llh[2])) {
+            res = QString("ENU_REF %1: lat %2 lon %3 height %4").arg(id).
+                    arg(llh[0], 0, 'f', 8).arg(llh[1], 0, 'f', 8).arg(llh[2]);
+        } else {
+            res = "ENU_REF: invalid length";
+        }
+    } break;
+
+    case NET_MSG_ERROR:
+        res = QString("ERROR for message %1: %2").
+                arg(data.size() > 1 ? (quint8)data.at(1) : -1).
+                arg(QString::fromLocal8Bit(data.mid(2)));
+        break;
+
+    default:
+        res = QString("Message type %1, %2 bytes").arg((int)msg).arg(data.size());
+        break;
+    }
+
+    return res;
+}
@@ -21,6 +21,7 @@
 #include <QMainWindow>
 #include <QTcpSocket>
 #include <QUdpSocket>
+#include "packet.h"
 
 namespace Ui {
 class MainWindow;
@@ -40,12 +41,15 @@ private slots:
     void tcpInputDataAvailable();
     void tcpInputError(QAbstractSocket::SocketError socketError);
     void udpReadReady();
+    void packetDataToSend(QByteArray &data);
+    void packetReceived(QByteArray &data);
 
     void on_sendButton_clicked();
     void on_clearButton_clicked();
     void on_disconnectedButton_toggled(bool checked);
     void on_tcpButton_toggled(bool checked);
     void on_udpButton_toggled(bool checked);
+    void on_binaryButton_toggled(bool checked);
     void on_getStateGenerateButton_clicked();
     void on_addRoutePointGenerateButton_clicked();
     void on_removeLastPointGenerateButton_clicked();
@@ -62,6 +66,13 @@ private:
     QUdpSocket *mUdpSocket;
     QTcpSocket *mTcpSocket;
     bool mTcpConnected;
+    Packet *mPacket;
+
+    // State interval of the binary subscription
+    static const int mSubIntervalMs = 100;
+
+    QList<QByteArray> xmlToBinary(const QString &xml, QString &error);
+    QString binaryToText(const QByteArray &data);
 
 };
 
@@ -11,6 +11,10 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
+# The MAIN_CONFIG types and codec are shared with RControlStation. The codec
+# only depends on mainconfigtypes.h, not on the datatypes.h of either program.
+INCLUDEPATH += ../RControlStation
+
 SOURCES += main.cpp \
     packetinterface.cpp \
     tcpbroadcast.cpp \
@@ -24,7 +28,9 @@ SOURCES += main.cpp \
     packet.cpp \
     tcpserversimple.cpp \
     chronos.cpp \
-    vbytearray.cpp
+    vbytearray.cpp \
+    ../RControlStation/mainconfigcodec.cpp \
+    posestreamserver.cpp
 
 HEADERS += \
     packetinterface.h \
@@ -40,5 +46,9 @@ HEADERS += \
     packet.h \
     tcpserversimple.h \
     chronos.h \
-    vbytearray.h
+    vbytearray.h \
+    ../RControlStation/mainconfigcodec.h \
+    ../RControlStation/mainconfigtypes.h \
+    posestreamserver.h \
+    ../../Embedded/RC_Controller/main_config_schema.h
 
@@ -22,9 +22,11 @@
 #include <sys/time.h>
 #include <sys/reboot.h>
 #include <unistd.h>
+#include <time.h>
 #include <QEventLoop>
 #include <QCoreApplication>
 #include "rtcm3_simple.h"
+#include "utility.h"
 
 namespace {
 void rtcm_rx(uint8_t *data, int len, int type) {
@@ -53,7 +55,9 @@ CarClient::CarClient(QObject *parent) : QObject(parent)
     mUblox = new Ublox(this);
     mTcpSocket = new QTcpSocket(this);
     mTcpServer = new TcpServerSimple(this);
+    mPoseServer = new PoseStreamServer(this);
     mCarId = 255;
+    mSerialRxTimeUs = 0;
     mReconnectTimer = new QTimer(this);
     mReconnectTimer->start(2000);
     mTcpConnected = false;
@@ -168,6 +172,11 @@ void CarClient::startUbxServer(int port)
     mUbxBroadcaster->startTcpServer(port);
 }
 
+void CarClient::startPoseServer(int port)
+{
+    mPoseServer->startServer(mPacketInterface, port);
+}
+
 void CarClient::connectNmea(QString server, int port)
 {
     mTcpSocket->close();
@@ -330,8 +339,12 @@ quint8 CarClient::carId()
 
 void CarClient::serialDataAvailable()
 {
-    while (mSerialPort->bytesAvailable() > 0) {
-        QByteArray data = mSerialPort->readAll();
+    QByteArray data;
+    qint64 timestampNs;
+
+    while (mSerialPort->readChunk(data, &timestampNs)) {
+        // Packets completed by this chunk were received when it was read
+        mSerialRxTimeUs = (quint32)(timestampNs / 1000);
         mPacketInterface->processData(data);
     }
 }
@@ -463,6 +476,7 @@ void CarClient::readPendingDatagrams()
         mUdpSocket->readDatagram(datagram.data(), datagram.size(),
                                 &mHostAddress, &senderPort);
 
+        appendTraceHops(datagram, TRACE_HOP_CLIENT_RX, TRACE_HOP_CLIENT_TX, traceTimeUs());
         mPacketInterface->sendPacket(datagram);
     }
 }
@@ -470,6 +484,25 @@ void CarClient::readPendingDatagrams()
 void CarClient::carPacketRx(quint8 id, CMD_PACKET cmd, const QByteArray &data)
 {
     mCarId = id;
+    mPoseServer->setCarId(id);
+
+    if (cmd == CMD_TRACE) {
+        QByteArray trace = data;
+        appendTraceHops(trace, TRACE_HOP_CLIENT_RX_RESP,
+                        TRACE_HOP_CLIENT_TX_RESP, mSerialRxTimeUs);
+
+        if (QString::compare(mHostAddress.toString(), "0.0.0.0") != 0) {
+            mUdpSocket->writeDatagram(trace, mHostAddress, mUdpPort);
+        }
+
+        mTcpServer->packet()->sendPacket(trace);
+        return;
+    }
+
+    // Requested by the pose stream, the station did not ask for it
+    if (cmd == CMD_POSE) {
+        return;
+    }
 
     if (QString::compare(mHostAddress.toString(), "0.0.0.0") != 0) {
         if (cmd != CMD_LOG_LINE_USB) {
@@ -565,6 +598,7 @@ void CarClient::rxRawx(ubx_rxm_rawx rawx)
 
 void CarClient::tcpRx(QByteArray &data)
 {
+    appendTraceHops(data, TRACE_HOP_CLIENT_RX, TRACE_HOP_CLIENT_TX, traceTimeUs());
     mPacketInterface->sendPacket(data);
 }
 
@@ -629,3 +663,49 @@ bool CarClient::waitProcess(QProcess &process, int timeoutMs)
 
     return !killed;
 }
+
+/**
+ * @brief CarClient::traceTimeUs
+ * Monotonic time used for latency tracing. Only differences are meaningful.
+ *
+ * @return
+ * The time in microseconds, wrapping at 32 bits.
+ */
+quint32 CarClient::traceTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (quint32)((quint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief CarClient::appendTraceHops
+ * Append the receive and transmit timestamps of this hop if the packet is
+ * a CMD_TRACE packet. Other packets are left untouched.
+ *
+ * @param data
+ * The packet, starting with the id and the command.
+ *
+ * @param rx
+ * Hop id for the receive timestamp.
+ *
+ * @param tx
+ * Hop id for the transmit timestamp.
+ *
+ * @param rxTime
+ * The time the packet was received.
+ */
+void CarClient::appendTraceHops(QByteArray &data, TRACE_HOP rx, TRACE_HOP tx, quint32 rxTime)
+{
+    if (data.size() < 2 || (quint8)data.at(1) != CMD_TRACE) {
+        return;
+    }
+
+    uint8_t buffer[10];
+    int32_t ind = 0;
+    buffer[ind++] = rx;
+    utility::buffer_append_uint32(buffer, rxTime, &ind);
+    buffer[ind++] = tx;
+    utility::buffer_append_uint32(buffer, traceTimeUs(), &ind);
+    data.append((const char*)buffer, ind);
+}
@@ -30,6 +30,7 @@
 #include "serialport.h"
 #include "ublox.h"
 #include "tcpserversimple.h"
+#include "posestreamserver.h"
 
 class CarClient : public QObject
 {
@@ -56,6 +57,7 @@ public:
     void connectSerialRtcm(QString port, int baudrate = 9600);
     void startRtcmServer(int port = 8200);
     void startUbxServer(int port = 8210);
+    void startPoseServer(int port = 2949);
     void connectNmea(QString server, int port = 2948);
     void startUdpServer(int port = 8300);
     bool startTcpServer(int port = 8300);
@@ -98,6 +100,7 @@ private:
     QSerialPort *mSerialPortRtcm;
     QTcpSocket *mTcpSocket;
     TcpServerSimple *mTcpServer;
+    PoseStreamServer *mPoseServer;
     int mCarId;
     QTimer *mReconnectTimer;
     QTimer *mLogFlushTimer;
@@ -109,11 +112,14 @@ private:
     QFile mLog;
     Ublox *mUblox;
     bool mRtklibRunning;
+    quint32 mSerialRxTimeUs;
 
     void rebootSystem(bool powerOff = false);
     bool setUnixTime(qint64 t);
     void printTerminal(QString str);
     bool waitProcess(QProcess &process, int timeoutMs = 300000);
+    quint32 traceTimeUs();
+    void appendTraceHops(QByteArray &data, TRACE_HOP rx, TRACE_HOP tx, quint32 rxTime);
 
 };
 
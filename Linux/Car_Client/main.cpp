@@ -32,6 +32,7 @@ void showHelp()
     qDebug() << "-l, --log : Log to file, e.g. /tmp/logfile.bin (TODO!)";
     qDebug() << "--tcprtcmport : TCP server port for RTCM data";
     qDebug() << "--tcpubxport : TCP server port for UBX data";
+    qDebug() << "--tcpposeport : TCP server port for the NMEA/binary pose stream";
     qDebug() << "--tcpnmeasrv : NMEA server address";
     qDebug() << "--tcpnmeaport : NMEA server port";
     qDebug() << "--useudp : Use UDP server";
@@ -63,6 +64,7 @@ int main(int argc, char *argv[])
     int baudrate = 115200;
     int tcpRtcmPort = 8200;
     int tcpUbxPort = 8210;
+    int tcpPosePort = 2949;
     QString tcpNmeaServer = "127.0.0.1";
     int tcpNmeaPort = 2948;
     bool useUdp = false;
@@ -144,6 +146,15 @@ int main(int argc, char *argv[])
             }
         }
 
+        if (str == "--tcpposeport") {
+            if ((i - 1) < args.size()) {
+                i++;
+                bool ok;
+                tcpPosePort = args.at(i).toInt(&ok);
+                found = ok;
+            }
+        }
+
         if (str == "--tcpnmeasrv") {
             if ((i - 1) < args.size()) {
                 i++;
@@ -247,6 +258,7 @@ int main(int argc, char *argv[])
     car.connectSerial(ttyPort, baudrate);
     car.startRtcmServer(tcpRtcmPort);
     car.startUbxServer(tcpUbxPort);
+    car.startPoseServer(tcpPosePort);
     car.restartRtklib();
 
     if (car.isRtklibRunning()) {
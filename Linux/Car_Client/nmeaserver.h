@@ -56,12 +56,16 @@ public:
     bool sendNmeaZda(quint16 wn, double tow);
     bool sendNmeaRmc(nmea_rmc_info_t &nmea);
     bool sendNmeaRaw(QString msg);
+    bool sendNmeaBytes(const QByteArray &nmea_bytes);
     bool logToFile(QString file);
     void logStop();
     bool connectClientTcp(QString server, int port = 80);
     bool isClientTcpConnected();
     void disconnectClientTcp();
 
+    static QByteArray ggaSentence(const nmea_gga_info_t &nmea);
+    static QByteArray zdaSentence(quint16 wn, double tow);
+    static QByteArray rmcSentence(const nmea_rmc_info_t &nmea);
     static int decodeNmeaGGA(QByteArray data, nmea_gga_info_t &gga);
 
 signals:
@@ -68,6 +68,7 @@ signals:
     void packetReceived(quint8 id, CMD_PACKET cmd, const QByteArray &data);
     void printReceived(quint8 id, QString str);
     void stateReceived(quint8 id, CAR_STATE state);
+    void poseReceived(quint8 id, CAR_POSE pose);
     void mrStateReceived(quint8 id, MULTIROTOR_STATE state);
     void vescFwdReceived(quint8 id, QByteArray data);
     void ackReceived(quint8 id, CMD_PACKET cmd, QString msg);
@@ -88,6 +89,7 @@ public slots:
     void timerSlot();
     void readPendingDatagrams();
     void getState(quint8 id);
+    void setPoseStream(quint8 id, int rateHz);
     void getMrState(quint8 id);
     void sendTerminalCmd(quint8 id, QString cmd);
     void forwardVesc(quint8 id, QByteArray data);
@@ -0,0 +1,332 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "posestreamserver.h"
+#include <QDebug>
+#include <QDateTime>
+#include <cmath>
+#include "nmeaserver.h"
+#include "packet.h"
+#include "vbytearray.h"
+#include "utility.h"
+
+PoseStreamServer::PoseStreamServer(QObject *parent) : QObject(parent)
+{
+    mTcpServer = new QTcpServer(this);
+    mPacket = 0;
+    mStreamTimer = new QTimer(this);
+    mStreamTimer->setInterval(mStreamRenewMs);
+    mCarId = ID_ALL;
+    mStreamRateHz = 0;
+    mEnuRefSet = false;
+    mEnuRef[0] = 0.0;
+    mEnuRef[1] = 0.0;
+    mEnuRef[2] = 0.0;
+    mEnuRefReqMs = -mEnuRefRetryMs;
+    mClock.start();
+
+    connect(mTcpServer, SIGNAL(newConnection()), this, SLOT(newTcpConnection()));
+    connect(mStreamTimer, SIGNAL(timeout()), this, SLOT(streamTimerSlot()));
+}
+
+bool PoseStreamServer::startServer(PacketInterface *packet, int port)
+{
+    if (!mTcpServer->listen(QHostAddress::Any, port)) {
+        qWarning() << "Unable to start pose stream server:" << mTcpServer->errorString();
+        return false;
+    }
+
+    if (mPacket != packet) {
+        if (mPacket) {
+            disconnect(mPacket, 0, this, 0);
+        }
+
+        mPacket = packet;
+        connect(mPacket, SIGNAL(poseReceived(quint8,CAR_POSE)),
+                this, SLOT(poseReceived(quint8,CAR_POSE)));
+        connect(mPacket, SIGNAL(enuRefReceived(quint8,double,double,double)),
+                this, SLOT(enuRefReceived(quint8,double,double,double)));
+    }
+
+    return true;
+}
+
+void PoseStreamServer::stopServer()
+{
+    mTcpServer->close();
+
+    for (pose_client_t &c: mClients) {
+        c.socket->deleteLater();
+    }
+
+    mClients.clear();
+    updateStreamRate();
+}
+
+void PoseStreamServer::setCarId(quint8 id)
+{
+    if (id != mCarId) {
+        mCarId = id;
+        mEnuRefSet = false;
+    }
+}
+
+void PoseStreamServer::newTcpConnection()
+{
+    pose_client_t c;
+    c.socket = mTcpServer->nextPendingConnection();
+    c.rateHz = mDefaultRateHz;
+    c.format = POSE_FORMAT_NMEA;
+    c.lastSentMs = 0;
+
+    connect(c.socket, SIGNAL(readyRead()), this, SLOT(clientDataAvailable()));
+
+    mClients.append(c);
+    qDebug() << "Pose stream connection accepted:" << c.socket->peerAddress();
+    updateStreamRate();
+}
+
+void PoseStreamServer::clientDataAvailable()
+{
+    for (pose_client_t &c: mClients) {
+        if (!c.socket->bytesAvailable()) {
+            continue;
+        }
+
+        c.rxBuffer.append(c.socket->readAll());
+
+        int ind;
+        while ((ind = c.rxBuffer.indexOf('\n')) >= 0) {
+            processClientLine(c, c.rxBuffer.left(ind).trimmed());
+            c.rxBuffer.remove(0, ind + 1);
+        }
+
+        // Nothing sensible is this long
+        if (c.rxBuffer.size() > 100) {
+            c.rxBuffer.clear();
+        }
+    }
+
+    updateStreamRate();
+}
+
+void PoseStreamServer::streamTimerSlot()
+{
+    removeClosedClients();
+
+    if (!mPacket || mClients.isEmpty()) {
+        return;
+    }
+
+    qint64 now = mClock.elapsed();
+
+    if (!mEnuRefSet && (now - mEnuRefReqMs) >= mEnuRefRetryMs) {
+        mPacket->getEnuRef(mCarId);
+        mEnuRefReqMs = now;
+    }
+
+    // Renew the stream, the car stops it after a few seconds otherwise
+    mPacket->setPoseStream(mCarId, mStreamRateHz);
+}
+
+void PoseStreamServer::poseReceived(quint8 id, CAR_POSE pose)
+{
+    if (mCarId != ID_ALL && id != mCarId) {
+        return;
+    }
+
+    if (!mEnuRefSet || mClients.isEmpty()) {
+        return;
+    }
+
+    double xyz[3] = {pose.px, pose.py, 0.0};
+    double llh[3];
+    utility::enuToLlh(mEnuRef, xyz, llh);
+
+    qint64 now = mClock.elapsed();
+    QByteArray nmea, binary;
+
+    for (pose_client_t &c: mClients) {
+        if ((now - c.lastSentMs) < (1000 / c.rateHz - mSubMinIntervalMs)) {
+            continue;
+        }
+
+        c.lastSentMs = now;
+
+        // Each format is built at most once per pose
+        if (c.format == POSE_FORMAT_BINARY) {
+            if (binary.isEmpty()) {
+                binary = binaryFrame(pose, llh);
+            }
+            c.socket->write(binary);
+        } else {
+            if (nmea.isEmpty()) {
+                nmea = nmeaFrame(pose, llh);
+            }
+            c.socket->write(nmea);
+        }
+    }
+}
+
+void PoseStreamServer::enuRefReceived(quint8 id, double lat, double lon, double height)
+{
+    if (mCarId != ID_ALL && id != mCarId) {
+        return;
+    }
+
+    mEnuRef[0] = lat;
+    mEnuRef[1] = lon;
+    mEnuRef[2] = height;
+    mEnuRefSet = true;
+}
+
+void PoseStreamServer::processClientLine(pose_client_t &client, const QByteArray &line)
+{
+    QList<QByteArray> tokens = line.toUpper().split(' ');
+
+    if (tokens.size() != 2) {
+        return;
+    }
+
+    if (tokens.at(0) == "RATE") {
+        bool ok;
+        int rate = tokens.at(1).toInt(&ok);
+        if (ok) {
+            client.rateHz = qBound(1, rate, (int)mMaxRateHz);
+        }
+    } else if (tokens.at(0) == "FORMAT") {
+        if (tokens.at(1) == "NMEA") {
+            client.format = POSE_FORMAT_NMEA;
+        } else if (tokens.at(1) == "BINARY") {
+            client.format = POSE_FORMAT_BINARY;
+        }
+    }
+}
+
+void PoseStreamServer::removeClosedClients()
+{
+    bool removed = false;
+
+    QMutableListIterator<pose_client_t> itr(mClients);
+    while (itr.hasNext()) {
+        pose_client_t &c = itr.next();
+
+        if (c.socket->state() != QAbstractSocket::ConnectedState) {
+            c.socket->deleteLater();
+            itr.remove();
+            removed = true;
+        }
+    }
+
+    if (removed) {
+        updateStreamRate();
+    }
+}
+
+void PoseStreamServer::updateStreamRate()
+{
+    int rate = 0;
+    for (const pose_client_t &c: mClients) {
+        rate = qMax(rate, c.rateHz);
+    }
+
+    if (rate == mStreamRateHz) {
+        return;
+    }
+
+    mStreamRateHz = rate;
+
+    if (mPacket) {
+        mPacket->setPoseStream(mCarId, mStreamRateHz);
+    }
+
+    if (rate == 0) {
+        mStreamTimer->stop();
+    } else if (!mStreamTimer->isActive()) {
+        mStreamTimer->start();
+    }
+}
+
+QByteArray PoseStreamServer::nmeaFrame(const CAR_POSE &pose, const double *llh)
+{
+    // The car only knows the time of day, so the date comes from the system
+    // clock. Around midnight the two can be on different days.
+    QDateTime now = QDateTime::currentDateTimeUtc();
+    qint64 day = now.date().toJulianDay() - 2440588;
+    qint64 msToday = pose.ms_today;
+    qint64 msSys = now.time().msecsSinceStartOfDay();
+
+    if (msToday < 0) {
+        msToday = msSys;
+    } else if ((msToday - msSys) > 43200000) {
+        day--;
+    } else if ((msSys - msToday) > 43200000) {
+        day++;
+    }
+
+    qint64 gpsDay = day - 3657;
+    double tow = (double)(gpsDay % 7) * 86400.0 + (double)msToday / 1000.0;
+    quint16 wn = gpsDay / 7;
+
+    NmeaServer::nmea_gga_info_t gga;
+    gga.lat = llh[0];
+    gga.lon = llh[1];
+    gga.height = llh[2];
+    gga.t_tow = tow;
+    gga.n_sat = 0;
+    gga.fix_type = 1;
+    gga.h_dop = 0.0;
+    gga.diff_age = -1.0;
+
+    // px is east and py is north. Yaw is the heading from east, clockwise.
+    double yawRad = pose.yaw * M_PI / 180.0;
+    NmeaServer::nmea_rmc_info_t rmc;
+    rmc.lat = llh[0];
+    rmc.lon = llh[1];
+    rmc.t_tow = tow;
+    rmc.t_wn = wn;
+    rmc.vel_x = -pose.speed * sin(yawRad);
+    rmc.vel_y = pose.speed * cos(yawRad);
+    rmc.vel_z = 0.0;
+
+    return NmeaServer::ggaSentence(gga) + NmeaServer::rmcSentence(rmc);
+}
+
+QByteArray PoseStreamServer::binaryFrame(const CAR_POSE &pose, const double *llh)
+{
+    VByteArray payload;
+    payload.vbAppendInt32(pose.ms_today);
+    payload.vbAppendDouble32(llh[0], 1e7);
+    payload.vbAppendDouble32(llh[1], 1e7);
+    payload.vbAppendDouble32(llh[2], 1e3);
+    payload.vbAppendDouble32(pose.speed, 1e3);
+    payload.vbAppendDouble32(pose.yaw, 1e4);
+    payload.vbAppendDouble32(pose.roll, 1e4);
+    payload.vbAppendDouble32(pose.pitch, 1e4);
+
+    unsigned short crc = Packet::crc16((const unsigned char*)payload.constData(),
+                                       payload.size());
+
+    QByteArray frame;
+    frame.append((char)2);
+    frame.append((char)payload.size());
+    frame.append(payload);
+    frame.append((char)(crc >> 8));
+    frame.append((char)(crc & 0xFF));
+    frame.append((char)3);
+    return frame;
+}
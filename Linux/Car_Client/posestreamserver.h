@@ -0,0 +1,101 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef POSESTREAMSERVER_H
+#define POSESTREAMSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QList>
+#include <QElapsedTimer>
+#include "packetinterface.h"
+
+// Streams the fused pose of the car to TCP clients at up to 50 Hz, as NMEA
+// GGA + RMC or as binary frames. Each client selects its own rate and format
+// by sending text lines:
+//
+// RATE <hz>        1 to 50, default 10
+// FORMAT NMEA      default
+// FORMAT BINARY
+//
+// The binary frames use the same framing as Packet (2, len, payload, crc16, 3)
+// and the payload is, big endian:
+//
+// int32 ms_today, int32 lat * 1e7, int32 lon * 1e7, int32 height * 1e3,
+// int32 speed * 1e3, int32 yaw * 1e4, int32 roll * 1e4, int32 pitch * 1e4
+//
+// The car streams CMD_POSE at the highest rate any client wants. The stream
+// is renewed every second while there are clients, and the car stops it by
+// itself if this program goes away.
+class PoseStreamServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PoseStreamServer(QObject *parent = 0);
+    bool startServer(PacketInterface *packet, int port = 2949);
+    void stopServer();
+    void setCarId(quint8 id);
+
+private slots:
+    void newTcpConnection();
+    void clientDataAvailable();
+    void streamTimerSlot();
+    void poseReceived(quint8 id, CAR_POSE pose);
+    void enuRefReceived(quint8 id, double lat, double lon, double height);
+
+private:
+    typedef enum {
+        POSE_FORMAT_NMEA = 0,
+        POSE_FORMAT_BINARY
+    } POSE_FORMAT;
+
+    typedef struct {
+        QTcpSocket *socket;
+        QByteArray rxBuffer;
+        int rateHz;
+        POSE_FORMAT format;
+        qint64 lastSentMs;
+    } pose_client_t;
+
+    QTcpServer *mTcpServer;
+    PacketInterface *mPacket;
+    QList<pose_client_t> mClients;
+    QTimer *mStreamTimer;
+    QElapsedTimer mClock;
+    quint8 mCarId;
+    int mStreamRateHz;
+    bool mEnuRefSet;
+    double mEnuRef[3];
+    qint64 mEnuRefReqMs;
+
+    static const int mMaxRateHz = 50;
+    static const int mDefaultRateHz = 10;
+    static const int mStreamRenewMs = 1000;
+    static const int mSubMinIntervalMs = 2;
+    static const int mEnuRefRetryMs = 2000;
+
+    void processClientLine(pose_client_t &client, const QByteArray &line);
+    void removeClosedClients();
+    void updateStreamRate();
+    QByteArray nmeaFrame(const CAR_POSE &pose, const double *llh);
+    QByteArray binaryFrame(const CAR_POSE &pose, const double *llh);
+
+};
+
+#endif // POSESTREAMSERVER_H
@@ -28,6 +28,7 @@
 #include <linux/serial.h>
 #include <sys/ioctl.h>
 #include <iostream>
+#include <cstring>
 
 #include "serialport.h"
 
@@ -41,11 +42,14 @@ SerialPort::SerialPort(QObject *parent) :
     mSettings.stopBits = STOP_1;
     mSettings.baudrate = 115200;
 
-    mBufferSize = 32768;
-    mReadBuffer = new char[mBufferSize];
-    mBufferRead = 0;
-    mBufferWrite = 0;
+    mChunks = new Chunk[mChunkNum];
+    mChunkWrite = 0;
+    mChunkRead = 0;
+    mChunkReadOffset = 0;
+    mNotifyPending = 0;
+    mDroppedBytes = 0;
 
+    mCaptureActive = 0;
     mCaptureBytes = 0;
     mCaptureBuffer = 0;
     mCaptureWrite = 0;
@@ -54,7 +58,7 @@ SerialPort::SerialPort(QObject *parent) :
 SerialPort::~SerialPort()
 {
     closePort();
-    delete mReadBuffer;
+    delete[] mChunks;
     //std::cout << "SerialPort destructor called";
 }
 
@@ -145,6 +149,11 @@ int SerialPort::openPort(
         return -7;
     }
 
+    mChunkWrite.storeRelease(0);
+    mChunkRead.storeRelease(0);
+    mChunkReadOffset = 0;
+    mNotifyPending.storeRelease(0);
+
     mAbort = false;
     start(LowPriority);
     return 0;
@@ -389,29 +398,50 @@ bool SerialPort::setParity(SerialParity parity)
     return true;
 }
 
-bool SerialPort::readByte(char &byte)
+/**
+ * @brief SerialPort::readChunk
+ * Read the next chunk of received data, as it was returned by one read()
+ * in the read thread. A new serial_data_available signal is emitted for
+ * data that arrives after this call.
+ *
+ * @param data
+ * The data in the chunk.
+ *
+ * @param timestampNs
+ * If not null, the CLOCK_MONOTONIC time in nanoseconds when the chunk was
+ * read is stored here.
+ *
+ * @return
+ * True if a chunk was read, false if there was no data.
+ */
+bool SerialPort::readChunk(QByteArray &data, qint64 *timestampNs)
 {
     if (!mIsOpen) {
         qCritical() << "Serial port not open.";
         return false;
     }
 
-    {
-        QMutexLocker locker(&mMutex);
-        if (mBufferRead == mBufferWrite) {
-            return false;
-        }
+    clearNotifyPending();
 
-        char tmp = mReadBuffer[mBufferRead];
-        mBufferRead++;
+    if (!chunkAvailable()) {
+        return false;
+    }
 
-        if (mBufferRead == mBufferSize) {
-            mBufferRead = 0;
-        }
+    const Chunk &c = mChunks[mChunkRead.loadAcquire()];
+    int len = c.len - mChunkReadOffset;
+    data = QByteArray(c.data + mChunkReadOffset, len);
 
-        byte = tmp;
-        return true;
+    if (timestampNs) {
+        *timestampNs = c.timestampNs;
     }
+
+    consumeChunkBytes(len);
+    return true;
+}
+
+bool SerialPort::readByte(char &byte)
+{
+    return readBytes(&byte, 1) == 1;
 }
 
 int SerialPort::readBytes(char* buffer, int bytes)
@@ -421,22 +451,18 @@ int SerialPort::readBytes(char* buffer, int bytes)
         return -1;
     }
 
-    {
-        QMutexLocker locker(&mMutex);
-        for (int i = 0;i < bytes;i++) {
-            if (mBufferRead == mBufferWrite) {
-                return i;
-            }
+    clearNotifyPending();
 
-            buffer[i] = mReadBuffer[mBufferRead];
-            mBufferRead++;
-            if (mBufferRead == mBufferSize) {
-                mBufferRead = 0;
-            }
-        }
+    int read = 0;
+    while (read < bytes && chunkAvailable()) {
+        const Chunk &c = mChunks[mChunkRead.loadAcquire()];
+        int len = qMin(c.len - mChunkReadOffset, bytes - read);
+        memcpy(buffer + read, c.data + mChunkReadOffset, len);
+        read += len;
+        consumeChunkBytes(len);
     }
 
-    return bytes;
+    return read;
 }
 
 int SerialPort::readString(QString& string, int length)
@@ -448,19 +474,14 @@ int SerialPort::readString(QString& string, int length)
 
     string = "";
 
-    QMutexLocker locker(&mMutex);
     for (int i = 0;i < length;i++) {
-        if (mBufferRead == mBufferWrite) {
+        char c;
+        if (!readByte(c)) {
             return i;
         }
 
-        if ('\0' != mReadBuffer[mBufferRead]) {
-            string.append(mReadBuffer[mBufferRead]);
-        }
-
-        mBufferRead++;
-        if (mBufferRead == mBufferSize) {
-            mBufferRead = 0;
+        if ('\0' != c) {
+            string.append(c);
         }
     }
 
@@ -474,13 +495,11 @@ QByteArray SerialPort::readAll()
         return 0;
     }
 
-    int len = bytesAvailable();
-    char data[len];
-
-    readBytes(data, len);
     QByteArray bytes;
-    bytes.clear();
-    bytes.append(data, len);
+    QByteArray chunk;
+    while (readChunk(chunk)) {
+        bytes.append(chunk);
+    }
 
     return bytes;
 }
@@ -558,14 +577,23 @@ int SerialPort::bytesAvailable()
         return -1;
     }
 
-    {
-        QMutexLocker locker(&mMutex);
-        if (mBufferRead <= mBufferWrite) {
-            return mBufferWrite - mBufferRead;
-        } else {
-            return (mBufferSize - 1) - mBufferRead + mBufferWrite;
-        }
+    int bytes = -mChunkReadOffset;
+    int write = mChunkWrite.loadAcquire();
+    for (int i = mChunkRead.loadAcquire();i != write;i = (i + 1) % mChunkNum) {
+        bytes += mChunks[i].len;
     }
+
+    return qMax(bytes, 0);
+}
+
+/**
+ * @brief SerialPort::droppedBytes
+ * The number of received bytes that were dropped because the chunk ring was
+ * full since the port was created.
+ */
+qint64 SerialPort::droppedBytes()
+{
+    return mDroppedBytes.loadAcquire();
 }
 
 bool SerialPort::writeString(const QString& string, bool block)
@@ -589,6 +617,7 @@ int SerialPort::captureBytes(char *buffer, int num, int timeoutMs, const QString
         mCaptureBuffer = buffer;
         mCaptureBytes = num;
         mCaptureWrite = 0;
+        mCaptureActive.storeRelease(1);
     }
 
     if (preTransmit.length() > 0) {
@@ -604,6 +633,7 @@ int SerialPort::captureBytes(char *buffer, int num, int timeoutMs, const QString
     {
         QMutexLocker locker(&mMutex);
         mCaptureBytes = 0;
+        mCaptureActive.storeRelease(0);
         return mCaptureWrite;
     }
 }
@@ -620,6 +650,7 @@ int SerialPort::captureBytes(char *buffer, int num, int timeoutMs, const char *p
         mCaptureBuffer = buffer;
         mCaptureBytes = num;
         mCaptureWrite = 0;
+        mCaptureActive.storeRelease(1);
     }
 
     if (preTransLen > 0) {
@@ -635,15 +666,17 @@ int SerialPort::captureBytes(char *buffer, int num, int timeoutMs, const char *p
     {
         QMutexLocker locker(&mMutex);
         mCaptureBytes = 0;
+        mCaptureActive.storeRelease(0);
         return mCaptureWrite;
     }
 }
 
 void SerialPort::run()
 {
-    unsigned char buffer[1024];
+    char dropBuffer[sizeof(mChunks[0].data)];
     int res = 0;
     int failed_reads = 0;
+    bool overflow = false;
     fd_set set;
     timespec timeout;
 
@@ -659,32 +692,70 @@ void SerialPort::run()
         } else if(res == 0) {
             // Timeout
         } else {
-            res = read(mFd, buffer, 1024);
-            if (res > 0) {
+            // Drain the port, one chunk per read
+            bool published = false;
+            bool first = true;
+
+            for (;;) {
+                int write = mChunkWrite.loadAcquire();
+                int next = (write + 1) % mChunkNum;
+                bool full = next == mChunkRead.loadAcquire();
+                Chunk &c = mChunks[write];
+                char *dest = full ? dropBuffer : c.data;
+
+                res = read(mFd, dest, sizeof(c.data));
+
+                if (res <= 0) {
+                    break;
+                }
+
                 failed_reads = 0;
+                first = false;
+                int start = 0;
 
-                QMutexLocker locker(&mMutex);
-                for (int i = 0;i < res;i++) {
+                if (mCaptureActive.loadAcquire()) {
+                    QMutexLocker locker(&mMutex);
                     if (mCaptureBytes > 0) {
+                        start = qMin(mCaptureBytes, res);
                         if (mCaptureBuffer != 0) {
-                            mCaptureBuffer[mCaptureWrite] = buffer[i];
-                            mCaptureWrite++;
+                            memcpy(mCaptureBuffer + mCaptureWrite, dest, start);
+                            mCaptureWrite += start;
                         }
-                        mCaptureBytes--;
+                        mCaptureBytes -= start;
                         if (mCaptureBytes == 0) {
                             mCondition.wakeOne();
                         }
-                    } else {
-                        mReadBuffer[mBufferWrite] = buffer[i];
-                        mBufferWrite++;
+                    }
+                }
 
-                        if (mBufferWrite == mBufferSize) {
-                            mBufferWrite = 0;
-                        }
-                        Q_EMIT serial_data_available();
+                if (full) {
+                    mDroppedBytes.fetchAndAddOrdered(res - start);
+                    if (!overflow && res > start) {
+                        qWarning() << "Serial read buffer full, dropping data";
+                        overflow = true;
                     }
+                } else if (res > start) {
+                    c.timestampNs = monotonicNs();
+                    if (start > 0) {
+                        memmove(c.data, c.data + start, res - start);
+                    }
+                    c.len = res - start;
+                    mChunkWrite.storeRelease(next);
+                    published = true;
+                    overflow = false;
                 }
-            } else {
+
+                if (res < (int)sizeof(c.data)) {
+                    break;
+                }
+            }
+
+            // One notification until the consumer reads again
+            if (published && mNotifyPending.testAndSetOrdered(0, 1)) {
+                Q_EMIT serial_data_available();
+            }
+
+            if (first) {
                 if (res < 0) {
                     qCritical().nospace() << "Reading failed. MSG: " << strerror(errno);
                 } else {
@@ -708,3 +779,40 @@ void SerialPort::run()
         }
     }
 }
+
+qint64 SerialPort::monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief SerialPort::clearNotifyPending
+ * Allow the read thread to emit serial_data_available again. This has to be
+ * a full barrier and not only a release store: the ring is checked right
+ * after this, and if that load could be done before the flag is cleared, the
+ * read thread could publish a chunk, see the flag still set and skip the
+ * signal, while the check here sees no new chunk. That chunk would then not
+ * be read until more data arrives.
+ */
+void SerialPort::clearNotifyPending()
+{
+    mNotifyPending.fetchAndStoreOrdered(0);
+}
+
+bool SerialPort::chunkAvailable()
+{
+    return mChunkRead.loadAcquire() != mChunkWrite.loadAcquire();
+}
+
+void SerialPort::consumeChunkBytes(int bytes)
+{
+    int read = mChunkRead.loadAcquire();
+    mChunkReadOffset += bytes;
+
+    if (mChunkReadOffset >= mChunks[read].len) {
+        mChunkReadOffset = 0;
+        mChunkRead.storeRelease((read + 1) % mChunkNum);
+    }
+}
@@ -22,6 +22,9 @@
 #include <QSize>
 #include <QThread>
 #include <QWaitCondition>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QByteArray>
 
 class SerialPort : public QThread
 {
@@ -54,6 +57,7 @@ public:
     bool setParity(SerialParity parity);
     bool setStopBits(SerialStopBits stopBits);
     bool setDataBits(SerialDataBits dataBits);
+    bool readChunk(QByteArray &data, qint64 *timestampNs = 0);
     bool readByte(char& byte);
     int readBytes(char* buffer, int bytes);
     int readString(QString& string, int length);
@@ -63,6 +67,7 @@ public:
     bool writeByte(char byte, bool block = true);
     bool writeString(const QString& string, bool block = true);
     int bytesAvailable();
+    qint64 droppedBytes();
     bool isOpen();
     int captureBytes(char* buffer, int num, int timeoutMs = 0, const QString& preTransmit = "");
     int captureBytes(char* buffer, int num, int timeoutMs = 0, const char* preTransmit = 0, int preTransLen = 0);
@@ -77,6 +82,11 @@ protected:
     void run();
 
 private:
+    static qint64 monotonicNs();
+    void clearNotifyPending();
+    bool chunkAvailable();
+    void consumeChunkBytes(int bytes);
+
     QMutex mMutex;
     QWaitCondition mCondition;
     bool mAbort;
@@ -85,11 +95,24 @@ private:
     SerialSettings mSettings;
     int mFd;
 
-    int mBufferSize;
-    char* mReadBuffer;
-    int mBufferRead;
-    int mBufferWrite;
+    // Received data is published by the read thread in chunks, one chunk
+    // per read(). The chunks are in a single producer, single consumer ring,
+    // so the read functions must only be called from one thread.
+    struct Chunk {
+        qint64 timestampNs;
+        int len;
+        char data[1024];
+    };
+
+    static const int mChunkNum = 64;
+    Chunk *mChunks;
+    QAtomicInt mChunkWrite;
+    QAtomicInt mChunkRead;
+    int mChunkReadOffset;
+    QAtomicInt mNotifyPending;
+    QAtomicInteger<qint64> mDroppedBytes;
 
+    QAtomicInt mCaptureActive;
     int mCaptureBytes;
     char* mCaptureBuffer;
     int mCaptureWrite;
@@ -0,0 +1,12 @@
+#-------------------------------------------------
+#
+# Host tests for Car_Client. Build and run with
+# qmake && make && make check
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += tst_serialport \
+    tst_nmeaserver \
+    tst_posestreamserver
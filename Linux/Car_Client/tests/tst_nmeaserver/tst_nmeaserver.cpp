@@ -0,0 +1,216 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include "nmeaserver.h"
+
+// The sentence builders are compared against the printf based formatting
+// they replaced. The reference uses UTC for the date and wraps the RMC
+// course to 0 - 360, as the builders do.
+namespace {
+const int randomSentences = 200000;
+
+double minutes(double x)
+{
+    return fabs(60.0 * (x - (qint16)x));
+}
+
+QByteArray withChecksum(const char *body)
+{
+    quint8 sum = 0;
+    for (const char *p = body + 1;*p;p++) {
+        sum ^= *p;
+    }
+
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "*%02X\r\n", sum);
+    return QByteArray(body) + suffix;
+}
+
+void utcFromGps(quint16 wn, double tow, struct tm &t)
+{
+    time_t time = 315964800 + (time_t)wn * 7 * 86400 + (time_t)tow;
+    gmtime_r(&time, &t);
+}
+
+QByteArray refGga(const NmeaServer::nmea_gga_info_t &nmea)
+{
+    int t = (int)nmea.t_tow;
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "$GPGGA,%02d%02d%02d.%02d,"
+             "%02d%010.7f,%c,%03d%010.7f,%c,"
+             "%01d,%02d,%.1f,%.2f,M,,M,,",
+             (t / 3600) % 24, (t / 60) % 60, t % 60, (int)(fmod(nmea.t_tow, 1.0) * 100.0),
+             abs((qint16)nmea.lat), minutes(nmea.lat), nmea.lat < 0.0 ? 'S' : 'N',
+             abs((qint16)nmea.lon), minutes(nmea.lon), nmea.lon < 0.0 ? 'W' : 'E',
+             nmea.fix_type, nmea.n_sat, nmea.h_dop, nmea.height);
+    return withChecksum(buf);
+}
+
+QByteArray refZda(quint16 wn, double tow)
+{
+    struct tm t;
+    utcFromGps(wn, tow, t);
+    char buf[100];
+    snprintf(buf, sizeof(buf), "$GPZDA,%02d%02d%02d.%02d,%02d,%02d,%04d,00,00",
+             t.tm_hour, t.tm_min, t.tm_sec, (int)(fmod(tow, 1.0) * 100.0),
+             t.tm_mday, t.tm_mon + 1, t.tm_year + 1900);
+    return withChecksum(buf);
+}
+
+QByteArray refRmc(const NmeaServer::nmea_rmc_info_t &nmea)
+{
+    struct tm t;
+    utcFromGps(nmea.t_wn, nmea.t_tow, t);
+
+    double velocity = sqrt(nmea.vel_x * nmea.vel_x + nmea.vel_y * nmea.vel_y +
+                           nmea.vel_z * nmea.vel_z) * 1.94385;
+    double course = atan2(nmea.vel_y, nmea.vel_x) * (180.0 / M_PI);
+    if (course < 0.0) {
+        course += 360.0;
+    }
+
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "$GPRMC,%02d%02d%02d.%02d,A,"
+             "%02d%010.7f,%c,%03d%010.7f,%c,"
+             "%06.2f,%05.1f,"
+             "%02d%02d%02d,"
+             ",",
+             t.tm_hour, t.tm_min, t.tm_sec, (int)(fmod(nmea.t_tow, 1.0) * 100.0),
+             abs((qint16)nmea.lat), minutes(nmea.lat), nmea.lat < 0.0 ? 'S' : 'N',
+             abs((qint16)nmea.lon), minutes(nmea.lon), nmea.lon < 0.0 ? 'W' : 'E',
+             velocity, course, t.tm_mday, t.tm_mon + 1, (t.tm_year + 1900) % 100);
+    return withChecksum(buf);
+}
+
+double randRange(double min, double max)
+{
+    return min + (max - min) * ((double)qrand() / (double)RAND_MAX);
+}
+
+NmeaServer::nmea_gga_info_t randomGga()
+{
+    NmeaServer::nmea_gga_info_t gga;
+    gga.lat = randRange(-89.9, 89.9);
+    gga.lon = randRange(-179.9, 179.9);
+    gga.height = randRange(-100.0, 5000.0);
+    gga.t_tow = randRange(0.0, 604799.0);
+    gga.n_sat = qrand() % 30;
+    gga.fix_type = qrand() % 6;
+    gga.h_dop = randRange(0.0, 20.0);
+    gga.diff_age = -1.0;
+    return gga;
+}
+}
+
+class TestNmeaServer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void ggaKnown();
+    void ggaRandom();
+    void zdaRandom();
+    void rmcRandom();
+    void benchmarkGga();
+};
+
+void TestNmeaServer::ggaKnown()
+{
+    NmeaServer::nmea_gga_info_t gga;
+    gga.lat = 57.71495867;
+    gga.lon = 12.89134921;
+    gga.height = 219.83;
+    gga.t_tow = 301234.5;
+    gga.n_sat = 12;
+    gga.fix_type = 4;
+    gga.h_dop = 0.8;
+    gga.diff_age = 1.0;
+
+    QCOMPARE(NmeaServer::ggaSentence(gga), refGga(gga));
+    QVERIFY(NmeaServer::ggaSentence(gga).startsWith("$GPGGA,114034.50,5742.8975202,N,"));
+}
+
+void TestNmeaServer::ggaRandom()
+{
+    qsrand(1);
+
+    for (int i = 0;i < randomSentences;i++) {
+        NmeaServer::nmea_gga_info_t gga = randomGga();
+        QByteArray res = NmeaServer::ggaSentence(gga);
+        QByteArray ref = refGga(gga);
+        if (res != ref) {
+            QCOMPARE(res, ref);
+        }
+    }
+}
+
+void TestNmeaServer::zdaRandom()
+{
+    qsrand(2);
+
+    for (int i = 0;i < randomSentences;i++) {
+        quint16 wn = 1800 + qrand() % 600;
+        double tow = randRange(0.0, 604799.0);
+        QByteArray res = NmeaServer::zdaSentence(wn, tow);
+        QByteArray ref = refZda(wn, tow);
+        if (res != ref) {
+            QCOMPARE(res, ref);
+        }
+    }
+}
+
+void TestNmeaServer::rmcRandom()
+{
+    qsrand(3);
+
+    for (int i = 0;i < randomSentences;i++) {
+        NmeaServer::nmea_rmc_info_t rmc;
+        rmc.lat = randRange(-89.9, 89.9);
+        rmc.lon = randRange(-179.9, 179.9);
+        rmc.t_tow = randRange(0.0, 604799.0);
+        rmc.t_wn = 1800 + qrand() % 600;
+        rmc.vel_x = randRange(-30.0, 30.0);
+        rmc.vel_y = randRange(-30.0, 30.0);
+        rmc.vel_z = randRange(-2.0, 2.0);
+
+        QByteArray res = NmeaServer::rmcSentence(rmc);
+        QByteArray ref = refRmc(rmc);
+        if (res != ref) {
+            QCOMPARE(res, ref);
+        }
+    }
+}
+
+void TestNmeaServer::benchmarkGga()
+{
+    qsrand(4);
+    NmeaServer::nmea_gga_info_t gga = randomGga();
+
+    QBENCHMARK {
+        NmeaServer::ggaSentence(gga);
+    }
+}
+
+QTEST_GUILESS_MAIN(TestNmeaServer)
+
+#include "tst_nmeaserver.moc"
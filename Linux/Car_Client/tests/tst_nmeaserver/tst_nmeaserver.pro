@@ -0,0 +1,17 @@
+QT       += core network testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_nmeaserver
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_nmeaserver.cpp \
+    ../../nmeaserver.cpp \
+    ../../tcpbroadcast.cpp
+
+HEADERS += ../../nmeaserver.h \
+    ../../tcpbroadcast.h
@@ -0,0 +1,315 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QTcpSocket>
+#include <cmath>
+#include "posestreamserver.h"
+#include "packetinterface.h"
+#include "packet.h"
+#include "utility.h"
+
+// The car side is played by feeding packets to PacketInterface::processData,
+// and the requests to the car are taken from dataToSend.
+namespace {
+const int testPort = 52949;
+const quint8 carId = 1;
+const double enuRef[3] = {57.71495867, 12.89134921, 219.0};
+
+QByteArray framed(const uint8_t *payload, int len)
+{
+    unsigned short crc = Packet::crc16(payload, len);
+
+    QByteArray res;
+    res.append((char)2);
+    res.append((char)len);
+    res.append((const char*)payload, len);
+    res.append((char)(crc >> 8));
+    res.append((char)(crc & 0xFF));
+    res.append((char)3);
+    return res;
+}
+
+// Same encoding as CMD_POSE in the firmware
+QByteArray posePacket(qint32 msToday, double px, double py, double speed,
+                      double yaw, double roll, double pitch)
+{
+    uint8_t buffer[64];
+    int32_t ind = 0;
+    buffer[ind++] = carId;
+    buffer[ind++] = CMD_POSE;
+    utility::buffer_append_int32(buffer, msToday, &ind);
+    utility::buffer_append_double32(buffer, px, 1e4, &ind);
+    utility::buffer_append_double32(buffer, py, 1e4, &ind);
+    utility::buffer_append_double16(buffer, speed, 1e3, &ind);
+    utility::buffer_append_double16(buffer, yaw, 1e2, &ind);
+    utility::buffer_append_double16(buffer, roll, 1e2, &ind);
+    utility::buffer_append_double16(buffer, pitch, 1e2, &ind);
+    return framed(buffer, ind);
+}
+
+QByteArray enuRefPacket()
+{
+    uint8_t buffer[64];
+    int32_t ind = 0;
+    buffer[ind++] = carId;
+    buffer[ind++] = CMD_GET_ENU_REF;
+    utility::buffer_append_double64(buffer, enuRef[0], 1e16, &ind);
+    utility::buffer_append_double64(buffer, enuRef[1], 1e16, &ind);
+    utility::buffer_append_double32(buffer, enuRef[2], 1e3, &ind);
+    return framed(buffer, ind);
+}
+
+double nmeaDegrees(const QByteArray &field)
+{
+    double v = field.toDouble();
+    double deg = floor(v / 100.0);
+    return deg + (v - deg * 100.0) / 60.0;
+}
+}
+
+class TestPoseStreamServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestPoseStreamServer();
+
+private slots:
+    void init();
+    void cleanup();
+    void poseFrameSize();
+    void binaryStream();
+    void nmeaStream();
+    void streamRate();
+
+public slots:
+    void packetSent(QByteArray &data);
+
+private:
+    PacketInterface *mPacket;
+    PoseStreamServer *mServer;
+    QList<QByteArray> mSent;
+
+    void feed(QByteArray data);
+    int lastStreamRate();
+    int enuRefRequests();
+
+};
+
+TestPoseStreamServer::TestPoseStreamServer()
+{
+    mPacket = 0;
+    mServer = 0;
+}
+
+void TestPoseStreamServer::init()
+{
+    mSent.clear();
+    mPacket = new PacketInterface(this);
+    mServer = new PoseStreamServer(this);
+    mServer->setCarId(carId);
+
+    connect(mPacket, SIGNAL(dataToSend(QByteArray&)),
+            this, SLOT(packetSent(QByteArray&)));
+
+    QVERIFY(mServer->startServer(mPacket, testPort));
+}
+
+void TestPoseStreamServer::cleanup()
+{
+    delete mServer;
+    delete mPacket;
+    mServer = 0;
+    mPacket = 0;
+}
+
+/*
+ * CMD_POSE is 20 bytes of data, which with the id, the command and the
+ * framing is 27 bytes. At 50 Hz that is 1350 B/s, compared to about 100
+ * bytes per CMD_GET_STATE reply that was polled before.
+ */
+void TestPoseStreamServer::poseFrameSize()
+{
+    QByteArray frame = posePacket(0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+    QCOMPARE(frame.size(), 27);
+    qDebug() << "CMD_POSE:" << frame.size() << "bytes," << frame.size() * 50 << "B/s at 50 Hz";
+}
+
+/*
+ * A client asking for binary frames at 50 Hz. Nothing is sent before the ENU
+ * reference is known, and then every pose arrives with the decoded values.
+ */
+void TestPoseStreamServer::binaryStream()
+{
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, testPort);
+    QVERIFY(client.waitForConnected(1000));
+    client.write("RATE 50\nFORMAT BINARY\n");
+    QTRY_COMPARE(lastStreamRate(), 50);
+
+    feed(posePacket(0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
+    QTest::qWait(50);
+    QCOMPARE(client.bytesAvailable(), (qint64)0);
+
+    // The reference is requested by the renew timer
+    QTRY_VERIFY(enuRefRequests() > 0);
+    feed(enuRefPacket());
+
+    const int poses = 50;
+    const int frameLen = 38;
+    for (int i = 0;i < poses;i++) {
+        feed(posePacket(36000000 + i * 20, 10.0 + 0.1 * i, -5.0, 2.0, 45.5, 1.25, -2.5));
+        QTest::qWait(20);
+    }
+
+    QTRY_COMPARE(client.bytesAvailable(), (qint64)(poses * frameLen));
+    QByteArray data = client.readAll();
+
+    for (int i = 0;i < poses;i++) {
+        const uint8_t *f = (const uint8_t*)data.constData() + i * frameLen;
+        QCOMPARE((int)f[0], 2);
+        QCOMPARE((int)f[1], 32);
+        QCOMPARE((int)f[frameLen - 1], 3);
+        QCOMPARE(Packet::crc16(f + 2, 32), (unsigned short)(f[34] << 8 | f[35]));
+
+        double xyz[3] = {10.0 + 0.1 * i, -5.0, 0.0};
+        double llh[3];
+        utility::enuToLlh(enuRef, xyz, llh);
+
+        int32_t ind = 2;
+        QCOMPARE(utility::buffer_get_int32(f, &ind), 36000000 + i * 20);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e7, &ind) - llh[0]) < 2e-7);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e7, &ind) - llh[1]) < 2e-7);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e3, &ind) - llh[2]) < 2e-3);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e3, &ind) - 2.0) < 1e-3);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e4, &ind) - 45.5) < 1e-3);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e4, &ind) - 1.25) < 1e-3);
+        QVERIFY(fabs(utility::buffer_get_double32(f, 1e4, &ind) + 2.5) < 1e-3);
+    }
+}
+
+/*
+ * The default NMEA client at 5 Hz gets every tenth pose of a 50 Hz stream,
+ * as GGA followed by RMC.
+ */
+void TestPoseStreamServer::nmeaStream()
+{
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, testPort);
+    QVERIFY(client.waitForConnected(1000));
+    client.write("RATE 5\n");
+    QTRY_COMPARE(lastStreamRate(), 5);
+
+    feed(enuRefPacket());
+
+    for (int i = 0;i < 50;i++) {
+        feed(posePacket(36000000 + i * 20, 100.0, 50.0, 1.0, 90.0, 0.0, 0.0));
+        QTest::qWait(20);
+    }
+
+    QTest::qWait(100);
+    QList<QByteArray> lines = client.readAll().split('\n');
+    lines.removeAll(QByteArray());
+
+    QVERIFY(lines.size() >= 8 && lines.size() <= 12);
+    QCOMPARE(lines.size() % 2, 0);
+
+    double xyz[3] = {100.0, 50.0, 0.0};
+    double llh[3];
+    utility::enuToLlh(enuRef, xyz, llh);
+
+    for (int i = 0;i < lines.size();i += 2) {
+        QVERIFY(lines.at(i).startsWith("$GPGGA,"));
+        QVERIFY(lines.at(i + 1).startsWith("$GPRMC,"));
+
+        QList<QByteArray> gga = lines.at(i).split(',');
+        QVERIFY(fabs(nmeaDegrees(gga.at(2)) - llh[0]) < 1e-6);
+        QCOMPARE(gga.at(3), QByteArray("N"));
+        QVERIFY(fabs(nmeaDegrees(gga.at(4)) - llh[1]) < 1e-6);
+        QCOMPARE(gga.at(5), QByteArray("E"));
+    }
+}
+
+/*
+ * The car streams at the highest client rate, capped at 50 Hz, and follows
+ * clients that leave.
+ */
+void TestPoseStreamServer::streamRate()
+{
+    QTcpSocket fast;
+    fast.connectToHost(QHostAddress::LocalHost, testPort);
+    QVERIFY(fast.waitForConnected(1000));
+    QTRY_COMPARE(lastStreamRate(), 10);
+
+    fast.write("RATE 200\n");
+    QTRY_COMPARE(lastStreamRate(), 50);
+
+    QTcpSocket slow;
+    slow.connectToHost(QHostAddress::LocalHost, testPort);
+    QVERIFY(slow.waitForConnected(1000));
+    slow.write("RATE 2\n");
+    QTest::qWait(50);
+    QCOMPARE(lastStreamRate(), 50);
+
+    // Closed clients are removed by the renew timer
+    fast.disconnectFromHost();
+    QTRY_COMPARE(lastStreamRate(), 2);
+
+    slow.disconnectFromHost();
+    QTRY_COMPARE(lastStreamRate(), 0);
+}
+
+void TestPoseStreamServer::packetSent(QByteArray &data)
+{
+    mSent.append(data);
+}
+
+void TestPoseStreamServer::feed(QByteArray data)
+{
+    mPacket->processData(data);
+}
+
+// The rate in the last CMD_SET_POSE_STREAM, or -1
+int TestPoseStreamServer::lastStreamRate()
+{
+    for (int i = mSent.size() - 1;i >= 0;i--) {
+        const QByteArray &p = mSent.at(i);
+        if (p.size() >= 5 && p.at(0) == 2 && (quint8)p.at(2) == carId &&
+                (quint8)p.at(3) == CMD_SET_POSE_STREAM) {
+            return (quint8)p.at(4);
+        }
+    }
+
+    return -1;
+}
+
+int TestPoseStreamServer::enuRefRequests()
+{
+    int res = 0;
+    for (const QByteArray &p: mSent) {
+        if (p.size() >= 4 && p.at(0) == 2 && (quint8)p.at(3) == CMD_GET_ENU_REF) {
+            res++;
+        }
+    }
+
+    return res;
+}
+
+QTEST_GUILESS_MAIN(TestPoseStreamServer)
+
+#include "tst_posestreamserver.moc"
@@ -0,0 +1,32 @@
+QT       += core network testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_posestreamserver
+TEMPLATE = app
+
+INCLUDEPATH += ../.. \
+    ../../../RControlStation
+
+SOURCES += tst_posestreamserver.cpp \
+    ../../posestreamserver.cpp \
+    ../../packetinterface.cpp \
+    ../../packet.cpp \
+    ../../nmeaserver.cpp \
+    ../../tcpbroadcast.cpp \
+    ../../utility.cpp \
+    ../../locpoint.cpp \
+    ../../vbytearray.cpp \
+    ../../../RControlStation/mainconfigcodec.cpp
+
+HEADERS += ../../posestreamserver.h \
+    ../../packetinterface.h \
+    ../../packet.h \
+    ../../nmeaserver.h \
+    ../../tcpbroadcast.h \
+    ../../utility.h \
+    ../../locpoint.h \
+    ../../vbytearray.h \
+    ../../../RControlStation/mainconfigcodec.h
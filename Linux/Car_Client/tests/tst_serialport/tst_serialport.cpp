@@ -0,0 +1,357 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <pty.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+#include "serialport.h"
+
+/*
+ * The reader before the chunk ring, kept as a reference for the benchmarks.
+ * The read thread copies every byte into a mutex protected buffer and emits
+ * a signal for each of them, and the consumer reads everything that is
+ * buffered when it gets a signal.
+ */
+class ByteReader : public QThread
+{
+    Q_OBJECT
+
+public:
+    ByteReader(int fd) : mFd(fd), mAbort(0) {}
+
+    ~ByteReader()
+    {
+        mAbort.storeRelease(1);
+        wait();
+    }
+
+    QByteArray readAll()
+    {
+        QMutexLocker locker(&mMutex);
+        QByteArray res = mBuffer;
+        mBuffer.clear();
+        return res;
+    }
+
+signals:
+    void dataAvailable();
+
+protected:
+    void run()
+    {
+        char buffer[1024];
+
+        while (!mAbort.loadAcquire()) {
+            fd_set set;
+            FD_ZERO(&set);
+            FD_SET(mFd, &set);
+            timespec timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_nsec = 10000000;
+
+            if (pselect(mFd + 1, &set, NULL, NULL, &timeout, NULL) <= 0) {
+                continue;
+            }
+
+            int res = read(mFd, buffer, sizeof(buffer));
+            QMutexLocker locker(&mMutex);
+            for (int i = 0;i < res;i++) {
+                mBuffer.append(buffer[i]);
+                emit dataAvailable();
+            }
+        }
+    }
+
+private:
+    int mFd;
+    QAtomicInt mAbort;
+    QMutex mMutex;
+    QByteArray mBuffer;
+};
+
+// The pseudo terminal master plays the device, the slave is opened by
+// SerialPort as if it was a serial port.
+class TestSerialPort : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void dataAvailable();
+    void byteReaderDataAvailable();
+
+private slots:
+    void init();
+    void cleanup();
+    void noLostWakeup();
+    void droppedBytes();
+    void benchmarkThroughput_data();
+    void benchmarkThroughput();
+    void benchmarkLatency_data();
+    void benchmarkLatency();
+
+private:
+    int writeMaster(const char *data, int len);
+    void startByteReader();
+    void stopByteReader();
+    bool transfer(const QByteArray &data);
+
+    int mMaster;
+    int mSlave;
+    SerialPort *mPort;
+    QByteArray mReceived;
+    bool mReadOnSignal;
+
+    // The old reader on a pty pair of its own
+    int mByteMaster;
+    int mByteSlave;
+    ByteReader *mByteReader;
+};
+
+void TestSerialPort::dataAvailable()
+{
+    if (!mReadOnSignal) {
+        return;
+    }
+
+    QByteArray chunk;
+    while (mPort->readChunk(chunk)) {
+        mReceived.append(chunk);
+    }
+}
+
+void TestSerialPort::byteReaderDataAvailable()
+{
+    mReceived.append(mByteReader->readAll());
+}
+
+void TestSerialPort::init()
+{
+    char name[256];
+    QVERIFY(openpty(&mMaster, &mSlave, name, 0, 0) == 0);
+    fcntl(mMaster, F_SETFL, fcntl(mMaster, F_GETFL) | O_NONBLOCK);
+
+    mPort = new SerialPort;
+    QCOMPARE(mPort->openPort(name), 0);
+    connect(mPort, SIGNAL(serial_data_available()),
+            this, SLOT(dataAvailable()));
+
+    mReceived.clear();
+    mReadOnSignal = true;
+    mByteReader = 0;
+}
+
+void TestSerialPort::cleanup()
+{
+    stopByteReader();
+    mPort->closePort();
+    delete mPort;
+    close(mSlave);
+    close(mMaster);
+}
+
+int TestSerialPort::writeMaster(const char *data, int len)
+{
+    int written = 0;
+
+    while (written < len) {
+        int res = write(mMaster, data + written, len - written);
+        if (res <= 0) {
+            break;
+        }
+        written += res;
+    }
+
+    return written;
+}
+
+void TestSerialPort::startByteReader()
+{
+    QVERIFY(openpty(&mByteMaster, &mByteSlave, 0, 0, 0) == 0);
+    fcntl(mByteMaster, F_SETFL, fcntl(mByteMaster, F_GETFL) | O_NONBLOCK);
+
+    termios options;
+    tcgetattr(mByteSlave, &options);
+    cfmakeraw(&options);
+    tcsetattr(mByteSlave, TCSANOW, &options);
+
+    mByteReader = new ByteReader(mByteSlave);
+    connect(mByteReader, SIGNAL(dataAvailable()),
+            this, SLOT(byteReaderDataAvailable()));
+    mByteReader->start();
+}
+
+void TestSerialPort::stopByteReader()
+{
+    if (!mByteReader) {
+        return;
+    }
+
+    delete mByteReader;
+    mByteReader = 0;
+    close(mByteSlave);
+    close(mByteMaster);
+}
+
+// Write data to the reader under test and run the event loop until all of
+// it has been received, as fast as the pty takes it.
+bool TestSerialPort::transfer(const QByteArray &data)
+{
+    const int master = mByteReader ? mByteMaster : mMaster;
+    int written = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    mReceived.clear();
+    while (mReceived.size() < data.size() && timer.elapsed() < 10000) {
+        if (written < data.size()) {
+            int res = write(master, data.constData() + written, data.size() - written);
+            if (res > 0) {
+                written += res;
+            }
+        }
+
+        QCoreApplication::processEvents();
+    }
+
+    return mReceived == data;
+}
+
+// Small writes with short pauses, so that the read thread publishes chunks
+// while the consumer is clearing the notification. Every byte has to arrive
+// without polling; a lost wakeup leaves data in the ring and fails the
+// final compare.
+void TestSerialPort::noLostWakeup()
+{
+    QByteArray sent;
+    qsrand(1234);
+
+    for (int i = 0;i < 2000;i++) {
+        QByteArray burst(1 + qrand() % 40, 'a' + (i % 26));
+        sent.append(burst);
+        QCOMPARE(writeMaster(burst.constData(), burst.size()), burst.size());
+
+        if (qrand() % 4 == 0) {
+            QThread::usleep(qrand() % 500);
+        }
+
+        QCoreApplication::processEvents();
+    }
+
+    QTRY_COMPARE_WITH_TIMEOUT(mReceived.size(), sent.size(), 5000);
+    QCOMPARE(mReceived, sent);
+    QCOMPARE(mPort->droppedBytes(), (qint64)0);
+}
+
+// Data that does not fit in the chunk ring is counted as dropped
+void TestSerialPort::droppedBytes()
+{
+    mReadOnSignal = false;
+
+    QByteArray block(1024, 'x');
+    int sent = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    // Write until the ring and the pty buffer are full
+    while (timer.elapsed() < 2000 && mPort->droppedBytes() < 100000) {
+        int res = write(mMaster, block.constData(), block.size());
+        if (res > 0) {
+            sent += res;
+        } else {
+            QThread::msleep(1);
+        }
+    }
+
+    QVERIFY(mPort->droppedBytes() > 0);
+
+    // Wait for the read thread to drain the pty
+    QTest::qWait(200);
+
+    QByteArray received;
+    QByteArray chunk;
+    while (mPort->readChunk(chunk)) {
+        received.append(chunk);
+    }
+
+    QCOMPARE((qint64)received.size() + mPort->droppedBytes(), (qint64)sent);
+}
+
+void TestSerialPort::benchmarkThroughput_data()
+{
+    QTest::addColumn<bool>("perByte");
+
+    QTest::newRow("chunk ring") << false;
+    QTest::newRow("old per-byte reader") << true;
+}
+
+// 256 kB through the pty, about 2 s of a 1 Mbaud link
+void TestSerialPort::benchmarkThroughput()
+{
+    QFETCH(bool, perByte);
+
+    if (perByte) {
+        startByteReader();
+    }
+
+    QByteArray data;
+    for (int i = 0;i < 256 * 1024;i++) {
+        data.append((char)(i * 7));
+    }
+
+    bool ok = true;
+    QBENCHMARK {
+        ok = ok && transfer(data);
+    }
+
+    QVERIFY(ok);
+    QCOMPARE(mPort->droppedBytes(), (qint64)0);
+}
+
+void TestSerialPort::benchmarkLatency_data()
+{
+    QTest::addColumn<bool>("perByte");
+
+    QTest::newRow("chunk ring") << false;
+    QTest::newRow("old per-byte reader") << true;
+}
+
+// The time from writing one packet sized message until the consumer has all
+// of it
+void TestSerialPort::benchmarkLatency()
+{
+    QFETCH(bool, perByte);
+
+    if (perByte) {
+        startByteReader();
+    }
+
+    QByteArray data(64, 'p');
+
+    bool ok = true;
+    QBENCHMARK {
+        ok = ok && transfer(data);
+    }
+
+    QVERIFY(ok);
+}
+
+QTEST_GUILESS_MAIN(TestSerialPort)
+
+#include "tst_serialport.moc"
@@ -0,0 +1,17 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_serialport
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+LIBS += -lutil
+
+SOURCES += tst_serialport.cpp \
+    ../../serialport.cpp
+
+HEADERS += ../../serialport.h
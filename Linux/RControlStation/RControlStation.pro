@@ -81,7 +81,20 @@ SOURCES += main.cpp\
     copterinterface.cpp \
     nmeawidget.cpp \
     confcommonwidget.cpp \
-    ublox.cpp
+    ublox.cpp \
+    latencytracer.cpp \
+    routeconflicts.cpp \
+    multilateration.cpp \
+    posepredictor.cpp \
+    mainconfigcodec.cpp \
+    netprotocol.cpp \
+    netapi.cpp \
+    netapiclient.cpp \
+    ubloxbase.cpp \
+    logloader.cpp \
+    obsmonitor.cpp \
+    surveyin.cpp \
+    rtcmsourcemanager.cpp
 
 HEADERS  += mainwindow.h \
     qcustomplot.h \
@@ -113,7 +126,22 @@ HEADERS  += mainwindow.h \
     copterinterface.h \
     nmeawidget.h \
     confcommonwidget.h \
-    ublox.h
+    ublox.h \
+    latencytracer.h \
+    routeconflicts.h \
+    multilateration.h \
+    posepredictor.h \
+    mainconfigcodec.h \
+    mainconfigtypes.h \
+    netprotocol.h \
+    netapi.h \
+    netapiclient.h \
+    ubloxbase.h \
+    logloader.h \
+    obsmonitor.h \
+    surveyin.h \
+    rtcmsourcemanager.h \
+    ../../Embedded/RC_Controller/main_config_schema.h
 
 FORMS    += mainwindow.ui \
     carinterface.ui \
@@ -23,7 +23,6 @@
 #include <QSerialPortInfo>
 #include "nmeaserver.h"
 #include "utility.h"
-#include "rtcm3_simple.h"
 
 BaseStation::BaseStation(QWidget *parent) :
     QWidget(parent),
@@ -36,16 +35,11 @@ BaseStation::BaseStation(QWidget *parent) :
     mXNow = 0.0;
     mYNow = 0.0;
     mZNow = 0.0;
-    mXAvg = 0.0;
-    mYAvg = 0.0;
-    mZAvg = 0.0;
-    mAvgSamples = 0.0;
-    mBasePosCnt = 0;
 
     mFixNowStr = "Solution...";
     mSatNowStr = "Sats...";
 
-    mUblox = new Ublox(this);
+    mBase = new UbloxBase(this);
     mTcpServer = new TcpBroadcast(this);
 
     mTimer = new QTimer(this);
@@ -59,11 +53,21 @@ BaseStation::BaseStation(QWidget *parent) :
             this, SLOT(tcpInputError(QAbstractSocket::SocketError)));
     connect(mTimer, SIGNAL(timeout()),
             this, SLOT(timerSlot()));
-    connect(mUblox, SIGNAL(rxGga(int,NmeaServer::nmea_gga_info_t)),
+    connect(mBase->ublox(), SIGNAL(rxGga(int,NmeaServer::nmea_gga_info_t)),
             this, SLOT(rxGga(int,NmeaServer::nmea_gga_info_t)));
-    connect(mUblox, SIGNAL(rxRawx(ubx_rxm_rawx)),
-            this, SLOT(rxRawx(ubx_rxm_rawx)));
-
+    connect(mBase, SIGNAL(rtcmEpoch(QByteArray,QByteArray)),
+            this, SLOT(baseRtcmEpoch(QByteArray,QByteArray)));
+    connect(mBase, SIGNAL(rtcmOut(QByteArray)),
+            this, SLOT(baseRtcmOut(QByteArray)));
+    connect(ui->surveyStopBox, SIGNAL(toggled(bool)), this, SLOT(updateBaseSettings()));
+    connect(ui->surveyAccBox, SIGNAL(valueChanged(double)), this, SLOT(updateBaseSettings()));
+    connect(ui->sendBaseBox, SIGNAL(toggled(bool)), this, SLOT(updateBaseSettings()));
+    connect(ui->refSendLatBox, SIGNAL(valueChanged(double)), this, SLOT(updateBaseSettings()));
+    connect(ui->refSendLonBox, SIGNAL(valueChanged(double)), this, SLOT(updateBaseSettings()));
+    connect(ui->refSendHBox, SIGNAL(valueChanged(double)), this, SLOT(updateBaseSettings()));
+    connect(ui->refSendAntHBox, SIGNAL(valueChanged(double)), this, SLOT(updateBaseSettings()));
+
+    updateBaseSettings();
     updateNmeaText();
     on_ubxSerialRefreshButton_clicked();
 }
@@ -75,13 +79,12 @@ BaseStation::~BaseStation()
 
 int BaseStation::getAvgPosLlh(double &lat, double &lon, double &height)
 {
-    double xAvg = mXAvg / mAvgSamples;
-    double yAvg = mYAvg / mAvgSamples;
-    double zAvg = mZAvg / mAvgSamples;
+    double xAvg, yAvg, zAvg;
+    mBase->survey().mean(xAvg, yAvg, zAvg);
 
     utility::xyzToLlh(xAvg, yAvg, zAvg, &lat, &lon, &height);
 
-    return (int)mAvgSamples;
+    return mBase->survey().samples();
 }
 
 void BaseStation::tcpInputConnected()
@@ -114,6 +117,7 @@ void BaseStation::tcpInputDataAvailable()
         QByteArray data = str.toLocal8Bit();
 
         int fields = NmeaServer::decodeNmeaGGA(data, gga);
+        mBase->addGga(fields, gga);
         rxGga(fields, gga);
     }
 }
@@ -139,8 +143,8 @@ void BaseStation::timerSlot()
 {
     // Update serial connected label
     static bool wasSerialConnected = false;
-    if (wasSerialConnected != mUblox->isSerialConnected()) {
-        wasSerialConnected = mUblox->isSerialConnected();
+    if (wasSerialConnected != mBase->isSerialConnected()) {
+        wasSerialConnected = mBase->isSerialConnected();
 
         if (wasSerialConnected) {
             ui->ubxSerialConnectedLabel->setText("Connected");
@@ -168,12 +172,9 @@ void BaseStation::rxGga(int fields, NmeaServer::nmea_gga_info_t gga)
         default: mFixNowStr = "Solution: Unknown"; break;
         }
 
-        if (gga.fix_type == 1 || gga.fix_type == 2 || gga.fix_type == 4 || gga.fix_type == 5) {
+        // The sample is added to the survey by mBase
+        if (gga.fix_type > 0) {
             utility::llhToXyz(gga.lat, gga.lon, gga.height, &mXNow, &mYNow, &mZNow);
-            mXAvg += mXNow;
-            mYAvg += mYNow;
-            mZAvg += mZNow;
-            mAvgSamples += 1.0;
         }
     } else {
         mFixNowStr = "Solution: Invalid";
@@ -183,136 +184,31 @@ void BaseStation::rxGga(int fields, NmeaServer::nmea_gga_info_t gga)
     updateNmeaText();
 }
 
-void BaseStation::rxRawx(ubx_rxm_rawx rawx)
+void BaseStation::baseRtcmEpoch(QByteArray obs, QByteArray refPos)
 {
-    uint8_t data_gps[1024];
-    uint8_t data_glo[1024];
-    uint8_t data_ref[512];
-
-    int gps_len = 0;
-    int glo_len = 0;
-    int ref_len = 0;
-
-    rtcm_obs_header_t header;
-    rtcm_obs_t obs[rawx.num_meas];
-
-    header.staid = 0;
-    header.t_wn = rawx.week;
-    header.t_tow = rawx.rcv_tow;
-    header.t_tod = fmod(rawx.rcv_tow - (double)rawx.leaps + 10800.0, 86400.0);
-
-    bool has_gps = false;
-    bool has_glo = false;
-    bool has_ref = false;
-
-    for (int i = 0;i < rawx.num_meas;i++) {
-        ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
-
-        if (raw_obs->gnss_id == 0) {
-            has_gps = true;
-        } else if (raw_obs->gnss_id == 6) {
-            has_glo = true;
-        }
-    }
-
-    // GPS
-    if (has_gps) {
-        int obs_ind = 0;
-        for (int i = 0;i < rawx.num_meas;i++) {
-            ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
-
-            if (raw_obs->gnss_id == 0) {
-                obs[obs_ind].P[0] = raw_obs->pr_mes;
-                obs[obs_ind].L[0] = raw_obs->cp_mes;
-                obs[obs_ind].cn0[0] = raw_obs->cno;
-                obs[obs_ind].lock[0] = raw_obs->locktime > 2000 ? 127 : 0;
-                obs[obs_ind].code[0] = CODE_L1C;
-                obs[obs_ind].prn = raw_obs->sv_id;
-                obs_ind++;
-            }
-        }
-        header.sync = has_glo;
-        rtcm3_encode_1002(&header, obs, obs_ind, data_gps, &gps_len);
-    }
-
-    // GLONASS
-    if (has_glo) {
-        int obs_ind = 0;
-        for (int i = 0;i < rawx.num_meas;i++) {
-            ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
-
-            if (raw_obs->gnss_id == 6) {
-                obs[obs_ind].P[0] = raw_obs->pr_mes;
-                obs[obs_ind].L[0] = raw_obs->cp_mes;
-                obs[obs_ind].cn0[0] = raw_obs->cno;
-                obs[obs_ind].lock[0] = raw_obs->locktime > 2000 ? 127 : 0;
-                obs[obs_ind].code[0] = CODE_L1C;
-                obs[obs_ind].prn = raw_obs->sv_id;
-                obs[obs_ind].freq = raw_obs->freq_id;
-                obs_ind++;
-            }
-        }
-        header.sync = 0;
-        rtcm3_encode_1010(&header, obs, obs_ind, data_glo, &glo_len);
-    }
+    ui->obsHealthBrowser->setText(mBase->obsMonitor().healthSummary());
 
-    // Base station position
-    if (ui->sendBaseBox->isChecked()) {
-        rtcm_ref_sta_pos_t pos;
-        pos.ant_height = ui->refSendAntHBox->value();
-        pos.height = ui->refSendHBox->value();
-        pos.lat = ui->refSendLatBox->value();
-        pos.lon = ui->refSendLonBox->value();
-        pos.staid = 0;
-        rtcm3_encode_1006(pos, data_ref, &ref_len);
-        has_ref = true;
-    }
-
-    if (ui->tcpServerBox->isChecked()) {
-        QByteArray message;
-        if (has_gps) {
-            message.append((char*)data_gps, gps_len);
-        }
-
-        if (has_glo) {
-            message.append((char*)data_glo, glo_len);
-        }
-
-        if (has_ref) {
-            message.append((char*)data_ref, ref_len);
-        }
-
-        mTcpServer->broadcastData(message);
+    if (ui->tcpServerBox->isChecked() && !obs.isEmpty()) {
+        mTcpServer->broadcastData(obs + refPos);
     }
+}
 
+void BaseStation::baseRtcmOut(QByteArray data)
+{
     if (ui->sendVehiclesBox->isChecked()) {
-        if (has_gps && has_glo && ((gps_len + glo_len) < 1000)) {
-            QByteArray message;
-            message.append((char*)data_gps, gps_len);
-            message.append((char*)data_glo, glo_len);
-            emit rtcmOut(message);
-        } else {
-            if (has_gps) {
-                emit rtcmOut(QByteArray((char*)data_gps, gps_len));
-            }
-
-            if (has_glo) {
-                emit rtcmOut(QByteArray((char*)data_glo, glo_len));
-            }
-        }
-
-        // Send base station position every 5 cycles to save bandwidth.
-        mBasePosCnt++;
-        if (mBasePosCnt >= 5) {
-            mBasePosCnt = 0;
-
-            if (has_ref) {
-                emit rtcmOut(QByteArray((char*)data_ref, ref_len));
-            }
-        }
+        emit rtcmOut(data);
     }
 }
 
+void BaseStation::updateBaseSettings()
+{
+    mBase->survey().setTargetAccuracy(ui->surveyStopBox->isChecked() ?
+                                          ui->surveyAccBox->value() : 0.0);
+    mBase->setRefPos(ui->refSendLatBox->value(), ui->refSendLonBox->value(),
+                     ui->refSendHBox->value(), ui->refSendAntHBox->value());
+    mBase->setSendRefPos(ui->sendBaseBox->isChecked());
+}
+
 void BaseStation::on_nmeaConnectButton_clicked()
 {
     if (mTcpConnected) {
@@ -334,23 +230,21 @@ void BaseStation::on_nmeaConnectButton_clicked()
 
 void BaseStation::on_nmeaSampleClearButton_clicked()
 {
-    mXAvg = 0.0;
-    mYAvg = 0.0;
-    mZAvg = 0.0;
-    mAvgSamples = 0.0;
+    mBase->survey().reset();
 
     updateNmeaText();
 }
 
 void BaseStation::updateNmeaText()
 {
+    const SurveyIn &survey = mBase->survey();
+
     QString sampStr;
-    sampStr.sprintf("Samples %d", (int)mAvgSamples);
+    sampStr.sprintf("Samples %d (%d rejected)", survey.samples(), survey.rejected());
     ui->nmeaSampleLabel->setText(sampStr);
 
-    double xAvg = mXAvg / mAvgSamples;
-    double yAvg = mYAvg / mAvgSamples;
-    double zAvg = mZAvg / mAvgSamples;
+    double xAvg, yAvg, zAvg;
+    survey.mean(xAvg, yAvg, zAvg);
 
     double lat_now, lon_now, height_now;
     double lat_avg, lon_avg, height_avg;
@@ -364,7 +258,22 @@ void BaseStation::updateNmeaText()
     statStr += QString().sprintf("LLH Now: %.8f, %.8f, %.3f\n\n", lat_now, lon_now, height_now);
 
     statStr += QString().sprintf("XYZ Avg: %.3f, %.3f, %.3f\n", xAvg, yAvg, zAvg);
-    statStr += QString().sprintf("LLH Avg: %.8f, %.8f, %.3f", lat_avg, lon_avg, height_avg);
+    statStr += QString().sprintf("LLH Avg: %.8f, %.8f, %.3f\n\n", lat_avg, lon_avg, height_avg);
+
+    double sd[3], se[3];
+    if (survey.stdDevEnu(sd)) {
+        statStr += QString().sprintf("Std Dev ENU: %.3f, %.3f, %.3f\n", sd[0], sd[1], sd[2]);
+    }
+
+    if (survey.stdErrorEnu(se)) {
+        statStr += QString().sprintf("Std Err ENU: %.3f, %.3f, %.3f\n", se[0], se[1], se[2]);
+        statStr += QString().sprintf("Accuracy 3D: %.3f (%.0f independent samples)\n",
+                                     survey.accuracy(), survey.effectiveSamples());
+    } else {
+        statStr += "Accuracy 3D: collecting...\n";
+    }
+
+    statStr += survey.isDone() ? "Survey: done" : "Survey: running";
 
     ui->nmeaBrowser->setText(statStr);
 }
@@ -383,42 +292,13 @@ void BaseStation::on_ubxSerialRefreshButton_clicked()
 
 void BaseStation::on_ubxSerialDisconnectButton_clicked()
 {
-    mUblox->disconnectSerial();
+    mBase->disconnectSerial();
 }
 
 void BaseStation::on_ubxSerialConnectButton_clicked()
 {
-    bool res = mUblox->connectSerial(ui->ubxSerialPortBox->currentData().toString(),
+    mBase->connectSerial(ui->ubxSerialPortBox->currentData().toString(),
                          ui->ubxSerialBaudBox->value());
-
-    if (res) {
-        // Serial port baud rate
-        // if it is too low the buffer will overfill and it won't work properly.
-        ubx_cfg_prt_uart uart;
-        uart.baudrate = 115200;
-        uart.in_ubx = true;
-        uart.in_nmea = true;
-        uart.in_rtcm2 = false;
-        uart.in_rtcm3 = true;
-        uart.out_ubx = true;
-        uart.out_nmea = true;
-        uart.out_rtcm3 = true;
-        mUblox->ubxCfgPrtUart(&uart);
-
-        // Set configuration
-        // Switch on RAWX and NMEA messages, set rate to 1 Hz and time reference to UTC
-        mUblox->ubxCfgRate(1000, 1, 0);
-        mUblox->ubxCfgMsg(UBX_CLASS_RXM, UBX_RXM_RAWX, 1); // Every second
-        mUblox->ubxCfgMsg(UBX_CLASS_RXM, UBX_RXM_SFRBX, 1); // Every second
-        mUblox->ubxCfgMsg(UBX_CLASS_NMEA, UBX_NMEA_GGA, 1); // Every second
-
-        // Stationary dynamic model
-        ubx_cfg_nav5 nav5;
-        memset(&nav5, 0, sizeof(ubx_cfg_nav5));
-        nav5.apply_dyn = true;
-        nav5.dyn_model = 2;
-        mUblox->ubxCfgNav5(&nav5);
-    }
 }
 
 void BaseStation::on_refGetButton_clicked()
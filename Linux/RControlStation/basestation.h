@@ -21,7 +21,7 @@
 #include <QWidget>
 #include <QTcpSocket>
 #include <QTimer>
-#include "ublox.h"
+#include "ubloxbase.h"
 #include "tcpbroadcast.h"
 
 namespace Ui {
@@ -47,7 +47,9 @@ private slots:
     void tcpInputError(QAbstractSocket::SocketError socketError);
     void timerSlot();
     void rxGga(int fields, NmeaServer::nmea_gga_info_t gga);
-    void rxRawx(ubx_rxm_rawx rawx);
+    void baseRtcmEpoch(QByteArray obs, QByteArray refPos);
+    void baseRtcmOut(QByteArray data);
+    void updateBaseSettings();
 
     void on_nmeaConnectButton_clicked();
     void on_nmeaSampleClearButton_clicked();
@@ -62,17 +64,12 @@ private:
     QTcpSocket *mTcpSocket;
     bool mTcpConnected;
     QTimer *mTimer;
-    Ublox *mUblox;
+    UbloxBase *mBase;
     TcpBroadcast *mTcpServer;
-    int mBasePosCnt;
 
     double mXNow;
     double mYNow;
     double mZNow;
-    double mXAvg;
-    double mYAvg;
-    double mZAvg;
-    double mAvgSamples;
 
     QString mFixNowStr;
     QString mSatNowStr;
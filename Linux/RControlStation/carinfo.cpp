@@ -16,6 +16,7 @@
     */
 
 #include "carinfo.h"
+#include <cmath>
 
 CarInfo::CarInfo(int id, Qt::GlobalColor color)
 {
@@ -24,6 +25,7 @@ CarInfo::CarInfo(int id, Qt::GlobalColor color)
     mName = "";
     mName.sprintf("Car %d", mId);
     mTime = 0;
+    mDirty = true;
 }
 
 int CarInfo::getId()
@@ -34,6 +36,7 @@ int CarInfo::getId()
 void CarInfo::setId(int id, bool changeName)
 {
     mId = id;
+    mDirty = true;
 
     if (changeName) {
         mName = "";
@@ -49,11 +52,13 @@ QString CarInfo::getName() const
 void CarInfo::setName(QString name)
 {
     mName = name;
+    mDirty = true;
 }
 
 void CarInfo::setLocation(LocPoint &point)
 {
     mLocation = point;
+    mDirty = true;
 }
 
 LocPoint CarInfo::getLocationGps() const
@@ -64,6 +69,7 @@ LocPoint CarInfo::getLocationGps() const
 void CarInfo::setLocationGps(LocPoint &point)
 {
     mLocationGps = point;
+    mDirty = true;
 }
 
 Qt::GlobalColor CarInfo::getColor() const
@@ -74,6 +80,7 @@ Qt::GlobalColor CarInfo::getColor() const
 void CarInfo::setColor(Qt::GlobalColor color)
 {
     mColor = color;
+    mDirty = true;
 }
 
 LocPoint CarInfo::getApGoal() const
@@ -84,6 +91,7 @@ LocPoint CarInfo::getApGoal() const
 void CarInfo::setApGoal(const LocPoint &apGoal)
 {
     mApGoal = apGoal;
+    mDirty = true;
 }
 
 qint32 CarInfo::getTime() const
@@ -94,6 +102,7 @@ qint32 CarInfo::getTime() const
 void CarInfo::setTime(const qint32 &time)
 {
     mTime = time;
+    mDirty = true;
 }
 
 LocPoint CarInfo::getLocation() const
@@ -101,3 +110,62 @@ LocPoint CarInfo::getLocation() const
     return mLocation;
 }
 
+/**
+ * @brief CarInfo::updatePrediction
+ * Update the pose predictor with the current location. Call this after
+ * setLocation when a new state arrives.
+ *
+ * @param speed
+ * The speed in m/s.
+ *
+ * @param yawRate
+ * The rate of change of the heading in rad/s, counter-clockwise.
+ *
+ * @param timeMs
+ * The local time when the state was received.
+ */
+void CarInfo::updatePrediction(double speed, double yawRate, qint64 timeMs)
+{
+    mPredictor.update(mLocation.getX(), mLocation.getY(), -mLocation.getYaw(),
+                      speed, yawRate, timeMs);
+}
+
+/**
+ * @brief CarInfo::getLocationPredicted
+ * Get the location extrapolated to a given time. The uncertainty of the
+ * prediction is added to the sigma of the location.
+ */
+LocPoint CarInfo::getLocationPredicted(qint64 timeMs) const
+{
+    LocPoint loc = mLocation;
+
+    if (mPredictor.isValid()) {
+        double px, py, heading, sigma;
+        mPredictor.predict(timeMs, px, py, heading, sigma);
+        loc.setXY(px, py);
+        loc.setYaw(-heading);
+        loc.setSigma(sqrt(loc.getSigma() * loc.getSigma() + sigma * sigma));
+    }
+
+    return loc;
+}
+
+bool CarInfo::isPredictionMoving(qint64 timeMs) const
+{
+    return mPredictor.isMoving(timeMs);
+}
+
+/**
+ * @brief CarInfo::isDirty
+ * Check if the car has changed since clearDirty was called. MapWidget uses
+ * this to know when the cached label of the car has to be updated.
+ */
+bool CarInfo::isDirty() const
+{
+    return mDirty;
+}
+
+void CarInfo::clearDirty()
+{
+    mDirty = false;
+}
@@ -21,6 +21,7 @@
 #include <QVector>
 #include <QString>
 #include "locpoint.h"
+#include "posepredictor.h"
 
 class CarInfo
 {
@@ -40,6 +41,11 @@ public:
     void setApGoal(const LocPoint &apGoal);
     qint32 getTime() const;
     void setTime(const qint32 &time);
+    void updatePrediction(double speed, double yawRate, qint64 timeMs);
+    LocPoint getLocationPredicted(qint64 timeMs) const;
+    bool isPredictionMoving(qint64 timeMs) const;
+    bool isDirty() const;
+    void clearDirty();
 
 private:
     int mId;
@@ -49,6 +55,8 @@ private:
     LocPoint mApGoal;
     Qt::GlobalColor mColor;
     qint32 mTime;
+    PosePredictor mPredictor;
+    bool mDirty;
 
 };
 
@@ -24,6 +24,8 @@
 #include <cmath>
 #include <QTime>
 #include <QDateTime>
+#include <QTextCursor>
+#include <QTextDocument>
 
 namespace {
 void faultToStr(mc_fault_code fault, QString &str, bool &isOk)
@@ -63,6 +65,13 @@ CarInterface::CarInterface(QWidget *parent) :
     mPacketInterface = 0;
     mId = 0;
     mExperimentReplot = false;
+    mTracer = new LatencyTracer(this);
+    mTraceId = 0;
+    mTraceTimer = 0;
+    mTraceSummaryTimer = 0;
+    mTraceSummaryCount = 0;
+    mTraceSummaryPos = -1;
+    mTraceSummaryEnd = -1;
 
     mTimer = new QTimer(this);
     mTimer->start(20);
@@ -78,6 +87,8 @@ CarInterface::CarInterface(QWidget *parent) :
             this, SLOT(tcpRx(QByteArray&)));
     connect(ui->confCommonWidget, SIGNAL(loadMagCal()),
             this, SLOT(loadMagCal()));
+    connect(ui->imuPlot, SIGNAL(captureChanged(bool,int)),
+            this, SLOT(imuCaptureChanged(bool,int)));
 
     mTcpServer->setUsePacket(true);
 
@@ -213,6 +224,8 @@ void CarInterface::setStateData(CAR_STATE data)
         car->setLocationGps(loc_gps);
         car->setApGoal(ap_goal);
         car->setTime(data.ms_today);
+        car->updatePrediction(data.speed, data.gyro[2],
+                              QDateTime::currentMSecsSinceEpoch());
         mMap->update();
     }
 
@@ -276,6 +289,8 @@ void CarInterface::setMap(MapWidget *map)
             this, SLOT(updateAnchorsMap()));
     connect(ui->dwAnch2PzBox, SIGNAL(valueChanged(double)),
             this, SLOT(updateAnchorsMap()));
+
+    updateMultilatAnchors();
 }
 
 void CarInterface::setPacketInterface(PacketInterface *packetInterface)
@@ -310,6 +325,14 @@ void CarInterface::setPacketInterface(PacketInterface *packetInterface)
             this, SLOT(radarSamplesReceived(quint8,QVector<QPair<double,double> >)));
     connect(mPacketInterface, SIGNAL(dwSampleReceived(quint8,DW_LOG_INFO)),
             this, SLOT(dwSampleReceived(quint8,DW_LOG_INFO)));
+    connect(mPacketInterface, SIGNAL(traceReceived(quint8,TRACE_INFO)),
+            this, SLOT(traceReceived(quint8,TRACE_INFO)));
+    connect(mPacketInterface, SIGNAL(statsReceived(quint8,FW_STATS)),
+            this, SLOT(statsReceived(quint8,FW_STATS)));
+    connect(mPacketInterface, SIGNAL(imuSamplesReceived(quint8,QVector<IMU_SAMPLE>,quint32)),
+            this, SLOT(imuSamplesReceived(quint8,QVector<IMU_SAMPLE>,quint32)));
+    connect(this, SIGNAL(setImuCapture(quint8,bool,int)),
+            mPacketInterface, SLOT(setImuCapture(quint8,bool,int)));
 }
 
 void CarInterface::setControlValues(double throttle, double steering, double max, bool currentMode)
@@ -375,6 +398,24 @@ void CarInterface::timerSlot()
         ui->experimentPlot->replot();
         mExperimentReplot = false;
     }
+
+    // Send a latency trace every 100 ms while tracing
+    if (ui->terminalTraceButton->isChecked() && mPacketInterface) {
+        mTraceTimer++;
+        if (mTraceTimer >= 5) {
+            mTraceTimer = 0;
+            mPacketInterface->sendTrace(mId, mTraceId++);
+        }
+
+        // Refresh the histograms once per second when new traces arrived
+        mTraceSummaryTimer++;
+        if (mTraceSummaryTimer >= 50) {
+            mTraceSummaryTimer = 0;
+            if (mTracer->traceCount() != mTraceSummaryCount) {
+                updateTraceSummary();
+            }
+        }
+    }
 }
 
 void CarInterface::udpReadReady()
@@ -549,11 +590,86 @@ void CarInterface::dwSampleReceived(quint8 id, DW_LOG_INFO dw)
     if (id == mId) {
         mDwData.append(dw);
         plotDwData();
+
+        Multilateration::fix_t fix;
+        if (mMap && ui->dwMultilatBox->isChecked() &&
+                mMultilat.addRange(dw.dw_anchor, dw.dw_dist, dw.time_today_ms,
+                                   dw.px, dw.py, fix)) {
+            LocPoint p;
+            p.setXY(fix.px, fix.py);
+
+            QString info;
+            QTime t = QTime::fromMSecsSinceStartOfDay(fix.timeMs);
+            info.sprintf("%02d:%02d:%02d:%03d\n"
+                         "UWB: %d ranges (%d rejected)\n"
+                         "RMS: %.2f m",
+                         t.hour(), t.minute(), t.second(), t.msec(),
+                         fix.rangesUsed, fix.rangesRejected, fix.rms);
+
+            p.setInfo(info);
+            mMap->addInfoPoint(p);
+        }
+    }
+}
+
+void CarInterface::traceReceived(quint8 id, TRACE_INFO trace)
+{
+    if (id == mId && ui->terminalTraceButton->isChecked()) {
+        mTracer->addTrace(trace);
+    }
+}
+
+void CarInterface::statsReceived(quint8 id, FW_STATS stats)
+{
+    if (id != mId) {
+        return;
+    }
+
+    const char *queueNames[] = {"ublox rx", "can rx", "cc2520 tx", "cc1120 tx",
+                                "imu capture"};
+
+    QString str;
+    str += QString().sprintf("Uptime: %u s, RTCM bytes: %u\n",
+                             stats.uptime_ms / 1000, stats.rtcm_bytes);
+
+    for (int i = 0;i < stats.queue_num;i++) {
+        str += QString().sprintf("Queue %-10s hwm: %4u / %4u, overflows: %u\n", queueNames[i],
+                                 stats.queue_hwm[i], stats.queue_size[i],
+                                 stats.queue_overflows[i]);
+    }
+
+    str += "\n          name   load\n";
+    for (int i = 0;i < stats.thread_num;i++) {
+        str += QString().sprintf("%14s %5.1f %%\n", stats.threads[i].name,
+                                 stats.threads[i].load * 100.0);
+    }
+
+    str += "\ncmd      count   avg (us)   max (us)\n";
+    for (int i = 0;i < stats.cmd_num;i++) {
+        const FW_STATS_CMD &c = stats.cmds[i];
+        str += QString().sprintf("%3d %10u %10.1f %10.1f\n", c.cmd, c.count,
+                                 c.time_avg_us, c.time_max_us);
+    }
+
+    ui->terminalBrowser->append(str);
+}
+
+void CarInterface::imuSamplesReceived(quint8 id, QVector<IMU_SAMPLE> samples, quint32 dropped)
+{
+    if (id == mId) {
+        ui->imuPlot->addCaptureSamples(samples, dropped);
     }
 }
 
+void CarInterface::imuCaptureChanged(bool enabled, int decimation)
+{
+    emit setImuCapture(mId, enabled, decimation);
+}
+
 void CarInterface::updateAnchorsMap()
 {
+    updateMultilatAnchors();
+
     if (mMap) {
         bool update = false;
 
@@ -657,6 +773,26 @@ void CarInterface::on_terminalClearButton_clicked()
     ui->terminalBrowser->clear();
 }
 
+void CarInterface::on_terminalStatsButton_clicked()
+{
+    if (mPacketInterface) {
+        mPacketInterface->getStats(mId);
+    }
+}
+
+void CarInterface::on_terminalTraceButton_toggled(bool checked)
+{
+    if (checked) {
+        mTracer->reset();
+        mTraceTimer = 0;
+        mTraceSummaryTimer = 0;
+        mTraceSummaryCount = 0;
+        mTraceSummaryPos = -1;
+    } else {
+        updateTraceSummary();
+    }
+}
+
 void CarInterface::on_idBox_valueChanged(int arg1)
 {
     if (mMap) {
@@ -762,7 +898,9 @@ void CarInterface::on_confReadDefaultButton_clicked()
 void CarInterface::on_confWriteButton_clicked()
 {
     if (mPacketInterface) {
+        // Fields that are not in the GUI keep their last known value
         MAIN_CONFIG conf;
+        mPacketInterface->getCachedConfiguration(mId, conf);
         getConfGui(conf);
         ui->confWriteButton->setEnabled(false);
         bool ok = mPacketInterface->setConfiguration(mId, conf, 5);
@@ -780,6 +918,7 @@ void CarInterface::getConfGui(MAIN_CONFIG &conf)
     conf.car.yaw_use_odometry = ui->confOdometryYawBox->isChecked();
     conf.car.yaw_imu_gain = ui->confYawImuGainBox->value();
     conf.car.disable_motor = ui->confMiscDisableMotorBox->isChecked();
+    conf.car.odometry_from_status = ui->confOdometryStatusBox->isChecked();
 
     conf.car.gear_ratio = ui->confGearRatioBox->value();
     conf.car.wheel_diam = ui->confWheelDiamBox->value();
@@ -799,6 +938,7 @@ void CarInterface::setConfGui(MAIN_CONFIG &conf)
     ui->confOdometryYawBox->setChecked(conf.car.yaw_use_odometry);
     ui->confYawImuGainBox->setValue(conf.car.yaw_imu_gain);
     ui->confMiscDisableMotorBox->setChecked(conf.car.disable_motor);
+    ui->confOdometryStatusBox->setChecked(conf.car.odometry_from_status);
 
     ui->confGearRatioBox->setValue(conf.car.gear_ratio);
     ui->confWheelDiamBox->setValue(conf.car.wheel_diam);
@@ -869,6 +1009,42 @@ void CarInterface::plotDwData()
     ui->dwPlot->replot();
 }
 
+/**
+ * @brief CarInterface::updateTraceSummary
+ * Print the latency summary to the terminal. If nothing was printed after
+ * the previous summary of this trace it is replaced, so that the histograms
+ * update in place while tracing.
+ */
+void CarInterface::updateTraceSummary()
+{
+    QTextDocument *doc = ui->terminalBrowser->document();
+    QString summary = mTracer->summary().trimmed();
+
+    if (mTraceSummaryPos >= 0 && doc->characterCount() == mTraceSummaryEnd) {
+        QTextCursor c(doc);
+        c.setPosition(mTraceSummaryPos);
+        c.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+        c.insertText(summary);
+    } else {
+        mTraceSummaryPos = doc->isEmpty() ? 0 : doc->characterCount();
+        ui->terminalBrowser->append(summary);
+    }
+
+    mTraceSummaryEnd = doc->characterCount();
+    mTraceSummaryCount = mTracer->traceCount();
+}
+
+void CarInterface::updateMultilatAnchors()
+{
+    mMultilat.clearAnchors();
+    mMultilat.setAnchor(ui->dwAnch0IdBox->value(), ui->dwAnch0PxBox->value(),
+                        ui->dwAnch0PyBox->value(), ui->dwAnch0PzBox->value());
+    mMultilat.setAnchor(ui->dwAnch1IdBox->value(), ui->dwAnch1PxBox->value(),
+                        ui->dwAnch1PyBox->value(), ui->dwAnch1PzBox->value());
+    mMultilat.setAnchor(ui->dwAnch2IdBox->value(), ui->dwAnch2PxBox->value(),
+                        ui->dwAnch2PyBox->value(), ui->dwAnch2PzBox->value());
+}
+
 void CarInterface::on_radarReadButton_clicked()
 {
     if (mPacketInterface) {
@@ -982,5 +1158,6 @@ void CarInterface::on_dwAnch2GetButton_clicked()
 void CarInterface::on_dwClearSamplesButton_clicked()
 {
     mDwData.clear();
+    mMultilat.reset();
     plotDwData();
 }
@@ -26,6 +26,8 @@
 #include "mapwidget.h"
 #include "packetinterface.h"
 #include "tcpserversimple.h"
+#include "latencytracer.h"
+#include "multilateration.h"
 
 #ifdef HAS_OPENGL
 #include "orientationwidget.h"
@@ -63,6 +65,7 @@ signals:
     void setRcDuty(quint8 id, double duty, double steering);
     void showStatusInfo(QString str, bool isGood);
     void setServoDirect(quint8 id, double value);
+    void setImuCapture(quint8 id, bool enabled, int decimation);
 
 private slots:
     void timerSlot();
@@ -79,6 +82,10 @@ private slots:
     void radarSetupReceived(quint8 id, radar_settings_t s);
     void radarSamplesReceived(quint8 id, QVector<QPair<double, double> > samples);
     void dwSampleReceived(quint8 id, DW_LOG_INFO dw);
+    void traceReceived(quint8 id, TRACE_INFO trace);
+    void statsReceived(quint8 id, FW_STATS stats);
+    void imuSamplesReceived(quint8 id, QVector<IMU_SAMPLE> samples, quint32 dropped);
+    void imuCaptureChanged(bool enabled, int decimation);
     void updateAnchorsMap();
     void loadMagCal();
 
@@ -86,6 +93,8 @@ private slots:
     void on_terminalSendVescButton_clicked();
     void on_terminalSendRadarButton_clicked();
     void on_terminalClearButton_clicked();
+    void on_terminalTraceButton_toggled(bool checked);
+    void on_terminalStatsButton_clicked();
     void on_idBox_valueChanged(int arg1);
     void on_bldcToolUdpBox_toggled(bool checked);
     void on_vescToolTcpBox_toggled(bool checked);
@@ -128,10 +137,20 @@ private:
     quint16 mUdpPort;
     TcpServerSimple *mTcpServer;
     bool mExperimentReplot;
+    LatencyTracer *mTracer;
+    quint32 mTraceId;
+    int mTraceTimer;
+    int mTraceSummaryTimer;
+    int mTraceSummaryCount;
+    int mTraceSummaryPos;
+    int mTraceSummaryEnd;
+    Multilateration mMultilat;
 
     void getConfGui(MAIN_CONFIG &conf);
     void setConfGui(MAIN_CONFIG &conf);
     void plotDwData();
+    void updateMultilatAnchors();
+    void updateTraceSummary();
 
 };
 
@@ -61,6 +61,9 @@ void ConfCommonWidget::getConfGui(MAIN_CONFIG &conf)
     conf.gps_send_nmea = ui->confGpsSendNmeaBox->isChecked();
     conf.gps_use_ubx_info = ui->confGpsUbxUseInfoBox->isChecked();
     conf.gps_ubx_max_acc = ui->confGpsUbxMaxAccBox->value();
+    conf.gps_use_mb_heading = ui->confGpsMbHeadingBox->isChecked();
+    conf.gps_mb_baseline = ui->confGpsMbBaselineBox->value();
+    conf.gps_mb_yaw_offset = ui->confGpsMbYawOffsetBox->value();
 
     conf.ap_repeat_routes = ui->confApRepeatBox->isChecked();
     conf.ap_base_rad = ui->confApBaseRadBox->value();
@@ -101,6 +104,9 @@ void ConfCommonWidget::setConfGui(const MAIN_CONFIG &conf)
     ui->confGpsSendNmeaBox->setChecked(conf.gps_send_nmea);
     ui->confGpsUbxUseInfoBox->setChecked(conf.gps_use_ubx_info);
     ui->confGpsUbxMaxAccBox->setValue(conf.gps_ubx_max_acc);
+    ui->confGpsMbHeadingBox->setChecked(conf.gps_use_mb_heading);
+    ui->confGpsMbBaselineBox->setValue(conf.gps_mb_baseline);
+    ui->confGpsMbYawOffsetBox->setValue(conf.gps_mb_yaw_offset);
 
     ui->confApRepeatBox->setChecked(conf.ap_repeat_routes);
     ui->confApBaseRadBox->setValue(conf.ap_base_rad);
@@ -342,7 +342,9 @@ void CopterInterface::on_terminalSendButton_clicked()
 void CopterInterface::on_confWriteButton_clicked()
 {
     if (mPacketInterface) {
+        // Fields that are not in the GUI keep their last known value
         MAIN_CONFIG conf;
+        mPacketInterface->getCachedConfiguration(mId, conf);
         getConfGui(conf);
         ui->confWriteButton->setEnabled(false);
         bool ok = mPacketInterface->setConfiguration(mId, conf, 5);
@@ -413,6 +415,7 @@ void CopterInterface::getConfGui(MAIN_CONFIG &conf)
     conf.mr.ctrl_gain_alt_p = ui->confCtrlGainAltPBox->value();
     conf.mr.ctrl_gain_alt_i = ui->confCtrlGainAltIBox->value();
     conf.mr.ctrl_gain_alt_d = ui->confCtrlGainAltDBox->value();
+    conf.mr.ap_enabled = ui->confApEnabledBox->isChecked();
 
     conf.mr.js_gain_tilt = ui->confJsGainTiltBox->value();
     conf.mr.js_gain_yaw = ui->confJsGainYawBox->value();
@@ -474,6 +477,7 @@ void CopterInterface::setConfGui(MAIN_CONFIG &conf)
     ui->confCtrlGainAltPBox->setValue(conf.mr.ctrl_gain_alt_p);
     ui->confCtrlGainAltIBox->setValue(conf.mr.ctrl_gain_alt_i);
     ui->confCtrlGainAltDBox->setValue(conf.mr.ctrl_gain_alt_d);
+    ui->confApEnabledBox->setChecked(conf.mr.ap_enabled);
 
     ui->confJsGainTiltBox->setValue(conf.mr.js_gain_tilt);
     ui->confJsGainYawBox->setValue(conf.mr.js_gain_yaw);
@@ -20,9 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-// Sizes
-#define LOG_NAME_MAX_LEN			20
+#include "mainconfigtypes.h"
 
 // Packet IDs
 #define ID_ALL						255
@@ -75,6 +73,17 @@ typedef struct {
     int32_t ms_today;
 } CAR_STATE;
 
+// The compact pose from CMD_POSE
+typedef struct {
+    int32_t ms_today;
+    double px;
+    double py;
+    double speed;
+    double yaw;
+    double roll;
+    double pitch;
+} CAR_POSE;
+
 typedef struct {
     uint8_t fw_major;
     uint8_t fw_minor;
@@ -94,6 +103,7 @@ typedef struct {
     double ap_goal_px;
     double ap_goal_py;
     int32_t ms_today;
+    double vz;
 } MULTIROTOR_STATE;
 
 typedef enum {
@@ -103,138 +113,13 @@ typedef enum {
     MOTE_PACKET_PROCESS_SHORT_BUFFER,
 } MOTE_PACKET;
 
-typedef struct {
-    bool yaw_use_odometry; // Use odometry data for yaw angle correction.
-    float yaw_imu_gain; // Gain for yaw angle from IMU (vs odometry)
-    bool disable_motor; // Disable motor drive commands to make sure that the motor does not move.
-
-    float gear_ratio;
-    float wheel_diam;
-    float motor_poles;
-    float steering_max_angle_rad; // = arctan(axist_distance / turn_radius_at_maximum_steering_angle)
-    float steering_center;
-    float steering_range;
-    float steering_ramp_time; // Ramp time constant for the steering servo in seconds
-    float axis_distance;
-} MAIN_CONFIG_CAR;
-
-typedef struct {
-    // Dead reckoning
-    float vel_decay_e;
-    float vel_decay_l;
-    float vel_max;
-    float map_min_x;
-    float map_max_x;
-    float map_min_y;
-    float map_max_y;
-
-    // State correction for dead reckoning
-    float vel_gain_p;
-    float vel_gain_i;
-    float vel_gain_d;
-
-    float tilt_gain_p;
-    float tilt_gain_i;
-    float tilt_gain_d;
-
-    float max_corr_error;
-    float max_tilt_error;
-
-    // Attitude controller
-    float ctrl_gain_roll_p;
-    float ctrl_gain_roll_i;
-    float ctrl_gain_roll_dp;
-    float ctrl_gain_roll_de;
-
-    float ctrl_gain_pitch_p;
-    float ctrl_gain_pitch_i;
-    float ctrl_gain_pitch_dp;
-    float ctrl_gain_pitch_de;
-
-    float ctrl_gain_yaw_p;
-    float ctrl_gain_yaw_i;
-    float ctrl_gain_yaw_dp;
-    float ctrl_gain_yaw_de;
-
-    // Position controller
-    float ctrl_gain_pos_p;
-    float ctrl_gain_pos_i;
-    float ctrl_gain_pos_d;
-
-    // Altitude controller
-    float ctrl_gain_alt_p;
-    float ctrl_gain_alt_i;
-    float ctrl_gain_alt_d;
-
-    // Joystick gain
-    float js_gain_tilt;
-    float js_gain_yaw;
-    bool js_mode_rate;
-
-    // Motor mapping and configuration
-    int8_t motor_fl_f; // x: Front Left  +: Front
-    int8_t motor_bl_l; // x: Back Left   +: Left
-    int8_t motor_fr_r; // x: Front Right +: Right
-    int8_t motor_br_b; // x: Back Right  +: Back
-    bool motors_x; // Use x motor configuration (use + if false)
-    bool motors_cw; // Front left (or front in + mode) runs in the clockwise direction (ccw if false)
-    uint16_t motor_pwm_min_us; // Minimum servo pulse length for motor in microseconds
-    uint16_t motor_pwm_max_us; // Maximum servo pulse length for motor in microseconds
-} MAIN_CONFIG_MULTIROTOR;
-
-// Car configuration
-typedef struct {
-    // Common vehicle settings
-    bool mag_use; // Use the magnetometer
-    bool mag_comp; // Should be 0 when capturing samples for the calibration
-    float yaw_mag_gain; // Gain for yaw angle from magnetomer (vs gyro)
-
-    // Magnetometer calibration
-    float mag_cal_cx;
-    float mag_cal_cy;
-    float mag_cal_cz;
-    float mag_cal_xx;
-    float mag_cal_xy;
-    float mag_cal_xz;
-    float mag_cal_yx;
-    float mag_cal_yy;
-    float mag_cal_yz;
-    float mag_cal_zx;
-    float mag_cal_zy;
-    float mag_cal_zz;
-
-    // GPS parameters
-    float gps_ant_x; // Antenna offset from vehicle center in X
-    float gps_ant_y; // Antenna offset from vehicle center in Y
-    bool gps_comp; // Use GPS position correction
-    bool gps_req_rtk; // Require RTK solution
-    float gps_corr_gain_stat; // Static GPS correction gain
-    float gps_corr_gain_dyn; // Dynamic GPS correction gain
-    float gps_corr_gain_yaw; // Gain for yaw correction
-    bool gps_send_nmea; // Send NMEA data for logging and debugging
-    bool gps_use_ubx_info; // Use info about the ublox solution
-    float gps_ubx_max_acc; // Maximum ublox accuracy to use solution (m, higher = worse)
-
-    // Autopilot parameters
-    bool ap_repeat_routes; // Repeat the same route when the end is reached
-    float ap_base_rad; // Radius around car at 0 speed
-    bool ap_mode_time; // Drive to route points based on timestamps instead of speed
-    float ap_max_speed; // Maximum allowed speed for autopilot
-    int32_t ap_time_add_repeat_ms; // Time to add to each point for each repetition of the route
-
-    // Logging
-    bool log_en;
-    char log_name[LOG_NAME_MAX_LEN + 1];
-
-    MAIN_CONFIG_CAR car;
-    MAIN_CONFIG_MULTIROTOR mr;
-} MAIN_CONFIG;
-
 // Commands
 typedef enum {
     // General commands
     CMD_PRINTF = 0,
     CMD_TERMINAL_CMD,
+    CMD_TRACE,
+    CMD_GET_STATS,
 
     // Common vehicle commands
     CMD_VESC_FWD = 50,
@@ -267,11 +152,19 @@ typedef enum {
     CMD_SET_MAIN_CONFIG,
     CMD_GET_MAIN_CONFIG,
     CMD_GET_MAIN_CONFIG_DEFAULT,
+    CMD_IMU_CAPTURE_SET,
+    CMD_IMU_CAPTURE_DATA,
+    CMD_GET_MAIN_CONFIG_HASH,
+    CMD_GET_MAIN_CONFIG_FIELDS,
+    CMD_SET_MAIN_CONFIG_FIELDS,
+    CMD_SET_POSE_STREAM,
+    CMD_POSE,
 
     // Car commands
     CMD_GET_STATE = 120,
     CMD_RC_CONTROL,
     CMD_SET_SERVO_DIRECT,
+    CMD_GEOFENCE_SET,
 
     // Multirotor commands
     CMD_MR_GET_STATE = 160,
@@ -284,6 +177,68 @@ typedef enum {
     CMD_MOTE_UBX_BASE_STATUS
 } CMD_PACKET;
 
+// Latency trace hops. Every node that handles a CMD_TRACE packet appends
+// the hop id followed by a 32-bit microsecond timestamp from its own clock.
+typedef enum {
+    TRACE_HOP_STATION_TX = 0,
+    TRACE_HOP_CLIENT_RX,
+    TRACE_HOP_CLIENT_TX,
+    TRACE_HOP_FW_RX,
+    TRACE_HOP_FW_TX,
+    TRACE_HOP_CLIENT_RX_RESP,
+    TRACE_HOP_CLIENT_TX_RESP,
+    TRACE_HOP_STATION_RX
+} TRACE_HOP;
+
+// Queues with high-water mark tracking in the firmware statistics
+typedef enum {
+    STATS_QUEUE_UBLOX_RX = 0,
+    STATS_QUEUE_CAN_RX,
+    STATS_QUEUE_CC2520_TX,
+    STATS_QUEUE_CC1120_TX,
+    STATS_QUEUE_IMU_CAPTURE,
+    STATS_QUEUE_NUM
+} STATS_QUEUE;
+
+typedef struct {
+    char name[20];
+    float load; // Fraction of the CPU time
+} FW_STATS_THREAD;
+
+typedef struct {
+    uint8_t cmd;
+    uint32_t count;
+    float time_avg_us;
+    float time_max_us;
+} FW_STATS_CMD;
+
+typedef struct {
+    uint32_t uptime_ms;
+    uint32_t rtcm_bytes;
+    int queue_num;
+    uint16_t queue_hwm[STATS_QUEUE_NUM];
+    uint16_t queue_size[STATS_QUEUE_NUM];
+    uint32_t queue_overflows[STATS_QUEUE_NUM];
+    int thread_num;
+    FW_STATS_THREAD threads[32];
+    int cmd_num;
+    FW_STATS_CMD cmds[256];
+} FW_STATS;
+
+typedef struct {
+    uint32_t trace_id;
+    uint32_t hop_valid; // Bitmask of the hops that were received
+    uint32_t hop_time[TRACE_HOP_STATION_RX + 1]; // Microseconds, local clock of each hop
+} TRACE_INFO;
+
+// Raw IMU sample from the capture stream, scaled to physical units
+typedef struct {
+    double time; // Seconds since the capture was started
+    double accel[3]; // G
+    double gyro[3]; // deg/s
+    double mag[3]; // uT, without hard and soft iron compensation
+} IMU_SAMPLE;
+
 // RC control modes
 typedef enum {
     RC_MODE_CURRENT = 0,
@@ -343,7 +298,7 @@ typedef struct {
     double P[2];        // Pseudorange observation
     double L[2];        // Carrier phase observation
     uint8_t cn0[2];     // Carrier-to-Noise density [dB Hz]
-    uint8_t lock[2];    // Lock. Set to 0 when the lock has changed, 127 otherwise. TODO: is this correct?
+    uint8_t lock[2];    // Lock time indicator (RTCM DF013/DF043). 0 after a slip, 127 after 937 s of lock
     uint8_t prn;        // Sattelite
     uint8_t freq;       // Frequency slot (GLONASS)
     uint8_t code[2];    // Code indicator
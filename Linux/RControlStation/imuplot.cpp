@@ -17,6 +17,30 @@
 
 #include "imuplot.h"
 #include "ui_imuplot.h"
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QTextStream>
+#include <cmath>
+
+namespace {
+// Number of CAR_STATE samples to keep
+const int stateRingSize = 1000;
+// Number of captured samples to keep, two minutes at 1 kHz
+const int captureRingSize = 120000;
+// Length of the captured data that is plotted, in seconds
+const double captureWindow = 10.0;
+
+double sampleValue(const IMU_SAMPLE &s, int ch)
+{
+    if (ch < 3) {
+        return s.accel[ch];
+    } else if (ch < 6) {
+        return s.gyro[ch - 3];
+    } else {
+        return s.mag[ch - 6];
+    }
+}
+}
 
 ImuPlot::ImuPlot(QWidget *parent) :
     QWidget(parent),
@@ -25,20 +49,12 @@ ImuPlot::ImuPlot(QWidget *parent) :
     ui->setupUi(this);
     layout()->setContentsMargins(0, 0, 0, 0);
 
-    mMaxSampleSize = 1000;
-    mAccelXData.resize(mMaxSampleSize);
-    mAccelYData.resize(mMaxSampleSize);
-    mAccelZData.resize(mMaxSampleSize);
-    mGyroXData.resize(mMaxSampleSize);
-    mGyroYData.resize(mMaxSampleSize);
-    mGyroZData.resize(mMaxSampleSize);
-    mMagXData.resize(mMaxSampleSize);
-    mMagYData.resize(mMaxSampleSize);
-    mMagZData.resize(mMaxSampleSize);
-    mAccelGyroMagXAxis.resize(mMaxSampleSize);
-    for(int i = 0;i < mAccelGyroMagXAxis.size();i++) {
-        mAccelGyroMagXAxis[mAccelGyroMagXAxis.size() - i - 1] = (40.0 / 1000.0 * i);
-    }
+    ringInit(mStateRing, stateRingSize);
+    ringInit(mCaptureRing, captureRingSize);
+    mCaptureDropped = 0;
+    mCaptureNum = 0;
+    mMaxPlotPoints = 2000;
+    mElapsed.start();
 
     ui->accelPlot->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
     ui->gyroPlot->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
@@ -48,15 +64,15 @@ ImuPlot::ImuPlot(QWidget *parent) :
     ui->accelPlot->addGraph();
     ui->accelPlot->xAxis->setRangeReversed(true);
     ui->accelPlot->graph()->setPen(QPen(Qt::black));
-    ui->accelPlot->graph()->setData(mAccelGyroMagXAxis, mAccelXData);
+    ui->accelPlot->graph()->setData(mPlotX[0], mPlotY[0]);
     ui->accelPlot->graph()->setName(tr("X"));
     ui->accelPlot->addGraph();
     ui->accelPlot->graph()->setPen(QPen(Qt::green));
-    ui->accelPlot->graph()->setData(mAccelGyroMagXAxis, mAccelYData);
+    ui->accelPlot->graph()->setData(mPlotX[1], mPlotY[1]);
     ui->accelPlot->graph()->setName(tr("Y"));
     ui->accelPlot->addGraph();
     ui->accelPlot->graph()->setPen(QPen(Qt::blue));
-    ui->accelPlot->graph()->setData(mAccelGyroMagXAxis, mAccelZData);
+    ui->accelPlot->graph()->setData(mPlotX[2], mPlotY[2]);
     ui->accelPlot->graph()->setName(tr("Z"));
     ui->accelPlot->rescaleAxes();
     ui->accelPlot->xAxis->setLabel("Seconds");
@@ -68,15 +84,15 @@ ImuPlot::ImuPlot(QWidget *parent) :
     ui->gyroPlot->addGraph();
     ui->gyroPlot->xAxis->setRangeReversed(true);
     ui->gyroPlot->graph()->setPen(QPen(Qt::black));
-    ui->gyroPlot->graph()->setData(mAccelGyroMagXAxis, mGyroXData);
+    ui->gyroPlot->graph()->setData(mPlotX[3], mPlotY[3]);
     ui->gyroPlot->graph()->setName(tr("X"));
     ui->gyroPlot->addGraph();
     ui->gyroPlot->graph()->setPen(QPen(Qt::green));
-    ui->gyroPlot->graph()->setData(mAccelGyroMagXAxis, mGyroYData);
+    ui->gyroPlot->graph()->setData(mPlotX[4], mPlotY[4]);
     ui->gyroPlot->graph()->setName(tr("Y"));
     ui->gyroPlot->addGraph();
     ui->gyroPlot->graph()->setPen(QPen(Qt::blue));
-    ui->gyroPlot->graph()->setData(mAccelGyroMagXAxis, mGyroZData);
+    ui->gyroPlot->graph()->setData(mPlotX[5], mPlotY[5]);
     ui->gyroPlot->graph()->setName(tr("Z"));
     ui->gyroPlot->rescaleAxes();
     ui->gyroPlot->xAxis->setLabel("Seconds");
@@ -88,15 +104,15 @@ ImuPlot::ImuPlot(QWidget *parent) :
     ui->magPlot->addGraph();
     ui->magPlot->xAxis->setRangeReversed(true);
     ui->magPlot->graph()->setPen(QPen(Qt::black));
-    ui->magPlot->graph()->setData(mAccelGyroMagXAxis, mMagXData);
+    ui->magPlot->graph()->setData(mPlotX[6], mPlotY[6]);
     ui->magPlot->graph()->setName(tr("X"));
     ui->magPlot->addGraph();
     ui->magPlot->graph()->setPen(QPen(Qt::green));
-    ui->magPlot->graph()->setData(mAccelGyroMagXAxis, mMagYData);
+    ui->magPlot->graph()->setData(mPlotX[7], mPlotY[7]);
     ui->magPlot->graph()->setName(tr("Y"));
     ui->magPlot->addGraph();
     ui->magPlot->graph()->setPen(QPen(Qt::blue));
-    ui->magPlot->graph()->setData(mAccelGyroMagXAxis, mMagZData);
+    ui->magPlot->graph()->setData(mPlotX[8], mPlotY[8]);
     ui->magPlot->graph()->setName(tr("Z"));
     ui->magPlot->rescaleAxes();
     ui->magPlot->xAxis->setLabel("Seconds");
@@ -118,51 +134,285 @@ ImuPlot::~ImuPlot()
 
 void ImuPlot::addSample(double *accel, double *gyro, double *mag)
 {
-    mAccelXData.append(accel[0]);
-    mAccelXData.remove(0, 1);
-    mAccelYData.append(accel[1]);
-    mAccelYData.remove(0, 1);
-    mAccelZData.append(accel[2]);
-    mAccelZData.remove(0, 1);
-
-    mGyroXData.append(gyro[0] * 180.0 / M_PI);
-    mGyroXData.remove(0, 1);
-    mGyroYData.append(gyro[1] * 180.0 / M_PI);
-    mGyroYData.remove(0, 1);
-    mGyroZData.append(gyro[2] * 180.0 / M_PI);
-    mGyroZData.remove(0, 1);
-
-    mMagXData.append(mag[0]);
-    mMagXData.remove(0, 1);
-    mMagYData.append(mag[1]);
-    mMagYData.remove(0, 1);
-    mMagZData.append(mag[2]);
-    mMagZData.remove(0, 1);
+    IMU_SAMPLE s;
+    s.time = (double)mElapsed.elapsed() / 1000.0;
+
+    for (int i = 0;i < 3;i++) {
+        s.accel[i] = accel[i];
+        s.gyro[i] = gyro[i] * 180.0 / M_PI;
+        s.mag[i] = mag[i];
+    }
 
+    ringAppend(mStateRing, s);
     mImuReplot = true;
 }
 
+/**
+ * @brief ImuPlot::addCaptureSamples
+ * Add samples from the high rate capture stream. The plot only shows a
+ * decimated version of the last seconds, but all samples in the capture
+ * buffer can be saved to a file.
+ *
+ * @param samples
+ * The samples, in the order they were taken.
+ *
+ * @param dropped
+ * The number of samples the firmware has dropped since the capture was
+ * started.
+ */
+void ImuPlot::addCaptureSamples(const QVector<IMU_SAMPLE> &samples, quint32 dropped)
+{
+    for (const IMU_SAMPLE &s: samples) {
+        // The firmware restarts the time when a new capture is started
+        if (mCaptureRing.num > 0 &&
+                s.time < ringAt(mCaptureRing, mCaptureRing.num - 1).time) {
+            ringClear(mCaptureRing);
+        }
+
+        ringAppend(mCaptureRing, s);
+    }
+
+    mCaptureDropped = dropped;
+    mCaptureNum += samples.size();
+    updateCaptureLabel();
+    mImuReplot = true;
+}
+
+/**
+ * @brief ImuPlot::saveCapture
+ * Save the capture buffer as tab separated text, with one sample per line.
+ *
+ * @param path
+ * The file to write.
+ *
+ * @return
+ * True on success.
+ */
+bool ImuPlot::saveCapture(QString path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream out(&file);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(6);
+
+    out << "# time (s)\tacc x\tacc y\tacc z (G)\t"
+           "gyro x\tgyro y\tgyro z (deg/s)\tmag x\tmag y\tmag z (uT)\n";
+
+    for (int i = 0;i < mCaptureRing.num;i++) {
+        const IMU_SAMPLE &s = ringAt(mCaptureRing, i);
+        out << s.time;
+        for (int ch = 0;ch < 9;ch++) {
+            out << "\t" << sampleValue(s, ch);
+        }
+        out << "\n";
+    }
+
+    file.close();
+    return true;
+}
+
 void ImuPlot::timerSlot()
 {
     if (mImuReplot) {
-        ui->accelPlot->graph(0)->setData(mAccelGyroMagXAxis, mAccelXData);
-        ui->accelPlot->graph(1)->setData(mAccelGyroMagXAxis, mAccelYData);
-        ui->accelPlot->graph(2)->setData(mAccelGyroMagXAxis, mAccelZData);
+        if (ui->captureBox->isChecked() && mCaptureRing.num > 0) {
+            updatePlotData(mCaptureRing, captureWindow);
+        } else {
+            updatePlotData(mStateRing, 1e9);
+        }
+
+        for (int i = 0;i < 3;i++) {
+            ui->accelPlot->graph(i)->setData(mPlotX[i], mPlotY[i]);
+            ui->gyroPlot->graph(i)->setData(mPlotX[i + 3], mPlotY[i + 3]);
+            ui->magPlot->graph(i)->setData(mPlotX[i + 6], mPlotY[i + 6]);
+        }
+
         ui->accelPlot->rescaleAxes();
         ui->accelPlot->replot();
-
-        ui->gyroPlot->graph(0)->setData(mAccelGyroMagXAxis, mGyroXData);
-        ui->gyroPlot->graph(1)->setData(mAccelGyroMagXAxis, mGyroYData);
-        ui->gyroPlot->graph(2)->setData(mAccelGyroMagXAxis, mGyroZData);
         ui->gyroPlot->rescaleAxes();
         ui->gyroPlot->replot();
-
-        ui->magPlot->graph(0)->setData(mAccelGyroMagXAxis, mMagXData);
-        ui->magPlot->graph(1)->setData(mAccelGyroMagXAxis, mMagYData);
-        ui->magPlot->graph(2)->setData(mAccelGyroMagXAxis, mMagZData);
         ui->magPlot->rescaleAxes();
         ui->magPlot->replot();
 
         mImuReplot = false;
     }
 }
+
+void ImuPlot::on_captureBox_toggled(bool checked)
+{
+    if (checked) {
+        on_captureClearButton_clicked();
+    }
+
+    emit captureChanged(checked, ui->captureDecimationBox->value());
+    mImuReplot = true;
+}
+
+void ImuPlot::on_captureDecimationBox_valueChanged(int arg1)
+{
+    if (ui->captureBox->isChecked()) {
+        emit captureChanged(true, arg1);
+    }
+}
+
+void ImuPlot::on_captureClearButton_clicked()
+{
+    ringClear(mCaptureRing);
+    mCaptureDropped = 0;
+    mCaptureNum = 0;
+    updateCaptureLabel();
+    mImuReplot = true;
+}
+
+void ImuPlot::on_captureSaveButton_clicked()
+{
+    QString path;
+    path = QFileDialog::getSaveFileName(this, tr("Choose where to save the IMU samples"));
+    if (path.isNull()) {
+        return;
+    }
+
+    if (!saveCapture(path)) {
+        QMessageBox::warning(this, "IMU Capture",
+                             "Could not open file.");
+    }
+}
+
+void ImuPlot::ringInit(SampleRing &ring, int size)
+{
+    ring.samples.resize(size);
+    ringClear(ring);
+}
+
+void ImuPlot::ringClear(SampleRing &ring)
+{
+    ring.head = 0;
+    ring.num = 0;
+}
+
+void ImuPlot::ringAppend(SampleRing &ring, const IMU_SAMPLE &sample)
+{
+    const int size = ring.samples.size();
+
+    if (ring.num < size) {
+        ring.samples[(ring.head + ring.num) % size] = sample;
+        ring.num++;
+    } else {
+        ring.samples[ring.head] = sample;
+        ring.head = (ring.head + 1) % size;
+    }
+}
+
+const IMU_SAMPLE &ImuPlot::ringAt(const SampleRing &ring, int ind)
+{
+    return ring.samples[(ring.head + ind) % ring.samples.size()];
+}
+
+/**
+ * @brief ImuPlot::updatePlotData
+ * Build the plot data for the last part of a sample ring. When there are
+ * more samples than can be drawn, the samples are split into buckets and
+ * only the minimum and maximum of each bucket are kept, so that short peaks
+ * remain visible.
+ *
+ * @param ring
+ * The samples to plot.
+ *
+ * @param window
+ * The time in seconds before the last sample to plot.
+ */
+void ImuPlot::updatePlotData(const SampleRing &ring, double window)
+{
+    for (int ch = 0;ch < 9;ch++) {
+        mPlotX[ch].clear();
+        mPlotY[ch].clear();
+    }
+
+    if (ring.num == 0) {
+        return;
+    }
+
+    const double timeLast = ringAt(ring, ring.num - 1).time;
+
+    // First sample in the window
+    int first = 0;
+    int last = ring.num - 1;
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if (ringAt(ring, mid).time < (timeLast - window)) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+
+    const int num = ring.num - first;
+
+    if (num <= mMaxPlotPoints) {
+        for (int i = first;i < ring.num;i++) {
+            const IMU_SAMPLE &s = ringAt(ring, i);
+            for (int ch = 0;ch < 9;ch++) {
+                mPlotX[ch].append(timeLast - s.time);
+                mPlotY[ch].append(sampleValue(s, ch));
+            }
+        }
+        return;
+    }
+
+    const int buckets = mMaxPlotPoints / 2;
+
+    for (int b = 0;b < buckets;b++) {
+        int start = first + (int)((qint64)num * b / buckets);
+        int end = first + (int)((qint64)num * (b + 1) / buckets);
+
+        for (int ch = 0;ch < 9;ch++) {
+            int indMin = start;
+            int indMax = start;
+            double valMin = sampleValue(ringAt(ring, start), ch);
+            double valMax = valMin;
+
+            for (int i = start + 1;i < end;i++) {
+                double val = sampleValue(ringAt(ring, i), ch);
+                if (val < valMin) {
+                    valMin = val;
+                    indMin = i;
+                } else if (val > valMax) {
+                    valMax = val;
+                    indMax = i;
+                }
+            }
+
+            int ind0 = qMin(indMin, indMax);
+            int ind1 = qMax(indMin, indMax);
+
+            mPlotX[ch].append(timeLast - ringAt(ring, ind0).time);
+            mPlotY[ch].append(sampleValue(ringAt(ring, ind0), ch));
+
+            if (ind1 != ind0) {
+                mPlotX[ch].append(timeLast - ringAt(ring, ind1).time);
+                mPlotY[ch].append(sampleValue(ringAt(ring, ind1), ch));
+            }
+        }
+    }
+}
+
+void ImuPlot::updateCaptureLabel()
+{
+    double rate = 0.0;
+
+    if (mCaptureRing.num > 1) {
+        int first = qMax(0, mCaptureRing.num - 1000);
+        double dt = ringAt(mCaptureRing, mCaptureRing.num - 1).time -
+                ringAt(mCaptureRing, first).time;
+        if (dt > 0.0) {
+            rate = (double)(mCaptureRing.num - 1 - first) / dt;
+        }
+    }
+
+    ui->captureLabel->setText(QString().sprintf("%llu samples, %u dropped, %.0f Hz",
+                                                (unsigned long long)mCaptureNum,
+                                                mCaptureDropped, rate));
+}
@@ -19,6 +19,8 @@
 #define IMUPLOT_H
 
 #include <QWidget>
+#include <QElapsedTimer>
+#include "datatypes.h"
 
 namespace Ui {
 class ImuPlot;
@@ -33,26 +35,48 @@ public:
     ~ImuPlot();
 
     void addSample(double *accel, double *gyro, double *mag);
+    void addCaptureSamples(const QVector<IMU_SAMPLE> &samples, quint32 dropped);
+    bool saveCapture(QString path);
+
+signals:
+    void captureChanged(bool enabled, int decimation);
 
 private slots:
     void timerSlot();
+    void on_captureBox_toggled(bool checked);
+    void on_captureDecimationBox_valueChanged(int arg1);
+    void on_captureClearButton_clicked();
+    void on_captureSaveButton_clicked();
 
 private:
+    // Fixed size sample buffer where the oldest sample is overwritten
+    struct SampleRing {
+        QVector<IMU_SAMPLE> samples;
+        int head; // Index of the oldest sample
+        int num;
+    };
+
     Ui::ImuPlot *ui;
     QTimer *mTimer;
+    QElapsedTimer mElapsed;
     bool mImuReplot;
 
-    QVector<double> mAccelXData;
-    QVector<double> mAccelYData;
-    QVector<double> mAccelZData;
-    QVector<double> mGyroXData;
-    QVector<double> mGyroYData;
-    QVector<double> mGyroZData;
-    QVector<double> mMagXData;
-    QVector<double> mMagYData;
-    QVector<double> mMagZData;
-    QVector<double> mAccelGyroMagXAxis;
-    int mMaxSampleSize;
+    SampleRing mStateRing;
+    SampleRing mCaptureRing;
+    quint32 mCaptureDropped;
+    quint64 mCaptureNum;
+
+    // Plot data for accel xyz, gyro xyz and mag xyz
+    QVector<double> mPlotX[9];
+    QVector<double> mPlotY[9];
+    int mMaxPlotPoints;
+
+    static void ringInit(SampleRing &ring, int size);
+    static void ringClear(SampleRing &ring);
+    static void ringAppend(SampleRing &ring, const IMU_SAMPLE &sample);
+    static const IMU_SAMPLE &ringAt(const SampleRing &ring, int ind);
+    void updatePlotData(const SampleRing &ring, double window);
+    void updateCaptureLabel();
 
 };
 
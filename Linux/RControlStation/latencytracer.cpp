@@ -0,0 +1,333 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "latencytracer.h"
+#include <cmath>
+
+namespace {
+inline bool hopValid(const TRACE_INFO &trace, int hop)
+{
+    return trace.hop_valid & (1 << hop);
+}
+}
+
+LatencyTracer::LatencyTracer(QObject *parent) : QObject(parent)
+{
+    addLeg(TRACE_HOP_STATION_TX, TRACE_HOP_CLIENT_RX, "Station -> Client");
+    addLeg(TRACE_HOP_CLIENT_RX, TRACE_HOP_CLIENT_TX, "Client forward");
+    addLeg(TRACE_HOP_CLIENT_TX, TRACE_HOP_FW_RX, "Client -> FW");
+    addLeg(TRACE_HOP_STATION_TX, TRACE_HOP_FW_RX, "Station -> FW");
+    addLeg(TRACE_HOP_FW_RX, TRACE_HOP_FW_TX, "FW processing");
+    addLeg(TRACE_HOP_FW_TX, TRACE_HOP_CLIENT_RX_RESP, "FW -> Client");
+    addLeg(TRACE_HOP_FW_TX, TRACE_HOP_STATION_RX, "FW -> Station");
+    addLeg(TRACE_HOP_CLIENT_RX_RESP, TRACE_HOP_CLIENT_TX_RESP, "Client return");
+    addLeg(TRACE_HOP_CLIENT_TX_RESP, TRACE_HOP_STATION_RX, "Client -> Station");
+    addLeg(TRACE_HOP_STATION_TX, TRACE_HOP_STATION_RX, "Total");
+
+    reset();
+}
+
+/**
+ * @brief LatencyTracer::addTrace
+ * Add a returned trace. The clock offsets of the client and the firmware are
+ * estimated NTP-style from the request and response timestamps of each link,
+ * using the sample with the lowest round trip time among the last few traces.
+ * Each leg between two consecutive hops is then added to its histogram.
+ *
+ * @param trace
+ * The trace, as received by the packet interface.
+ */
+void LatencyTracer::addTrace(const TRACE_INFO &trace)
+{
+    if (!hopValid(trace, TRACE_HOP_STATION_TX) ||
+            !hopValid(trace, TRACE_HOP_STATION_RX)) {
+        return;
+    }
+
+    mTraceCount++;
+
+    bool viaClient = hopValid(trace, TRACE_HOP_CLIENT_RX) &&
+            hopValid(trace, TRACE_HOP_CLIENT_TX_RESP);
+
+    if (viaClient) {
+        updateOffset(LINK_STATION_CLIENT, trace,
+                     TRACE_HOP_STATION_TX, TRACE_HOP_CLIENT_RX,
+                     TRACE_HOP_CLIENT_TX_RESP, TRACE_HOP_STATION_RX);
+        updateOffset(LINK_CLIENT_FW, trace,
+                     TRACE_HOP_CLIENT_TX, TRACE_HOP_FW_RX,
+                     TRACE_HOP_FW_TX, TRACE_HOP_CLIENT_RX_RESP);
+    } else {
+        updateOffset(LINK_STATION_FW, trace,
+                     TRACE_HOP_STATION_TX, TRACE_HOP_FW_RX,
+                     TRACE_HOP_FW_TX, TRACE_HOP_STATION_RX);
+    }
+
+    // Offset of each hop clock relative to the station clock
+    quint32 hopOffset[TRACE_HOP_STATION_RX + 1];
+    bool hopOffsetValid[TRACE_HOP_STATION_RX + 1];
+    offset_sample_t client = {0, 0};
+    offset_sample_t fw = {0, 0};
+    bool clientOk = false;
+    bool fwOk = false;
+
+    if (viaClient) {
+        clientOk = bestOffset(LINK_STATION_CLIENT, client);
+        fwOk = bestOffset(LINK_CLIENT_FW, fw) && clientOk;
+        if (fwOk) {
+            fw.offsetUs = (qint32)((quint32)fw.offsetUs + (quint32)client.offsetUs);
+        }
+    } else {
+        fwOk = bestOffset(LINK_STATION_FW, fw);
+    }
+
+    for (int i = 0;i <= TRACE_HOP_STATION_RX;i++) {
+        switch (i) {
+        case TRACE_HOP_CLIENT_RX:
+        case TRACE_HOP_CLIENT_TX:
+        case TRACE_HOP_CLIENT_RX_RESP:
+        case TRACE_HOP_CLIENT_TX_RESP:
+            hopOffset[i] = client.offsetUs;
+            hopOffsetValid[i] = clientOk;
+            break;
+
+        case TRACE_HOP_FW_RX:
+        case TRACE_HOP_FW_TX:
+            hopOffset[i] = fw.offsetUs;
+            hopOffsetValid[i] = fwOk;
+            break;
+
+        default:
+            hopOffset[i] = 0;
+            hopOffsetValid[i] = true;
+            break;
+        }
+    }
+
+    int last = -1;
+    for (int i = 0;i <= TRACE_HOP_STATION_RX;i++) {
+        if (!hopValid(trace, i)) {
+            continue;
+        }
+
+        for (int j = 0;j < mLegs.size();j++) {
+            leg_t &leg = mLegs[j];
+
+            bool isTotal = leg.from == TRACE_HOP_STATION_TX &&
+                    leg.to == TRACE_HOP_STATION_RX;
+
+            if (leg.to != i || (leg.from != last && !isTotal) ||
+                    !hopOffsetValid[leg.from] || !hopOffsetValid[leg.to]) {
+                continue;
+            }
+
+            qint32 latency = (qint32)(trace.hop_time[leg.to] - trace.hop_time[leg.from] -
+                                      (hopOffset[leg.to] - hopOffset[leg.from]));
+
+            int bin = latency / mBinWidthUs;
+            if (bin < 0) {
+                bin = 0;
+            }
+
+            if (bin < mBinNum) {
+                leg.bins[bin]++;
+            } else {
+                leg.overflow++;
+            }
+
+            if (leg.count == 0 || latency < leg.minUs) {
+                leg.minUs = latency;
+            }
+
+            if (leg.count == 0 || latency > leg.maxUs) {
+                leg.maxUs = latency;
+            }
+
+            leg.count++;
+            leg.sumUs += latency;
+        }
+
+        last = i;
+    }
+}
+
+void LatencyTracer::reset()
+{
+    for (int i = 0;i < mLegs.size();i++) {
+        leg_t &leg = mLegs[i];
+        leg.bins.fill(0, mBinNum);
+        leg.overflow = 0;
+        leg.count = 0;
+        leg.sumUs = 0;
+        leg.minUs = 0;
+        leg.maxUs = 0;
+    }
+
+    for (int i = 0;i <= LINK_STATION_FW;i++) {
+        mOffsetSamples[i].clear();
+    }
+
+    mTraceCount = 0;
+}
+
+int LatencyTracer::traceCount()
+{
+    return mTraceCount;
+}
+
+/**
+ * @brief LatencyTracer::clockOffset
+ * Get the current clock offset estimate of a link.
+ *
+ * @param link
+ * The link.
+ *
+ * @param offsetMs
+ * The offset of the remote clock relative to the local clock. Since all
+ * clocks wrap at 32 bits of microseconds, this is only meaningful modulo
+ * that range.
+ *
+ * @param rttMs
+ * The round trip time of the sample the estimate is based on.
+ *
+ * @return
+ * True if there is an estimate for the link.
+ */
+bool LatencyTracer::clockOffset(TRACE_LINK link, double &offsetMs, double &rttMs)
+{
+    offset_sample_t s;
+    if (!bestOffset(link, s)) {
+        return false;
+    }
+
+    offsetMs = (double)s.offsetUs / 1000.0;
+    rttMs = (double)s.rttUs / 1000.0;
+    return true;
+}
+
+QString LatencyTracer::summary()
+{
+    QString str;
+    str += QString().sprintf("Traces: %d\n", mTraceCount);
+
+    const char *linkNames[] = {"Station-Client", "Client-FW", "Station-FW"};
+    for (int i = 0;i <= LINK_STATION_FW;i++) {
+        double offset, rtt;
+        if (clockOffset((TRACE_LINK)i, offset, rtt)) {
+            str += QString().sprintf("Offset %-15s %12.3f ms (RTT %.3f ms)\n",
+                                     linkNames[i], offset, rtt);
+        }
+    }
+
+    str += QString().sprintf("%-18s %6s %8s %8s %8s %8s %8s %8s\n",
+                             "Leg (ms)", "Count", "Min", "Mean",
+                             "P50", "P95", "P99", "Max");
+
+    for (int i = 0;i < mLegs.size();i++) {
+        const leg_t &leg = mLegs.at(i);
+
+        if (leg.count == 0) {
+            continue;
+        }
+
+        str += QString().sprintf("%-18s %6d %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+                                 leg.name.toLocal8Bit().data(), leg.count,
+                                 (double)leg.minUs / 1000.0,
+                                 (double)leg.sumUs / (double)leg.count / 1000.0,
+                                 (double)percentileUs(leg, 0.5) / 1000.0,
+                                 (double)percentileUs(leg, 0.95) / 1000.0,
+                                 (double)percentileUs(leg, 0.99) / 1000.0,
+                                 (double)leg.maxUs / 1000.0);
+    }
+
+    return str;
+}
+
+void LatencyTracer::addLeg(TRACE_HOP from, TRACE_HOP to, QString name)
+{
+    leg_t leg;
+    leg.from = from;
+    leg.to = to;
+    leg.name = name;
+    mLegs.append(leg);
+}
+
+/**
+ * @brief LatencyTracer::updateOffset
+ * Add an offset sample for a link. t1 and t4 are the request transmit and
+ * response receive time on the local side, t2 and t3 the request receive
+ * and response transmit time on the remote side. The offset is computed as
+ * (t2 - t1) - rtt / 2, which avoids halving a wrapped 32-bit difference.
+ */
+void LatencyTracer::updateOffset(TRACE_LINK link, const TRACE_INFO &trace,
+                                 TRACE_HOP t1, TRACE_HOP t2, TRACE_HOP t3, TRACE_HOP t4)
+{
+    if (!hopValid(trace, t1) || !hopValid(trace, t2) ||
+            !hopValid(trace, t3) || !hopValid(trace, t4)) {
+        return;
+    }
+
+    quint32 up = trace.hop_time[t2] - trace.hop_time[t1];
+    quint32 down = trace.hop_time[t4] - trace.hop_time[t3];
+
+    offset_sample_t s;
+    s.rttUs = (qint32)(up + down);
+    s.offsetUs = (qint32)(up - (quint32)(s.rttUs / 2));
+
+    if (s.rttUs < 0) {
+        return;
+    }
+
+    QVector<offset_sample_t> &samples = mOffsetSamples[link];
+    samples.append(s);
+    while (samples.size() > mOffsetWindow) {
+        samples.removeFirst();
+    }
+}
+
+bool LatencyTracer::bestOffset(TRACE_LINK link, offset_sample_t &sample)
+{
+    const QVector<offset_sample_t> &samples = mOffsetSamples[link];
+
+    if (samples.isEmpty()) {
+        return false;
+    }
+
+    sample = samples.first();
+    for (int i = 1;i < samples.size();i++) {
+        if (samples.at(i).rttUs < sample.rttUs) {
+            sample = samples.at(i);
+        }
+    }
+
+    return true;
+}
+
+qint32 LatencyTracer::percentileUs(const LatencyTracer::leg_t &leg, double p)
+{
+    int target = (int)ceil(p * (double)leg.count);
+    int sum = 0;
+
+    for (int i = 0;i < mBinNum;i++) {
+        sum += leg.bins.at(i);
+        if (sum >= target) {
+            qint32 res = (i + 1) * mBinWidthUs;
+            return res > leg.maxUs ? leg.maxUs : res;
+        }
+    }
+
+    return leg.maxUs;
+}
@@ -0,0 +1,77 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef LATENCYTRACER_H
+#define LATENCYTRACER_H
+
+#include <QObject>
+#include <QVector>
+#include <QString>
+#include "datatypes.h"
+
+class LatencyTracer : public QObject
+{
+    Q_OBJECT
+public:
+    typedef enum {
+        LINK_STATION_CLIENT = 0,
+        LINK_CLIENT_FW,
+        LINK_STATION_FW
+    } TRACE_LINK;
+
+    typedef struct {
+        TRACE_HOP from;
+        TRACE_HOP to;
+        QString name;
+        QVector<int> bins;
+        int overflow;
+        int count;
+        qint64 sumUs;
+        qint32 minUs;
+        qint32 maxUs;
+    } leg_t;
+
+    explicit LatencyTracer(QObject *parent = 0);
+    void addTrace(const TRACE_INFO &trace);
+    void reset();
+    int traceCount();
+    bool clockOffset(TRACE_LINK link, double &offsetMs, double &rttMs);
+    QString summary();
+
+private:
+    typedef struct {
+        qint32 offsetUs;
+        qint32 rttUs;
+    } offset_sample_t;
+
+    static const int mBinWidthUs = 500;
+    static const int mBinNum = 400;
+    static const int mOffsetWindow = 16;
+
+    QVector<leg_t> mLegs;
+    QVector<offset_sample_t> mOffsetSamples[LINK_STATION_FW + 1];
+    int mTraceCount;
+
+    void addLeg(TRACE_HOP from, TRACE_HOP to, QString name);
+    void updateOffset(TRACE_LINK link, const TRACE_INFO &trace,
+                      TRACE_HOP t1, TRACE_HOP t2, TRACE_HOP t3, TRACE_HOP t4);
+    bool bestOffset(TRACE_LINK link, offset_sample_t &sample);
+    qint32 percentileUs(const leg_t &leg, double p);
+
+};
+
+#endif // LATENCYTRACER_H
@@ -0,0 +1,566 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "logloader.h"
+#include "utility.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QDebug>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const quint32 indexMagic = 0x524c4958; // RLIX
+const quint32 indexVersion = 1;
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+inline bool isLineEnd(char c)
+{
+    return c == '\n' || c == '\r';
+}
+
+// Parse a decimal number such as -12.345. The locale is not used, and
+// exponents are not supported since the logger never writes them.
+bool parseNumber(const char *p, const char *end, double &res)
+{
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+
+    double val = 0.0;
+    int digits = 0;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        val = val * 10.0 + (*p++ - '0');
+        digits++;
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        double scale = 0.1;
+        while (p < end && *p >= '0' && *p <= '9') {
+            val += (*p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+
+    if (digits == 0 || p != end) {
+        return false;
+    }
+
+    res = neg ? -val : val;
+    return true;
+}
+
+bool parseInt(const char *p, const char *end, int &res)
+{
+    if (p == end) {
+        return false;
+    }
+
+    int val = 0;
+    while (p < end) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        val = val * 10 + (*p++ - '0');
+    }
+
+    res = val;
+    return true;
+}
+
+// Local time in ISO format, e.g. 2017-03-01T12:34:56. QDateTime is only used
+// once per hour of log, the rest is added from the parsed fields.
+class IsoTimeParser
+{
+public:
+    IsoTimeParser() : mHourKey(-1), mHourMs(0) {}
+
+    bool parse(const char *p, const char *end, qint64 &ms) {
+        if ((end - p) < 19 || p[4] != '-' || p[7] != '-' || p[10] != 'T' ||
+                p[13] != ':' || p[16] != ':') {
+            return false;
+        }
+
+        int y, mo, d, h, mi, s;
+        if (!parseInt(p, p + 4, y) || !parseInt(p + 5, p + 7, mo) ||
+                !parseInt(p + 8, p + 10, d) || !parseInt(p + 11, p + 13, h) ||
+                !parseInt(p + 14, p + 16, mi) || !parseInt(p + 17, p + 19, s)) {
+            return false;
+        }
+
+        qint64 key = ((qint64)y * 10000 + mo * 100 + d) * 100 + h;
+        if (key != mHourKey) {
+            QDateTime date(QDate(y, mo, d), QTime(h, 0, 0));
+            if (!date.isValid()) {
+                return false;
+            }
+            mHourMs = date.toMSecsSinceEpoch();
+            mHourKey = key;
+        }
+
+        ms = mHourMs + (mi * 60 + s) * 1000;
+        return true;
+    }
+
+private:
+    qint64 mHourKey;
+    qint64 mHourMs;
+};
+
+// Split a line into whitespace separated fields
+int splitFields(const char *p, const char *end, const char **start, const char **stop, int max)
+{
+    int num = 0;
+
+    while (p < end && num < max) {
+        while (p < end && isSpace(*p)) {
+            p++;
+        }
+
+        if (p == end) {
+            break;
+        }
+
+        start[num] = p;
+        while (p < end && !isSpace(*p)) {
+            p++;
+        }
+        stop[num] = p;
+        num++;
+    }
+
+    return num;
+}
+
+void reserveColumns(LOG_COLUMNS &cols, int size)
+{
+    cols.timeMs.reserve(size);
+    cols.east.reserve(size);
+    cols.north.reserve(size);
+    cols.up.reserve(size);
+    cols.fixType.reserve(size);
+    cols.dataLen.reserve(size);
+    cols.pingMs.reserve(size);
+}
+}
+
+LogLoader::LogLoader(QObject *parent) : QThread(parent)
+{
+    mZeroEnu = true;
+    mUseIndex = true;
+    mEnuRef[0] = 0.0;
+    mEnuRef[1] = 0.0;
+    mEnuRef[2] = 0.0;
+    mStop = 0;
+
+    qRegisterMetaType<LOG_COLUMNS>("LOG_COLUMNS");
+}
+
+LogLoader::~LogLoader()
+{
+    stop();
+}
+
+/**
+ * @brief LogLoader::load
+ * Start loading a log. A load that is running is stopped first.
+ *
+ * @param path
+ * The log file.
+ *
+ * @param zeroEnu
+ * Use the first sample in the log as ENU reference.
+ *
+ * @param enuRef
+ * ENU reference to use when zeroEnu is false.
+ *
+ * @param useIndex
+ * Read the index file next to the log if it matches the log.
+ */
+void LogLoader::load(const QString &path, bool zeroEnu, const double *enuRef, bool useIndex)
+{
+    stop();
+
+    mPath = path;
+    mZeroEnu = zeroEnu;
+    mUseIndex = useIndex;
+    mEnuRef[0] = enuRef[0];
+    mEnuRef[1] = enuRef[1];
+    mEnuRef[2] = enuRef[2];
+    mStop = 0;
+
+    start(LowPriority);
+}
+
+void LogLoader::stop()
+{
+    mStop = 1;
+    wait();
+}
+
+void LogLoader::appendColumns(LOG_COLUMNS &to, const LOG_COLUMNS &from)
+{
+    to.timeMs += from.timeMs;
+    to.east += from.east;
+    to.north += from.north;
+    to.up += from.up;
+    to.fixType += from.fixType;
+    to.dataLen += from.dataLen;
+    to.pingMs += from.pingMs;
+}
+
+int LogLoader::columnsSize(const LOG_COLUMNS &cols)
+{
+    return cols.timeMs.size();
+}
+
+/**
+ * @brief LogLoader::indexOfTime
+ * Find the first sample at or after a time. The log is written in time
+ * order, so this is a binary search.
+ *
+ * @param cols
+ * The samples.
+ *
+ * @param timeMs
+ * Time in milliseconds since the epoch.
+ *
+ * @return
+ * The index of the sample, or the number of samples if all are before.
+ */
+int LogLoader::indexOfTime(const LOG_COLUMNS &cols, qint64 timeMs)
+{
+    return std::lower_bound(cols.timeMs.constBegin(), cols.timeMs.constEnd(), timeMs) -
+            cols.timeMs.constBegin();
+}
+
+void LogLoader::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(mPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit loadFinished(false, "Could not open " + mPath, false, timer.elapsed());
+        return;
+    }
+
+    QFileInfo info(file);
+    qint64 fileSize = file.size();
+    qint64 modifiedMs = info.lastModified().toMSecsSinceEpoch();
+
+    if (mUseIndex && readIndex(fileSize, modifiedMs)) {
+        emit loadFinished(true, "", true, timer.elapsed());
+        return;
+    }
+
+    if (fileSize == 0) {
+        emit loadFinished(false, "The log is empty", false, timer.elapsed());
+        return;
+    }
+
+    const char *data = (const char*)file.map(0, fileSize);
+    if (!data) {
+        emit loadFinished(false, "Could not map " + mPath, false, timer.elapsed());
+        return;
+    }
+
+    if (mZeroEnu && !parseFirstLlh(data, fileSize, mEnuRef)) {
+        emit loadFinished(false, "No valid samples in the log", false, timer.elapsed());
+        return;
+    }
+
+    emit enuRefUsed(mEnuRef[0], mEnuRef[1], mEnuRef[2]);
+
+    // Split at line boundaries
+    QVector<qint64> bounds;
+    bounds.append(0);
+    for (int i = 1;i < mChunkNum;i++) {
+        qint64 pos = qMax(bounds.last(), fileSize * i / mChunkNum);
+        while (pos < fileSize && data[pos] != '\n') {
+            pos++;
+        }
+        if (pos < fileSize) {
+            pos++;
+        }
+        bounds.append(pos);
+    }
+    bounds.append(fileSize);
+
+    // Parse the chunks on all cores. The chunks are handed out in file order,
+    // so this thread can emit every chunk as soon as it and all chunks before
+    // it are done, while the rest are still being parsed.
+    QVector<LOG_COLUMNS> chunks(mChunkNum);
+    QVector<bool> done(mChunkNum, false);
+    LOG_COLUMNS *chunkData = chunks.data();
+    bool *doneData = done.data();
+    const qint64 *boundData = bounds.constData();
+    QAtomicInt next(0);
+    QMutex doneMutex;
+    QWaitCondition doneCond;
+    int threadNum = qMax(1, (int)std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+
+    for (int t = 0;t < threadNum;t++) {
+        threads.push_back(std::thread([&]() {
+            int i;
+            while ((i = next.fetchAndAddOrdered(1)) < mChunkNum) {
+                if (!mStop.loadAcquire()) {
+                    parseChunk(data + boundData[i], boundData[i + 1] - boundData[i], chunkData[i]);
+                }
+
+                QMutexLocker locker(&doneMutex);
+                doneData[i] = true;
+                doneCond.wakeAll();
+            }
+        }));
+    }
+
+    for (int i = 0;i < mChunkNum;i++) {
+        doneMutex.lock();
+        while (!doneData[i]) {
+            doneCond.wait(&doneMutex);
+        }
+        doneMutex.unlock();
+
+        if (mStop.loadAcquire()) {
+            break;
+        }
+
+        if (columnsSize(chunks[i]) > 0) {
+            emit columnsLoaded(chunks[i]);
+        }
+        emit progress((100 * (i + 1)) / mChunkNum);
+    }
+
+    for (std::thread &t: threads) {
+        t.join();
+    }
+
+    if (mStop.loadAcquire()) {
+        emit loadFinished(false, "Loading stopped", false, timer.elapsed());
+        return;
+    }
+
+    file.unmap((uchar*)data);
+    file.close();
+
+    writeIndex(fileSize, modifiedMs, chunks);
+    emit loadFinished(true, "", false, timer.elapsed());
+}
+
+/**
+ * @brief LogLoader::parseChunk
+ * Parse log lines with the format written by NetworkLogger:
+ * date lat lon height fix_type datalen ping_ms|error
+ * Lines that do not match are skipped.
+ */
+bool LogLoader::parseChunk(const char *data, qint64 len, LOG_COLUMNS &cols)
+{
+    double refXyz[3];
+    double enuMat[9];
+    utility::llhToXyz(mEnuRef[0], mEnuRef[1], mEnuRef[2], &refXyz[0], &refXyz[1], &refXyz[2]);
+    utility::createEnuMatrix(mEnuRef[0], mEnuRef[1], enuMat);
+
+    // Log lines are around 80 bytes
+    reserveColumns(cols, len / 70);
+
+    IsoTimeParser timeParser;
+    const char *p = data;
+    const char *end = data + len;
+    const char *start[7];
+    const char *stop[7];
+
+    while (p < end) {
+        const char *lineEnd = p;
+        while (lineEnd < end && !isLineEnd(*lineEnd)) {
+            lineEnd++;
+        }
+
+        int fields = splitFields(p, lineEnd, start, stop, 7);
+        p = lineEnd;
+        while (p < end && isLineEnd(*p)) {
+            p++;
+        }
+
+        if (fields < 7) {
+            continue;
+        }
+
+        qint64 timeMs;
+        double llh[3];
+        int fixType, dataLen;
+        if (!timeParser.parse(start[0], stop[0], timeMs) ||
+                !parseNumber(start[1], stop[1], llh[0]) ||
+                !parseNumber(start[2], stop[2], llh[1]) ||
+                !parseNumber(start[3], stop[3], llh[2]) ||
+                !parseInt(start[4], stop[4], fixType) ||
+                !parseInt(start[5], stop[5], dataLen)) {
+            continue;
+        }
+
+        double ping;
+        if (!parseNumber(start[6], stop[6], ping)) {
+            ping = NAN;
+        }
+
+        double x, y, z;
+        utility::llhToXyz(llh[0], llh[1], llh[2], &x, &y, &z);
+        double dx = x - refXyz[0];
+        double dy = y - refXyz[1];
+        double dz = z - refXyz[2];
+
+        cols.timeMs.append(timeMs);
+        cols.east.append(enuMat[0] * dx + enuMat[1] * dy + enuMat[2] * dz);
+        cols.north.append(enuMat[3] * dx + enuMat[4] * dy + enuMat[5] * dz);
+        cols.up.append(enuMat[6] * dx + enuMat[7] * dy + enuMat[8] * dz);
+        cols.fixType.append(fixType);
+        cols.dataLen.append(dataLen);
+        cols.pingMs.append(ping);
+    }
+
+    return true;
+}
+
+bool LogLoader::parseFirstLlh(const char *data, qint64 len, double *llh)
+{
+    IsoTimeParser timeParser;
+    const char *p = data;
+    const char *end = data + len;
+    const char *start[4];
+    const char *stop[4];
+
+    while (p < end) {
+        const char *lineEnd = p;
+        while (lineEnd < end && !isLineEnd(*lineEnd)) {
+            lineEnd++;
+        }
+
+        qint64 timeMs;
+        if (splitFields(p, lineEnd, start, stop, 4) == 4 &&
+                timeParser.parse(start[0], stop[0], timeMs) &&
+                parseNumber(start[1], stop[1], llh[0]) &&
+                parseNumber(start[2], stop[2], llh[1]) &&
+                parseNumber(start[3], stop[3], llh[2])) {
+            return true;
+        }
+
+        p = lineEnd;
+        while (p < end && isLineEnd(*p)) {
+            p++;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief LogLoader::readIndex
+ * Load the samples from the index file if it was written for the same log
+ * and ENU reference.
+ *
+ * @return
+ * True if the samples were loaded from the index.
+ */
+bool LogLoader::readIndex(qint64 fileSize, qint64 modifiedMs)
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint32 magic, version;
+    qint64 size, modified;
+    bool zeroEnu;
+    double ref[3];
+
+    in >> magic >> version >> size >> modified >> zeroEnu >> ref[0] >> ref[1] >> ref[2];
+
+    if (in.status() != QDataStream::Ok || magic != indexMagic || version != indexVersion ||
+            size != fileSize || modified != modifiedMs || zeroEnu != mZeroEnu) {
+        return false;
+    }
+
+    if (!mZeroEnu && (ref[0] != mEnuRef[0] || ref[1] != mEnuRef[1] || ref[2] != mEnuRef[2])) {
+        return false;
+    }
+
+    LOG_COLUMNS cols;
+    in >> cols.timeMs >> cols.east >> cols.north >> cols.up >>
+            cols.fixType >> cols.dataLen >> cols.pingMs;
+
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    mEnuRef[0] = ref[0];
+    mEnuRef[1] = ref[1];
+    mEnuRef[2] = ref[2];
+
+    emit enuRefUsed(ref[0], ref[1], ref[2]);
+    emit columnsLoaded(cols);
+    emit progress(100);
+
+    return true;
+}
+
+void LogLoader::writeIndex(qint64 fileSize, qint64 modifiedMs, const QVector<LOG_COLUMNS> &chunks)
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write log index" << file.fileName();
+        return;
+    }
+
+    LOG_COLUMNS cols;
+    int size = 0;
+    for (const LOG_COLUMNS &c: chunks) {
+        size += columnsSize(c);
+    }
+
+    reserveColumns(cols, size);
+    for (const LOG_COLUMNS &c: chunks) {
+        appendColumns(cols, c);
+    }
+
+    QDataStream out(&file);
+    out << indexMagic << indexVersion << fileSize << modifiedMs << mZeroEnu <<
+           mEnuRef[0] << mEnuRef[1] << mEnuRef[2];
+    out << cols.timeMs << cols.east << cols.north << cols.up <<
+           cols.fixType << cols.dataLen << cols.pingMs;
+}
+
+QString LogLoader::indexPath()
+{
+    return mPath + ".idx";
+}
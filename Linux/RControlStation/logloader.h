@@ -0,0 +1,86 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef LOGLOADER_H
+#define LOGLOADER_H
+
+#include <QThread>
+#include <QVector>
+#include <QString>
+#include <QAtomicInt>
+#include <QMetaType>
+
+// Samples of a network log, one vector per column. ENU positions are
+// relative to the reference the log was loaded with.
+typedef struct {
+    QVector<qint64> timeMs;
+    QVector<float> east;
+    QVector<float> north;
+    QVector<float> up;
+    QVector<quint8> fixType;
+    QVector<quint16> dataLen;
+    QVector<float> pingMs; // NaN if the ping failed
+} LOG_COLUMNS;
+
+Q_DECLARE_METATYPE(LOG_COLUMNS)
+
+// Loads network logs written by NetworkLogger in a background thread. The
+// file is memory mapped and split into chunks at line boundaries that are
+// parsed in parallel. The chunks are emitted in file order as soon as they
+// are parsed. The result is also stored in an index file next to the log,
+// so that loading the same log again only has to read the columns.
+class LogLoader : public QThread
+{
+    Q_OBJECT
+public:
+    explicit LogLoader(QObject *parent = 0);
+    ~LogLoader();
+
+    void load(const QString &path, bool zeroEnu, const double *enuRef, bool useIndex = true);
+    void stop();
+
+    static void appendColumns(LOG_COLUMNS &to, const LOG_COLUMNS &from);
+    static int columnsSize(const LOG_COLUMNS &cols);
+    static int indexOfTime(const LOG_COLUMNS &cols, qint64 timeMs);
+
+signals:
+    void enuRefUsed(double lat, double lon, double height);
+    void columnsLoaded(LOG_COLUMNS columns);
+    void progress(int percent);
+    void loadFinished(bool ok, QString msg, bool fromIndex, qint64 elapsedMs);
+
+protected:
+    void run();
+
+private:
+    QString mPath;
+    bool mZeroEnu;
+    bool mUseIndex;
+    double mEnuRef[3];
+    QAtomicInt mStop;
+
+    static const int mChunkNum = 64;
+
+    bool parseChunk(const char *data, qint64 len, LOG_COLUMNS &cols);
+    bool parseFirstLlh(const char *data, qint64 len, double *llh);
+    bool readIndex(qint64 fileSize, qint64 modifiedMs);
+    void writeIndex(qint64 fileSize, qint64 modifiedMs, const QVector<LOG_COLUMNS> &chunks);
+    QString indexPath();
+
+};
+
+#endif // LOGLOADER_H
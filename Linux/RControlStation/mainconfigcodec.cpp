@@ -0,0 +1,292 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "mainconfigcodec.h"
+#include "utility.h"
+#include "packet.h"
+#include <cstddef>
+#include <cstring>
+
+namespace {
+// Offsets in a packet with all fields, known at compile time
+#define FIELD_OFFSET(id, type, member) offsetof(main_config_wire_t, id),
+const int fieldOffsets[] = {MAIN_CONFIG_FIELDS(FIELD_OFFSET)};
+#undef FIELD_OFFSET
+
+#define FIELD_SIZE(id, type, member) MAIN_CONFIG_WIRE_SIZE_##type,
+const int fieldSizes[] = {MAIN_CONFIG_FIELDS(FIELD_SIZE)};
+#undef FIELD_SIZE
+}
+
+// Encoders and decoders for the field types in main_config_schema.h
+#define ENCODE_BOOL(v)      buffer[ind++] = (v)
+#define ENCODE_INT8(v)      buffer[ind++] = (quint8)(v)
+#define ENCODE_UINT16(v)    utility::buffer_append_uint16(buffer, (v), &ind)
+#define ENCODE_INT32(v)     utility::buffer_append_int32(buffer, (v), &ind)
+#define ENCODE_FLOAT(v)     utility::buffer_append_double32_auto(buffer, (v), &ind)
+#define ENCODE_NAME(v)      strncpy((char*)buffer + ind, (v), MAIN_CONFIG_WIRE_SIZE_NAME); \
+                            buffer[ind + MAIN_CONFIG_WIRE_SIZE_NAME - 1] = '\0'; \
+                            ind += MAIN_CONFIG_WIRE_SIZE_NAME
+
+#define DECODE_BOOL(v)      (v) = data[ind++]
+#define DECODE_INT8(v)      (v) = (qint8)data[ind++]
+#define DECODE_UINT16(v)    (v) = utility::buffer_get_uint16(data, &ind)
+#define DECODE_INT32(v)     (v) = utility::buffer_get_int32(data, &ind)
+#define DECODE_FLOAT(v)     (v) = utility::buffer_get_double32_auto(data, &ind)
+#define DECODE_NAME(v)      memcpy((v), data + ind, MAIN_CONFIG_WIRE_SIZE_NAME); \
+                            (v)[MAIN_CONFIG_WIRE_SIZE_NAME - 1] = '\0'; \
+                            ind += MAIN_CONFIG_WIRE_SIZE_NAME
+
+/**
+ * @brief MainConfigView::MainConfigView
+ * Check the header of a serialized MAIN_CONFIG and locate the fields. When
+ * all fields are present the compile-time offsets are used, otherwise they
+ * are computed from the field mask. Nothing is copied from the buffer.
+ *
+ * @param data
+ * The serialized configuration, starting with the schema header.
+ *
+ * @param len
+ * The length of the data.
+ */
+MainConfigView::MainConfigView(const unsigned char *data, int len)
+{
+    mValid = false;
+    mFieldNum = 0;
+    mMask = 0;
+    mFields = 0;
+
+    for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+        mOffsets[i] = -1;
+    }
+
+    if (len < 2 || data[0] != MAIN_CONFIG_SCHEMA_VERSION) {
+        return;
+    }
+
+    mFieldNum = data[1];
+    int headerLen = 2 + (mFieldNum + 7) / 8;
+
+    if (len < headerLen) {
+        return;
+    }
+
+    mMask = data + 2;
+    mFields = data + headerLen;
+
+    bool all = mFieldNum >= MAIN_CONFIG_FIELD_NUM;
+    for (int i = 0;i < MAIN_CONFIG_FIELD_NUM && all;i++) {
+        all = MAIN_CONFIG_MASK_GET(mMask, i);
+    }
+
+    int fieldsLen = 0;
+
+    if (all) {
+        for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+            mOffsets[i] = fieldOffsets[i];
+        }
+        fieldsLen = sizeof(main_config_wire_t);
+    } else {
+        for (int i = 0;i < MAIN_CONFIG_FIELD_NUM && i < mFieldNum;i++) {
+            if (MAIN_CONFIG_MASK_GET(mMask, i)) {
+                mOffsets[i] = fieldsLen;
+                fieldsLen += fieldSizes[i];
+            }
+        }
+    }
+
+    mValid = (headerLen + fieldsLen) <= len;
+}
+
+bool MainConfigView::isValid() const
+{
+    return mValid;
+}
+
+int MainConfigView::fieldNum() const
+{
+    return mFieldNum;
+}
+
+bool MainConfigView::hasField(MAIN_CONFIG_FIELD field) const
+{
+    return mValid && mOffsets[field] >= 0;
+}
+
+/**
+ * @brief MainConfigView::fieldData
+ * Get a pointer to the serialized field in the packet buffer.
+ *
+ * @param field
+ * The field.
+ *
+ * @return
+ * A pointer to fieldSize(field) bytes, or null if the field is not present.
+ */
+const unsigned char *MainConfigView::fieldData(MAIN_CONFIG_FIELD field) const
+{
+    if (!hasField(field)) {
+        return 0;
+    }
+
+    return mFields + mOffsets[field];
+}
+
+/**
+ * @brief MainConfigView::apply
+ * Update the fields in a configuration that are present in this view.
+ *
+ * @param conf
+ * The configuration to update.
+ *
+ * @return
+ * The number of updated fields, or -1 if the view is invalid.
+ */
+int MainConfigView::apply(MAIN_CONFIG &conf) const
+{
+    if (!mValid) {
+        return -1;
+    }
+
+    const unsigned char *data = mFields;
+    int fields = 0;
+
+#define APPLY_FIELD(id, type, member) \
+    if (mOffsets[MAIN_CONFIG_FIELD_##id] >= 0) { \
+        int32_t ind = mOffsets[MAIN_CONFIG_FIELD_##id]; \
+        DECODE_##type(conf.member); \
+        fields++; \
+    }
+
+    MAIN_CONFIG_FIELDS(APPLY_FIELD)
+#undef APPLY_FIELD
+
+    return fields;
+}
+
+/**
+ * @brief MainConfigView::encode
+ * Serialize a configuration as described in main_config_schema.h.
+ *
+ * @param conf
+ * The configuration.
+ *
+ * @param buffer
+ * The buffer to write to, with room for maxLength bytes.
+ *
+ * @param mask
+ * Field mask with MAIN_CONFIG_MASK_BYTES bytes for the fields to include.
+ * If this is null all fields are included.
+ *
+ * @return
+ * The number of bytes written.
+ */
+int MainConfigView::encode(const MAIN_CONFIG &conf, unsigned char *buffer, const quint8 *mask)
+{
+    int32_t ind = 0;
+
+    buffer[ind++] = MAIN_CONFIG_SCHEMA_VERSION;
+    buffer[ind++] = MAIN_CONFIG_FIELD_NUM;
+
+    if (mask) {
+        memcpy(buffer + ind, mask, MAIN_CONFIG_MASK_BYTES);
+    } else {
+        memset(buffer + ind, 0, MAIN_CONFIG_MASK_BYTES);
+        for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+            MAIN_CONFIG_MASK_SET(buffer + ind, i);
+        }
+    }
+
+    const unsigned char *maskNow = buffer + ind;
+    ind += MAIN_CONFIG_MASK_BYTES;
+
+#define ENCODE_FIELD(id, type, member) \
+    if (MAIN_CONFIG_MASK_GET(maskNow, MAIN_CONFIG_FIELD_##id)) { \
+        ENCODE_##type(conf.member); \
+    }
+
+    MAIN_CONFIG_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
+
+    return ind;
+}
+
+/**
+ * @brief MainConfigView::hash
+ * Calculate the hash that the firmware uses to check that delta updates are
+ * based on the configuration it has.
+ *
+ * @param conf
+ * The configuration.
+ *
+ * @return
+ * CRC16 of the full serialization of the configuration.
+ */
+quint16 MainConfigView::hash(const MAIN_CONFIG &conf)
+{
+    unsigned char buffer[maxLength];
+    int len = encode(conf, buffer);
+    return Packet::crc16(buffer, len);
+}
+
+/**
+ * @brief MainConfigView::diff
+ * Find the fields that differ on the wire between two configurations.
+ *
+ * @param confOld
+ * The old configuration.
+ *
+ * @param confNew
+ * The new configuration.
+ *
+ * @param mask
+ * Field mask with MAIN_CONFIG_MASK_BYTES bytes where the changed fields
+ * are set.
+ *
+ * @return
+ * The number of changed fields.
+ */
+int MainConfigView::diff(const MAIN_CONFIG &confOld, const MAIN_CONFIG &confNew, quint8 *mask)
+{
+    unsigned char bufOld[maxLength];
+    unsigned char bufNew[maxLength];
+    encode(confOld, bufOld);
+    encode(confNew, bufNew);
+
+    memset(mask, 0, MAIN_CONFIG_MASK_BYTES);
+    int changed = 0;
+
+    for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+        int offset = MAIN_CONFIG_HEADER_SIZE + fieldOffsets[i];
+        if (memcmp(bufOld + offset, bufNew + offset, fieldSizes[i]) != 0) {
+            MAIN_CONFIG_MASK_SET(mask, i);
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+int MainConfigView::fieldOffset(MAIN_CONFIG_FIELD field)
+{
+    return fieldOffsets[field];
+}
+
+int MainConfigView::fieldSize(MAIN_CONFIG_FIELD field)
+{
+    return fieldSizes[field];
+}
@@ -0,0 +1,54 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef MAINCONFIGCODEC_H
+#define MAINCONFIGCODEC_H
+
+#include <QtGlobal>
+#include "mainconfigtypes.h"
+#include "../../Embedded/RC_Controller/main_config_schema.h"
+
+// Read access to a serialized MAIN_CONFIG directly in the packet buffer. The
+// buffer must stay valid while the view is used.
+class MainConfigView
+{
+public:
+    MainConfigView(const unsigned char *data, int len);
+    bool isValid() const;
+    int fieldNum() const;
+    bool hasField(MAIN_CONFIG_FIELD field) const;
+    const unsigned char *fieldData(MAIN_CONFIG_FIELD field) const;
+    int apply(MAIN_CONFIG &conf) const;
+
+    static int encode(const MAIN_CONFIG &conf, unsigned char *buffer, const quint8 *mask = 0);
+    static quint16 hash(const MAIN_CONFIG &conf);
+    static int diff(const MAIN_CONFIG &confOld, const MAIN_CONFIG &confNew, quint8 *mask);
+    static int fieldOffset(MAIN_CONFIG_FIELD field);
+    static int fieldSize(MAIN_CONFIG_FIELD field);
+
+    static const int maxLength = MAIN_CONFIG_HEADER_SIZE + sizeof(main_config_wire_t);
+
+private:
+    bool mValid;
+    int mFieldNum;
+    const unsigned char *mMask;
+    const unsigned char *mFields;
+    int mOffsets[MAIN_CONFIG_FIELD_NUM];
+
+};
+
+#endif // MAINCONFIGCODEC_H
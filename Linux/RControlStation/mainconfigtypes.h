@@ -0,0 +1,166 @@
+/*
+    Copyright 2016-2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAINCONFIGTYPES_H
+#define MAINCONFIGTYPES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * MAIN_CONFIG and its parts. This is shared by RControlStation and Car_Client,
+ * so that both programs and the MAIN_CONFIG codec use the same definition.
+ */
+
+// Sizes
+#define LOG_NAME_MAX_LEN			20
+
+typedef struct {
+    bool yaw_use_odometry; // Use odometry data for yaw angle correction.
+    float yaw_imu_gain; // Gain for yaw angle from IMU (vs odometry)
+    bool disable_motor; // Disable motor drive commands to make sure that the motor does not move.
+
+    float gear_ratio;
+    float wheel_diam;
+    float motor_poles;
+    float steering_max_angle_rad; // = arctan(axist_distance / turn_radius_at_maximum_steering_angle)
+    float steering_center;
+    float steering_range;
+    float steering_ramp_time; // Ramp time constant for the steering servo in seconds
+    float axis_distance;
+    bool odometry_from_status; // Use the CAN status broadcasts from the motor controller for odometry instead of polling.
+} MAIN_CONFIG_CAR;
+
+typedef struct {
+    // Dead reckoning
+    float vel_decay_e;
+    float vel_decay_l;
+    float vel_max;
+    float map_min_x;
+    float map_max_x;
+    float map_min_y;
+    float map_max_y;
+
+    // State correction for dead reckoning
+    float vel_gain_p;
+    float vel_gain_i;
+    float vel_gain_d;
+
+    float tilt_gain_p;
+    float tilt_gain_i;
+    float tilt_gain_d;
+
+    float max_corr_error;
+    float max_tilt_error;
+
+    // Attitude controller
+    float ctrl_gain_roll_p;
+    float ctrl_gain_roll_i;
+    float ctrl_gain_roll_dp;
+    float ctrl_gain_roll_de;
+
+    float ctrl_gain_pitch_p;
+    float ctrl_gain_pitch_i;
+    float ctrl_gain_pitch_dp;
+    float ctrl_gain_pitch_de;
+
+    float ctrl_gain_yaw_p;
+    float ctrl_gain_yaw_i;
+    float ctrl_gain_yaw_dp;
+    float ctrl_gain_yaw_de;
+
+    // Position controller
+    float ctrl_gain_pos_p;
+    float ctrl_gain_pos_i;
+    float ctrl_gain_pos_d;
+
+    // Altitude controller
+    float ctrl_gain_alt_p;
+    float ctrl_gain_alt_i;
+    float ctrl_gain_alt_d;
+
+    // Joystick gain
+    float js_gain_tilt;
+    float js_gain_yaw;
+    bool js_mode_rate;
+
+    // Motor mapping and configuration
+    int8_t motor_fl_f; // x: Front Left  +: Front
+    int8_t motor_bl_l; // x: Back Left   +: Left
+    int8_t motor_fr_r; // x: Front Right +: Right
+    int8_t motor_br_b; // x: Back Right  +: Back
+    bool motors_x; // Use x motor configuration (use + if false)
+    bool motors_cw; // Front left (or front in + mode) runs in the clockwise direction (ccw if false)
+    uint16_t motor_pwm_min_us; // Minimum servo pulse length for motor in microseconds
+    uint16_t motor_pwm_max_us; // Maximum servo pulse length for motor in microseconds
+
+    // Hand over to position hold or the route at full throttle
+    bool ap_enabled;
+} MAIN_CONFIG_MULTIROTOR;
+
+// Car configuration
+typedef struct {
+    // Common vehicle settings
+    bool mag_use; // Use the magnetometer
+    bool mag_comp; // Should be 0 when capturing samples for the calibration
+    float yaw_mag_gain; // Gain for yaw angle from magnetomer (vs gyro)
+
+    // Magnetometer calibration
+    float mag_cal_cx;
+    float mag_cal_cy;
+    float mag_cal_cz;
+    float mag_cal_xx;
+    float mag_cal_xy;
+    float mag_cal_xz;
+    float mag_cal_yx;
+    float mag_cal_yy;
+    float mag_cal_yz;
+    float mag_cal_zx;
+    float mag_cal_zy;
+    float mag_cal_zz;
+
+    // GPS parameters
+    float gps_ant_x; // Antenna offset from vehicle center in X
+    float gps_ant_y; // Antenna offset from vehicle center in Y
+    bool gps_comp; // Use GPS position correction
+    bool gps_req_rtk; // Require RTK solution
+    float gps_corr_gain_stat; // Static GPS correction gain
+    float gps_corr_gain_dyn; // Dynamic GPS correction gain
+    float gps_corr_gain_yaw; // Gain for yaw correction
+    bool gps_send_nmea; // Send NMEA data for logging and debugging
+    bool gps_use_ubx_info; // Use info about the ublox solution
+    float gps_ubx_max_acc; // Maximum ublox accuracy to use solution (m, higher = worse)
+    bool gps_use_mb_heading; // Correct yaw with the heading from a moving base receiver
+    float gps_mb_baseline; // Distance between the moving base antennas (m, 0 = don't check)
+    float gps_mb_yaw_offset; // Angle of the base to rover antenna vector from vehicle forward, clockwise (deg)
+
+    // Autopilot parameters
+    bool ap_repeat_routes; // Repeat the same route when the end is reached
+    float ap_base_rad; // Radius around car at 0 speed
+    bool ap_mode_time; // Drive to route points based on timestamps instead of speed
+    float ap_max_speed; // Maximum allowed speed for autopilot
+    int32_t ap_time_add_repeat_ms; // Time to add to each point for each repetition of the route
+
+    // Logging
+    bool log_en;
+    char log_name[LOG_NAME_MAX_LEN + 1];
+
+    MAIN_CONFIG_CAR car;
+    MAIN_CONFIG_MULTIROTOR mr;
+} MAIN_CONFIG;
+
+#endif // MAINCONFIGTYPES_H
@@ -119,7 +119,7 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->rtcmWidget, SIGNAL(rtcmReceived(QByteArray)),
             this, SLOT(rtcmReceived(QByteArray)));
     connect(ui->baseStationWidget, SIGNAL(rtcmOut(QByteArray)),
-            this, SLOT(rtcmReceived(QByteArray)));
+            ui->rtcmWidget, SLOT(localBaseRtcm(QByteArray)));
     connect(ui->rtcmWidget, SIGNAL(refPosGet()), this, SLOT(rtcmRefPosGet()));
     connect(mPing, SIGNAL(pingRx(int,QString)), this, SLOT(pingRx(int,QString)));
     connect(mPing, SIGNAL(pingError(QString,QString)), this, SLOT(pingError(QString,QString)));
@@ -1404,3 +1404,51 @@ void MainWindow::on_actionExit_triggered()
 {
     qApp->exit();
 }
+
+void MainWindow::on_mapRouteConflictsBox_toggled(bool checked)
+{
+    ui->mapWidget->setDrawRouteConflicts(checked);
+}
+
+void MainWindow::on_mapRouteConflictRadiusBox_valueChanged(double arg1)
+{
+    ui->mapWidget->setRouteConflictRadius(arg1);
+}
+
+void MainWindow::on_mapUploadFenceButton_clicked()
+{
+    if (!mSerialPort->isOpen() && !mPacketInterface->isUdpConnected() && !mTcpSocket->isOpen()) {
+        QMessageBox::warning(this, "Upload geofence",
+                             "Serial port not connected.");
+        return;
+    }
+
+    QList<LocPoint> route = ui->mapWidget->getRoute();
+
+    if (route.size() > 0 && route.size() < 3) {
+        QMessageBox::warning(this, "Upload geofence",
+                             "The geofence needs at least three points.");
+        return;
+    }
+
+    // Must match GEOFENCE_MAX_POINTS in the firmware
+    if (route.size() > 64) {
+        QMessageBox::warning(this, "Upload geofence",
+                             "The geofence can have at most 64 points.");
+        return;
+    }
+
+    ui->mapUploadFenceButton->setEnabled(false);
+
+    if (!mPacketInterface->setGeofence(ui->mapCarBox->value(), route)) {
+        QMessageBox::warning(this, "Upload geofence",
+                             "No response when uploading geofence.");
+    }
+
+    ui->mapUploadFenceButton->setEnabled(true);
+}
+
+void MainWindow::on_mapPredictPoseBox_toggled(bool checked)
+{
+    ui->mapWidget->setPredictPose(checked);
+}
@@ -133,6 +133,10 @@ private slots:
     void on_actionAbout_triggered();
     void on_actionAboutLibrariesUsed_triggered();
     void on_actionExit_triggered();
+    void on_mapRouteConflictsBox_toggled(bool checked);
+    void on_mapRouteConflictRadiusBox_valueChanged(double arg1);
+    void on_mapUploadFenceButton_clicked();
+    void on_mapPredictPoseBox_toggled(bool checked);
 
 private:
     Ui::MainWindow *ui;
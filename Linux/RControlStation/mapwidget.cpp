@@ -16,6 +16,7 @@
     */
 
 #include <QDebug>
+#include <QDateTime>
 #include <math.h>
 #include <qmath.h>
 
@@ -24,6 +25,11 @@
 
 namespace
 {
+// Car dimensions in mm
+const double car_w = 800;
+const double car_h = 335;
+const double car_corner = 20;
+
 static void normalizeAngleRad(double &angle)
 {
     angle = fmod(angle, 2.0 * M_PI);
@@ -127,6 +133,34 @@ bool isLineSegmentWithinRect(const QPointF &p1, const QPointF &p2, double xStart
 
     return res;
 }
+
+// Draw a car at the origin, pointing along the x-axis. Units are mm.
+void drawCarShape(QPainter &painter, const QColor &col_wheels, const QColor &col_bumper,
+                  const QColor &col_hull, const QColor &col_center) {
+    // Wheels
+    painter.setBrush(col_wheels);
+    painter.drawRoundedRect(-car_w / 12.0,-(car_h / 2), car_w / 6.0, car_h, car_corner / 3, car_corner / 3);
+    painter.drawRoundedRect(car_w - car_w / 2.5,-(car_h / 2), car_w / 6.0, car_h, car_corner / 3, car_corner / 3);
+    // Front bumper
+    painter.setBrush(col_bumper);
+    painter.drawRoundedRect(-car_w / 6.0, -((car_h - car_w / 20.0) / 2.0), car_w, car_h - car_w / 20.0, car_corner, car_corner);
+    // Hull
+    painter.setBrush(col_hull);
+    painter.drawRoundedRect(-car_w / 6.0, -((car_h - car_w / 20.0) / 2.0), car_w - (car_w / 20.0), car_h - car_w / 20.0, car_corner, car_corner);
+    // Center
+    painter.setBrush(col_center);
+    painter.drawEllipse(QPointF(0, 0), car_h / 15.0, car_h / 15.0);
+}
+
+// Width in mm of the cached car pixmaps. The car is centered in them, so
+// that they can be rotated around the car position.
+double carGlyphWidth() {
+    return 2.0 * (car_w * 5.0 / 6.0 + car_corner);
+}
+
+quint64 carGlyphKey(Qt::GlobalColor color, bool selected, int size) {
+    return ((quint64)color << 32) | ((quint64)selected << 31) | (quint64)size;
+}
 }
 
 MapWidget::MapWidget(QWidget *parent) : QWidget(parent)
@@ -158,6 +192,9 @@ MapWidget::MapWidget(QWidget *parent) : QWidget(parent)
     mTraceMinSpaceCar = 0.05;
     mTraceMinSpaceGps = 0.05;
     mInfoTraceNow = 0;
+    mRouteConflicts = new RouteConflicts(this);
+    mDrawRouteConflicts = false;
+    mPredictPose = true;
 
     mOsm = new OsmClient(this);
     mDrawOpenStreetmap = true;
@@ -195,18 +232,19 @@ MapWidget::MapWidget(QWidget *parent) : QWidget(parent)
     connect(mOsm, SIGNAL(errorGetTile(QString)),
             this, SLOT(errorGetTile(QString)));
 
+    // Redraw at display rate while a predicted car pose is moving
+    mPredictTimer = new QTimer(this);
+    mPredictTimer->start(16);
+    connect(mPredictTimer, SIGNAL(timeout()),
+            this, SLOT(predictTimerSlot()));
+
     setMouseTracking(true);
 }
 
 CarInfo *MapWidget::getCarInfo(int car)
 {
-    for (int i = 0;i < mCarInfo.size();i++) {
-        if (mCarInfo[i].getId() == car) {
-            return &mCarInfo[i];
-        }
-    }
-
-    return 0;
+    int ind = carIndex(car);
+    return ind >= 0 ? &mCarInfo[ind] : 0;
 }
 
 CopterInfo *MapWidget::getCopterInfo(int copter)
@@ -223,6 +261,9 @@ CopterInfo *MapWidget::getCopterInfo(int copter)
 void MapWidget::addCar(const CarInfo &car)
 {
     mCarInfo.append(car);
+    if (!mCarIndex.contains(mCarInfo.last().getId())) {
+        mCarIndex.insert(mCarInfo.last().getId(), mCarInfo.size() - 1);
+    }
     update();
 }
 
@@ -234,15 +275,22 @@ void MapWidget::addCopter(const CopterInfo &copter)
 
 bool MapWidget::removeCar(int carId)
 {
-    QMutableListIterator<CarInfo> i(mCarInfo);
-    while (i.hasNext()) {
-        if (i.next().getId() == carId) {
-            i.remove();
-            return true;
-        }
+    int ind = carIndex(carId);
+
+    if (ind < 0) {
+        return false;
     }
 
-    return false;
+    mCarInfo.removeAt(ind);
+    mCarLabels.remove(carId);
+
+    // Indexes after the removed car have moved
+    mCarIndex.clear();
+    for (int i = mCarInfo.size() - 1;i >= 0;i--) {
+        mCarIndex.insert(mCarInfo[i].getId(), i);
+    }
+
+    return true;
 }
 
 bool MapWidget::removeCopter(int copterId)
@@ -331,6 +379,7 @@ void MapWidget::addRoutePoint(double px, double py, double speed, qint32 time)
     pos.setSpeed(speed);
     pos.setTime(time);
     mRoutes[mRouteNow].append(pos);
+    routeChanged(mRouteNow);
     update();
 }
 
@@ -342,12 +391,14 @@ QList<LocPoint> MapWidget::getRoute()
 void MapWidget::setRoute(QList<LocPoint> route)
 {
     mRoutes[mRouteNow] = route;
+    routeChanged(mRouteNow);
     update();
 }
 
 void MapWidget::clearRoute()
 {
     mRoutes[mRouteNow].clear();
+    routeChanged(mRouteNow);
     update();
 }
 
@@ -355,6 +406,7 @@ void MapWidget::clearAllRoutes()
 {
     for (int i = 0;i < mRoutes.size();i++) {
         mRoutes[i].clear();
+        routeChanged(i);
     }
 
     update();
@@ -408,6 +460,7 @@ QPoint MapWidget::getMousePosRelative()
 void MapWidget::setAntialiasDrawings(bool antialias)
 {
     mAntialiasDrawings = antialias;
+    mCarGlyphs.clear();
     update();
 }
 
@@ -428,6 +481,22 @@ void MapWidget::errorGetTile(QString reason)
     qWarning() << "OSM tile error:" << reason;
 }
 
+void MapWidget::predictTimerSlot()
+{
+    if (!mPredictPose) {
+        return;
+    }
+
+    const qint64 timeNow = QDateTime::currentMSecsSinceEpoch();
+
+    for (int i = 0;i < mCarInfo.size();i++) {
+        if (mCarInfo.at(i).isPredictionMoving(timeNow)) {
+            update();
+            break;
+        }
+    }
+}
+
 void MapWidget::setFollowCar(int car)
 {
     int oldCar = mFollowCar;
@@ -476,15 +545,16 @@ void MapWidget::paintEvent(QPaintEvent *event)
         mYOffset *= scaleDiff;
     }
 
+    const qint64 timeNow = QDateTime::currentMSecsSinceEpoch();
+
     // Optionally follow a car or copter
     if (mFollowCar >= 0) {
-        for (int i = 0;i < mCarInfo.size();i++) {
-            CarInfo &carInfo = mCarInfo[i];
-            if (carInfo.getId() == mFollowCar) {
-                LocPoint followLoc = carInfo.getLocation();
-                mXOffset = -followLoc.getX() * 1000.0 * mScaleFactor;
-                mYOffset = -followLoc.getY() * 1000.0 * mScaleFactor;
-            }
+        CarInfo *carInfo = getCarInfo(mFollowCar);
+        if (carInfo) {
+            LocPoint followLoc = mPredictPose ?
+                        carInfo->getLocationPredicted(timeNow) : carInfo->getLocation();
+            mXOffset = -followLoc.getX() * 1000.0 * mScaleFactor;
+            mYOffset = -followLoc.getY() * 1000.0 * mScaleFactor;
         }
 
         for (int i = 0;i < mCopterInfo.size();i++) {
@@ -514,9 +584,6 @@ void MapWidget::paintEvent(QPaintEvent *event)
     // Paint begins here
     painter.fillRect(event->rect(), QBrush(Qt::transparent));
 
-    const double car_w = 800;
-    const double car_h = 335;
-    const double car_corner = 20;
     double angle, x, y;
     QString txt;
     QPointF pt_txt;
@@ -735,22 +802,20 @@ void MapWidget::paintEvent(QPaintEvent *event)
 
     // Store trace for the selected car or copter
     if (mTraceCar >= 0) {
-        for (int i = 0;i < mCarInfo.size();i++) {
-            CarInfo &carInfo = mCarInfo[i];
-            if (carInfo.getId() == mTraceCar) {
-                if (mCarTrace.isEmpty()) {
-                    mCarTrace.append(carInfo.getLocation());
-                }
-                if (mCarTrace.last().getDistanceTo(carInfo.getLocation()) > mTraceMinSpaceCar) {
-                    mCarTrace.append(carInfo.getLocation());
-                }
-                // GPS trace
-                if (mCarTraceGps.isEmpty()) {
-                    mCarTraceGps.append(carInfo.getLocationGps());
-                }
-                if (mCarTraceGps.last().getDistanceTo(carInfo.getLocationGps()) > mTraceMinSpaceGps) {
-                    mCarTraceGps.append(carInfo.getLocationGps());
-                }
+        CarInfo *carInfo = getCarInfo(mTraceCar);
+        if (carInfo) {
+            if (mCarTrace.isEmpty()) {
+                mCarTrace.append(carInfo->getLocation());
+            }
+            if (mCarTrace.last().getDistanceTo(carInfo->getLocation()) > mTraceMinSpaceCar) {
+                mCarTrace.append(carInfo->getLocation());
+            }
+            // GPS trace
+            if (mCarTraceGps.isEmpty()) {
+                mCarTraceGps.append(carInfo->getLocationGps());
+            }
+            if (mCarTraceGps.last().getDistanceTo(carInfo->getLocationGps()) > mTraceMinSpaceGps) {
+                mCarTraceGps.append(carInfo->getLocationGps());
             }
         }
 
@@ -916,6 +981,21 @@ void MapWidget::paintEvent(QPaintEvent *event)
             painter.drawLine(routeNow[i - 1].getX() * 1000.0, routeNow[i - 1].getY() * 1000.0,
                     routeNow[i].getX() * 1000.0, routeNow[i].getY() * 1000.0);
         }
+
+        // Draw segments that conflict with other routes on top
+        if (mDrawRouteConflicts && mRouteConflicts->getConflictNum() > 0) {
+            QPen penConf = pen;
+            penConf.setColor(Qt::red);
+            painter.setPen(penConf);
+            for (int i = 1;i < routeNow.size();i++) {
+                if (mRouteConflicts->isSegmentInConflict(rn, i - 1)) {
+                    painter.drawLine(routeNow[i - 1].getX() * 1000.0, routeNow[i - 1].getY() * 1000.0,
+                            routeNow[i].getX() * 1000.0, routeNow[i].getY() * 1000.0);
+                }
+            }
+            painter.setPen(pen);
+        }
+
         for (int i = 0;i < routeNow.size();i++) {
             QPointF p = routeNow[i].getPointMm();
             painter.setTransform(drawTrans);
@@ -944,96 +1024,174 @@ void MapWidget::paintEvent(QPaintEvent *event)
         }
     }
 
-    // Draw cars
+    // Draw route conflicts
+    if (mDrawRouteConflicts) {
+        QList<RouteConflicts::conflict_t> conflicts = mRouteConflicts->getConflicts();
+        QColor col = Qt::red;
+        col.setAlphaF(0.3);
+        painter.setTransform(drawTrans);
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QBrush(col));
+
+        for (int i = 0;i < conflicts.size();i++) {
+            const RouteConflicts::conflict_t &c = conflicts.at(i);
+            QPointF p(c.x * 1000.0, c.y * 1000.0);
+
+            if (!isPointWithinRect(p, xStart2, xEnd2, yStart2, yEnd2)) {
+                continue;
+            }
+
+            painter.drawEllipse(p, mRouteConflicts->getRadius() * 500.0,
+                                mRouteConflicts->getRadius() * 500.0);
+        }
+    }
+
+    // Draw cars. Car symbols are drawn from cached pixmaps in one batch per
+    // symbol, and cars that are smaller than a few pixels are drawn as dots.
+    // Labels are cached and only laid out again when the car has changed.
+    const QRectF viewMm = drawTrans.inverted().mapRect(QRectF(rect())).
+            adjusted(-car_w - 320.0 / mScaleFactor, -car_w - 320.0 / mScaleFactor,
+                     car_w + 320.0 / mScaleFactor, car_w + 320.0 / mScaleFactor);
+    const int carGlyphSize = qRound(carGlyphWidth() * mScaleFactor);
+    const bool carDrawLabels = carGlyphSize >= mCarLabelMinPx || mCarInfo.size() <= mCarLabelLodCars;
+
+    QHash<quint64, QVector<QPainter::PixmapFragment> > carGlyphBatches;
+    QHash<QRgb, QPolygonF> carDots;
+    QVector<int> carsVisible;
+    QVector<LocPoint> carsVisiblePos;
+    carsVisible.reserve(mCarInfo.size());
+    carsVisiblePos.reserve(mCarInfo.size());
+
+    if (mCarGlyphs.size() > mCarGlyphCacheMax) {
+        mCarGlyphs.clear();
+    }
+
+    painter.setTransform(drawTrans);
     painter.setPen(QPen(textColor));
     for(int i = 0;i < mCarInfo.size();i++) {
         CarInfo &carInfo = mCarInfo[i];
-        LocPoint pos = carInfo.getLocation();
-        LocPoint pos_gps = carInfo.getLocationGps();
+        LocPoint pos = mPredictPose ?
+                    carInfo.getLocationPredicted(timeNow) : carInfo.getLocation();
         x = pos.getX() * 1000.0;
         y = pos.getY() * 1000.0;
-        double x_gps = pos_gps.getX() * 1000.0;
-        double y_gps = pos_gps.getY() * 1000.0;
-        angle = pos.getYaw() * 180.0 / M_PI;
-        painter.setTransform(drawTrans);
 
-        QColor col_sigma = Qt::red;
-        QColor col_wheels = Qt::black;
-        QColor col_bumper = Qt::green;
-        QColor col_hull = carInfo.getColor();
-        QColor col_center = Qt::blue;
-        QColor col_gps = Qt::magenta;
-        QColor col_ap = carInfo.getColor();
+        if (!viewMm.contains(x, y)) {
+            continue;
+        }
 
-        if (carInfo.getId() != mSelectedCar) {
-            col_wheels = Qt::darkGray;
-            col_bumper = Qt::lightGray;
-            col_ap = Qt::lightGray;
+        carsVisible.append(i);
+        carsVisiblePos.append(pos);
+        angle = pos.getYaw() * 180.0 / M_PI;
+        bool selected = carInfo.getId() == mSelectedCar;
+
+        if (carGlyphSize < mCarGlyphMinPx) {
+            carDots[QColor(carInfo.getColor()).rgba()].append(QPointF(x, y));
+            continue;
         }
 
         // Draw standard deviation
         if (pos.getSigma() > 0.0) {
-            QColor col = col_sigma;
+            QColor col = Qt::red;
             col.setAlphaF(0.2);
             painter.setBrush(QBrush(col));
             painter.drawEllipse(pos.getPointMm(), pos.getSigma() * 1000.0, pos.getSigma() * 1000.0);
         }
 
         // Draw car
-        painter.setBrush(QBrush(col_wheels));
-        painter.save();
-        painter.translate(x, y);
-        painter.rotate(-angle);
-        // Wheels
-        painter.drawRoundedRect(-car_w / 12.0,-(car_h / 2), car_w / 6.0, car_h, car_corner / 3, car_corner / 3);
-        painter.drawRoundedRect(car_w - car_w / 2.5,-(car_h / 2), car_w / 6.0, car_h, car_corner / 3, car_corner / 3);
-        // Front bumper
-        painter.setBrush(col_bumper);
-        painter.drawRoundedRect(-car_w / 6.0, -((car_h - car_w / 20.0) / 2.0), car_w, car_h - car_w / 20.0, car_corner, car_corner);
-        // Hull
-        painter.setBrush(col_hull);
-        painter.drawRoundedRect(-car_w / 6.0, -((car_h - car_w / 20.0) / 2.0), car_w - (car_w / 20.0), car_h - car_w / 20.0, car_corner, car_corner);
-        painter.restore();
-
-        // Center
-        painter.setBrush(col_center);
-        painter.drawEllipse(QPointF(x, y), car_h / 15.0, car_h / 15.0);
+        if (carGlyphSize > mCarGlyphMaxPx) {
+            QColor col_wheels = selected ? Qt::black : Qt::darkGray;
+            QColor col_bumper = selected ? Qt::green : Qt::lightGray;
+            painter.save();
+            painter.translate(x, y);
+            painter.rotate(-angle);
+            drawCarShape(painter, col_wheels, col_bumper, carInfo.getColor(), Qt::blue);
+            painter.restore();
+        } else {
+            quint64 key = carGlyphKey(carInfo.getColor(), selected, carGlyphSize);
+            const QPixmap &glyph = carGlyph(key, carInfo.getColor(), selected, carGlyphSize);
+            double scale = carGlyphWidth() / (double)glyph.width();
+            carGlyphBatches[key].append(QPainter::PixmapFragment::create(
+                                            QPointF(x, y), QRectF(glyph.rect()),
+                                            scale, scale, -angle));
+        }
+    }
 
-        // GPS Location
-        painter.setBrush(col_gps);
-        painter.drawEllipse(QPointF(x_gps, y_gps), car_h / 15.0, car_h / 15.0);
+    for (QHash<quint64, QVector<QPainter::PixmapFragment> >::const_iterator it = carGlyphBatches.constBegin();
+         it != carGlyphBatches.constEnd();++it) {
+        painter.drawPixmapFragments(it.value().constData(), it.value().size(), mCarGlyphs.value(it.key()));
+    }
 
-        // Autopilot state
-        LocPoint ap_goal = carInfo.getApGoal();
-        if (ap_goal.getRadius() > 0.0) {
-            QPointF p = ap_goal.getPointMm();
-            pen.setWidthF(3.0 / mScaleFactor);
-            pen.setColor(col_ap);
-            painter.setPen(pen);
-            painter.drawEllipse(p, 10 / mScaleFactor, 10 / mScaleFactor);
+    if (carGlyphSize >= mCarGlyphMinPx) {
+        for (int i = 0;i < carsVisible.size();i++) {
+            CarInfo &carInfo = mCarInfo[carsVisible.at(i)];
+            const LocPoint &pos = carsVisiblePos.at(i);
+
+            // GPS Location
+            LocPoint pos_gps = carInfo.getLocationGps();
+            painter.setBrush(Qt::magenta);
+            painter.drawEllipse(pos_gps.getPointMm(), car_h / 15.0, car_h / 15.0);
+
+            // Autopilot state
+            LocPoint ap_goal = carInfo.getApGoal();
+            if (ap_goal.getRadius() > 0.0) {
+                QPointF p = ap_goal.getPointMm();
+                pen.setWidthF(3.0 / mScaleFactor);
+                pen.setColor(carInfo.getId() == mSelectedCar ? QColor(carInfo.getColor()) : QColor(Qt::lightGray));
+                painter.setPen(pen);
+                painter.drawEllipse(p, 10 / mScaleFactor, 10 / mScaleFactor);
 
-            QPointF pm = pos.getPointMm();
-            painter.setBrush(Qt::transparent);
-            painter.drawEllipse(pm, ap_goal.getRadius() * 1000.0, ap_goal.getRadius() * 1000.0);
+                QPointF pm = pos.getPointMm();
+                painter.setBrush(Qt::transparent);
+                painter.drawEllipse(pm, ap_goal.getRadius() * 1000.0, ap_goal.getRadius() * 1000.0);
+                painter.setPen(QPen(textColor));
+            }
         }
+    }
 
-        painter.setPen(QPen(textColor));
+    for (QHash<QRgb, QPolygonF>::const_iterator it = carDots.constBegin();it != carDots.constEnd();++it) {
+        QPen dotPen(QColor::fromRgba(it.key()), mCarGlyphMinPx);
+        dotPen.setCosmetic(true);
+        dotPen.setCapStyle(Qt::RoundCap);
+        painter.setPen(dotPen);
+        painter.drawPoints(it.value());
+    }
+
+    // Print data
+    painter.setTransform(txtTrans);
+    painter.setPen(QPen(textColor));
+    for (int i = 0;i < carsVisible.size();i++) {
+        CarInfo &carInfo = mCarInfo[carsVisible.at(i)];
+
+        if (!carDrawLabels && carInfo.getId() != mSelectedCar) {
+            continue;
+        }
+
+        bool moving = mPredictPose && carInfo.isPredictionMoving(timeNow);
+        const LocPoint &pos = carsVisiblePos.at(i);
+        x = pos.getX() * 1000.0;
+        y = pos.getY() * 1000.0;
+        angle = pos.getYaw() * 180.0 / M_PI;
+
+        if (carInfo.isDirty() || moving || !mCarLabels.contains(carInfo.getId())) {
+            QTime t = QTime::fromMSecsSinceStartOfDay(carInfo.getTime());
+            txt.sprintf("%s\n"
+                        "(%.3f, %.3f, %.0f)\n"
+                        "%02d:%02d:%02d:%03d",
+                        carInfo.getName().toLocal8Bit().data(),
+                        pos.getX(), pos.getY(), angle,
+                        t.hour(), t.minute(), t.second(), t.msec());
+            txt.replace('\n', QChar::LineSeparator);
+
+            QStaticText &label = mCarLabels[carInfo.getId()];
+            label.setTextFormat(Qt::PlainText);
+            label.setText(txt);
+            carInfo.clearDirty();
+        }
 
-        // Print data
-        QTime t = QTime::fromMSecsSinceStartOfDay(carInfo.getTime());
-        txt.sprintf("%s\n"
-                    "(%.3f, %.3f, %.0f)\n"
-                    "%02d:%02d:%02d:%03d",
-                    carInfo.getName().toLocal8Bit().data(),
-                    pos.getX(), pos.getY(), angle,
-                    t.hour(), t.minute(), t.second(), t.msec());
         pt_txt.setX(x + 120 + (car_w - 190) * ((cos(pos.getYaw()) + 1) / 2));
         pt_txt.setY(y);
-        painter.setTransform(txtTrans);
         pt_txt = drawTrans.map(pt_txt);
-        rect_txt.setCoords(pt_txt.x(), pt_txt.y() - 20,
-                           pt_txt.x() + 300, pt_txt.y() + 25);
-        painter.drawText(rect_txt, txt);
+        painter.drawStaticText(QPointF(pt_txt.x(), pt_txt.y() - 20), mCarLabels[carInfo.getId()]);
     }
 
     // Draw copters
@@ -1221,6 +1379,12 @@ void MapWidget::paintEvent(QPaintEvent *event)
         start_txt += txt_row_h;
     }
 
+    if (mDrawRouteConflicts) {
+        txt.sprintf("Conflicts: %d", mRouteConflicts->getConflictNum());
+        painter.drawText(width() - 140.0, start_txt, txt);
+        start_txt += txt_row_h;
+    }
+
     painter.end();
 }
 
@@ -1257,6 +1421,7 @@ void MapWidget::mouseMoveEvent(QMouseEvent *e)
         pos.setXY(p.x() / 1000.0, p.y() / 1000.0);
 
         mRoutes[mRouteNow][mRoutePointSelected].setXY(pos.getX(), pos.getY());
+        routeChanged(mRouteNow);
         update();
     }
 
@@ -1281,15 +1446,13 @@ void MapWidget::mousePressEvent(QMouseEvent *e)
     if (ctrl) {
         if (e->buttons() & Qt::LeftButton) {
             if (mSelectedCar >= 0 && (e->buttons() & Qt::LeftButton)) {
-                for (int i = 0;i < mCarInfo.size();i++) {
-                    CarInfo &carInfo = mCarInfo[i];
-                    if (carInfo.getId() == mSelectedCar) {
-                        LocPoint pos = carInfo.getLocation();
-                        QPoint p = getMousePosRelative();
-                        pos.setXY(p.x() / 1000.0, p.y() / 1000.0);
-                        carInfo.setLocation(pos);
-                        emit posSet(mSelectedCar, pos);
-                    }
+                CarInfo *carInfo = getCarInfo(mSelectedCar);
+                if (carInfo) {
+                    LocPoint pos = carInfo->getLocation();
+                    QPoint p = getMousePosRelative();
+                    pos.setXY(p.x() / 1000.0, p.y() / 1000.0);
+                    carInfo->setLocation(pos);
+                    emit posSet(mSelectedCar, pos);
                 }
 
                 for (int i = 0;i < mCopterInfo.size();i++) {
@@ -1307,6 +1470,7 @@ void MapWidget::mousePressEvent(QMouseEvent *e)
             if (routeFound) {
                 mRoutes[mRouteNow][routeInd].setSpeed(mRoutePointSpeed);
                 mRoutes[mRouteNow][routeInd].setTime(mRoutePointTime);
+                routeChanged(mRouteNow);
             }
         }
         update();
@@ -1331,6 +1495,7 @@ void MapWidget::mousePressEvent(QMouseEvent *e)
                 emit lastRoutePointRemoved(pos);
             }
         }
+        routeChanged(mRouteNow);
         update();
     } else if (ctrl_shift) {
         if (e->buttons() & Qt::LeftButton) {
@@ -1364,17 +1529,15 @@ void MapWidget::mouseReleaseEvent(QMouseEvent *e)
 void MapWidget::wheelEvent(QWheelEvent *e)
 {
     if (e->modifiers() & Qt::ControlModifier && mSelectedCar >= 0) {
-        for (int i = 0;i < mCarInfo.size();i++) {
-            CarInfo &carInfo = mCarInfo[i];
-            if (carInfo.getId() == mSelectedCar) {
-                LocPoint pos = carInfo.getLocation();
-                double angle = pos.getYaw() + (double)e->delta() * 0.0005;
-                normalizeAngleRad(angle);
-                pos.setYaw(angle);
-                carInfo.setLocation(pos);
-                emit posSet(mSelectedCar, pos);
-                update();
-            }
+        CarInfo *carInfo = getCarInfo(mSelectedCar);
+        if (carInfo) {
+            LocPoint pos = carInfo->getLocation();
+            double angle = pos.getYaw() + (double)e->delta() * 0.0005;
+            normalizeAngleRad(angle);
+            pos.setYaw(angle);
+            carInfo->setLocation(pos);
+            emit posSet(mSelectedCar, pos);
+            update();
         }
 
         for (int i = 0;i < mCopterInfo.size();i++) {
@@ -1506,6 +1669,48 @@ void MapWidget::setDrawGrid(bool drawGrid)
     update();
 }
 
+bool MapWidget::getDrawRouteConflicts() const
+{
+    return mDrawRouteConflicts;
+}
+
+void MapWidget::setDrawRouteConflicts(bool drawRouteConflicts)
+{
+    mDrawRouteConflicts = drawRouteConflicts;
+
+    if (mDrawRouteConflicts) {
+        for (int i = 0;i < mRoutes.size();i++) {
+            mRouteConflicts->updateRoute(i, mRoutes.at(i));
+        }
+    } else {
+        mRouteConflicts->clear();
+    }
+
+    update();
+}
+
+double MapWidget::getRouteConflictRadius() const
+{
+    return mRouteConflicts->getRadius();
+}
+
+void MapWidget::setRouteConflictRadius(double radius)
+{
+    mRouteConflicts->setRadius(radius);
+    update();
+}
+
+bool MapWidget::getPredictPose() const
+{
+    return mPredictPose;
+}
+
+void MapWidget::setPredictPose(bool predictPose)
+{
+    mPredictPose = predictPose;
+    update();
+}
+
 void MapWidget::updateClosestInfoPoint()
 {
     QPointF mpq = getMousePosRelative();
@@ -1589,6 +1794,13 @@ int MapWidget::drawInfoPoints(QPainter &painter, const QList<LocPoint> &pts,
     return drawn;
 }
 
+void MapWidget::routeChanged(int route)
+{
+    if (mDrawRouteConflicts) {
+        mRouteConflicts->updateRoute(route, mRoutes.at(route));
+    }
+}
+
 int MapWidget::getClosestPoint(LocPoint p, QList<LocPoint> points, double &dist)
 {
     int closest = -1;
@@ -1708,3 +1920,83 @@ void MapWidget::getEnuRef(double *llh)
     llh[1] = mRefLon;
     llh[2] = mRefHeight;
 }
+
+/**
+ * @brief MapWidget::carIndex
+ * Get the index of a car in mCarInfo. Ids can be changed through the pointer
+ * from getCarInfo, so the index is rebuilt if it does not match.
+ *
+ * @param id
+ * The car id.
+ *
+ * @return
+ * The index, or -1 if there is no car with that id.
+ */
+int MapWidget::carIndex(int id)
+{
+    int ind = mCarIndex.value(id, -1);
+
+    if (ind >= 0 && ind < mCarInfo.size() && mCarInfo[ind].getId() == id) {
+        return ind;
+    }
+
+    mCarIndex.clear();
+    ind = -1;
+    for (int i = 0;i < mCarInfo.size();i++) {
+        int carId = mCarInfo[i].getId();
+        if (!mCarIndex.contains(carId)) {
+            mCarIndex.insert(carId, i);
+        }
+
+        if (ind < 0 && carId == id) {
+            ind = i;
+        }
+    }
+
+    return ind;
+}
+
+/**
+ * @brief MapWidget::carGlyph
+ * Get the pixmap of a car symbol, rendering it if it is not cached.
+ *
+ * @param key
+ * The cache key from carGlyphKey.
+ *
+ * @param color
+ * The hull color.
+ *
+ * @param selected
+ * Draw the car as selected.
+ *
+ * @param size
+ * The width of the pixmap in pixels. It covers carGlyphWidth mm.
+ *
+ * @return
+ * The pixmap.
+ */
+const QPixmap &MapWidget::carGlyph(quint64 key, Qt::GlobalColor color, bool selected, int size)
+{
+    QHash<quint64, QPixmap>::iterator it = mCarGlyphs.find(key);
+    if (it != mCarGlyphs.end()) {
+        return it.value();
+    }
+
+    const double ppm = (double)size / carGlyphWidth();
+    const int height = (int)ceil((car_h + 2.0 * car_corner) * ppm);
+
+    QPixmap glyph(size, height);
+    glyph.fill(Qt::transparent);
+
+    QPainter painter(&glyph);
+    painter.setRenderHint(QPainter::Antialiasing, mAntialiasDrawings);
+    painter.translate(size / 2.0, height / 2.0);
+    painter.scale(ppm, ppm);
+    const QColor textColor = QPalette::Foreground;
+    painter.setPen(QPen(textColor));
+    drawCarShape(painter, selected ? Qt::black : Qt::darkGray,
+                 selected ? Qt::green : Qt::lightGray, color, Qt::blue);
+    painter.end();
+
+    return mCarGlyphs.insert(key, glyph).value();
+}
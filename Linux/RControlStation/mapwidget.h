@@ -28,12 +28,16 @@
 #include <QList>
 #include <QInputDialog>
 #include <QTimer>
+#include <QHash>
+#include <QPixmap>
+#include <QStaticText>
 
 #include "locpoint.h"
 #include "carinfo.h"
 #include "copterinfo.h"
 #include "perspectivepixmap.h"
 #include "osmclient.h"
+#include "routeconflicts.h"
 
 class MapWidget : public QWidget
 {
@@ -111,6 +115,15 @@ public:
     int getInfoTraceNow() const;
     void setInfoTraceNow(int infoTraceNow);
 
+    bool getDrawRouteConflicts() const;
+    void setDrawRouteConflicts(bool drawRouteConflicts);
+
+    double getRouteConflictRadius() const;
+    void setRouteConflictRadius(double radius);
+
+    bool getPredictPose() const;
+    void setPredictPose(bool predictPose);
+
 signals:
     void scaleChanged(double newScale);
     void offsetChanged(double newXOffset, double newYOffset);
@@ -122,6 +135,7 @@ signals:
 private slots:
     void tileReady(OsmTile tile);
     void errorGetTile(QString reason);
+    void predictTimerSlot();
 
 protected:
     void paintEvent(QPaintEvent *event);
@@ -132,6 +146,9 @@ protected:
 
 private:
     QList<CarInfo> mCarInfo;
+    QHash<int, int> mCarIndex;
+    QHash<int, QStaticText> mCarLabels;
+    QHash<quint64, QPixmap> mCarGlyphs;
     QList<CopterInfo> mCopterInfo;
     QList<LocPoint> mCarTrace;
     QList<LocPoint> mCarTraceGps;
@@ -172,8 +189,25 @@ private:
     int mInfoTraceNow;
     double mTraceMinSpaceCar;
     double mTraceMinSpaceGps;
+    RouteConflicts *mRouteConflicts;
+    bool mDrawRouteConflicts;
+    bool mPredictPose;
+    QTimer *mPredictTimer;
+
+    // Car symbols smaller than mCarGlyphMinPx are drawn as dots, and larger
+    // than mCarGlyphMaxPx without the pixmap cache. Labels are only drawn
+    // for the selected car when the symbols are smaller than mCarLabelMinPx
+    // and there are more than mCarLabelLodCars cars.
+    static const int mCarGlyphMinPx = 4;
+    static const int mCarGlyphMaxPx = 256;
+    static const int mCarGlyphCacheMax = 64;
+    static const int mCarLabelMinPx = 40;
+    static const int mCarLabelLodCars = 10;
 
     void updateClosestInfoPoint();
+    int carIndex(int id);
+    const QPixmap &carGlyph(quint64 key, Qt::GlobalColor color, bool selected, int size);
+    void routeChanged(int route);
     int drawInfoPoints(QPainter &painter, const QList<LocPoint> &pts,
                         QTransform drawTrans, QTransform txtTrans,
                        double xStart, double xEnd, double yStart, double yEnd,
@@ -0,0 +1,330 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "multilateration.h"
+#include <cmath>
+
+namespace {
+const int maxIterations = 15;
+const double stepTolerance = 1e-4;
+const double minGeometryDet = 1e-6;
+}
+
+Multilateration::Multilateration()
+{
+    mTagHeight = 0.0;
+    mMaxAgeMs = 1000;
+    mOutlierThreshold = 0.5;
+    mMaxJump = 1.0;
+    reset();
+}
+
+void Multilateration::setAnchor(int id, double px, double py, double pz)
+{
+    anchor_t a;
+    a.px = px;
+    a.py = py;
+    a.pz = pz;
+    mAnchors.insert(id, a);
+}
+
+void Multilateration::removeAnchor(int id)
+{
+    mAnchors.remove(id);
+    mRanges.remove(id);
+}
+
+void Multilateration::clearAnchors()
+{
+    mAnchors.clear();
+    mRanges.clear();
+}
+
+void Multilateration::reset()
+{
+    mRanges.clear();
+    mFixValid = false;
+    mLastFixOdomX = 0.0;
+    mLastFixOdomY = 0.0;
+}
+
+/**
+ * @brief Multilateration::addRange
+ * Add a range sample and try to solve for the tag position. The latest range
+ * to every known anchor that is younger than the maximum age is used. Since
+ * the anchors are ranged one after the other while the car is moving, the
+ * anchor positions of older ranges are shifted by the odometry displacement
+ * since the range was taken.
+ *
+ * The position is solved with Gauss-Newton. If there are more ranges than
+ * needed, the range with the largest residual is dropped for as long as it is
+ * above the outlier threshold.
+ *
+ * With only three ranges the bad range cannot be identified, and most of its
+ * error goes into the position rather than the residuals. The fit error is
+ * therefore scaled by the number of redundant ranges before it is compared
+ * to the threshold, and while there is a recent fix, a fix further than the
+ * maximum jump from where odometry says the car should be is rejected.
+ *
+ * @param anchorId
+ * The anchor the range was measured to.
+ *
+ * @param range
+ * The range in meters.
+ *
+ * @param timeMs
+ * The time of the range sample.
+ *
+ * @param odomX
+ * The x position of the car from odometry when the range was measured.
+ *
+ * @param odomY
+ * The y position of the car from odometry when the range was measured.
+ *
+ * @param fix
+ * The fix, if there is one.
+ *
+ * @return
+ * True if a new fix was computed.
+ */
+bool Multilateration::addRange(int anchorId, double range, qint32 timeMs,
+                               double odomX, double odomY, fix_t &fix)
+{
+    if (!mAnchors.contains(anchorId) || range <= 0.0) {
+        return false;
+    }
+
+    range_t r;
+    r.range = range;
+    r.timeMs = timeMs;
+    r.odomX = odomX;
+    r.odomY = odomY;
+    mRanges.insert(anchorId, r);
+
+    QVector<obs_t> obs;
+    QHashIterator<int, range_t> it(mRanges);
+    while (it.hasNext()) {
+        it.next();
+        const range_t &rn = it.value();
+        qint32 age = timeMs - rn.timeMs;
+
+        if (age < 0 || age > mMaxAgeMs || !mAnchors.contains(it.key())) {
+            continue;
+        }
+
+        const anchor_t &a = mAnchors[it.key()];
+        obs_t o;
+        o.ax = a.px + (odomX - rn.odomX);
+        o.ay = a.py + (odomY - rn.odomY);
+        o.dz = a.pz - mTagHeight;
+        o.range = rn.range;
+        o.res = 0.0;
+        obs.append(o);
+    }
+
+    if (obs.size() < 3) {
+        return false;
+    }
+
+    // Start from the last fix moved with odometry, or the odometry
+    // position itself.
+    double px = odomX;
+    double py = odomY;
+    bool predicted = false;
+    if (mFixValid) {
+        qint32 age = timeMs - mLastFix.timeMs;
+        if (age >= 0 && age <= 2 * mMaxAgeMs) {
+            px = mLastFix.px + (odomX - mLastFixOdomX);
+            py = mLastFix.py + (odomY - mLastFixOdomY);
+            predicted = true;
+        }
+    }
+
+    const double px0 = px;
+    const double py0 = py;
+    int iterations = 0;
+    int rejected = 0;
+    double rms = 0.0;
+
+    for (;;) {
+        px = px0;
+        py = py0;
+
+        if (!solve(obs, px, py, iterations)) {
+            return false;
+        }
+
+        rms = updateResiduals(obs, px, py);
+
+        if (obs.size() <= 3) {
+            break;
+        }
+
+        int worst = 0;
+        for (int i = 1;i < obs.size();i++) {
+            if (fabs(obs.at(i).res) > fabs(obs.at(worst).res)) {
+                worst = i;
+            }
+        }
+
+        if (fabs(obs.at(worst).res) <= mOutlierThreshold) {
+            break;
+        }
+
+        obs.remove(worst);
+        rejected++;
+    }
+
+    if (rms > mOutlierThreshold) {
+        return false;
+    }
+
+    if (predicted && sqrt((px - px0) * (px - px0) + (py - py0) * (py - py0)) > mMaxJump) {
+        return false;
+    }
+
+    fix.px = px;
+    fix.py = py;
+    fix.rms = rms;
+    fix.rangesUsed = obs.size();
+    fix.rangesRejected = rejected;
+    fix.iterations = iterations;
+    fix.timeMs = timeMs;
+
+    mLastFix = fix;
+    mLastFixOdomX = odomX;
+    mLastFixOdomY = odomY;
+    mFixValid = true;
+
+    return true;
+}
+
+double Multilateration::getTagHeight() const
+{
+    return mTagHeight;
+}
+
+void Multilateration::setTagHeight(double tagHeight)
+{
+    mTagHeight = tagHeight;
+}
+
+qint32 Multilateration::getMaxAgeMs() const
+{
+    return mMaxAgeMs;
+}
+
+void Multilateration::setMaxAgeMs(qint32 maxAgeMs)
+{
+    mMaxAgeMs = maxAgeMs;
+}
+
+double Multilateration::getOutlierThreshold() const
+{
+    return mOutlierThreshold;
+}
+
+void Multilateration::setOutlierThreshold(double outlierThreshold)
+{
+    mOutlierThreshold = outlierThreshold;
+}
+
+double Multilateration::getMaxJump() const
+{
+    return mMaxJump;
+}
+
+void Multilateration::setMaxJump(double maxJump)
+{
+    mMaxJump = maxJump;
+}
+
+/**
+ * @brief Multilateration::solve
+ * Gauss-Newton on the 2D position, with the height difference to each anchor
+ * as a constant. The normal equations are only 2x2, so they are solved
+ * directly. A near-singular system means that the anchors are close to being
+ * on a line as seen from the tag, in which case there is no fix.
+ */
+bool Multilateration::solve(QVector<obs_t> &obs, double &px, double &py, int &iterations)
+{
+    for (int iter = 0;iter < maxIterations;iter++) {
+        double a11 = 0.0, a12 = 0.0, a22 = 0.0;
+        double b1 = 0.0, b2 = 0.0;
+
+        for (int i = 0;i < obs.size();i++) {
+            const obs_t &o = obs.at(i);
+            double dx = px - o.ax;
+            double dy = py - o.ay;
+            double rho = sqrt(dx * dx + dy * dy + o.dz * o.dz);
+
+            if (rho < 1e-9) {
+                continue;
+            }
+
+            double jx = dx / rho;
+            double jy = dy / rho;
+            double res = rho - o.range;
+
+            a11 += jx * jx;
+            a12 += jx * jy;
+            a22 += jy * jy;
+            b1 += jx * res;
+            b2 += jy * res;
+        }
+
+        double det = a11 * a22 - a12 * a12;
+        if (fabs(det) < minGeometryDet) {
+            return false;
+        }
+
+        double sx = -(a22 * b1 - a12 * b2) / det;
+        double sy = -(a11 * b2 - a12 * b1) / det;
+
+        px += sx;
+        py += sy;
+        iterations = iter + 1;
+
+        if (sqrt(sx * sx + sy * sy) < stepTolerance) {
+            break;
+        }
+    }
+
+    return std::isfinite(px) && std::isfinite(py);
+}
+
+/**
+ * @brief Multilateration::updateResiduals
+ * Update the residual of every range and return the fit error, which is the
+ * residual RMS corrected for the two degrees of freedom of the position. With
+ * three ranges only one degree of freedom is left for the residuals, so the
+ * plain RMS would hide most of an outlier.
+ */
+double Multilateration::updateResiduals(QVector<obs_t> &obs, double px, double py)
+{
+    double sum = 0.0;
+
+    for (int i = 0;i < obs.size();i++) {
+        obs_t &o = obs[i];
+        double dx = px - o.ax;
+        double dy = py - o.ay;
+        o.res = sqrt(dx * dx + dy * dy + o.dz * o.dz) - o.range;
+        sum += o.res * o.res;
+    }
+
+    return sqrt(sum / (double)(obs.size() - 2));
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef MULTILATERATION_H
+#define MULTILATERATION_H
+
+#include <QHash>
+#include <QVector>
+
+class Multilateration
+{
+public:
+    typedef struct {
+        double px;
+        double py;
+        double rms; // Residual RMS corrected for the redundancy
+        int rangesUsed;
+        int rangesRejected;
+        int iterations;
+        qint32 timeMs;
+    } fix_t;
+
+    Multilateration();
+    void setAnchor(int id, double px, double py, double pz);
+    void removeAnchor(int id);
+    void clearAnchors();
+    void reset();
+    bool addRange(int anchorId, double range, qint32 timeMs,
+                  double odomX, double odomY, fix_t &fix);
+
+    double getTagHeight() const;
+    void setTagHeight(double tagHeight);
+    qint32 getMaxAgeMs() const;
+    void setMaxAgeMs(qint32 maxAgeMs);
+    double getOutlierThreshold() const;
+    void setOutlierThreshold(double outlierThreshold);
+    double getMaxJump() const;
+    void setMaxJump(double maxJump);
+
+private:
+    typedef struct {
+        double px;
+        double py;
+        double pz;
+    } anchor_t;
+
+    typedef struct {
+        double range;
+        qint32 timeMs;
+        double odomX;
+        double odomY;
+    } range_t;
+
+    typedef struct {
+        double ax;
+        double ay;
+        double dz;
+        double range;
+        double res;
+    } obs_t;
+
+    QHash<int, anchor_t> mAnchors;
+    QHash<int, range_t> mRanges;
+    double mTagHeight;
+    qint32 mMaxAgeMs;
+    double mOutlierThreshold;
+    double mMaxJump;
+    bool mFixValid;
+    fix_t mLastFix;
+    double mLastFixOdomX;
+    double mLastFixOdomY;
+
+    bool solve(QVector<obs_t> &obs, double &px, double &py, int &iterations);
+    double updateResiduals(QVector<obs_t> &obs, double px, double py);
+
+};
+
+#endif // MULTILATERATION_H
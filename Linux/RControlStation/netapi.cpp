@@ -0,0 +1,481 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "netapi.h"
+#include "netprotocol.h"
+#include "utility.h"
+#include <QDebug>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QPointer>
+
+NetApi::NetApi(QObject *parent) : QObject(parent)
+{
+    mTcpServer = new QTcpServer(this);
+    mLocalServer = new QLocalServer(this);
+    mPacketInterface = 0;
+    mSendToCars = true;
+    mSubMinIntervalMs = 20;
+    mStationEnuRefSet = false;
+    mStationEnuRef[0] = 0.0;
+    mStationEnuRef[1] = 0.0;
+    mStationEnuRef[2] = 0.0;
+
+    connect(mTcpServer, SIGNAL(newConnection()), this, SLOT(tcpNewConnection()));
+    connect(mLocalServer, SIGNAL(newConnection()), this, SLOT(localNewConnection()));
+}
+
+bool NetApi::startTcpServer(int port)
+{
+    if (!mTcpServer->listen(QHostAddress::Any, port)) {
+        mErrorString = mTcpServer->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief NetApi::startLocalServer
+ * Start listening on a local socket. A stale socket with the same name is
+ * removed first.
+ *
+ * @param name
+ * The socket name, or a path for a socket file.
+ *
+ * @return
+ * True on success.
+ */
+bool NetApi::startLocalServer(QString name)
+{
+    QLocalServer::removeServer(name);
+
+    if (!mLocalServer->listen(name)) {
+        mErrorString = mLocalServer->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief NetApi::stopServer
+ * Stop listening and disconnect all clients.
+ */
+void NetApi::stopServer()
+{
+    mTcpServer->close();
+    mLocalServer->close();
+
+    for (NetApiClient *client: mClients) {
+        client->deleteLater();
+    }
+
+    mClients.clear();
+    emit clientsChanged(0);
+    emit subscriptionsChanged();
+}
+
+QString NetApi::errorString()
+{
+    return mErrorString;
+}
+
+QString NetApi::serverName()
+{
+    return mLocalServer->fullServerName();
+}
+
+quint16 NetApi::serverPort()
+{
+    return mTcpServer->serverPort();
+}
+
+int NetApi::clientNum()
+{
+    return mClients.size();
+}
+
+void NetApi::setPacketInterface(PacketInterface *packetInterface)
+{
+    mPacketInterface = packetInterface;
+}
+
+/**
+ * @brief NetApi::setSendToCars
+ * Enable or disable forwarding of client commands to the cars. When
+ * disabled, the commands are still accepted and routeReceived and enuRefSet
+ * are still emitted.
+ */
+void NetApi::setSendToCars(bool send)
+{
+    mSendToCars = send;
+}
+
+/**
+ * @brief NetApi::setSubMinIntervalMs
+ * Set the shortest state interval that is granted to a subscription.
+ */
+void NetApi::setSubMinIntervalMs(int ms)
+{
+    mSubMinIntervalMs = ms;
+}
+
+/**
+ * @brief NetApi::setStationEnuRef
+ * Set the ENU reference of the station, which is sent to clients that ask
+ * for the map reference. Owners that keep the reference elsewhere can
+ * update it from stationEnuRefRequested.
+ */
+void NetApi::setStationEnuRef(double lat, double lon, double height)
+{
+    mStationEnuRef[0] = lat;
+    mStationEnuRef[1] = lon;
+    mStationEnuRef[2] = height;
+    mStationEnuRefSet = true;
+}
+
+/**
+ * @brief NetApi::isPolled
+ * Check if any client subscribed with NET_SUB_POLL for a car.
+ */
+bool NetApi::isPolled(quint8 id)
+{
+    for (NetApiClient *client: mClients) {
+        if (client->pollsCar(id)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief NetApi::pollIntervalMs
+ * The shortest interval among the clients that asked for polling.
+ *
+ * @return
+ * The interval, or -1 if no client asked for polling.
+ */
+int NetApi::pollIntervalMs()
+{
+    int res = -1;
+
+    for (NetApiClient *client: mClients) {
+        if ((client->subFlags() & NET_SUB_POLL) &&
+                (res < 0 || client->subIntervalMs() < res)) {
+            res = client->subIntervalMs();
+        }
+    }
+
+    return res;
+}
+
+void NetApi::sendState(quint8 id, CAR_STATE state)
+{
+    // Requested states are always sent, subscribed states are decimated to
+    // the interval of every client.
+    QByteArray msg;
+    for (NetApiClient *client: mClients) {
+        if (client->takeState(id)) {
+            if (msg.isEmpty()) {
+                msg = NetProtocol::encodeState(id, state);
+            }
+            client->sendMessage(msg);
+        }
+    }
+}
+
+void NetApi::sendEnuRef(quint8 id, double lat, double lon, double height)
+{
+    QByteArray msg;
+    for (NetApiClient *client: mClients) {
+        if (client->takeEnuRef(id)) {
+            if (msg.isEmpty()) {
+                msg = NetProtocol::encodeEnuRef(NET_MSG_ENU_REF, id, lat, lon, height);
+            }
+            client->sendMessage(msg);
+        }
+    }
+}
+
+void NetApi::tcpNewConnection()
+{
+    while (mTcpServer->hasPendingConnections()) {
+        QTcpSocket *socket = mTcpServer->nextPendingConnection();
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, true);
+        addClient(socket);
+    }
+}
+
+void NetApi::localNewConnection()
+{
+    while (mLocalServer->hasPendingConnections()) {
+        addClient(mLocalServer->nextPendingConnection());
+    }
+}
+
+void NetApi::clientMessageReceived(NetApiClient *client, QByteArray data)
+{
+    processMessage(client, data);
+}
+
+void NetApi::clientDisconnected(NetApiClient *client)
+{
+    mClients.removeAll(client);
+    client->deleteLater();
+    emit clientsChanged(mClients.size());
+
+    if (client->subFlags() & NET_SUB_POLL) {
+        emit subscriptionsChanged();
+    }
+}
+
+void NetApi::addClient(QIODevice *socket)
+{
+    NetApiClient *client = new NetApiClient(socket, this);
+
+    connect(client, SIGNAL(messageReceived(NetApiClient*,QByteArray)),
+            this, SLOT(clientMessageReceived(NetApiClient*,QByteArray)));
+    connect(client, SIGNAL(disconnected(NetApiClient*)),
+            this, SLOT(clientDisconnected(NetApiClient*)));
+
+    mClients.append(client);
+    emit clientsChanged(mClients.size());
+}
+
+/**
+ * @brief NetApi::processMessage
+ * Handle a message from a client.
+ *
+ * @param client
+ * The client that sent the message. Answers and errors go to this client.
+ *
+ * @param data
+ * The packet payload, starting with the message type.
+ */
+void NetApi::processMessage(NetApiClient *client, const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return;
+    }
+
+    const uint8_t *buffer = (const uint8_t*)data.constData();
+    NET_MSG msg = (NET_MSG)buffer[0];
+    bool sendCar = mSendToCars && mPacketInterface;
+    QString ackError = "No ACK received from car. Make sure that the car connection works.";
+
+    // The calls that wait for an ACK run the event loop, so the client can
+    // disconnect and be deleted before they return.
+    QPointer<NetApiClient> guard(client);
+
+    switch (msg) {
+    case NET_MSG_HELLO: {
+        client->sendMessage(NetProtocol::encodeHello());
+
+        if (data.size() < 2 || buffer[1] != NET_PROTOCOL_VERSION) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Unsupported protocol version"));
+        }
+    } break;
+
+    case NET_MSG_SUBSCRIBE: {
+        int32_t ind = 1;
+
+        if (data.size() < 5 || data.size() < (5 + buffer[4])) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        quint8 flags = buffer[ind++];
+        int intervalMs = utility::buffer_get_uint16(buffer, &ind);
+        if (intervalMs < mSubMinIntervalMs) {
+            intervalMs = mSubMinIntervalMs;
+        }
+
+        QVector<quint8> ids;
+        int num = buffer[ind++];
+        for (int i = 0;i < num;i++) {
+            ids.append(buffer[ind++]);
+        }
+
+        client->subscribe(flags, intervalMs, ids);
+        client->sendMessage(NetProtocol::encodeSubscribed(flags, intervalMs));
+        emit subscriptionsChanged();
+    } break;
+
+    case NET_MSG_GET_STATE: {
+        if (data.size() < 2) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        client->requestState(buffer[1]);
+
+        if (sendCar) {
+            mPacketInterface->getState(buffer[1]);
+        }
+    } break;
+
+    case NET_MSG_GET_ENU_REF: {
+        if (data.size() < 3) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        if (buffer[2]) {
+            emit stationEnuRefRequested();
+
+            if (mStationEnuRefSet) {
+                client->sendMessage(NetProtocol::encodeEnuRef(NET_MSG_ENU_REF, 255,
+                                                              mStationEnuRef[0],
+                                                              mStationEnuRef[1],
+                                                              mStationEnuRef[2]));
+            } else {
+                client->sendMessage(NetProtocol::encodeError(msg, "No ENU reference set on the station"));
+            }
+        } else {
+            client->requestEnuRef(buffer[1]);
+
+            if (sendCar) {
+                mPacketInterface->getEnuRef(buffer[1]);
+            }
+        }
+    } break;
+
+    case NET_MSG_SET_ENU_REF: {
+        quint8 id;
+        double llh[3];
+
+        if (!NetProtocol::decodeEnuRef(data, id, llh[0], llh[1], llh[2])) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        if (id == 255) {
+            setStationEnuRef(llh[0], llh[1], llh[2]);
+        } else if (sendCar && !mPacketInterface->setEnuRef(id, llh)) {
+            if (guard) {
+                client->sendMessage(NetProtocol::encodeError(msg, ackError));
+            }
+        }
+
+        emit enuRefSet(id, llh[0], llh[1], llh[2]);
+    } break;
+
+    case NET_MSG_ROUTE_ADD:
+    case NET_MSG_ROUTE_REPLACE: {
+        quint8 id;
+        QList<LocPoint> route;
+
+        if (!NetProtocol::decodeRoute(data, id, route)) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        if (sendCar) {
+            bool ok = msg == NET_MSG_ROUTE_ADD ?
+                        mPacketInterface->setRoutePoints(id, route) :
+                        mPacketInterface->replaceRoute(id, route);
+
+            if (!ok && guard) {
+                client->sendMessage(NetProtocol::encodeError(msg, ackError));
+            }
+        }
+
+        emit routeReceived(id, route, msg == NET_MSG_ROUTE_REPLACE);
+    } break;
+
+    case NET_MSG_ROUTE_REMOVE_LAST:
+    case NET_MSG_ROUTE_CLEAR: {
+        if (data.size() < 2) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        if (sendCar) {
+            bool ok = msg == NET_MSG_ROUTE_CLEAR ?
+                        mPacketInterface->clearRoute(buffer[1]) :
+                        mPacketInterface->removeLastRoutePoint(buffer[1]);
+
+            if (!ok && guard) {
+                client->sendMessage(NetProtocol::encodeError(msg, ackError));
+            }
+        }
+    } break;
+
+    case NET_MSG_AP_ACTIVE: {
+        if (data.size() < 3) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        if (sendCar && !mPacketInterface->setApActive(buffer[1], buffer[2])) {
+            if (guard) {
+                client->sendMessage(NetProtocol::encodeError(msg, ackError));
+            }
+        }
+    } break;
+
+    case NET_MSG_RC_CONTROL: {
+        int32_t ind = 1;
+
+        if (data.size() < 11) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid length"));
+            break;
+        }
+
+        quint8 id = buffer[ind++];
+        int mode = buffer[ind++];
+        double value = utility::buffer_get_double32_auto(buffer, &ind);
+        double steering = utility::buffer_get_double32_auto(buffer, &ind);
+
+        if (mode < RC_MODE_CURRENT || mode > RC_MODE_CURRENT_BRAKE) {
+            client->sendMessage(NetProtocol::encodeError(msg, "Invalid mode"));
+            break;
+        }
+
+        if (!sendCar) {
+            break;
+        }
+
+        switch (mode) {
+        case RC_MODE_CURRENT:
+            mPacketInterface->setRcControlCurrent(id, value, steering);
+            break;
+
+        case RC_MODE_DUTY:
+            mPacketInterface->setRcControlDuty(id, value / 100.0, steering);
+            break;
+
+        case RC_MODE_PID:
+            mPacketInterface->setRcControlPid(id, value, steering);
+            break;
+
+        case RC_MODE_CURRENT_BRAKE:
+            mPacketInterface->setRcControlCurrentBrake(id, value, steering);
+            break;
+
+        default:
+            break;
+        }
+    } break;
+
+    default:
+        client->sendMessage(NetProtocol::encodeError(msg, "Message type not supported"));
+        break;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef NETAPI_H
+#define NETAPI_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QLocalServer>
+#include <QList>
+#include "packetinterface.h"
+#include "netapiclient.h"
+#include "locpoint.h"
+
+// Server side of the binary protocol in netprotocol.h. It accepts any number
+// of clients on a TCP port (NetworkInterface) or a local socket
+// (StationDaemon), keeps the subscription of every client and forwards
+// commands to the cars through PacketInterface. The owner feeds it the
+// received states and ENU references with sendState and sendEnuRef.
+class NetApi : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NetApi(QObject *parent = 0);
+    bool startTcpServer(int port);
+    bool startLocalServer(QString name);
+    void stopServer();
+    QString errorString();
+    QString serverName();
+    quint16 serverPort();
+    int clientNum();
+    void setPacketInterface(PacketInterface *packetInterface);
+    void setSendToCars(bool send);
+    void setSubMinIntervalMs(int ms);
+    void setStationEnuRef(double lat, double lon, double height);
+    bool isPolled(quint8 id);
+    int pollIntervalMs();
+
+signals:
+    void clientsChanged(int num);
+    void subscriptionsChanged();
+    void stationEnuRefRequested();
+    void enuRefSet(quint8 id, double lat, double lon, double height);
+    void routeReceived(quint8 id, QList<LocPoint> route, bool replace);
+
+public slots:
+    void sendState(quint8 id, CAR_STATE state);
+    void sendEnuRef(quint8 id, double lat, double lon, double height);
+
+private slots:
+    void tcpNewConnection();
+    void localNewConnection();
+    void clientMessageReceived(NetApiClient *client, QByteArray data);
+    void clientDisconnected(NetApiClient *client);
+
+private:
+    QTcpServer *mTcpServer;
+    QLocalServer *mLocalServer;
+    QList<NetApiClient*> mClients;
+    PacketInterface *mPacketInterface;
+    bool mSendToCars;
+    int mSubMinIntervalMs;
+    bool mStationEnuRefSet;
+    double mStationEnuRef[3];
+    QString mErrorString;
+
+    void addClient(QIODevice *socket);
+    void processMessage(NetApiClient *client, const QByteArray &data);
+
+};
+
+#endif // NETAPI_H
@@ -0,0 +1,167 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "netapiclient.h"
+#include "netprotocol.h"
+
+NetApiClient::NetApiClient(QIODevice *socket, QObject *parent) : QObject(parent)
+{
+    mSocket = socket;
+    mSocket->setParent(this);
+    mPacket = new Packet(this);
+    mSubFlags = 0;
+    mSubIntervalMs = 0;
+    mSubCars.resize(256);
+    mStateRequested.resize(256);
+    mEnuRequested.resize(256);
+    mTimer.start();
+
+    connect(mSocket, SIGNAL(readyRead()), this, SLOT(socketDataAvailable()));
+    // Both QTcpSocket and QLocalSocket have this signal
+    connect(mSocket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()));
+    connect(mPacket, SIGNAL(dataToSend(QByteArray&)),
+            this, SLOT(packetDataToSend(QByteArray&)));
+    connect(mPacket, SIGNAL(packetReceived(QByteArray&)),
+            this, SLOT(packetReceived(QByteArray&)));
+}
+
+void NetApiClient::sendMessage(const QByteArray &data)
+{
+    mPacket->sendPacket(data);
+}
+
+/**
+ * @brief NetApiClient::subscribe
+ * Replace the subscription of this client.
+ *
+ * @param flags
+ * NET_SUB_* flags.
+ *
+ * @param intervalMs
+ * The granted state interval.
+ *
+ * @param ids
+ * The subscribed cars. Ignored if NET_SUB_ALL_CARS is set.
+ */
+void NetApiClient::subscribe(quint8 flags, int intervalMs, const QVector<quint8> &ids)
+{
+    mSubFlags = flags;
+    mSubIntervalMs = intervalMs;
+    mSubCars.fill(false);
+    for (quint8 id: ids) {
+        mSubCars[id] = true;
+    }
+    mLastStateMs.clear();
+}
+
+void NetApiClient::unsubscribe()
+{
+    subscribe(0, 0, QVector<quint8>());
+}
+
+quint8 NetApiClient::subFlags() const
+{
+    return mSubFlags;
+}
+
+int NetApiClient::subIntervalMs() const
+{
+    return mSubIntervalMs;
+}
+
+bool NetApiClient::isSubscribed(quint8 id) const
+{
+    return (mSubFlags & NET_SUB_ALL_CARS) || mSubCars[id];
+}
+
+/**
+ * @brief NetApiClient::pollsCar
+ * Check if the client asked the station to poll a car. Only the listed cars
+ * are polled, also when NET_SUB_ALL_CARS is set.
+ */
+bool NetApiClient::pollsCar(quint8 id) const
+{
+    return (mSubFlags & NET_SUB_POLL) && mSubCars[id];
+}
+
+void NetApiClient::requestState(quint8 id)
+{
+    mStateRequested[id] = true;
+}
+
+void NetApiClient::requestEnuRef(quint8 id)
+{
+    mEnuRequested[id] = true;
+}
+
+/**
+ * @brief NetApiClient::takeState
+ * Check if a received state should be sent to this client. Requested
+ * states are always sent, subscribed states are decimated to the
+ * subscription interval.
+ *
+ * @param id
+ * The car the state is from.
+ *
+ * @return
+ * True if the state should be sent.
+ */
+bool NetApiClient::takeState(quint8 id)
+{
+    qint64 now = mTimer.elapsed();
+
+    if (mStateRequested[id]) {
+        mStateRequested[id] = false;
+    } else if (!isSubscribed(id) || (mLastStateMs.contains(id) &&
+                                     (now - mLastStateMs[id]) < mSubIntervalMs)) {
+        return false;
+    }
+
+    mLastStateMs[id] = now;
+    return true;
+}
+
+bool NetApiClient::takeEnuRef(quint8 id)
+{
+    bool res = isSubscribed(id) || mEnuRequested[id];
+    mEnuRequested[id] = false;
+    return res;
+}
+
+void NetApiClient::socketDataAvailable()
+{
+    while (mSocket->bytesAvailable() > 0) {
+        mPacket->processData(mSocket->readAll());
+    }
+}
+
+void NetApiClient::socketDisconnected()
+{
+    emit disconnected(this);
+}
+
+void NetApiClient::packetDataToSend(QByteArray &data)
+{
+    if (mSocket->isOpen()) {
+        mSocket->write(data);
+    }
+}
+
+void NetApiClient::packetReceived(QByteArray &data)
+{
+    emit messageReceived(this, data);
+}
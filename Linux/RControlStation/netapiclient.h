@@ -0,0 +1,72 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef NETAPICLIENT_H
+#define NETAPICLIENT_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+#include "packet.h"
+
+// A client of the binary API, connected over TCP (NetworkInterface) or a
+// local socket (StationDaemon). Messages use the protocol in netprotocol.h,
+// framed by Packet. Every client has its own subscription.
+class NetApiClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NetApiClient(QIODevice *socket, QObject *parent = 0);
+    void sendMessage(const QByteArray &data);
+
+    void subscribe(quint8 flags, int intervalMs, const QVector<quint8> &ids);
+    void unsubscribe();
+    quint8 subFlags() const;
+    int subIntervalMs() const;
+    bool isSubscribed(quint8 id) const;
+    bool pollsCar(quint8 id) const;
+    void requestState(quint8 id);
+    void requestEnuRef(quint8 id);
+    bool takeState(quint8 id);
+    bool takeEnuRef(quint8 id);
+
+signals:
+    void messageReceived(NetApiClient *client, QByteArray data);
+    void disconnected(NetApiClient *client);
+
+private slots:
+    void socketDataAvailable();
+    void socketDisconnected();
+    void packetDataToSend(QByteArray &data);
+    void packetReceived(QByteArray &data);
+
+private:
+    QIODevice *mSocket;
+    Packet *mPacket;
+    quint8 mSubFlags;
+    int mSubIntervalMs;
+    QVector<bool> mSubCars;
+    QVector<bool> mStateRequested;
+    QVector<bool> mEnuRequested;
+    QHash<int, qint64> mLastStateMs;
+    QElapsedTimer mTimer;
+
+};
+
+#endif // NETAPICLIENT_H
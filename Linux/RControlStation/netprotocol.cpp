@@ -0,0 +1,239 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "netprotocol.h"
+#include "utility.h"
+
+QByteArray NetProtocol::encodeHello()
+{
+    QByteArray data;
+    data.append((char)NET_MSG_HELLO);
+    data.append((char)NET_PROTOCOL_VERSION);
+    return data;
+}
+
+QByteArray NetProtocol::encodeSubscribe(quint8 flags, int intervalMs, const QVector<quint8> &ids)
+{
+    QByteArray data(5 + ids.size(), 0);
+    uint8_t *buffer = (uint8_t*)data.data();
+    int32_t ind = 0;
+
+    buffer[ind++] = NET_MSG_SUBSCRIBE;
+    buffer[ind++] = flags;
+    utility::buffer_append_uint16(buffer, intervalMs, &ind);
+    buffer[ind++] = ids.size();
+    for (quint8 id: ids) {
+        buffer[ind++] = id;
+    }
+
+    return data;
+}
+
+QByteArray NetProtocol::encodeSubscribed(quint8 flags, int intervalMs)
+{
+    QByteArray data(4, 0);
+    uint8_t *buffer = (uint8_t*)data.data();
+    int32_t ind = 0;
+
+    buffer[ind++] = NET_MSG_SUBSCRIBED;
+    buffer[ind++] = flags;
+    utility::buffer_append_uint16(buffer, intervalMs, &ind);
+
+    return data;
+}
+
+/**
+ * @brief NetProtocol::encodeState
+ * Encode a car state. The fields are the same as in the getState XML
+ * message, in the same order.
+ *
+ * @param id
+ * The car id.
+ *
+ * @param state
+ * The state.
+ *
+ * @return
+ * The message, stateLength bytes.
+ */
+QByteArray NetProtocol::encodeState(quint8 id, const CAR_STATE &state)
+{
+    QByteArray data(stateLength, 0);
+    uint8_t *buffer = (uint8_t*)data.data();
+    int32_t ind = 0;
+
+    buffer[ind++] = NET_MSG_STATE;
+    buffer[ind++] = id;
+    buffer[ind++] = state.fw_major;
+    buffer[ind++] = state.fw_minor;
+    utility::buffer_append_double32_auto(buffer, state.roll, &ind);
+    utility::buffer_append_double32_auto(buffer, state.pitch, &ind);
+    utility::buffer_append_double32_auto(buffer, state.yaw, &ind);
+    utility::buffer_append_double32_auto(buffer, state.accel[0], &ind);
+    utility::buffer_append_double32_auto(buffer, state.accel[1], &ind);
+    utility::buffer_append_double32_auto(buffer, state.accel[2], &ind);
+    utility::buffer_append_double32_auto(buffer, state.gyro[0], &ind);
+    utility::buffer_append_double32_auto(buffer, state.gyro[1], &ind);
+    utility::buffer_append_double32_auto(buffer, state.gyro[2], &ind);
+    utility::buffer_append_double32_auto(buffer, state.mag[0], &ind);
+    utility::buffer_append_double32_auto(buffer, state.mag[1], &ind);
+    utility::buffer_append_double32_auto(buffer, state.mag[2], &ind);
+    utility::buffer_append_double32_auto(buffer, state.px, &ind);
+    utility::buffer_append_double32_auto(buffer, state.py, &ind);
+    utility::buffer_append_double32_auto(buffer, state.speed, &ind);
+    utility::buffer_append_double32_auto(buffer, state.vin, &ind);
+    utility::buffer_append_double32_auto(buffer, state.temp_fet, &ind);
+    buffer[ind++] = (quint8)state.mc_fault;
+    utility::buffer_append_double32_auto(buffer, state.px_gps, &ind);
+    utility::buffer_append_double32_auto(buffer, state.py_gps, &ind);
+    utility::buffer_append_double32_auto(buffer, state.ap_goal_px, &ind);
+    utility::buffer_append_double32_auto(buffer, state.ap_goal_py, &ind);
+    utility::buffer_append_double32_auto(buffer, state.ap_rad, &ind);
+    utility::buffer_append_int32(buffer, state.ms_today, &ind);
+
+    return data;
+}
+
+QByteArray NetProtocol::encodeEnuRef(NET_MSG msg, quint8 id, double lat, double lon, double height)
+{
+    QByteArray data(enuRefLength, 0);
+    uint8_t *buffer = (uint8_t*)data.data();
+    int32_t ind = 0;
+
+    buffer[ind++] = msg;
+    buffer[ind++] = id;
+    utility::buffer_append_double64(buffer, lat, 1e16, &ind);
+    utility::buffer_append_double64(buffer, lon, 1e16, &ind);
+    utility::buffer_append_double32(buffer, height, 1e3, &ind);
+
+    return data;
+}
+
+QByteArray NetProtocol::encodeRoute(NET_MSG msg, quint8 id, const QList<LocPoint> &route)
+{
+    QByteArray data(4 + route.size() * routePointLength, 0);
+    uint8_t *buffer = (uint8_t*)data.data();
+    int32_t ind = 0;
+
+    buffer[ind++] = msg;
+    buffer[ind++] = id;
+    utility::buffer_append_uint16(buffer, route.size(), &ind);
+
+    for (const LocPoint &p: route) {
+        utility::buffer_append_double32_auto(buffer, p.getX(), &ind);
+        utility::buffer_append_double32_auto(buffer, p.getY(), &ind);
+        utility::buffer_append_double32_auto(buffer, p.getSpeed(), &ind);
+        utility::buffer_append_int32(buffer, p.getTime(), &ind);
+    }
+
+    return data;
+}
+
+QByteArray NetProtocol::encodeError(NET_MSG msg, const QString &txt)
+{
+    QByteArray data;
+    data.append((char)NET_MSG_ERROR);
+    data.append((char)msg);
+    data.append(txt.toLocal8Bit());
+    return data;
+}
+
+bool NetProtocol::decodeState(const QByteArray &data, quint8 &id, CAR_STATE &state)
+{
+    if (data.size() < stateLength || (quint8)data.at(0) != NET_MSG_STATE) {
+        return false;
+    }
+
+    const uint8_t *buffer = (const uint8_t*)data.constData();
+    int32_t ind = 1;
+
+    id = buffer[ind++];
+    state.fw_major = buffer[ind++];
+    state.fw_minor = buffer[ind++];
+    state.roll = utility::buffer_get_double32_auto(buffer, &ind);
+    state.pitch = utility::buffer_get_double32_auto(buffer, &ind);
+    state.yaw = utility::buffer_get_double32_auto(buffer, &ind);
+    state.accel[0] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.accel[1] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.accel[2] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.gyro[0] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.gyro[1] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.gyro[2] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.mag[0] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.mag[1] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.mag[2] = utility::buffer_get_double32_auto(buffer, &ind);
+    state.px = utility::buffer_get_double32_auto(buffer, &ind);
+    state.py = utility::buffer_get_double32_auto(buffer, &ind);
+    state.speed = utility::buffer_get_double32_auto(buffer, &ind);
+    state.vin = utility::buffer_get_double32_auto(buffer, &ind);
+    state.temp_fet = utility::buffer_get_double32_auto(buffer, &ind);
+    state.mc_fault = (mc_fault_code)buffer[ind++];
+    state.px_gps = utility::buffer_get_double32_auto(buffer, &ind);
+    state.py_gps = utility::buffer_get_double32_auto(buffer, &ind);
+    state.ap_goal_px = utility::buffer_get_double32_auto(buffer, &ind);
+    state.ap_goal_py = utility::buffer_get_double32_auto(buffer, &ind);
+    state.ap_rad = utility::buffer_get_double32_auto(buffer, &ind);
+    state.ms_today = utility::buffer_get_int32(buffer, &ind);
+
+    return true;
+}
+
+bool NetProtocol::decodeEnuRef(const QByteArray &data, quint8 &id, double &lat, double &lon, double &height)
+{
+    if (data.size() < enuRefLength) {
+        return false;
+    }
+
+    const uint8_t *buffer = (const uint8_t*)data.constData();
+    int32_t ind = 1;
+
+    id = buffer[ind++];
+    lat = utility::buffer_get_double64(buffer, 1e16, &ind);
+    lon = utility::buffer_get_double64(buffer, 1e16, &ind);
+    height = utility::buffer_get_double32(buffer, 1e3, &ind);
+
+    return true;
+}
+
+bool NetProtocol::decodeRoute(const QByteArray &data, quint8 &id, QList<LocPoint> &route)
+{
+    if (data.size() < 4) {
+        return false;
+    }
+
+    const uint8_t *buffer = (const uint8_t*)data.constData();
+    int32_t ind = 1;
+
+    id = buffer[ind++];
+    int num = utility::buffer_get_uint16(buffer, &ind);
+
+    if (data.size() < (4 + num * routePointLength)) {
+        return false;
+    }
+
+    route.clear();
+    for (int i = 0;i < num;i++) {
+        LocPoint p;
+        p.setX(utility::buffer_get_double32_auto(buffer, &ind));
+        p.setY(utility::buffer_get_double32_auto(buffer, &ind));
+        p.setSpeed(utility::buffer_get_double32_auto(buffer, &ind));
+        p.setTime(utility::buffer_get_int32(buffer, &ind));
+        route.append(p);
+    }
+
+    return true;
+}
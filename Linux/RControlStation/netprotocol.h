@@ -0,0 +1,110 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef NETPROTOCOL_H
+#define NETPROTOCOL_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include "datatypes.h"
+#include "locpoint.h"
+
+/*
+ * Binary alternative to the XML protocol of NetworkInterface. It runs on its
+ * own TCP port, or on the local socket of Station_Daemon, and every message
+ * is sent in a Packet frame (start byte, length, payload, CRC16, stop byte),
+ * so it is length-prefixed and checked. Any number of clients can be
+ * connected, and every client has its own subscription (see NetApi).
+ * The first payload byte is the NET_MSG type. Numbers are big endian and
+ * floats use the same 32-bit encoding as the car packets.
+ *
+ * A client starts with NET_MSG_HELLO carrying its protocol version, and the
+ * station answers with its own. NET_MSG_SUBSCRIBE selects the cars and the
+ * state interval the client wants. The station answers with
+ * NET_MSG_SUBSCRIBED and the interval it grants, and then pushes
+ * NET_MSG_STATE and NET_MSG_ENU_REF for the selected cars. States are
+ * decimated per car to the granted interval.
+ *
+ * Messages (payload after the type byte):
+ *   HELLO            u8 version
+ *   SUBSCRIBE        u8 flags (NET_SUB_*), u16 interval ms, u8 n, n * u8 id
+ *   SUBSCRIBED       u8 flags, u16 granted interval ms
+ *   STATE            u8 id, state (see encodeState)
+ *   ENU_REF          u8 id, double64 lat 1e16, double64 lon 1e16,
+ *                    double32 height 1e3
+ *   GET_STATE        u8 id
+ *   GET_ENU_REF      u8 id, u8 from map (the station reference, sent
+ *                    back with id 255)
+ *   SET_ENU_REF      u8 id, same fields as ENU_REF. Id 255 sets the station
+ *                    reference instead of a car.
+ *   ROUTE_ADD        u8 id, u16 n, n * (float px, float py, float speed,
+ *                    i32 time)
+ *   ROUTE_REPLACE    same as ROUTE_ADD
+ *   ROUTE_REMOVE_LAST u8 id
+ *   ROUTE_CLEAR      u8 id
+ *   AP_ACTIVE        u8 id, u8 enabled
+ *   RC_CONTROL       u8 id, u8 RC_MODE, float value, float steering
+ *   ERROR            u8 message type that failed, description string
+ */
+
+#define NET_PROTOCOL_VERSION        1
+
+typedef enum {
+    NET_MSG_HELLO = 0,
+    NET_MSG_SUBSCRIBE,
+    NET_MSG_SUBSCRIBED,
+    NET_MSG_STATE,
+    NET_MSG_ENU_REF,
+    NET_MSG_GET_STATE,
+    NET_MSG_GET_ENU_REF,
+    NET_MSG_SET_ENU_REF,
+    NET_MSG_ROUTE_ADD,
+    NET_MSG_ROUTE_REPLACE,
+    NET_MSG_ROUTE_REMOVE_LAST,
+    NET_MSG_ROUTE_CLEAR,
+    NET_MSG_AP_ACTIVE,
+    NET_MSG_RC_CONTROL,
+    NET_MSG_ERROR
+} NET_MSG;
+
+// Subscription flags
+#define NET_SUB_ALL_CARS            0x01 // Ignore the id list and send all cars
+#define NET_SUB_POLL                0x02 // Let the station poll the listed cars
+
+class NetProtocol
+{
+public:
+    static QByteArray encodeHello();
+    static QByteArray encodeSubscribe(quint8 flags, int intervalMs, const QVector<quint8> &ids);
+    static QByteArray encodeSubscribed(quint8 flags, int intervalMs);
+    static QByteArray encodeState(quint8 id, const CAR_STATE &state);
+    static QByteArray encodeEnuRef(NET_MSG msg, quint8 id, double lat, double lon, double height);
+    static QByteArray encodeRoute(NET_MSG msg, quint8 id, const QList<LocPoint> &route);
+    static QByteArray encodeError(NET_MSG msg, const QString &txt);
+
+    static bool decodeState(const QByteArray &data, quint8 &id, CAR_STATE &state);
+    static bool decodeEnuRef(const QByteArray &data, quint8 &id, double &lat, double &lon, double &height);
+    static bool decodeRoute(const QByteArray &data, quint8 &id, QList<LocPoint> &route);
+
+    static const int stateLength = 97;
+    static const int enuRefLength = 22;
+    static const int routePointLength = 16;
+
+};
+
+#endif // NETPROTOCOL_H
@@ -18,6 +18,7 @@
 #include "networkinterface.h"
 #include "ui_networkinterface.h"
 #include <QMessageBox>
+#include "utility.h"
 
 NetworkInterface::NetworkInterface(QWidget *parent) :
     QWidget(parent),
@@ -34,6 +35,10 @@ NetworkInterface::NetworkInterface(QWidget *parent) :
     mPollTimerCarId = -1;
     mPollTimer->setSingleShot(false);
 
+    mBinaryApi = new NetApi(this);
+    mBinaryPollTimer = new QTimer(this);
+    mBinaryPollTimer->setSingleShot(false);
+
     connect(mTcpServer, SIGNAL(dataRx(QByteArray)),
             this, SLOT(tcpDataRx(QByteArray)));
     connect(mTcpServer, SIGNAL(connectionChanged(bool)),
@@ -42,8 +47,22 @@ NetworkInterface::NetworkInterface(QWidget *parent) :
             this, SLOT(udpReadReady()));
     connect(mPollTimer, SIGNAL(timeout()),
             this, SLOT(pollTimerSlot()));
-
+    connect(mBinaryApi, SIGNAL(clientsChanged(int)),
+            this, SLOT(binaryClientsChanged(int)));
+    connect(mBinaryApi, SIGNAL(subscriptionsChanged()),
+            this, SLOT(binarySubscriptionsChanged()));
+    connect(mBinaryApi, SIGNAL(stationEnuRefRequested()),
+            this, SLOT(binaryStationEnuRefRequested()));
+    connect(mBinaryApi, SIGNAL(enuRefSet(quint8,double,double,double)),
+            this, SLOT(binaryEnuRefSet(quint8,double,double,double)));
+    connect(mBinaryApi, SIGNAL(routeReceived(quint8,QList<LocPoint>,bool)),
+            this, SLOT(binaryRouteReceived(quint8,QList<LocPoint>,bool)));
+    connect(mBinaryPollTimer, SIGNAL(timeout()),
+            this, SLOT(binaryPollTimerSlot()));
+
+    mBinaryApi->setSendToCars(!ui->disableSendCarBox->isChecked());
     tcpConnectionChanged(false);
+    binaryClientsChanged(0);
 }
 
 NetworkInterface::~NetworkInterface()
@@ -59,6 +78,7 @@ void NetworkInterface::setMap(MapWidget *map)
 void NetworkInterface::setPacketInterface(PacketInterface *packetInterface)
 {
     mPacketInterface = packetInterface;
+    mBinaryApi->setPacketInterface(packetInterface);
 
     connect(mPacketInterface, SIGNAL(stateReceived(quint8,CAR_STATE)),
             this, SLOT(stateReceived(quint8,CAR_STATE)));
@@ -201,14 +221,96 @@ void NetworkInterface::pollTimerSlot()
     }
 }
 
+void NetworkInterface::binaryClientsChanged(int num)
+{
+    QString style_red = "color: rgb(255, 255, 255);"
+                        "background-color: rgb(150, 0, 0);";
+
+    QString style_green = "color: rgb(255, 255, 255);"
+                          "background-color: rgb(0, 150, 0);";
+
+    if (num > 0) {
+        ui->binaryClientConnectedLabel->setStyleSheet(QString("#binaryClientConnectedLabel {%1}").arg(style_green));
+        ui->binaryClientConnectedLabel->setText(tr("%n Client(s) Connected", "", num));
+    } else {
+        ui->binaryClientConnectedLabel->setStyleSheet(QString("#binaryClientConnectedLabel {%1}").arg(style_red));
+        ui->binaryClientConnectedLabel->setText(tr("No Client Connected"));
+    }
+}
+
+void NetworkInterface::binarySubscriptionsChanged()
+{
+    int interval = mBinaryApi->pollIntervalMs();
+
+    if (interval > 0) {
+        mBinaryPollTimer->start(interval);
+    } else {
+        mBinaryPollTimer->stop();
+    }
+}
+
+void NetworkInterface::binaryPollTimerSlot()
+{
+    if (!mPacketInterface || ui->disableSendCarBox->isChecked()) {
+        return;
+    }
+
+    for (int id = 0;id < 255;id++) {
+        if (mBinaryApi->isPolled(id)) {
+            mPacketInterface->getState(id);
+        }
+    }
+}
+
+void NetworkInterface::binaryStationEnuRefRequested()
+{
+    if (mMap) {
+        double llh[3];
+        mMap->getEnuRef(llh);
+        mBinaryApi->setStationEnuRef(llh[0], llh[1], llh[2]);
+    }
+}
+
+void NetworkInterface::binaryEnuRefSet(quint8 id, double lat, double lon, double height)
+{
+    (void)id;
+
+    if (mMap && ui->plotRouteMapBox->isChecked()) {
+        mMap->setEnuRef(lat, lon, height);
+    }
+}
+
+void NetworkInterface::binaryRouteReceived(quint8 id, QList<LocPoint> route, bool replace)
+{
+    (void)id;
+
+    if (mMap && ui->plotRouteMapBox->isChecked()) {
+        if (replace) {
+            mMap->clearRoute();
+        }
+
+        for (LocPoint p: route) {
+            mMap->addRoutePoint(p.getX(), p.getY(), p.getSpeed(), p.getTime());
+        }
+    }
+}
+
 void NetworkInterface::stateReceived(quint8 id, CAR_STATE state)
 {
     sendState(id, state);
+
+    if (!ui->noForwardStateBox->isChecked()) {
+        mBinaryApi->sendState(id, state);
+    }
 }
 
 void NetworkInterface::enuRefReceived(quint8 id, double lat, double lon, double height)
 {
     sendEnuRef(id, lat, lon, height);
+
+    if (!ui->noForwardStateBox->isChecked()) {
+        mBinaryApi->sendEnuRef(id, lat, lon, height);
+    }
 }
 
 void NetworkInterface::on_tcpActivateBox_toggled(bool checked)
@@ -247,6 +349,30 @@ void NetworkInterface::on_udpActivateBox_toggled(bool checked)
     ui->udpPortBox->setEnabled(!ui->udpActivateBox->isChecked());
 }
 
+void NetworkInterface::on_binaryActivateBox_toggled(bool checked)
+{
+    ui->binaryPortBox->setEnabled(false);
+
+    if (checked) {
+        if (!mBinaryApi->startTcpServer(ui->binaryPortBox->value())) {
+            qWarning() << "Starting binary TCP server failed:" << mBinaryApi->errorString();
+            QMessageBox::warning(this, "TCP Server Error",
+                                 tr("Starting binary TCP server failed. Make sure that the port is not "
+                                    "already in use. Error: %1").arg(mBinaryApi->errorString()));
+            ui->binaryActivateBox->setChecked(false);
+        }
+    } else {
+        mBinaryApi->stopServer();
+    }
+
+    ui->binaryPortBox->setEnabled(!ui->binaryActivateBox->isChecked());
+}
+
+void NetworkInterface::on_disableSendCarBox_toggled(bool checked)
+{
+    mBinaryApi->setSendToCars(!checked);
+}
+
 void NetworkInterface::processData(const QByteArray &data)
 {
     mRxBuffer.append(data);
@@ -26,6 +26,7 @@
 #include "packetinterface.h"
 #include "carinterface.h"
 #include "mapwidget.h"
+#include "netapi.h"
 
 namespace Ui {
 class NetworkInterface;
@@ -50,12 +51,20 @@ private slots:
     void tcpConnectionChanged(bool connected);
     void udpReadReady();
     void pollTimerSlot();
+    void binaryClientsChanged(int num);
+    void binarySubscriptionsChanged();
+    void binaryPollTimerSlot();
+    void binaryStationEnuRefRequested();
+    void binaryEnuRefSet(quint8 id, double lat, double lon, double height);
+    void binaryRouteReceived(quint8 id, QList<LocPoint> route, bool replace);
 
     void stateReceived(quint8 id, CAR_STATE state);
     void enuRefReceived(quint8 id, double lat, double lon, double height);
 
     void on_tcpActivateBox_toggled(bool checked);
     void on_udpActivateBox_toggled(bool checked);
+    void on_binaryActivateBox_toggled(bool checked);
+    void on_disableSendCarBox_toggled(bool checked);
 
 private:
     Ui::NetworkInterface *ui;
@@ -68,6 +77,10 @@ private:
     QTimer *mPollTimer;
     int mPollTimerCarId;
 
+    // Binary protocol clients
+    NetApi *mBinaryApi;
+    QTimer *mBinaryPollTimer;
+
     void processData(const QByteArray &data);
     void processXml(const QByteArray &xml);
     void sendData(const QByteArray &data);
@@ -26,6 +26,12 @@
 #include <QStringList>
 #include "qcustomplot.h"
 
+namespace {
+// Only one point per map cell and ping class is drawn, so that the number of
+// points depends on the area the log covers and not on its length.
+const double logPlotCell = 0.5;
+}
+
 NetworkLogger::NetworkLogger(QWidget *parent) :
     QWidget(parent),
     ui(new Ui::NetworkLogger)
@@ -38,6 +44,14 @@ NetworkLogger::NetworkLogger(QWidget *parent) :
     mSatNowStr = "Sats...";
     mPing = new Ping(this);
     mMap = 0;
+    mLoader = new LogLoader(this);
+    mLogEnuRef[0] = 0.0;
+    mLogEnuRef[1] = 0.0;
+    mLogEnuRef[2] = 0.0;
+    mLogInfoTrace = 0;
+    mLoadStats = pingStats(0, 0);
+    mRangeStart = 0;
+    mRangeEnd = 0;
 
     connect(mTcpSocket, SIGNAL(readyRead()), this, SLOT(tcpInputDataAvailable()));
     connect(mTcpSocket, SIGNAL(connected()), this, SLOT(tcpInputConnected()));
@@ -47,6 +61,13 @@ NetworkLogger::NetworkLogger(QWidget *parent) :
             this, SLOT(tcpInputError(QAbstractSocket::SocketError)));
     connect(mPing, SIGNAL(pingRx(int,QString)), this, SLOT(pingRx(int,QString)));
     connect(mPing, SIGNAL(pingError(QString,QString)), this, SLOT(pingError(QString,QString)));
+    connect(mLoader, SIGNAL(enuRefUsed(double,double,double)),
+            this, SLOT(logEnuRefUsed(double,double,double)));
+    connect(mLoader, SIGNAL(columnsLoaded(LOG_COLUMNS)),
+            this, SLOT(logColumnsLoaded(LOG_COLUMNS)));
+    connect(mLoader, SIGNAL(progress(int)), ui->statLogProgressBar, SLOT(setValue(int)));
+    connect(mLoader, SIGNAL(loadFinished(bool,QString,bool,qint64)),
+            this, SLOT(logLoadFinished(bool,QString,bool,qint64)));
 
     ui->statHistogramPlot->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
     ui->statHistogramPlot->xAxis->setLabel("Milliseconds (ms)");
@@ -55,6 +76,8 @@ NetworkLogger::NetworkLogger(QWidget *parent) :
 
 NetworkLogger::~NetworkLogger()
 {
+    mLoader->stop();
+
     if (mLog.isOpen()) {
         qDebug() << "Closing log:" << mLog.fileName();
         mLog.close();
@@ -294,151 +317,40 @@ void NetworkLogger::on_logFileActiveBox_toggled(bool checked)
 
 void NetworkLogger::on_statLogOpenButton_clicked()
 {
-    QFile log;
-    log.setFileName(ui->statLogLoadEdit->text());
-
-    if (log.exists()) {
-        bool ok = log.open(QIODevice::ReadOnly | QIODevice::Text);
-
-        if (ok) {
-            QTextStream in(&log);
-
-            // Load log to memory
-            mLogLoaded.clear();
-            while(!in.atEnd()) {
-                LOGPOINT lp;
+    QString path = ui->statLogLoadEdit->text();
 
-                QString line = in.readLine();
-                QStringList list = line.split(QRegExp("[ ]"), QString::SkipEmptyParts);
+    if (!QFile::exists(path)) {
+        QMessageBox::warning(this, "Open Error", "Please select a valid log file");
+        return;
+    }
 
-                lp.date = QDateTime::fromString(list.at(0), Qt::ISODate);
-                lp.llh[0] = list.at(1).toDouble();
-                lp.llh[1] = list.at(2).toDouble();
-                lp.llh[2] = list.at(3).toDouble();
-                lp.fix_type = list.at(4).toInt();
-                lp.datalen = list.at(5).toInt();
-                lp.pingRes = list.at(6);
-                lp.pingMs = lp.pingRes.toDouble(&lp.pingOk);
+    mLoader->stop();
 
-                mLogLoaded.append(lp);
-            }
+    mLogLoaded = LOG_COLUMNS();
+    mLoadStats = pingStats(0, 0);
+    mRangeStart = 0;
+    mRangeEnd = 0;
+    mLogPlotted.clear();
 
-            log.close();
-
-            // Calculate statistics
-            double ping_min = 1e100;
-            double ping_max = 0.0;
-            double ping_avg = 0.0;
-            int ping_errors = 0;
-            for (int i = 0;i < mLogLoaded.size();i++) {
-                const LOGPOINT &lp = mLogLoaded.at(i);
-
-                if (lp.pingOk) {
-                    if (lp.pingMs < ping_min) {
-                        ping_min = lp.pingMs;
-                    }
-
-                    if (lp.pingMs > ping_max) {
-                        ping_max = lp.pingMs;
-                    }
-
-                    ping_avg += lp.pingMs;
-                } else {
-                    ping_errors++;
-                }
-            }
+    double i_llh[3] = {0.0, 0.0, 0.0};
+    bool zeroEnu = ui->statLogZeroEnuBox->isChecked() || !mMap;
 
-            ping_avg /= (double)mLogLoaded.size();
-
-            QString statStr;
-            statStr.sprintf("Samples : %d\n"
-                            "Ping min: %.3f ms\n"
-                            "Ping max: %.3f ms\n"
-                            "Ping avg: %.3f ms\n"
-                            "Ping err: %d (%.4f %%)",
-                            mLogLoaded.size(), ping_min, ping_max,
-                            ping_avg, ping_errors,
-                            100.0 * (double)ping_errors / (double)mLogLoaded.size());
-            ui->statBrowser->setText(statStr);
-
-            // Plot on map
-            if (mMap) {
-                // Load points to empty info array on map or create new one
-                mMap->setNextEmptyOrCreateNewInfoTrace();
-
-                double i_llh[3];
-                bool i_llh_set = false;
-                for (int i = 0;i < mLogLoaded.size();i++) {
-                    const LOGPOINT &lp = mLogLoaded.at(i);
-
-                    if (!i_llh_set) {
-                        if (ui->statLogZeroEnuBox->isChecked() || !mMap) {
-                            i_llh[0] = lp.llh[0];
-                            i_llh[1] = lp.llh[1];
-                            i_llh[2] = lp.llh[2];
-                        } else {
-                            mMap->getEnuRef(i_llh);
-                        }
-
-                        i_llh_set = true;
-
-                        if (mMap) {
-                            mMap->setEnuRef(i_llh[0], i_llh[1], i_llh[2]);
-                        }
-                    }
-
-                    double xyz[3];
-                    utility::llhToEnu(i_llh, lp.llh, xyz);
-
-                    LocPoint p;
-                    p.setXY(xyz[0], xyz[1]);
-
-                    QString info;
-                    info.sprintf("Date : %s\n"
-                                 "Lat  : %.8f\n"
-                                 "Lon  : %.8f\n"
-                                 "H    : %.3f\n"
-                                 "Fix  : %d\n"
-                                 "Pktzs: %d\n"
-                                 "Ping : %s",
-                                 lp.date.toString(Qt::ISODate).toLocal8Bit().data(),
-                                 lp.llh[0], lp.llh[1], lp.llh[2],
-                            lp.fix_type, lp.datalen, lp.pingRes.toLocal8Bit().data());
-
-                    p.setInfo(info);
-
-                    const double l_green = ping_avg * 1.2;
-                    const double l_red = ping_avg * 2.0;
-
-                    if (lp.pingOk) {
-                        if (lp.pingMs > l_red) {
-                            p.setColor(Qt::red);
-                        } else if (lp.pingMs > l_green) {
-                            p.setColor(Qt::yellow);
-                        }
-                    } else {
-                        p.setColor(Qt::red);
-                    }
-
-                    double w = 20.0;
-                    if (lp.pingOk) {
-                        w = utility::map(lp.pingMs, ping_min, ping_max, 3.0, 20.0);
-                    }
-
-                    p.setRadius(w);
-
-                    mMap->addInfoPoint(p);
-                }
-
-                drawHistogram(ui->statHistBinsBox->value(), mLogLoaded);
-            }
-        } else {
-            QMessageBox::warning(this, "Open Error", "Could not open " + log.fileName());
+    if (mMap) {
+        if (!zeroEnu) {
+            mMap->getEnuRef(i_llh);
         }
 
-    } else {
-        QMessageBox::warning(this, "Open Error", "Please select a valid log file");
+        // Load points to empty info array on map or create new one
+        mLogInfoTrace = mMap->setNextEmptyOrCreateNewInfoTrace();
     }
+
+    ui->statLogProgressBar->setValue(0);
+    ui->statLogOpenButton->setEnabled(false);
+    ui->statRangeApplyButton->setEnabled(false);
+    ui->statRangeResetButton->setEnabled(false);
+    ui->statBrowser->setText("Loading...");
+
+    mLoader->load(path, zeroEnu, i_llh, ui->statLogUseIndexBox->isChecked());
 }
 
 void NetworkLogger::on_statLogChooseButton_clicked()
@@ -452,7 +364,7 @@ void NetworkLogger::on_statLogChooseButton_clicked()
     ui->statLogLoadEdit->setText(path);
 }
 
-void NetworkLogger::drawHistogram(int bins, const QList<NetworkLogger::LOGPOINT> &log)
+void NetworkLogger::drawHistogram(int bins, const LOG_COLUMNS &log, int start, int end)
 {
     QCustomPlot *customPlot = ui->statHistogramPlot;
     customPlot->clearPlottables();
@@ -460,29 +372,35 @@ void NetworkLogger::drawHistogram(int bins, const QList<NetworkLogger::LOGPOINT>
     QVector<int> binVec;
     binVec.resize(bins);
 
+    const float *ping = log.pingMs.constData();
+
     double min = 1e20;
     double max = 0;
-    for (int i = 0;i < log.size();i++) {
-        const LOGPOINT &p = log.at(i);
-        if (p.pingOk) {
-            if (p.pingMs < min) {
-                min = p.pingMs;
-            } else if (p.pingMs > max) {
-                max = p.pingMs;
+    for (int i = start;i < end;i++) {
+        if (!std::isnan(ping[i])) {
+            if (ping[i] < min) {
+                min = ping[i];
+            }
+
+            if (ping[i] > max) {
+                max = ping[i];
             }
         }
     }
 
+    if (min > max) {
+        customPlot->replot();
+        return;
+    }
+
     double step = (max - min) / bins;
     double range = max - min;
 
-    for (int i = 0;i < log.size();i++) {
-        const LOGPOINT &p = log.at(i);
-
-        if (p.pingOk) {
-            double val = p.pingMs;
+    for (int i = start;i < end;i++) {
+        if (!std::isnan(ping[i])) {
+            double val = ping[i];
             val -= min;
-            val /= range;
+            val /= range > 0.0 ? range : 1.0;
             val *= (bins - 1);
 
             int bin = (int)round(val);
@@ -510,5 +428,238 @@ void NetworkLogger::on_statHistRescaleButton_clicked()
 
 void NetworkLogger::on_statHistBinsBox_valueChanged(int arg1)
 {
-    drawHistogram(arg1, mLogLoaded);
+    drawHistogram(arg1, mLogLoaded, mRangeStart, mRangeEnd);
+}
+
+void NetworkLogger::on_statRangeApplyButton_clicked()
+{
+    // The end time is inclusive and the log has second resolution
+    mRangeStart = LogLoader::indexOfTime(mLogLoaded,
+                                         ui->statRangeStartEdit->dateTime().toMSecsSinceEpoch());
+    mRangeEnd = LogLoader::indexOfTime(mLogLoaded,
+                                       ui->statRangeEndEdit->dateTime().toMSecsSinceEpoch() + 1000);
+    mRangeEnd = qMax(mRangeStart, mRangeEnd);
+
+    PING_STATS stats = pingStats(mRangeStart, mRangeEnd);
+    updateStats();
+
+    if (mMap) {
+        int traceOld = mMap->getInfoTraceNow();
+        mMap->setInfoTraceNow(mLogInfoTrace);
+        mMap->clearInfoTrace();
+        mLogPlotted.clear();
+        plotLogPoints(mRangeStart, mRangeEnd, stats);
+        mMap->setInfoTraceNow(traceOld);
+    }
+
+    drawHistogram(ui->statHistBinsBox->value(), mLogLoaded, mRangeStart, mRangeEnd);
+}
+
+void NetworkLogger::on_statRangeResetButton_clicked()
+{
+    int size = LogLoader::columnsSize(mLogLoaded);
+    if (size == 0) {
+        return;
+    }
+
+    ui->statRangeStartEdit->setDateTime(QDateTime::fromMSecsSinceEpoch(mLogLoaded.timeMs.first()));
+    ui->statRangeEndEdit->setDateTime(QDateTime::fromMSecsSinceEpoch(mLogLoaded.timeMs.last()));
+    on_statRangeApplyButton_clicked();
+}
+
+void NetworkLogger::logEnuRefUsed(double lat, double lon, double height)
+{
+    mLogEnuRef[0] = lat;
+    mLogEnuRef[1] = lon;
+    mLogEnuRef[2] = height;
+
+    if (mMap) {
+        mMap->setEnuRef(lat, lon, height);
+    }
+}
+
+void NetworkLogger::logColumnsLoaded(LOG_COLUMNS columns)
+{
+    int start = LogLoader::columnsSize(mLogLoaded);
+    LogLoader::appendColumns(mLogLoaded, columns);
+    int end = LogLoader::columnsSize(mLogLoaded);
+
+    // The points are colored with the statistics of what has been loaded so far
+    PING_STATS stats = pingStats(start, end);
+    mLoadStats.min = qMin(mLoadStats.min, stats.min);
+    mLoadStats.max = qMax(mLoadStats.max, stats.max);
+    mLoadStats.sum += stats.sum;
+    mLoadStats.samples += stats.samples;
+    mLoadStats.errors += stats.errors;
+
+    if (mMap) {
+        int traceOld = mMap->getInfoTraceNow();
+        mMap->setInfoTraceNow(mLogInfoTrace);
+        plotLogPoints(start, end, mLoadStats);
+        mMap->setInfoTraceNow(traceOld);
+    }
+}
+
+void NetworkLogger::logLoadFinished(bool ok, QString msg, bool fromIndex, qint64 elapsedMs)
+{
+    ui->statLogOpenButton->setEnabled(true);
+
+    if (!ok) {
+        ui->statBrowser->clear();
+        QMessageBox::warning(this, "Open Error", msg);
+        return;
+    }
+
+    int size = LogLoader::columnsSize(mLogLoaded);
+    mRangeStart = 0;
+    mRangeEnd = size;
+
+    if (size > 0) {
+        QDateTime first = QDateTime::fromMSecsSinceEpoch(mLogLoaded.timeMs.first());
+        QDateTime last = QDateTime::fromMSecsSinceEpoch(mLogLoaded.timeMs.last());
+        ui->statRangeStartEdit->setDateTimeRange(first, last);
+        ui->statRangeEndEdit->setDateTimeRange(first, last);
+        ui->statRangeStartEdit->setDateTime(first);
+        ui->statRangeEndEdit->setDateTime(last);
+        ui->statRangeApplyButton->setEnabled(true);
+        ui->statRangeResetButton->setEnabled(true);
+    }
+
+    QString loadInfo;
+    loadInfo.sprintf("Loaded in %lld ms%s", elapsedMs, fromIndex ? " (index)" : "");
+    updateStats(loadInfo);
+
+    drawHistogram(ui->statHistBinsBox->value(), mLogLoaded, mRangeStart, mRangeEnd);
+}
+
+NetworkLogger::PING_STATS NetworkLogger::pingStats(int start, int end)
+{
+    PING_STATS stats;
+    stats.min = 1e100;
+    stats.max = 0.0;
+    stats.sum = 0.0;
+    stats.samples = end - start;
+    stats.errors = 0;
+
+    const float *ping = mLogLoaded.pingMs.constData();
+
+    for (int i = start;i < end;i++) {
+        if (std::isnan(ping[i])) {
+            stats.errors++;
+        } else {
+            if (ping[i] < stats.min) {
+                stats.min = ping[i];
+            }
+
+            if (ping[i] > stats.max) {
+                stats.max = ping[i];
+            }
+
+            stats.sum += ping[i];
+        }
+    }
+
+    return stats;
+}
+
+void NetworkLogger::updateStats(const QString &loadInfo)
+{
+    PING_STATS stats = pingStats(mRangeStart, mRangeEnd);
+    double samples = qMax(stats.samples, 1);
+
+    QString statStr;
+    statStr.sprintf("Samples : %d\n"
+                    "Ping min: %.3f ms\n"
+                    "Ping max: %.3f ms\n"
+                    "Ping avg: %.3f ms\n"
+                    "Ping err: %d (%.4f %%)",
+                    stats.samples, stats.min, stats.max,
+                    stats.sum / samples, stats.errors,
+                    100.0 * (double)stats.errors / samples);
+
+    if (!loadInfo.isEmpty()) {
+        statStr += "\n\n" + loadInfo;
+    }
+
+    ui->statBrowser->setText(statStr);
+}
+
+void NetworkLogger::plotLogPoints(int start, int end, const PING_STATS &stats)
+{
+    const double ping_avg = stats.sum / (double)qMax(stats.samples, 1);
+    const double l_green = ping_avg * 1.2;
+    const double l_red = ping_avg * 2.0;
+
+    for (int i = start;i < end;i++) {
+        float pingMs = mLogLoaded.pingMs.at(i);
+        bool pingOk = !std::isnan(pingMs);
+
+        // Skip the sample if a point with the same color already is drawn
+        // in its cell. Slow and failed pings are kept apart from good ones.
+        quint32 pingClass = 0;
+        if (!pingOk || pingMs > l_red) {
+            pingClass = 2;
+        } else if (pingMs > l_green) {
+            pingClass = 1;
+        }
+
+        qint32 cx = (qint32)floor(mLogLoaded.east.at(i) / logPlotCell);
+        qint32 cy = (qint32)floor(mLogLoaded.north.at(i) / logPlotCell);
+        quint64 key = ((quint64)(quint32)cx << 32) | ((quint32)cy << 2) | pingClass;
+
+        if (mLogPlotted.contains(key)) {
+            continue;
+        }
+        mLogPlotted.insert(key);
+
+        double xyz[3];
+        double llh[3];
+        xyz[0] = mLogLoaded.east.at(i);
+        xyz[1] = mLogLoaded.north.at(i);
+        xyz[2] = mLogLoaded.up.at(i);
+        utility::enuToLlh(mLogEnuRef, xyz, llh);
+
+        LocPoint p;
+        p.setXY(xyz[0], xyz[1]);
+
+        QString pingRes = "error";
+        if (pingOk) {
+            pingRes.sprintf("%.3f", pingMs);
+        }
+
+        QString info;
+        info.sprintf("Date : %s\n"
+                     "Lat  : %.8f\n"
+                     "Lon  : %.8f\n"
+                     "H    : %.3f\n"
+                     "Fix  : %d\n"
+                     "Pktzs: %d\n"
+                     "Ping : %s",
+                     QDateTime::fromMSecsSinceEpoch(mLogLoaded.timeMs.at(i)).
+                     toString(Qt::ISODate).toLocal8Bit().data(),
+                     llh[0], llh[1], llh[2],
+                     mLogLoaded.fixType.at(i), mLogLoaded.dataLen.at(i),
+                     pingRes.toLocal8Bit().data());
+
+        p.setInfo(info);
+
+        if (pingOk) {
+            if (pingMs > l_red) {
+                p.setColor(Qt::red);
+            } else if (pingMs > l_green) {
+                p.setColor(Qt::yellow);
+            }
+        } else {
+            p.setColor(Qt::red);
+        }
+
+        double w = 20.0;
+        if (pingOk) {
+            w = utility::map(pingMs, stats.min, stats.max, 3.0, 20.0);
+        }
+
+        p.setRadius(w);
+
+        mMap->addInfoPoint(p);
+    }
 }
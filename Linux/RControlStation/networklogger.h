@@ -23,10 +23,12 @@
 #include <QFile>
 #include <QList>
 #include <QDateTime>
+#include <QSet>
 #include "datatypes.h"
 #include "ping.h"
 #include "locpoint.h"
 #include "mapwidget.h"
+#include "logloader.h"
 
 namespace Ui {
 class NetworkLogger;
@@ -51,6 +53,14 @@ public:
         bool pingOk;
     } LOGPOINT;
 
+    typedef struct {
+        double min;
+        double max;
+        double sum;
+        int samples;
+        int errors;
+    } PING_STATS;
+
 private slots:
     void tcpInputConnected();
     void tcpInputDisconnected();
@@ -68,6 +78,12 @@ private slots:
     void on_statLogChooseButton_clicked();
     void on_statHistRescaleButton_clicked();
     void on_statHistBinsBox_valueChanged(int arg1);
+    void on_statRangeApplyButton_clicked();
+    void on_statRangeResetButton_clicked();
+
+    void logEnuRefUsed(double lat, double lon, double height);
+    void logColumnsLoaded(LOG_COLUMNS columns);
+    void logLoadFinished(bool ok, QString msg, bool fromIndex, qint64 elapsedMs);
 
 private:
     Ui::NetworkLogger *ui;
@@ -80,9 +96,19 @@ private:
     LocPoint mLastPoint;
     MapWidget *mMap;
     QList<LOGPOINT> mLogRt;
-    QList<LOGPOINT> mLogLoaded;
+    LogLoader *mLoader;
+    LOG_COLUMNS mLogLoaded;
+    double mLogEnuRef[3];
+    int mLogInfoTrace;
+    PING_STATS mLoadStats;
+    int mRangeStart;
+    int mRangeEnd;
+    QSet<quint64> mLogPlotted;
 
-    void drawHistogram(int bins, const QList<LOGPOINT> &log);
+    PING_STATS pingStats(int start, int end);
+    void updateStats(const QString &loadInfo = "");
+    void plotLogPoints(int start, int end, const PING_STATS &stats);
+    void drawHistogram(int bins, const LOG_COLUMNS &log, int start, int end);
 
 };
 
@@ -18,10 +18,13 @@
 #include "nmeaserver.h"
 #include <cstdio>
 #include <cmath>
-#include <ctime>
 #include <cstring>
 #include <locale.h>
+#include <QDebug>
+#include <QTextStream>
+#ifdef QT_WIDGETS_LIB
 #include <QMessageBox>
+#endif
 
 namespace
 {
@@ -29,33 +32,160 @@ namespace
 #define MINUTES(X) fabs(60 * ((X) - ((qint16)(X))))
 #define MS2KNOTTS(x,y,z) sqrt((x)*(x) + (y)*(y) + (z)*(z)) * 1.94385
 
-/** Calculate and append the checksum of an NMEA sentence.
- * Calculates the bitwise XOR of the characters in a string until the end of
- * the string or a `*` is encountered. If the first character is `$` then it
- * is skipped.
- *
- * \param s A null-terminated NMEA sentence, up to and optionally
- * including the '*'
- *
- * \param size Length of the buffer.
- *
+/**
+ * Fixed size sentence buffer. Numbers are written with integer digit
+ * emitters instead of sprintf, and the checksum is updated for every
+ * character so that finishing a sentence only appends the suffix.
  */
-static void nmea_append_checksum(char *s, size_t size) {
-    quint8 sum = 0;
-    char *p = s;
+class NmeaWriter
+{
+public:
+    NmeaWriter(const char *header) : mLen(0), mSum(0) {
+        // '$' header not included in checksum calculation
+        mBuf[mLen++] = '$';
+        str(header);
+    }
+
+    void chr(char c) {
+        if (mLen < (int)sizeof(mBuf) - NMEA_SUFFIX_LEN) {
+            mBuf[mLen++] = c;
+            mSum ^= (quint8)c;
+        }
+    }
+
+    void str(const char *s) {
+        while (*s) {
+            chr(*s++);
+        }
+    }
+
+    /**
+     * Write an unsigned integer, zero padded to at least width digits.
+     */
+    void num(quint64 v, int width) {
+        char digits[20];
+        int n = 0;
+
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v > 0 && n < (int)sizeof(digits));
+
+        while (n < width && n < (int)sizeof(digits)) {
+            digits[n++] = '0';
+        }
+
+        while (n > 0) {
+            chr(digits[--n]);
+        }
+    }
+
+    /**
+     * Write the same text as printf("%0<width>.<decimals>f", v).
+     */
+    void fixed(double v, int width, int decimals) {
+        static const quint64 scale[] = {
+            1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+        };
+
+        if (!std::isfinite(v)) {
+            v = 0.0;
+        }
+
+        decimals = qBound(0, decimals, 8);
+        bool neg = std::signbit(v);
+        quint64 scaled = (quint64)(fabs(v) * scale[decimals] + 0.5);
+        int intWidth = width - (neg ? 1 : 0) - (decimals > 0 ? decimals + 1 : 0);
+
+        if (neg) {
+            chr('-');
+        }
+
+        num(scaled / scale[decimals], qMax(intWidth, 1));
+
+        if (decimals > 0) {
+            chr('.');
+            num(scaled % scale[decimals], decimals);
+        }
+    }
+
+    /**
+     * Write hhmmss.ss from the time of week.
+     */
+    void timeOfDay(double tow) {
+        int t = (int)tow;
+        num((t / 3600) % 24, 2);
+        num((t / 60) % 60, 2);
+        num(t % 60, 2);
+        chr('.');
+        num((int)(fmod(tow, 1.0) * 100.0), 2);
+    }
+
+    /**
+     * Write ddmm.mmmmmmm,N for latitudes or dddmm.mmmmmmm,E for longitudes.
+     */
+    void coord(double deg, bool isLat) {
+        qint16 d = abs((qint16)deg);
+        num(d, isLat ? 2 : 3);
+        fixed(MINUTES(deg), 10, 7);
+        chr(',');
+        chr(isLat ? (deg < 0.0 ? 'S' : 'N') : (deg < 0.0 ? 'W' : 'E'));
+    }
+
+    QByteArray finish() {
+        static const char hex[] = "0123456789ABCDEF";
+        quint8 sum = mSum;
+
+        mBuf[mLen++] = '*';
+        mBuf[mLen++] = hex[sum >> 4];
+        mBuf[mLen++] = hex[sum & 0x0F];
+        mBuf[mLen++] = '\r';
+        mBuf[mLen++] = '\n';
 
-    // '$' header not included in checksum calculation
-    if (*p == '$') {
-        p++;
+        return QByteArray(mBuf, mLen);
     }
 
-    // '*'  not included in checksum calculation
-    while (*p != '*' && *p && p + NMEA_SUFFIX_LEN < s + size) {
-        sum ^= *p;
-        p++;
+private:
+    char mBuf[128];
+    int mLen;
+    quint8 mSum;
+
+};
+
+typedef struct {
+    qint64 day;
+    int year;
+    int month;
+    int mday;
+} nmea_date_t;
+
+static nmea_date_t date_cache = {-1, 0, 0, 0};
+
+/**
+ * Get the UTC calendar date of a GPS week and time of week. The civil date
+ * is only recomputed when the day changes, so this is cheap at high rates.
+ */
+static const nmea_date_t &nmea_date(quint16 wn, double tow)
+{
+    // 1980-01-06 is day 3657 since 1970-01-01
+    qint64 day = 3657 + (qint64)wn * 7 + (qint64)floor(tow / 86400.0);
+
+    if (day != date_cache.day) {
+        // See http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+        qint64 z = day + 719468;
+        qint64 era = (z >= 0 ? z : z - 146096) / 146097;
+        qint64 doe = z - era * 146097;
+        qint64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        qint64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        qint64 mp = (5 * doy + 2) / 153;
+
+        date_cache.day = day;
+        date_cache.mday = doy - (153 * mp + 2) / 5 + 1;
+        date_cache.month = mp < 10 ? mp + 3 : mp - 9;
+        date_cache.year = yoe + era * 400 + (date_cache.month <= 2 ? 1 : 0);
     }
 
-    sprintf(p, "*%02X\r\n", sum);
+    return date_cache;
 }
 
 static double nmea_parse_val(char *str) {
@@ -135,152 +265,26 @@ bool NmeaServer::startTcpServer(int port)
 
 bool NmeaServer::sendNmeaGga(NmeaServer::nmea_gga_info_t &nmea)
 {
-    qint16 lat_deg = nmea.lat;
-    double lat_min = MINUTES(nmea.lat);
-    qint16 lon_deg = nmea.lon;
-    double lon_min = MINUTES(nmea.lon);
-    lat_deg = abs(lat_deg);
-    lon_deg = abs(lon_deg);
-
-    char lat_dir = nmea.lat < 0.0 ? 'S' : 'N';
-    char lon_dir = nmea.lon < 0.0 ? 'W' : 'E';
-
-    int t = (int)nmea.t_tow;
-    int hour = (t / 3600) % 24;
-    int min = (t / 60) % 60;
-    int sec = t % 60;
-    int frac_s = fmod(nmea.t_tow, 1.0) * 100.0;
-
-    QString nmea_str;
-    nmea_str.sprintf("$GPGGA,%02d%02d%02d.%02d,"
-                     "%02d%010.7f,%c,%03d%010.7f,%c,"
-                     "%01d,%02d,%.1f,%.2f,M,,M,,",
-                     hour, min, sec, frac_s,
-                     lat_deg, lat_min, lat_dir, lon_deg, lon_min, lon_dir,
-                     nmea.fix_type, nmea.n_sat, nmea.h_dop, nmea.height);
-    nmea_str.append("*    ");
-    QByteArray nmea_bytes = nmea_str.toLocal8Bit();
-    nmea_append_checksum(nmea_bytes.data(), nmea_bytes.size());
-    nmea_bytes.remove(nmea_bytes.size() - 1, 1);
-
-    //qDebug() << nmea_bytes;
-
-    if (mLog.isOpen()) {
-        mLog.write(nmea_bytes);
-    }
-
-    mTcpBroadcast->broadcastData(nmea_bytes);
-
-    return true;
+    return sendNmeaBytes(ggaSentence(nmea));
 }
 
 bool NmeaServer::sendNmeaZda(quint16 wn, double tow)
 {
-    struct tm time_tm;
-    time_tm.tm_sec = 0;
-    time_tm.tm_hour = 1;
-    time_tm.tm_min = 0;
-    time_tm.tm_mday = 6;
-    time_tm.tm_year = 1980 - 1900;
-    time_tm.tm_mon = 0;
-
-    time_t time = mktime(&time_tm);
-    time += (time_t)wn * 24 * 7 * 60 * 60 + (time_t)tow;
-    time_tm = *localtime(&time);
-
-    int year = time_tm.tm_year + 1900;
-    int month = time_tm.tm_mon + 1;
-    int day = time_tm.tm_mday;
-    int hour = time_tm.tm_hour;
-    int min = time_tm.tm_min;
-    int sec = time_tm.tm_sec;
-    int frac_s = fmod(tow, 1.0) * 100.0;
-
-    QString nmea_str;
-    nmea_str.sprintf("$GPZDA,%02d%02d%02d.%02d,%02d,%02d,%04d,00,00",
-                     hour, min, sec, frac_s, day, month, year);
-    nmea_str.append("*    ");
-    QByteArray nmea_bytes = nmea_str.toLocal8Bit();
-    nmea_append_checksum(nmea_bytes.data(), nmea_bytes.size());
-    nmea_bytes.remove(nmea_bytes.size() - 1, 1);
-
-    //qDebug() << nmea_bytes;
-
-    if (mLog.isOpen()) {
-        mLog.write(nmea_bytes);
-    }
-
-    mTcpBroadcast->broadcastData(nmea_bytes);
-
-    return true;
+    return sendNmeaBytes(zdaSentence(wn, tow));
 }
 
 bool NmeaServer::sendNmeaRmc(NmeaServer::nmea_rmc_info_t &nmea)
 {
-    qint16 lat_deg = nmea.lat;
-    double lat_min = MINUTES(nmea.lat);
-    qint16 lon_deg = nmea.lon;
-    double lon_min = MINUTES(nmea.lon);
-    lat_deg = abs(lat_deg);
-    lon_deg = abs(lon_deg);
-
-    char lat_dir = nmea.lat < 0.0 ? 'S' : 'N';
-    char lon_dir = nmea.lon < 0.0 ? 'W' : 'E';
-
-    struct tm time_tm;
-    time_tm.tm_sec = 0;
-    time_tm.tm_hour = 1;
-    time_tm.tm_min = 0;
-    time_tm.tm_mday = 6;
-    time_tm.tm_year = 1980 - 1900;
-    time_tm.tm_mon = 0;
-
-    time_t time = mktime(&time_tm);
-    time += (time_t)nmea.t_wn * 24 * 7 * 60 * 60 + (time_t)nmea.t_tow;
-    time_tm = *localtime(&time);
-
-    int year = time_tm.tm_year + 1900;
-    int month = time_tm.tm_mon + 1;
-    int day = time_tm.tm_mday;
-    int hour = time_tm.tm_hour;
-    int min = time_tm.tm_min;
-    int sec = time_tm.tm_sec;
-    int frac_s = fmod(nmea.t_tow, 1.0) * 100.0;
-
-    double velocity;
-    double course = atan2(nmea.vel_y, nmea.vel_x);
-    velocity = MS2KNOTTS(nmea.vel_x, nmea.vel_y, nmea.vel_z);
-
-    QString nmea_str;
-    nmea_str.sprintf("$GPRMC,%02d%02d%02d.%02d,A,"
-                     "%02d%010.7f,%c,%03d%010.7f,%c,"
-                     "%06.2f,%05.1f,"
-                     "%02d%02d%02d,"
-                     ",",
-                     hour, min, sec, frac_s,
-                     lat_deg, lat_min, lat_dir, lon_deg, lon_min, lon_dir,
-                     velocity, course * (180.0 / M_PI),
-                     day, month, year % 100);
-    nmea_str.append("*    ");
-    QByteArray nmea_bytes = nmea_str.toLocal8Bit();
-    nmea_append_checksum(nmea_bytes.data(), nmea_bytes.size());
-    nmea_bytes.remove(nmea_bytes.size() - 1, 1);
-
-     //qDebug() << nmea_bytes;
-
-    if (mLog.isOpen()) {
-        mLog.write(nmea_bytes);
-    }
-
-    mTcpBroadcast->broadcastData(nmea_bytes);
-
-    return true;
+    return sendNmeaBytes(rmcSentence(nmea));
 }
 
 bool NmeaServer::sendNmeaRaw(QString msg)
 {
-    QByteArray nmea_bytes = msg.toLocal8Bit();
+    return sendNmeaBytes(msg.toLocal8Bit());
+}
 
+bool NmeaServer::sendNmeaBytes(const QByteArray &nmea_bytes)
+{
     if (mLog.isOpen()) {
         mLog.write(nmea_bytes);
     }
@@ -328,6 +332,81 @@ void NmeaServer::disconnectClientTcp()
     mTcpClient->close();
 }
 
+/**
+ * @brief NmeaServer::ggaSentence
+ * Build a GGA sentence, including checksum and line ending.
+ */
+QByteArray NmeaServer::ggaSentence(const NmeaServer::nmea_gga_info_t &nmea)
+{
+    NmeaWriter w("GPGGA,");
+    w.timeOfDay(nmea.t_tow);
+    w.chr(',');
+    w.coord(nmea.lat, true);
+    w.chr(',');
+    w.coord(nmea.lon, false);
+    w.chr(',');
+    w.num(nmea.fix_type, 1);
+    w.chr(',');
+    w.num(nmea.n_sat, 2);
+    w.chr(',');
+    w.fixed(nmea.h_dop, 0, 1);
+    w.chr(',');
+    w.fixed(nmea.height, 0, 2);
+    w.str(",M,,M,,");
+    return w.finish();
+}
+
+/**
+ * @brief NmeaServer::zdaSentence
+ * Build a ZDA sentence with the UTC date of GPS week wn.
+ */
+QByteArray NmeaServer::zdaSentence(quint16 wn, double tow)
+{
+    const nmea_date_t &date = nmea_date(wn, tow);
+
+    NmeaWriter w("GPZDA,");
+    w.timeOfDay(tow);
+    w.chr(',');
+    w.num(date.mday, 2);
+    w.chr(',');
+    w.num(date.month, 2);
+    w.chr(',');
+    w.num(date.year, 4);
+    w.str(",00,00");
+    return w.finish();
+}
+
+/**
+ * @brief NmeaServer::rmcSentence
+ * Build an RMC sentence. vel_x is north and vel_y is east.
+ */
+QByteArray NmeaServer::rmcSentence(const NmeaServer::nmea_rmc_info_t &nmea)
+{
+    const nmea_date_t &date = nmea_date(nmea.t_wn, nmea.t_tow);
+
+    double course = atan2(nmea.vel_y, nmea.vel_x) * (180.0 / M_PI);
+    if (course < 0.0) {
+        course += 360.0;
+    }
+
+    NmeaWriter w("GPRMC,");
+    w.timeOfDay(nmea.t_tow);
+    w.str(",A,");
+    w.coord(nmea.lat, true);
+    w.chr(',');
+    w.coord(nmea.lon, false);
+    w.chr(',');
+    w.fixed(MS2KNOTTS(nmea.vel_x, nmea.vel_y, nmea.vel_z), 6, 2);
+    w.chr(',');
+    w.fixed(course, 5, 1);
+    w.chr(',');
+    w.num(date.mday, 2);
+    w.num(date.month, 2);
+    w.num(date.year % 100, 2);
+    w.str(",,");
+    return w.finish();
+}
+
 /**
  * @brief NmeaServer::decodeNmeaGGA
  * Decode NMEA GGA message.
@@ -541,9 +620,11 @@ void NmeaServer::tcpInputError(QAbstractSocket::SocketError socketError)
     QString errorStr = mTcpClient->errorString();
     qWarning() << "NMEA TcpError:" << errorStr;
 
+#ifdef QT_WIDGETS_LIB
     // TODO: casting parent to QWidget might not always work. This is however
     // required for making the dialog modal properly.
     QMessageBox::warning((QWidget*)this->parent(), "NMEA TCP Error", errorStr);
+#endif
 
     mTcpClient->close();
 }
@@ -0,0 +1,353 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "obsmonitor.h"
+#include <cmath>
+#include <cstring>
+
+namespace {
+const double speedOfLight = 299792458.0;
+const double secondsPerWeek = 604800.0;
+// A satellite that has not been seen for this long starts over
+const double maxGap = 30.0;
+// The receiver lock time saturates at this value (ms)
+const int locktimeRxMax = 64500;
+// Allowed shortfall of the receiver lock time before it counts as a slip (ms)
+const int locktimeRxMargin = 500;
+// Allowed difference between the phase change and the Doppler prediction,
+// per second between the epochs
+const double phaseJumpCycles = 1.0;
+// Code-minus-carrier jumps are compared to the larger of these
+const double cmcJumpMin = 10.0;
+const double cmcJumpSigmas = 6.0;
+const int cmcMinSamples = 5;
+const double cmcAlpha = 0.05;
+const double cn0Alpha = 0.2;
+// Satellites below this are listed as weak in the summary
+const double cn0Weak = 30.0;
+const double recentSlipTime = 60.0;
+const int summaryMaxListed = 8;
+
+double carrierWavelength(int gnssId, int freqId)
+{
+    switch (gnssId) {
+    case 3: return speedOfLight / 1561.098e6; // BeiDou B1I
+    case 6: return speedOfLight / (1602.0e6 + (double)(freqId - 7) * 0.5625e6);
+    default: return speedOfLight / 1575.42e6;
+    }
+}
+
+const char *gnssName(int gnssId)
+{
+    switch (gnssId) {
+    case 0: return "GPS";
+    case 1: return "SBAS";
+    case 2: return "GAL";
+    case 3: return "BDS";
+    case 5: return "QZSS";
+    case 6: return "GLO";
+    default: return "???";
+    }
+}
+
+char gnssPrefix(int gnssId)
+{
+    switch (gnssId) {
+    case 0: return 'G';
+    case 1: return 'S';
+    case 2: return 'E';
+    case 3: return 'C';
+    case 5: return 'J';
+    case 6: return 'R';
+    default: return '?';
+    }
+}
+}
+
+ObsMonitor::ObsMonitor()
+{
+    reset();
+}
+
+void ObsMonitor::reset()
+{
+    memset(mSats, 0, sizeof(mSats));
+    mTimeNow = 0.0;
+    mSlipsTotal = 0;
+}
+
+/**
+ * @brief ObsMonitor::update
+ * Process one epoch of raw observations. Call this before asking for lock
+ * indicators of the epoch.
+ *
+ * @param rawx
+ * The observations.
+ */
+void ObsMonitor::update(const ubx_rxm_rawx &rawx)
+{
+    const double time = (double)rawx.week * secondsPerWeek + rawx.rcv_tow;
+    mTimeNow = time;
+
+    for (int i = 0;i < rawx.num_meas;i++) {
+        const ubx_rxm_rawx_obs &o = rawx.obs[i];
+
+        // GLONASS satellites with an unknown slot have sv_id 255
+        if (o.gnss_id >= mGnssNum || o.sv_id >= mSvNum) {
+            continue;
+        }
+
+        sat_state_t &s = mSats[o.gnss_id][o.sv_id];
+
+        if (!o.cp_valid || !o.pr_valid) {
+            s.active = false;
+            continue;
+        }
+
+        const double cmc = o.pr_mes - o.cp_mes * carrierWavelength(o.gnss_id, o.freq_id);
+        const double dt = time - s.lastTime;
+        const int halfCycSub = o.half_cyc_valid ? (o.half_cyc_sub ? 1 : 0) : -1;
+
+        if (!s.active || dt > maxGap) {
+            // New satellite. The receiver knows how long it has been locked.
+            int slips = s.slips;
+            double lastSlipTime = s.lastSlipTime;
+            memset(&s, 0, sizeof(sat_state_t));
+            s.active = true;
+            s.slips = slips;
+            s.lastSlipTime = lastSlipTime;
+            s.cn0 = o.cno;
+            s.lockStart = time - (double)o.locktime / 1000.0;
+        } else if (dt <= 0.0) {
+            // Repeated epoch
+            continue;
+        } else {
+            bool slipRx = false;
+            bool slipDetected = false;
+
+            int locktimeExp = s.locktimeRx + (int)(dt * 1000.0);
+            if (locktimeExp > locktimeRxMax) {
+                locktimeExp = locktimeRxMax;
+            }
+
+            if ((int)o.locktime + locktimeRxMargin < locktimeExp) {
+                slipRx = true;
+            }
+
+            // The phase decreases with a positive Doppler. After a receiver
+            // clock reset the phase jumps, so don't look at it then.
+            if (!rawx.clk_reset) {
+                double phaseRes = (o.cp_mes - s.cp) + 0.5 * ((double)o.do_mes + s.doppler) * dt;
+                if (fabs(phaseRes) > phaseJumpCycles * qMax(1.0, dt)) {
+                    slipDetected = true;
+                }
+            }
+
+            if (s.cmcSamples >= cmcMinSamples) {
+                double diff = cmc - s.cmcMean;
+                if (fabs(diff) > qMax(cmcJumpMin, cmcJumpSigmas * sqrt(s.cmcVar))) {
+                    slipDetected = true;
+                }
+            }
+
+            if (halfCycSub >= 0 && s.halfCycSub >= 0 && halfCycSub != s.halfCycSub) {
+                slipDetected = true;
+            }
+
+            if (slipRx) {
+                slip(s, time);
+                s.lockStart = time - (double)o.locktime / 1000.0;
+            } else if (slipDetected) {
+                slip(s, time);
+                s.lockStart = time;
+            }
+
+            s.cn0 += cn0Alpha * ((double)o.cno - s.cn0);
+        }
+
+        // The code-minus-carrier mean follows the ionosphere divergence and
+        // its variance is the code noise and multipath.
+        s.cmcSamples++;
+        double alpha = qMax(1.0 / (double)s.cmcSamples, cmcAlpha);
+        double diff = cmc - s.cmcMean;
+        s.cmcMean += alpha * diff;
+        s.cmcVar = (1.0 - alpha) * (s.cmcVar + alpha * diff * diff);
+
+        s.lastTime = time;
+        s.cp = o.cp_mes;
+        s.doppler = o.do_mes;
+        s.locktimeRx = o.locktime;
+        s.halfCycSub = halfCycSub;
+    }
+}
+
+/**
+ * @brief ObsMonitor::lockIndicator
+ * Get the RTCM 1002/1010 lock time indicator of a satellite in the latest
+ * epoch.
+ *
+ * @return
+ * The indicator, 0 to 127.
+ */
+int ObsMonitor::lockIndicator(int gnssId, int svId) const
+{
+    double t = lockTime(gnssId, svId);
+    return t < 0.0 ? 0 : rtcmLockIndicator(t);
+}
+
+/**
+ * @brief ObsMonitor::lockTime
+ * Get the continuous lock time of a satellite.
+ *
+ * @return
+ * The lock time in seconds, or -1 if the satellite was not tracked in the
+ * latest epoch.
+ */
+double ObsMonitor::lockTime(int gnssId, int svId) const
+{
+    const sat_state_t *s = sat(gnssId, svId);
+
+    if (!s || !s->active || s->lastTime != mTimeNow) {
+        return -1.0;
+    }
+
+    return qMax(0.0, s->lastTime - s->lockStart);
+}
+
+int ObsMonitor::slipsTotal() const
+{
+    return mSlipsTotal;
+}
+
+/**
+ * @brief ObsMonitor::healthSummary
+ * A few lines of text about the satellites in the latest epoch.
+ */
+QString ObsMonitor::healthSummary() const
+{
+    QString str;
+    QString listed;
+    int listedNum = 0;
+    int slipsRecent = 0;
+
+    for (int g = 0;g < mGnssNum;g++) {
+        int num = 0;
+        int numLongLock = 0;
+        double cn0Sum = 0.0;
+        double cn0Min = 0.0;
+
+        for (int sv = 0;sv < mSvNum;sv++) {
+            const sat_state_t &s = mSats[g][sv];
+
+            if (s.slips > 0 && (mTimeNow - s.lastSlipTime) < recentSlipTime) {
+                slipsRecent++;
+            }
+
+            double lock = lockTime(g, sv);
+            if (lock < 0.0) {
+                continue;
+            }
+
+            if (num == 0 || s.cn0 < cn0Min) {
+                cn0Min = s.cn0;
+            }
+
+            num++;
+            cn0Sum += s.cn0;
+
+            if (rtcmLockIndicator(lock) == 127) {
+                numLongLock++;
+            }
+
+            bool slippedRecently = s.slips > 0 && (mTimeNow - s.lastSlipTime) < recentSlipTime;
+            if ((s.cn0 < cn0Weak || slippedRecently) && listedNum < summaryMaxListed) {
+                listed += QString().sprintf("%c%02d (%.0f dB-Hz, lock %.0f s, %d slips)\n",
+                                            gnssPrefix(g), sv, s.cn0, lock, s.slips);
+                listedNum++;
+            }
+        }
+
+        if (num > 0) {
+            str += QString().sprintf("%s: %d sats, CN0 %.1f (min %.1f) dB-Hz, locked > 937 s: %d\n",
+                                     gnssName(g), num, cn0Sum / (double)num, cn0Min, numLongLock);
+        }
+    }
+
+    if (str.isEmpty()) {
+        str = "No observations\n";
+    }
+
+    str += QString().sprintf("Cycle slips: %d sats last minute, %d total\n", slipsRecent, mSlipsTotal);
+
+    if (!listed.isEmpty()) {
+        str += "\nWeak or slipping:\n" + listed;
+    }
+
+    return str.trimmed();
+}
+
+/**
+ * @brief ObsMonitor::rtcmLockIndicator
+ * Convert a lock time to the lock time indicator of RTCM 1001-1004 and
+ * 1009-1012 (DF013 and DF043). The resolution gets coarser with longer lock
+ * times and 127 means at least 937 s.
+ *
+ * @param lockTime
+ * The continuous lock time in seconds.
+ *
+ * @return
+ * The indicator, 0 to 127.
+ */
+int ObsMonitor::rtcmLockIndicator(double lockTime)
+{
+    int t = (int)lockTime;
+
+    if (t < 24) {
+        return qMax(t, 0);
+    } else if (t < 72) {
+        return (t + 24) / 2;
+    } else if (t < 168) {
+        return (t + 120) / 4;
+    } else if (t < 360) {
+        return (t + 408) / 8;
+    } else if (t < 744) {
+        return (t + 1176) / 16;
+    } else if (t < 937) {
+        return (t + 3096) / 32;
+    } else {
+        return 127;
+    }
+}
+
+const ObsMonitor::sat_state_t *ObsMonitor::sat(int gnssId, int svId) const
+{
+    if (gnssId < 0 || gnssId >= mGnssNum || svId < 0 || svId >= mSvNum) {
+        return 0;
+    }
+
+    return &mSats[gnssId][svId];
+}
+
+void ObsMonitor::slip(sat_state_t &s, double time)
+{
+    s.slips++;
+    s.lastSlipTime = time;
+    s.cmcSamples = 0;
+    s.cmcMean = 0.0;
+    s.cmcVar = 0.0;
+    mSlipsTotal++;
+}
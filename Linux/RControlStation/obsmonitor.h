@@ -0,0 +1,79 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef OBSMONITOR_H
+#define OBSMONITOR_H
+
+#include <QString>
+#include "datatypes.h"
+
+// Tracks the quality of raw observations from UBX-RXM-RAWX epochs, one
+// satellite at a time and with a fixed table, so that the memory use does not
+// depend on how long the station runs.
+//
+// For every satellite the continuous lock time is kept. It is restarted when
+// a cycle slip is detected by any of:
+//
+// - The receiver lock time being shorter than the time since the last epoch.
+// - A carrier phase jump compared to the phase predicted from the Doppler.
+// - A code-minus-carrier jump compared to its filtered value.
+// - A change of the half cycle correction.
+//
+// The lock time is then turned into RTCM 1002/1010 lock time indicators.
+class ObsMonitor
+{
+public:
+    ObsMonitor();
+    void reset();
+    void update(const ubx_rxm_rawx &rawx);
+    int lockIndicator(int gnssId, int svId) const;
+    double lockTime(int gnssId, int svId) const;
+    int slipsTotal() const;
+    QString healthSummary() const;
+
+    static int rtcmLockIndicator(double lockTime);
+
+private:
+    typedef struct {
+        bool active;
+        double lastTime;
+        double lockStart;
+        double cp;
+        double doppler;
+        double cmcMean;
+        double cmcVar;
+        int cmcSamples;
+        double cn0;
+        int locktimeRx;
+        int halfCycSub;
+        int slips;
+        double lastSlipTime;
+    } sat_state_t;
+
+    static const int mGnssNum = 7;
+    static const int mSvNum = 64;
+
+    sat_state_t mSats[mGnssNum][mSvNum];
+    double mTimeNow;
+    int mSlipsTotal;
+
+    const sat_state_t *sat(int gnssId, int svId) const;
+    void slip(sat_state_t &s, double time);
+
+};
+
+#endif // OBSMONITOR_H
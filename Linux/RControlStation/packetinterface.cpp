@@ -17,6 +17,7 @@
 
 #include "packetinterface.h"
 #include "utility.h"
+#include "mainconfigcodec.h"
 #include <QDebug>
 #include <math.h>
 #include <QEventLoop>
@@ -68,6 +69,7 @@ PacketInterface::PacketInterface(QObject *parent) :
     mCrcLow = 0;
     mCrcHigh = 0;
     mWaitingAck = false;
+    mConfigSetResult = MAIN_CONFIG_SET_INVALID;
 
     mTimer = new QTimer(this);
     mTimer->setInterval(10);
@@ -77,6 +79,7 @@ PacketInterface::PacketInterface(QObject *parent) :
     mUdpPort = 0;
     mUdpSocket = new QUdpSocket(this);
     mUdpServer = false;
+    mTraceTimer.start();
 
     connect(mUdpSocket, SIGNAL(readyRead()),
             this, SLOT(readPendingDatagrams()));
@@ -196,6 +199,94 @@ void PacketInterface::readPendingDatagrams()
     }
 }
 
+/**
+ * @brief PacketInterface::decodeStats
+ * Decode the payload of CMD_GET_STATS. The length is checked before every
+ * field, so a truncated or corrupt packet is never read past its end.
+ *
+ * @param data
+ * The payload, after the id and command bytes.
+ *
+ * @param len
+ * The length of the payload.
+ *
+ * @param stats
+ * The decoded statistics.
+ *
+ * @return
+ * False if the packet is malformed.
+ */
+bool PacketInterface::decodeStats(const unsigned char *data, int len, FW_STATS &stats)
+{
+    memset(&stats, 0, sizeof(FW_STATS));
+    int32_t ind = 0;
+
+    if (len < 9) {
+        return false;
+    }
+
+    stats.uptime_ms = utility::buffer_get_uint32(data, &ind);
+    stats.rtcm_bytes = utility::buffer_get_uint32(data, &ind);
+
+    int queue_num = data[ind++];
+    if ((len - ind) < (queue_num * 8 + 1)) {
+        return false;
+    }
+
+    for (int i = 0;i < queue_num;i++) {
+        quint16 hwm = utility::buffer_get_uint16(data, &ind);
+        quint16 size = utility::buffer_get_uint16(data, &ind);
+        quint32 overflows = utility::buffer_get_uint32(data, &ind);
+        if (i < STATS_QUEUE_NUM) {
+            stats.queue_hwm[i] = hwm;
+            stats.queue_size[i] = size;
+            stats.queue_overflows[i] = overflows;
+            stats.queue_num++;
+        }
+    }
+
+    int thread_num = data[ind++];
+    for (int i = 0;i < thread_num;i++) {
+        const char *name = (const char*)data + ind;
+        const char *nameEnd = (const char*)memchr(name, '\0', len - ind);
+        if (!nameEnd) {
+            return false;
+        }
+
+        ind += nameEnd - name + 1;
+        if ((len - ind) < 4) {
+            return false;
+        }
+
+        float load = utility::buffer_get_double32_auto(data, &ind);
+        if (stats.thread_num < 32) {
+            FW_STATS_THREAD &t = stats.threads[stats.thread_num++];
+            strncpy(t.name, name, sizeof(t.name) - 1);
+            t.load = load;
+        }
+    }
+
+    if ((len - ind) < 1) {
+        return false;
+    }
+
+    stats.cmd_num = data[ind++];
+    if ((len - ind) < (stats.cmd_num * 13)) {
+        stats.cmd_num = 0;
+        return false;
+    }
+
+    for (int i = 0;i < stats.cmd_num;i++) {
+        FW_STATS_CMD &c = stats.cmds[i];
+        c.cmd = data[ind++];
+        c.count = utility::buffer_get_uint32(data, &ind);
+        c.time_avg_us = utility::buffer_get_double32_auto(data, &ind);
+        c.time_max_us = utility::buffer_get_double32_auto(data, &ind);
+    }
+
+    return true;
+}
+
 unsigned short PacketInterface::crc16(const unsigned char *buf, unsigned int len)
 {
     unsigned int i;
@@ -353,116 +444,64 @@ void PacketInterface::processPacket(const unsigned char *data, int len)
     case CMD_GET_MAIN_CONFIG:
     case CMD_GET_MAIN_CONFIG_DEFAULT: {
         MAIN_CONFIG conf;
+        memset(&conf, 0, sizeof(MAIN_CONFIG));
 
+        MainConfigView view(data, len);
+        if (view.apply(conf) < 0) {
+            break;
+        }
+
+        if (cmd == CMD_GET_MAIN_CONFIG) {
+            mConfigCache[id] = conf;
+        }
+
+        emit configurationReceived(id, conf);
+    } break;
+
+    case CMD_GET_MAIN_CONFIG_HASH: {
         int32_t ind = 0;
-        conf.mag_use = data[ind++];
-        conf.mag_comp = data[ind++];
-        conf.yaw_mag_gain = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mag_cal_cx = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_cy = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_cz = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_xx = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_xy = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_xz = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_yx = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_yy = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_yz = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_zx = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_zy = utility::buffer_get_double32_auto(data, &ind);
-        conf.mag_cal_zz = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.gps_ant_x = utility::buffer_get_double32_auto(data, &ind);
-        conf.gps_ant_y = utility::buffer_get_double32_auto(data, &ind);
-        conf.gps_comp = data[ind++];
-        conf.gps_req_rtk = data[ind++];
-        conf.gps_corr_gain_stat = utility::buffer_get_double32_auto(data, &ind);
-        conf.gps_corr_gain_dyn = utility::buffer_get_double32_auto(data, &ind);
-        conf.gps_corr_gain_yaw = utility::buffer_get_double32_auto(data, &ind);
-        conf.gps_send_nmea = data[ind++];
-        conf.gps_use_ubx_info = data[ind++];
-        conf.gps_ubx_max_acc = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.ap_repeat_routes = data[ind++];
-        conf.ap_base_rad = utility::buffer_get_double32_auto(data, &ind);
-        conf.ap_mode_time = data[ind++];
-        conf.ap_max_speed = utility::buffer_get_double32_auto(data, &ind);
-        conf.ap_time_add_repeat_ms = utility::buffer_get_int32(data, &ind);
-
-        conf.log_en = data[ind++];
-        strcpy(conf.log_name, (const char*)(data + ind));
-        ind += strlen(conf.log_name) + 1;
-
-        // Car settings
-        conf.car.yaw_use_odometry = data[ind++];
-        conf.car.yaw_imu_gain = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.disable_motor = data[ind++];
-
-        conf.car.gear_ratio = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.wheel_diam = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.motor_poles = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.steering_max_angle_rad = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.steering_center = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.steering_range = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.steering_ramp_time = utility::buffer_get_double32_auto(data, &ind);
-        conf.car.axis_distance = utility::buffer_get_double32_auto(data, &ind);
-
-        // Multirotor settings
-        conf.mr.vel_decay_e = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.vel_decay_l = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.vel_max = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.map_min_x = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.map_max_x = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.map_min_y = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.map_max_y = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.vel_gain_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.vel_gain_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.vel_gain_d = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.tilt_gain_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.tilt_gain_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.tilt_gain_d = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.max_corr_error = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.max_tilt_error = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.ctrl_gain_roll_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_roll_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_roll_dp = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_roll_de = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.ctrl_gain_pitch_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_pitch_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_pitch_dp = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_pitch_de = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.ctrl_gain_yaw_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_yaw_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_yaw_dp = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_yaw_de = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.ctrl_gain_pos_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_pos_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_pos_d = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.ctrl_gain_alt_p = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_alt_i = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.ctrl_gain_alt_d = utility::buffer_get_double32_auto(data, &ind);
-
-        conf.mr.js_gain_tilt = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.js_gain_yaw = utility::buffer_get_double32_auto(data, &ind);
-        conf.mr.js_mode_rate = data[ind++];
-
-        conf.mr.motor_fl_f = data[ind++];
-        conf.mr.motor_bl_l = data[ind++];
-        conf.mr.motor_fr_r = data[ind++];
-        conf.mr.motor_br_b = data[ind++];
-        conf.mr.motors_x = data[ind++];
-        conf.mr.motors_cw = data[ind++];
-        conf.mr.motor_pwm_min_us = utility::buffer_get_uint16(data, &ind);
-        conf.mr.motor_pwm_max_us = utility::buffer_get_uint16(data, &ind);
 
+        if (len < 2) {
+            break;
+        }
+
+        quint16 hash = utility::buffer_get_uint16(data, &ind);
+
+        // Drop a cached configuration that was changed by someone else
+        if (mConfigCache.contains(id) && MainConfigView::hash(mConfigCache[id]) != hash) {
+            mConfigCache.remove(id);
+        }
+
+        emit configurationHashReceived(id, hash);
+    } break;
+
+    case CMD_GET_MAIN_CONFIG_FIELDS: {
+        int32_t ind = 0;
+
+        if (len < 2) {
+            break;
+        }
+
+        quint16 hash = utility::buffer_get_uint16(data, &ind);
+        MainConfigView view(data + ind, len - ind);
+
+        // The fields are merged into the cached configuration. If the result
+        // does not match the firmware the whole configuration is read again.
+        if (!view.isValid() || !mConfigCache.contains(id)) {
+            getConfiguration(id);
+            break;
+        }
+
+        MAIN_CONFIG conf = mConfigCache[id];
+        view.apply(conf);
+
+        if (MainConfigView::hash(conf) != hash) {
+            mConfigCache.remove(id);
+            getConfiguration(id);
+            break;
+        }
+
+        mConfigCache[id] = conf;
         emit configurationReceived(id, conf);
     } break;
 
@@ -537,6 +576,82 @@ void PacketInterface::processPacket(const unsigned char *data, int len)
         emit dwSampleReceived(id, dw);
     } break;
 
+    case CMD_TRACE: {
+        TRACE_INFO trace;
+        memset(&trace, 0, sizeof(TRACE_INFO));
+        int32_t ind = 0;
+
+        if (len < 4) {
+            break;
+        }
+
+        trace.trace_id = utility::buffer_get_uint32(data, &ind);
+        while ((ind + 5) <= len) {
+            int hop = data[ind++];
+            quint32 time = utility::buffer_get_uint32(data, &ind);
+            if (hop < TRACE_HOP_STATION_RX) {
+                trace.hop_time[hop] = time;
+                trace.hop_valid |= 1 << hop;
+            }
+        }
+
+        trace.hop_time[TRACE_HOP_STATION_RX] = (quint32)(mTraceTimer.nsecsElapsed() / 1000);
+        trace.hop_valid |= 1 << TRACE_HOP_STATION_RX;
+
+        emit traceReceived(id, trace);
+    } break;
+
+    case CMD_GET_STATS: {
+        FW_STATS stats;
+        if (decodeStats(data, len, stats)) {
+            emit statsReceived(id, stats);
+        } else {
+            qWarning() << "Invalid stats packet from car" << id;
+        }
+    } break;
+
+    case CMD_IMU_CAPTURE_DATA: {
+        int32_t ind = 0;
+
+        if (len < 11) {
+            break;
+        }
+
+        ind += 2; // Sequence number
+        quint32 dropped = utility::buffer_get_uint32(data, &ind);
+        int num = data[ind++];
+        quint32 time_us = utility::buffer_get_uint32(data, &ind);
+
+        if (len < (11 + num * 20)) {
+            break;
+        }
+
+        QVector<IMU_SAMPLE> samples;
+        samples.reserve(num);
+
+        for (int i = 0;i < num;i++) {
+            IMU_SAMPLE s;
+            time_us += utility::buffer_get_uint16(data, &ind);
+            s.time = (double)time_us / 1e6;
+
+            for (int j = 0;j < 3;j++) {
+                s.accel[j] = (double)utility::buffer_get_int16(data, &ind) * 16.0 / 32768.0;
+            }
+
+            for (int j = 0;j < 3;j++) {
+                s.gyro[j] = (double)utility::buffer_get_int16(data, &ind) * 2000.0 / 32768.0;
+            }
+
+            for (int j = 0;j < 3;j++) {
+                s.mag[j] = (double)utility::buffer_get_int16(data, &ind) * 1200.0 / 4096.0;
+            }
+
+            samples.append(s);
+        }
+
+        emit imuSamplesReceived(id, samples, dropped);
+    } break;
+
     case CMD_SET_SYSTEM_TIME: {
         int32_t ind = 0;
         qint32 sec = utility::buffer_get_int32(data, &ind);
@@ -626,6 +741,12 @@ void PacketInterface::processPacket(const unsigned char *data, int len)
         state.ap_goal_py = utility::buffer_get_double32_auto(data, &ind);
         state.ms_today = utility::buffer_get_int32(data, &ind);
 
+        // Older firmware does not send the climb rate
+        state.vz = 0.0;
+        if ((len - ind) >= 4) {
+            state.vz = utility::buffer_get_double32_auto(data, &ind);
+        }
+
         emit mrStateReceived(id, state);
     } break;
 
@@ -645,9 +766,21 @@ void PacketInterface::processPacket(const unsigned char *data, int len)
     case CMD_AP_REPLACE_ROUTE:
         emit ackReceived(id, cmd, "CMD_AP_REPLACE_ROUTE");
         break;
+    case CMD_GEOFENCE_SET:
+        emit ackReceived(id, cmd, (len > 0 && data[0]) ?
+                "CMD_GEOFENCE_SET" : "CMD_GEOFENCE_SET (rejected)");
+        break;
     case CMD_SET_MAIN_CONFIG:
         emit ackReceived(id, cmd, "CMD_SET_MAIN_CONFIG");
         break;
+    case CMD_SET_MAIN_CONFIG_FIELDS:
+        mConfigSetResult = len > 0 ? (MAIN_CONFIG_SET_RESULT)data[0] : MAIN_CONFIG_SET_INVALID;
+        emit ackReceived(id, cmd, mConfigSetResult == MAIN_CONFIG_SET_OK ?
+                "CMD_SET_MAIN_CONFIG_FIELDS" : "CMD_SET_MAIN_CONFIG_FIELDS (rejected)");
+        break;
+    case CMD_IMU_CAPTURE_SET:
+        emit ackReceived(id, cmd, "CMD_IMU_CAPTURE_SET");
+        break;
     case CMD_SET_POS_ACK:
         emit ackReceived(id, cmd, "CMD_SET_POS_ACK");
         break;
@@ -757,6 +890,37 @@ bool PacketInterface::clearRoute(quint8 id, int retries)
     return sendPacketAck(mSendBuffer, send_index, retries);
 }
 
+/**
+ * @brief PacketInterface::setGeofence
+ * Upload a geofence polygon. The car brakes when it is outside of it.
+ *
+ * @param id
+ * The car id.
+ *
+ * @param points
+ * The polygon corners. An empty list disables the geofence.
+ *
+ * @param retries
+ * The maximum number of retries before giving up.
+ *
+ * @return
+ * True if the car acknowledged the packet.
+ */
+bool PacketInterface::setGeofence(quint8 id, QList<LocPoint> points, int retries)
+{
+    qint32 send_index = 0;
+    mSendBuffer[send_index++] = id;
+    mSendBuffer[send_index++] = CMD_GEOFENCE_SET;
+
+    for (int i = 0;i < points.size();i++) {
+        LocPoint *p = &points[i];
+        utility::buffer_append_double32(mSendBuffer, p->getX(), 1e4, &send_index);
+        utility::buffer_append_double32(mSendBuffer, p->getY(), 1e4, &send_index);
+    }
+
+    return sendPacketAck(mSendBuffer, send_index, retries);
+}
+
 bool PacketInterface::setApActive(quint8 id, bool active, int retries)
 {
     qint32 send_index = 0;
@@ -767,121 +931,119 @@ bool PacketInterface::setApActive(quint8 id, bool active, int retries)
     return sendPacketAck(mSendBuffer, send_index, retries);
 }
 
+/**
+ * @brief PacketInterface::setConfiguration
+ * Write a configuration. If the configuration of the car is cached, only the
+ * fields that differ from the cached copy are sent. The whole configuration
+ * is sent if there is no cached copy or if the firmware rejects the changes
+ * because its configuration does not match the cached copy.
+ *
+ * @param id
+ * The car id.
+ *
+ * @param conf
+ * The configuration to write.
+ *
+ * @param retries
+ * The maximum number of retries before giving up.
+ *
+ * @return
+ * True if the configuration was written, false otherwise.
+ */
 bool PacketInterface::setConfiguration(quint8 id, MAIN_CONFIG &conf, int retries)
 {
     qint32 send_index = 0;
+
+    if (mConfigCache.contains(id)) {
+        const MAIN_CONFIG &confOld = mConfigCache[id];
+        quint8 mask[MAIN_CONFIG_MASK_BYTES];
+        MainConfigView::diff(confOld, conf, mask);
+
+        mSendBuffer[send_index++] = id;
+        mSendBuffer[send_index++] = CMD_SET_MAIN_CONFIG_FIELDS;
+        utility::buffer_append_uint16(mSendBuffer, MainConfigView::hash(confOld), &send_index);
+        send_index += MainConfigView::encode(conf, mSendBuffer + send_index, mask);
+
+        mConfigSetResult = MAIN_CONFIG_SET_INVALID;
+        if (!sendPacketAck(mSendBuffer, send_index, retries, 500)) {
+            return false;
+        }
+
+        if (mConfigSetResult == MAIN_CONFIG_SET_OK) {
+            mConfigCache[id] = conf;
+            return true;
+        }
+
+        mConfigCache.remove(id);
+        send_index = 0;
+    }
+
     mSendBuffer[send_index++] = id;
     mSendBuffer[send_index++] = CMD_SET_MAIN_CONFIG;
+    send_index += MainConfigView::encode(conf, mSendBuffer + send_index);
+
+    bool ok = sendPacketAck(mSendBuffer, send_index, retries, 500);
+
+    if (ok) {
+        mConfigCache[id] = conf;
+    }
 
-    mSendBuffer[send_index++] = conf.mag_use;
-    mSendBuffer[send_index++] = conf.mag_comp;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.yaw_mag_gain, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_cx, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_cy, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_cz, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_xx, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_xy, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_xz, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_yx, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_yy, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_yz, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_zx, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_zy, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mag_cal_zz, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_ant_x, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_ant_y, &send_index);
-    mSendBuffer[send_index++] = conf.gps_comp;
-    mSendBuffer[send_index++] = conf.gps_req_rtk;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_corr_gain_stat, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_corr_gain_dyn, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_corr_gain_yaw, &send_index);
-    mSendBuffer[send_index++] = conf.gps_send_nmea;
-    mSendBuffer[send_index++] = conf.gps_use_ubx_info;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.gps_ubx_max_acc, &send_index);
-
-    mSendBuffer[send_index++] = conf.ap_repeat_routes;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.ap_base_rad, &send_index);
-    mSendBuffer[send_index++] = conf.ap_mode_time;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.ap_max_speed, &send_index);
-    utility::buffer_append_int32(mSendBuffer, conf.ap_time_add_repeat_ms, &send_index);
-
-    mSendBuffer[send_index++] = conf.log_en;
-    strcpy((char*)(mSendBuffer + send_index), conf.log_name);
-    send_index += strlen(conf.log_name) + 1;
-
-    // Car settings
-    mSendBuffer[send_index++] = conf.car.yaw_use_odometry;
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.yaw_imu_gain, &send_index);
-    mSendBuffer[send_index++] = conf.car.disable_motor;
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.gear_ratio, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.wheel_diam, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.motor_poles, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.steering_max_angle_rad, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.steering_center, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.steering_range, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.steering_ramp_time, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.car.axis_distance, &send_index);
-
-    // Multirotor settings
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_decay_e, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_decay_l, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_max, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.map_min_x, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.map_max_x, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.map_min_y, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.map_max_y, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_gain_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_gain_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.vel_gain_d, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.tilt_gain_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.tilt_gain_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.tilt_gain_d, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.max_corr_error, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.max_tilt_error, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_roll_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_roll_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_roll_dp, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_roll_de, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pitch_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pitch_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pitch_dp, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pitch_de, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_yaw_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_yaw_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_yaw_dp, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_yaw_de, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pos_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pos_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_pos_d, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_alt_p, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_alt_i, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.ctrl_gain_alt_d, &send_index);
-
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.js_gain_tilt, &send_index);
-    utility::buffer_append_double32_auto(mSendBuffer, conf.mr.js_gain_yaw, &send_index);
-    mSendBuffer[send_index++] = conf.mr.js_mode_rate;
-
-    mSendBuffer[send_index++] = conf.mr.motor_fl_f;
-    mSendBuffer[send_index++] = conf.mr.motor_bl_l;
-    mSendBuffer[send_index++] = conf.mr.motor_fr_r;
-    mSendBuffer[send_index++] = conf.mr.motor_br_b;
-    mSendBuffer[send_index++] = conf.mr.motors_x;
-    mSendBuffer[send_index++] = conf.mr.motors_cw;
-    utility::buffer_append_uint16(mSendBuffer, conf.mr.motor_pwm_min_us, &send_index);
-    utility::buffer_append_uint16(mSendBuffer, conf.mr.motor_pwm_max_us, &send_index);
-
-    return sendPacketAck(mSendBuffer, send_index, retries, 500);
+    return ok;
+}
+
+/**
+ * @brief PacketInterface::getCachedConfiguration
+ * Get the last configuration that was read from or written to a car.
+ *
+ * @param id
+ * The car id.
+ *
+ * @param conf
+ * The cached configuration, or all zeroes if there is none.
+ *
+ * @return
+ * True if a configuration was cached for the car.
+ */
+bool PacketInterface::getCachedConfiguration(quint8 id, MAIN_CONFIG &conf)
+{
+    if (!mConfigCache.contains(id)) {
+        memset(&conf, 0, sizeof(MAIN_CONFIG));
+        return false;
+    }
+
+    conf = mConfigCache[id];
+    return true;
+}
+
+/**
+ * @brief PacketInterface::getConfigurationFields
+ * Read some fields of the configuration. They are merged into the cached
+ * configuration, which is then emitted with configurationReceived. If there
+ * is no cached configuration, or it turns out to be outdated, the whole
+ * configuration is read instead.
+ *
+ * @param id
+ * The car id.
+ *
+ * @param fields
+ * The fields to read.
+ */
+void PacketInterface::getConfigurationFields(quint8 id, QVector<MAIN_CONFIG_FIELD> fields)
+{
+    qint32 send_index = 0;
+    mSendBuffer[send_index++] = id;
+    mSendBuffer[send_index++] = CMD_GET_MAIN_CONFIG_FIELDS;
+    mSendBuffer[send_index++] = MAIN_CONFIG_SCHEMA_VERSION;
+    mSendBuffer[send_index++] = MAIN_CONFIG_FIELD_NUM;
+
+    quint8 *mask = mSendBuffer + send_index;
+    memset(mask, 0, MAIN_CONFIG_MASK_BYTES);
+    foreach(MAIN_CONFIG_FIELD f, fields) {
+        MAIN_CONFIG_MASK_SET(mask, f);
+    }
+    send_index += MAIN_CONFIG_MASK_BYTES;
+
+    sendPacket(mSendBuffer, send_index);
 }
 
 bool PacketInterface::setPosAck(quint8 id, double x, double y, double angle, int retries)
@@ -1116,6 +1278,15 @@ void PacketInterface::getDefaultConfiguration(quint8 id)
     sendPacket(packet);
 }
 
+void PacketInterface::getConfigurationHash(quint8 id)
+{
+    QByteArray packet;
+    packet.clear();
+    packet.append(id);
+    packet.append((char)CMD_GET_MAIN_CONFIG_HASH);
+    sendPacket(packet);
+}
+
 void PacketInterface::setYawOffset(quint8 id, double angle)
 {
     qint32 send_index = 0;
@@ -1175,3 +1346,33 @@ void PacketInterface::mrOverridePower(quint8 id, double fl_f, double bl_l, doubl
     utility::buffer_append_double32_auto(mSendBuffer, br_b, &send_index);
     sendPacket(mSendBuffer, send_index);
 }
+
+void PacketInterface::sendTrace(quint8 id, quint32 traceId)
+{
+    qint32 send_index = 0;
+    mSendBuffer[send_index++] = id;
+    mSendBuffer[send_index++] = CMD_TRACE;
+    utility::buffer_append_uint32(mSendBuffer, traceId, &send_index);
+    mSendBuffer[send_index++] = TRACE_HOP_STATION_TX;
+    utility::buffer_append_uint32(mSendBuffer, (quint32)(mTraceTimer.nsecsElapsed() / 1000), &send_index);
+    sendPacket(mSendBuffer, send_index);
+}
+
+void PacketInterface::getStats(quint8 id)
+{
+    QByteArray packet;
+    packet.clear();
+    packet.append(id);
+    packet.append((char)CMD_GET_STATS);
+    sendPacket(packet);
+}
+
+void PacketInterface::setImuCapture(quint8 id, bool enabled, int decimation)
+{
+    qint32 send_index = 0;
+    mSendBuffer[send_index++] = id;
+    mSendBuffer[send_index++] = CMD_IMU_CAPTURE_SET;
+    mSendBuffer[send_index++] = enabled;
+    mSendBuffer[send_index++] = decimation;
+    sendPacket(mSendBuffer, send_index);
+}
@@ -22,8 +22,11 @@
 #include <QTimer>
 #include <QVector>
 #include <QUdpSocket>
+#include <QElapsedTimer>
+#include <QHash>
 #include "datatypes.h"
 #include "locpoint.h"
+#include "mainconfigcodec.h"
 
 class PacketInterface : public QObject
 {
@@ -45,13 +48,18 @@ public:
     bool replaceRoute(quint8 id, QList<LocPoint> points, int retries = 10);
     bool removeLastRoutePoint(quint8 id, int retries = 10);
     bool clearRoute(quint8 id, int retries = 10);
+    bool setGeofence(quint8 id, QList<LocPoint> points, int retries = 10);
     bool setApActive(quint8 id, bool active, int retries = 10);
     bool setConfiguration(quint8 id, MAIN_CONFIG &conf, int retries = 10);
+    bool getCachedConfiguration(quint8 id, MAIN_CONFIG &conf);
+    void getConfigurationFields(quint8 id, QVector<MAIN_CONFIG_FIELD> fields);
     bool setPosAck(quint8 id, double x, double y, double angle, int retries = 10);
     bool setYawOffsetAck(quint8 id, double angle, int retries = 10);
     bool setEnuRef(quint8 id, double *llh, int retries = 10);
     bool radarSetupSet(quint8 id, radar_settings_t *s, int retries = 10);
     bool setSystemTime(quint8 id, qint32 sec, qint32 usec, int retries = 10);
+
+    static bool decodeStats(const unsigned char *data, int len, FW_STATS &stats);
     bool sendReboot(quint8 id, bool powerOff, int retries = 10);
 
     bool sendMoteUbxBase(int mode,
@@ -74,6 +82,7 @@ signals:
     void rtcmUsbReceived(quint8 id, QByteArray data);
     void nmeaRadioReceived(quint8 id, QByteArray data);
     void configurationReceived(quint8 id, MAIN_CONFIG conf);
+    void configurationHashReceived(quint8 id, quint16 hash);
     void enuRefReceived(quint8 id, double lat, double lon, double height);
     void logLineUsbReceived(quint8 id, QString str);
     void plotInitReceived(quint8 id, QString xLabel, QString yLabel);
@@ -83,6 +92,9 @@ signals:
     void systemTimeReceived(quint8 id, qint32 sec, qint32 usec);
     void rebootSystemReceived(quint8 id, bool powerOff);
     void dwSampleReceived(quint8 id, DW_LOG_INFO dw);
+    void traceReceived(quint8 id, TRACE_INFO trace);
+    void statsReceived(quint8 id, FW_STATS stats);
+    void imuSamplesReceived(quint8 id, QVector<IMU_SAMPLE> samples, quint32 dropped);
     
 public slots:
     void timerSlot();
@@ -101,12 +113,16 @@ public slots:
     void sendNmeaRadio(quint8 id, QByteArray nmea_msg);
     void getConfiguration(quint8 id);
     void getDefaultConfiguration(quint8 id);
+    void getConfigurationHash(quint8 id);
     void setYawOffset(quint8 id, double angle);
     void getEnuRef(quint8 id);
     void setMsToday(quint8 id, qint32 time);
     void radarSetupGet(quint8 id);
     void mrRcControl(quint8 id, double throttle, double roll, double pitch, double yaw);
     void mrOverridePower(quint8 id, double fl_f, double bl_l, double fr_r, double br_b);
+    void sendTrace(quint8 id, quint32 traceId);
+    void getStats(quint8 id);
+    void setImuCapture(quint8 id, bool enabled, int decimation);
 
 private:
     unsigned short crc16(const unsigned char *buf, unsigned int len);
@@ -119,6 +135,12 @@ private:
     int mUdpPort;
     bool mUdpServer;
     bool mWaitingAck;
+    QElapsedTimer mTraceTimer;
+
+    // Last configuration read from or written to each car, used to send
+    // only the fields that changed.
+    QHash<quint8, MAIN_CONFIG> mConfigCache;
+    MAIN_CONFIG_SET_RESULT mConfigSetResult;
 
     // Packet state machine variables
     static const unsigned int mMaxBufferLen = 4096;
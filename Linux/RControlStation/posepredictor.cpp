@@ -0,0 +1,225 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "posepredictor.h"
+#include <cmath>
+
+namespace {
+// Do not extrapolate further than this
+const double maxHorizon = 1.0;
+// Time constant for fading out the correction after a new state
+const double correctionTau = 0.15;
+// Corrections larger than this are applied directly
+const double maxCorrection = 2.0;
+// Assumed unknown acceleration and yaw rate error for the uncertainty
+const double accelSigma = 2.0;
+const double yawRateSigma = 0.5;
+
+double normalizeAngle(double angle)
+{
+    while (angle > M_PI) {
+        angle -= 2.0 * M_PI;
+    }
+
+    while (angle < -M_PI) {
+        angle += 2.0 * M_PI;
+    }
+
+    return angle;
+}
+}
+
+PosePredictor::PosePredictor()
+{
+    reset();
+}
+
+/**
+ * @brief PosePredictor::update
+ * Set a new measured state. The difference between the pose that was
+ * predicted for this moment and the new state is kept and faded out, so that
+ * the displayed pose moves smoothly to the new state instead of jumping.
+ *
+ * @param px
+ * The x position in meters.
+ *
+ * @param py
+ * The y position in meters.
+ *
+ * @param heading
+ * The heading in radians, counter-clockwise from the x axis.
+ *
+ * @param speed
+ * The speed in m/s.
+ *
+ * @param yawRate
+ * The rate of change of the heading in rad/s.
+ *
+ * @param timeMs
+ * The local time when the state was received.
+ */
+void PosePredictor::update(double px, double py, double heading,
+                           double speed, double yawRate, qint64 timeMs)
+{
+    double corrX = 0.0;
+    double corrY = 0.0;
+    double corrHeading = 0.0;
+
+    if (mValid) {
+        double dpx, dpy, dheading, sigma;
+        predict(timeMs, dpx, dpy, dheading, sigma);
+
+        corrX = dpx - px;
+        corrY = dpy - py;
+        corrHeading = normalizeAngle(dheading - heading);
+
+        if (sqrt(corrX * corrX + corrY * corrY) > maxCorrection) {
+            corrX = 0.0;
+            corrY = 0.0;
+            corrHeading = 0.0;
+        }
+    }
+
+    mPx = px;
+    mPy = py;
+    mHeading = heading;
+    mSpeed = speed;
+    mYawRate = yawRate;
+    mTimeMs = timeMs;
+    mCorrX = corrX;
+    mCorrY = corrY;
+    mCorrHeading = corrHeading;
+    mValid = true;
+}
+
+/**
+ * @brief PosePredictor::predict
+ * Extrapolate the last state to a given time with a constant turn rate and
+ * velocity model.
+ *
+ * @param timeMs
+ * The time to predict the pose at.
+ *
+ * @param px
+ * The predicted x position.
+ *
+ * @param py
+ * The predicted y position.
+ *
+ * @param heading
+ * The predicted heading.
+ *
+ * @param sigma
+ * The standard deviation of the predicted position. This grows with the age
+ * of the state.
+ */
+void PosePredictor::predict(qint64 timeMs, double &px, double &py,
+                            double &heading, double &sigma) const
+{
+    if (!mValid) {
+        px = 0.0;
+        py = 0.0;
+        heading = 0.0;
+        sigma = 0.0;
+        return;
+    }
+
+    double dt = age(timeMs);
+    predictRaw(dt, px, py, heading);
+
+    double gain = correctionGain(timeMs);
+    px += mCorrX * gain;
+    py += mCorrY * gain;
+    heading = normalizeAngle(heading + mCorrHeading * gain);
+
+    sigma = 0.5 * dt * dt * (accelSigma + fabs(mSpeed) * yawRateSigma);
+}
+
+/**
+ * @brief PosePredictor::isMoving
+ * Check if the predicted pose still changes, so that it is worth redrawing.
+ */
+bool PosePredictor::isMoving(qint64 timeMs) const
+{
+    if (!mValid) {
+        return false;
+    }
+
+    if (fabs(mSpeed) > 0.01 || fabs(mYawRate) > 0.01) {
+        return (double)(timeMs - mTimeMs) / 1000.0 < maxHorizon;
+    }
+
+    double gain = correctionGain(timeMs);
+    return (fabs(mCorrX) + fabs(mCorrY)) * gain > 0.001 ||
+            fabs(mCorrHeading) * gain > 0.001;
+}
+
+bool PosePredictor::isValid() const
+{
+    return mValid;
+}
+
+void PosePredictor::reset()
+{
+    mValid = false;
+    mPx = 0.0;
+    mPy = 0.0;
+    mHeading = 0.0;
+    mSpeed = 0.0;
+    mYawRate = 0.0;
+    mTimeMs = 0;
+    mCorrX = 0.0;
+    mCorrY = 0.0;
+    mCorrHeading = 0.0;
+}
+
+void PosePredictor::predictRaw(double dt, double &px, double &py, double &heading) const
+{
+    if (fabs(mYawRate) < 1e-4) {
+        px = mPx + mSpeed * dt * cos(mHeading);
+        py = mPy + mSpeed * dt * sin(mHeading);
+        heading = mHeading;
+    } else {
+        heading = mHeading + mYawRate * dt;
+        px = mPx + mSpeed / mYawRate * (sin(heading) - sin(mHeading));
+        py = mPy + mSpeed / mYawRate * (cos(mHeading) - cos(heading));
+    }
+}
+
+double PosePredictor::age(qint64 timeMs) const
+{
+    double dt = (double)(timeMs - mTimeMs) / 1000.0;
+
+    if (dt < 0.0) {
+        dt = 0.0;
+    } else if (dt > maxHorizon) {
+        dt = maxHorizon;
+    }
+
+    return dt;
+}
+
+double PosePredictor::correctionGain(qint64 timeMs) const
+{
+    double dt = (double)(timeMs - mTimeMs) / 1000.0;
+
+    if (dt < 0.0) {
+        dt = 0.0;
+    }
+
+    return exp(-dt / correctionTau);
+}
@@ -0,0 +1,56 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef POSEPREDICTOR_H
+#define POSEPREDICTOR_H
+
+#include <QtGlobal>
+
+class PosePredictor
+{
+public:
+    PosePredictor();
+    void update(double px, double py, double heading,
+                double speed, double yawRate, qint64 timeMs);
+    void predict(qint64 timeMs, double &px, double &py,
+                 double &heading, double &sigma) const;
+    bool isMoving(qint64 timeMs) const;
+    bool isValid() const;
+    void reset();
+
+private:
+    bool mValid;
+    double mPx;
+    double mPy;
+    double mHeading;
+    double mSpeed;
+    double mYawRate;
+    qint64 mTimeMs;
+
+    // Difference between what was displayed and the new state, which is
+    // faded out to avoid jumps.
+    double mCorrX;
+    double mCorrY;
+    double mCorrHeading;
+
+    void predictRaw(double dt, double &px, double &py, double &heading) const;
+    double age(qint64 timeMs) const;
+    double correctionGain(qint64 timeMs) const;
+
+};
+
+#endif // POSEPREDICTOR_H
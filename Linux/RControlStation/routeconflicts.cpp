@@ -0,0 +1,438 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "routeconflicts.h"
+#include <QSet>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+inline quint64 segId(int route, int seg)
+{
+    return ((quint64)(quint32)route << 32) | (quint64)(quint32)seg;
+}
+
+inline int segIdRoute(quint64 id)
+{
+    return (int)(id >> 32);
+}
+
+inline int segIdSeg(quint64 id)
+{
+    return (int)(id & 0xFFFFFFFF);
+}
+
+// 21 bits for x and y and 22 bits for time. Cells that alias after
+// wrapping only give extra candidates, which are rejected by the exact check.
+inline quint64 cellKey(qint64 ix, qint64 iy, qint64 it)
+{
+    return (((quint64)ix & 0x1FFFFF) << 43) |
+            (((quint64)iy & 0x1FFFFF) << 22) |
+            ((quint64)it & 0x3FFFFF);
+}
+
+inline bool pointChanged(const LocPoint &a, const LocPoint &b)
+{
+    return a.getX() != b.getX() || a.getY() != b.getY() ||
+            a.getTime() != b.getTime();
+}
+}
+
+RouteConflicts::RouteConflicts(QObject *parent) : QObject(parent)
+{
+    mRadius = 2.0;
+    mTimeCellMs = 1000;
+    mConflictNum = 0;
+    mConflictListValid = false;
+}
+
+/**
+ * @brief RouteConflicts::updateRoute
+ * Update the points of a route and re-check it against all other routes. When
+ * the number of points is unchanged only the segments next to points that
+ * moved or got a new time are re-checked, so that dragging a point on a long
+ * route stays cheap. Otherwise the whole route is re-indexed.
+ *
+ * @param route
+ * The route index.
+ *
+ * @param points
+ * The points of the route. Segments where the time does not increase are
+ * ignored.
+ */
+void RouteConflicts::updateRoute(int route, const QList<LocPoint> &points)
+{
+    if (route < 0) {
+        return;
+    }
+
+    while (mRoutes.size() <= route) {
+        mRoutes.append(route_t());
+    }
+
+    route_t &r = mRoutes[route];
+
+    if (r.points.size() != points.size()) {
+        unindexRoute(route);
+        r.points = points;
+        indexRoute(route);
+        return;
+    }
+
+    QVector<int> dirty;
+    for (int i = 0;i < points.size();i++) {
+        if (pointChanged(r.points.at(i), points.at(i))) {
+            if (i > 0 && (dirty.isEmpty() || dirty.last() != (i - 1))) {
+                dirty.append(i - 1);
+            }
+
+            if (i < (points.size() - 1)) {
+                dirty.append(i);
+            }
+        }
+    }
+
+    if (dirty.isEmpty()) {
+        return;
+    }
+
+    for (int i = 0;i < dirty.size();i++) {
+        removeSegment(route, dirty.at(i));
+    }
+
+    r.points = points;
+
+    for (int i = 0;i < dirty.size();i++) {
+        insertSegment(route, dirty.at(i));
+    }
+}
+
+void RouteConflicts::clear()
+{
+    mRoutes.clear();
+    mCells.clear();
+    mConflicts.clear();
+    mConflictNum = 0;
+    mConflictList.clear();
+    mConflictListValid = false;
+}
+
+double RouteConflicts::getRadius() const
+{
+    return mRadius;
+}
+
+/**
+ * @brief RouteConflicts::setRadius
+ * Set the safety radius. Two cars closer than this at the same moment
+ * are reported as a conflict.
+ *
+ * @param radius
+ * The radius in meters.
+ */
+void RouteConflicts::setRadius(double radius)
+{
+    if (radius > 0.0 && radius != mRadius) {
+        mRadius = radius;
+        rebuild();
+    }
+}
+
+qint32 RouteConflicts::getTimeCellMs() const
+{
+    return mTimeCellMs;
+}
+
+void RouteConflicts::setTimeCellMs(qint32 timeCellMs)
+{
+    if (timeCellMs > 0 && timeCellMs != mTimeCellMs) {
+        mTimeCellMs = timeCellMs;
+        rebuild();
+    }
+}
+
+bool RouteConflicts::isSegmentInConflict(int route, int seg) const
+{
+    return mConflicts.contains(segId(route, seg));
+}
+
+/**
+ * @brief RouteConflicts::getConflicts
+ * Get all conflicts, each one once. The map calls this on every repaint, so
+ * the list is kept until a segment is added or removed.
+ */
+QList<RouteConflicts::conflict_t> RouteConflicts::getConflicts() const
+{
+    if (mConflictListValid) {
+        return mConflictList;
+    }
+
+    QList<conflict_t> res;
+
+    QHashIterator<quint64, QHash<quint64, conflict_t> > it(mConflicts);
+    while (it.hasNext()) {
+        it.next();
+        QHashIterator<quint64, conflict_t> it2(it.value());
+        while (it2.hasNext()) {
+            it2.next();
+            // Every conflict is stored for both segments
+            if (it.key() < it2.key()) {
+                res.append(it2.value());
+            }
+        }
+    }
+
+    mConflictList = res;
+    mConflictListValid = true;
+
+    return res;
+}
+
+int RouteConflicts::getConflictNum() const
+{
+    return mConflictNum;
+}
+
+void RouteConflicts::rebuild()
+{
+    mCells.clear();
+    mConflicts.clear();
+    mConflictNum = 0;
+    mConflictListValid = false;
+
+    for (int i = 0;i < mRoutes.size();i++) {
+        mRoutes[i].segments.clear();
+    }
+
+    for (int i = 0;i < mRoutes.size();i++) {
+        indexRoute(i);
+    }
+}
+
+void RouteConflicts::indexRoute(int route)
+{
+    route_t &r = mRoutes[route];
+    r.segments.resize(qMax(0, r.points.size() - 1));
+
+    for (int i = 0;i < r.segments.size();i++) {
+        insertSegment(route, i);
+    }
+}
+
+void RouteConflicts::unindexRoute(int route)
+{
+    route_t &r = mRoutes[route];
+
+    for (int i = 0;i < r.segments.size();i++) {
+        removeSegment(route, i);
+    }
+
+    r.segments.clear();
+}
+
+/**
+ * @brief RouteConflicts::insertSegment
+ * Add a segment to the space-time hash and check it against the segments of
+ * other routes that share a cell with it. The segment is split into pieces
+ * that are at most one time cell long and one space cell wide, and every
+ * piece covers the cells of its bounding box grown by half the radius. Two
+ * points closer than the radius at the same time therefore always end up in
+ * at least one common cell.
+ */
+void RouteConflicts::insertSegment(int route, int seg)
+{
+    route_t &r = mRoutes[route];
+    segment_t &s = r.segments[seg];
+    const LocPoint &p0 = r.points.at(seg);
+    const LocPoint &p1 = r.points.at(seg + 1);
+
+    s.x0 = p0.getX();
+    s.y0 = p0.getY();
+    s.x1 = p1.getX();
+    s.y1 = p1.getY();
+    s.t0 = p0.getTime();
+    s.t1 = p1.getTime();
+    s.cells.clear();
+
+    if (s.t1 <= s.t0) {
+        return;
+    }
+
+    const double cs = cellSize();
+    const double margin = mRadius / 2.0;
+    const double len = sqrt((s.x1 - s.x0) * (s.x1 - s.x0) + (s.y1 - s.y0) * (s.y1 - s.y0));
+    const int pieces = qMax(1, qMax((int)ceil(len / cs),
+                                    (int)ceil((double)(s.t1 - s.t0) / (double)mTimeCellMs)));
+
+    for (int k = 0;k < pieces;k++) {
+        const double f0 = (double)k / (double)pieces;
+        const double f1 = (double)(k + 1) / (double)pieces;
+        const double xa = s.x0 + (s.x1 - s.x0) * f0;
+        const double xb = s.x0 + (s.x1 - s.x0) * f1;
+        const double ya = s.y0 + (s.y1 - s.y0) * f0;
+        const double yb = s.y0 + (s.y1 - s.y0) * f1;
+        const double ta = s.t0 + (s.t1 - s.t0) * f0;
+        const double tb = s.t0 + (s.t1 - s.t0) * f1;
+
+        const qint64 ixMin = (qint64)floor((qMin(xa, xb) - margin) / cs);
+        const qint64 ixMax = (qint64)floor((qMax(xa, xb) + margin) / cs);
+        const qint64 iyMin = (qint64)floor((qMin(ya, yb) - margin) / cs);
+        const qint64 iyMax = (qint64)floor((qMax(ya, yb) + margin) / cs);
+        const qint64 itMin = (qint64)floor(ta / (double)mTimeCellMs);
+        const qint64 itMax = (qint64)floor(tb / (double)mTimeCellMs);
+
+        for (qint64 ix = ixMin;ix <= ixMax;ix++) {
+            for (qint64 iy = iyMin;iy <= iyMax;iy++) {
+                for (qint64 it = itMin;it <= itMax;it++) {
+                    s.cells.append(cellKey(ix, iy, it));
+                }
+            }
+        }
+    }
+
+    std::sort(s.cells.begin(), s.cells.end());
+    s.cells.erase(std::unique(s.cells.begin(), s.cells.end()), s.cells.end());
+
+    const quint64 id = segId(route, seg);
+    QSet<quint64> candidates;
+
+    for (int i = 0;i < s.cells.size();i++) {
+        QVector<quint64> &cell = mCells[s.cells.at(i)];
+
+        for (int j = 0;j < cell.size();j++) {
+            if (segIdRoute(cell.at(j)) != route) {
+                candidates.insert(cell.at(j));
+            }
+        }
+
+        cell.append(id);
+    }
+
+    foreach (quint64 other, candidates) {
+        const int otherRoute = segIdRoute(other);
+        const int otherSeg = segIdSeg(other);
+
+        conflict_t conf;
+        if (checkSegments(s, mRoutes.at(otherRoute).segments.at(otherSeg), conf)) {
+            conf.routeA = route;
+            conf.segA = seg;
+            conf.routeB = otherRoute;
+            conf.segB = otherSeg;
+            mConflicts[id].insert(other, conf);
+            mConflicts[other].insert(id, conf);
+            mConflictNum++;
+            mConflictListValid = false;
+        }
+    }
+}
+
+void RouteConflicts::removeSegment(int route, int seg)
+{
+    segment_t &s = mRoutes[route].segments[seg];
+    const quint64 id = segId(route, seg);
+
+    for (int i = 0;i < s.cells.size();i++) {
+        QHash<quint64, QVector<quint64> >::iterator it = mCells.find(s.cells.at(i));
+        if (it != mCells.end()) {
+            it.value().removeOne(id);
+            if (it.value().isEmpty()) {
+                mCells.erase(it);
+            }
+        }
+    }
+
+    s.cells.clear();
+
+    QHash<quint64, QHash<quint64, conflict_t> >::iterator it = mConflicts.find(id);
+    if (it != mConflicts.end()) {
+        foreach (quint64 other, it.value().keys()) {
+            QHash<quint64, QHash<quint64, conflict_t> >::iterator it2 = mConflicts.find(other);
+            if (it2 != mConflicts.end()) {
+                it2.value().remove(id);
+                if (it2.value().isEmpty()) {
+                    mConflicts.erase(it2);
+                }
+            }
+
+            mConflictNum--;
+        }
+
+        mConflictListValid = false;
+
+        mConflicts.remove(id);
+    }
+}
+
+/**
+ * @brief RouteConflicts::checkSegments
+ * Check if two segments come closer than the radius. Both cars are assumed to
+ * move with constant velocity along their segment, so the distance is a
+ * quadratic in time and the closest approach within the common time interval
+ * can be computed directly.
+ */
+bool RouteConflicts::checkSegments(const segment_t &a, const segment_t &b, conflict_t &conf)
+{
+    const qint32 t0 = qMax(a.t0, b.t0);
+    const qint32 t1 = qMin(a.t1, b.t1);
+
+    if (t1 < t0) {
+        return false;
+    }
+
+    const double avx = (a.x1 - a.x0) / (double)(a.t1 - a.t0);
+    const double avy = (a.y1 - a.y0) / (double)(a.t1 - a.t0);
+    const double bvx = (b.x1 - b.x0) / (double)(b.t1 - b.t0);
+    const double bvy = (b.y1 - b.y0) / (double)(b.t1 - b.t0);
+
+    const double ax = a.x0 + avx * (double)(t0 - a.t0);
+    const double ay = a.y0 + avy * (double)(t0 - a.t0);
+    const double bx = b.x0 + bvx * (double)(t0 - b.t0);
+    const double by = b.y0 + bvy * (double)(t0 - b.t0);
+
+    const double dx = bx - ax;
+    const double dy = by - ay;
+    const double dvx = bvx - avx;
+    const double dvy = bvy - avy;
+    const double dv2 = dvx * dvx + dvy * dvy;
+
+    double tau = 0.0;
+    if (dv2 > 1e-12) {
+        tau = -(dx * dvx + dy * dvy) / dv2;
+        tau = qBound(0.0, tau, (double)(t1 - t0));
+    }
+
+    const double cx = dx + dvx * tau;
+    const double cy = dy + dvy * tau;
+    const double dist = sqrt(cx * cx + cy * cy);
+
+    if (dist >= mRadius) {
+        return false;
+    }
+
+    conf.x = ax + avx * tau + cx / 2.0;
+    conf.y = ay + avy * tau + cy / 2.0;
+    conf.time = t0 + (qint32)tau;
+    conf.dist = dist;
+
+    return true;
+}
+
+double RouteConflicts::cellSize() const
+{
+    // Very small cells only make the hash larger without removing candidates
+    return qMax(mRadius, 0.5);
+}
@@ -0,0 +1,88 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef ROUTECONFLICTS_H
+#define ROUTECONFLICTS_H
+
+#include <QObject>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include "locpoint.h"
+
+class RouteConflicts : public QObject
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        int routeA;
+        int segA;
+        int routeB;
+        int segB;
+        double x;
+        double y;
+        qint32 time;
+        double dist;
+    } conflict_t;
+
+    explicit RouteConflicts(QObject *parent = 0);
+    void updateRoute(int route, const QList<LocPoint> &points);
+    void clear();
+    double getRadius() const;
+    void setRadius(double radius);
+    qint32 getTimeCellMs() const;
+    void setTimeCellMs(qint32 timeCellMs);
+    bool isSegmentInConflict(int route, int seg) const;
+    QList<conflict_t> getConflicts() const;
+    int getConflictNum() const;
+
+private:
+    typedef struct {
+        double x0;
+        double y0;
+        double x1;
+        double y1;
+        qint32 t0;
+        qint32 t1;
+        QVector<quint64> cells;
+    } segment_t;
+
+    typedef struct {
+        QList<LocPoint> points;
+        QVector<segment_t> segments;
+    } route_t;
+
+    double mRadius;
+    qint32 mTimeCellMs;
+    int mConflictNum;
+    QVector<route_t> mRoutes;
+    QHash<quint64, QVector<quint64> > mCells;
+    QHash<quint64, QHash<quint64, conflict_t> > mConflicts;
+    mutable QList<conflict_t> mConflictList;
+    mutable bool mConflictListValid;
+
+    void rebuild();
+    void indexRoute(int route);
+    void unindexRoute(int route);
+    void insertSegment(int route, int seg);
+    void removeSegment(int route, int seg);
+    bool checkSegments(const segment_t &a, const segment_t &b, conflict_t &conf);
+    double cellSize() const;
+
+};
+
+#endif // ROUTECONFLICTS_H
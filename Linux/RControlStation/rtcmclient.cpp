@@ -18,7 +18,9 @@
 #include "rtcmclient.h"
 #include "rtcm3_simple.h"
 #include <QDebug>
+#ifdef QT_WIDGETS_LIB
 #include <QMessageBox>
+#endif
 
 namespace {
 void rtcm_rx(uint8_t *data, int len, int type) {
@@ -77,21 +79,27 @@ void rtcm_rx_obs(rtcm_obs_header_t *header, rtcm_obs_t *obs, int obs_num) {
 // Static member initialization
 RtcmClient *RtcmClient::currentMsgHandler = 0;
 bool RtcmClient::gpsOnly = false;
-rtcm3_state RtcmClient::rtcmState;
 
 RtcmClient::RtcmClient(QObject *parent) : QObject(parent)
 {
     mTcpSocket = new QTcpSocket(this);
     mSerialPort = new QSerialPort(this);
+    mTcpPort = 80;
+    mAutoReconnect = false;
+    mReconnectTimer = new QTimer(this);
+    mReconnectTimer->setInterval(5000);
 
     qRegisterMetaType<rtcm_obs_header_t>("rtcm_obs_header_t");
     qRegisterMetaType<rtcm_obs_t>("rtcm_obs_gps_t");
 
+    // Each client has its own decoder, so that several clients can be used
+    // at the same time. The callbacks go to currentMsgHandler, which is set
+    // before data is decoded.
     currentMsgHandler = this;
-    rtcm3_init_state(&rtcmState);
-    rtcm3_set_rx_callback(rtcm_rx, &rtcmState);
-    rtcm3_set_rx_callback_1005_1006(rtcm_rx_1006, &rtcmState);
-    rtcm3_set_rx_callback_obs(rtcm_rx_obs, &rtcmState);
+    rtcm3_init_state(&mRtcmState);
+    rtcm3_set_rx_callback(rtcm_rx, &mRtcmState);
+    rtcm3_set_rx_callback_1005_1006(rtcm_rx_1006, &mRtcmState);
+    rtcm3_set_rx_callback_obs(rtcm_rx_obs, &mRtcmState);
 
     connect(mTcpSocket, SIGNAL(readyRead()), this, SLOT(tcpInputDataAvailable()));
     connect(mTcpSocket, SIGNAL(connected()), this, SLOT(tcpInputConnected()));
@@ -102,6 +110,7 @@ RtcmClient::RtcmClient(QObject *parent) : QObject(parent)
     connect(mSerialPort, SIGNAL(readyRead()), this, SLOT(serialDataAvailable()));
     connect(mSerialPort, SIGNAL(error(QSerialPort::SerialPortError)),
             this, SLOT(serialPortError(QSerialPort::SerialPortError)));
+    connect(mReconnectTimer, SIGNAL(timeout()), this, SLOT(reconnectTimerSlot()));
 }
 
 bool RtcmClient::connectNtrip(QString server, QString stream, QString user, QString pass, int port)
@@ -110,7 +119,10 @@ bool RtcmClient::connectNtrip(QString server, QString stream, QString user, QStr
     mNtripPassword = pass;
     mNtripStream = stream;
     mNtripServer = server;
+    mTcpHost = server;
+    mTcpPort = port;
 
+    mTcpRxTime.start();
     mTcpSocket->abort();
     mTcpSocket->connectToHost(server, port);
 
@@ -123,7 +135,10 @@ bool RtcmClient::connectTcp(QString server, int port)
     mNtripPassword = "";
     mNtripStream = "";
     mNtripServer = "";
+    mTcpHost = server;
+    mTcpPort = port;
 
+    mTcpRxTime.start();
     mTcpSocket->abort();
     mTcpSocket->connectToHost(server, port);
 
@@ -165,6 +180,7 @@ bool RtcmClient::isSerialConnected()
 
 void RtcmClient::disconnectTcpNtrip()
 {
+    mTcpHost.clear();
     mTcpSocket->close();
 }
 
@@ -178,6 +194,23 @@ void RtcmClient::setGpsOnly(bool isGpsOnly)
     gpsOnly = isGpsOnly;
 }
 
+/**
+ * @brief RtcmClient::setAutoReconnect
+ * Reconnect the TCP/NTRIP connection when it is lost, fails or stops
+ * delivering data, until disconnectTcpNtrip is called. Errors are then only
+ * logged, not shown in message boxes.
+ */
+void RtcmClient::setAutoReconnect(bool reconnect)
+{
+    mAutoReconnect = reconnect;
+
+    if (reconnect) {
+        mReconnectTimer->start();
+    } else {
+        mReconnectTimer->stop();
+    }
+}
+
 void RtcmClient::emitRtcmReceived(QByteArray data, int type, bool sync)
 {
     emit rtcmReceived(data, type, sync);
@@ -209,6 +242,7 @@ QByteArray RtcmClient::encodeBasePos(double lat, double lon, double height, doub
 void RtcmClient::tcpInputConnected()
 {
     qDebug() << "RTCM TCP connected";
+    mTcpRxTime.restart();
 
     // If no stream is selected we have simply connected to a TCP server.
     if (mNtripStream.size() > 0) {
@@ -238,13 +272,8 @@ void RtcmClient::tcpInputDisconnected()
 void RtcmClient::tcpInputDataAvailable()
 {
     QByteArray data =  mTcpSocket->readAll();
-
-    for (int i = 0;i < data.size();i++) {
-        int ret = rtcm3_input_data(data.at(i), &rtcmState);
-        if (ret == -1 || ret == -2) {
-            //qWarning() << "RTCM decode error:" <<  ret;
-        }
-    }
+    mTcpRxTime.restart();
+    inputData(data);
 }
 
 void RtcmClient::tcpInputError(QAbstractSocket::SocketError socketError)
@@ -253,7 +282,11 @@ void RtcmClient::tcpInputError(QAbstractSocket::SocketError socketError)
 
     QString errorStr = mTcpSocket->errorString();
     qWarning() << "RTCM TCP Error:" << errorStr;
-    QMessageBox::warning(0, "RTCM TCP Error", errorStr);
+#ifdef QT_WIDGETS_LIB
+    if (!mAutoReconnect) {
+        QMessageBox::warning(0, "RTCM TCP Error", errorStr);
+    }
+#endif
 
     mTcpSocket->close();
 }
@@ -262,13 +295,7 @@ void RtcmClient::serialDataAvailable()
 {
     while (mSerialPort->bytesAvailable() > 0) {
         QByteArray data = mSerialPort->readAll();
-
-        for (int i = 0;i < data.size();i++) {
-            int ret = rtcm3_input_data(data.at(i), &rtcmState);
-            if (ret == -1 || ret == -2) {
-                //qWarning() << "RTCM decode error:" <<  ret;
-            }
-        }
+        inputData(data);
     }
 }
 
@@ -310,3 +337,33 @@ void RtcmClient::serialPortError(QSerialPort::SerialPortError error)
     }
 }
 
+void RtcmClient::reconnectTimerSlot()
+{
+    if (mTcpHost.isEmpty()) {
+        return;
+    }
+
+    if (mTcpSocket->state() == QAbstractSocket::UnconnectedState) {
+        qDebug() << "RTCM TCP reconnecting to" << mTcpHost << mTcpPort;
+        mTcpRxTime.restart();
+        mTcpSocket->connectToHost(mTcpHost, mTcpPort);
+    } else if (mTcpSocket->state() == QAbstractSocket::ConnectedState &&
+               mTcpRxTime.elapsed() > mTcpStallMs) {
+        qWarning() << "RTCM TCP stalled, reconnecting to" << mTcpHost << mTcpPort;
+        mTcpSocket->abort();
+        mTcpRxTime.restart();
+        mTcpSocket->connectToHost(mTcpHost, mTcpPort);
+    }
+}
+
+void RtcmClient::inputData(const QByteArray &data)
+{
+    currentMsgHandler = this;
+
+    for (int i = 0;i < data.size();i++) {
+        int ret = rtcm3_input_data(data.at(i), &mRtcmState);
+        if (ret == -1 || ret == -2) {
+            //qWarning() << "RTCM decode error:" <<  ret;
+        }
+    }
+}
@@ -21,6 +21,8 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QSerialPort>
+#include <QTimer>
+#include <QElapsedTimer>
 #include "datatypes.h"
 
 class RtcmClient : public QObject
@@ -29,7 +31,6 @@ class RtcmClient : public QObject
 public:
     static RtcmClient* currentMsgHandler;
     static bool gpsOnly;
-    static rtcm3_state rtcmState;
 
     explicit RtcmClient(QObject *parent = 0);
     bool connectNtrip(QString server, QString stream, QString user = "", QString pass = "", int port = 80);
@@ -40,6 +41,7 @@ public:
     void disconnectTcpNtrip();
     void disconnectSerial();
     void setGpsOnly(bool isGpsOnly);
+    void setAutoReconnect(bool reconnect);
 
     void emitRtcmReceived(QByteArray data, int type, bool sync = false);
     void emitRefPosReceived(double lat, double lon, double height, double antenna_height);
@@ -57,14 +59,26 @@ private slots:
     void tcpInputError(QAbstractSocket::SocketError socketError);
     void serialDataAvailable();
     void serialPortError(QSerialPort::SerialPortError error);
+    void reconnectTimerSlot();
 
 private:
     QString mNtripUser;
     QString mNtripPassword;
     QString mNtripServer;
     QString mNtripStream;
+    QString mTcpHost;
+    int mTcpPort;
     QTcpSocket *mTcpSocket;
     QSerialPort *mSerialPort;
+    rtcm3_state mRtcmState;
+    bool mAutoReconnect;
+    QTimer *mReconnectTimer;
+    QElapsedTimer mTcpRxTime;
+
+    // A connection that delivers nothing for this long is reconnected
+    static const int mTcpStallMs = 30000;
+
+    void inputData(const QByteArray &data);
 
 };
 
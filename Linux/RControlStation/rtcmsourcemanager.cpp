@@ -0,0 +1,624 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "rtcmsourcemanager.h"
+#include <QDebug>
+#include <QDateTime>
+#include <cmath>
+
+namespace {
+// Health limits
+const double minCompleteness = 0.75;
+const int minEpochsForCompleteness = 5;
+const qint64 refPosMaxAgeMs = 120000;
+const double refPosMaxJump = 1.0;
+const qint64 inconsistentHoldMs = 60000;
+// A higher priority source must be healthy this long before switching back
+const qint64 returnHoldoffMs = 10000;
+// An epoch without the final message is closed after this long
+const qint64 epochTimeoutMs = 1000;
+const double completenessAlpha = 0.1;
+// The duplicate epoch check is skipped after this long without output
+const qint64 lastOutValidMs = 10000;
+const qint64 msPerWeek = 604800000;
+
+unsigned int getbitu(const unsigned char *buff, int pos, int len)
+{
+    unsigned int bits = 0;
+    for (int i = pos;i < pos + len;i++) {
+        bits = (bits << 1) + ((buff[i / 8] >> (7 - i % 8)) & 1u);
+    }
+    return bits;
+}
+
+// CRC-24Q of RTCM3 frames, bitwise to not need the table of rtcm3_simple.c
+unsigned int crc24q(const unsigned char *buff, int len)
+{
+    unsigned int crc = 0;
+
+    for (int i = 0;i < len;i++) {
+        crc ^= (unsigned int)buff[i] << 16;
+        for (int j = 0;j < 8;j++) {
+            crc <<= 1;
+            if (crc & 0x1000000) {
+                crc ^= 0x1864CFB;
+            }
+        }
+    }
+
+    return crc & 0xFFFFFF;
+}
+
+// 38 bit two's complement, as in the ECEF coordinates of 1005/1006
+double getbits38(const unsigned char *buff, int pos)
+{
+    return (double)(int)getbitu(buff, pos, 32) * 64.0 + (double)getbitu(buff, pos + 32, 6);
+}
+
+// GNSS index of an observation message, or -1 for other messages
+int obsSystem(int type)
+{
+    if (type >= 1001 && type <= 1004) {
+        return 0;
+    } else if (type >= 1009 && type <= 1012) {
+        return 1;
+    } else if (type >= 1071 && type <= 1127 && ((type - 1071) % 10) <= 6) {
+        return (type - 1071) / 10;
+    }
+
+    return -1;
+}
+
+bool towAfter(qint64 a, qint64 b)
+{
+    qint64 d = a - b;
+
+    if (d < -msPerWeek / 2) {
+        d += msPerWeek;
+    } else if (d > msPerWeek / 2) {
+        d -= msPerWeek;
+    }
+
+    return d > 0;
+}
+}
+
+RtcmSourceManager::RtcmSourceManager(QObject *parent) : QObject(parent)
+{
+    mTimer = new QTimer(this);
+    mTimer->start(100);
+    mClock.start();
+    mActive = -1;
+    mPending = -1;
+    mNoSourceReported = false;
+    mForwardRefPos = true;
+    mMaxPacketSize = 1000;
+    mMaxObsAgeMs = 3000;
+    mLastOutTowMs = -1;
+    mLastOutMs = -lastOutValidMs;
+
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(timerSlot()));
+}
+
+/**
+ * @brief RtcmSourceManager::addSource
+ * Add a correction source. Sources added first have higher priority.
+ *
+ * @param name
+ * Name for status and logs.
+ *
+ * @param type
+ * The kind of source.
+ *
+ * @param emitter
+ * Optional object that emits the RTCM data of the source. Its signal must
+ * have a QByteArray with complete RTCM3 frames as the first argument, e.g.
+ * SIGNAL(rtcmReceived(QByteArray,int,bool)) of RtcmClient. Without an
+ * emitter the data is given to rtcmInput.
+ *
+ * @return
+ * The index of the source.
+ */
+int RtcmSourceManager::addSource(QString name, RTCM_SOURCE_TYPE type, QObject *emitter, const char *signal)
+{
+    source_t s;
+    s.name = name;
+    s.type = type;
+    s.emitter = emitter;
+    s.lastObsMs = -1;
+    s.lastRefPosMs = -1;
+    s.obsStaId = -1;
+    s.refStaId = -1;
+    s.refPos[0] = 0.0;
+    s.refPos[1] = 0.0;
+    s.refPos[2] = 0.0;
+    s.inconsistentUntilMs = -1;
+    s.epochSystems = 0;
+    s.epochStartMs = 0;
+    s.epochGpsTowMs = -1;
+    s.completeness = 1.0;
+    s.epochs = 0;
+    s.healthySinceMs = -1;
+    s.problem = "no observations";
+    mSources.append(s);
+
+    if (emitter && signal) {
+        connect(emitter, signal, this, SLOT(rtcmRx(QByteArray)));
+    }
+
+    return mSources.size() - 1;
+}
+
+int RtcmSourceManager::sourceNum() const
+{
+    return mSources.size();
+}
+
+QString RtcmSourceManager::sourceName(int source) const
+{
+    if (source < 0 || source >= mSources.size()) {
+        return "None";
+    }
+
+    return mSources.at(source).name;
+}
+
+void RtcmSourceManager::setSourceType(int source, RTCM_SOURCE_TYPE type)
+{
+    if (source >= 0 && source < mSources.size()) {
+        mSources[source].type = type;
+    }
+}
+
+int RtcmSourceManager::activeSource() const
+{
+    return mActive;
+}
+
+bool RtcmSourceManager::isHealthy(int source) const
+{
+    QString problem;
+    return checkHealth(source, mClock.elapsed(), problem);
+}
+
+/**
+ * @brief RtcmSourceManager::statusText
+ * One line per source with its health.
+ */
+QString RtcmSourceManager::statusText() const
+{
+    QString str;
+    const qint64 now = mClock.elapsed();
+
+    for (int i = 0;i < mSources.size();i++) {
+        const source_t &s = mSources.at(i);
+
+        str += i == mActive ? "* " : "  ";
+        str += s.name + " (" + typeName(s.type) + "): ";
+
+        if (s.lastObsMs >= 0) {
+            str += QString().sprintf("age %.1f s, complete %.0f %%, station %d",
+                                     (double)(now - s.lastObsMs) / 1000.0,
+                                     s.completeness * 100.0, s.obsStaId);
+        }
+
+        if (s.healthySinceMs < 0) {
+            str += (s.lastObsMs >= 0 ? ", " : "") + s.problem;
+        }
+
+        str += "\n";
+    }
+
+    return str.trimmed();
+}
+
+QList<RtcmSourceManager::switch_event_t> RtcmSourceManager::switchEvents() const
+{
+    return mEvents;
+}
+
+/**
+ * @brief RtcmSourceManager::setForwardRefPos
+ * Forward the reference position (1005/1006) of the active source. When the
+ * reference position is sent from elsewhere this should be off, and sources
+ * are then not required to send one.
+ */
+void RtcmSourceManager::setForwardRefPos(bool forward)
+{
+    mForwardRefPos = forward;
+}
+
+void RtcmSourceManager::setMaxPacketSize(int size)
+{
+    mMaxPacketSize = size;
+}
+
+void RtcmSourceManager::setMaxObsAge(int ms)
+{
+    mMaxObsAgeMs = ms;
+}
+
+QString RtcmSourceManager::typeName(RTCM_SOURCE_TYPE type)
+{
+    switch (type) {
+    case RTCM_SOURCE_NTRIP: return "NTRIP";
+    case RTCM_SOURCE_SERIAL: return "Serial";
+    case RTCM_SOURCE_LOCAL_BASE: return "Local base";
+    case RTCM_SOURCE_TCP: return "TCP";
+    default: return "Unknown";
+    }
+}
+
+/**
+ * @brief RtcmSourceManager::rtcmInput
+ * Give RTCM3 data from a source. Frames may be split between calls. Frames
+ * with a bad CRC are dropped, and the search for the next frame continues
+ * after their preamble.
+ */
+void RtcmSourceManager::rtcmInput(int source, const QByteArray &data)
+{
+    if (source < 0 || source >= mSources.size()) {
+        return;
+    }
+
+    QByteArray &buf = mSources[source].rxBuffer;
+    buf.append(data);
+
+    while (!buf.isEmpty()) {
+        int start = buf.indexOf((char)0xD3);
+        if (start < 0) {
+            buf.clear();
+            break;
+        } else if (start > 0) {
+            buf.remove(0, start);
+        }
+
+        if (buf.size() < 3) {
+            break;
+        }
+
+        // The six bits before the length are reserved and zero
+        if ((quint8)buf.at(1) & 0xFC) {
+            buf.remove(0, 1);
+            continue;
+        }
+
+        int len = (((quint8)buf.at(1) & 0x03) << 8) | (quint8)buf.at(2);
+        if (buf.size() < len + 6) {
+            break;
+        }
+
+        const unsigned char *p = (const unsigned char*)buf.constData();
+        unsigned int crc = ((unsigned int)p[len + 3] << 16) |
+                ((unsigned int)p[len + 4] << 8) | (unsigned int)p[len + 5];
+
+        if (crc24q(p, len + 3) != crc) {
+            buf.remove(0, 1);
+            continue;
+        }
+
+        QByteArray frame = buf.left(len + 6);
+        buf.remove(0, len + 6);
+        processFrame(source, frame);
+    }
+}
+
+void RtcmSourceManager::rtcmRx(QByteArray data)
+{
+    for (int i = 0;i < mSources.size();i++) {
+        if (mSources.at(i).emitter == sender()) {
+            rtcmInput(i, data);
+            break;
+        }
+    }
+}
+
+void RtcmSourceManager::timerSlot()
+{
+    const qint64 now = mClock.elapsed();
+    int best = -1;
+
+    for (int i = 0;i < mSources.size();i++) {
+        source_t &s = mSources[i];
+
+        if (s.epochSystems && (now - s.epochStartMs) > epochTimeoutMs) {
+            closeEpoch(i, false);
+        }
+
+        QString problem;
+        if (checkHealth(i, now, problem)) {
+            if (s.healthySinceMs < 0) {
+                s.healthySinceMs = now;
+            }
+
+            if (best < 0) {
+                best = i;
+            }
+        } else {
+            s.healthySinceMs = -1;
+            s.problem = problem;
+        }
+    }
+
+    if (best < 0) {
+        if (!mNoSourceReported && !mSources.isEmpty()) {
+            qWarning() << "RTCM: no healthy correction source";
+            mNoSourceReported = true;
+        }
+
+        // Stop forwarding, the rover is better off without corrections
+        // than with stale or inconsistent ones
+        if (mActive >= 0) {
+            switchTo(-1, mSources.at(mActive).name + ": " + mSources.at(mActive).problem);
+        }
+        return;
+    }
+
+    mNoSourceReported = false;
+
+    if (mActive < 0) {
+        switchTo(best, "first healthy source");
+    } else if (mSources.at(mActive).healthySinceMs < 0) {
+        // The active source failed, so switch right away. Its partial
+        // epoch is dropped.
+        switchTo(best, mSources.at(mActive).name + ": " + mSources.at(mActive).problem);
+    } else if (best < mActive && (now - mSources.at(best).healthySinceMs) >= returnHoldoffMs) {
+        // Wait for the end of the current epoch
+        mPending = best;
+        mPendingReason = "higher priority source healthy for " +
+                QString::number(returnHoldoffMs / 1000) + " s";
+
+        if (!mSources.at(mActive).epochSystems) {
+            switchTo(mPending, mPendingReason);
+        }
+    }
+}
+
+void RtcmSourceManager::processFrame(int source, const QByteArray &frame)
+{
+    source_t &s = mSources[source];
+    const unsigned char *p = (const unsigned char*)frame.constData();
+    const int bits = (frame.size() - 3) * 8;
+    const qint64 now = mClock.elapsed();
+
+    if (bits < 48) {
+        return;
+    }
+
+    const int type = getbitu(p, 24, 12);
+    const int staid = getbitu(p, 36, 12);
+    const int sys = obsSystem(type);
+
+    if (sys >= 0) {
+        // GLONASS legacy messages have a 27 bit time, the others 30 bits
+        const int syncPos = (type >= 1009 && type <= 1012) ? 75 : 78;
+
+        if (bits <= syncPos) {
+            return;
+        }
+
+        const bool sync = getbitu(p, syncPos, 1);
+
+        // Same system again means that the last epoch never ended
+        if ((s.epochSystems & (1 << sys)) ||
+                (s.epochBuffer.size() + frame.size()) > mMaxEpochBytes) {
+            closeEpoch(source, false);
+        }
+
+        if (!s.epochSystems) {
+            s.epochStartMs = now;
+            s.epochGpsTowMs = -1;
+        }
+
+        s.epochSystems |= 1 << sys;
+        s.epochBuffer.append(frame);
+        s.obsStaId = staid;
+        s.lastObsMs = now;
+
+        if (sys == 0) {
+            s.epochGpsTowMs = getbitu(p, 48, 30);
+        }
+
+        if (!sync) {
+            closeEpoch(source, true);
+        }
+    } else if (type == 1005 || type == 1006) {
+        if (bits < 176) {
+            return;
+        }
+
+        double pos[3];
+        pos[0] = getbits38(p, 58) * 0.0001;
+        pos[1] = getbits38(p, 98) * 0.0001;
+        pos[2] = getbits38(p, 138) * 0.0001;
+
+        if (s.refStaId == staid && s.lastRefPosMs >= 0) {
+            double dx = pos[0] - s.refPos[0];
+            double dy = pos[1] - s.refPos[1];
+            double dz = pos[2] - s.refPos[2];
+
+            if (sqrt(dx * dx + dy * dy + dz * dz) > refPosMaxJump) {
+                qWarning() << "RTCM:" << s.name << "reference position of station"
+                           << staid << "moved";
+                s.inconsistentUntilMs = now + inconsistentHoldMs;
+            }
+        }
+
+        s.refStaId = staid;
+        s.refPos[0] = pos[0];
+        s.refPos[1] = pos[1];
+        s.refPos[2] = pos[2];
+        s.lastRefPosMs = now;
+        s.refPosFrame = frame;
+
+        if (source == mActive && mForwardRefPos) {
+            sendPackets(frame);
+        }
+    } else if (source == mActive) {
+        sendPackets(frame);
+    }
+}
+
+void RtcmSourceManager::closeEpoch(int source, bool complete)
+{
+    source_t &s = mSources[source];
+
+    if (!s.epochSystems) {
+        return;
+    }
+
+    s.epochs++;
+    s.completeness += completenessAlpha * ((complete ? 1.0 : 0.0) - s.completeness);
+
+    if (source == mActive) {
+        forwardEpoch(s);
+    }
+
+    s.epochBuffer.clear();
+    s.epochSystems = 0;
+
+    if (source == mActive && mPending >= 0) {
+        switchTo(mPending, mPendingReason);
+    }
+}
+
+void RtcmSourceManager::forwardEpoch(source_t &s)
+{
+    const qint64 now = mClock.elapsed();
+
+    if (s.epochGpsTowMs >= 0) {
+        if (mLastOutTowMs >= 0 && (now - mLastOutMs) < lastOutValidMs &&
+                !towAfter(s.epochGpsTowMs, mLastOutTowMs)) {
+            // Already sent from the previous source
+            return;
+        }
+
+        mLastOutTowMs = s.epochGpsTowMs;
+    }
+
+    mLastOutMs = now;
+    sendPackets(s.epochBuffer);
+}
+
+void RtcmSourceManager::switchTo(int source, QString reason)
+{
+    const int from = mActive;
+    mPending = -1;
+
+    if (source == from) {
+        return;
+    }
+
+    if (from >= 0) {
+        mSources[from].epochBuffer.clear();
+        mSources[from].epochSystems = 0;
+    }
+
+    mActive = source;
+
+    switch_event_t e;
+    e.time = QDateTime::currentMSecsSinceEpoch();
+    e.from = from;
+    e.to = source;
+    e.reason = reason;
+    mEvents.append(e);
+
+    while (mEvents.size() > mMaxEvents) {
+        mEvents.removeFirst();
+    }
+
+    qDebug() << "RTCM source switched from" << sourceName(from) << "to"
+             << sourceName(source) << "-" << reason;
+
+    // The rover should know the new reference station before its first epoch
+    if (mForwardRefPos && source >= 0 && !mSources.at(source).refPosFrame.isEmpty()) {
+        sendPackets(mSources.at(source).refPosFrame);
+    }
+
+    emit sourceSwitched(from, source, reason);
+}
+
+// Send frames in packets of at most mMaxPacketSize bytes. Frames are not
+// split, so a frame larger than that is sent alone.
+void RtcmSourceManager::sendPackets(const QByteArray &data)
+{
+    QByteArray packet;
+    int ind = 0;
+
+    while ((ind + 3) <= data.size()) {
+        int len = ((((quint8)data.at(ind + 1) & 0x03) << 8) | (quint8)data.at(ind + 2)) + 6;
+
+        if (!packet.isEmpty() && (packet.size() + len) > mMaxPacketSize) {
+            emit rtcmOut(packet);
+            packet.clear();
+        }
+
+        packet.append(data.mid(ind, len));
+        ind += len;
+    }
+
+    if (!packet.isEmpty()) {
+        emit rtcmOut(packet);
+    }
+}
+
+bool RtcmSourceManager::checkHealth(int source, qint64 now, QString &problem) const
+{
+    if (source < 0 || source >= mSources.size()) {
+        problem = "no such source";
+        return false;
+    }
+
+    const source_t &s = mSources.at(source);
+
+    if (s.lastObsMs < 0) {
+        problem = "no observations";
+        return false;
+    }
+
+    if ((now - s.lastObsMs) > mMaxObsAgeMs) {
+        problem = QString().sprintf("no observations for %.1f s",
+                                    (double)(now - s.lastObsMs) / 1000.0);
+        return false;
+    }
+
+    if (s.epochs >= minEpochsForCompleteness && s.completeness < minCompleteness) {
+        problem = QString().sprintf("incomplete epochs (%.0f %% complete)",
+                                    s.completeness * 100.0);
+        return false;
+    }
+
+    if (mForwardRefPos) {
+        if (s.lastRefPosMs < 0 || (now - s.lastRefPosMs) > refPosMaxAgeMs) {
+            problem = "no reference position";
+            return false;
+        }
+
+        if (s.obsStaId != s.refStaId) {
+            problem = QString().sprintf("station id %d in observations but %d in reference position",
+                                        s.obsStaId, s.refStaId);
+            return false;
+        }
+
+        if (s.inconsistentUntilMs >= 0 && now < s.inconsistentUntilMs) {
+            problem = "reference position moved";
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,135 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef RTCMSOURCEMANAGER_H
+#define RTCMSOURCEMANAGER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QList>
+#include <QVector>
+#include <QElapsedTimer>
+
+// Selects one of several RTCM3 correction sources and forwards only that
+// one, so that vehicles never get a mix of reference stations.
+//
+// Every source is checked for the age of its observations, the share of
+// epochs that arrive complete (the multiple message bit chain ends) and that
+// the station id of the observations matches a recent, stable reference
+// position. The first added source has the highest priority. When the active
+// source gets unhealthy the manager switches to the healthy source with the
+// highest priority, and it switches back once a higher priority source has
+// been healthy for a while. When no source is healthy nothing is forwarded.
+//
+// Observations are forwarded one whole epoch at a time, and switches only
+// happen between epochs. After a switch the reference position of the new
+// source is sent first, and epochs that are not newer than the last
+// forwarded one are dropped.
+class RtcmSourceManager : public QObject
+{
+    Q_OBJECT
+public:
+    typedef enum {
+        RTCM_SOURCE_NTRIP = 0,
+        RTCM_SOURCE_SERIAL,
+        RTCM_SOURCE_LOCAL_BASE,
+        RTCM_SOURCE_TCP
+    } RTCM_SOURCE_TYPE;
+
+    typedef struct {
+        qint64 time; // ms since 1970
+        int from;
+        int to;
+        QString reason;
+    } switch_event_t;
+
+    explicit RtcmSourceManager(QObject *parent = 0);
+    int addSource(QString name, RTCM_SOURCE_TYPE type, QObject *emitter = 0, const char *signal = 0);
+    int sourceNum() const;
+    QString sourceName(int source) const;
+    void setSourceType(int source, RTCM_SOURCE_TYPE type);
+    int activeSource() const;
+    bool isHealthy(int source) const;
+    QString statusText() const;
+    QList<switch_event_t> switchEvents() const;
+    void setForwardRefPos(bool forward);
+    void setMaxPacketSize(int size);
+    void setMaxObsAge(int ms);
+
+    static QString typeName(RTCM_SOURCE_TYPE type);
+
+signals:
+    void rtcmOut(QByteArray data);
+    void sourceSwitched(int from, int to, QString reason);
+
+public slots:
+    void rtcmInput(int source, const QByteArray &data);
+
+private slots:
+    void rtcmRx(QByteArray data);
+    void timerSlot();
+
+private:
+    typedef struct {
+        QString name;
+        RTCM_SOURCE_TYPE type;
+        QObject *emitter;
+        QByteArray rxBuffer;
+        qint64 lastObsMs;
+        qint64 lastRefPosMs;
+        int obsStaId;
+        int refStaId;
+        double refPos[3];
+        qint64 inconsistentUntilMs;
+        QByteArray refPosFrame;
+        QByteArray epochBuffer;
+        int epochSystems;
+        qint64 epochStartMs;
+        qint64 epochGpsTowMs;
+        double completeness;
+        int epochs;
+        qint64 healthySinceMs;
+        QString problem;
+    } source_t;
+
+    QVector<source_t> mSources;
+    QList<switch_event_t> mEvents;
+    QTimer *mTimer;
+    QElapsedTimer mClock;
+    int mActive;
+    int mPending;
+    QString mPendingReason;
+    bool mNoSourceReported;
+    bool mForwardRefPos;
+    int mMaxPacketSize;
+    int mMaxObsAgeMs;
+    qint64 mLastOutTowMs;
+    qint64 mLastOutMs;
+
+    static const int mMaxEpochBytes = 4096;
+    static const int mMaxEvents = 100;
+
+    void processFrame(int source, const QByteArray &frame);
+    void closeEpoch(int source, bool complete);
+    void forwardEpoch(source_t &s);
+    void switchTo(int source, QString reason);
+    void sendPackets(const QByteArray &data);
+    bool checkHealth(int source, qint64 now, QString &problem) const;
+
+};
+
+#endif // RTCMSOURCEMANAGER_H
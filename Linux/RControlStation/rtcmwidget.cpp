@@ -19,6 +19,7 @@
 #include "ui_rtcmwidget.h"
 #include <QSerialPortInfo>
 #include <QMessageBox>
+#include <QDateTime>
 #include "utility.h"
 
 RtcmWidget::RtcmWidget(QWidget *parent) :
@@ -27,20 +28,40 @@ RtcmWidget::RtcmWidget(QWidget *parent) :
 {
     ui->setupUi(this);
     mRtcm = new RtcmClient(this);
+    mRtcmSerial = new RtcmClient(this);
+    mSources = new RtcmSourceManager(this);
     mTimer = new QTimer(this);
     mTimer->start(20);
     mTcpServer = new TcpBroadcast(this);
 
+    // The sources in priority order
+    mNetworkSource = mSources->addSource("Network", RtcmSourceManager::RTCM_SOURCE_NTRIP,
+                                         mRtcm, SIGNAL(rtcmReceived(QByteArray,int,bool)));
+    mSources->addSource("Serial", RtcmSourceManager::RTCM_SOURCE_SERIAL,
+                        mRtcmSerial, SIGNAL(rtcmReceived(QByteArray,int,bool)));
+    mLocalBaseSource = mSources->addSource("Base station",
+                                           RtcmSourceManager::RTCM_SOURCE_LOCAL_BASE);
+
     connect(mRtcm, SIGNAL(rtcmReceived(QByteArray,int,bool)),
             this, SLOT(rtcmRx(QByteArray,int,bool)));
     connect(mRtcm, SIGNAL(refPosReceived(double,double,double,double)),
             this, SLOT(refPosRx(double,double,double,double)));
+    connect(mRtcmSerial, SIGNAL(rtcmReceived(QByteArray,int,bool)),
+            this, SLOT(rtcmRx(QByteArray,int,bool)));
+    connect(mRtcmSerial, SIGNAL(refPosReceived(double,double,double,double)),
+            this, SLOT(refPosRx(double,double,double,double)));
+    connect(mSources, SIGNAL(rtcmOut(QByteArray)),
+            this, SLOT(sourcesRtcmOut(QByteArray)));
+    connect(mSources, SIGNAL(sourceSwitched(int,int,QString)),
+            this, SLOT(sourceSwitched(int,int,QString)));
     connect(mTimer, SIGNAL(timeout()),
             this, SLOT(timerSlot()));
 
     on_rtcmSerialRefreshButton_clicked();
     on_ntripBox_toggled(ui->ntripBox->isChecked());
     on_gpsOnlyBox_toggled(ui->gpsOnlyBox->isChecked());
+    on_ntripReconnectBox_toggled(ui->ntripReconnectBox->isChecked());
+    on_sendRefPosBox_toggled(ui->sendRefPosBox->isChecked());
 
     // SPT00 default
     ui->refSendLatBox->setValue(57.71495867);
@@ -74,6 +95,16 @@ void RtcmWidget::setRefPos(double lat, double lon, double height, double antenna
     ui->refSendAntHBox->setValue(antenna_height);
 }
 
+/**
+ * @brief RtcmWidget::localBaseRtcm
+ * RTCM from the local base station. It is used when the network and serial
+ * sources are not healthy.
+ */
+void RtcmWidget::localBaseRtcm(QByteArray data)
+{
+    mSources->rtcmInput(mLocalBaseSource, data);
+}
+
 void RtcmWidget::timerSlot()
 {
     // Update ntrip connected label
@@ -90,8 +121,8 @@ void RtcmWidget::timerSlot()
 
     // Update serial connected label
     static bool wasSerialConnected = false;
-    if (wasSerialConnected != mRtcm->isSerialConnected()) {
-        wasSerialConnected = mRtcm->isSerialConnected();
+    if (wasSerialConnected != mRtcmSerial->isSerialConnected()) {
+        wasSerialConnected = mRtcmSerial->isSerialConnected();
 
         if (wasSerialConnected) {
             ui->rtcmSerialConnectedLabel->setText("Connected");
@@ -116,10 +147,23 @@ void RtcmWidget::timerSlot()
             mTcpServer->broadcastData(data);
         }
     }
+
+    // Update source status
+    static int statusCnt = 0;
+    statusCnt++;
+    if (statusCnt >= (500 / mTimer->interval())) {
+        statusCnt = 0;
+        ui->sourceStatusLabel->setText(mSources->statusText());
+    }
 }
 
 void RtcmWidget::rtcmRx(QByteArray data, int type, bool sync)
 {
+    (void)data;
+    (void)sync;
+
+    // Only the counters are updated here. RtcmSourceManager selects what
+    // is forwarded.
     switch (type) {
     case 1001: ui->rtcm1001Number->display(ui->rtcm1001Number->value() + 1); break;
     case 1002: ui->rtcm1002Number->display(ui->rtcm1002Number->value() + 1); break;
@@ -139,32 +183,6 @@ void RtcmWidget::rtcmRx(QByteArray data, int type, bool sync)
     default:
         break;
     }
-
-    // Put messages from the same epoch together unless they are too large. This is
-    // because packets can get lost and rtklib seems to behave better when not only
-    // getting half of the observations from the same epoch. Also make sure to not
-    // send too large packets.
-
-    bool tooLarge = false;
-
-    if ((mRtcmBuffer.size() + data.size()) < 1000) {
-        mRtcmBuffer.append(data);
-    } else {
-        tooLarge = true;
-    }
-
-    if (!sync || tooLarge) {
-        if (!ui->sendRefPosBox->isChecked() || (type != 1005 && type != 1006)) {
-            emit rtcmReceived(mRtcmBuffer);
-            mTcpServer->broadcastData(mRtcmBuffer);
-            mRtcmBuffer.clear();
-
-            if (tooLarge) {
-                emit rtcmReceived(data);
-                mTcpServer->broadcastData(data);
-            }
-        }
-    }
 }
 
 void RtcmWidget::refPosRx(double lat, double lon, double height, double antenna_height)
@@ -178,8 +196,25 @@ void RtcmWidget::refPosRx(double lat, double lon, double height, double antenna_
     ui->lastRefPosLablel->setText(str);
 }
 
+void RtcmWidget::sourcesRtcmOut(QByteArray data)
+{
+    emit rtcmReceived(data);
+    mTcpServer->broadcastData(data);
+}
+
+void RtcmWidget::sourceSwitched(int from, int to, QString reason)
+{
+    ui->sourceLogBrowser->append(QDateTime::currentDateTime().toString("hh:mm:ss") + " " +
+                                 mSources->sourceName(from) + " -> " +
+                                 mSources->sourceName(to) + ": " + reason);
+}
+
 void RtcmWidget::on_ntripConnectButton_clicked()
 {
+    mSources->setSourceType(mNetworkSource, ui->ntripBox->isChecked() ?
+                                RtcmSourceManager::RTCM_SOURCE_NTRIP :
+                                RtcmSourceManager::RTCM_SOURCE_TCP);
+
     if (ui->ntripBox->isChecked()) {
         mRtcm->connectNtrip(ui->ntripServerEdit->text(),
                             ui->ntripStreamEdit->text(),
@@ -248,13 +283,13 @@ void RtcmWidget::on_rtcmSerialRefreshButton_clicked()
 
 void RtcmWidget::on_rtcmSerialDisconnectButton_clicked()
 {
-    mRtcm->disconnectSerial();
+    mRtcmSerial->disconnectSerial();
 }
 
 void RtcmWidget::on_rtcmSerialConnectButton_clicked()
 {
-    mRtcm->connectSerial(ui->rtcmSerialPortBox->currentData().toString(),
-                         ui->rtcmSerialBaudBox->value());
+    mRtcmSerial->connectSerial(ui->rtcmSerialPortBox->currentData().toString(),
+                               ui->rtcmSerialBaudBox->value());
 }
 
 void RtcmWidget::on_refGetButton_clicked()
@@ -280,3 +315,14 @@ void RtcmWidget::on_gpsOnlyBox_toggled(bool checked)
 {
     mRtcm->setGpsOnly(checked);
 }
+
+void RtcmWidget::on_ntripReconnectBox_toggled(bool checked)
+{
+    mRtcm->setAutoReconnect(checked);
+}
+
+void RtcmWidget::on_sendRefPosBox_toggled(bool checked)
+{
+    // The position is sent from here, so the sources don't have to
+    mSources->setForwardRefPos(!checked);
+}
@@ -22,6 +22,7 @@
 #include <QTimer>
 #include "rtcmclient.h"
 #include "tcpbroadcast.h"
+#include "rtcmsourcemanager.h"
 
 namespace Ui {
 class RtcmWidget;
@@ -40,10 +41,15 @@ signals:
     void rtcmReceived(QByteArray data);
     void refPosGet();
 
+public slots:
+    void localBaseRtcm(QByteArray data);
+
 private slots:
     void timerSlot();
     void rtcmRx(QByteArray data, int type, bool sync);
     void refPosRx(double lat, double lon, double height, double antenna_height);
+    void sourcesRtcmOut(QByteArray data);
+    void sourceSwitched(int from, int to, QString reason);
 
     void on_ntripConnectButton_clicked();
     void on_ntripDisconnectButton_clicked();
@@ -55,13 +61,18 @@ private slots:
     void on_refGetButton_clicked();
     void on_tcpServerBox_toggled(bool checked);
     void on_gpsOnlyBox_toggled(bool checked);
+    void on_ntripReconnectBox_toggled(bool checked);
+    void on_sendRefPosBox_toggled(bool checked);
 
 private:
     Ui::RtcmWidget *ui;
     RtcmClient *mRtcm;
+    RtcmClient *mRtcmSerial;
+    RtcmSourceManager *mSources;
+    int mNetworkSource;
+    int mLocalBaseSource;
     QTimer *mTimer;
     TcpBroadcast *mTcpServer;
-    QByteArray mRtcmBuffer;
 };
 
 #endif // RTCMWIDGET_H
@@ -0,0 +1,411 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "surveyin.h"
+#include <cmath>
+#include <cstring>
+#include "utility.h"
+
+namespace {
+// 99.9 % of the chi-square distribution with 3 degrees of freedom
+const double gateChi2 = 16.27;
+// Added to the variances before gating, so that a very tight early
+// distribution does not reject everything (m^2)
+const double gateMinVar = 0.05 * 0.05;
+// Limit for the lag-1 correlation of the batch means
+const double maxBatchCorr = 0.9;
+// One-sided 95 % quantile of the normal distribution
+const double stopConfidenceZ = 1.645;
+}
+
+SurveyIn::SurveyIn()
+{
+    mTargetAccuracy = 0.0;
+    reset();
+}
+
+void SurveyIn::reset()
+{
+    mSamples = 0;
+    mRejected = 0;
+    mRejectStreak = 0;
+    mQuality = 0;
+    memset(mMean, 0, sizeof(mMean));
+    memset(mM2, 0, sizeof(mM2));
+    memset(mBatches, 0, sizeof(mBatches));
+    mBatchNum = 0;
+    mBatchSize = 1;
+    memset(mBatchSum, 0, sizeof(mBatchSum));
+    mBatchCount = 0;
+}
+
+/**
+ * @brief SurveyIn::addSample
+ * Add a position sample.
+ *
+ * @param x
+ * ECEF X in meters.
+ *
+ * @param y
+ * ECEF Y in meters.
+ *
+ * @param z
+ * ECEF Z in meters.
+ *
+ * @param quality
+ * Solution quality, higher is better. E.g. 1 for SPP and 4 for RTK fix.
+ *
+ * @return
+ * true if the sample was used. Samples are not used when the survey is done.
+ */
+bool SurveyIn::addSample(double x, double y, double z, int quality)
+{
+    if (isDone()) {
+        return false;
+    }
+
+    if (quality < mQuality) {
+        mRejected++;
+        return false;
+    } else if (quality > mQuality) {
+        reset();
+        mQuality = quality;
+    }
+
+    const double p[3] = {x, y, z};
+
+    if (isOutlier(p)) {
+        mRejected++;
+        mRejectStreak++;
+
+        if (mRejectStreak <= mMaxRejectStreak) {
+            return false;
+        }
+
+        // The antenna has moved, start over from the new position
+        int quality = mQuality;
+        reset();
+        mQuality = quality;
+    }
+
+    mRejectStreak = 0;
+    mSamples++;
+
+    double d1[3], d2[3];
+    for (int i = 0;i < 3;i++) {
+        d1[i] = p[i] - mMean[i];
+        mMean[i] += d1[i] / (double)mSamples;
+        d2[i] = p[i] - mMean[i];
+    }
+
+    for (int i = 0;i < 3;i++) {
+        for (int j = 0;j < 3;j++) {
+            mM2[i][j] += d1[i] * d2[j];
+        }
+    }
+
+    mBatchCount++;
+    for (int i = 0;i < 3;i++) {
+        mBatchSum[i] += p[i];
+    }
+
+    if (mBatchCount >= mBatchSize) {
+        for (int i = 0;i < 3;i++) {
+            mBatches[mBatchNum][i] = mBatchSum[i] / (double)mBatchCount;
+            mBatchSum[i] = 0.0;
+        }
+
+        mBatchCount = 0;
+        mBatchNum++;
+
+        if (mBatchNum >= mMaxBatches) {
+            for (int b = 0;b < mMaxBatches / 2;b++) {
+                for (int i = 0;i < 3;i++) {
+                    mBatches[b][i] = 0.5 * (mBatches[2 * b][i] + mBatches[2 * b + 1][i]);
+                }
+            }
+
+            mBatchNum = mMaxBatches / 2;
+            mBatchSize *= 2;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief SurveyIn::setTargetAccuracy
+ * Stop the survey when the 3D standard error of the mean gets this small.
+ *
+ * @param accuracy
+ * The accuracy in meters. 0 to never stop.
+ */
+void SurveyIn::setTargetAccuracy(double accuracy)
+{
+    mTargetAccuracy = accuracy;
+}
+
+bool SurveyIn::isDone() const
+{
+    if (mTargetAccuracy <= 0.0 || mSamples < mMinSamplesDone) {
+        return false;
+    }
+
+    double acc = accuracy();
+    if (acc < 0.0) {
+        return false;
+    }
+
+    // The accuracy is estimated from few batches, so stopping as soon as it
+    // dips below the target would mostly stop on underestimates. Require the
+    // upper bound of the 95 % confidence interval to be below the target,
+    // with the chi-square quantile from the Wilson-Hilferty approximation.
+    double dof = (double)(mBatchNum - 1);
+    double h = 2.0 / (9.0 * dof);
+    double q = 1.0 - h - stopConfidenceZ * sqrt(h);
+    double accUpper = acc * sqrt(1.0 / (q * q * q));
+
+    return accUpper <= mTargetAccuracy;
+}
+
+int SurveyIn::samples() const
+{
+    return mSamples;
+}
+
+int SurveyIn::rejected() const
+{
+    return mRejected;
+}
+
+int SurveyIn::quality() const
+{
+    return mQuality;
+}
+
+void SurveyIn::mean(double &x, double &y, double &z) const
+{
+    x = mMean[0];
+    y = mMean[1];
+    z = mMean[2];
+}
+
+/**
+ * @brief SurveyIn::accuracy
+ * The 3D standard error of the mean.
+ *
+ * @return
+ * The accuracy in meters, or -1 if there are too few samples to tell.
+ */
+double SurveyIn::accuracy() const
+{
+    double cov[3][3];
+    if (!stdErrorCov(cov)) {
+        return -1.0;
+    }
+
+    return sqrt(cov[0][0] + cov[1][1] + cov[2][2]);
+}
+
+/**
+ * @brief SurveyIn::effectiveSamples
+ * The number of independent samples that would give the same standard error.
+ *
+ * @return
+ * The number of samples, or -1 if unknown.
+ */
+double SurveyIn::effectiveSamples() const
+{
+    double cov[3][3], se[3][3];
+    if (!stdErrorCov(se)) {
+        return -1.0;
+    }
+
+    covariance(cov);
+    double seTrace = se[0][0] + se[1][1] + se[2][2];
+
+    if (seTrace <= 0.0) {
+        return mSamples;
+    }
+
+    return (cov[0][0] + cov[1][1] + cov[2][2]) / seTrace;
+}
+
+/**
+ * @brief SurveyIn::stdDevEnu
+ * The standard deviation of the samples in east, north and up.
+ *
+ * @return
+ * false if there are less than two samples.
+ */
+bool SurveyIn::stdDevEnu(double *sd) const
+{
+    if (mSamples < 2) {
+        return false;
+    }
+
+    double cov[3][3];
+    covariance(cov);
+    toEnuDiag(cov, sd);
+    return true;
+}
+
+/**
+ * @brief SurveyIn::stdErrorEnu
+ * The standard error of the mean in east, north and up.
+ *
+ * @return
+ * false if there are too few samples to tell.
+ */
+bool SurveyIn::stdErrorEnu(double *se) const
+{
+    double cov[3][3];
+    if (!stdErrorCov(cov)) {
+        return false;
+    }
+
+    toEnuDiag(cov, se);
+    return true;
+}
+
+void SurveyIn::covariance(double cov[3][3]) const
+{
+    for (int i = 0;i < 3;i++) {
+        for (int j = 0;j < 3;j++) {
+            cov[i][j] = mSamples > 1 ? mM2[i][j] / (double)(mSamples - 1) : 0.0;
+        }
+    }
+}
+
+// The covariance of the mean from the spread of the batch means. Remaining
+// correlation between neighbouring batches is accounted for with an AR(1)
+// factor per axis, and the result is never below the naive estimate.
+bool SurveyIn::stdErrorCov(double cov[3][3]) const
+{
+    if (mBatchNum < mMinBatches) {
+        return false;
+    }
+
+    const double nb = (double)mBatchNum;
+    double bMean[3] = {0.0, 0.0, 0.0};
+
+    for (int b = 0;b < mBatchNum;b++) {
+        for (int i = 0;i < 3;i++) {
+            bMean[i] += mBatches[b][i] / nb;
+        }
+    }
+
+    double factor[3];
+    for (int i = 0;i < 3;i++) {
+        double s0 = 0.0, s1 = 0.0;
+        for (int b = 0;b < mBatchNum;b++) {
+            double d = mBatches[b][i] - bMean[i];
+            s0 += d * d;
+            if (b > 0) {
+                s1 += d * (mBatches[b - 1][i] - bMean[i]);
+            }
+        }
+
+        double rho = s0 > 0.0 ? s1 / s0 : 0.0;
+        rho = rho < 0.0 ? 0.0 : (rho > maxBatchCorr ? maxBatchCorr : rho);
+        factor[i] = sqrt((1.0 + rho) / (1.0 - rho));
+    }
+
+    double naive[3][3];
+    covariance(naive);
+
+    double traceBatch = 0.0;
+    double traceNaive = 0.0;
+
+    for (int i = 0;i < 3;i++) {
+        for (int j = 0;j < 3;j++) {
+            double c = 0.0;
+            for (int b = 0;b < mBatchNum;b++) {
+                c += (mBatches[b][i] - bMean[i]) * (mBatches[b][j] - bMean[j]);
+            }
+
+            cov[i][j] = c / (nb - 1.0) / nb * factor[i] * factor[j];
+            naive[i][j] /= (double)mSamples;
+        }
+
+        traceBatch += cov[i][i];
+        traceNaive += naive[i][i];
+    }
+
+    if (traceNaive > traceBatch) {
+        memcpy(cov, naive, sizeof(naive));
+    }
+
+    return true;
+}
+
+bool SurveyIn::isOutlier(const double *p) const
+{
+    if (mSamples < mGateMinSamples) {
+        return false;
+    }
+
+    double c[3][3];
+    covariance(c);
+
+    for (int i = 0;i < 3;i++) {
+        c[i][i] += gateMinVar;
+    }
+
+    // Inverse by the adjugate, the matrix is symmetric
+    double a00 = c[1][1] * c[2][2] - c[1][2] * c[2][1];
+    double a01 = c[0][2] * c[2][1] - c[0][1] * c[2][2];
+    double a02 = c[0][1] * c[1][2] - c[0][2] * c[1][1];
+    double a11 = c[0][0] * c[2][2] - c[0][2] * c[2][0];
+    double a12 = c[0][2] * c[1][0] - c[0][0] * c[1][2];
+    double a22 = c[0][0] * c[1][1] - c[0][1] * c[1][0];
+    double det = c[0][0] * a00 + c[0][1] * (c[1][2] * c[2][0] - c[1][0] * c[2][2]) +
+            c[0][2] * (c[1][0] * c[2][1] - c[1][1] * c[2][0]);
+
+    if (det <= 0.0) {
+        return false;
+    }
+
+    double d[3];
+    for (int i = 0;i < 3;i++) {
+        d[i] = p[i] - mMean[i];
+    }
+
+    double m2 = d[0] * d[0] * a00 + d[1] * d[1] * a11 + d[2] * d[2] * a22 +
+            2.0 * (d[0] * d[1] * a01 + d[0] * d[2] * a02 + d[1] * d[2] * a12);
+
+    return m2 / det > gateChi2;
+}
+
+void SurveyIn::toEnuDiag(double cov[3][3], double *res) const
+{
+    double lat, lon, height;
+    double r[9];
+    utility::xyzToLlh(mMean[0], mMean[1], mMean[2], &lat, &lon, &height);
+    utility::createEnuMatrix(lat, lon, r);
+
+    for (int k = 0;k < 3;k++) {
+        double v = 0.0;
+        for (int i = 0;i < 3;i++) {
+            for (int j = 0;j < 3;j++) {
+                v += r[3 * k + i] * cov[i][j] * r[3 * k + j];
+            }
+        }
+
+        res[k] = v > 0.0 ? sqrt(v) : 0.0;
+    }
+}
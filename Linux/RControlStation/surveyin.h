@@ -0,0 +1,80 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef SURVEYIN_H
+#define SURVEYIN_H
+
+// Streaming estimate of a static antenna position from ECEF samples, with
+// constant memory regardless of the survey length.
+//
+// - The mean and covariance are updated with Welford's method.
+// - Samples far outside the current distribution are rejected. If too many
+//   in a row are rejected the position has probably moved for real, and the
+//   survey restarts from the new position.
+// - Samples with a worse solution than the best seen so far are rejected,
+//   and a better solution restarts the survey.
+// - The standard error of the mean is estimated from a fixed number of batch
+//   means, with the batch length doubling as the survey goes on. GNSS errors
+//   are correlated over minutes, so the naive sigma / sqrt(n) is far too
+//   optimistic.
+class SurveyIn
+{
+public:
+    SurveyIn();
+    void reset();
+    bool addSample(double x, double y, double z, int quality);
+    void setTargetAccuracy(double accuracy);
+    bool isDone() const;
+
+    int samples() const;
+    int rejected() const;
+    int quality() const;
+    void mean(double &x, double &y, double &z) const;
+    double accuracy() const;
+    double effectiveSamples() const;
+    bool stdDevEnu(double *sd) const;
+    bool stdErrorEnu(double *se) const;
+
+private:
+    static const int mMaxBatches = 32;
+    static const int mMinBatches = 16;
+    static const int mGateMinSamples = 60;
+    static const int mMaxRejectStreak = 30;
+    static const int mMinSamplesDone = 300;
+
+    int mSamples;
+    int mRejected;
+    int mRejectStreak;
+    int mQuality;
+    double mMean[3];
+    double mM2[3][3];
+    double mTargetAccuracy;
+
+    double mBatches[mMaxBatches][3];
+    int mBatchNum;
+    int mBatchSize;
+    double mBatchSum[3];
+    int mBatchCount;
+
+    void covariance(double cov[3][3]) const;
+    bool stdErrorCov(double cov[3][3]) const;
+    bool isOutlier(const double *p) const;
+    void toEnuDiag(double cov[3][3], double *res) const;
+
+};
+
+#endif // SURVEYIN_H
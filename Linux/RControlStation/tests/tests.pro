@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Host tests for RControlStation. Build and run with
+# qmake && make && make check
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += tst_logloader \
+    tst_packetinterface \
+    tst_multilateration \
+    tst_surveyin \
+    tst_netapi \
+    tst_rtcmsourcemanager \
+    tst_mainconfigcodec \
+    tst_routeconflicts \
+    tst_obsmonitor \
+    tst_mapwidget
@@ -0,0 +1,270 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include "logloader.h"
+
+// Collects the output of a load. The loader emits from its own thread, so
+// the slots are connected directly and read after the thread has finished.
+class LoadRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    LoadRecorder() : ok(false), fromIndex(false), finishMs(-1) {
+        timer.start();
+    }
+
+    LOG_COLUMNS cols;
+    QVector<qint64> chunkMs;
+    QVector<qint64> chunkFirstTime;
+    bool ok;
+    bool fromIndex;
+    qint64 finishMs;
+    QElapsedTimer timer;
+
+public slots:
+    void columnsLoaded(LOG_COLUMNS c) {
+        chunkMs.append(timer.elapsed());
+        chunkFirstTime.append(c.timeMs.first());
+        LogLoader::appendColumns(cols, c);
+    }
+
+    void loadFinished(bool ok, QString msg, bool fromIndex, qint64 elapsedMs) {
+        (void)msg;
+        (void)elapsedMs;
+        this->ok = ok;
+        this->fromIndex = fromIndex;
+        finishMs = timer.elapsed();
+    }
+};
+
+class TestLogLoader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void parseAll();
+    void skipInvalidLines();
+    void progressiveChunks();
+    void index();
+    void benchmarkLargeLog();
+
+private:
+    QTemporaryDir mDir;
+
+    QString writeLog(const QString &name, int lines, int pingErrorEvery = 0);
+    bool load(const QString &path, bool useIndex, LoadRecorder &rec);
+};
+
+void TestLogLoader::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+}
+
+// A log in the format NetworkLogger writes, one sample per second
+QString TestLogLoader::writeLog(const QString &name, int lines, int pingErrorEvery)
+{
+    QString path = mDir.path() + "/" + name;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return QString();
+    }
+
+    // Starts at 2017-03-01 12:00:00. The date is only formatted when it
+    // changes, so that large logs can be written quickly.
+    const QDate startDate(2017, 3, 1);
+    int day = -1;
+    QByteArray date;
+    QByteArray buf;
+    char line[200];
+
+    for (int i = 0;i < lines;i++) {
+        const qint64 secs = 12 * 3600 + (qint64)i;
+        if (secs / 86400 != day) {
+            day = secs / 86400;
+            date = startDate.addDays(day).toString(Qt::ISODate).toLocal8Bit();
+        }
+
+        const int sec = secs % 86400;
+        char ping[20] = "error";
+        if (pingErrorEvery <= 0 || (i % pingErrorEvery) != 0) {
+            qsnprintf(ping, sizeof(ping), "%.3f", 10.0 + (double)(i % 50));
+        }
+
+        int len = qsnprintf(line, sizeof(line),
+                            "%sT%02d:%02d:%02d    %.8f    %.8f    %.3f    %d    %d    %s\r\n",
+                            date.constData(), sec / 3600, (sec / 60) % 60, sec % 60,
+                            57.71495867 + (double)i * 1e-7, 12.89134921, 219.0,
+                            4, 100 + (i % 7), ping);
+        buf.append(line, len);
+
+        if (buf.size() > 1000000) {
+            file.write(buf);
+            buf.clear();
+        }
+    }
+
+    file.write(buf);
+    file.close();
+    QFile::remove(path + ".idx");
+    return path;
+}
+
+bool TestLogLoader::load(const QString &path, bool useIndex, LoadRecorder &rec)
+{
+    LogLoader loader;
+    connect(&loader, SIGNAL(columnsLoaded(LOG_COLUMNS)),
+            &rec, SLOT(columnsLoaded(LOG_COLUMNS)), Qt::DirectConnection);
+    connect(&loader, SIGNAL(loadFinished(bool,QString,bool,qint64)),
+            &rec, SLOT(loadFinished(bool,QString,bool,qint64)), Qt::DirectConnection);
+
+    double ref[3] = {0.0, 0.0, 0.0};
+    rec.timer.restart();
+    loader.load(path, true, ref, useIndex);
+
+    return loader.wait(600000) && rec.finishMs >= 0 && rec.ok;
+}
+
+void TestLogLoader::parseAll()
+{
+    QString path = writeLog("all.log", 10000, 10);
+    LoadRecorder rec;
+    QVERIFY(load(path, false, rec));
+    const LOG_COLUMNS &cols = rec.cols;
+
+    QCOMPARE(LogLoader::columnsSize(cols), 10000);
+
+    // In file order, one second apart
+    for (int i = 1;i < cols.timeMs.size();i++) {
+        QCOMPARE(cols.timeMs.at(i) - cols.timeMs.at(i - 1), (qint64)1000);
+    }
+
+    // The first sample is the ENU reference
+    QVERIFY(qAbs(cols.east.first()) < 1e-3);
+    QVERIFY(qAbs(cols.north.first()) < 1e-3);
+
+    // Failed pings are NaN
+    QVERIFY(std::isnan(cols.pingMs.at(0)));
+    QCOMPARE(cols.pingMs.at(1), 11.0f);
+    QCOMPARE((int)cols.dataLen.at(3), 103);
+
+    QCOMPARE(LogLoader::indexOfTime(cols, cols.timeMs.at(500)), 500);
+    QCOMPARE(LogLoader::indexOfTime(cols, cols.timeMs.last() + 1), cols.timeMs.size());
+}
+
+void TestLogLoader::skipInvalidLines()
+{
+    QString path = mDir.path() + "/invalid.log";
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write("garbage\n"
+               "2017-03-01T12:00:00    57.7    12.8    219.0    4    100    12.5\n"
+               "2017-03-01T12:00:01    57.7    12.8\n"
+               "2017-03-01T12:00:02    57.7    x12.8    219.0    4    100    12.5\n"
+               "2017-03-01T12:00:03    57.7    12.8    219.0    4    100    error\n");
+    file.close();
+
+    LoadRecorder rec;
+    QVERIFY(load(path, false, rec));
+    QCOMPARE(LogLoader::columnsSize(rec.cols), 2);
+}
+
+// The chunks must be emitted one by one while the log is parsed, in file
+// order, and not all at once at the end.
+void TestLogLoader::progressiveChunks()
+{
+    QString path = writeLog("chunks.log", 500000);
+    LoadRecorder rec;
+    QVERIFY(load(path, false, rec));
+
+    QVERIFY(rec.chunkMs.size() > 1);
+    for (int i = 1;i < rec.chunkFirstTime.size();i++) {
+        QVERIFY(rec.chunkFirstTime.at(i) > rec.chunkFirstTime.at(i - 1));
+    }
+
+    qDebug() << "First chunk after" << rec.chunkMs.first() << "ms, last after" <<
+                rec.chunkMs.last() << "ms, finished after" << rec.finishMs << "ms";
+    QVERIFY(rec.chunkMs.first() < rec.finishMs / 2);
+}
+
+void TestLogLoader::index()
+{
+    QString path = writeLog("index.log", 5000);
+
+    LoadRecorder rec1, rec2;
+    QVERIFY(load(path, true, rec1));
+    QVERIFY(!rec1.fromIndex);
+    QVERIFY(load(path, true, rec2));
+    QVERIFY(rec2.fromIndex);
+
+    QCOMPARE(rec2.cols.timeMs, rec1.cols.timeMs);
+    QCOMPARE(rec2.cols.east, rec1.cols.east);
+    QCOMPARE(rec2.cols.pingMs.size(), rec1.cols.pingMs.size());
+}
+
+/*
+ * Load time of a log with 10M lines, which is about 850 MB. The number of
+ * lines can be set with LOGLOADER_BENCH_LINES on machines with less disk or
+ * memory. The columns of the first load are dropped before the second, so
+ * that only one copy is held at a time.
+ */
+void TestLogLoader::benchmarkLargeLog()
+{
+    int lines = 10000000;
+    if (qEnvironmentVariableIsSet("LOGLOADER_BENCH_LINES")) {
+        lines = qEnvironmentVariableIntValue("LOGLOADER_BENCH_LINES");
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QString path = writeLog("large.log", lines);
+    QVERIFY(!path.isEmpty());
+    qint64 writeMs = timer.elapsed();
+    QFileInfo info(path);
+
+    qint64 parseMs;
+    {
+        LoadRecorder rec;
+        QVERIFY(load(path, false, rec));
+        QCOMPARE(LogLoader::columnsSize(rec.cols), lines);
+        parseMs = rec.finishMs;
+    }
+
+    qint64 indexMs;
+    {
+        LoadRecorder rec;
+        QVERIFY(load(path, true, rec));
+        QVERIFY(rec.fromIndex);
+        QCOMPARE(LogLoader::columnsSize(rec.cols), lines);
+        indexMs = rec.finishMs;
+    }
+
+    qDebug() << QString("%1 lines, %2 MB written in %3 ms: parsed in %4 ms, index read in %5 ms").
+                arg(lines).arg((double)info.size() / 1e6, 0, 'f', 1).
+                arg(writeMs).arg(parseMs).arg(indexMs);
+
+    QFile::remove(path);
+    QFile::remove(path + ".idx");
+}
+
+QTEST_GUILESS_MAIN(TestLogLoader)
+
+#include "tst_logloader.moc"
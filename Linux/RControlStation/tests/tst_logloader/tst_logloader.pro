@@ -0,0 +1,17 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_logloader
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_logloader.cpp \
+    ../../logloader.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../logloader.h \
+    ../../utility.h
@@ -0,0 +1,265 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "mainconfigcodec.h"
+
+namespace {
+// A different value in every field, based on the field index. The float
+// values are exact in single precision so that they survive the encoding.
+#define SET_BOOL(v, i)      (v) = ((i) % 2) == 0
+#define SET_INT8(v, i)      (v) = (i) - 60
+#define SET_UINT16(v, i)    (v) = 1000 + 37 * (i)
+#define SET_INT32(v, i)     (v) = -100000 * ((i) + 1)
+#define SET_FLOAT(v, i)     (v) = 0.25f * (float)(i) - 3.5f
+#define SET_NAME(v, i)      snprintf((v), sizeof(v), "log_%d", (i))
+
+#define SAME_BOOL(a, b)     ((a) == (b))
+#define SAME_INT8(a, b)     ((a) == (b))
+#define SAME_UINT16(a, b)   ((a) == (b))
+#define SAME_INT32(a, b)    ((a) == (b))
+#define SAME_FLOAT(a, b)    (fabs((a) - (b)) < 1e-6)
+#define SAME_NAME(a, b)     (strcmp((a), (b)) == 0)
+
+void fillConf(MAIN_CONFIG &conf, int seed)
+{
+    memset(&conf, 0, sizeof(MAIN_CONFIG));
+
+#define FILL_FIELD(id, type, member) \
+    SET_##type(conf.member, MAIN_CONFIG_FIELD_##id + seed);
+
+    MAIN_CONFIG_FIELDS(FILL_FIELD)
+#undef FILL_FIELD
+}
+
+// The fields that differ, as a list of field ids
+QList<int> differentFields(const MAIN_CONFIG &a, const MAIN_CONFIG &b)
+{
+    QList<int> res;
+
+#define COMPARE_FIELD(id, type, member) \
+    if (!SAME_##type(a.member, b.member)) { \
+        res.append(MAIN_CONFIG_FIELD_##id); \
+    }
+
+    MAIN_CONFIG_FIELDS(COMPARE_FIELD)
+#undef COMPARE_FIELD
+
+    return res;
+}
+}
+
+class TestMainConfigCodec : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTripAll();
+    void roundTripMask();
+    void unknownFieldsIgnored();
+    void invalidRejected();
+    void benchmarkEncode();
+    void benchmarkApply();
+    void benchmarkDiff();
+};
+
+/*
+ * Every field encoded and decoded into an empty configuration must come back
+ * unchanged, and encoding the result again must give the same bytes.
+ */
+void TestMainConfigCodec::roundTripAll()
+{
+    MAIN_CONFIG conf;
+    fillConf(conf, 3);
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = MainConfigView::encode(conf, buffer);
+    QCOMPARE(len, (int)MainConfigView::maxLength);
+
+    MainConfigView view(buffer, len);
+    QVERIFY(view.isValid());
+    QCOMPARE(view.fieldNum(), (int)MAIN_CONFIG_FIELD_NUM);
+
+    for (int i = 0;i < MAIN_CONFIG_FIELD_NUM;i++) {
+        QVERIFY(view.hasField((MAIN_CONFIG_FIELD)i));
+        const unsigned char *expected = buffer + MAIN_CONFIG_HEADER_SIZE +
+                MainConfigView::fieldOffset((MAIN_CONFIG_FIELD)i);
+        QCOMPARE(view.fieldData((MAIN_CONFIG_FIELD)i), expected);
+    }
+
+    MAIN_CONFIG decoded;
+    memset(&decoded, 0, sizeof(MAIN_CONFIG));
+    QCOMPARE(view.apply(decoded), (int)MAIN_CONFIG_FIELD_NUM);
+    QCOMPARE(differentFields(conf, decoded), QList<int>());
+
+    unsigned char buffer2[MainConfigView::maxLength];
+    QCOMPARE(MainConfigView::encode(decoded, buffer2), len);
+    QVERIFY(memcmp(buffer, buffer2, len) == 0);
+    QCOMPARE(MainConfigView::hash(decoded), MainConfigView::hash(conf));
+}
+
+/*
+ * A delta update with the fields from diff applied to the old configuration
+ * must give the new one, and leave the other fields alone.
+ */
+void TestMainConfigCodec::roundTripMask()
+{
+    MAIN_CONFIG confOld;
+    MAIN_CONFIG confNew;
+    fillConf(confOld, 0);
+    confNew = confOld;
+
+    confNew.log_en = !confOld.log_en;
+    confNew.mr.motor_pwm_min_us = 1100;
+    strcpy(confNew.log_name, "other");
+
+    quint8 mask[MAIN_CONFIG_MASK_BYTES];
+    QCOMPARE(MainConfigView::diff(confOld, confNew, mask), 3);
+    QVERIFY(MAIN_CONFIG_MASK_GET(mask, MAIN_CONFIG_FIELD_LOG_EN));
+    QVERIFY(MAIN_CONFIG_MASK_GET(mask, MAIN_CONFIG_FIELD_MR_MOTOR_PWM_MIN_US));
+    QVERIFY(MAIN_CONFIG_MASK_GET(mask, MAIN_CONFIG_FIELD_LOG_NAME));
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = MainConfigView::encode(confNew, buffer, mask);
+    QCOMPARE(len, MAIN_CONFIG_HEADER_SIZE +
+             MainConfigView::fieldSize(MAIN_CONFIG_FIELD_LOG_EN) +
+             MainConfigView::fieldSize(MAIN_CONFIG_FIELD_MR_MOTOR_PWM_MIN_US) +
+             MainConfigView::fieldSize(MAIN_CONFIG_FIELD_LOG_NAME));
+
+    MainConfigView view(buffer, len);
+    QVERIFY(view.isValid());
+    QVERIFY(!view.hasField(MAIN_CONFIG_FIELD_MAG_USE));
+
+    MAIN_CONFIG decoded = confOld;
+    QCOMPARE(view.apply(decoded), 3);
+    QCOMPARE(differentFields(confNew, decoded), QList<int>());
+    QCOMPARE(MainConfigView::hash(decoded), MainConfigView::hash(confNew));
+
+    // Nothing changed gives an empty update
+    QCOMPARE(MainConfigView::diff(confNew, decoded, mask), 0);
+}
+
+/*
+ * A newer sender can have more fields. The known ones are decoded and the
+ * rest are skipped.
+ */
+void TestMainConfigCodec::unknownFieldsIgnored()
+{
+    MAIN_CONFIG conf;
+    fillConf(conf, 5);
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = MainConfigView::encode(conf, buffer);
+
+    // One more field, not set in the mask, in a new header
+    QByteArray data;
+    data.append((char)MAIN_CONFIG_SCHEMA_VERSION);
+    data.append((char)(MAIN_CONFIG_FIELD_NUM + 8));
+    data.append((const char*)buffer + 2, MAIN_CONFIG_MASK_BYTES);
+    data.append((char)0);
+    data.append((const char*)buffer + MAIN_CONFIG_HEADER_SIZE, len - MAIN_CONFIG_HEADER_SIZE);
+
+    MainConfigView view((const unsigned char*)data.constData(), data.size());
+    QVERIFY(view.isValid());
+
+    MAIN_CONFIG decoded;
+    memset(&decoded, 0, sizeof(MAIN_CONFIG));
+    QCOMPARE(view.apply(decoded), (int)MAIN_CONFIG_FIELD_NUM);
+    QCOMPARE(differentFields(conf, decoded), QList<int>());
+}
+
+void TestMainConfigCodec::invalidRejected()
+{
+    MAIN_CONFIG conf;
+    fillConf(conf, 1);
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = MainConfigView::encode(conf, buffer);
+
+    MAIN_CONFIG decoded;
+    memset(&decoded, 0, sizeof(MAIN_CONFIG));
+
+    MainConfigView truncated(buffer, len - 1);
+    QVERIFY(!truncated.isValid());
+    QVERIFY(!truncated.hasField(MAIN_CONFIG_FIELD_MAG_USE));
+    QCOMPARE(truncated.apply(decoded), -1);
+
+    buffer[0] = MAIN_CONFIG_SCHEMA_VERSION + 1;
+    MainConfigView version(buffer, len);
+    QVERIFY(!version.isValid());
+    QCOMPARE(version.apply(decoded), -1);
+
+    QVERIFY(!MainConfigView(buffer, 1).isValid());
+}
+
+void TestMainConfigCodec::benchmarkEncode()
+{
+    MAIN_CONFIG conf;
+    fillConf(conf, 2);
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = 0;
+    QBENCHMARK {
+        len = MainConfigView::encode(conf, buffer);
+    }
+
+    QCOMPARE(len, (int)MainConfigView::maxLength);
+}
+
+// Parsing the header and decoding all fields, as for a received configuration
+void TestMainConfigCodec::benchmarkApply()
+{
+    MAIN_CONFIG conf;
+    fillConf(conf, 2);
+
+    unsigned char buffer[MainConfigView::maxLength];
+    int len = MainConfigView::encode(conf, buffer);
+
+    MAIN_CONFIG decoded;
+    memset(&decoded, 0, sizeof(MAIN_CONFIG));
+    int fields = 0;
+    QBENCHMARK {
+        MainConfigView view(buffer, len);
+        fields = view.apply(decoded);
+    }
+
+    QCOMPARE(fields, (int)MAIN_CONFIG_FIELD_NUM);
+}
+
+// One changed field, which is the common case when a setting is edited
+void TestMainConfigCodec::benchmarkDiff()
+{
+    MAIN_CONFIG confOld;
+    fillConf(confOld, 2);
+    MAIN_CONFIG confNew = confOld;
+    confNew.mr.ap_enabled = !confOld.mr.ap_enabled;
+
+    quint8 mask[MAIN_CONFIG_MASK_BYTES];
+    int changed = 0;
+    QBENCHMARK {
+        changed = MainConfigView::diff(confOld, confNew, mask);
+    }
+
+    QCOMPARE(changed, 1);
+}
+
+QTEST_GUILESS_MAIN(TestMainConfigCodec)
+
+#include "tst_mainconfigcodec.moc"
@@ -0,0 +1,20 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_mainconfigcodec
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_mainconfigcodec.cpp \
+    ../../mainconfigcodec.cpp \
+    ../../packet.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../mainconfigcodec.h \
+    ../../mainconfigtypes.h \
+    ../../packet.h \
+    ../../utility.h
@@ -0,0 +1,255 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QImage>
+#include <random>
+#include <cmath>
+#include "mapwidget.h"
+
+namespace {
+const int mapWidth = 1000;
+const int mapHeight = 800;
+
+void setupMap(MapWidget &map, double scale)
+{
+    map.resize(mapWidth, mapHeight);
+    map.setDrawOpenStreetmap(false);
+    map.setDrawGrid(false);
+    map.setPredictPose(false);
+    map.setScaleFactor(scale);
+}
+
+// Cars spread over an area of the given size around the origin
+void addCars(MapWidget &map, int num, double size, int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> pos(-size / 2.0, size / 2.0);
+    std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+    const Qt::GlobalColor colors[] = {Qt::red, Qt::blue, Qt::green, Qt::magenta};
+
+    for (int i = 0;i < num;i++) {
+        CarInfo car(i, colors[i % 4]);
+        LocPoint loc(pos(gen), pos(gen), 0.0, 0.0, yaw(gen));
+        car.setLocation(loc);
+        car.setLocationGps(loc);
+        map.addCar(car);
+    }
+}
+
+QImage render(MapWidget &map)
+{
+    QImage img(mapWidth, mapHeight, QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::white);
+    map.render(&img);
+    return img;
+}
+
+// Pixels that differ in a square around the center of the map
+int centerDiff(const QImage &a, const QImage &b, int half)
+{
+    int res = 0;
+    for (int y = mapHeight / 2 - half;y < mapHeight / 2 + half;y++) {
+        for (int x = mapWidth / 2 - half;x < mapWidth / 2 + half;x++) {
+            if (a.pixel(x, y) != b.pixel(x, y)) {
+                res++;
+            }
+        }
+    }
+
+    return res;
+}
+}
+
+class TestMapWidget : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void getCarInfoById();
+    void getCarInfoChangedId();
+    void carDrawnAtAllZooms_data();
+    void carDrawnAtAllZooms();
+    void benchmarkGetCarInfo();
+    void benchmarkRender_data();
+    void benchmarkRender();
+};
+
+void TestMapWidget::getCarInfoById()
+{
+    MapWidget map;
+
+    for (int i = 0;i < 100;i++) {
+        map.addCar(CarInfo(i * 3));
+    }
+
+    for (int i = 0;i < 100;i++) {
+        QVERIFY(map.getCarInfo(i * 3));
+        QCOMPARE(map.getCarInfo(i * 3)->getId(), i * 3);
+    }
+
+    QVERIFY(!map.getCarInfo(1));
+    QVERIFY(!map.getCarInfo(-1));
+
+    // The cars after the removed one move in the list
+    QVERIFY(map.removeCar(30));
+    QVERIFY(!map.removeCar(30));
+    QVERIFY(!map.getCarInfo(30));
+    QCOMPARE(map.getCarInfo(33)->getId(), 33);
+    QCOMPARE(map.getCarInfo(297)->getId(), 297);
+
+    // With the same id twice the first car is used, as before the index
+    CarInfo other(6);
+    other.setName("Other");
+    map.addCar(other);
+    QVERIFY(map.getCarInfo(6)->getName() != "Other");
+    QVERIFY(map.removeCar(6));
+    QCOMPARE(map.getCarInfo(6)->getName(), QString("Other"));
+}
+
+// Ids can be changed through the pointer, without the map knowing
+void TestMapWidget::getCarInfoChangedId()
+{
+    MapWidget map;
+
+    for (int i = 0;i < 10;i++) {
+        map.addCar(CarInfo(i));
+    }
+
+    CarInfo *car = map.getCarInfo(4);
+    car->setId(40);
+
+    QVERIFY(!map.getCarInfo(4));
+    QCOMPARE(map.getCarInfo(40), car);
+
+    // Swap two ids
+    map.getCarInfo(2)->setId(100);
+    map.getCarInfo(3)->setId(2);
+    map.getCarInfo(100)->setId(3);
+    QCOMPARE(map.getCarInfo(2)->getId(), 2);
+    QCOMPARE(map.getCarInfo(3)->getId(), 3);
+    QVERIFY(map.getCarInfo(2) != map.getCarInfo(3));
+
+    QVERIFY(map.removeCar(40));
+    QVERIFY(!map.getCarInfo(40));
+    QCOMPARE(map.getCarInfo(9)->getId(), 9);
+}
+
+void TestMapWidget::carDrawnAtAllZooms_data()
+{
+    QTest::addColumn<double>("scale");
+    QTest::addColumn<int>("half");
+
+    // The car is about 1.4 m wide with the margins of the symbol
+    QTest::newRow("vector 410 px") << 0.3 << 100;
+    QTest::newRow("glyph 70 px") << 0.05 << 30;
+    QTest::newRow("glyph 14 px") << 0.01 << 8;
+    QTest::newRow("dot") << 0.001 << 4;
+}
+
+/*
+ * One car at the origin, drawn as a vector shape, from the symbol cache and
+ * as a dot depending on the zoom. A car outside the view is not drawn.
+ */
+void TestMapWidget::carDrawnAtAllZooms()
+{
+    QFETCH(double, scale);
+    QFETCH(int, half);
+
+    MapWidget map;
+    setupMap(map, scale);
+    QImage empty = render(map);
+
+    CarInfo far(1);
+    LocPoint farLoc(1e5, 1e5);
+    far.setLocation(farLoc);
+    far.setLocationGps(farLoc);
+    map.addCar(far);
+    QCOMPARE(render(map), empty);
+
+    CarInfo car(2, Qt::blue);
+    LocPoint loc(0.0, 0.0, 0.0, 0.0, 0.5);
+    car.setLocation(loc);
+    car.setLocationGps(loc);
+    map.addCar(car);
+    QImage withCar = render(map);
+    QVERIFY(centerDiff(empty, withCar, half) > 0);
+
+    map.setSelectedCar(2);
+    QVERIFY(render(map) != empty);
+}
+
+void TestMapWidget::benchmarkGetCarInfo()
+{
+    MapWidget map;
+    for (int i = 0;i < 1000;i++) {
+        map.addCar(CarInfo(i));
+    }
+
+    int found = 0;
+    QBENCHMARK {
+        for (int i = 0;i < 1000;i++) {
+            if (map.getCarInfo(i)) {
+                found++;
+            }
+        }
+    }
+
+    QVERIFY(found > 0);
+}
+
+void TestMapWidget::benchmarkRender_data()
+{
+    QTest::addColumn<double>("scale");
+    QTest::addColumn<int>("cars");
+    QTest::addColumn<double>("area");
+
+    QTest::newRow("50 cars, 410 px") << 0.3 << 50 << 3.0;
+    QTest::newRow("500 cars, 70 px") << 0.05 << 500 << 20.0;
+    QTest::newRow("500 cars, 14 px") << 0.01 << 500 << 100.0;
+    QTest::newRow("2000 cars, 14 px, half in view") << 0.01 << 2000 << 200.0;
+    QTest::newRow("2000 cars, dots") << 0.001 << 2000 << 1000.0;
+}
+
+/*
+ * Rendering many cars, with the area scaled to the view so that about the
+ * same share of the map is covered at every zoom.
+ */
+void TestMapWidget::benchmarkRender()
+{
+    QFETCH(double, scale);
+    QFETCH(int, cars);
+    QFETCH(double, area);
+
+    MapWidget map;
+    setupMap(map, scale);
+    addCars(map, cars, area, 64);
+    map.setSelectedCar(cars / 2);
+
+    QImage img(mapWidth, mapHeight, QImage::Format_ARGB32_Premultiplied);
+
+    // The first frame fills the symbol and label caches
+    map.render(&img);
+
+    QBENCHMARK {
+        map.render(&img);
+    }
+}
+
+QTEST_MAIN(TestMapWidget)
+
+#include "tst_mapwidget.moc"
@@ -0,0 +1,32 @@
+QT       += core gui widgets network testlib
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_mapwidget
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_mapwidget.cpp \
+    ../../mapwidget.cpp \
+    ../../carinfo.cpp \
+    ../../copterinfo.cpp \
+    ../../locpoint.cpp \
+    ../../perspectivepixmap.cpp \
+    ../../osmclient.cpp \
+    ../../osmtile.cpp \
+    ../../routeconflicts.cpp \
+    ../../posepredictor.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../mapwidget.h \
+    ../../carinfo.h \
+    ../../copterinfo.h \
+    ../../locpoint.h \
+    ../../perspectivepixmap.h \
+    ../../osmclient.h \
+    ../../osmtile.h \
+    ../../routeconflicts.h \
+    ../../posepredictor.h \
+    ../../utility.h
@@ -0,0 +1,197 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <cmath>
+#include "multilateration.h"
+
+namespace {
+const double anchorHeight = 2.0;
+const double anchors[4][2] = {{0.0, 0.0}, {20.0, 0.0}, {10.0, 15.0}, {0.0, 15.0}};
+}
+
+class TestMultilateration : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void exactFix();
+    void movingWithOdometry();
+    void outlierThreeAnchors_data();
+    void outlierThreeAnchors();
+    void outlierFourAnchors();
+    void benchmarkSolve_data();
+    void benchmarkSolve();
+
+private:
+    void setup(Multilateration &m, int anchorNum);
+    double range(int anchor, double px, double py);
+    bool round(Multilateration &m, int anchorNum, qint32 timeMs,
+               double px, double py, Multilateration::fix_t &fix,
+               int badAnchor = -1, double error = 0.0);
+};
+
+void TestMultilateration::setup(Multilateration &m, int anchorNum)
+{
+    for (int i = 0;i < anchorNum;i++) {
+        m.setAnchor(i, anchors[i][0], anchors[i][1], anchorHeight);
+    }
+}
+
+double TestMultilateration::range(int anchor, double px, double py)
+{
+    double dx = px - anchors[anchor][0];
+    double dy = py - anchors[anchor][1];
+    return sqrt(dx * dx + dy * dy + anchorHeight * anchorHeight);
+}
+
+// Range all anchors at the same time from a stationary car, returns whether
+// the last range gave a fix
+bool TestMultilateration::round(Multilateration &m, int anchorNum, qint32 timeMs,
+                                double px, double py, Multilateration::fix_t &fix,
+                                int badAnchor, double error)
+{
+    bool res = false;
+    for (int i = 0;i < anchorNum;i++) {
+        double r = range(i, px, py) + (i == badAnchor ? error : 0.0);
+        res = m.addRange(i, r, timeMs, 0.0, 0.0, fix);
+    }
+    return res;
+}
+
+void TestMultilateration::exactFix()
+{
+    Multilateration m;
+    setup(m, 3);
+    Multilateration::fix_t fix;
+
+    QVERIFY(round(m, 3, 1000, 10.0, 5.0, fix));
+    QVERIFY(fabs(fix.px - 10.0) < 1e-3);
+    QVERIFY(fabs(fix.py - 5.0) < 1e-3);
+    QCOMPARE(fix.rangesUsed, 3);
+    QCOMPARE(fix.rangesRejected, 0);
+}
+
+// The anchors are ranged one after the other while the car drives, which is
+// compensated with the odometry of every sample.
+void TestMultilateration::movingWithOdometry()
+{
+    Multilateration m;
+    setup(m, 3);
+    Multilateration::fix_t fix;
+    bool hasFix = false;
+
+    const double startX = 5.0;
+    const double startY = 4.0;
+    const double speed = 2.0;
+
+    for (int i = 0;i < 60;i++) {
+        qint32 t = i * 100;
+        double odomX = speed * t / 1000.0;
+        int anchor = i % 3;
+        double r = range(anchor, startX + odomX, startY);
+        if (m.addRange(anchor, r, t, odomX, 0.0, fix)) {
+            hasFix = true;
+            QVERIFY(fabs(fix.px - (startX + odomX)) < 0.01);
+            QVERIFY(fabs(fix.py - startY) < 0.01);
+        }
+    }
+
+    QVERIFY(hasFix);
+}
+
+void TestMultilateration::outlierThreeAnchors_data()
+{
+    QTest::addColumn<int>("anchor");
+    QTest::addColumn<double>("error");
+
+    for (int i = 0;i < 3;i++) {
+        QTest::newRow(qPrintable(QString("anchor %1 long").arg(i))) << i << 1.5;
+        QTest::newRow(qPrintable(QString("anchor %1 short").arg(i))) << i << -1.5;
+    }
+}
+
+// With three ranges the bad one cannot be dropped, but the fix must be
+// rejected rather than reported a meter off. The plain residual RMS stays
+// below the threshold for some of these.
+void TestMultilateration::outlierThreeAnchors()
+{
+    QFETCH(int, anchor);
+    QFETCH(double, error);
+
+    Multilateration m;
+    setup(m, 3);
+    Multilateration::fix_t fix;
+
+    QVERIFY(round(m, 3, 1000, 10.0, 5.0, fix));
+    QVERIFY(!round(m, 3, 1100, 10.0, 5.0, fix, anchor, error));
+
+    // Without a recent fix only the fit error is left to catch it
+    Multilateration m2;
+    setup(m2, 3);
+    QVERIFY(!round(m2, 3, 1000, 10.0, 5.0, fix, anchor, error));
+}
+
+void TestMultilateration::outlierFourAnchors()
+{
+    Multilateration m;
+    setup(m, 4);
+    Multilateration::fix_t fix;
+
+    QVERIFY(round(m, 4, 1000, 8.0, 6.0, fix, 3, 2.0));
+    QCOMPARE(fix.rangesUsed, 3);
+    QCOMPARE(fix.rangesRejected, 1);
+    QVERIFY(fabs(fix.px - 8.0) < 1e-3);
+    QVERIFY(fabs(fix.py - 6.0) < 1e-3);
+}
+
+void TestMultilateration::benchmarkSolve_data()
+{
+    QTest::addColumn<int>("anchorNum");
+    QTest::addColumn<double>("error");
+
+    QTest::newRow("3 anchors") << 3 << 0.0;
+    QTest::newRow("4 anchors") << 4 << 0.0;
+    QTest::newRow("4 anchors, one outlier") << 4 << 2.0;
+}
+
+// One solve with ranges from all anchors. With an outlier among four anchors
+// the solve is repeated after leaving the worst range out.
+void TestMultilateration::benchmarkSolve()
+{
+    QFETCH(int, anchorNum);
+    QFETCH(double, error);
+
+    Multilateration m;
+    setup(m, anchorNum);
+    Multilateration::fix_t fix;
+    const int bad = anchorNum - 1;
+    round(m, anchorNum, 1000, 8.0, 6.0, fix, bad, error);
+
+    const double r = range(bad, 8.0, 6.0) + error;
+    bool ok = true;
+    QBENCHMARK {
+        ok = ok && m.addRange(bad, r, 1000, 0.0, 0.0, fix);
+    }
+
+    QVERIFY(ok);
+    QCOMPARE(fix.rangesUsed, error > 0.0 ? anchorNum - 1 : anchorNum);
+}
+
+QTEST_GUILESS_MAIN(TestMultilateration)
+
+#include "tst_multilateration.moc"
@@ -0,0 +1,15 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_multilateration
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_multilateration.cpp \
+    ../../multilateration.cpp
+
+HEADERS += ../../multilateration.h
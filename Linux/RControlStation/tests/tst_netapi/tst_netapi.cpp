@@ -0,0 +1,395 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QTcpSocket>
+#include <QXmlStreamWriter>
+#include <cmath>
+#include <cstring>
+#include "netapi.h"
+#include "netprotocol.h"
+#include "packet.h"
+
+// A client of the binary port, as CarNetworkTester would connect
+class ApiTestClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ApiTestClient(quint16 port, QObject *parent = 0) : QObject(parent)
+    {
+        mPacket = new Packet(this);
+        connect(&mSocket, SIGNAL(readyRead()), this, SLOT(socketDataAvailable()));
+        connect(mPacket, SIGNAL(dataToSend(QByteArray&)),
+                this, SLOT(packetDataToSend(QByteArray&)));
+        connect(mPacket, SIGNAL(packetReceived(QByteArray&)),
+                this, SLOT(packetReceived(QByteArray&)));
+        mSocket.connectToHost(QHostAddress::LocalHost, port);
+        mSocket.waitForConnected(1000);
+    }
+
+    void send(const QByteArray &data)
+    {
+        mPacket->sendPacket(data);
+        mSocket.flush();
+    }
+
+    int count(NET_MSG msg)
+    {
+        int res = 0;
+        for (QByteArray m: rx) {
+            if ((NET_MSG)m.at(0) == msg) {
+                res++;
+            }
+        }
+        return res;
+    }
+
+    QTcpSocket mSocket;
+    QList<QByteArray> rx;
+
+private slots:
+    void socketDataAvailable()
+    {
+        mPacket->processData(mSocket.readAll());
+    }
+
+    void packetDataToSend(QByteArray &data)
+    {
+        mSocket.write(data);
+    }
+
+    void packetReceived(QByteArray &data)
+    {
+        rx.append(data);
+    }
+
+private:
+    Packet *mPacket;
+
+};
+
+class TestNetApi : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void perClientSubscription();
+    void decimation();
+    void disconnectKeepsOthers();
+    void pollUnion();
+    void stationEnuRef();
+    void invalidLength();
+    void encodeBinary();
+    void encodeXml();
+    void decodeBinary();
+    void decodeXml();
+
+private:
+    NetApi *mApi;
+
+    void subscribe(ApiTestClient &c, quint8 flags, int intervalMs,
+                   const QVector<quint8> &ids);
+    static CAR_STATE testState();
+    static QByteArray xmlState(quint8 id, const CAR_STATE &state);
+};
+
+void TestNetApi::init()
+{
+    mApi = new NetApi;
+    mApi->setSubMinIntervalMs(0);
+    QVERIFY(mApi->startTcpServer(0));
+}
+
+void TestNetApi::cleanup()
+{
+    delete mApi;
+}
+
+void TestNetApi::subscribe(ApiTestClient &c, quint8 flags, int intervalMs,
+                           const QVector<quint8> &ids)
+{
+    c.send(NetProtocol::encodeSubscribe(flags, intervalMs, ids));
+    QTRY_COMPARE(c.count(NET_MSG_SUBSCRIBED), 1);
+    c.rx.clear();
+}
+
+CAR_STATE TestNetApi::testState()
+{
+    CAR_STATE state;
+    memset(&state, 0, sizeof(state));
+    state.fw_major = 10;
+    state.fw_minor = 2;
+    state.roll = 1.5;
+    state.pitch = -2.25;
+    state.yaw = 123.5;
+    state.accel[2] = 9.81;
+    state.px = 12.345;
+    state.py = -67.89;
+    state.speed = 3.2;
+    state.vin = 24.1;
+    state.temp_fet = 41.0;
+    state.ap_goal_px = 13.0;
+    state.ap_goal_py = -66.0;
+    state.ap_rad = 1.2;
+    state.ms_today = 45296789;
+    return state;
+}
+
+// The same document as NetworkInterface::sendState
+QByteArray TestNetApi::xmlState(quint8 id, const CAR_STATE &state)
+{
+    QByteArray data;
+    QXmlStreamWriter stream(&data);
+    stream.setAutoFormatting(true);
+
+    stream.writeStartDocument();
+    stream.writeStartElement("message");
+    stream.writeStartElement("getState");
+
+    stream.writeTextElement("id", QString::number(id));
+    stream.writeTextElement("fw_major", QString::number(state.fw_major));
+    stream.writeTextElement("fw_minor", QString::number(state.fw_minor));
+    stream.writeTextElement("roll", QString::number(state.roll));
+    stream.writeTextElement("pitch", QString::number(state.pitch));
+    stream.writeTextElement("yaw", QString::number(state.yaw));
+    stream.writeTextElement("accel_0", QString::number(state.accel[0]));
+    stream.writeTextElement("accel_1", QString::number(state.accel[1]));
+    stream.writeTextElement("accel_2", QString::number(state.accel[2]));
+    stream.writeTextElement("gyro_0", QString::number(state.gyro[0]));
+    stream.writeTextElement("gyro_1", QString::number(state.gyro[1]));
+    stream.writeTextElement("gyro_2", QString::number(state.gyro[2]));
+    stream.writeTextElement("mag_0", QString::number(state.mag[0]));
+    stream.writeTextElement("mag_1", QString::number(state.mag[1]));
+    stream.writeTextElement("mag_2", QString::number(state.mag[2]));
+    stream.writeTextElement("px", QString::number(state.px));
+    stream.writeTextElement("py", QString::number(state.py));
+    stream.writeTextElement("speed", QString::number(state.speed));
+    stream.writeTextElement("vin", QString::number(state.vin));
+    stream.writeTextElement("temp_fet", QString::number(state.temp_fet));
+    stream.writeTextElement("mc_fault", QString::number((int)state.mc_fault));
+    stream.writeTextElement("px_gps", QString::number(state.px_gps));
+    stream.writeTextElement("py_gps", QString::number(state.py_gps));
+    stream.writeTextElement("ap_goal_px", QString::number(state.ap_goal_px));
+    stream.writeTextElement("ap_goal_py", QString::number(state.ap_goal_py));
+    stream.writeTextElement("ap_rad", QString::number(state.ap_rad));
+    stream.writeTextElement("ms_today", QString::number(state.ms_today));
+
+    stream.writeEndDocument();
+    return data;
+}
+
+// Two clients with different cars only get their own states
+void TestNetApi::perClientSubscription()
+{
+    ApiTestClient a(mApi->serverPort());
+    ApiTestClient b(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 2);
+
+    subscribe(a, 0, 0, QVector<quint8>() << 1);
+    subscribe(b, NET_SUB_ALL_CARS, 0, QVector<quint8>());
+
+    mApi->sendState(1, testState());
+    mApi->sendState(2, testState());
+    mApi->sendEnuRef(2, 57.7, 12.9, 219.0);
+
+    QTRY_COMPARE(b.count(NET_MSG_STATE), 2);
+    QTRY_COMPARE(b.count(NET_MSG_ENU_REF), 1);
+    QTRY_COMPARE(a.count(NET_MSG_STATE), 1);
+    QTest::qWait(50);
+    QCOMPARE(a.count(NET_MSG_STATE), 1);
+    QCOMPARE(a.count(NET_MSG_ENU_REF), 0);
+
+    quint8 id;
+    CAR_STATE state;
+    QVERIFY(NetProtocol::decodeState(a.rx.first(), id, state));
+    QCOMPARE(id, (quint8)1);
+    QCOMPARE(state.ms_today, testState().ms_today);
+}
+
+// Every client is decimated to its own interval
+void TestNetApi::decimation()
+{
+    ApiTestClient fast(mApi->serverPort());
+    ApiTestClient slow(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 2);
+
+    subscribe(fast, NET_SUB_ALL_CARS, 0, QVector<quint8>());
+    subscribe(slow, NET_SUB_ALL_CARS, 10000, QVector<quint8>());
+
+    for (int i = 0;i < 20;i++) {
+        mApi->sendState(1, testState());
+    }
+
+    QTRY_COMPARE(fast.count(NET_MSG_STATE), 20);
+    QCOMPARE(slow.count(NET_MSG_STATE), 1);
+
+    // A requested state is sent right away
+    slow.send(QByteArray(1, NET_MSG_GET_STATE) + QByteArray(1, 1));
+    QTest::qWait(50);
+    mApi->sendState(1, testState());
+    QTRY_COMPARE(slow.count(NET_MSG_STATE), 2);
+}
+
+void TestNetApi::disconnectKeepsOthers()
+{
+    ApiTestClient a(mApi->serverPort());
+    ApiTestClient *b = new ApiTestClient(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 2);
+
+    subscribe(a, 0, 0, QVector<quint8>() << 5);
+    subscribe(*b, NET_SUB_POLL, 0, QVector<quint8>() << 6);
+    QVERIFY(mApi->isPolled(6));
+
+    delete b;
+    QTRY_COMPARE(mApi->clientNum(), 1);
+    QVERIFY(!mApi->isPolled(6));
+
+    mApi->sendState(5, testState());
+    QTRY_COMPARE(a.count(NET_MSG_STATE), 1);
+}
+
+void TestNetApi::pollUnion()
+{
+    ApiTestClient a(mApi->serverPort());
+    ApiTestClient b(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 2);
+    QCOMPARE(mApi->pollIntervalMs(), -1);
+
+    QSignalSpy spy(mApi, SIGNAL(subscriptionsChanged()));
+    subscribe(a, NET_SUB_POLL, 100, QVector<quint8>() << 3);
+    subscribe(b, NET_SUB_POLL | NET_SUB_ALL_CARS, 30, QVector<quint8>() << 4);
+
+    QCOMPARE(spy.count(), 2);
+    QVERIFY(mApi->isPolled(3));
+    QVERIFY(mApi->isPolled(4));
+    QVERIFY(!mApi->isPolled(5));
+    QCOMPARE(mApi->pollIntervalMs(), 30);
+}
+
+void TestNetApi::stationEnuRef()
+{
+    ApiTestClient a(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 1);
+
+    QByteArray get(1, NET_MSG_GET_ENU_REF);
+    get.append((char)0);
+    get.append((char)1);
+
+    a.send(get);
+    QTRY_COMPARE(a.count(NET_MSG_ERROR), 1);
+
+    a.send(NetProtocol::encodeEnuRef(NET_MSG_SET_ENU_REF, 255, 57.5, 13.1, 204.6));
+    a.send(get);
+    QTRY_COMPARE(a.count(NET_MSG_ENU_REF), 1);
+
+    quint8 id;
+    double llh[3];
+    QVERIFY(NetProtocol::decodeEnuRef(a.rx.last(), id, llh[0], llh[1], llh[2]));
+    QCOMPARE(id, (quint8)255);
+    QVERIFY(fabs(llh[0] - 57.5) < 1e-9);
+    QVERIFY(fabs(llh[1] - 13.1) < 1e-9);
+    QVERIFY(fabs(llh[2] - 204.6) < 1e-3);
+}
+
+void TestNetApi::invalidLength()
+{
+    ApiTestClient a(mApi->serverPort());
+    QTRY_COMPARE(mApi->clientNum(), 1);
+
+    // Claims four ids but carries one
+    QByteArray sub = NetProtocol::encodeSubscribe(0, 0, QVector<quint8>() << 1);
+    sub[4] = 4;
+    a.send(sub);
+    a.send(QByteArray(1, NET_MSG_RC_CONTROL));
+
+    QTRY_COMPARE(a.count(NET_MSG_ERROR), 2);
+    QCOMPARE(a.count(NET_MSG_SUBSCRIBED), 0);
+}
+
+void TestNetApi::encodeBinary()
+{
+    CAR_STATE state = testState();
+    QByteArray data;
+
+    QBENCHMARK {
+        data = NetProtocol::encodeState(1, state);
+    }
+
+    qDebug() << "Binary state:" << data.size() << "bytes";
+}
+
+void TestNetApi::encodeXml()
+{
+    CAR_STATE state = testState();
+    QByteArray data;
+
+    QBENCHMARK {
+        data = xmlState(1, state);
+    }
+
+    qDebug() << "XML state:" << data.size() << "bytes";
+    QVERIFY(data.size() > 4 * NetProtocol::stateLength);
+}
+
+void TestNetApi::decodeBinary()
+{
+    QByteArray data = NetProtocol::encodeState(1, testState());
+    quint8 id;
+    CAR_STATE state;
+
+    QBENCHMARK {
+        NetProtocol::decodeState(data, id, state);
+    }
+
+    QVERIFY(fabs(state.px - testState().px) < 1e-3);
+}
+
+// The same parsing as NetworkInterface::processXml does for a message
+void TestNetApi::decodeXml()
+{
+    QByteArray data = xmlState(1, testState());
+    CAR_STATE state;
+    memset(&state, 0, sizeof(state));
+
+    QBENCHMARK {
+        QXmlStreamReader stream(data);
+        while (!stream.atEnd() && !stream.hasError()) {
+            if (stream.readNext() != QXmlStreamReader::StartElement) {
+                continue;
+            }
+
+            QStringRef name = stream.name();
+            if (name == "px") {
+                state.px = stream.readElementText().toDouble();
+            } else if (name == "py") {
+                state.py = stream.readElementText().toDouble();
+            } else if (name == "yaw") {
+                state.yaw = stream.readElementText().toDouble();
+            } else if (name == "speed") {
+                state.speed = stream.readElementText().toDouble();
+            }
+        }
+    }
+
+    QVERIFY(fabs(state.px - testState().px) < 1e-3);
+}
+
+QTEST_GUILESS_MAIN(TestNetApi)
+
+#include "tst_netapi.moc"
@@ -0,0 +1,28 @@
+QT       += core gui network testlib
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_netapi
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_netapi.cpp \
+    ../../netapi.cpp \
+    ../../netapiclient.cpp \
+    ../../netprotocol.cpp \
+    ../../packetinterface.cpp \
+    ../../packet.cpp \
+    ../../locpoint.cpp \
+    ../../mainconfigcodec.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../netapi.h \
+    ../../netapiclient.h \
+    ../../netprotocol.h \
+    ../../packetinterface.h \
+    ../../packet.h \
+    ../../locpoint.h \
+    ../../mainconfigcodec.h \
+    ../../utility.h
@@ -0,0 +1,382 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include "obsmonitor.h"
+
+namespace {
+const double gpsWavelength = 299792458.0 / 1575.42e6;
+
+// GPS satellites with a constant range rate, as seen by a receiver at 1 Hz.
+// The code has 0.3 m of noise and the carrier phase none. The events the
+// monitor should detect are made by changing the fields of a satellite
+// between epochs.
+class RawxSim
+{
+public:
+    typedef struct {
+        int svId;
+        double range;
+        double rate;
+        double lockStart;
+        double cpOffset;
+        double prBias;
+        bool halfCycValid;
+        bool halfCycSub;
+        bool visible;
+    } sim_sat_t;
+
+    RawxSim() : mGen(73), mNoise(0.0, 0.3) {
+        mTime = 0.0;
+        mClockOffset = 0.0;
+    }
+
+    void addSat(int svId, double range, double rate) {
+        sim_sat_t s;
+        s.svId = svId;
+        s.range = range;
+        s.rate = rate;
+        s.lockStart = mTime - 10.0;
+        s.cpOffset = 1000.5;
+        s.prBias = 0.0;
+        s.halfCycValid = true;
+        s.halfCycSub = true;
+        s.visible = true;
+        mSats.append(s);
+    }
+
+    sim_sat_t &sat(int svId) {
+        for (sim_sat_t &s: mSats) {
+            if (s.svId == svId) {
+                return s;
+            }
+        }
+
+        return mSats.first();
+    }
+
+    double time() const {
+        return mTime;
+    }
+
+    // A receiver clock reset of 1 ms moves the code and the phase
+    void clockReset() {
+        mClockOffset += 299792.458;
+    }
+
+    ubx_rxm_rawx next(bool clkReset = false) {
+        mTime += 1.0;
+
+        ubx_rxm_rawx rawx;
+        memset(&rawx, 0, sizeof(rawx));
+        rawx.rcv_tow = 100000.0 + mTime;
+        rawx.week = 2000;
+        rawx.clk_reset = clkReset;
+
+        for (const sim_sat_t &s: mSats) {
+            if (!s.visible) {
+                continue;
+            }
+
+            const double rho = s.range + s.rate * mTime + mClockOffset;
+            ubx_rxm_rawx_obs &o = rawx.obs[rawx.num_meas++];
+            o.gnss_id = 0;
+            o.sv_id = s.svId;
+            o.pr_mes = rho + s.prBias + mNoise(mGen);
+            o.cp_mes = rho / gpsWavelength + s.cpOffset;
+            o.do_mes = -s.rate / gpsWavelength;
+            o.locktime = qMin(64500, (int)((mTime - s.lockStart) * 1000.0));
+            o.cno = 45;
+            o.pr_valid = true;
+            o.cp_valid = true;
+            o.half_cyc_valid = s.halfCycValid;
+            o.half_cyc_sub = s.halfCycSub;
+        }
+
+        return rawx;
+    }
+
+private:
+    QList<sim_sat_t> mSats;
+    std::mt19937 mGen;
+    std::normal_distribution<double> mNoise;
+    double mTime;
+    double mClockOffset;
+};
+
+void addSats(RawxSim &sim)
+{
+    sim.addSat(2, 21.0e6, 350.0);
+    sim.addSat(5, 22.5e6, -610.0);
+    sim.addSat(13, 24.1e6, 120.0);
+    sim.addSat(29, 20.3e6, -45.0);
+}
+
+void run(ObsMonitor &mon, RawxSim &sim, int epochs)
+{
+    for (int i = 0;i < epochs;i++) {
+        mon.update(sim.next());
+    }
+}
+}
+
+class TestObsMonitor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lockIndicatorTable();
+    void cleanTrack();
+    void phaseJump();
+    void receiverLockReset();
+    void halfCycleChange();
+    void cmcJump();
+    void clockResetIgnored();
+    void satelliteGap();
+    void fixedTable();
+};
+
+// The boundaries of DF013/DF043
+void TestObsMonitor::lockIndicatorTable()
+{
+    const int table[][2] = {
+        {0, 0}, {23, 23}, {24, 24}, {71, 47}, {72, 48}, {167, 71}, {168, 72},
+        {359, 95}, {360, 96}, {743, 119}, {744, 120}, {936, 126}, {937, 127},
+        {100000, 127}
+    };
+
+    for (const auto &t: table) {
+        QCOMPARE(ObsMonitor::rtcmLockIndicator((double)t[0]), t[1]);
+    }
+
+    QCOMPARE(ObsMonitor::rtcmLockIndicator(-1.0), 0);
+    QCOMPARE(ObsMonitor::rtcmLockIndicator(23.9), 23);
+
+    int last = 0;
+    for (int t = 0;t < 1000;t++) {
+        int ind = ObsMonitor::rtcmLockIndicator((double)t);
+        QVERIFY(ind >= last);
+        last = ind;
+    }
+}
+
+/*
+ * Without events the lock time starts at the receiver lock time and grows
+ * with the epochs, also after the receiver lock time saturates at 64.5 s.
+ */
+void TestObsMonitor::cleanTrack()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+
+    for (int i = 1;i <= 1000;i++) {
+        mon.update(sim.next());
+        QVERIFY(fabs(mon.lockTime(0, 5) - (10.0 + i)) < 1e-3);
+    }
+
+    QCOMPARE(mon.slipsTotal(), 0);
+    QCOMPARE(mon.lockIndicator(0, 2), 127);
+    QCOMPARE(mon.lockIndicator(0, 29), 127);
+
+    QString summary = mon.healthSummary();
+    QVERIFY2(summary.contains("GPS: 4 sats"), qPrintable(summary));
+    QVERIFY2(summary.contains("locked > 937 s: 4"), qPrintable(summary));
+    QVERIFY2(!summary.contains("Weak or slipping"), qPrintable(summary));
+}
+
+// The phase jumps 5 cycles while the receiver keeps its lock time
+void TestObsMonitor::phaseJump()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 100);
+
+    sim.sat(5).cpOffset += 5.0;
+    mon.update(sim.next());
+
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 5)) < 1e-3);
+    QCOMPARE(mon.lockIndicator(0, 5), 0);
+    QVERIFY(fabs(mon.lockTime(0, 2) - 111.0) < 1e-3);
+
+    run(mon, sim, 30);
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 5) - 30.0) < 1e-3);
+    QCOMPARE(mon.lockIndicator(0, 5), ObsMonitor::rtcmLockIndicator(30.0));
+
+    QString summary = mon.healthSummary();
+    QVERIFY2(summary.contains("G05"), qPrintable(summary));
+    QVERIFY2(!summary.contains("G02"), qPrintable(summary));
+}
+
+// The receiver restarts its lock, the phase stays consistent
+void TestObsMonitor::receiverLockReset()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 100);
+
+    sim.sat(13).lockStart = sim.time() + 1.0 - 0.2;
+    mon.update(sim.next());
+
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 13) - 0.2) < 1e-3);
+
+    run(mon, sim, 20);
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 13) - 20.2) < 1e-3);
+}
+
+void TestObsMonitor::halfCycleChange()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 50);
+
+    // An invalid half cycle flag is not a change
+    sim.sat(29).halfCycValid = false;
+    run(mon, sim, 1);
+    sim.sat(29).halfCycValid = true;
+    run(mon, sim, 49);
+    QCOMPARE(mon.slipsTotal(), 0);
+
+    sim.sat(29).halfCycSub = false;
+    mon.update(sim.next());
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 29)) < 1e-3);
+}
+
+/*
+ * The code jumps 30 m against the carrier, with the phase and the Doppler
+ * consistent. The filter starts over from the new level after the slip.
+ */
+void TestObsMonitor::cmcJump()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 100);
+
+    sim.sat(2).prBias = 30.0;
+    mon.update(sim.next());
+    QCOMPARE(mon.slipsTotal(), 1);
+    QVERIFY(fabs(mon.lockTime(0, 2)) < 1e-3);
+
+    run(mon, sim, 200);
+    QCOMPARE(mon.slipsTotal(), 1);
+}
+
+// A receiver clock reset moves the phase by many cycles, but it is no slip
+void TestObsMonitor::clockResetIgnored()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 100);
+
+    sim.clockReset();
+    mon.update(sim.next(true));
+    run(mon, sim, 10);
+
+    QCOMPARE(mon.slipsTotal(), 0);
+    QVERIFY(fabs(mon.lockTime(0, 5) - 121.0) < 1e-3);
+}
+
+/*
+ * A satellite that is gone for more than 30 s starts over from the receiver
+ * lock time. While it is gone it has no lock.
+ */
+void TestObsMonitor::satelliteGap()
+{
+    ObsMonitor mon;
+    RawxSim sim;
+    addSats(sim);
+    run(mon, sim, 100);
+
+    sim.sat(13).visible = false;
+    run(mon, sim, 40);
+    QCOMPARE(mon.lockTime(0, 13), -1.0);
+    QCOMPARE(mon.lockIndicator(0, 13), 0);
+
+    sim.sat(13).visible = true;
+    sim.sat(13).lockStart = sim.time() + 1.0 - 5.0;
+    sim.sat(13).cpOffset += 1234.0;
+    mon.update(sim.next());
+
+    QCOMPARE(mon.slipsTotal(), 0);
+    QVERIFY(fabs(mon.lockTime(0, 13) - 5.0) < 1e-3);
+}
+
+/*
+ * Every GNSS id and SV id in the table can be tracked, and ids outside of it
+ * are skipped.
+ */
+void TestObsMonitor::fixedTable()
+{
+    ObsMonitor mon;
+
+    for (int e = 1;e <= 3;e++) {
+        ubx_rxm_rawx rawx;
+        memset(&rawx, 0, sizeof(rawx));
+        rawx.rcv_tow = 1000.0 + e;
+        rawx.week = 2000;
+
+        for (int i = 0;i < 64;i++) {
+            ubx_rxm_rawx_obs &o = rawx.obs[rawx.num_meas++];
+            o.gnss_id = i % 8;
+            o.sv_id = i == 63 ? 255 : (i * 7) % 64;
+            o.pr_mes = 2.0e7 + 100.0 * i;
+            o.cp_mes = o.pr_mes / gpsWavelength;
+            o.locktime = 3000 + e * 1000;
+            o.cno = 40;
+            o.pr_valid = true;
+            o.cp_valid = true;
+        }
+
+        mon.update(rawx);
+    }
+
+    for (int i = 0;i < 63;i++) {
+        const int gnssId = i % 8;
+        const int svId = (i * 7) % 64;
+
+        if (gnssId < 7) {
+            QVERIFY(fabs(mon.lockTime(gnssId, svId) - 6.0) < 1e-3);
+        } else {
+            QCOMPARE(mon.lockTime(gnssId, svId), -1.0);
+        }
+    }
+
+    QCOMPARE(mon.lockTime(0, 64), -1.0);
+    QCOMPARE(mon.lockTime(-1, 0), -1.0);
+    QCOMPARE(mon.slipsTotal(), 0);
+
+    mon.reset();
+    QCOMPARE(mon.lockTime(0, 0), -1.0);
+    QCOMPARE(mon.healthSummary(), QString("No observations\nCycle slips: 0 sats last minute, 0 total"));
+}
+
+QTEST_GUILESS_MAIN(TestObsMonitor)
+
+#include "tst_obsmonitor.moc"
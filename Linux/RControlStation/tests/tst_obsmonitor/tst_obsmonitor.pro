@@ -0,0 +1,16 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_obsmonitor
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_obsmonitor.cpp \
+    ../../obsmonitor.cpp
+
+HEADERS += ../../obsmonitor.h \
+    ../../datatypes.h
@@ -0,0 +1,142 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include "packetinterface.h"
+#include "utility.h"
+
+class TestPacketInterface : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void decodeStats();
+    void decodeStatsTruncated();
+    void decodeStatsUnterminatedName();
+    void decodeStatsLargeCounts();
+
+private:
+    QByteArray statsPacket();
+};
+
+// The CMD_GET_STATS payload in the same layout as stats_serialize in stats.c
+QByteArray TestPacketInterface::statsPacket()
+{
+    uint8_t buffer[512];
+    int32_t ind = 0;
+
+    utility::buffer_append_uint32(buffer, 123456, &ind);
+    utility::buffer_append_uint32(buffer, 7890, &ind);
+
+    buffer[ind++] = 2;
+    utility::buffer_append_uint16(buffer, 10, &ind);
+    utility::buffer_append_uint16(buffer, 63, &ind);
+    utility::buffer_append_uint32(buffer, 0, &ind);
+    utility::buffer_append_uint16(buffer, 3, &ind);
+    utility::buffer_append_uint16(buffer, 31, &ind);
+    utility::buffer_append_uint32(buffer, 17, &ind);
+
+    buffer[ind++] = 2;
+    strcpy((char*)buffer + ind, "main");
+    ind += 5;
+    utility::buffer_append_double32_auto(buffer, 0.25, &ind);
+    strcpy((char*)buffer + ind, "ublox process");
+    ind += 14;
+    utility::buffer_append_double32_auto(buffer, 0.5, &ind);
+
+    buffer[ind++] = 1;
+    buffer[ind++] = 42;
+    utility::buffer_append_uint32(buffer, 1000, &ind);
+    utility::buffer_append_double32_auto(buffer, 12.5, &ind);
+    utility::buffer_append_double32_auto(buffer, 80.0, &ind);
+
+    return QByteArray((const char*)buffer, ind);
+}
+
+void TestPacketInterface::decodeStats()
+{
+    QByteArray pkt = statsPacket();
+    FW_STATS stats;
+
+    QVERIFY(PacketInterface::decodeStats((const unsigned char*)pkt.constData(),
+                                         pkt.size(), stats));
+    QCOMPARE(stats.uptime_ms, (uint32_t)123456);
+    QCOMPARE(stats.rtcm_bytes, (uint32_t)7890);
+    QCOMPARE(stats.queue_num, 2);
+    QCOMPARE(stats.queue_hwm[1], (uint16_t)3);
+    QCOMPARE(stats.queue_size[1], (uint16_t)31);
+    QCOMPARE(stats.queue_overflows[0], (uint32_t)0);
+    QCOMPARE(stats.queue_overflows[1], (uint32_t)17);
+    QCOMPARE(stats.thread_num, 2);
+    QCOMPARE(QString(stats.threads[1].name), QString("ublox process"));
+    QCOMPARE(stats.threads[1].load, 0.5f);
+    QCOMPARE(stats.cmd_num, 1);
+    QCOMPARE((int)stats.cmds[0].cmd, 42);
+    QCOMPARE(stats.cmds[0].count, (uint32_t)1000);
+    QCOMPARE(stats.cmds[0].time_max_us, 80.0f);
+}
+
+// Every truncation of a valid packet must be rejected
+void TestPacketInterface::decodeStatsTruncated()
+{
+    QByteArray pkt = statsPacket();
+
+    for (int len = 0;len < pkt.size();len++) {
+        // Copy to a buffer of the exact length so that ASan catches overreads
+        QScopedArrayPointer<unsigned char> buf(new unsigned char[len + 1]);
+        memcpy(buf.data(), pkt.constData(), len);
+        FW_STATS stats;
+        QVERIFY2(!PacketInterface::decodeStats(buf.data(), len, stats),
+                 qPrintable(QString("Accepted a packet truncated to %1 bytes").arg(len)));
+    }
+}
+
+void TestPacketInterface::decodeStatsUnterminatedName()
+{
+    QByteArray pkt = statsPacket();
+
+    // Cut the packet in the middle of the second thread name
+    int nameStart = pkt.indexOf("ublox");
+    QVERIFY(nameStart > 0);
+    pkt.truncate(nameStart + 3);
+
+    FW_STATS stats;
+    QVERIFY(!PacketInterface::decodeStats((const unsigned char*)pkt.constData(),
+                                          pkt.size(), stats));
+}
+
+// Counts that do not fit in the packet must not be trusted
+void TestPacketInterface::decodeStatsLargeCounts()
+{
+    QByteArray pkt = statsPacket();
+    FW_STATS stats;
+
+    QByteArray bad = pkt;
+    bad[8] = (char)255;
+    QVERIFY(!PacketInterface::decodeStats((const unsigned char*)bad.constData(),
+                                          bad.size(), stats));
+
+    bad = pkt;
+    bad[bad.size() - 14] = (char)255;
+    QVERIFY(!PacketInterface::decodeStats((const unsigned char*)bad.constData(),
+                                          bad.size(), stats));
+    QCOMPARE(stats.cmd_num, 0);
+}
+
+QTEST_GUILESS_MAIN(TestPacketInterface)
+
+#include "tst_packetinterface.moc"
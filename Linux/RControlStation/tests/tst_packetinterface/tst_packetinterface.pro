@@ -0,0 +1,22 @@
+QT       += core gui network testlib
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_packetinterface
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_packetinterface.cpp \
+    ../../packetinterface.cpp \
+    ../../packet.cpp \
+    ../../locpoint.cpp \
+    ../../mainconfigcodec.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../packetinterface.h \
+    ../../packet.h \
+    ../../locpoint.h \
+    ../../mainconfigcodec.h \
+    ../../utility.h
@@ -0,0 +1,342 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <random>
+#include <cmath>
+#include "routeconflicts.h"
+
+namespace {
+LocPoint timedPoint(double x, double y, qint32 time)
+{
+    LocPoint p(x, y);
+    p.setTime(time);
+    return p;
+}
+
+// A car driving around in a square area with a slowly changing heading,
+// one point every 200 ms.
+QList<LocPoint> randomRoute(std::mt19937 &gen, int points, double size, double speed)
+{
+    std::uniform_real_distribution<double> pos(0.0, size);
+    std::uniform_real_distribution<double> dir(0.0, 2.0 * M_PI);
+    std::normal_distribution<double> turn(0.0, 0.1);
+
+    QList<LocPoint> route;
+    double x = pos(gen);
+    double y = pos(gen);
+    double heading = dir(gen);
+    const qint32 dtMs = 200;
+
+    for (int i = 0;i < points;i++) {
+        route.append(timedPoint(x, y, i * dtMs));
+
+        heading += turn(gen);
+        x += cos(heading) * speed * (double)dtMs / 1000.0;
+        y += sin(heading) * speed * (double)dtMs / 1000.0;
+
+        // Bounce off the edges
+        if (x < 0.0 || x > size) {
+            heading = M_PI - heading;
+            x = qBound(0.0, x, size);
+        }
+
+        if (y < 0.0 || y > size) {
+            heading = -heading;
+            y = qBound(0.0, y, size);
+        }
+    }
+
+    return route;
+}
+
+// Closest approach between two timed segments over their common time, the
+// same model as RouteConflicts but without the space-time hash.
+bool segmentsConflict(const LocPoint &a0, const LocPoint &a1,
+                      const LocPoint &b0, const LocPoint &b1, double radius)
+{
+    if (a1.getTime() <= a0.getTime() || b1.getTime() <= b0.getTime()) {
+        return false;
+    }
+
+    const qint32 t0 = qMax(a0.getTime(), b0.getTime());
+    const qint32 t1 = qMin(a1.getTime(), b1.getTime());
+
+    if (t1 < t0) {
+        return false;
+    }
+
+    const double avx = (a1.getX() - a0.getX()) / (double)(a1.getTime() - a0.getTime());
+    const double avy = (a1.getY() - a0.getY()) / (double)(a1.getTime() - a0.getTime());
+    const double bvx = (b1.getX() - b0.getX()) / (double)(b1.getTime() - b0.getTime());
+    const double bvy = (b1.getY() - b0.getY()) / (double)(b1.getTime() - b0.getTime());
+
+    const double dx = (b0.getX() + bvx * (double)(t0 - b0.getTime())) -
+            (a0.getX() + avx * (double)(t0 - a0.getTime()));
+    const double dy = (b0.getY() + bvy * (double)(t0 - b0.getTime())) -
+            (a0.getY() + avy * (double)(t0 - a0.getTime()));
+    const double dvx = bvx - avx;
+    const double dvy = bvy - avy;
+    const double dv2 = dvx * dvx + dvy * dvy;
+
+    double tau = 0.0;
+    if (dv2 > 1e-12) {
+        tau = qBound(0.0, -(dx * dvx + dy * dvy) / dv2, (double)(t1 - t0));
+    }
+
+    const double cx = dx + dvx * tau;
+    const double cy = dy + dvy * tau;
+
+    return sqrt(cx * cx + cy * cy) < radius;
+}
+
+int bruteForceConflicts(const QList<QList<LocPoint> > &routes, double radius)
+{
+    int res = 0;
+
+    for (int ra = 0;ra < routes.size();ra++) {
+        for (int rb = ra + 1;rb < routes.size();rb++) {
+            const QList<LocPoint> &a = routes.at(ra);
+            const QList<LocPoint> &b = routes.at(rb);
+
+            for (int i = 1;i < a.size();i++) {
+                for (int j = 1;j < b.size();j++) {
+                    if (segmentsConflict(a.at(i - 1), a.at(i), b.at(j - 1), b.at(j), radius)) {
+                        res++;
+                    }
+                }
+            }
+        }
+    }
+
+    return res;
+}
+}
+
+class TestRouteConflicts : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestRouteConflicts();
+
+private slots:
+    void crossing();
+    void conflictListUpdated();
+    void matchesBruteForce();
+    void benchmarkIndex();
+    void benchmarkMovePoint();
+    void benchmarkGetConflicts();
+
+private:
+    QList<QList<LocPoint> > mFleet;
+    RouteConflicts *mFleetConflicts;
+    RouteConflicts *fleetConflicts();
+
+};
+
+TestRouteConflicts::TestRouteConflicts()
+{
+    mFleetConflicts = 0;
+}
+
+/*
+ * 50 cars with 10000 points each, 2000 s of driving in a 1 km square. The
+ * index is built once and shared by the move and get benchmarks.
+ */
+RouteConflicts *TestRouteConflicts::fleetConflicts()
+{
+    if (!mFleetConflicts) {
+        std::mt19937 gen(53);
+        for (int i = 0;i < 50;i++) {
+            mFleet.append(randomRoute(gen, 10000, 1000.0, 2.0));
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        mFleetConflicts = new RouteConflicts(this);
+        for (int i = 0;i < mFleet.size();i++) {
+            mFleetConflicts->updateRoute(i, mFleet.at(i));
+        }
+
+        qDebug() << "50 x 10000 points indexed in" << timer.elapsed() << "ms," <<
+                    mFleetConflicts->getConflictNum() << "conflicts";
+    }
+
+    return mFleetConflicts;
+}
+
+void TestRouteConflicts::crossing()
+{
+    RouteConflicts rc;
+    rc.setRadius(2.0);
+
+    // Two cars crossing the origin at t = 5 s
+    QList<LocPoint> a;
+    a.append(timedPoint(-10.0, 0.0, 0));
+    a.append(timedPoint(10.0, 0.0, 10000));
+
+    QList<LocPoint> b;
+    b.append(timedPoint(0.0, -10.0, 0));
+    b.append(timedPoint(0.0, 10.0, 10000));
+
+    rc.updateRoute(0, a);
+    rc.updateRoute(1, b);
+
+    QCOMPARE(rc.getConflictNum(), 1);
+    QVERIFY(rc.isSegmentInConflict(0, 0));
+    QVERIFY(rc.isSegmentInConflict(1, 0));
+
+    QList<RouteConflicts::conflict_t> conflicts = rc.getConflicts();
+    QCOMPARE(conflicts.size(), 1);
+    QVERIFY(fabs(conflicts.first().x) < 1e-6);
+    QVERIFY(fabs(conflicts.first().y) < 1e-6);
+    QVERIFY(qAbs(conflicts.first().time - 5000) <= 1);
+    QVERIFY(conflicts.first().dist < 1e-6);
+
+    // Same path 10 s later, the first car is gone
+    b[0].setTime(10000);
+    b[1].setTime(20000);
+    rc.updateRoute(1, b);
+    QCOMPARE(rc.getConflictNum(), 0);
+    QVERIFY(!rc.isSegmentInConflict(0, 0));
+}
+
+/*
+ * The conflict list is cached between calls, so it has to follow moved
+ * points, added points, a new radius and clear.
+ */
+void TestRouteConflicts::conflictListUpdated()
+{
+    RouteConflicts rc;
+    rc.setRadius(2.0);
+
+    QList<LocPoint> a;
+    a.append(timedPoint(0.0, 0.0, 0));
+    a.append(timedPoint(20.0, 0.0, 10000));
+
+    QList<LocPoint> b;
+    b.append(timedPoint(0.0, 3.0, 0));
+    b.append(timedPoint(20.0, 3.0, 10000));
+
+    rc.updateRoute(0, a);
+    rc.updateRoute(1, b);
+    QCOMPARE(rc.getConflicts().size(), 0);
+
+    // Move the end closer
+    b[1].setY(0.5);
+    rc.updateRoute(1, b);
+    QCOMPARE(rc.getConflicts().size(), 1);
+    QCOMPARE(rc.getConflicts().first().segB + rc.getConflicts().first().segA, 0);
+
+    // A point added, two segments that both conflict
+    b.insert(1, timedPoint(10.0, 0.5, 5000));
+    rc.updateRoute(1, b);
+    QCOMPARE(rc.getConflicts().size(), 2);
+    QCOMPARE(rc.getConflictNum(), 2);
+
+    rc.setRadius(0.1);
+    QCOMPARE(rc.getConflicts().size(), 0);
+
+    rc.setRadius(2.0);
+    QCOMPARE(rc.getConflicts().size(), 2);
+
+    rc.clear();
+    QCOMPARE(rc.getConflicts().size(), 0);
+    QCOMPARE(rc.getConflictNum(), 0);
+}
+
+/*
+ * Random routes in a small area checked against all segment pairs, after
+ * building the index and after moving points around.
+ */
+void TestRouteConflicts::matchesBruteForce()
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> move(-3.0, 3.0);
+    QList<QList<LocPoint> > routes;
+    RouteConflicts rc;
+    rc.setRadius(1.5);
+
+    for (int i = 0;i < 6;i++) {
+        routes.append(randomRoute(gen, 500, 30.0, 1.5));
+        rc.updateRoute(i, routes.last());
+    }
+
+    const int expected = bruteForceConflicts(routes, 1.5);
+    QVERIFY(expected > 0);
+    QCOMPARE(rc.getConflictNum(), expected);
+    QCOMPARE(rc.getConflicts().size(), expected);
+
+    for (int i = 0;i < 200;i++) {
+        const int r = gen() % routes.size();
+        LocPoint &p = routes[r][gen() % routes.at(r).size()];
+        p.setXY(p.getX() + move(gen), p.getY() + move(gen));
+        rc.updateRoute(r, routes.at(r));
+    }
+
+    const int expectedMoved = bruteForceConflicts(routes, 1.5);
+    QCOMPARE(rc.getConflictNum(), expectedMoved);
+    QCOMPARE(rc.getConflicts().size(), expectedMoved);
+}
+
+void TestRouteConflicts::benchmarkIndex()
+{
+    fleetConflicts();
+
+    QBENCHMARK_ONCE {
+        RouteConflicts rc;
+        for (int i = 0;i < mFleet.size();i++) {
+            rc.updateRoute(i, mFleet.at(i));
+        }
+    }
+}
+
+// Dragging a point on one route, what the map does on every mouse move
+void TestRouteConflicts::benchmarkMovePoint()
+{
+    RouteConflicts *rc = fleetConflicts();
+    QList<LocPoint> route = mFleet.at(17);
+    const double x = route.at(5000).getX();
+    int step = 0;
+
+    QBENCHMARK {
+        route[5000].setX(x + (double)(step++ % 10) * 0.5);
+        rc->updateRoute(17, route);
+    }
+
+    rc->updateRoute(17, mFleet.at(17));
+}
+
+// The map asks for the conflicts on every repaint
+void TestRouteConflicts::benchmarkGetConflicts()
+{
+    RouteConflicts *rc = fleetConflicts();
+    int num = 0;
+
+    QBENCHMARK {
+        num = rc->getConflicts().size();
+    }
+
+    QCOMPARE(num, rc->getConflictNum());
+}
+
+QTEST_GUILESS_MAIN(TestRouteConflicts)
+
+#include "tst_routeconflicts.moc"
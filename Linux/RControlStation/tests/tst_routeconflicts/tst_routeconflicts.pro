@@ -0,0 +1,16 @@
+QT       += core gui testlib
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_routeconflicts
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_routeconflicts.cpp \
+    ../../routeconflicts.cpp \
+    ../../locpoint.cpp
+
+HEADERS += ../../routeconflicts.h \
+    ../../locpoint.h
@@ -0,0 +1,454 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <cstring>
+#include "rtcmsourcemanager.h"
+#include "rtcmclient.h"
+#include "rtcm3_simple.h"
+
+namespace {
+// Epochs are 100 ms apart, at the same GPS time for all stations
+const int epochMs = 100;
+QElapsedTimer towClock;
+
+int towNow()
+{
+    if (!towClock.isValid()) {
+        towClock.start();
+    }
+
+    return 100000000 + (int)(towClock.elapsed() / epochMs) * epochMs;
+}
+
+// GPS observations of one epoch in a single 1002 message
+QByteArray rtcmObs(int staid, int towMs, bool sync = false)
+{
+    rtcm_obs_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.staid = staid;
+    header.t_wn = 1970;
+    header.t_tow = (double)towMs / 1000.0;
+    header.sync = sync;
+
+    rtcm_obs_t obs[4];
+    memset(obs, 0, sizeof(obs));
+
+    for (int i = 0;i < 4;i++) {
+        obs[i].P[0] = 2.1e7 + (double)i * 1e5;
+        obs[i].L[0] = obs[i].P[0] / 0.190293672798365;
+        obs[i].cn0[0] = 45;
+        obs[i].lock[0] = 127;
+        obs[i].code[0] = CODE_L1C;
+        obs[i].prn = i + 1;
+    }
+
+    uint8_t buffer[512];
+    int len = 0;
+    rtcm3_encode_1002(&header, obs, 4, buffer, &len);
+    return QByteArray((char*)buffer, len);
+}
+
+// GLONASS observations in a 1010 message, the last one of the epoch
+QByteArray rtcmObsGlo(int staid, int towMs)
+{
+    rtcm_obs_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.staid = staid;
+    header.t_tod = (double)((towMs + 10782000) % 86400000) / 1000.0;
+    header.sync = false;
+
+    rtcm_obs_t obs[3];
+    memset(obs, 0, sizeof(obs));
+
+    for (int i = 0;i < 3;i++) {
+        obs[i].P[0] = 1.9e7 + (double)i * 1e5;
+        obs[i].L[0] = obs[i].P[0] / 0.187;
+        obs[i].cn0[0] = 42;
+        obs[i].lock[0] = 127;
+        obs[i].code[0] = CODE_L1C;
+        obs[i].prn = i + 1;
+        obs[i].freq = 7 + i;
+    }
+
+    uint8_t buffer[512];
+    int len = 0;
+    rtcm3_encode_1010(&header, obs, 3, buffer, &len);
+    return QByteArray((char*)buffer, len);
+}
+
+QByteArray rtcmRef(int staid)
+{
+    rtcm_ref_sta_pos_t pos;
+    pos.staid = staid;
+    pos.lat = 57.71;
+    pos.lon = 12.89;
+    pos.height = 220.0;
+    pos.ant_height = 0.0;
+
+    uint8_t buffer[64];
+    int len = 0;
+    rtcm3_encode_1006(pos, buffer, &len);
+    return QByteArray((char*)buffer, len);
+}
+
+unsigned int getbitu(const unsigned char *buff, int pos, int len)
+{
+    unsigned int bits = 0;
+    for (int i = pos;i < pos + len;i++) {
+        bits = (bits << 1) + ((buff[i / 8] >> (7 - i % 8)) & 1u);
+    }
+    return bits;
+}
+
+typedef struct {
+    int type;
+    int staid;
+    int tow;
+    bool sync;
+} frame_info_t;
+
+// The frames in the output of the manager
+QList<frame_info_t> parseFrames(const QByteArray &data)
+{
+    QList<frame_info_t> res;
+    int ind = 0;
+
+    while ((ind + 6) <= data.size()) {
+        const unsigned char *p = (const unsigned char*)data.constData() + ind;
+        frame_info_t f;
+        f.type = getbitu(p, 24, 12);
+        f.staid = getbitu(p, 36, 12);
+        f.tow = f.type == 1002 ? (int)getbitu(p, 48, 30) : -1;
+        f.sync = f.type == 1002 ? getbitu(p, 78, 1) : (f.type == 1010 ? getbitu(p, 75, 1) : false);
+        res.append(f);
+        ind += (((p[1] & 0x03) << 8) | p[2]) + 6;
+    }
+
+    return res;
+}
+}
+
+/*
+ * An NTRIP caster with one station. After the request from a client it
+ * sends the reference position every ten epochs and GPS (1002, more
+ * messages follow) and GLONASS (1010) observations every epoch.
+ */
+class NtripStandIn : public QObject
+{
+    Q_OBJECT
+
+public:
+    NtripStandIn(int staid, QObject *parent = 0) : QObject(parent) {
+        mStaid = staid;
+        mSocket = 0;
+        mStreaming = true;
+        mStall = false;
+        mStalledTow = -1;
+        mLastTow = -1;
+        mEpochs = 0;
+        mServer = new QTcpServer(this);
+        mTimer = new QTimer(this);
+
+        connect(mServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
+        connect(mTimer, SIGNAL(timeout()), this, SLOT(timerSlot()));
+        mTimer->start(epochMs);
+    }
+
+    bool listen() {
+        return mServer->listen(QHostAddress::LocalHost);
+    }
+
+    int port() const {
+        return mServer->serverPort();
+    }
+
+    void setStreaming(bool streaming) {
+        mStreaming = streaming;
+    }
+
+    // Send the GPS message of the next epoch and then nothing
+    void stallMidEpoch() {
+        mStall = true;
+    }
+
+    void resume() {
+        mStall = false;
+        mStalledTow = -1;
+    }
+
+    int stalledTow() const {
+        return mStalledTow;
+    }
+
+private slots:
+    void newConnection() {
+        mSocket = mServer->nextPendingConnection();
+        connect(mSocket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+    }
+
+    void readRequest() {
+        mRequest.append(mSocket->readAll());
+        if (mRequest.contains("\r\n\r\n") && mRequest.startsWith("GET /")) {
+            mSocket->write("ICY 200 OK\r\n\r\n");
+        }
+    }
+
+    void timerSlot() {
+        if (!mSocket || !mRequest.contains("\r\n\r\n") || !mStreaming ||
+                mStalledTow >= 0) {
+            return;
+        }
+
+        const int tow = qMax(towNow(), mLastTow + epochMs);
+        mLastTow = tow;
+
+        if (mEpochs++ % 10 == 0) {
+            mSocket->write(rtcmRef(mStaid));
+        }
+
+        mSocket->write(rtcmObs(mStaid, tow, true));
+
+        if (mStall) {
+            mStalledTow = tow;
+            return;
+        }
+
+        mSocket->write(rtcmObsGlo(mStaid, tow));
+    }
+
+private:
+    QTcpServer *mServer;
+    QTcpSocket *mSocket;
+    QTimer *mTimer;
+    QByteArray mRequest;
+    int mStaid;
+    bool mStreaming;
+    bool mStall;
+    int mStalledTow;
+    int mLastTow;
+    int mEpochs;
+
+};
+
+class TestRtcmSourceManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void forwardsEpochs();
+    void corruptFramesDropped();
+    void noHealthySourceStops();
+    void switchNtripSources();
+
+private:
+    RtcmSourceManager *mSources;
+    int mSource;
+    QSignalSpy *mOut;
+
+    QByteArray output();
+};
+
+void TestRtcmSourceManager::init()
+{
+    mSources = new RtcmSourceManager;
+    mSource = mSources->addSource("test", RtcmSourceManager::RTCM_SOURCE_TCP);
+    mOut = new QSignalSpy(mSources, SIGNAL(rtcmOut(QByteArray)));
+
+    mSources->rtcmInput(mSource, rtcmRef(3) + rtcmObs(3, 1000));
+    QTRY_COMPARE(mSources->activeSource(), mSource);
+}
+
+void TestRtcmSourceManager::cleanup()
+{
+    delete mOut;
+    delete mSources;
+}
+
+QByteArray TestRtcmSourceManager::output()
+{
+    QByteArray res;
+    for (QList<QVariant> args: *mOut) {
+        res.append(args.at(0).toByteArray());
+    }
+    return res;
+}
+
+void TestRtcmSourceManager::forwardsEpochs()
+{
+    QByteArray ref = rtcmRef(3);
+    QByteArray obs = rtcmObs(3, 2000);
+
+    // Split in the middle of the frame
+    mSources->rtcmInput(mSource, obs.left(7));
+    mSources->rtcmInput(mSource, obs.mid(7));
+
+    QCOMPARE(output(), ref + obs);
+}
+
+// A frame with a bad CRC is dropped, and a false preamble in front of a
+// frame does not hide it
+void TestRtcmSourceManager::corruptFramesDropped()
+{
+    QByteArray ref = rtcmRef(3);
+    QByteArray bad = rtcmObs(3, 2000);
+    bad[10] = bad[10] ^ 0x10;
+    QByteArray obs = rtcmObs(3, 3000);
+
+    QByteArray data;
+    data.append(bad);
+    data.append((char)0xD3);
+    data.append((char)0x00);
+    data.append((char)0x04);
+    data.append(obs);
+
+    mSources->rtcmInput(mSource, data);
+
+    QCOMPARE(output(), ref + obs);
+}
+
+// Without a healthy source nothing is forwarded, not even the messages
+// that are not observations
+void TestRtcmSourceManager::noHealthySourceStops()
+{
+    QSignalSpy switched(mSources, SIGNAL(sourceSwitched(int,int,QString)));
+    mSources->setMaxObsAge(200);
+
+    QTRY_COMPARE(mSources->activeSource(), -1);
+    QCOMPARE(switched.count(), 1);
+    QCOMPARE(switched.at(0).at(0).toInt(), mSource);
+    QCOMPARE(switched.at(0).at(1).toInt(), -1);
+
+    int outNum = mOut->count();
+    mSources->rtcmInput(mSource, rtcmRef(3));
+    QCOMPARE(mOut->count(), outNum);
+
+    // Back when the source recovers
+    mSources->rtcmInput(mSource, rtcmObs(3, 5000));
+    QTRY_COMPARE(mSources->activeSource(), mSource);
+}
+
+/*
+ * Two NTRIP casters with different stations, received with RtcmClient as in
+ * RtcmWidget. The first one stalls in the middle of an epoch, so the manager
+ * fails over to the second one and returns when the first one has been
+ * healthy for the holdoff time. The output must never have a partial epoch,
+ * stations mixed within an epoch or observations of a station before its
+ * reference position.
+ */
+void TestRtcmSourceManager::switchNtripSources()
+{
+    const int staA = 10;
+    const int staB = 20;
+
+    NtripStandIn casterA(staA);
+    NtripStandIn casterB(staB);
+    QVERIFY(casterA.listen());
+    QVERIFY(casterB.listen());
+    casterB.setStreaming(false);
+
+    RtcmClient clientA;
+    RtcmClient clientB;
+    RtcmSourceManager sources;
+    sources.setMaxObsAge(500);
+    QSignalSpy out(&sources, SIGNAL(rtcmOut(QByteArray)));
+
+    const int a = sources.addSource("A", RtcmSourceManager::RTCM_SOURCE_NTRIP, &clientA,
+                                    SIGNAL(rtcmReceived(QByteArray,int,bool)));
+    const int b = sources.addSource("B", RtcmSourceManager::RTCM_SOURCE_NTRIP, &clientB,
+                                    SIGNAL(rtcmReceived(QByteArray,int,bool)));
+
+    clientA.connectNtrip("127.0.0.1", "A", "", "", casterA.port());
+    clientB.connectNtrip("127.0.0.1", "B", "", "", casterB.port());
+
+    QTRY_COMPARE(sources.activeSource(), a);
+    casterB.setStreaming(true);
+    QTest::qWait(1000);
+
+    casterA.stallMidEpoch();
+    QTRY_COMPARE(sources.activeSource(), b);
+    QVERIFY(casterA.stalledTow() >= 0);
+    const int stalledTow = casterA.stalledTow();
+    QTest::qWait(1000);
+
+    casterA.resume();
+    QTRY_COMPARE_WITH_TIMEOUT(sources.activeSource(), a, 20000);
+    QTest::qWait(1000);
+
+    QList<RtcmSourceManager::switch_event_t> events = sources.switchEvents();
+    QCOMPARE(events.size(), 3);
+    QCOMPARE(events.at(0).from, -1);
+    QCOMPARE(events.at(0).to, a);
+    QCOMPARE(events.at(1).from, a);
+    QCOMPARE(events.at(1).to, b);
+    QVERIFY2(events.at(1).reason.startsWith("A: no observations"), qPrintable(events.at(1).reason));
+    QCOMPARE(events.at(2).from, b);
+    QCOMPARE(events.at(2).to, a);
+    QVERIFY2(events.at(2).reason.startsWith("higher priority"), qPrintable(events.at(2).reason));
+
+    QByteArray data;
+    for (QList<QVariant> args: out) {
+        data.append(args.at(0).toByteArray());
+    }
+
+    int refSta = -1;
+    int epochSta = -1;
+    int lastTow = -1;
+    QList<int> stations;
+
+    for (const frame_info_t &f: parseFrames(data)) {
+        if (f.type == 1006) {
+            QCOMPARE(epochSta, -1);
+            refSta = f.staid;
+            continue;
+        }
+
+        QVERIFY(f.type == 1002 || f.type == 1010);
+        QCOMPARE(f.staid, refSta);
+
+        if (epochSta < 0) {
+            epochSta = f.staid;
+            if (stations.isEmpty() || stations.last() != f.staid) {
+                stations.append(f.staid);
+            }
+        }
+
+        QCOMPARE(f.staid, epochSta);
+
+        if (f.type == 1002) {
+            QVERIFY(f.tow > lastTow);
+            QVERIFY(f.staid != staA || f.tow != stalledTow);
+            lastTow = f.tow;
+        }
+
+        if (!f.sync) {
+            epochSta = -1;
+        }
+    }
+
+    // The output ends between epochs
+    QCOMPARE(epochSta, -1);
+    QCOMPARE(stations, QList<int>() << staA << staB << staA);
+}
+
+QTEST_GUILESS_MAIN(TestRtcmSourceManager)
+
+#include "tst_rtcmsourcemanager.moc"
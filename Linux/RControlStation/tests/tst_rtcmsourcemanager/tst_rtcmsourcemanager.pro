@@ -0,0 +1,19 @@
+QT       += core network serialport testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_rtcmsourcemanager
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_rtcmsourcemanager.cpp \
+    ../../rtcmsourcemanager.cpp \
+    ../../rtcmclient.cpp \
+    ../../rtcm3_simple.c
+
+HEADERS += ../../rtcmsourcemanager.h \
+    ../../rtcmclient.h \
+    ../../rtcm3_simple.h
@@ -0,0 +1,276 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <random>
+#include <cmath>
+#include "surveyin.h"
+
+namespace {
+// A point in ECEF, roughly in Sweden
+const double refX = 3.4e6;
+const double refY = 0.7e6;
+const double refZ = 5.3e6;
+
+// Position noise with a first order correlation time, like GNSS errors. The
+// standard deviation is 1.5 m horizontally and 3 m vertically (roughly, the
+// axes are ECEF and not ENU).
+class NoiseGen
+{
+public:
+    NoiseGen(int seed, double tauSamples) : mGen(seed), mDist(0.0, 1.0) {
+        mA = tauSamples > 0.0 ? exp(-1.0 / tauSamples) : 0.0;
+        for (int i = 0;i < 3;i++) {
+            mE[i] = 0.0;
+        }
+    }
+
+    void next(double *p) {
+        const double sig[3] = {1.5, 1.5, 3.0};
+        for (int i = 0;i < 3;i++) {
+            mE[i] = mA * mE[i] + sqrt(1.0 - mA * mA) * sig[i] * mDist(mGen);
+        }
+
+        p[0] = refX + mE[0];
+        p[1] = refY + mE[1];
+        p[2] = refZ + mE[2];
+    }
+
+private:
+    std::mt19937 mGen;
+    std::normal_distribution<double> mDist;
+    double mA;
+    double mE[3];
+};
+
+double meanError(const SurveyIn &s, double x, double y, double z)
+{
+    double m[3];
+    s.mean(m[0], m[1], m[2]);
+    return sqrt((m[0] - x) * (m[0] - x) + (m[1] - y) * (m[1] - y) + (m[2] - z) * (m[2] - z));
+}
+}
+
+class TestSurveyIn : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void outliersRejected();
+    void moveRestarts();
+    void qualityUpgradeRestarts();
+    void accuracyCalibrated();
+    void twoHourSurvey();
+    void autoStop();
+};
+
+void TestSurveyIn::outliersRejected()
+{
+    SurveyIn s;
+    NoiseGen g(1, 0.0);
+    int spikes = 0;
+
+    for (int i = 0;i < 5000;i++) {
+        double p[3];
+        g.next(p);
+        if (i % 97 == 50) {
+            p[0] += 50.0;
+            spikes++;
+        }
+        s.addSample(p[0], p[1], p[2], 1);
+    }
+
+    QVERIFY(s.rejected() >= spikes);
+    QVERIFY(meanError(s, refX, refY, refZ) < 0.2);
+}
+
+// When the antenna is moved the samples from the new position are first
+// rejected, and then the survey starts over from there.
+void TestSurveyIn::moveRestarts()
+{
+    SurveyIn s;
+    NoiseGen g(2, 0.0);
+
+    for (int i = 0;i < 2000;i++) {
+        double p[3];
+        g.next(p);
+        s.addSample(p[0], p[1], p[2], 1);
+    }
+
+    for (int i = 0;i < 1000;i++) {
+        double p[3];
+        g.next(p);
+        s.addSample(p[0] + 10.0, p[1], p[2], 1);
+    }
+
+    QVERIFY(s.samples() < 1000);
+    QCOMPARE(s.quality(), 1);
+    QVERIFY2(meanError(s, refX + 10.0, refY, refZ) < 0.3,
+             qPrintable(QString("Mean is %1 m from the new position").
+                        arg(meanError(s, refX + 10.0, refY, refZ))));
+}
+
+void TestSurveyIn::qualityUpgradeRestarts()
+{
+    SurveyIn s;
+    NoiseGen g(3, 0.0);
+
+    for (int i = 0;i < 500;i++) {
+        double p[3];
+        g.next(p);
+        QVERIFY(s.addSample(p[0], p[1], p[2], 1));
+    }
+
+    int accepted = 0;
+    for (int i = 0;i < 300;i++) {
+        double p[3];
+        g.next(p);
+        if (s.addSample(p[0], p[1], p[2], i % 2 ? 4 : 1)) {
+            accepted++;
+        }
+    }
+
+    QCOMPARE(s.quality(), 4);
+    QCOMPARE(s.samples(), 150);
+    QCOMPARE(accepted, 150);
+}
+
+// With correlated noise the reported accuracy has to follow the actual error
+// of the mean, and not the naive sigma / sqrt(n), which is about 20 times
+// too small here.
+void TestSurveyIn::accuracyCalibrated()
+{
+    const int runs = 40;
+    double err2 = 0.0;
+    double acc2 = 0.0;
+
+    for (int r = 0;r < runs;r++) {
+        SurveyIn s;
+        NoiseGen g(100 + r, 120.0);
+
+        for (int i = 0;i < 3600;i++) {
+            double p[3];
+            g.next(p);
+            s.addSample(p[0], p[1], p[2], 1);
+        }
+
+        double e = meanError(s, refX, refY, refZ);
+        double acc = s.accuracy();
+        QVERIFY(acc > 0.0);
+        err2 += e * e;
+        acc2 += acc * acc;
+    }
+
+    double ratio = sqrt(err2 / acc2);
+    qDebug() << "RMS error / RMS reported accuracy:" << ratio;
+    QVERIFY(ratio > 0.6 && ratio < 1.6);
+}
+
+/*
+ * Two hours at 1 Hz with correlated noise and a spike every 97 samples, the
+ * case the survey is meant for. The spikes must be rejected, apart from the
+ * few that land before the gate is active after a restart.
+ */
+void TestSurveyIn::twoHourSurvey()
+{
+    const int runs = 20;
+    int spikes = 0;
+    int spikesAccepted = 0;
+    double err2 = 0.0;
+    double acc2 = 0.0;
+    double naive2 = 0.0;
+
+    for (int r = 0;r < runs;r++) {
+        SurveyIn s;
+        NoiseGen g(300 + r, 120.0);
+
+        for (int i = 0;i < 7200;i++) {
+            double p[3];
+            g.next(p);
+
+            bool spike = (i % 97) == 96;
+            if (spike) {
+                p[0] += 50.0;
+                p[2] -= 30.0;
+                spikes++;
+            }
+
+            if (s.addSample(p[0], p[1], p[2], 1) && spike) {
+                spikesAccepted++;
+            }
+        }
+
+        double sd[3];
+        QVERIFY(s.stdDevEnu(sd));
+        double naive = sqrt((sd[0] * sd[0] + sd[1] * sd[1] + sd[2] * sd[2]) / s.samples());
+        double e = meanError(s, refX, refY, refZ);
+        double acc = s.accuracy();
+
+        err2 += e * e;
+        acc2 += acc * acc;
+        naive2 += naive * naive;
+    }
+
+    double err = sqrt(err2 / runs);
+    double acc = sqrt(acc2 / runs);
+    double naive = sqrt(naive2 / runs);
+
+    qDebug() << "RMS error:" << err << "RMS reported accuracy:" << acc <<
+                "sigma / sqrt(n):" << naive;
+    qDebug() << "Spikes accepted:" << spikesAccepted << "of" << spikes;
+
+    QVERIFY(spikesAccepted * 50 < spikes);
+    QVERIFY(err / acc > 0.6 && err / acc < 1.6);
+    QVERIFY(naive < acc / 5.0);
+}
+
+void TestSurveyIn::autoStop()
+{
+    const int runs = 40;
+    const double target = 0.8;
+    int done = 0;
+    double err2 = 0.0;
+
+    for (int r = 0;r < runs;r++) {
+        SurveyIn s;
+        s.setTargetAccuracy(target);
+        NoiseGen g(200 + r, 120.0);
+
+        for (int i = 0;i < 20000 && !s.isDone();i++) {
+            double p[3];
+            g.next(p);
+            s.addSample(p[0], p[1], p[2], 1);
+        }
+
+        if (s.isDone()) {
+            double e = meanError(s, refX, refY, refZ);
+            err2 += e * e;
+            done++;
+
+            double p[3];
+            g.next(p);
+            QVERIFY(!s.addSample(p[0], p[1], p[2], 1));
+        }
+    }
+
+    QVERIFY(done >= runs * 3 / 4);
+    QVERIFY(sqrt(err2 / done) < 1.5 * target);
+}
+
+QTEST_GUILESS_MAIN(TestSurveyIn)
+
+#include "tst_surveyin.moc"
@@ -0,0 +1,17 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_surveyin
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_surveyin.cpp \
+    ../../surveyin.cpp \
+    ../../utility.cpp
+
+HEADERS += ../../surveyin.h \
+    ../../utility.h
@@ -0,0 +1,296 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "ubloxbase.h"
+#include "utility.h"
+#include "rtcm3_simple.h"
+#include <cmath>
+#include <cstring>
+
+UbloxBase::UbloxBase(QObject *parent) : QObject(parent)
+{
+    mUblox = new Ublox(this);
+    mSendRefPos = false;
+    mRefPosFromSurvey = false;
+    mRefPos[0] = 0.0;
+    mRefPos[1] = 0.0;
+    mRefPos[2] = 0.0;
+    mRefPos[3] = 0.0;
+    mRefPosInterval = 5;
+    mRefPosCnt = 0;
+
+    connect(mUblox, SIGNAL(rxGga(int,NmeaServer::nmea_gga_info_t)),
+            this, SLOT(rxGga(int,NmeaServer::nmea_gga_info_t)));
+    connect(mUblox, SIGNAL(rxRawx(ubx_rxm_rawx)),
+            this, SLOT(rxRawx(ubx_rxm_rawx)));
+}
+
+/**
+ * @brief UbloxBase::connectSerial
+ * Connect to the receiver and configure it for raw observations and GGA
+ * once per second with the stationary dynamic model.
+ *
+ * @return
+ * True if the port could be opened.
+ */
+bool UbloxBase::connectSerial(QString port, int baudrate)
+{
+    bool res = mUblox->connectSerial(port, baudrate);
+
+    if (res) {
+        mObsMonitor.reset();
+
+        // Serial port baud rate
+        // if it is too low the buffer will overfill and it won't work properly.
+        ubx_cfg_prt_uart uart;
+        uart.baudrate = 115200;
+        uart.in_ubx = true;
+        uart.in_nmea = true;
+        uart.in_rtcm2 = false;
+        uart.in_rtcm3 = true;
+        uart.out_ubx = true;
+        uart.out_nmea = true;
+        uart.out_rtcm3 = true;
+        mUblox->ubxCfgPrtUart(&uart);
+
+        // Set configuration
+        // Switch on RAWX and NMEA messages, set rate to 1 Hz and time reference to UTC
+        mUblox->ubxCfgRate(1000, 1, 0);
+        mUblox->ubxCfgMsg(UBX_CLASS_RXM, UBX_RXM_RAWX, 1); // Every second
+        mUblox->ubxCfgMsg(UBX_CLASS_RXM, UBX_RXM_SFRBX, 1); // Every second
+        mUblox->ubxCfgMsg(UBX_CLASS_NMEA, UBX_NMEA_GGA, 1); // Every second
+
+        // Stationary dynamic model
+        ubx_cfg_nav5 nav5;
+        memset(&nav5, 0, sizeof(ubx_cfg_nav5));
+        nav5.apply_dyn = true;
+        nav5.dyn_model = 2;
+        mUblox->ubxCfgNav5(&nav5);
+    }
+
+    return res;
+}
+
+void UbloxBase::disconnectSerial()
+{
+    mUblox->disconnectSerial();
+}
+
+bool UbloxBase::isSerialConnected()
+{
+    return mUblox->isSerialConnected();
+}
+
+Ublox *UbloxBase::ublox()
+{
+    return mUblox;
+}
+
+SurveyIn &UbloxBase::survey()
+{
+    return mSurvey;
+}
+
+ObsMonitor &UbloxBase::obsMonitor()
+{
+    return mObsMonitor;
+}
+
+/**
+ * @brief UbloxBase::addGga
+ * Add a position solution to the survey. The solutions from the receiver
+ * are added automatically, this is for other sources such as an NMEA
+ * stream.
+ */
+void UbloxBase::addGga(int fields, const NmeaServer::nmea_gga_info_t &gga)
+{
+    if (fields < 2) {
+        return;
+    }
+
+    // Rank the solutions, the survey only uses the best one seen
+    int quality = 0;
+    switch (gga.fix_type) {
+    case 1: quality = 1; break;
+    case 2: quality = 2; break;
+    case 5: quality = 3; break;
+    case 4: quality = 4; break;
+    default: break;
+    }
+
+    if (quality > 0) {
+        double x, y, z;
+        utility::llhToXyz(gga.lat, gga.lon, gga.height, &x, &y, &z);
+        mSurvey.addSample(x, y, z, quality);
+    }
+}
+
+void UbloxBase::setRefPos(double lat, double lon, double height, double antHeight)
+{
+    mRefPos[0] = lat;
+    mRefPos[1] = lon;
+    mRefPos[2] = height;
+    mRefPos[3] = antHeight;
+}
+
+/**
+ * @brief UbloxBase::setSendRefPos
+ * Send the reference position set with setRefPos.
+ */
+void UbloxBase::setSendRefPos(bool send)
+{
+    mSendRefPos = send;
+}
+
+/**
+ * @brief UbloxBase::setRefPosFromSurvey
+ * When no reference position is sent with setSendRefPos, send the survey
+ * mean once the survey is done.
+ */
+void UbloxBase::setRefPosFromSurvey(bool fromSurvey)
+{
+    mRefPosFromSurvey = fromSurvey;
+}
+
+/**
+ * @brief UbloxBase::setRefPosInterval
+ * Add the reference position to rtcmOut every this many epochs, to save
+ * bandwidth on the link to the vehicles.
+ */
+void UbloxBase::setRefPosInterval(int epochs)
+{
+    mRefPosInterval = epochs;
+}
+
+void UbloxBase::rxGga(int fields, NmeaServer::nmea_gga_info_t gga)
+{
+    addGga(fields, gga);
+}
+
+void UbloxBase::rxRawx(ubx_rxm_rawx rawx)
+{
+    uint8_t data_gps[1024];
+    uint8_t data_glo[1024];
+    uint8_t data_ref[512];
+
+    int gps_len = 0;
+    int glo_len = 0;
+    int ref_len = 0;
+
+    rtcm_obs_header_t header;
+    rtcm_obs_t obs[rawx.num_meas];
+
+    header.staid = 0;
+    header.t_wn = rawx.week;
+    header.t_tow = rawx.rcv_tow;
+    header.t_tod = fmod(rawx.rcv_tow - (double)rawx.leaps + 10800.0, 86400.0);
+
+    mObsMonitor.update(rawx);
+
+    bool has_gps = false;
+    bool has_glo = false;
+
+    for (int i = 0;i < rawx.num_meas;i++) {
+        ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
+
+        if (raw_obs->gnss_id == 0) {
+            has_gps = true;
+        } else if (raw_obs->gnss_id == 6) {
+            has_glo = true;
+        }
+    }
+
+    // GPS
+    if (has_gps) {
+        int obs_ind = 0;
+        for (int i = 0;i < rawx.num_meas;i++) {
+            ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
+
+            if (raw_obs->gnss_id == 0) {
+                obs[obs_ind].P[0] = raw_obs->pr_mes;
+                obs[obs_ind].L[0] = raw_obs->cp_mes;
+                obs[obs_ind].cn0[0] = raw_obs->cno;
+                obs[obs_ind].lock[0] = mObsMonitor.lockIndicator(raw_obs->gnss_id, raw_obs->sv_id);
+                obs[obs_ind].code[0] = CODE_L1C;
+                obs[obs_ind].prn = raw_obs->sv_id;
+                obs_ind++;
+            }
+        }
+        header.sync = has_glo;
+        rtcm3_encode_1002(&header, obs, obs_ind, data_gps, &gps_len);
+    }
+
+    // GLONASS
+    if (has_glo) {
+        int obs_ind = 0;
+        for (int i = 0;i < rawx.num_meas;i++) {
+            ubx_rxm_rawx_obs *raw_obs = &rawx.obs[i];
+
+            if (raw_obs->gnss_id == 6) {
+                obs[obs_ind].P[0] = raw_obs->pr_mes;
+                obs[obs_ind].L[0] = raw_obs->cp_mes;
+                obs[obs_ind].cn0[0] = raw_obs->cno;
+                obs[obs_ind].lock[0] = mObsMonitor.lockIndicator(raw_obs->gnss_id, raw_obs->sv_id);
+                obs[obs_ind].code[0] = CODE_L1C;
+                obs[obs_ind].prn = raw_obs->sv_id;
+                obs[obs_ind].freq = raw_obs->freq_id;
+                obs_ind++;
+            }
+        }
+        header.sync = 0;
+        rtcm3_encode_1010(&header, obs, obs_ind, data_glo, &glo_len);
+    }
+
+    // Base station position
+    rtcm_ref_sta_pos_t pos;
+    pos.staid = 0;
+
+    if (mSendRefPos) {
+        pos.lat = mRefPos[0];
+        pos.lon = mRefPos[1];
+        pos.height = mRefPos[2];
+        pos.ant_height = mRefPos[3];
+        rtcm3_encode_1006(pos, data_ref, &ref_len);
+    } else if (mRefPosFromSurvey && mSurvey.isDone()) {
+        double x, y, z;
+        mSurvey.mean(x, y, z);
+        utility::xyzToLlh(x, y, z, &pos.lat, &pos.lon, &pos.height);
+        pos.ant_height = 0.0;
+        rtcm3_encode_1006(pos, data_ref, &ref_len);
+    }
+
+    QByteArray obsData;
+    obsData.append((char*)data_gps, gps_len);
+    obsData.append((char*)data_glo, glo_len);
+    QByteArray refData((char*)data_ref, ref_len);
+
+    emit rtcmEpoch(obsData, refData);
+
+    if (obsData.isEmpty()) {
+        return;
+    }
+
+    QByteArray out = obsData;
+
+    mRefPosCnt++;
+    if (mRefPosCnt >= mRefPosInterval) {
+        mRefPosCnt = 0;
+        out.append(refData);
+    }
+
+    emit rtcmOut(out);
+}
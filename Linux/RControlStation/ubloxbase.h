@@ -0,0 +1,67 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef UBLOXBASE_H
+#define UBLOXBASE_H
+
+#include <QObject>
+#include "ublox.h"
+#include "obsmonitor.h"
+#include "surveyin.h"
+
+// The u-blox base station without a GUI, used by BaseStation and
+// Station_Daemon. It configures the receiver for raw observations, surveys
+// the antenna position from the GGA solution and encodes RTCM3 1002 (GPS),
+// 1010 (GLONASS) and 1006 (reference position) for every epoch.
+class UbloxBase : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UbloxBase(QObject *parent = 0);
+    bool connectSerial(QString port, int baudrate = 115200);
+    void disconnectSerial();
+    bool isSerialConnected();
+    Ublox *ublox();
+    SurveyIn &survey();
+    ObsMonitor &obsMonitor();
+    void addGga(int fields, const NmeaServer::nmea_gga_info_t &gga);
+    void setRefPos(double lat, double lon, double height, double antHeight = 0.0);
+    void setSendRefPos(bool send);
+    void setRefPosFromSurvey(bool fromSurvey);
+    void setRefPosInterval(int epochs);
+
+signals:
+    void rtcmOut(QByteArray data);
+    void rtcmEpoch(QByteArray obs, QByteArray refPos);
+
+private slots:
+    void rxGga(int fields, NmeaServer::nmea_gga_info_t gga);
+    void rxRawx(ubx_rxm_rawx rawx);
+
+private:
+    Ublox *mUblox;
+    SurveyIn mSurvey;
+    ObsMonitor mObsMonitor;
+    bool mSendRefPos;
+    bool mRefPosFromSurvey;
+    double mRefPos[4];
+    int mRefPosInterval;
+    int mRefPosCnt;
+
+};
+
+#endif // UBLOXBASE_H
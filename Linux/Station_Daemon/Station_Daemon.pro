@@ -0,0 +1,57 @@
+# gui is kept for QColor in LocPoint, no widgets are used
+QT += core
+QT += network
+QT += serialport
+
+CONFIG += c++11
+
+TARGET = Station_Daemon
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+# Most of the sources are shared with RControlStation
+INCLUDEPATH += ../RControlStation
+
+SOURCES += main.cpp \
+    stationdaemon.cpp \
+    ../RControlStation/packetinterface.cpp \
+    ../RControlStation/utility.cpp \
+    ../RControlStation/locpoint.cpp \
+    ../RControlStation/packet.cpp \
+    ../RControlStation/rtcmclient.cpp \
+    ../RControlStation/rtcmsourcemanager.cpp \
+    ../RControlStation/rtcm3_simple.c \
+    ../RControlStation/mainconfigcodec.cpp \
+    ../RControlStation/netprotocol.cpp \
+    ../RControlStation/netapi.cpp \
+    ../RControlStation/netapiclient.cpp \
+    ../RControlStation/ubloxbase.cpp \
+    ../RControlStation/ublox.cpp \
+    ../RControlStation/nmeaserver.cpp \
+    ../RControlStation/tcpbroadcast.cpp \
+    ../RControlStation/obsmonitor.cpp \
+    ../RControlStation/surveyin.cpp
+
+HEADERS += \
+    stationdaemon.h \
+    ../RControlStation/packetinterface.h \
+    ../RControlStation/utility.h \
+    ../RControlStation/datatypes.h \
+    ../RControlStation/locpoint.h \
+    ../RControlStation/packet.h \
+    ../RControlStation/rtcmclient.h \
+    ../RControlStation/rtcmsourcemanager.h \
+    ../RControlStation/rtcm3_simple.h \
+    ../RControlStation/mainconfigcodec.h \
+    ../RControlStation/netprotocol.h \
+    ../RControlStation/netapi.h \
+    ../RControlStation/netapiclient.h \
+    ../RControlStation/ubloxbase.h \
+    ../RControlStation/ublox.h \
+    ../RControlStation/nmeaserver.h \
+    ../RControlStation/tcpbroadcast.h \
+    ../RControlStation/obsmonitor.h \
+    ../RControlStation/surveyin.h \
+    ../../Embedded/RC_Controller/main_config_schema.h
@@ -0,0 +1,259 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QStringList>
+#include <signal.h>
+
+#include "stationdaemon.h"
+
+void showHelp()
+{
+    qDebug() << "Arguments";
+    qDebug() << "-h, --help : Show help text";
+    qDebug() << "--ttyport : Serial port to the cars, e.g. /dev/ttyUSB0";
+    qDebug() << "--baudrate : Serial baud rate, e.g. 115200";
+    qDebug() << "--tcphost : Car TCP server address, e.g. 127.0.0.1";
+    qDebug() << "--tcpport : Car TCP server port";
+    qDebug() << "--udphost : Car UDP address";
+    qDebug() << "--udpport : Car UDP port";
+    qDebug() << "--cars : Comma separated ids of the cars to poll, e.g. 0,1,2";
+    qDebug() << "--pollinterval : Poll interval in ms";
+    qDebug() << "--api : Local socket name or path for the script API";
+    qDebug() << "--statelog : Append received states to file";
+    qDebug() << "--enuref : ENU reference of the station, lat,lon,height";
+    qDebug() << "--ntripserver : NTRIP server for RTCM";
+    qDebug() << "--ntripstream : NTRIP stream";
+    qDebug() << "--ntripuser : NTRIP user";
+    qDebug() << "--ntrippass : NTRIP password";
+    qDebug() << "--ntripport : NTRIP port";
+    qDebug() << "--rtcmtcphost : TCP server for RTCM";
+    qDebug() << "--rtcmtcpport : TCP port for RTCM";
+    qDebug() << "--ttyportrtcm : Serial port for RTCM, e.g. /dev/ttyUSB1";
+    qDebug() << "--rtcmbaud : RTCM port baud rate, e.g. 9600";
+    qDebug() << "--rtcmmaxage : Switch RTCM source after this long without observations (ms)";
+    qDebug() << "--ttyportbase : Serial port of a u-blox base station, e.g. /dev/ttyACM0";
+    qDebug() << "--basebaud : Base station baud rate, e.g. 115200";
+    qDebug() << "--baseref : Base station position, lat,lon,height[,antenna height]";
+    qDebug() << "--surveyacc : Without --baseref, survey the base position to this accuracy (m)";
+    qDebug() << "";
+    qDebug() << "Several RTCM sources can be given. The first healthy one of NTRIP,";
+    qDebug() << "TCP, serial and the base station, in that order, is forwarded.";
+}
+
+static void m_cleanup(int sig)
+{
+    (void)sig;
+    qApp->quit();
+    qDebug() << "Bye :)";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList args = QCoreApplication::arguments();
+    QString ttyPort = "";
+    int baudrate = 115200;
+    QString tcpHost = "";
+    int tcpPort = 8300;
+    QString udpHost = "";
+    int udpPort = 8300;
+    QStringList cars;
+    int pollInterval = 20;
+    QString apiName = "rcontrolstation";
+    QString stateLog = "";
+    QStringList enuRef;
+    QString ntripServer = "";
+    QString ntripStream = "";
+    QString ntripUser = "";
+    QString ntripPass = "";
+    int ntripPort = 80;
+    QString rtcmTcpHost = "";
+    int rtcmTcpPort = 8200;
+    QString ttyPortRtcm = "";
+    int rtcmBaud = 9600;
+    int rtcmMaxAge = 3000;
+    QString ttyPortBase = "";
+    int baseBaud = 115200;
+    QStringList baseRef;
+    double surveyAcc = 0.5;
+
+    signal(SIGINT, m_cleanup);
+    signal(SIGTERM, m_cleanup);
+
+    for (int i = 1;i < args.size();i++) {
+        QString str = args.at(i).toLower();
+        bool hasArg = (i + 1) < args.size();
+        bool found = false;
+        bool ok = true;
+
+        if (str == "-h" || str == "--help") {
+            showHelp();
+            return 0;
+        }
+
+        if (!hasArg) {
+            qCritical() << "Missing value or invalid option:" << str;
+            showHelp();
+            return 1;
+        }
+
+        QString val = args.at(++i);
+        found = true;
+
+        if (str == "--ttyport") {
+            ttyPort = val;
+        } else if (str == "--baudrate") {
+            baudrate = val.toInt(&ok);
+        } else if (str == "--tcphost") {
+            tcpHost = val;
+        } else if (str == "--tcpport") {
+            tcpPort = val.toInt(&ok);
+        } else if (str == "--udphost") {
+            udpHost = val;
+        } else if (str == "--udpport") {
+            udpPort = val.toInt(&ok);
+        } else if (str == "--cars") {
+            cars = val.split(",", QString::SkipEmptyParts);
+        } else if (str == "--pollinterval") {
+            pollInterval = val.toInt(&ok);
+        } else if (str == "--api") {
+            apiName = val;
+        } else if (str == "--statelog") {
+            stateLog = val;
+        } else if (str == "--enuref") {
+            enuRef = val.split(",");
+            ok = enuRef.size() == 3;
+        } else if (str == "--ntripserver") {
+            ntripServer = val;
+        } else if (str == "--ntripstream") {
+            ntripStream = val;
+        } else if (str == "--ntripuser") {
+            ntripUser = val;
+        } else if (str == "--ntrippass") {
+            ntripPass = val;
+        } else if (str == "--ntripport") {
+            ntripPort = val.toInt(&ok);
+        } else if (str == "--rtcmtcphost") {
+            rtcmTcpHost = val;
+        } else if (str == "--rtcmtcpport") {
+            rtcmTcpPort = val.toInt(&ok);
+        } else if (str == "--ttyportrtcm") {
+            ttyPortRtcm = val;
+        } else if (str == "--rtcmbaud") {
+            rtcmBaud = val.toInt(&ok);
+        } else if (str == "--rtcmmaxage") {
+            rtcmMaxAge = val.toInt(&ok);
+        } else if (str == "--ttyportbase") {
+            ttyPortBase = val;
+        } else if (str == "--basebaud") {
+            baseBaud = val.toInt(&ok);
+        } else if (str == "--baseref") {
+            baseRef = val.split(",");
+            ok = baseRef.size() == 3 || baseRef.size() == 4;
+        } else if (str == "--surveyacc") {
+            surveyAcc = val.toDouble(&ok);
+        } else {
+            found = false;
+        }
+
+        if (!found || !ok) {
+            qCritical() << "Invalid option:" << str << val;
+            showHelp();
+            return 1;
+        }
+    }
+
+    StationDaemon station;
+
+    for (QString id: cars) {
+        bool ok;
+        int idInt = id.toInt(&ok);
+        if (!ok || idInt < 0 || idInt > 254) {
+            qCritical() << "Invalid car id:" << id;
+            return 1;
+        }
+        station.addCar(idInt);
+    }
+
+    station.setPollInterval(pollInterval);
+
+    if (enuRef.size() == 3) {
+        station.setEnuRef(enuRef.at(0).toDouble(), enuRef.at(1).toDouble(),
+                          enuRef.at(2).toDouble());
+    }
+
+    if (!ttyPort.isEmpty() && !station.connectSerial(ttyPort, baudrate)) {
+        return 1;
+    }
+
+    if (!tcpHost.isEmpty()) {
+        station.connectTcp(tcpHost, tcpPort);
+    }
+
+    if (!udpHost.isEmpty()) {
+        station.connectUdp(udpHost, udpPort);
+    }
+
+    station.rtcmSources()->setMaxObsAge(rtcmMaxAge);
+
+    if (!ntripServer.isEmpty()) {
+        station.addRtcmSource(ntripStream, RtcmSourceManager::RTCM_SOURCE_NTRIP)->
+                connectNtrip(ntripServer, ntripStream, ntripUser, ntripPass, ntripPort);
+    }
+
+    if (!rtcmTcpHost.isEmpty()) {
+        station.addRtcmSource(rtcmTcpHost, RtcmSourceManager::RTCM_SOURCE_TCP)->
+                connectTcp(rtcmTcpHost, rtcmTcpPort);
+    }
+
+    if (!ttyPortRtcm.isEmpty()) {
+        station.addRtcmSource(ttyPortRtcm, RtcmSourceManager::RTCM_SOURCE_SERIAL)->
+                connectSerial(ttyPortRtcm, rtcmBaud);
+    }
+
+    if (!ttyPortBase.isEmpty()) {
+        UbloxBase *base = station.addBaseStation(ttyPortBase);
+
+        if (baseRef.size() >= 3) {
+            base->setRefPos(baseRef.at(0).toDouble(), baseRef.at(1).toDouble(),
+                            baseRef.at(2).toDouble(),
+                            baseRef.size() > 3 ? baseRef.at(3).toDouble() : 0.0);
+            base->setSendRefPos(true);
+        } else {
+            base->survey().setTargetAccuracy(surveyAcc);
+            base->setRefPosFromSurvey(true);
+        }
+
+        if (!base->connectSerial(ttyPortBase, baseBaud)) {
+            qWarning() << "Could not open base station port" << ttyPortBase;
+            return 1;
+        }
+    }
+
+    if (!stateLog.isEmpty() && !station.startStateLog(stateLog)) {
+        return 1;
+    }
+
+    if (!station.startApi(apiName)) {
+        return 1;
+    }
+
+    return a.exec();
+}
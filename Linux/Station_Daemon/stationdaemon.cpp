@@ -0,0 +1,354 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include "stationdaemon.h"
+#include <QDebug>
+#include <QDateTime>
+#include <QHostInfo>
+
+StationDaemon::StationDaemon(QObject *parent) : QObject(parent)
+{
+    mPacketInterface = new PacketInterface(this);
+    mSerialPort = new QSerialPort(this);
+    mTcpSocket = new QTcpSocket(this);
+    mTcpPort = 8300;
+    mReconnectTimer = new QTimer(this);
+    mReconnectTimer->setInterval(2000);
+    mRtcmSources = new RtcmSourceManager(this);
+    mApi = new NetApi(this);
+    mApi->setPacketInterface(mPacketInterface);
+    mApi->setSubMinIntervalMs(mSubMinIntervalMs);
+    mPollTimer = new QTimer(this);
+    mPollTimer->start(20);
+    mCars.resize(256);
+    mPollSentMs.fill(-1, 256);
+    mPollClock.start();
+
+    connect(mPacketInterface, SIGNAL(dataToSend(QByteArray&)),
+            this, SLOT(packetDataToSend(QByteArray&)));
+    connect(mPacketInterface, SIGNAL(stateReceived(quint8,CAR_STATE)),
+            this, SLOT(stateReceived(quint8,CAR_STATE)));
+    connect(mPacketInterface, SIGNAL(enuRefReceived(quint8,double,double,double)),
+            mApi, SLOT(sendEnuRef(quint8,double,double,double)));
+    connect(mSerialPort, SIGNAL(readyRead()),
+            this, SLOT(serialDataAvailable()));
+    connect(mSerialPort, SIGNAL(error(QSerialPort::SerialPortError)),
+            this, SLOT(serialPortError(QSerialPort::SerialPortError)));
+    connect(mTcpSocket, SIGNAL(readyRead()), this, SLOT(tcpInputDataAvailable()));
+    connect(mTcpSocket, SIGNAL(connected()), this, SLOT(tcpInputConnected()));
+    connect(mTcpSocket, SIGNAL(disconnected()),
+            this, SLOT(tcpInputDisconnected()));
+    connect(mTcpSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(tcpInputError(QAbstractSocket::SocketError)));
+    connect(mReconnectTimer, SIGNAL(timeout()), this, SLOT(reconnectTimerSlot()));
+    connect(mRtcmSources, SIGNAL(rtcmOut(QByteArray)),
+            this, SLOT(rtcmOut(QByteArray)));
+    connect(mPollTimer, SIGNAL(timeout()), this, SLOT(pollTimerSlot()));
+    connect(mApi, SIGNAL(clientsChanged(int)), this, SLOT(apiClientsChanged(int)));
+}
+
+StationDaemon::~StationDaemon()
+{
+    if (mStateLog.isOpen()) {
+        mStateLog.close();
+    }
+}
+
+bool StationDaemon::connectSerial(QString port, int baudrate)
+{
+    if (mSerialPort->isOpen()) {
+        mSerialPort->close();
+    }
+
+    mSerialPort->setPortName(port);
+    mSerialPort->open(QIODevice::ReadWrite);
+
+    if (!mSerialPort->isOpen()) {
+        qWarning() << "Could not open serial port" << port;
+        return false;
+    }
+
+    mSerialPort->setBaudRate(baudrate);
+    mSerialPort->setDataBits(QSerialPort::Data8);
+    mSerialPort->setParity(QSerialPort::NoParity);
+    mSerialPort->setStopBits(QSerialPort::OneStop);
+    mSerialPort->setFlowControl(QSerialPort::NoFlowControl);
+
+    qDebug() << "Connected to serial port" << port;
+    return true;
+}
+
+/**
+ * @brief StationDaemon::connectTcp
+ * Connect to the TCP server of a car client. The connection is retried
+ * until it succeeds, and again if it is lost.
+ */
+void StationDaemon::connectTcp(QString host, int port)
+{
+    mTcpHost = host;
+    mTcpPort = port;
+    mTcpSocket->abort();
+    mTcpSocket->connectToHost(host, port);
+}
+
+void StationDaemon::connectUdp(QString host, int port)
+{
+    QHostAddress ip;
+
+    if (!ip.setAddress(host)) {
+        QHostInfo info = QHostInfo::fromName(host);
+        if (info.addresses().isEmpty()) {
+            qWarning() << "Could not resolve" << host;
+            return;
+        }
+        ip = info.addresses().first();
+    }
+
+    mPacketInterface->startUdpConnection(ip, port);
+}
+
+/**
+ * @brief StationDaemon::startApi
+ * Start listening for scripts on a local socket.
+ *
+ * @param name
+ * The socket name, or a path for a socket file.
+ *
+ * @return
+ * True on success.
+ */
+bool StationDaemon::startApi(QString name)
+{
+    if (!mApi->startLocalServer(name)) {
+        qWarning() << "Could not start API server:" << mApi->errorString();
+        return false;
+    }
+
+    qDebug() << "API listening on" << mApi->serverName();
+    return true;
+}
+
+/**
+ * @brief StationDaemon::startStateLog
+ * Append every received car state to a text file, one line per state:
+ * date id px py yaw speed vin
+ */
+bool StationDaemon::startStateLog(QString path)
+{
+    if (mStateLog.isOpen()) {
+        mStateLog.close();
+    }
+
+    mStateLog.setFileName(path);
+    if (!mStateLog.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Could not open state log" << path;
+        return false;
+    }
+
+    return true;
+}
+
+void StationDaemon::addCar(quint8 id)
+{
+    mCars[id] = true;
+}
+
+void StationDaemon::setPollInterval(int ms)
+{
+    mPollTimer->start(ms);
+}
+
+void StationDaemon::setEnuRef(double lat, double lon, double height)
+{
+    mApi->setStationEnuRef(lat, lon, height);
+}
+
+PacketInterface *StationDaemon::packetInterface()
+{
+    return mPacketInterface;
+}
+
+/**
+ * @brief StationDaemon::addRtcmSource
+ * Add an RTCM client as a correction source. Sources added first have
+ * higher priority. TCP and NTRIP connections are reconnected when lost.
+ *
+ * @return
+ * The client, to be connected by the caller.
+ */
+RtcmClient *StationDaemon::addRtcmSource(QString name, RtcmSourceManager::RTCM_SOURCE_TYPE type)
+{
+    RtcmClient *client = new RtcmClient(this);
+    client->setAutoReconnect(true);
+    mRtcmSources->addSource(name, type, client, SIGNAL(rtcmReceived(QByteArray,int,bool)));
+    return client;
+}
+
+/**
+ * @brief StationDaemon::addBaseStation
+ * Add a local u-blox base station as a correction source, the same as the
+ * base station tab of RControlStation. Add it after the other sources to use
+ * it only when they fail.
+ *
+ * @return
+ * The base station, to be connected and configured by the caller.
+ */
+UbloxBase *StationDaemon::addBaseStation(QString name)
+{
+    UbloxBase *base = new UbloxBase(this);
+    mRtcmSources->addSource(name, RtcmSourceManager::RTCM_SOURCE_LOCAL_BASE,
+                            base, SIGNAL(rtcmOut(QByteArray)));
+    return base;
+}
+
+RtcmSourceManager *StationDaemon::rtcmSources()
+{
+    return mRtcmSources;
+}
+
+void StationDaemon::packetDataToSend(QByteArray &data)
+{
+    if (mSerialPort->isOpen()) {
+        mSerialPort->write(data);
+    }
+
+    if (mTcpSocket->state() == QAbstractSocket::ConnectedState) {
+        mTcpSocket->write(data);
+    }
+}
+
+void StationDaemon::serialDataAvailable()
+{
+    while (mSerialPort->bytesAvailable() > 0) {
+        QByteArray data = mSerialPort->readAll();
+        mPacketInterface->processData(data);
+    }
+}
+
+void StationDaemon::serialPortError(QSerialPort::SerialPortError error)
+{
+    if (error == QSerialPort::NoError) {
+        return;
+    }
+
+    qWarning() << "Serial port error:" << mSerialPort->errorString();
+
+    if (error == QSerialPort::ResourceError && mSerialPort->isOpen()) {
+        mSerialPort->close();
+    }
+}
+
+void StationDaemon::tcpInputConnected()
+{
+    qDebug() << "TCP connected to" << mTcpHost << mTcpPort;
+    mReconnectTimer->stop();
+}
+
+void StationDaemon::tcpInputDisconnected()
+{
+    qWarning() << "TCP disconnected from" << mTcpHost << mTcpPort;
+    mReconnectTimer->start();
+}
+
+void StationDaemon::tcpInputDataAvailable()
+{
+    while (mTcpSocket->bytesAvailable() > 0) {
+        QByteArray data = mTcpSocket->readAll();
+        mPacketInterface->processData(data);
+    }
+}
+
+void StationDaemon::tcpInputError(QAbstractSocket::SocketError socketError)
+{
+    (void)socketError;
+
+    qWarning() << "TCP error:" << mTcpSocket->errorString();
+    mTcpSocket->abort();
+    mReconnectTimer->start();
+}
+
+void StationDaemon::reconnectTimerSlot()
+{
+    if (!mTcpHost.isEmpty() && mTcpSocket->state() == QAbstractSocket::UnconnectedState) {
+        mTcpSocket->connectToHost(mTcpHost, mTcpPort);
+    }
+}
+
+void StationDaemon::rtcmOut(QByteArray data)
+{
+    // Whole epochs from one source, split in packets of at most 1000 bytes
+    mPacketInterface->sendRtcmUsb(255, data);
+}
+
+/**
+ * @brief StationDaemon::pollTimerSlot
+ * Poll all cars every interval instead of one car per interval as the GUI
+ * does. The requests are sent back to back and the answers are handled as
+ * they arrive. A car that has not answered is skipped until the poll times
+ * out, so a slow link does not build up a queue of requests.
+ */
+void StationDaemon::pollTimerSlot()
+{
+    if (!mSerialPort->isOpen() && !mPacketInterface->isUdpConnected() &&
+            mTcpSocket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    qint64 now = mPollClock.elapsed();
+    qint64 timeout = mPollTimer->interval() * mPollTimeoutIntervals;
+
+    for (int id = 0;id < 255;id++) {
+        if (!isPolled(id)) {
+            continue;
+        }
+
+        if (mPollSentMs[id] < 0 || (now - mPollSentMs[id]) >= timeout) {
+            mPollSentMs[id] = now;
+            mPacketInterface->getState(id);
+        }
+    }
+}
+
+void StationDaemon::stateReceived(quint8 id, CAR_STATE state)
+{
+    mPollSentMs[id] = -1;
+
+    if (mStateLog.isOpen()) {
+        QString line;
+        line.sprintf("%s    %d    %.3f    %.3f    %.2f    %.3f    %.2f\n",
+                     QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz").toLocal8Bit().data(),
+                     id, state.px, state.py, state.yaw, state.speed, state.vin);
+        mStateLog.write(line.toLocal8Bit());
+    }
+
+    mApi->sendState(id, state);
+}
+
+void StationDaemon::apiClientsChanged(int num)
+{
+    qDebug() << "API clients:" << num;
+}
+
+bool StationDaemon::isPolled(quint8 id)
+{
+    if (mCars[id]) {
+        return true;
+    }
+
+    // Clients that subscribe with NET_SUB_POLL add their cars to the poll
+    return mApi->isPolled(id);
+}
@@ -0,0 +1,98 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#ifndef STATIONDAEMON_H
+#define STATIONDAEMON_H
+
+#include <QObject>
+#include <QSerialPort>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QFile>
+#include <QList>
+#include <QVector>
+#include <QElapsedTimer>
+#include "packetinterface.h"
+#include "rtcmclient.h"
+#include "rtcmsourcemanager.h"
+#include "netapi.h"
+#include "ubloxbase.h"
+
+// RControlStation without the GUI. It connects to the cars the same way as
+// the GUI (serial port, TCP or UDP), forwards RTCM from the best of its
+// correction sources (see RtcmSourceManager) and polls the state of all cars
+// at a fixed rate. Scripts control it through a local
+// socket that speaks the binary protocol in netprotocol.h.
+class StationDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StationDaemon(QObject *parent = 0);
+    ~StationDaemon();
+
+    bool connectSerial(QString port, int baudrate = 115200);
+    void connectTcp(QString host, int port = 8300);
+    void connectUdp(QString host, int port = 8300);
+    bool startApi(QString name);
+    bool startStateLog(QString path);
+    void addCar(quint8 id);
+    void setPollInterval(int ms);
+    void setEnuRef(double lat, double lon, double height);
+    PacketInterface *packetInterface();
+    RtcmClient *addRtcmSource(QString name, RtcmSourceManager::RTCM_SOURCE_TYPE type);
+    UbloxBase *addBaseStation(QString name);
+    RtcmSourceManager *rtcmSources();
+
+private slots:
+    void packetDataToSend(QByteArray &data);
+    void serialDataAvailable();
+    void serialPortError(QSerialPort::SerialPortError error);
+    void tcpInputConnected();
+    void tcpInputDisconnected();
+    void tcpInputDataAvailable();
+    void tcpInputError(QAbstractSocket::SocketError socketError);
+    void reconnectTimerSlot();
+    void rtcmOut(QByteArray data);
+    void pollTimerSlot();
+    void stateReceived(quint8 id, CAR_STATE state);
+    void apiClientsChanged(int num);
+
+private:
+    PacketInterface *mPacketInterface;
+    QSerialPort *mSerialPort;
+    QTcpSocket *mTcpSocket;
+    QString mTcpHost;
+    int mTcpPort;
+    QTimer *mReconnectTimer;
+    RtcmSourceManager *mRtcmSources;
+    NetApi *mApi;
+    QTimer *mPollTimer;
+    QVector<bool> mCars;
+    QVector<qint64> mPollSentMs;
+    QElapsedTimer mPollClock;
+    QFile mStateLog;
+
+    // A car that has not answered the previous poll is not polled again
+    // until this many poll intervals have passed.
+    static const int mPollTimeoutIntervals = 5;
+    static const int mSubMinIntervalMs = 5;
+
+    bool isPolled(quint8 id);
+
+};
+
+#endif // STATIONDAEMON_H
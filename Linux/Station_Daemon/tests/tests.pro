@@ -0,0 +1,10 @@
+#-------------------------------------------------
+#
+# Host tests for Station_Daemon. Build and run with
+# qmake && make && make check
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += tst_stationdaemon
@@ -0,0 +1,413 @@
+/*
+    Copyright 2017 Benjamin Vedder	benjamin@vedder.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+    */
+
+#include <QtTest>
+#include <QLocalSocket>
+#include <cmath>
+#include <cstring>
+#include "stationdaemon.h"
+#include "tcpserversimple.h"
+#include "netprotocol.h"
+#include "rtcm3_simple.h"
+#include "utility.h"
+
+namespace {
+const int carPort = 18300;
+const char *apiName = "tst_stationdaemon";
+}
+
+// The TCP server of Car_Client with a car behind it. It answers the state
+// requests of the cars in answerIds and keeps the RTCM that is sent to the
+// cars.
+class FakeCar : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FakeCar(QObject *parent = 0) : QObject(parent)
+    {
+        mServer = new TcpServerSimple(this);
+        mServer->setUsePacket(true);
+        connect(mServer->packet(), SIGNAL(packetReceived(QByteArray&)),
+                this, SLOT(packetReceived(QByteArray&)));
+        connect(mServer, SIGNAL(connectionChanged(bool)),
+                this, SLOT(connectionChanged(bool)));
+        started = mServer->startServer(carPort);
+        connected = false;
+        stateReq.fill(0, 256);
+    }
+
+    bool started;
+    bool connected;
+    QVector<int> stateReq;
+    QVector<quint8> answerIds;
+    QByteArray rtcm;
+
+private slots:
+    void connectionChanged(bool isConnected)
+    {
+        connected = isConnected;
+    }
+
+    void packetReceived(QByteArray &data)
+    {
+        if (data.size() < 2) {
+            return;
+        }
+
+        quint8 id = data.at(0);
+        CMD_PACKET cmd = (CMD_PACKET)(quint8)data.at(1);
+
+        if (cmd == CMD_GET_STATE) {
+            stateReq[id]++;
+            if (answerIds.contains(id)) {
+                sendState(id);
+            }
+        } else if (cmd == CMD_SEND_RTCM_USB && id == 255) {
+            rtcm.append(data.mid(2));
+        }
+    }
+
+private:
+    TcpServerSimple *mServer;
+
+    // The reply of the car to CMD_GET_STATE, with the position set to the id
+    void sendState(quint8 id)
+    {
+        uint8_t buffer[200];
+        int32_t ind = 0;
+
+        buffer[ind++] = id;
+        buffer[ind++] = CMD_GET_STATE;
+        buffer[ind++] = 10;
+        buffer[ind++] = 2;
+
+        // Roll, pitch, yaw, accel, gyro and mag
+        for (int i = 0;i < 12;i++) {
+            utility::buffer_append_double32(buffer, 0.0, 1e6, &ind);
+        }
+
+        utility::buffer_append_double32(buffer, (double)id, 1e4, &ind);
+        utility::buffer_append_double32(buffer, -(double)id, 1e4, &ind);
+        utility::buffer_append_double32(buffer, 1.5, 1e6, &ind);
+        utility::buffer_append_double32(buffer, 24.0, 1e6, &ind);
+        utility::buffer_append_double32(buffer, 35.0, 1e6, &ind);
+        buffer[ind++] = 0;
+
+        // GPS position and autopilot goal
+        for (int i = 0;i < 4;i++) {
+            utility::buffer_append_double32(buffer, 0.0, 1e4, &ind);
+        }
+
+        utility::buffer_append_double32(buffer, 0.0, 1e6, &ind);
+        utility::buffer_append_int32(buffer, 1000 * id, &ind);
+
+        mServer->packet()->sendPacket(QByteArray((char*)buffer, ind));
+    }
+
+};
+
+// The states that the daemon has received
+class StateCollector : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StateCollector(QObject *parent = 0) : QObject(parent) {}
+
+    QList<quint8> ids;
+    QList<CAR_STATE> states;
+
+public slots:
+    void stateReceived(quint8 id, CAR_STATE state)
+    {
+        ids.append(id);
+        states.append(state);
+    }
+
+};
+
+// A script on the local socket of the daemon
+class LocalApiClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LocalApiClient(QString name, QObject *parent = 0) : QObject(parent)
+    {
+        mPacket = new Packet(this);
+        connect(&mSocket, SIGNAL(readyRead()), this, SLOT(socketDataAvailable()));
+        connect(mPacket, SIGNAL(dataToSend(QByteArray&)),
+                this, SLOT(packetDataToSend(QByteArray&)));
+        connect(mPacket, SIGNAL(packetReceived(QByteArray&)),
+                this, SLOT(packetReceived(QByteArray&)));
+        mSocket.connectToServer(name);
+        mSocket.waitForConnected(1000);
+    }
+
+    void send(const QByteArray &data)
+    {
+        mPacket->sendPacket(data);
+        mSocket.flush();
+    }
+
+    int count(NET_MSG msg)
+    {
+        int res = 0;
+        for (QByteArray m: rx) {
+            if ((NET_MSG)m.at(0) == msg) {
+                res++;
+            }
+        }
+        return res;
+    }
+
+    QLocalSocket mSocket;
+    QList<QByteArray> rx;
+
+private slots:
+    void socketDataAvailable()
+    {
+        mPacket->processData(mSocket.readAll());
+    }
+
+    void packetDataToSend(QByteArray &data)
+    {
+        mSocket.write(data);
+    }
+
+    void packetReceived(QByteArray &data)
+    {
+        rx.append(data);
+    }
+
+private:
+    Packet *mPacket;
+
+};
+
+class TestStationDaemon : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void pollsCarsTogether();
+    void silentCarNotFlooded();
+    void rtcmForwarded();
+    void baseStationFallback();
+    void apiLocalSocket();
+
+private:
+    FakeCar *mCar;
+    StationDaemon *mDaemon;
+
+    static QByteArray rtcmObs(int staid, int towMs);
+    static QByteArray rtcmRef(int staid, double lat, double lon, double height);
+};
+
+void TestStationDaemon::init()
+{
+    mCar = new FakeCar;
+    QVERIFY(mCar->started);
+    mDaemon = new StationDaemon;
+    mDaemon->connectTcp("127.0.0.1", carPort);
+    QTRY_VERIFY(mCar->connected);
+}
+
+void TestStationDaemon::cleanup()
+{
+    delete mDaemon;
+    delete mCar;
+}
+
+// GPS observations of one epoch in a single 1002 message
+QByteArray TestStationDaemon::rtcmObs(int staid, int towMs)
+{
+    rtcm_obs_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.staid = staid;
+    header.t_wn = 1970;
+    header.t_tow = (double)towMs / 1000.0;
+    header.sync = false;
+
+    rtcm_obs_t obs[4];
+    memset(obs, 0, sizeof(obs));
+
+    for (int i = 0;i < 4;i++) {
+        obs[i].P[0] = 2.1e7 + (double)i * 1e5;
+        obs[i].L[0] = obs[i].P[0] / 0.190293672798365;
+        obs[i].cn0[0] = 45;
+        obs[i].lock[0] = 127;
+        obs[i].code[0] = CODE_L1C;
+        obs[i].prn = i + 1;
+    }
+
+    uint8_t buffer[512];
+    int len = 0;
+    rtcm3_encode_1002(&header, obs, 4, buffer, &len);
+    return QByteArray((char*)buffer, len);
+}
+
+QByteArray TestStationDaemon::rtcmRef(int staid, double lat, double lon, double height)
+{
+    rtcm_ref_sta_pos_t pos;
+    pos.staid = staid;
+    pos.lat = lat;
+    pos.lon = lon;
+    pos.height = height;
+    pos.ant_height = 0.0;
+
+    uint8_t buffer[64];
+    int len = 0;
+    rtcm3_encode_1006(pos, buffer, &len);
+    return QByteArray((char*)buffer, len);
+}
+
+// All cars are polled in every interval, not one car per interval
+void TestStationDaemon::pollsCarsTogether()
+{
+    StateCollector rx;
+    connect(mDaemon->packetInterface(), SIGNAL(stateReceived(quint8,CAR_STATE)),
+            &rx, SLOT(stateReceived(quint8,CAR_STATE)));
+    mCar->answerIds << 1 << 2 << 3;
+    mDaemon->addCar(1);
+    mDaemon->addCar(2);
+    mDaemon->addCar(3);
+    mDaemon->setPollInterval(20);
+
+    QTRY_VERIFY(mCar->stateReq[3] >= 10);
+    QVERIFY(qAbs(mCar->stateReq[1] - mCar->stateReq[3]) <= 1);
+    QVERIFY(qAbs(mCar->stateReq[2] - mCar->stateReq[3]) <= 1);
+    QTRY_VERIFY(rx.ids.size() >= 27);
+
+    for (int i = 0;i < rx.ids.size();i++) {
+        quint8 id = rx.ids.at(i);
+        QVERIFY(id >= 1 && id <= 3);
+        QVERIFY(fabs(rx.states.at(i).px - (double)id) < 1e-3);
+        QCOMPARE(rx.states.at(i).ms_today, 1000 * (int32_t)id);
+    }
+
+    QVERIFY(rx.ids.contains(1) && rx.ids.contains(2) && rx.ids.contains(3));
+}
+
+// A car that does not answer is polled again after the timeout only
+void TestStationDaemon::silentCarNotFlooded()
+{
+    mCar->answerIds << 1;
+    mDaemon->addCar(1);
+    mDaemon->addCar(4);
+    mDaemon->setPollInterval(20);
+
+    QTest::qWait(500);
+
+    // 5 intervals timeout
+    QVERIFY(mCar->stateReq[1] >= 15);
+    QVERIFY(mCar->stateReq[4] >= 2);
+    QVERIFY(mCar->stateReq[4] <= 6);
+}
+
+// RTCM from a source is sent to all cars in whole epochs, the reference
+// position first
+void TestStationDaemon::rtcmForwarded()
+{
+    RtcmSourceManager *sources = mDaemon->rtcmSources();
+    int src = sources->addSource("test", RtcmSourceManager::RTCM_SOURCE_TCP);
+
+    QByteArray ref = rtcmRef(3, 57.71, 12.89, 220.0);
+    sources->rtcmInput(src, ref + rtcmObs(3, 1000));
+    QTRY_COMPARE(sources->activeSource(), src);
+
+    QByteArray obs = rtcmObs(3, 2000);
+
+    // Frames split between reads
+    sources->rtcmInput(src, obs.left(10));
+    sources->rtcmInput(src, obs.mid(10));
+
+    QTRY_VERIFY(mCar->rtcm.contains(obs));
+    QVERIFY(mCar->rtcm.startsWith(ref));
+}
+
+// The local base station is added last and only used when the other
+// sources fail
+void TestStationDaemon::baseStationFallback()
+{
+    RtcmSourceManager *sources = mDaemon->rtcmSources();
+    sources->setMaxObsAge(300);
+    int src = sources->addSource("test", RtcmSourceManager::RTCM_SOURCE_TCP);
+    UbloxBase *base = mDaemon->addBaseStation("base");
+
+    QByteArray refBase = rtcmRef(7, 57.72, 12.88, 215.0);
+    int towMs = 1000;
+
+    sources->rtcmInput(src, rtcmRef(3, 57.71, 12.89, 220.0) + rtcmObs(3, towMs));
+    emit base->rtcmOut(rtcmObs(7, towMs) + refBase);
+    QTRY_COMPARE(sources->activeSource(), src);
+
+    // The test source stops
+    QByteArray obs;
+    QElapsedTimer timer;
+    timer.start();
+
+    while (timer.elapsed() < 2000 && sources->activeSource() == src) {
+        towMs += 100;
+        obs = rtcmObs(7, towMs);
+        emit base->rtcmOut(obs + refBase);
+        QTest::qWait(50);
+    }
+
+    QCOMPARE(sources->sourceName(sources->activeSource()), QString("base"));
+
+    towMs += 100;
+    obs = rtcmObs(7, towMs);
+    emit base->rtcmOut(obs);
+
+    QTRY_VERIFY(mCar->rtcm.contains(obs));
+    QVERIFY(mCar->rtcm.contains(refBase));
+}
+
+// A script subscribes with NET_SUB_POLL on the local socket and gets the
+// states of its car, which the daemon then polls as well
+void TestStationDaemon::apiLocalSocket()
+{
+    QVERIFY(mDaemon->startApi(apiName));
+    mCar->answerIds << 7;
+    mDaemon->setPollInterval(20);
+
+    LocalApiClient client(apiName);
+    QVERIFY(client.mSocket.state() == QLocalSocket::ConnectedState);
+    client.send(NetProtocol::encodeSubscribe(NET_SUB_POLL, 0, QVector<quint8>() << 7));
+
+    QTRY_VERIFY(client.count(NET_MSG_STATE) > 0);
+
+    QByteArray stateMsg;
+    for (QByteArray m: client.rx) {
+        if ((NET_MSG)m.at(0) == NET_MSG_STATE) {
+            stateMsg = m;
+        }
+    }
+
+    quint8 id;
+    CAR_STATE state;
+    QVERIFY(NetProtocol::decodeState(stateMsg, id, state));
+    QCOMPARE(id, (quint8)7);
+    QVERIFY(fabs(state.px - 7.0) < 1e-3);
+    QVERIFY(fabs(state.py + 7.0) < 1e-3);
+    QCOMPARE(mCar->stateReq[8], 0);
+}
+
+QTEST_GUILESS_MAIN(TestStationDaemon)
+
+#include "tst_stationdaemon.moc"
@@ -0,0 +1,51 @@
+QT       += core gui network serialport testlib
+
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_stationdaemon
+TEMPLATE = app
+
+# The daemon talks to the TCP server of Car_Client
+INCLUDEPATH += ../.. ../../../RControlStation
+
+SOURCES += tst_stationdaemon.cpp \
+    ../../stationdaemon.cpp \
+    ../../../Car_Client/tcpserversimple.cpp \
+    ../../../RControlStation/packetinterface.cpp \
+    ../../../RControlStation/utility.cpp \
+    ../../../RControlStation/locpoint.cpp \
+    ../../../RControlStation/packet.cpp \
+    ../../../RControlStation/rtcmclient.cpp \
+    ../../../RControlStation/rtcmsourcemanager.cpp \
+    ../../../RControlStation/rtcm3_simple.c \
+    ../../../RControlStation/mainconfigcodec.cpp \
+    ../../../RControlStation/netprotocol.cpp \
+    ../../../RControlStation/netapi.cpp \
+    ../../../RControlStation/netapiclient.cpp \
+    ../../../RControlStation/ubloxbase.cpp \
+    ../../../RControlStation/ublox.cpp \
+    ../../../RControlStation/nmeaserver.cpp \
+    ../../../RControlStation/tcpbroadcast.cpp \
+    ../../../RControlStation/obsmonitor.cpp \
+    ../../../RControlStation/surveyin.cpp
+
+HEADERS += ../../stationdaemon.h \
+    ../../../Car_Client/tcpserversimple.h \
+    ../../../RControlStation/packetinterface.h \
+    ../../../RControlStation/utility.h \
+    ../../../RControlStation/locpoint.h \
+    ../../../RControlStation/packet.h \
+    ../../../RControlStation/rtcmclient.h \
+    ../../../RControlStation/rtcmsourcemanager.h \
+    ../../../RControlStation/rtcm3_simple.h \
+    ../../../RControlStation/mainconfigcodec.h \
+    ../../../RControlStation/netprotocol.h \
+    ../../../RControlStation/netapi.h \
+    ../../../RControlStation/netapiclient.h \
+    ../../../RControlStation/ubloxbase.h \
+    ../../../RControlStation/ublox.h \
+    ../../../RControlStation/nmeaserver.h \
+    ../../../RControlStation/tcpbroadcast.h \
+    ../../../RControlStation/obsmonitor.h \
+    ../../../RControlStation/surveyin.h